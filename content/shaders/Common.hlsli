@@ -28,6 +28,7 @@ cbuffer ObjectCBuffer : register(b1)
     float CustomAlphaDiscard;
     uint OriginalInstanceCount;
     uint RenderingObjectFlags;
+    uint IndirectFirstInstance; // of the object's culled instances (GPU indirect draw)
 };
 
 struct QUAD_VS_IN
@@ -0,0 +1,19 @@
+// Compact (32 bytes) per-instance data, decoded into a world matrix in the vertex shader.
+// Keep in sync with InstancedDataCompact and ER_CompactInstanceData::Decode() in ER_CompactInstanceData.h/.cpp!
+//
+// - INSTANCE_POSITION: translation (float3)
+// - INSTANCE_COLOR: packed RGBA8 color or user id (not used by the world matrix)
+// - INSTANCE_ROTATION: quaternion (xyzw), [-1, 1] stored as UNORM16 in [0, 65534] (so that 0 is exact)
+// - INSTANCE_SCALE: half precision scale (xyz)
+
+float4x4 DecodeCompactInstanceWorld(float3 position, float4 rotation, float3 scale)
+{
+    float4 q = normalize(rotation * (2.0f * 65535.0f / 65534.0f) - 1.0f);
+
+    float4x4 world;
+    world[0] = float4(scale.x * float3(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.z * q.w), 2.0f * (q.x * q.z - q.y * q.w)), 0.0f);
+    world[1] = float4(scale.y * float3(2.0f * (q.x * q.y - q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.x * q.w)), 0.0f);
+    world[2] = float4(scale.z * float3(2.0f * (q.x * q.z + q.y * q.w), 2.0f * (q.y * q.z - q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y)), 0.0f);
+    world[3] = float4(position, 1.0f);
+    return world;
+}
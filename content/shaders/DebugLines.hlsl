@@ -0,0 +1,48 @@
+// ================================================================================================
+// Vertex/Pixel shader for batched debug lines (AABBs, frustums, spheres, etc.).
+// One instance per line, its 2 vertices are fetched from a structured buffer by SV_VertexID.
+//
+// Written by Gen Afanasev for 'EveryRay Rendering Engine', 2017-2022
+// ================================================================================================
+
+struct DebugLine
+{
+    float3 Start;
+    uint Color; // RGBA8, R in the lowest byte
+    float3 End;
+    uint Pad;
+};
+
+StructuredBuffer<DebugLine> Lines : register(t0);
+
+cbuffer DebugLinesCBuffer : register (b0)
+{
+    float4x4 ViewProjection;
+}
+
+struct VS_OUTPUT
+{
+    float4 Position : SV_Position;
+    float4 Color : COLOR;
+};
+
+float4 UnpackColor(uint packedColor)
+{
+    return float4(packedColor & 0xFF, (packedColor >> 8) & 0xFF, (packedColor >> 16) & 0xFF, (packedColor >> 24) & 0xFF) / 255.0;
+}
+
+VS_OUTPUT VSMain(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+    VS_OUTPUT OUT = (VS_OUTPUT) 0;
+
+    DebugLine debugLine = Lines[instanceID];
+    float3 position = (vertexID == 0) ? debugLine.Start : debugLine.End;
+    OUT.Position = mul(float4(position, 1.0), ViewProjection);
+    OUT.Color = UnpackColor(debugLine.Color);
+    return OUT;
+}
+
+float4 PSMain(VS_OUTPUT IN) : SV_Target
+{
+    return IN.Color;
+}
@@ -1,4 +1,5 @@
 #include "Common.hlsli"
+#include "CompactInstanceData.hlsli"
 
 cbuffer FoliageCBuffer : register(b0)
 {
@@ -41,6 +42,18 @@ struct VS_INPUT
     row_major float4x4 World : WORLD;
 };
 
+struct VS_INPUT_COMPACT
+{
+    float4 Position : POSITION;
+    float2 TextureCoordinates : TEXCOORD0;
+    float3 Normal : NORMAL;
+    
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+};
+
 struct VS_OUTPUT
 {
     float4 Position : SV_Position;
@@ -184,6 +197,17 @@ VS_OUTPUT VSMain(VS_INPUT IN)
     return OUT;
 }
 
+// Same as VSMain() but with compact instance data (see CompactInstanceData.hlsli)
+VS_OUTPUT VSMain_compact(VS_INPUT_COMPACT IN)
+{
+    VS_INPUT instanceIN;
+    instanceIN.Position = IN.Position;
+    instanceIN.TextureCoordinates = IN.TextureCoordinates;
+    instanceIN.Normal = IN.Normal;
+    instanceIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain(instanceIN);
+}
+
 float CalculateShadow(float3 ShadowCoord, int index)
 {
     const float Dilation = 2.0;
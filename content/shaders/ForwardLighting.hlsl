@@ -21,6 +21,7 @@
 #include "Lighting.hlsli"
 #include "IndirectCulling.hlsli"
 #include "Common.hlsli"
+#include "CompactInstanceData.hlsli"
 
 Texture2D<float4> AlbedoTexture : register(t0);
 Texture2D<float4> NormalTexture : register(t1);
@@ -82,6 +83,21 @@ struct VS_INPUT_INSTANCING
     uint InstanceID : SV_InstanceID;
 };
 
+struct VS_INPUT_INSTANCING_COMPACT
+{
+    float4 Position : POSITION;
+    float2 Texcoord0 : TEXCOORD;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+    
+    //instancing (compact)
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+    uint InstanceID : SV_InstanceID;
+};
+
 struct VS_OUTPUT
 {
     float4 Position : SV_Position;
@@ -143,7 +159,7 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     VS_OUTPUT OUT = (VS_OUTPUT) 0;
 
     float4x4 World = (RenderingObjectFlags & RENDERING_OBJECT_FLAG_GPU_INDIRECT_DRAW) ?
-        transpose(IndirectInstanceData[(int)OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
+        transpose(IndirectInstanceData[IndirectFirstInstance + OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
 
     OUT.WorldPos = mul(IN.Position, World).xyz;
     OUT.Position = mul(float4(OUT.WorldPos, 1.0f), ViewProjection);
@@ -179,6 +195,19 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     return OUT;
 }
 
+// Same as VSMain_instancing() but with compact instance data (see CompactInstanceData.hlsli)
+VS_OUTPUT VSMain_instancing_compact(VS_INPUT_INSTANCING_COMPACT IN)
+{
+    VS_INPUT_INSTANCING instancingIN;
+    instancingIN.Position = IN.Position;
+    instancingIN.Texcoord0 = IN.Texcoord0;
+    instancingIN.Normal = IN.Normal;
+    instancingIN.Tangent = IN.Tangent;
+    instancingIN.InstanceID = IN.InstanceID;
+    instancingIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain_instancing(instancingIN);
+}
+
 // ================================================================================================
 // Parallax-Occlusion Mapping (with soft self-shadowing)
 // ================================================================================================
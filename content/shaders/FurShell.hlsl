@@ -5,6 +5,7 @@
 // ================================================================================================
 #include "Lighting.hlsli"
 #include "Common.hlsli"
+#include "CompactInstanceData.hlsli"
 
 Texture2D<float4> FurAlbedoTexture : register(t0);
 Texture2D<float> FurHeightTexture : register(t1);
@@ -48,6 +49,20 @@ struct VS_INPUT_INSTANCING
     row_major float4x4 World : WORLD;
 };
 
+struct VS_INPUT_INSTANCING_COMPACT
+{
+    float4 Position : POSITION;
+    float2 Texcoord0 : TEXCOORD;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+
+    //instancing (compact)
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+};
+
 struct VS_OUTPUT
 {
     float4 Position : SV_Position;
@@ -100,6 +115,18 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
 
     return OUT;
 }
+
+// Same as VSMain_instancing() but with compact instance data (see CompactInstanceData.hlsli)
+VS_OUTPUT VSMain_instancing_compact(VS_INPUT_INSTANCING_COMPACT IN)
+{
+    VS_INPUT_INSTANCING instancingIN;
+    instancingIN.Position = IN.Position;
+    instancingIN.Texcoord0 = IN.Texcoord0;
+    instancingIN.Normal = IN.Normal;
+    instancingIN.Tangent = IN.Tangent;
+    instancingIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain_instancing(instancingIN);
+}
 float4 PSMain(VS_OUTPUT vsOutput) : SV_Target
 {
     float2 texCoord = vsOutput.UV * FurMultiplierUVScale.y;
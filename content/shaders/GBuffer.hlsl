@@ -8,6 +8,7 @@
 // ================================================================================================
 #include "IndirectCulling.hlsli"
 #include "Common.hlsli"
+#include "CompactInstanceData.hlsli"
 
 Texture2D<float4> AlbedoMap : register(t0);
 Texture2D<float4> NormalMap : register(t1);
@@ -52,6 +53,21 @@ struct VS_INPUT_INSTANCING
     uint InstanceID : SV_InstanceID;
 };
 
+struct VS_INPUT_INSTANCING_COMPACT
+{
+    float4 ObjectPosition : POSITION;
+    float2 TextureCoordinate : TEXCOORD;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+    
+    //instancing (compact)
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+    uint InstanceID : SV_InstanceID;
+};
+
 struct VS_OUTPUT
 {
     float4 Position : SV_Position;
@@ -78,7 +94,7 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     VS_OUTPUT OUT = (VS_OUTPUT) 0;
     
     float4x4 World = (RenderingObjectFlags & RENDERING_OBJECT_FLAG_GPU_INDIRECT_DRAW) ?
-        transpose(IndirectInstanceData[(int)OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
+        transpose(IndirectInstanceData[IndirectFirstInstance + OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
     OUT.WorldPos = mul(IN.ObjectPosition, World).xyz;
     OUT.Position = mul(float4(OUT.WorldPos, 1.0f), ViewProjection);
     OUT.Normal = normalize(mul(float4(IN.Normal, 0), World).xyz);
@@ -88,6 +104,19 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     return OUT;
 }
 
+// Same as VSMain_instancing() but with compact instance data (see CompactInstanceData.hlsli)
+VS_OUTPUT VSMain_instancing_compact(VS_INPUT_INSTANCING_COMPACT IN)
+{
+    VS_INPUT_INSTANCING instancingIN;
+    instancingIN.ObjectPosition = IN.ObjectPosition;
+    instancingIN.TextureCoordinate = IN.TextureCoordinate;
+    instancingIN.Normal = IN.Normal;
+    instancingIN.Tangent = IN.Tangent;
+    instancingIN.InstanceID = IN.InstanceID;
+    instancingIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain_instancing(instancingIN);
+}
+
 struct PS_OUTPUT
 {
     float4 Color : SV_Target0;
@@ -0,0 +1,100 @@
+// Generates DrawIndexedInstancedIndirect() args from the base args of the draws and their instance counts (see ER_IndirectArgs).
+// CPU reference: ER_IndirectArgs::GenerateDrawArgsGroupScan() (keep both in sync)
+
+#define GROUP_SIZE 256 // ER_INDIRECT_ARGS_GENERATION_GROUP_SIZE
+#define ARGS_COUNT 5 // ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT
+
+cbuffer ArgsGenerationConstants : register(b0)
+{
+	uint DrawsCount;
+	uint IsCompacted;
+	uint DispatchGroupSize;
+	uint DrawsPerInstanceCount; // consecutive draws sharing a count (i.e. meshes of the same LOD)
+};
+
+StructuredBuffer<uint4> baseArgs : register(t0); // IndexCount, StartIndexLoc, BaseVtxLoc, StartInstLoc
+Buffer<uint> instanceCounts : register(t1); // DrawsCount / DrawsPerInstanceCount
+RWBuffer<uint> argsBuffer : register(u0); // DrawsCount * 5
+RWBuffer<uint> countBuffer : register(u1); // draws count, dispatch args over the visible instances (3)
+
+groupshared uint gsScan[2][GROUP_SIZE];
+groupshared uint gsInstancesCount;
+
+// One group loops over the draws in chunks: compacted slots are the exclusive prefix sum of the visibility
+[numthreads(GROUP_SIZE, 1, 1)]
+void CSMain(uint3 GTid : SV_GroupThreadID)
+{
+	uint thread = GTid.x;
+	if (thread == 0)
+		gsInstancesCount = 0;
+
+	uint visibleOffset = 0; // visible draws in the previous chunks
+	GroupMemoryBarrierWithGroupSync();
+
+	[loop]
+	for (uint chunk = 0; chunk < DrawsCount; chunk += GROUP_SIZE)
+	{
+		uint draw = chunk + thread;
+		uint count = (draw < DrawsCount) ? instanceCounts[draw / DrawsPerInstanceCount] : 0;
+		uint visible = (count > 0) ? 1 : 0;
+
+		// Hillis-Steele inclusive scan (only needed for the compacted slots, uniform branch)
+		gsScan[0][thread] = visible;
+		GroupMemoryBarrierWithGroupSync();
+
+		uint src = 0;
+		if (IsCompacted)
+		{
+			[unroll]
+			for (uint stride = 1; stride < GROUP_SIZE; stride <<= 1)
+			{
+				uint value = gsScan[src][thread];
+				if (thread >= stride)
+					value += gsScan[src][thread - stride];
+				gsScan[1 - src][thread] = value;
+				src = 1 - src;
+				GroupMemoryBarrierWithGroupSync();
+			}
+		}
+
+		if (draw < DrawsCount)
+		{
+			if (count > 0)
+				InterlockedAdd(gsInstancesCount, count);
+
+			uint slot = IsCompacted ? visibleOffset + gsScan[src][thread] - visible : draw;
+			if (!IsCompacted || visible)
+			{
+				uint4 base = baseArgs[draw];
+				argsBuffer[slot * ARGS_COUNT + 0] = base.x;
+				argsBuffer[slot * ARGS_COUNT + 1] = count;
+				argsBuffer[slot * ARGS_COUNT + 2] = base.y;
+				argsBuffer[slot * ARGS_COUNT + 3] = base.z;
+				argsBuffer[slot * ARGS_COUNT + 4] = base.w;
+			}
+		}
+		if (IsCompacted)
+			visibleOffset += gsScan[src][GROUP_SIZE - 1];
+
+		// the next chunk overwrites the scan
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// empty draws in the tail (valid args for a multi-draw without the count buffer)
+	if (IsCompacted)
+	{
+		for (uint draw = visibleOffset + thread; draw < DrawsCount; draw += GROUP_SIZE)
+		{
+			for (uint arg = 0; arg < ARGS_COUNT; arg++)
+				argsBuffer[draw * ARGS_COUNT + arg] = 0;
+		}
+	}
+
+	if (thread == 0)
+	{
+		countBuffer[0] = IsCompacted ? visibleOffset : DrawsCount;
+		countBuffer[1] = (gsInstancesCount + DispatchGroupSize - 1) / DispatchGroupSize;
+		countBuffer[2] = 1;
+		countBuffer[3] = 1;
+	}
+}
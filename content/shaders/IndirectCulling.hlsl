@@ -1,22 +1,11 @@
+// Instances of all objects in one dispatch (CPU reference: ER_GPUCuller::CullInstances(), keep both in sync)
 #include "IndirectCulling.hlsli"
 
-cbuffer MeshConstants : register(b0)
-{
-	uint4 IndexCount_StartIndexLoc_BaseVtxLoc_StartInstLoc[MAX_LOD_COUNT * MAX_MESH_COUNT];
-	uint OriginalInstancesCount;
-    uint3 pad;
-};
-
-cbuffer CameraConstants : register(b1)
-{
-	float4 FrustumPlanes[6];
-	float4 LODCameraSqrDistances;
-	float4 CameraPos;
-};
-
-StructuredBuffer<Instance> instanceData : register(t0);
-RWStructuredBuffer<Instance> newInstanceData : register(u0); // OriginalInstancesCount * MAX_LOD_COUNT
-RWBuffer<uint> argsBuffer : register(u1); // MAX_LOD_COUNT * MAX_MESH_COUNT * 5
+StructuredBuffer<Instance> instanceData : register(t0); // InstancesCount
+Buffer<uint> instanceObjects : register(t1); // InstancesCount
+StructuredBuffer<CulledObject> objects : register(t2);
+RWStructuredBuffer<Instance> newInstanceData : register(u0); // InstancesCount * MAX_LOD_COUNT
+RWBuffer<uint> instanceCounts : register(u1); // CountersCount (args are generated from them in IndirectArgsGeneration.hlsl)
 
 bool PerformFrustumCull(float4 aabbMin, float4 aabbMax)
 {
@@ -83,7 +72,7 @@ int CalculateLodIndex(float4x4 worldMat)
 void CSMain(int3 DTid : SV_DispatchThreadID)
 {
 	int index = DTid.x;
-	if (index >= OriginalInstancesCount)
+	if (index >= (int)InstancesCount)
 		return;
 
 	Instance data = instanceData[index];
@@ -92,18 +81,14 @@ void CSMain(int3 DTid : SV_DispatchThreadID)
 	if (!isCulled)
 	{
 		int lod = CalculateLodIndex(data.WorldMat);
-		if (lod == -1)
+		uint objectIndex = instanceObjects[index];
+		CulledObject object = objects[objectIndex];
+		if (lod == -1 || lod >= (int)object.LODsCount)
 			return;
 
-		// we just need to copy the counters for all meshes in that lod
-		for (int mesh = 0; mesh < MAX_MESH_COUNT; mesh++)
-		{
-			uint offset = MAX_MESH_COUNT * lod + mesh;
-
-			uint outIndex;
-			InterlockedAdd(argsBuffer[offset * 5 + 1], 1, outIndex);
-			if (mesh == 0)
-				newInstanceData[OriginalInstancesCount * lod + outIndex] = data;
-		}
+		// one counter for all meshes of the lod
+		uint outIndex;
+		InterlockedAdd(instanceCounts[objectIndex * MAX_LOD_COUNT + lod], 1, outIndex);
+		newInstanceData[object.FirstInstance * MAX_LOD_COUNT + object.InstancesCount * lod + outIndex] = data;
 	}
 }
\ No newline at end of file
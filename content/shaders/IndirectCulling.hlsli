@@ -7,4 +7,22 @@ struct Instance
 	float4x4 WorldMat;
 	float4 AABBmin;
 	float4 AABBmax;
-};
\ No newline at end of file
+};
+// Range of an object in the shared buffers (ER_GPUCullerObject)
+struct CulledObject
+{
+	uint FirstInstance;
+	uint InstancesCount;
+	uint LODsCount;
+	uint pad;
+};
+
+cbuffer CullingConstants : register(b0)
+{
+	float4 FrustumPlanes[6];
+	float4 LODCameraSqrDistances;
+	float4 CameraPos;
+	uint InstancesCount; // of all objects
+	uint CountersCount; // objects * MAX_LOD_COUNT
+	uint2 pad;
+};
@@ -9,6 +9,7 @@
 
 #include "IndirectCulling.hlsli"
 #include "Common.hlsli"
+#include "CompactInstanceData.hlsli"
 
 cbuffer ShadowMapCBuffer : register(b0)
 {
@@ -42,6 +43,21 @@ struct VS_INPUT_INSTANCING
     uint InstanceID : SV_InstanceID;
 };
 
+struct VS_INPUT_INSTANCING_COMPACT
+{
+    float4 Position : POSITION;
+    float2 TextureCoordinate : TEXCOORD;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+    
+    //instancing (compact)
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+    uint InstanceID : SV_InstanceID;
+};
+
 struct VS_OUTPUT
 {
     float4 Position : SV_Position;
@@ -69,7 +85,7 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     VS_OUTPUT OUT = (VS_OUTPUT) 0;
 
     float4x4 World = (RenderingObjectFlags & RENDERING_OBJECT_FLAG_GPU_INDIRECT_DRAW) ?
-        transpose(IndirectInstanceData[(int)OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
+        transpose(IndirectInstanceData[IndirectFirstInstance + OriginalInstanceCount * CurrentLod + IN.InstanceID].WorldMat) : IN.World;
     float3 WorldPos = mul(IN.Position, World).xyz;
     OUT.Position = mul(float4(WorldPos, 1.0f), LightViewProjection);
     OUT.Depth = OUT.Position.zw;
@@ -78,6 +94,19 @@ VS_OUTPUT VSMain_instancing(VS_INPUT_INSTANCING IN)
     return OUT;
 }
 
+// Same as VSMain_instancing() but with compact instance data (see CompactInstanceData.hlsli)
+VS_OUTPUT VSMain_instancing_compact(VS_INPUT_INSTANCING_COMPACT IN)
+{
+    VS_INPUT_INSTANCING instancingIN;
+    instancingIN.Position = IN.Position;
+    instancingIN.TextureCoordinate = IN.TextureCoordinate;
+    instancingIN.Normal = IN.Normal;
+    instancingIN.Tangent = IN.Tangent;
+    instancingIN.InstanceID = IN.InstanceID;
+    instancingIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain_instancing(instancingIN);
+}
+
 float4 PSMain(VS_OUTPUT IN) : SV_Target
 {
     float alphaValue = AlbedoTexture.Sample(Sampler, IN.TextureCoordinate).a;
@@ -5,6 +5,7 @@
 // - Cascaded Shadow Mapping
 // - PBR with Image Based Lighting (via global light probes)
 // - dynamic GPU tessellation
+// - CDLOD (quadtree LOD selection on CPU + vertex morphing in domain shader)
 //
 // TODO:
 // - move to "Forward+"
@@ -38,6 +39,8 @@ cbuffer TerrainDataCBuffer : register(b0)
     float TessellationFactorDynamic;
     float DistanceFactor;
     float TileSize;
+    float UseCDLOD;
+    float CDLODGridResolution;
 };
 
 cbuffer TerrainShadowDataCBuffer : register(b1)
@@ -49,12 +52,14 @@ struct VS_INPUT_TS
 {
     float4 PatchInfo : PATCH_INFO;
     float TileIndex : TILE_INDEX;
+    float3 LODInfo : LOD_INFO; // x - LOD level, y - morph start, z - morph end
 };
 
 struct HS_INPUT
 {
     float4 PatchInfo : PATCH_INFO;
     float4 TileIndex : TILE_INDEX; //this fixes a dx compiler bug (error X8000)
+    float4 LODInfo : LOD_INFO;
 };
 
 struct HS_OUTPUT
@@ -81,6 +86,7 @@ struct PatchData
     float2 origin : ORIGIN;
     float2 size : SIZE;
     float TileIndex : TILE_INDEX;
+    float3 LODInfo : LOD_INFO;
 };
 
 SamplerState LinearSampler : register(s0);
@@ -104,6 +110,7 @@ HS_INPUT VSMain(VS_INPUT_TS IN)
 	
     OUT.PatchInfo = IN.PatchInfo;
     OUT.TileIndex = float4(IN.TileIndex, 0.0f, 0.0f, 0.0f);
+    OUT.LODInfo = float4(IN.LODInfo, 0.0f);
     return OUT;
 }
 
@@ -130,6 +137,20 @@ float3 GetNormalFromHeightmap(float2 uv, float texelSize, float maxHeight)
     return normalize(n);
 }
 
+// CDLOD morphing (https://github.com/fstrugar/CDLOD): in the end of the patch's LOD range, odd grid vertices are moved onto their even neighbours,
+// so that the patch smoothly turns into the grid of its parent (coarser) LOD and there are no cracks between the patches of different LODs
+float2 GetMorphedUV_CDLOD(PatchData input, float2 uv)
+{
+    float2 localPos = input.origin + uv * input.size;
+    float height = TerrainHeightScale * HeightTexture.SampleLevel(LinearSamplerClamp, localPos / TileSize, 0).r;
+    float3 worldPos = mul(float4(localPos.x, height, localPos.y, 1.0), TerrainTileWorld[(int)input.TileIndex]).xyz;
+    
+    float morphK = saturate((distance(worldPos, CameraPosition.xyz) - input.LODInfo.y) / (input.LODInfo.z - input.LODInfo.y));
+    float2 gridPos = round(uv * CDLODGridResolution);
+    gridPos -= frac(gridPos * 0.5) * 2.0 * morphK;
+    return gridPos / CDLODGridResolution;
+}
+
 PatchData hull_constant_function(InputPatch<HS_INPUT, 1> inputPatch)
 {
     PatchData output;
@@ -145,6 +166,15 @@ PatchData hull_constant_function(InputPatch<HS_INPUT, 1> inputPatch)
     output.origin = origin;
     output.size = size;
     output.TileIndex = inputPatch[0].TileIndex;
+    output.LODInfo = inputPatch[0].LODInfo.xyz;
+    
+    // CDLOD: every patch gets the same grid, LOD comes from the patch size (selected on CPU)
+    if (UseCDLOD > 0.0f)
+    {
+        output.Edges[0] = output.Edges[1] = output.Edges[2] = output.Edges[3] = CDLODGridResolution;
+        output.Inside[0] = output.Inside[1] = CDLODGridResolution;
+        return output;
+    }
     
     float4 pos = float4(origin.x, 0.0f, origin.y, 1.0f);
     pos = mul(pos, TerrainTileWorld[(int)(output.TileIndex)]);
@@ -184,12 +214,26 @@ HS_OUTPUT HSMain(InputPatch<HS_INPUT, 1> inputPatch)
     return (HS_OUTPUT)0;
 }
 
+// integer partitioning, so that the domain locations match the CDLOD grid exactly
+[domain("quad")]
+[partitioning("integer")]
+[outputtopology("triangle_cw")]
+[outputcontrolpoints(1)]
+[patchconstantfunc("hull_constant_function")]
+HS_OUTPUT HSMain_CDLOD(InputPatch<HS_INPUT, 1> inputPatch)
+{
+    return (HS_OUTPUT)0;
+}
+
 [domain("quad")]
 DS_OUTPUT DSMain(PatchData input, float2 uv : SV_DomainLocation, OutputPatch<HS_OUTPUT, 1> inputPatch)
 {
     DS_OUTPUT output;
     float3 vertexPosition;
     
+    if (UseCDLOD > 0.0f)
+        uv = GetMorphedUV_CDLOD(input, uv);
+    
     float2 texcoord01 = (input.origin + uv * input.size) / TileSize;
     float height = HeightTexture.SampleLevel(LinearSamplerClamp, texcoord01, 0).r;
 	
@@ -227,6 +271,9 @@ DS_OUTPUT DSShadowMap(PatchData input, float2 uv : SV_DomainLocation, OutputPatc
     DS_OUTPUT output;
     float3 vertexPosition;
     
+    if (UseCDLOD > 0.0f)
+        uv = GetMorphedUV_CDLOD(input, uv);
+    
     float2 texcoord01 = (input.origin + uv * input.size) / TileSize;
     float height = HeightTexture.SampleLevel(LinearSamplerClamp, texcoord01, 0).r;
 	
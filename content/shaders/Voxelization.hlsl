@@ -12,6 +12,8 @@
 // Written by Gen Afanasev for 'EveryRay Rendering Engine', 2017-2022
 // ================================================================================================
 
+#include "CompactInstanceData.hlsli"
+
 cbuffer VoxelizationCB : register(b0)
 {
     float4x4 World;
@@ -51,6 +53,20 @@ struct VS_IN_INSTANCING
     row_major float4x4 World : WORLD;
 };
 
+struct VS_IN_INSTANCING_COMPACT
+{
+    float4 Position : POSITION;
+    float2 UV : TEXCOORD;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+    
+    //instancing (compact)
+    float3 InstancePosition : INSTANCE_POSITION;
+    float4 InstanceColor : INSTANCE_COLOR;
+    float4 InstanceRotation : INSTANCE_ROTATION;
+    float4 InstanceScale : INSTANCE_SCALE;
+};
+
 struct GS_IN
 {
     float4 Position : SV_POSITION;
@@ -91,6 +107,18 @@ GS_IN VSMain_instancing(VS_IN_INSTANCING input)
     return output;
 }
 
+// Same as VSMain_instancing() but with compact instance data (see CompactInstanceData.hlsli)
+GS_IN VSMain_instancing_compact(VS_IN_INSTANCING_COMPACT IN)
+{
+    VS_IN_INSTANCING instancingIN;
+    instancingIN.Position = IN.Position;
+    instancingIN.UV = IN.UV;
+    instancingIN.Normal = IN.Normal;
+    instancingIN.Tangent = IN.Tangent;
+    instancingIN.World = DecodeCompactInstanceWorld(IN.InstancePosition, IN.InstanceRotation, IN.InstanceScale.xyz);
+    return VSMain_instancing(instancingIN);
+}
+
 [maxvertexcount(3)]
 void GSMain(triangle GS_IN input[3], inout TriangleStream<PS_IN> OutputStream)
 {
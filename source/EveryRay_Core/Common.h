@@ -88,6 +88,7 @@ using namespace DirectX;
 #define NUM_SHADOW_CASCADES 3
 #define MAX_LOD 3
 #define MAX_MESH_COUNT 32 // should match with IndirectCulling.hlsli
+#define ER_HASH_SEED 14695981039346656037ULL // FNV-1a offset basis
 
 template <typename T>
 inline T ER_DivideByMultiple(T value, unsigned int alignment) {	return (T)((value + alignment - 1) / alignment); }
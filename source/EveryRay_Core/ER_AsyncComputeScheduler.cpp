@@ -0,0 +1,583 @@
+#include "stdafx.h"
+
+#include "ER_AsyncComputeScheduler.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	static const float SimulationEpsilon = 0.0001f;
+
+	static const char* GetReleaseStateName(ER_RHI_RESOURCE_STATE aState)
+	{
+		switch (aState)
+		{
+		case ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS:
+			return "UAV";
+		case ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE:
+			return "non-pixel SRV";
+		default:
+			return "other";
+		}
+	}
+
+	ER_AsyncComputeScheduler::ER_AsyncComputeScheduler()
+	{
+	}
+
+	ER_AsyncComputeScheduler::~ER_AsyncComputeScheduler()
+	{
+	}
+
+	void ER_AsyncComputeScheduler::Clear()
+	{
+		mResources.clear();
+		mPasses.clear();
+		mFrameBeginReleases.clear();
+		mFrameEndWaitForPass = -1;
+		mSerializedTimeMs = 0.0f;
+		mAsyncTimeMs = 0.0f;
+	}
+
+	int ER_AsyncComputeScheduler::AddResource(const std::string& aName, ER_RHI_GPUResource* aResource)
+	{
+		mResources.push_back(std::make_pair(aName, aResource));
+		return static_cast<int>(mResources.size()) - 1;
+	}
+
+	int ER_AsyncComputeScheduler::AddPass(const std::string& aName, ER_AsyncComputePassType aType, float aEstimatedCostMs, const std::vector<int>& aReads, const std::vector<int>& aWrites)
+	{
+		ER_AsyncComputePass pass;
+		pass.Name = aName;
+		pass.Type = aType;
+		pass.EstimatedCostMs = aEstimatedCostMs;
+		pass.Reads = aReads;
+		pass.Writes = aWrites;
+		mPasses.push_back(pass);
+		return static_cast<int>(mPasses.size()) - 1;
+	}
+
+	bool ER_AsyncComputeScheduler::AccessesResource(int aPass, int aResource) const
+	{
+		const ER_AsyncComputePass& pass = mPasses[aPass];
+		return std::find(pass.Reads.begin(), pass.Reads.end(), aResource) != pass.Reads.end() || WritesResource(aPass, aResource);
+	}
+
+	bool ER_AsyncComputeScheduler::WritesResource(int aPass, int aResource) const
+	{
+		const ER_AsyncComputePass& pass = mPasses[aPass];
+		return std::find(pass.Writes.begin(), pass.Writes.end(), aResource) != pass.Writes.end();
+	}
+
+	void ER_AsyncComputeScheduler::AddRelease(std::vector<ER_AsyncComputeRelease>& aReleases, int aResource, ER_RHI_RESOURCE_STATE aState)
+	{
+		for (auto& release : aReleases)
+		{
+			if (release.Resource == aResource)
+				return;
+		}
+
+		ER_AsyncComputeRelease release;
+		release.Resource = aResource;
+		release.State = aState;
+		aReleases.push_back(release);
+	}
+
+	void ER_AsyncComputeScheduler::Schedule(bool aUseComputeQueue)
+	{
+		for (auto& pass : mPasses)
+		{
+			pass.Dependencies.clear();
+			pass.IsOnComputeQueue = false;
+			pass.ComputeCommandListIndex = -1;
+			pass.WaitForPass = -1;
+			pass.Signals = false;
+			pass.Releases.clear();
+		}
+		mFrameBeginReleases.clear();
+		mFrameEndWaitForPass = -1;
+
+		BuildDependencies();
+
+		// A pass goes to the compute queue if it overlaps enough graphics work. It also needs an earlier graphics pass in the frame to wait for,
+		// so that it never runs together with the previous frame's graphics work.
+		int computePassesCount = 0;
+		bool hasGraphicsPass = false;
+		for (int i = 0; i < static_cast<int>(mPasses.size()); i++)
+		{
+			ER_AsyncComputePass& pass = mPasses[i];
+			if (aUseComputeQueue && pass.Type == ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE && hasGraphicsPass && computePassesCount < ER_ASYNC_COMPUTE_MAX_PASSES &&
+				std::min(GetOverlapWindow(i), pass.EstimatedCostMs) >= ER_ASYNC_COMPUTE_MIN_OVERLAP_MS)
+			{
+				pass.IsOnComputeQueue = true;
+				pass.ComputeCommandListIndex = computePassesCount++;
+			}
+			else
+				hasGraphicsPass = true;
+		}
+
+		PlaceSynchronization();
+		Simulate();
+	}
+
+	void ER_AsyncComputeScheduler::BuildDependencies()
+	{
+		std::vector<int> lastWriters(mResources.size(), -1);
+		std::vector<std::vector<int>> readersSinceWrite(mResources.size());
+
+		auto addDependency = [](ER_AsyncComputePass& aPass, int aDependencyPass, int aResource)
+		{
+			for (auto& dependency : aPass.Dependencies)
+			{
+				if (dependency.Pass == aDependencyPass)
+					return;
+			}
+
+			ER_AsyncComputeDependency dependency;
+			dependency.Pass = aDependencyPass;
+			dependency.Resource = aResource;
+			aPass.Dependencies.push_back(dependency);
+		};
+
+		for (int i = 0; i < static_cast<int>(mPasses.size()); i++)
+		{
+			ER_AsyncComputePass& pass = mPasses[i];
+			for (int resource : pass.Reads)
+			{
+				if (lastWriters[resource] > -1 && lastWriters[resource] != i)
+					addDependency(pass, lastWriters[resource], resource); // read after write
+			}
+			for (int resource : pass.Writes)
+			{
+				if (lastWriters[resource] > -1 && lastWriters[resource] != i)
+					addDependency(pass, lastWriters[resource], resource); // write after write
+				for (int reader : readersSinceWrite[resource])
+				{
+					if (reader != i)
+						addDependency(pass, reader, resource); // write after read
+				}
+			}
+
+			for (int resource : pass.Writes)
+			{
+				lastWriters[resource] = i;
+				readersSinceWrite[resource].clear();
+			}
+			for (int resource : pass.Reads)
+			{
+				if (!WritesResource(i, resource))
+					readersSinceWrite[resource].push_back(i);
+			}
+		}
+	}
+
+	// Graphics work (async compute candidates are not counted) between the pass and the first graphics work which needs its results
+	float ER_AsyncComputeScheduler::GetOverlapWindow(int aPass) const
+	{
+		const int passesCount = static_cast<int>(mPasses.size());
+		std::vector<bool> dependsOnPass(passesCount, false);
+		dependsOnPass[aPass] = true;
+
+		float window = 0.0f;
+		for (int i = aPass + 1; i < passesCount; i++)
+		{
+			for (auto& dependency : mPasses[i].Dependencies)
+			{
+				if (dependsOnPass[dependency.Pass])
+				{
+					dependsOnPass[i] = true;
+					break;
+				}
+			}
+
+			if (mPasses[i].Type == ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE)
+				continue;
+			if (dependsOnPass[i])
+				break;
+			window += mPasses[i].EstimatedCostMs;
+		}
+		return window;
+	}
+
+	void ER_AsyncComputeScheduler::PlaceSynchronization()
+	{
+		const int passesCount = static_cast<int>(mPasses.size());
+		int firstGraphicsPass = -1;
+		for (int i = 0; i < passesCount && firstGraphicsPass == -1; i++)
+		{
+			if (!mPasses[i].IsOnComputeQueue)
+				firstGraphicsPass = i;
+		}
+
+		// the latest pass of the other queue each queue has already waited for (the other queue executes in order, so earlier passes are covered too)
+		int lastWaitedPass[2] = { -1, -1 };
+		for (int i = 0; i < passesCount; i++)
+		{
+			ER_AsyncComputePass& pass = mPasses[i];
+			const int queue = pass.IsOnComputeQueue ? 1 : 0;
+
+			int neededPass = -1;
+			for (auto& dependency : pass.Dependencies)
+			{
+				if (mPasses[dependency.Pass].IsOnComputeQueue != pass.IsOnComputeQueue)
+					neededPass = std::max(neededPass, dependency.Pass);
+			}
+
+			// compute lists can not leave graphics-only states: the last graphics user of a resource hands it over in the state the pass needs
+			if (pass.IsOnComputeQueue)
+			{
+				neededPass = std::max(neededPass, firstGraphicsPass);
+
+				std::vector<int> resources = pass.Reads;
+				resources.insert(resources.end(), pass.Writes.begin(), pass.Writes.end());
+				for (int resource : resources)
+				{
+					const ER_RHI_RESOURCE_STATE state = WritesResource(i, resource) ?
+						ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS : ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+
+					int lastUser = -1;
+					for (int j = i - 1; j >= 0 && lastUser == -1; j--)
+					{
+						if (AccessesResource(j, resource))
+							lastUser = j;
+					}
+
+					if (lastUser == -1)
+						AddRelease(mFrameBeginReleases, resource, state); // used by the graphics queue in the previous frame (or loaded)
+					else if (!mPasses[lastUser].IsOnComputeQueue)
+					{
+						AddRelease(mPasses[lastUser].Releases, resource, state);
+						neededPass = std::max(neededPass, lastUser);
+
+						// the last graphics user only read it: earlier compute reads may still be running when it is released for writing
+						if (state == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS)
+						{
+							int lastComputeReader = -1;
+							int lastWaitedByUser = -1;
+							for (int j = 0; j < lastUser; j++)
+							{
+								if (mPasses[j].IsOnComputeQueue && AccessesResource(j, resource))
+									lastComputeReader = j;
+								else if (!mPasses[j].IsOnComputeQueue)
+									lastWaitedByUser = std::max(lastWaitedByUser, mPasses[j].WaitForPass);
+							}
+							lastWaitedByUser = std::max(lastWaitedByUser, mPasses[lastUser].WaitForPass);
+
+							if (lastComputeReader > lastWaitedByUser)
+							{
+								mPasses[lastUser].WaitForPass = lastComputeReader;
+								mPasses[lastComputeReader].Signals = true;
+								lastWaitedPass[0] = std::max(lastWaitedPass[0], lastComputeReader);
+							}
+						}
+					}
+				}
+			}
+
+			if (neededPass > lastWaitedPass[queue])
+			{
+				pass.WaitForPass = neededPass;
+				mPasses[neededPass].Signals = true;
+				lastWaitedPass[queue] = neededPass;
+			}
+		}
+
+		// compute work must be finished with the frame (its command lists are reset in the next frame with the same back buffer)
+		int lastComputePass = -1;
+		for (int i = 0; i < passesCount; i++)
+		{
+			if (mPasses[i].IsOnComputeQueue)
+				lastComputePass = i;
+		}
+		if (lastComputePass > lastWaitedPass[0])
+		{
+			mFrameEndWaitForPass = lastComputePass;
+			mPasses[lastComputePass].Signals = true;
+		}
+	}
+
+	void ER_AsyncComputeScheduler::Simulate()
+	{
+		float queueTimes[2] = { 0.0f, 0.0f };
+		mSerializedTimeMs = 0.0f;
+		for (auto& pass : mPasses)
+		{
+			const int queue = pass.IsOnComputeQueue ? 1 : 0;
+			float start = queueTimes[queue];
+			if (pass.WaitForPass > -1)
+				start = std::max(start, mPasses[pass.WaitForPass].SimulatedEndMs);
+
+			pass.SimulatedStartMs = start;
+			pass.SimulatedEndMs = start + pass.EstimatedCostMs;
+			queueTimes[queue] = pass.SimulatedEndMs;
+			mSerializedTimeMs += pass.EstimatedCostMs;
+		}
+		mAsyncTimeMs = std::max(queueTimes[0], queueTimes[1]);
+	}
+
+	std::string ER_AsyncComputeScheduler::Validate() const
+	{
+		std::string errors;
+		const int passesCount = static_cast<int>(mPasses.size());
+
+		int lastWaitedPass[2] = { -1, -1 };
+		int computePassesCount = 0;
+		for (int i = 0; i < passesCount; i++)
+		{
+			const ER_AsyncComputePass& pass = mPasses[i];
+			const int queue = pass.IsOnComputeQueue ? 1 : 0;
+
+			if (pass.WaitForPass > -1)
+			{
+				if (pass.WaitForPass >= i)
+					errors += pass.Name + ": waits for a later submission\n";
+				else if (mPasses[pass.WaitForPass].IsOnComputeQueue == pass.IsOnComputeQueue)
+					errors += pass.Name + ": waits for its own queue\n";
+				else if (!mPasses[pass.WaitForPass].Signals)
+					errors += pass.Name + ": waits for a pass which does not signal\n";
+				lastWaitedPass[queue] = std::max(lastWaitedPass[queue], pass.WaitForPass);
+			}
+
+			for (auto& dependency : pass.Dependencies)
+			{
+				if (dependency.Pass >= i)
+					errors += pass.Name + ": depends on a later pass\n";
+				if (mPasses[dependency.Pass].IsOnComputeQueue != pass.IsOnComputeQueue && lastWaitedPass[queue] < dependency.Pass)
+					errors += pass.Name + ": no wait for " + mPasses[dependency.Pass].Name + "\n";
+				if (pass.SimulatedStartMs + SimulationEpsilon < mPasses[dependency.Pass].SimulatedEndMs)
+					errors += pass.Name + ": starts before " + mPasses[dependency.Pass].Name + " ends\n";
+			}
+
+			if (!pass.IsOnComputeQueue)
+				continue;
+
+			if (pass.ComputeCommandListIndex != computePassesCount++ || pass.ComputeCommandListIndex >= ER_ASYNC_COMPUTE_MAX_PASSES)
+				errors += pass.Name + ": wrong compute command list\n";
+			if (lastWaitedPass[1] == -1)
+				errors += pass.Name + ": does not wait for the graphics work of the frame\n";
+
+			std::vector<int> resources = pass.Reads;
+			resources.insert(resources.end(), pass.Writes.begin(), pass.Writes.end());
+			for (int resource : resources)
+			{
+				const ER_RHI_RESOURCE_STATE state = WritesResource(i, resource) ?
+					ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS : ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+
+				int lastUser = -1;
+				for (int j = i - 1; j >= 0 && lastUser == -1; j--)
+				{
+					if (AccessesResource(j, resource))
+						lastUser = j;
+				}
+				if (lastUser > -1 && mPasses[lastUser].IsOnComputeQueue)
+					continue;
+
+				const std::vector<ER_AsyncComputeRelease>& releases = (lastUser == -1) ? mFrameBeginReleases : mPasses[lastUser].Releases;
+				bool isReleased = false;
+				for (auto& release : releases)
+				{
+					if (release.Resource == resource && release.State == state)
+						isReleased = true;
+				}
+				if (!isReleased)
+					errors += pass.Name + ": " + mResources[resource].first + " is not released to the compute queue\n";
+				if (lastUser > -1 && lastWaitedPass[1] < lastUser)
+					errors += pass.Name + ": no wait for the release of " + mResources[resource].first + "\n";
+			}
+		}
+
+		// releases from the graphics queue must not change the state of resources still used by the compute queue
+		int lastWaitedByGraphics = -1;
+		for (int i = 0; i < passesCount; i++)
+		{
+			const ER_AsyncComputePass& pass = mPasses[i];
+			if (pass.IsOnComputeQueue)
+			{
+				if (std::max(lastWaitedPass[0], mFrameEndWaitForPass) < i)
+					errors += pass.Name + ": not finished with the frame\n";
+				continue;
+			}
+
+			lastWaitedByGraphics = std::max(lastWaitedByGraphics, pass.WaitForPass);
+			for (auto& release : pass.Releases)
+			{
+				for (int j = lastWaitedByGraphics + 1; j < i; j++)
+				{
+					if (!mPasses[j].IsOnComputeQueue || !AccessesResource(j, release.Resource))
+						continue;
+
+					const ER_RHI_RESOURCE_STATE state = WritesResource(j, release.Resource) ?
+						ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS : ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+					if (state != release.State)
+						errors += pass.Name + ": releases " + mResources[release.Resource].first + " while " + mPasses[j].Name + " uses it\n";
+				}
+			}
+		}
+		return errors;
+	}
+
+	int ER_AsyncComputeScheduler::GetWaitsCount() const
+	{
+		int waits = (mFrameEndWaitForPass > -1) ? 1 : 0;
+		for (auto& pass : mPasses)
+		{
+			if (pass.WaitForPass > -1)
+				waits++;
+		}
+		return waits;
+	}
+
+	std::string ER_AsyncComputeScheduler::GetScheduleString() const
+	{
+		std::string result;
+		for (auto& pass : mPasses)
+		{
+			result += pass.Name + (pass.IsOnComputeQueue ? " [compute]" : " [graphics]");
+			if (pass.WaitForPass > -1)
+				result += ", waits for " + mPasses[pass.WaitForPass].Name;
+			for (auto& release : pass.Releases)
+				result += ", releases " + mResources[release.Resource].first + " (" + GetReleaseStateName(release.State) + ")";
+			if (pass.Signals)
+				result += ", signals";
+			result += "\n";
+		}
+		if (mFrameEndWaitForPass > -1)
+			result += "frame end waits for " + mPasses[mFrameEndWaitForPass].Name + "\n";
+		result += "serialized: " + std::to_string(mSerializedTimeMs) + " ms, async: " + std::to_string(mAsyncTimeMs) + " ms (estimated)";
+		return result;
+	}
+
+	bool ER_AsyncComputeScheduler::RunSelfTest(std::string& aOutReport)
+	{
+		std::string result;
+		int failedCount = 0;
+		auto check = [&](const std::string& aName, bool aPassed, const std::string& aErrors)
+		{
+			result += aName + (aPassed ? ": passed\n" : ": FAILED\n") + aErrors;
+			if (!aPassed)
+				failedCount++;
+		};
+
+		// a deferred frame: fog overlaps GI and local illumination, culling has nothing to overlap
+		{
+			ER_AsyncComputeScheduler scheduler;
+			const int culledInstances = scheduler.AddResource("culled instances");
+			const int gbuffer = scheduler.AddResource("gbuffer");
+			const int shadowMap = scheduler.AddResource("shadow map");
+			const int fogVolume = scheduler.AddResource("fog volume");
+			const int gi = scheduler.AddResource("gi");
+			const int lit = scheduler.AddResource("lit");
+			const int finalColor = scheduler.AddResource("final");
+			const int culling = scheduler.AddPass("culling", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.3f, {}, { culledInstances });
+			scheduler.AddPass("gbuffer", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 2.0f, { culledInstances }, { gbuffer });
+			const int shadows = scheduler.AddPass("shadows", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.5f, {}, { shadowMap });
+			const int fog = scheduler.AddPass("fog", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.8f, { shadowMap }, { fogVolume });
+			scheduler.AddPass("gi", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { gbuffer, shadowMap }, { gi });
+			scheduler.AddPass("local illumination", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.2f, { gbuffer, shadowMap, gi }, { lit });
+			const int composite = scheduler.AddPass("composite", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 0.5f, { lit, fogVolume }, { finalColor });
+
+			scheduler.Schedule(true);
+			std::string errors = scheduler.Validate();
+			check("deferred frame", errors.empty() && !scheduler.GetPass(culling).IsOnComputeQueue && scheduler.GetPass(fog).IsOnComputeQueue &&
+				scheduler.GetPass(fog).WaitForPass == shadows && scheduler.GetPass(composite).WaitForPass == fog && scheduler.GetWaitsCount() == 2 &&
+				scheduler.GetPass(shadows).Releases.size() == 1 && scheduler.GetFrameBeginReleases().size() == 1 &&
+				scheduler.GetAsyncTime() + SimulationEpsilon < scheduler.GetSerializedTime(), errors);
+
+			scheduler.Schedule(false);
+			errors = scheduler.Validate();
+			check("deferred frame (graphics queue only)", errors.empty() && !scheduler.GetPass(fog).IsOnComputeQueue && scheduler.GetWaitsCount() == 0 &&
+				fabs(scheduler.GetAsyncTime() - scheduler.GetSerializedTime()) < SimulationEpsilon, errors);
+		}
+
+		// the consumer follows right away: nothing to overlap
+		{
+			ER_AsyncComputeScheduler scheduler;
+			const int x = scheduler.AddResource("x");
+			const int r = scheduler.AddResource("r");
+			scheduler.AddPass("g0", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, {}, { x });
+			const int a = scheduler.AddPass("a", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 1.0f, { x }, { r });
+			scheduler.AddPass("g1", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { r }, { x });
+
+			scheduler.Schedule(true);
+			const std::string errors = scheduler.Validate();
+			check("no overlap", errors.empty() && !scheduler.GetPass(a).IsOnComputeQueue && scheduler.GetWaitsCount() == 0, errors);
+		}
+
+		// several consumers of the compute results (and a write after the compute read): one wait on each queue
+		{
+			ER_AsyncComputeScheduler scheduler;
+			const int x = scheduler.AddResource("x");
+			const int r = scheduler.AddResource("r");
+			const int y = scheduler.AddResource("y");
+			scheduler.AddPass("g0", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, {}, { x });
+			const int a = scheduler.AddPass("a", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 1.0f, { x }, { r });
+			scheduler.AddPass("g1", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, {}, { y });
+			const int g2 = scheduler.AddPass("g2", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { y }, { x });
+			const int g3 = scheduler.AddPass("g3", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { r }, { y });
+			const int g4 = scheduler.AddPass("g4", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { r, y }, {});
+
+			scheduler.Schedule(true);
+			const std::string errors = scheduler.Validate();
+			check("redundant waits", errors.empty() && scheduler.GetPass(a).IsOnComputeQueue && scheduler.GetPass(g2).WaitForPass == a &&
+				scheduler.GetPass(g3).WaitForPass == -1 && scheduler.GetPass(g4).WaitForPass == -1 && scheduler.GetWaitsCount() == 2, errors);
+		}
+
+		// a chain of compute passes: ordered by the compute queue itself
+		{
+			ER_AsyncComputeScheduler scheduler;
+			const int x = scheduler.AddResource("x");
+			const int r = scheduler.AddResource("r");
+			const int s = scheduler.AddResource("s");
+			const int y = scheduler.AddResource("y");
+			scheduler.AddPass("g0", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, {}, { x });
+			const int a = scheduler.AddPass("a", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.5f, { x }, { r });
+			const int b = scheduler.AddPass("b", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.5f, { r }, { s });
+			scheduler.AddPass("g1", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 2.0f, {}, { y });
+			const int g2 = scheduler.AddPass("g2", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { s, y }, {});
+
+			scheduler.Schedule(true);
+			const std::string errors = scheduler.Validate();
+			check("compute chain", errors.empty() && scheduler.GetPass(a).IsOnComputeQueue && scheduler.GetPass(b).IsOnComputeQueue &&
+				scheduler.GetPass(b).WaitForPass == -1 && scheduler.GetPass(b).ComputeCommandListIndex == 1 && scheduler.GetPass(g2).WaitForPass == b &&
+				scheduler.GetWaitsCount() == 2, errors);
+		}
+
+		// random frames
+		{
+			ER_Random random(ER_RANDOM_DEFAULT_SEED);
+			std::string errors;
+			int invalidFramesCount = 0;
+			for (int frame = 0; frame < ER_ASYNC_COMPUTE_SELF_TEST_RANDOM_FRAMES; frame++)
+			{
+				ER_AsyncComputeScheduler scheduler;
+				const int resourcesCount = random.NextInt(2, 9);
+				for (int i = 0; i < resourcesCount; i++)
+					scheduler.AddResource("r" + std::to_string(i));
+
+				const int passesCount = random.NextInt(4, 17);
+				for (int i = 0; i < passesCount; i++)
+				{
+					std::vector<int> reads(random.NextInt(0, 4));
+					std::vector<int> writes(random.NextInt(0, 3));
+					for (auto& resource : reads)
+						resource = random.NextInt(0, resourcesCount);
+					for (auto& resource : writes)
+						resource = random.NextInt(0, resourcesCount);
+					scheduler.AddPass("p" + std::to_string(i), static_cast<ER_AsyncComputePassType>(random.NextInt(0, 3)), random.NextFloat(0.1f, 2.0f), reads, writes);
+				}
+
+				scheduler.Schedule(true);
+				const std::string frameErrors = scheduler.Validate();
+				if (!frameErrors.empty() || scheduler.GetAsyncTime() > scheduler.GetSerializedTime() + SimulationEpsilon)
+				{
+					if (invalidFramesCount++ == 0)
+						errors = "frame " + std::to_string(frame) + ":\n" + frameErrors + scheduler.GetScheduleString() + "\n";
+				}
+			}
+			check(std::to_string(ER_ASYNC_COMPUTE_SELF_TEST_RANDOM_FRAMES) + " random frames (" + std::to_string(invalidFramesCount) + " invalid)", invalidFramesCount == 0, errors);
+		}
+
+		result += (failedCount == 0) ? "All passed" : std::to_string(failedCount) + " FAILED";
+		aOutReport = result;
+		return failedCount == 0;
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "Common.h"
+#include "RHI/ER_RHI.h"
+
+#define ER_ASYNC_COMPUTE_MIN_OVERLAP_MS 0.1f // a pass goes to the compute queue only if it can overlap at least this much graphics work
+#define ER_ASYNC_COMPUTE_MAX_PASSES 2 // one compute command list per pass (see ER_RHI_MAX_COMPUTE_COMMAND_LISTS), each reset once a frame
+#define ER_ASYNC_COMPUTE_SELF_TEST_RANDOM_FRAMES 1000
+
+namespace EveryRay_Core
+{
+	enum ER_AsyncComputePassType
+	{
+		ER_ASYNC_COMPUTE_PASS_GRAPHICS = 0,
+		ER_ASYNC_COMPUTE_PASS_COMPUTE, // compute work which stays on the graphics queue
+		ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE // compute-only work which may go to the compute queue
+	};
+
+	// Hand-over of a resource to the other queue at the end of a pass (or at the beginning of the frame)
+	struct ER_AsyncComputeRelease
+	{
+		int Resource = -1;
+		ER_RHI_RESOURCE_STATE State = ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COMMON;
+	};
+
+	struct ER_AsyncComputeDependency
+	{
+		int Pass = -1; // earlier pass which must be finished
+		int Resource = -1;
+	};
+
+	struct ER_AsyncComputePass
+	{
+		std::string Name;
+		ER_AsyncComputePassType Type = ER_ASYNC_COMPUTE_PASS_GRAPHICS;
+		float EstimatedCostMs = 0.0f;
+		std::vector<int> Reads;
+		std::vector<int> Writes;
+
+		// results of Schedule()
+		std::vector<ER_AsyncComputeDependency> Dependencies; // read after write, write after read and write after write
+		bool IsOnComputeQueue = false;
+		int ComputeCommandListIndex = -1;
+		int WaitForPass = -1; // the queue waits for the signal of this pass (from the other queue) before the pass
+		bool Signals = false; // the queue signals its fence after the pass (and its releases)
+		std::vector<ER_AsyncComputeRelease> Releases; // recorded at the end of the pass on its queue
+		float SimulatedStartMs = 0.0f;
+		float SimulatedEndMs = 0.0f;
+	};
+
+	// CPU model of a frame on two queues: passes are declared in their submission order with the resources they read and write.
+	// Schedule() builds the dependencies, decides which async compute passes overlap enough graphics work to go to the compute queue,
+	// places a minimal set of cross-queue waits and the resource releases (compute lists can not use graphics-only states) and simulates
+	// both queue timelines. Does not touch the RHI, so the dependency logic can be validated without a GPU (see RunSelfTest()).
+	class ER_AsyncComputeScheduler
+	{
+	public:
+		ER_AsyncComputeScheduler();
+		~ER_AsyncComputeScheduler();
+
+		void Clear();
+		int AddResource(const std::string& aName, ER_RHI_GPUResource* aResource = nullptr);
+		int AddPass(const std::string& aName, ER_AsyncComputePassType aType, float aEstimatedCostMs, const std::vector<int>& aReads, const std::vector<int>& aWrites);
+		void SetPassCost(int aPass, float aEstimatedCostMs) { mPasses[aPass].EstimatedCostMs = aEstimatedCostMs; }
+
+		void Schedule(bool aUseComputeQueue);
+		// Checks the result of Schedule(): every dependency is ordered by its queue or by a wait (also in the simulated timelines), waits only go back
+		// in the submission order and every resource used on the compute queue is released to it. Returns the errors (empty if valid).
+		std::string Validate() const;
+
+		const std::vector<ER_AsyncComputePass>& GetPasses() const { return mPasses; }
+		const ER_AsyncComputePass& GetPass(int aPass) const { return mPasses[aPass]; }
+		ER_RHI_GPUResource* GetResource(int aResource) const { return mResources[aResource].second; }
+		const std::vector<ER_AsyncComputeRelease>& GetFrameBeginReleases() const { return mFrameBeginReleases; } // recorded on the graphics queue
+		int GetFrameEndWaitForPass() const { return mFrameEndWaitForPass; } // graphics waits for the compute queue before the end of the frame
+		int GetWaitsCount() const;
+
+		float GetSerializedTime() const { return mSerializedTimeMs; }
+		float GetAsyncTime() const { return mAsyncTimeMs; }
+		std::string GetScheduleString() const;
+
+		// Hand-made frames with known schedules and random frames checked with Validate() (results of all cases)
+		static bool RunSelfTest(std::string& aOutReport);
+	private:
+		void BuildDependencies();
+		float GetOverlapWindow(int aPass) const; // cost of graphics work between the pass and its first consumer
+		void PlaceSynchronization();
+		void Simulate();
+		bool AccessesResource(int aPass, int aResource) const;
+		bool WritesResource(int aPass, int aResource) const;
+		void AddRelease(std::vector<ER_AsyncComputeRelease>& aReleases, int aResource, ER_RHI_RESOURCE_STATE aState);
+
+		std::vector<std::pair<std::string, ER_RHI_GPUResource*>> mResources;
+		std::vector<ER_AsyncComputePass> mPasses;
+		std::vector<ER_AsyncComputeRelease> mFrameBeginReleases;
+		int mFrameEndWaitForPass = -1;
+
+		float mSerializedTimeMs = 0.0f;
+		float mAsyncTimeMs = 0.0f;
+	};
+}
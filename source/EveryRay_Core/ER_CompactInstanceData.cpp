@@ -0,0 +1,210 @@
+#include "stdafx.h"
+
+#include "ER_CompactInstanceData.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	// [-1, 1] -> [0, 65534] (not 65535, so that 0 is stored exactly and identity rotations stay exact)
+	static UINT16 QuantizeSignedUnorm16(float aValue)
+	{
+		const float unorm = std::min(std::max(aValue * 0.5f + 0.5f, 0.0f), 1.0f);
+		return static_cast<UINT16>(unorm * 65534.0f + 0.5f);
+	}
+
+	static float DequantizeSignedUnorm16(UINT16 aValue)
+	{
+		return static_cast<float>(aValue) / 65534.0f * 2.0f - 1.0f;
+	}
+
+	void ER_CompactInstanceData::Encode(const XMFLOAT4X4& aWorld, InstancedDataCompact& aOutData, UINT aColor)
+	{
+		// scale from the lengths of the basis rows, rotation from the normalized rows
+		float rows[3][3];
+		float scale[3];
+		for (int i = 0; i < 3; i++)
+		{
+			scale[i] = sqrtf(aWorld.m[i][0] * aWorld.m[i][0] + aWorld.m[i][1] * aWorld.m[i][1] + aWorld.m[i][2] * aWorld.m[i][2]);
+			for (int j = 0; j < 3; j++)
+				rows[i][j] = (scale[i] > FLT_MIN) ? aWorld.m[i][j] / scale[i] : (i == j ? 1.0f : 0.0f);
+		}
+
+		// mirrored transform: flip the first axis, so that the rows are a proper rotation
+		const float determinant =
+			rows[0][0] * (rows[1][1] * rows[2][2] - rows[1][2] * rows[2][1]) -
+			rows[0][1] * (rows[1][0] * rows[2][2] - rows[1][2] * rows[2][0]) +
+			rows[0][2] * (rows[1][0] * rows[2][1] - rows[1][1] * rows[2][0]);
+		if (determinant < 0.0f)
+		{
+			scale[0] = -scale[0];
+			for (int j = 0; j < 3; j++)
+				rows[0][j] = -rows[0][j];
+		}
+
+		// quaternion of the rotation (inverse of the row-vector matrix in Decode()), pivoting on the largest diagonal term
+		float q[4]; // xyzw
+		const float trace = rows[0][0] + rows[1][1] + rows[2][2];
+		if (trace > 0.0f)
+		{
+			const float s = sqrtf(trace + 1.0f) * 2.0f; // 4w
+			q[3] = 0.25f * s;
+			q[0] = (rows[1][2] - rows[2][1]) / s;
+			q[1] = (rows[2][0] - rows[0][2]) / s;
+			q[2] = (rows[0][1] - rows[1][0]) / s;
+		}
+		else if (rows[0][0] > rows[1][1] && rows[0][0] > rows[2][2])
+		{
+			const float s = sqrtf(1.0f + rows[0][0] - rows[1][1] - rows[2][2]) * 2.0f; // 4x
+			q[3] = (rows[1][2] - rows[2][1]) / s;
+			q[0] = 0.25f * s;
+			q[1] = (rows[0][1] + rows[1][0]) / s;
+			q[2] = (rows[0][2] + rows[2][0]) / s;
+		}
+		else if (rows[1][1] > rows[2][2])
+		{
+			const float s = sqrtf(1.0f + rows[1][1] - rows[0][0] - rows[2][2]) * 2.0f; // 4y
+			q[3] = (rows[2][0] - rows[0][2]) / s;
+			q[0] = (rows[0][1] + rows[1][0]) / s;
+			q[1] = 0.25f * s;
+			q[2] = (rows[1][2] + rows[2][1]) / s;
+		}
+		else
+		{
+			const float s = sqrtf(1.0f + rows[2][2] - rows[0][0] - rows[1][1]) * 2.0f; // 4z
+			q[3] = (rows[0][1] - rows[1][0]) / s;
+			q[0] = (rows[0][2] + rows[2][0]) / s;
+			q[1] = (rows[1][2] + rows[2][1]) / s;
+			q[2] = 0.25f * s;
+		}
+		const float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+
+		aOutData.Position = XMFLOAT3(aWorld._41, aWorld._42, aWorld._43);
+		aOutData.Color = aColor;
+		for (int i = 0; i < 4; i++)
+			aOutData.Rotation[i] = QuantizeSignedUnorm16(q[i] / length);
+		for (int i = 0; i < 3; i++)
+			aOutData.Scale[i] = PackedVector::XMConvertFloatToHalf(scale[i]);
+		aOutData.Scale[3] = PackedVector::XMConvertFloatToHalf(1.0f);
+	}
+
+	void ER_CompactInstanceData::Encode(const XMFLOAT3& aPosition, float aUniformScale, InstancedDataCompact& aOutData, UINT aColor)
+	{
+		static const UINT16 zero = QuantizeSignedUnorm16(0.0f);
+		static const UINT16 one = QuantizeSignedUnorm16(1.0f);
+
+		aOutData.Position = aPosition;
+		aOutData.Color = aColor;
+		aOutData.Rotation[0] = aOutData.Rotation[1] = aOutData.Rotation[2] = zero;
+		aOutData.Rotation[3] = one;
+		aOutData.Scale[0] = aOutData.Scale[1] = aOutData.Scale[2] = PackedVector::XMConvertFloatToHalf(aUniformScale);
+		aOutData.Scale[3] = PackedVector::XMConvertFloatToHalf(1.0f);
+	}
+
+	XMFLOAT4X4 ER_CompactInstanceData::Decode(const InstancedDataCompact& aData)
+	{
+		float q[4];
+		for (int i = 0; i < 4; i++)
+			q[i] = DequantizeSignedUnorm16(aData.Rotation[i]);
+		const float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		for (int i = 0; i < 4; i++)
+			q[i] /= length;
+
+		const float sx = PackedVector::XMConvertHalfToFloat(aData.Scale[0]);
+		const float sy = PackedVector::XMConvertHalfToFloat(aData.Scale[1]);
+		const float sz = PackedVector::XMConvertHalfToFloat(aData.Scale[2]);
+		const float x = q[0], y = q[1], z = q[2], w = q[3];
+
+		return XMFLOAT4X4(
+			sx * (1.0f - 2.0f * (y * y + z * z)), sx * 2.0f * (x * y + z * w), sx * 2.0f * (x * z - y * w), 0.0f,
+			sy * 2.0f * (x * y - z * w), sy * (1.0f - 2.0f * (x * x + z * z)), sy * 2.0f * (y * z + x * w), 0.0f,
+			sz * 2.0f * (x * z + y * w), sz * 2.0f * (y * z - x * w), sz * (1.0f - 2.0f * (x * x + y * y)), 0.0f,
+			aData.Position.x, aData.Position.y, aData.Position.z, 1.0f);
+	}
+
+	void ER_CompactInstanceData::GetInputElements(UINT aInputSlot, ER_RHI_INPUT_ELEMENT_DESC aOutElements[ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS])
+	{
+		aOutElements[0] = { "INSTANCE_POSITION", 0, ER_FORMAT_R32G32B32_FLOAT, aInputSlot, 0, false, 1 };
+		aOutElements[1] = { "INSTANCE_COLOR", 0, ER_FORMAT_R8G8B8A8_UNORM, aInputSlot, 12, false, 1 };
+		aOutElements[2] = { "INSTANCE_ROTATION", 0, ER_FORMAT_R16G16B16A16_UNORM, aInputSlot, 16, false, 1 };
+		aOutElements[3] = { "INSTANCE_SCALE", 0, ER_FORMAT_R16G16B16A16_FLOAT, aInputSlot, 24, false, 1 };
+	}
+
+	bool ER_CompactInstanceData::RunPrecisionCheck(int aSamplesCount, std::string& aOutReport)
+	{
+		const float rotationBound = 1.0f / 65534.0f + 1e-6f; // + float rounding of the reference quaternion
+		const float scaleBound = 1.0f / 2048.0f;
+
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		float maxRotationError = 0.0f;
+		float maxScaleError = 0.0f;
+		float maxPositionError = 0.0f;
+		float maxMatrixError = 0.0f; // relative to the largest scale
+		int failedSamples = 0;
+
+		double encodeTime = 0.0;
+		InstancedDataCompact data;
+		for (int sample = 0; sample < aSamplesCount; sample++)
+		{
+			const bool isUniform = (sample % 2) == 0;
+			const bool isMirrored = (sample % 16) == 1;
+			XMFLOAT3 scale;
+			scale.x = random.NextFloat(0.01f, 100.0f);
+			scale.y = isUniform ? scale.x : random.NextFloat(0.01f, 100.0f);
+			scale.z = isUniform ? scale.x : random.NextFloat(0.01f, 100.0f);
+			if (isMirrored)
+				scale.x = -scale.x;
+			const XMVECTOR quaternion = XMQuaternionRotationRollPitchYaw(random.NextFloat(-XM_PI, XM_PI), random.NextFloat(-XM_PI, XM_PI), random.NextFloat(-XM_PI, XM_PI));
+
+			XMFLOAT4X4 world;
+			XMStoreFloat4x4(&world, XMMatrixScaling(scale.x, scale.y, scale.z) * XMMatrixRotationQuaternion(quaternion) *
+				XMMatrixTranslation(random.NextFloat(-5000.0f, 5000.0f), random.NextFloat(-500.0f, 500.0f), random.NextFloat(-5000.0f, 5000.0f)));
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			Encode(world, data);
+			auto endTime = std::chrono::high_resolution_clock::now();
+			encodeTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+			const XMFLOAT4X4 decoded = Decode(data);
+
+			// q and -q are the same rotation
+			XMFLOAT4 reference;
+			XMStoreFloat4(&reference, quaternion);
+			const float referenceQ[4] = { reference.x, reference.y, reference.z, reference.w };
+			float rotationError[2] = { 0.0f, 0.0f };
+			for (int i = 0; i < 4; i++)
+			{
+				const float value = DequantizeSignedUnorm16(data.Rotation[i]);
+				rotationError[0] = std::max(rotationError[0], fabsf(value - referenceQ[i]));
+				rotationError[1] = std::max(rotationError[1], fabsf(value + referenceQ[i]));
+			}
+			const float rotationErrorSample = std::min(rotationError[0], rotationError[1]);
+
+			const float referenceScale[3] = { scale.x, scale.y, scale.z };
+			float scaleErrorSample = 0.0f;
+			for (int i = 0; i < 3; i++)
+			{
+				const float value = PackedVector::XMConvertHalfToFloat(data.Scale[i]);
+				scaleErrorSample = std::max(scaleErrorSample, fabsf(value - referenceScale[i]) / fabsf(referenceScale[i]));
+			}
+
+			const float positionErrorSample = std::max(std::max(fabsf(decoded._41 - world._41), fabsf(decoded._42 - world._42)), fabsf(decoded._43 - world._43));
+
+			const float maxScale = std::max(std::max(fabsf(scale.x), fabsf(scale.y)), fabsf(scale.z));
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					maxMatrixError = std::max(maxMatrixError, fabsf(decoded.m[i][j] - world.m[i][j]) / maxScale);
+
+			if (rotationErrorSample > rotationBound || scaleErrorSample > scaleBound || positionErrorSample > 0.0f)
+				failedSamples++;
+
+			maxRotationError = std::max(maxRotationError, rotationErrorSample);
+			maxScaleError = std::max(maxScaleError, scaleErrorSample);
+			maxPositionError = std::max(maxPositionError, positionErrorSample);
+		}
+
+		aOutReport = std::to_string(aSamplesCount) + " samples, encode: " + std::to_string(encodeTime * 1000000.0 / aSamplesCount) + " ns/instance\n" +
+			"rotation: " + std::to_string(maxRotationError * 65534.0f) + "/65534, scale: " + std::to_string(maxScaleError * 2048.0f) + "/2048, position: " +
+			std::to_string(maxPositionError) + ", matrix: " + std::to_string(maxMatrixError) + "\nout of bounds: " + std::to_string(failedSamples);
+		return failedSamples == 0;
+	}
+}
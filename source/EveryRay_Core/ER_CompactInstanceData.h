@@ -0,0 +1,42 @@
+#pragma once
+#include "Common.h"
+#include "RHI/ER_RHI.h"
+
+#define ER_COMPACT_INSTANCE_DATA_CHECK_SAMPLES 100000
+#define ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS 4
+
+namespace EveryRay_Core
+{
+	// 32 bytes per instance instead of a full world matrix (64 bytes, see InstancedData), decoded in vertex shaders (CompactInstanceData.hlsli).
+	// Only translation * rotation * scale transforms can be stored (no shear), mirrored transforms are stored with a negative X scale.
+	// Error bounds of Encode() -> Decode() (checked in RunPrecisionCheck()):
+	// - position: exact
+	// - rotation: every quaternion component within 1/65534 (before the renormalization in Decode())
+	// - scale: relative error within 2^-11 (half float, for |scale| in [2^-14, 65504])
+	struct InstancedDataCompact
+	{
+		XMFLOAT3 Position;
+		UINT Color; // packed RGBA8 (R in the lowest byte) or a user id
+		UINT16 Rotation[4]; // quaternion xyzw, [-1, 1] -> [0, 65534]
+		PackedVector::HALF Scale[4]; // xyz, w is always 1
+	};
+	static_assert(sizeof(InstancedDataCompact) == 32, "InstancedDataCompact must be 32 bytes (see the input layout in ER_CompactInstanceData::GetInputElements())");
+
+	class ER_CompactInstanceData
+	{
+	public:
+		static void Encode(const XMFLOAT4X4& aWorld, InstancedDataCompact& aOutData, UINT aColor = 0xffffffff);
+		static void Encode(const XMFLOAT3& aPosition, float aUniformScale, InstancedDataCompact& aOutData, UINT aColor = 0xffffffff); // no rotation (fast path)
+		static XMFLOAT4X4 Decode(const InstancedDataCompact& aData); // same math as DecodeCompactInstanceWorld() in the shaders
+
+		// Per-instance vertex elements which replace the 4 "WORLD" elements of the old layout
+		static void GetInputElements(UINT aInputSlot, ER_RHI_INPUT_ELEMENT_DESC aOutElements[ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS]);
+
+		// Encodes random transforms and compares the decoded ones with the bounds above (fails if any sample is out of bounds)
+		static bool RunPrecisionCheck(int aSamplesCount, std::string& aOutReport);
+	private:
+		ER_CompactInstanceData();
+		ER_CompactInstanceData(const ER_CompactInstanceData& rhs);
+		ER_CompactInstanceData& operator=(const ER_CompactInstanceData& rhs);
+	};
+}
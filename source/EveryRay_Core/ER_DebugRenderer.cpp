@@ -0,0 +1,292 @@
+#include "stdafx.h"
+
+#include "ER_DebugRenderer.h"
+#include "ER_Core.h"
+#include "ER_CoreException.h"
+#include "ER_Camera.h"
+#include "ER_Frustum.h"
+#include "ER_Utility.h"
+#include "ER_Random.h"
+
+#define DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
+#define DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX 1
+
+namespace EveryRay_Core
+{
+	RTTI_DEFINITIONS(ER_DebugRenderer)
+
+	// Edges of a box with the corners in the order of ER_Frustum::Corners()
+	static const int BoxEdges[12][2] = {
+		// near plane lines
+		{ 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 },
+		// sides
+		{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+		// far plane lines
+		{ 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }
+	};
+
+	static inline void WriteBoxLines(const XMFLOAT3* aCorners, UINT aColor, ER_DebugLine* aOutLines)
+	{
+		for (int edge = 0; edge < 12; edge++)
+		{
+			aOutLines[edge].Start = aCorners[BoxEdges[edge][0]];
+			aOutLines[edge].Color = aColor;
+			aOutLines[edge].End = aCorners[BoxEdges[edge][1]];
+			aOutLines[edge].Pad = 0;
+		}
+	}
+
+	static inline void GetAABBCorners(const ER_AABB& aAABB, XMFLOAT3* aOutCorners)
+	{
+		aOutCorners[0] = XMFLOAT3(aAABB.first.x, aAABB.second.y, aAABB.first.z);
+		aOutCorners[1] = XMFLOAT3(aAABB.second.x, aAABB.second.y, aAABB.first.z);
+		aOutCorners[2] = XMFLOAT3(aAABB.second.x, aAABB.first.y, aAABB.first.z);
+		aOutCorners[3] = XMFLOAT3(aAABB.first.x, aAABB.first.y, aAABB.first.z);
+		aOutCorners[4] = XMFLOAT3(aAABB.first.x, aAABB.second.y, aAABB.second.z);
+		aOutCorners[5] = XMFLOAT3(aAABB.second.x, aAABB.second.y, aAABB.second.z);
+		aOutCorners[6] = XMFLOAT3(aAABB.second.x, aAABB.first.y, aAABB.second.z);
+		aOutCorners[7] = XMFLOAT3(aAABB.first.x, aAABB.first.y, aAABB.second.z);
+	}
+
+	ER_DebugRenderer::ER_DebugRenderer(ER_Core& game) : ER_CoreComponent(game)
+	{
+	}
+
+	ER_DebugRenderer::~ER_DebugRenderer()
+	{
+		DeleteObject(mVS);
+		DeleteObject(mPS);
+		DeleteObject(mRootSignature);
+		DeleteObject(mLinesBuffer);
+		mConstantBuffer.Release();
+	}
+
+	void ER_DebugRenderer::Init()
+	{
+		if (mVS) // already initialized by a previous level
+			return;
+
+		auto rhi = GetCore()->GetRHI();
+
+		mVS = rhi->CreateGPUShader();
+		mVS->CompileShader(rhi, "content\\shaders\\DebugLines.hlsl", "VSMain", ER_VERTEX);
+		mPS = rhi->CreateGPUShader();
+		mPS->CompileShader(rhi, "content\\shaders\\DebugLines.hlsl", "PSMain", ER_PIXEL);
+
+		mRootSignature = rhi->CreateRootSignature(2, 0);
+		if (mRootSignature)
+		{
+			mRootSignature->InitDescriptorTable(rhi, DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_SRV }, { 0 }, { 1 }, ER_RHI_SHADER_VISIBILITY_VERTEX);
+			mRootSignature->InitDescriptorTable(rhi, DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 1 }, ER_RHI_SHADER_VISIBILITY_VERTEX);
+			mRootSignature->Finalize(rhi, "ER_RHI_GPURootSignature: Debug Lines Pass", true);
+		}
+
+		mConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: Debug Lines CB");
+		mLines.reserve(ER_DEBUG_RENDERER_INITIAL_LINES);
+	}
+
+	void ER_DebugRenderer::Draw(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth)
+	{
+		assert(aRenderTarget);
+
+		const int linesCount = std::min(GetLinesCount(), ER_DEBUG_RENDERER_MAX_LINES);
+		mLastFrameLinesCount = linesCount;
+		mLastFrameDroppedLinesCount = GetLinesCount() - linesCount;
+		if (linesCount == 0 || !mVS)
+		{
+			mLines.clear();
+			return;
+		}
+
+		auto rhi = GetCore()->GetRHI();
+		ER_Camera* camera = (ER_Camera*)(GetCore()->GetServices().FindService(ER_Camera::TypeIdClass()));
+		assert(camera);
+
+		// grows in powers of 2, so reallocations stop after the first frames
+		if (static_cast<UINT>(linesCount) > mLinesBufferCapacity)
+		{
+			UINT capacity = std::max(mLinesBufferCapacity, static_cast<UINT>(ER_DEBUG_RENDERER_INITIAL_LINES));
+			while (capacity < static_cast<UINT>(linesCount))
+				capacity *= 2;
+
+			if (mLinesBuffer)
+				rhi->WaitForGpuOnGraphicsFence(); // previous frames might still use the old buffer
+			DeleteObject(mLinesBuffer);
+			mLinesBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Debug Lines");
+			mLinesBuffer->CreateGPUBufferResource(rhi, nullptr, capacity, sizeof(ER_DebugLine), true, ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
+			mLinesBufferCapacity = capacity;
+		}
+		rhi->UpdateBuffer(mLinesBuffer, mLines.data(), linesCount * static_cast<int>(sizeof(ER_DebugLine)));
+
+		mConstantBuffer.Data.ViewProjection = XMMatrixTranspose(camera->ViewMatrix() * camera->ProjectionMatrix());
+		mConstantBuffer.ApplyChanges(rhi);
+
+		rhi->BeginEventTag("EveryRay: Debug lines");
+		rhi->SetRenderTargets({ aRenderTarget }, aDepth);
+		rhi->SetRootSignature(mRootSignature);
+		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_LINELIST);
+		if (!rhi->IsPSOReady(mPSOName))
+		{
+			rhi->InitializePSO(mPSOName);
+			rhi->SetShader(mVS);
+			rhi->SetShader(mPS);
+			rhi->SetEmptyInputLayout();
+			rhi->SetRenderTargetFormats({ aRenderTarget }, aDepth);
+			rhi->SetRasterizerState(ER_NO_CULLING);
+			rhi->SetBlendState(ER_NO_BLEND);
+			rhi->SetDepthStencilState(ER_DEPTH_ONLY_WRITE_COMPARISON_LESS_EQUAL);
+			rhi->SetTopologyTypeToPSO(mPSOName, ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_LINELIST);
+			rhi->SetRootSignatureToPSO(mPSOName, mRootSignature);
+			rhi->FinalizePSO(mPSOName);
+		}
+		rhi->SetPSO(mPSOName);
+		rhi->SetShaderResources(ER_VERTEX, { mLinesBuffer }, 0, mRootSignature, DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX);
+		rhi->SetConstantBuffers(ER_VERTEX, { mConstantBuffer.Buffer() }, 0, mRootSignature, DEBUG_LINES_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX);
+		rhi->DrawInstanced(2, static_cast<UINT>(linesCount), 0, 0);
+		rhi->UnsetPSO();
+		rhi->UnbindResourcesFromShader(ER_VERTEX);
+		rhi->EndEventTag();
+
+		mLines.clear();
+	}
+
+	UINT ER_DebugRenderer::PackColor(const XMFLOAT4& aColor)
+	{
+		auto toByte = [](float aValue) { return static_cast<UINT>(std::min(std::max(aValue, 0.0f), 1.0f) * 255.0f + 0.5f); };
+		return toByte(aColor.x) | (toByte(aColor.y) << 8) | (toByte(aColor.z) << 16) | (toByte(aColor.w) << 24);
+	}
+
+	void ER_DebugRenderer::AddLine(const XMFLOAT3& aStart, const XMFLOAT3& aEnd, const XMFLOAT4& aColor)
+	{
+		mLines.push_back({ aStart, PackColor(aColor), aEnd, 0 });
+	}
+
+	void ER_DebugRenderer::AddAABB(const ER_AABB& aAABB, const XMFLOAT4& aColor)
+	{
+		XMFLOAT3 corners[8];
+		GetAABBCorners(aAABB, corners);
+		AddBox(corners, aColor);
+	}
+
+	void ER_DebugRenderer::AddBox(const XMFLOAT3* aCorners, const XMFLOAT4& aColor)
+	{
+		const UINT color = PackColor(aColor);
+		const size_t first = mLines.size();
+		mLines.resize(first + 12);
+		WriteBoxLines(aCorners, color, &mLines[first]);
+	}
+
+	void ER_DebugRenderer::AddFrustum(const ER_Frustum& aFrustum, const XMFLOAT4& aColor)
+	{
+		AddBox(aFrustum.Corners(), aColor);
+	}
+
+	// 3 circles in the XY, XZ and YZ planes
+	void ER_DebugRenderer::AddSphere(const XMFLOAT3& aCenter, float aRadius, const XMFLOAT4& aColor, int aSegments)
+	{
+		const UINT color = PackColor(aColor);
+		aSegments = std::max(aSegments, 3);
+		const float step = XM_2PI / static_cast<float>(aSegments);
+		for (int segment = 0; segment < aSegments; segment++)
+		{
+			const float c0 = cosf(step * segment) * aRadius, s0 = sinf(step * segment) * aRadius;
+			const float c1 = cosf(step * (segment + 1)) * aRadius, s1 = sinf(step * (segment + 1)) * aRadius;
+			mLines.push_back({ XMFLOAT3(aCenter.x + c0, aCenter.y + s0, aCenter.z), color, XMFLOAT3(aCenter.x + c1, aCenter.y + s1, aCenter.z), 0 });
+			mLines.push_back({ XMFLOAT3(aCenter.x + c0, aCenter.y, aCenter.z + s0), color, XMFLOAT3(aCenter.x + c1, aCenter.y, aCenter.z + s1), 0 });
+			mLines.push_back({ XMFLOAT3(aCenter.x, aCenter.y + c0, aCenter.z + s0), color, XMFLOAT3(aCenter.x, aCenter.y + c1, aCenter.z + s1), 0 });
+		}
+	}
+
+	bool ER_DebugRenderer::RunBenchmark(int aBoxesCount, int aFramesCount, std::string& aOutReport)
+	{
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		const float fieldSize = 2000.0f;
+		const XMFLOAT4 color(0.0f, 0.0f, 1.0f, 1.0f);
+
+		std::vector<ER_AABB> boxes(aBoxesCount);
+		for (int i = 0; i < aBoxesCount; i++)
+		{
+			const XMFLOAT3 center(random.NextFloat(-fieldSize, fieldSize), random.NextFloat(0.0f, 50.0f), random.NextFloat(-fieldSize, fieldSize));
+			const XMFLOAT3 extent(random.NextFloat(0.5f, 10.0f), random.NextFloat(0.5f, 10.0f), random.NextFloat(0.5f, 10.0f));
+			boxes[i] = { XMFLOAT3(center.x - extent.x, center.y - extent.y, center.z - extent.z), XMFLOAT3(center.x + extent.x, center.y + extent.y, center.z + extent.z) };
+		}
+
+		// previous path: every box updates its own vertex buffer (8 float4 vertices) and constant buffer (world, view-projection, color)
+		// before its draw, uploads are emulated by copies into per-box buffers
+		const int vertexBufferSize = 8 * sizeof(XMFLOAT4);
+		const int constantBufferSize = 256; // 2 matrices and a color, aligned
+		std::vector<unsigned char> perBoxBuffers(static_cast<size_t>(aBoxesCount) * (vertexBufferSize + constantBufferSize));
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			for (int i = 0; i < aBoxesCount; i++)
+			{
+				XMFLOAT3 corners[8];
+				GetAABBCorners(boxes[i], corners);
+				XMFLOAT4 vertices[8];
+				for (int corner = 0; corner < 8; corner++)
+					vertices[corner] = XMFLOAT4(corners[corner].x, corners[corner].y, corners[corner].z, 1.0f);
+
+				unsigned char* boxBuffers = &perBoxBuffers[static_cast<size_t>(i) * (vertexBufferSize + constantBufferSize)];
+				memcpy(boxBuffers, vertices, vertexBufferSize);
+				memcpy(boxBuffers + vertexBufferSize, &color, sizeof(color));
+			}
+		}
+		auto endTime = std::chrono::high_resolution_clock::now();
+		const double perBoxTime = std::chrono::duration<double, std::milli>(endTime - startTime).count() / std::max(aFramesCount, 1);
+
+		// batched path: lines of all boxes and one upload
+		std::vector<ER_DebugLine> lines;
+		std::vector<ER_DebugLine> uploadBuffer;
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			lines.resize(static_cast<size_t>(aBoxesCount) * 12);
+			const UINT packedColor = PackColor(color);
+			for (int i = 0; i < aBoxesCount; i++)
+			{
+				XMFLOAT3 corners[8];
+				GetAABBCorners(boxes[i], corners);
+				WriteBoxLines(corners, packedColor, &lines[static_cast<size_t>(i) * 12]);
+			}
+			uploadBuffer.resize(lines.size());
+			if (!lines.empty())
+				memcpy(uploadBuffer.data(), lines.data(), lines.size() * sizeof(ER_DebugLine));
+		}
+		endTime = std::chrono::high_resolution_clock::now();
+		const double batchedTime = std::chrono::duration<double, std::milli>(endTime - startTime).count() / std::max(aFramesCount, 1);
+
+		// every line is an edge of its box: both ends are corners and they differ in one axis only
+		int errors = (uploadBuffer.size() == static_cast<size_t>(aBoxesCount) * 12) ? 0 : 1;
+		for (size_t i = 0; i < uploadBuffer.size() && errors == 0; i++)
+		{
+			const ER_AABB& box = boxes[i / 12];
+			const float start[3] = { uploadBuffer[i].Start.x, uploadBuffer[i].Start.y, uploadBuffer[i].Start.z };
+			const float end[3] = { uploadBuffer[i].End.x, uploadBuffer[i].End.y, uploadBuffer[i].End.z };
+			const float boxMin[3] = { box.first.x, box.first.y, box.first.z };
+			const float boxMax[3] = { box.second.x, box.second.y, box.second.z };
+			int differentAxes = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if ((start[axis] != boxMin[axis] && start[axis] != boxMax[axis]) || (end[axis] != boxMin[axis] && end[axis] != boxMax[axis]))
+					errors++;
+				if (start[axis] != end[axis])
+					differentAxes++;
+			}
+			if (differentAxes != 1)
+				errors++;
+		}
+
+		// GPU commands per box: vertex and index buffers, PSO, constant buffer update and 2 bindings, draw, PSO unset
+		const int perBoxCommands = 8;
+		// batched: lines upload, render targets, root signature, topology, PSO, SRV, constant buffer update and binding, draw, PSO unset, SRV unbind
+		const int batchedCommands = 11;
+
+		aOutReport = std::to_string(aBoxesCount) + " boxes, " + std::to_string(lines.size()) + " lines, per frame (data preparation on CPU, the driver's cost of the commands is not measured)\n" +
+			"per box: " + std::to_string(perBoxTime) + " ms, " + std::to_string(aBoxesCount) + " draws, " + std::to_string(aBoxesCount * perBoxCommands) + " commands, " +
+			std::to_string(static_cast<UINT64>(aBoxesCount) * (vertexBufferSize + constantBufferSize) / 1024) + " KB uploaded\n" +
+			"batched: " + std::to_string(batchedTime) + " ms, 1 draw, " + std::to_string(batchedCommands) + " commands, " +
+			std::to_string(lines.size() * sizeof(ER_DebugLine) / 1024) + " KB uploaded, errors: " + std::to_string(errors);
+		return errors == 0;
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "Common.h"
+#include "ER_CoreComponent.h"
+#include "RHI/ER_RHI.h"
+
+#define ER_DEBUG_RENDERER_INITIAL_LINES 4096
+#define ER_DEBUG_RENDERER_MAX_LINES (1 << 20) // 32 MB of lines, the rest of the frame's lines is dropped
+#define ER_DEBUG_RENDERER_SPHERE_SEGMENTS 24 // per circle (3 circles per sphere)
+#define ER_DEBUG_RENDERER_BENCHMARK_BOXES 20000
+#define ER_DEBUG_RENDERER_BENCHMARK_FRAMES 20
+
+namespace EveryRay_Core
+{
+	class ER_Frustum;
+
+	// Same layout as 'DebugLine' in DebugLines.hlsl
+	struct ER_DebugLine
+	{
+		XMFLOAT3 Start;
+		UINT Color; // RGBA8, R in the lowest byte
+		XMFLOAT3 End;
+		UINT Pad;
+	};
+
+	namespace DebugLinesCBufferData
+	{
+		struct ER_ALIGN_GPU_BUFFER DebugLinesCB
+		{
+			XMMATRIX ViewProjection;
+		};
+	}
+
+	// Debug-draw service: systems add lines, boxes, spheres and frustums during the frame, Draw() uploads them into one dynamic structured buffer
+	// and renders them with one instanced draw (an instance per line, its 2 vertices are fetched by SV_VertexID in DebugLines.hlsl, no vertex buffers).
+	// Lines only live for one frame: they are cleared by Draw() (or Clear() if nothing is drawn).
+	class ER_DebugRenderer : public ER_CoreComponent
+	{
+		RTTI_DECLARATIONS(ER_DebugRenderer, ER_CoreComponent)
+	public:
+		ER_DebugRenderer(ER_Core& game);
+		~ER_DebugRenderer();
+
+		void Init();
+		void Draw(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth);
+		void Clear() { mLines.clear(); }
+
+		void AddLine(const XMFLOAT3& aStart, const XMFLOAT3& aEnd, const XMFLOAT4& aColor);
+		void AddAABB(const ER_AABB& aAABB, const XMFLOAT4& aColor);
+		// 8 corners in the order of ER_Frustum::Corners() (near plane: 0-3, far plane: 4-7), i.e. oriented boxes
+		void AddBox(const XMFLOAT3* aCorners, const XMFLOAT4& aColor);
+		void AddFrustum(const ER_Frustum& aFrustum, const XMFLOAT4& aColor);
+		void AddSphere(const XMFLOAT3& aCenter, float aRadius, const XMFLOAT4& aColor, int aSegments = ER_DEBUG_RENDERER_SPHERE_SEGMENTS);
+
+		int GetLinesCount() const { return static_cast<int>(mLines.size()); }
+		int GetLastFrameLinesCount() const { return mLastFrameLinesCount; }
+		int GetLastFrameDroppedLinesCount() const { return mLastFrameDroppedLinesCount; }
+
+		static UINT PackColor(const XMFLOAT4& aColor);
+
+		// AABBs of aBoxesCount instances on CPU: batching them into lines against the previous path (a vertex buffer update, a constant buffer
+		// update and a draw per box, as in the removed ER_RenderableAABB): timings, GPU commands and uploaded bytes per frame.
+		// Fails if the batched lines are not the 12 edges of their boxes.
+		static bool RunBenchmark(int aBoxesCount, int aFramesCount, std::string& aOutReport);
+	private:
+		std::vector<ER_DebugLine> mLines;
+
+		ER_RHI_GPUShader* mVS = nullptr;
+		ER_RHI_GPUShader* mPS = nullptr;
+		ER_RHI_GPURootSignature* mRootSignature = nullptr;
+		ER_RHI_GPUConstantBuffer<DebugLinesCBufferData::DebugLinesCB> mConstantBuffer;
+		ER_RHI_GPUBuffer* mLinesBuffer = nullptr;
+		UINT mLinesBufferCapacity = 0;
+		const std::string mPSOName = "ER_RHI_GPUPipelineStateObject: Debug Lines";
+
+		int mLastFrameLinesCount = 0;
+		int mLastFrameDroppedLinesCount = 0;
+	};
+}
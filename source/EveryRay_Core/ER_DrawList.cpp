@@ -0,0 +1,264 @@
+#include "stdafx.h"
+
+#include "ER_DrawList.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	static const UINT64 DrawListRootSignatureMask = 0xff;
+	static const UINT64 DrawListPSOMask = 0xfff;
+	static const UINT64 DrawListMaterialMask = 0xffff;
+	static const UINT64 DrawListDepthMask = (1ull << ER_DRAW_LIST_KEY_DEPTH_BITS) - 1;
+
+	ER_DrawList::ER_DrawList()
+	{
+	}
+
+	ER_DrawList::~ER_DrawList()
+	{
+	}
+
+	void ER_DrawList::Clear()
+	{
+		mItems.clear();
+	}
+
+	void ER_DrawList::Sort()
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		const UINT count = static_cast<UINT>(mItems.size());
+		if (mKeys.size() < count)
+		{
+			mKeys.resize(count);
+			mTempKeys.resize(count);
+			mIndices.resize(count);
+			mTempIndices.resize(count);
+		}
+
+		for (UINT i = 0; i < count; i++)
+		{
+			mKeys[i] = mItems[i].SortKey;
+			mIndices[i] = i;
+		}
+		mUnsortedStats = CountStateChanges(mKeys.data(), count);
+
+		RadixSort(mKeys.data(), mIndices.data(), mTempKeys.data(), mTempIndices.data(), count);
+
+		mTempItems.resize(count);
+		for (UINT i = 0; i < count; i++)
+			mTempItems[i] = mItems[mIndices[i]];
+		mItems.swap(mTempItems);
+		mSortedStats = CountStateChanges(mKeys.data(), count);
+
+		auto endTime = std::chrono::high_resolution_clock::now();
+		mSortTimeMs = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+	}
+
+	UINT ER_DrawList::GetRootSignatureID(const ER_RHI_GPURootSignature* aRootSignature)
+	{
+		auto it = mRootSignatureIDs.find(aRootSignature);
+		if (it != mRootSignatureIDs.end())
+			return it->second;
+
+		const UINT id = static_cast<UINT>(mRootSignatureIDs.size());
+		assert(id <= DrawListRootSignatureMask);
+		mRootSignatureIDs.emplace(aRootSignature, id);
+		return id;
+	}
+
+	UINT ER_DrawList::GetPSOID(const std::string& aPSOName)
+	{
+		auto it = mPSOIDs.find(aPSOName);
+		if (it != mPSOIDs.end())
+			return it->second;
+
+		const UINT id = static_cast<UINT>(mPSOIDs.size());
+		assert(id <= DrawListPSOMask);
+		mPSOIDs.emplace(aPSOName, id);
+		return id;
+	}
+
+	UINT ER_DrawList::GetMaterialID(const std::string& aMaterialName)
+	{
+		auto it = mMaterialIDs.find(aMaterialName);
+		if (it != mMaterialIDs.end())
+			return it->second;
+
+		const UINT id = static_cast<UINT>(mMaterialIDs.size());
+		assert(id <= DrawListMaterialMask);
+		mMaterialIDs.emplace(aMaterialName, id);
+		return id;
+	}
+
+	UINT64 ER_DrawList::MakeSortKey(ER_DrawListPass aPass, UINT aRootSignatureID, UINT aPSOID, UINT aMaterialID, float aDepth)
+	{
+		const bool isBlended = IsBlendedPass(aPass);
+		float depth = std::min(std::max(aDepth, 0.0f), 1.0f);
+		if (isBlended)
+			depth = 1.0f - depth;
+		const UINT64 depthBits = static_cast<UINT64>(depth * static_cast<float>(DrawListDepthMask));
+
+		if (isBlended)
+			return (static_cast<UINT64>(aPass) << ER_DRAW_LIST_KEY_PASS_SHIFT) |
+				(depthBits << ER_DRAW_LIST_BLENDED_KEY_DEPTH_SHIFT) |
+				((static_cast<UINT64>(aRootSignatureID) & DrawListRootSignatureMask) << ER_DRAW_LIST_BLENDED_KEY_ROOT_SIGNATURE_SHIFT) |
+				((static_cast<UINT64>(aPSOID) & DrawListPSOMask) << ER_DRAW_LIST_BLENDED_KEY_PSO_SHIFT) |
+				((static_cast<UINT64>(aMaterialID) & DrawListMaterialMask) << ER_DRAW_LIST_BLENDED_KEY_MATERIAL_SHIFT);
+		else
+			return (static_cast<UINT64>(aPass) << ER_DRAW_LIST_KEY_PASS_SHIFT) |
+				((static_cast<UINT64>(aRootSignatureID) & DrawListRootSignatureMask) << ER_DRAW_LIST_KEY_ROOT_SIGNATURE_SHIFT) |
+				((static_cast<UINT64>(aPSOID) & DrawListPSOMask) << ER_DRAW_LIST_KEY_PSO_SHIFT) |
+				((static_cast<UINT64>(aMaterialID) & DrawListMaterialMask) << ER_DRAW_LIST_KEY_MATERIAL_SHIFT) |
+				depthBits;
+	}
+
+	UINT64 ER_DrawList::GetStateKey(UINT64 aSortKey)
+	{
+		const UINT64 passBits = aSortKey & (~0ull << ER_DRAW_LIST_KEY_PASS_SHIFT);
+		if (!IsBlendedPass(static_cast<ER_DrawListPass>(aSortKey >> ER_DRAW_LIST_KEY_PASS_SHIFT)))
+			return aSortKey & ~DrawListDepthMask;
+
+		// root signature, PSO and material are in the same order in both layouts, only lower
+		const UINT64 stateBits = aSortKey & ((1ull << ER_DRAW_LIST_BLENDED_KEY_DEPTH_SHIFT) - 1);
+		return passBits | (stateBits << ER_DRAW_LIST_KEY_MATERIAL_SHIFT);
+	}
+
+	float ER_DrawList::GetNormalizedDepth(const XMFLOAT3& aCameraPosition, float aFarPlaneDistance, const ER_AABB& aAABB)
+	{
+		const float dx = (aAABB.first.x + aAABB.second.x) * 0.5f - aCameraPosition.x;
+		const float dy = (aAABB.first.y + aAABB.second.y) * 0.5f - aCameraPosition.y;
+		const float dz = (aAABB.first.z + aAABB.second.z) * 0.5f - aCameraPosition.z;
+		return sqrtf(dx * dx + dy * dy + dz * dz) / aFarPlaneDistance;
+	}
+
+	ER_DrawListStats ER_DrawList::CountStateChanges(const UINT64* aKeys, UINT aCount)
+	{
+		ER_DrawListStats stats;
+		stats.Draws = aCount;
+		for (UINT i = 0; i < aCount; i++)
+		{
+			// a different pass or root signature also means a different PSO (and a different PSO - a different material setup)
+			const UINT64 current = GetStateKey(aKeys[i]);
+			const UINT64 previous = (i > 0) ? GetStateKey(aKeys[i - 1]) : ~current;
+			const UINT64 changed = previous ^ current;
+			if (changed >> ER_DRAW_LIST_KEY_ROOT_SIGNATURE_SHIFT)
+				stats.RootSignatureChanges++;
+			if (changed >> ER_DRAW_LIST_KEY_PSO_SHIFT)
+				stats.PSOChanges++;
+			if (changed >> ER_DRAW_LIST_KEY_MATERIAL_SHIFT)
+				stats.MaterialChanges++;
+		}
+		return stats;
+	}
+
+	void ER_DrawList::RadixSort(UINT64* aKeys, UINT* aIndices, UINT64* aTempKeys, UINT* aTempIndices, UINT aCount)
+	{
+		if (aCount < 2)
+			return;
+
+		// all 8 histograms in one pass over the keys
+		UINT histograms[8][256] = {};
+		for (UINT i = 0; i < aCount; i++)
+		{
+			const UINT64 key = aKeys[i];
+			for (int digit = 0; digit < 8; digit++)
+				histograms[digit][(key >> (digit * 8)) & 0xff]++;
+		}
+
+		UINT64* keys = aKeys;
+		UINT* indices = aIndices;
+		UINT64* tempKeys = aTempKeys;
+		UINT* tempIndices = aTempIndices;
+		for (int digit = 0; digit < 8; digit++)
+		{
+			UINT* histogram = histograms[digit];
+			const int shift = digit * 8;
+			if (histogram[(keys[0] >> shift) & 0xff] == aCount)
+				continue; // the same digit in all keys (i.e. unused ids or a single pass)
+
+			UINT offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++)
+			{
+				const UINT bucketCount = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketCount;
+			}
+
+			for (UINT i = 0; i < aCount; i++)
+			{
+				const UINT destination = histogram[(keys[i] >> shift) & 0xff]++;
+				tempKeys[destination] = keys[i];
+				tempIndices[destination] = indices[i];
+			}
+			std::swap(keys, tempKeys);
+			std::swap(indices, tempIndices);
+		}
+
+		if (keys != aKeys)
+		{
+			memcpy(aKeys, keys, aCount * sizeof(UINT64));
+			memcpy(aIndices, indices, aCount * sizeof(UINT));
+		}
+	}
+
+	bool ER_DrawList::RunBenchmark(int aItemsCount, int aFramesCount, std::string& aOutReport)
+	{
+		const int objectsPerMaterial = 16;
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+
+		// scene-like keys: objects in their scene order, a few root signatures/PSOs, materials shared by several objects, random depths
+		std::vector<UINT64> unsortedKeys(aItemsCount);
+		std::vector<ER_DrawListPass> passes(aItemsCount);
+		std::vector<UINT> materials(aItemsCount);
+		for (int i = 0; i < aItemsCount; i++)
+		{
+			passes[i] = (random.NextInt(0, 8) == 0) ? ER_DRAW_LIST_PASS_FORWARD_LAYERED : ER_DRAW_LIST_PASS_FORWARD;
+			materials[i] = static_cast<UINT>(random.NextInt(0, std::max(1, aItemsCount / objectsPerMaterial)));
+			unsortedKeys[i] = MakeSortKey(passes[i], materials[i] % 4, materials[i] % 32, materials[i], random.NextFloat());
+		}
+		const ER_DrawListStats unsortedStats = CountStateChanges(unsortedKeys.data(), aItemsCount);
+
+		std::vector<UINT64> keys(aItemsCount), tempKeys(aItemsCount);
+		std::vector<UINT> indices(aItemsCount), tempIndices(aItemsCount), referenceIndices(aItemsCount);
+		double radixTime = 0.0;
+		double referenceTime = 0.0;
+		int mismatches = 0;
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			for (int i = 0; i < aItemsCount; i++)
+			{
+				keys[i] = unsortedKeys[i];
+				indices[i] = static_cast<UINT>(i);
+				referenceIndices[i] = static_cast<UINT>(i);
+			}
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			RadixSort(keys.data(), indices.data(), tempKeys.data(), tempIndices.data(), static_cast<UINT>(aItemsCount));
+			auto endTime = std::chrono::high_resolution_clock::now();
+			radixTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+			startTime = std::chrono::high_resolution_clock::now();
+			std::stable_sort(referenceIndices.begin(), referenceIndices.end(), [&unsortedKeys](UINT a, UINT b) { return unsortedKeys[a] < unsortedKeys[b]; });
+			endTime = std::chrono::high_resolution_clock::now();
+			referenceTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+			for (int i = 0; i < aItemsCount; i++)
+			{
+				if (indices[i] != referenceIndices[i] || keys[i] != unsortedKeys[referenceIndices[i]])
+					mismatches++;
+			}
+
+			// next frame: depths change a bit
+			for (int i = 0; i < aItemsCount; i += 7)
+				unsortedKeys[i] = MakeSortKey(passes[i], materials[i] % 4, materials[i] % 32, materials[i], random.NextFloat());
+		}
+		const ER_DrawListStats sortedStats = CountStateChanges(keys.data(), aItemsCount);
+
+		aOutReport = std::to_string(aItemsCount) + " draws, " + std::to_string(aFramesCount) + " frames\n" +
+			"radix sort: " + std::to_string(radixTime / aFramesCount) + " ms, std::stable_sort: " + std::to_string(referenceTime / aFramesCount) + " ms, mismatches: " + std::to_string(mismatches) + "\n" +
+			"root signature/PSO/material changes: " + std::to_string(unsortedStats.RootSignatureChanges) + "/" + std::to_string(unsortedStats.PSOChanges) + "/" + std::to_string(unsortedStats.MaterialChanges) +
+			" unsorted, " + std::to_string(sortedStats.RootSignatureChanges) + "/" + std::to_string(sortedStats.PSOChanges) + "/" + std::to_string(sortedStats.MaterialChanges) + " sorted";
+		return mismatches == 0;
+	}
+}
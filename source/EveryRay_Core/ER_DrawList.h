@@ -0,0 +1,106 @@
+#pragma once
+#include "Common.h"
+
+#define ER_DRAW_LIST_BENCHMARK_ITEMS 10000
+#define ER_DRAW_LIST_BENCHMARK_FRAMES 100
+
+// 64-bit sort key, from the most significant bits: pass (4) | root signature (8) | PSO (12) | material (16) | depth (24)
+#define ER_DRAW_LIST_KEY_PASS_SHIFT 60
+#define ER_DRAW_LIST_KEY_ROOT_SIGNATURE_SHIFT 52
+#define ER_DRAW_LIST_KEY_PSO_SHIFT 40
+#define ER_DRAW_LIST_KEY_MATERIAL_SHIFT 24
+#define ER_DRAW_LIST_KEY_DEPTH_BITS 24
+// Blended passes must be drawn back to front regardless of their state, so depth goes right under the pass:
+// pass (4) | depth (24) | root signature (8) | PSO (12) | material (16)
+#define ER_DRAW_LIST_BLENDED_KEY_DEPTH_SHIFT 36
+#define ER_DRAW_LIST_BLENDED_KEY_ROOT_SIGNATURE_SHIFT 28
+#define ER_DRAW_LIST_BLENDED_KEY_PSO_SHIFT 16
+#define ER_DRAW_LIST_BLENDED_KEY_MATERIAL_SHIFT 0
+
+namespace EveryRay_Core
+{
+	class ER_RenderingObject;
+	class ER_RHI_GPURootSignature;
+
+	// Order of the passes in the key (lower passes are submitted first)
+	enum ER_DrawListPass
+	{
+		ER_DRAW_LIST_PASS_GBUFFER = 0,
+		ER_DRAW_LIST_PASS_FORWARD,
+		ER_DRAW_LIST_PASS_FORWARD_TRANSPARENT, // blended
+		ER_DRAW_LIST_PASS_FORWARD_LAYERED // blended: standard materials layered onto already rendered objects (snow, fur, outlines etc.)
+	};
+
+	struct ER_DrawItem
+	{
+		UINT64 SortKey = 0;
+		ER_RenderingObject* Object = nullptr;
+		const std::string* MaterialName = nullptr; // key in the object's materials
+		const std::string* PSOName = nullptr; // nullptr if the material sets its own PSO
+		ER_RHI_GPURootSignature* RootSignature = nullptr;
+	};
+
+	// State changes needed to submit the items in their order (the first item counts as a change of everything)
+	struct ER_DrawListStats
+	{
+		UINT Draws = 0;
+		UINT RootSignatureChanges = 0;
+		UINT PSOChanges = 0;
+		UINT MaterialChanges = 0;
+	};
+
+	// Per-frame list of draws of a pass (or several passes), sorted by a packed key with a radix sort, so that draws sharing a root signature,
+	// a PSO and a material are submitted next to each other (and their state is only set once). Ids in the key are small integers
+	// registered on first use and kept between frames. Does not touch the RHI, so sorting can be tested and benchmarked without a device.
+	class ER_DrawList
+	{
+	public:
+		ER_DrawList();
+		~ER_DrawList();
+
+		void Clear(); // keeps the capacity (no allocations in the following frames)
+		void Add(const ER_DrawItem& aItem) { mItems.push_back(aItem); }
+
+		// Sorts the items by their keys (stable) and updates the stats of both orders
+		void Sort();
+		const std::vector<ER_DrawItem>& GetItems() const { return mItems; }
+
+		const ER_DrawListStats& GetUnsortedStats() const { return mUnsortedStats; }
+		const ER_DrawListStats& GetSortedStats() const { return mSortedStats; }
+		float GetSortTime() const { return mSortTimeMs; }
+
+		UINT GetRootSignatureID(const ER_RHI_GPURootSignature* aRootSignature);
+		UINT GetPSOID(const std::string& aPSOName);
+		UINT GetMaterialID(const std::string& aMaterialName);
+
+		// aDepth is normalized to [0, 1] (i.e. distance / far plane): front to back inside state groups,
+		// or back to front across state groups for blended passes (see ER_DRAW_LIST_BLENDED_KEY_*)
+		static UINT64 MakeSortKey(ER_DrawListPass aPass, UINT aRootSignatureID, UINT aPSOID, UINT aMaterialID, float aDepth);
+		// Key without its depth, in the layout of non-blended passes (equal state keys share pass, root signature, PSO and material)
+		static UINT64 GetStateKey(UINT64 aSortKey);
+		static bool IsBlendedPass(ER_DrawListPass aPass) { return aPass == ER_DRAW_LIST_PASS_FORWARD_TRANSPARENT || aPass == ER_DRAW_LIST_PASS_FORWARD_LAYERED; }
+		static float GetNormalizedDepth(const XMFLOAT3& aCameraPosition, float aFarPlaneDistance, const ER_AABB& aAABB); // of the AABB's center
+		static ER_DrawListStats CountStateChanges(const UINT64* aKeys, UINT aCount);
+
+		// LSD radix sort (8-bit digits) of keys with their indices; digits which are the same in all keys are skipped
+		static void RadixSort(UINT64* aKeys, UINT* aIndices, UINT64* aTempKeys, UINT* aTempIndices, UINT aCount);
+
+		// Sorts random keys of a scene-like distribution with RadixSort() and std::stable_sort (timings, state changes and mismatches, which must be 0)
+		static bool RunBenchmark(int aItemsCount, int aFramesCount, std::string& aOutReport);
+	private:
+		std::vector<ER_DrawItem> mItems;
+		std::vector<ER_DrawItem> mTempItems;
+		std::vector<UINT64> mKeys;
+		std::vector<UINT64> mTempKeys;
+		std::vector<UINT> mIndices;
+		std::vector<UINT> mTempIndices;
+
+		std::unordered_map<const ER_RHI_GPURootSignature*, UINT> mRootSignatureIDs;
+		std::unordered_map<std::string, UINT> mPSOIDs;
+		std::unordered_map<std::string, UINT> mMaterialIDs;
+
+		ER_DrawListStats mUnsortedStats;
+		ER_DrawListStats mSortedStats;
+		float mSortTimeMs = 0.0f;
+	};
+}
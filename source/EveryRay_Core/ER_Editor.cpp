@@ -8,11 +8,20 @@
 #include "ER_RenderingObject.h"
 #include "ER_Utility.h"
 #include "ER_Scene.h"
+#include "ER_Terrain.h"
+#include "ER_Camera.h"
+#include "ER_SelfTests.h"
 
 namespace EveryRay_Core
 {
 	RTTI_DEFINITIONS(ER_Editor)
-	static int selectedObjectIndex = -1;
+
+	static std::string ToLowercase(const std::string& aText)
+	{
+		std::string result(aText);
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+		return result;
+	}
 	
 	ER_Editor::ER_Editor(ER_Core& game)
 		: ER_CoreComponent(game)
@@ -31,6 +40,161 @@ namespace EveryRay_Core
 	void ER_Editor::LoadScene(ER_Scene* scene)
 	{
 		mScene = scene;
+		mSelectedObject = ER_RenderingObjectHandle();
+		mIsEditorObjectsListDirty = true;
+	}
+
+	// Sorted by name, so the filter can narrow its results without touching the scene
+	void ER_Editor::RebuildObjectsList()
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		const ER_RenderingObjectRegistry& registry = mScene->GetRenderingObjectsRegistry();
+		mEditorObjects.clear();
+		mEditorObjects.reserve(registry.GetCount());
+		for (int i = 0; i < registry.GetCount(); i++)
+		{
+			if (!registry.GetObjectByDenseIndex(i)->IsAvailableInEditor())
+				continue;
+
+			EditorObjectEntry entry;
+			entry.Name = registry.GetNameByDenseIndex(i);
+			entry.LowercaseName = ToLowercase(entry.Name);
+			entry.Handle = registry.GetHandleByDenseIndex(i);
+			mEditorObjects.push_back(entry);
+		}
+		std::sort(mEditorObjects.begin(), mEditorObjects.end(), [](const EditorObjectEntry& a, const EditorObjectEntry& b) { return a.LowercaseName < b.LowercaseName; });
+
+		mEditorObjectsVersion = registry.GetVersion();
+		mIsEditorObjectsListDirty = false;
+		UpdateObjectsFilter(true);
+
+		auto endTime = std::chrono::high_resolution_clock::now();
+		mEditorObjectsListUpdateTime = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+	}
+
+	// If the new filter contains the previous one, only the previous results can match (typing narrows the list without a full search)
+	void ER_Editor::UpdateObjectsFilter(bool aForceFullSearch)
+	{
+		const std::string filter = ToLowercase(mEditorFilter);
+		const bool isRefining = !aForceFullSearch && !mEditorAppliedFilter.empty() && filter.find(mEditorAppliedFilter) != std::string::npos;
+		mEditorAppliedFilter = filter;
+
+		if (filter.empty())
+		{
+			mEditorFilteredObjects.resize(mEditorObjects.size());
+			for (int i = 0; i < static_cast<int>(mEditorObjects.size()); i++)
+				mEditorFilteredObjects[i] = i;
+			return;
+		}
+
+		if (isRefining)
+		{
+			auto it = std::remove_if(mEditorFilteredObjects.begin(), mEditorFilteredObjects.end(),
+				[this, &filter](int index) { return mEditorObjects[index].LowercaseName.find(filter) == std::string::npos; });
+			mEditorFilteredObjects.erase(it, mEditorFilteredObjects.end());
+			return;
+		}
+
+		mEditorFilteredObjects.clear();
+		for (int i = 0; i < static_cast<int>(mEditorObjects.size()); i++)
+		{
+			if (mEditorObjects[i].LowercaseName.find(filter) != std::string::npos)
+				mEditorFilteredObjects.push_back(i);
+		}
+	}
+
+	void ER_Editor::SelectObject(const ER_RenderingObjectHandle& aHandle)
+	{
+		if (ER_RenderingObject* previousObject = mScene->GetRenderingObject(mSelectedObject))
+			previousObject->SetSelected(false);
+
+		mSelectedObject = aHandle;
+		if (ER_RenderingObject* object = mScene->GetRenderingObject(mSelectedObject))
+			object->SetSelected(true);
+	}
+
+	// Only the visible rows are submitted (clipped), selection is stored by handle
+	void ER_Editor::ShowObjectsList()
+	{
+		if (mIsEditorObjectsListDirty || mEditorObjectsVersion != mScene->GetRenderingObjectsRegistry().GetVersion())
+			RebuildObjectsList();
+
+		ImGui::PushItemWidth(-1);
+		if (ImGui::Button("Deselect"))
+			SelectObject(ER_RenderingObjectHandle());
+		ImGui::SameLine();
+		if (ImGui::Button("Delete selected") && mScene->RemoveRenderingObject(mSelectedObject))
+			mSelectedObject = ER_RenderingObjectHandle(); // registry's version has changed, so the list is rebuilt below
+
+		if (ImGui::InputTextWithHint("##filter", "Filter by name", mEditorFilter, ER_EDITOR_FILTER_MAX_LENGTH))
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			UpdateObjectsFilter(false);
+			auto endTime = std::chrono::high_resolution_clock::now();
+			mEditorObjectsListUpdateTime = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+		}
+		ImGui::Text("Objects: %d/%d (list updated in %.3f ms)", static_cast<int>(mEditorFilteredObjects.size()), static_cast<int>(mEditorObjects.size()), mEditorObjectsListUpdateTime);
+
+		const int filteredCount = static_cast<int>(mEditorFilteredObjects.size());
+		if (ImGui::ListBoxHeader("##empty", filteredCount, ER_EDITOR_LIST_HEIGHT_IN_ITEMS))
+		{
+			ImGuiListClipper clipper(filteredCount);
+			while (clipper.Step())
+			{
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+				{
+					const EditorObjectEntry& entry = mEditorObjects[mEditorFilteredObjects[i]];
+					ImGui::PushID(i);
+					if (ImGui::Selectable(entry.Name.c_str(), entry.Handle == mSelectedObject))
+						SelectObject(entry.Handle);
+					ImGui::PopID();
+				}
+			}
+			ImGui::ListBoxFooter();
+		}
+		ImGui::PopItemWidth();
+	}
+
+	// Segment from the near to the far plane through the mouse cursor, tested against the terrain's full resolution heights (see ER_Terrain::Raycast())
+	void ER_Editor::PickTerrain()
+	{
+		ER_Terrain* terrain = mCore->GetLevel()->mTerrain;
+		ER_Camera* camera = (ER_Camera*)(mCore->GetServices().FindService(ER_Camera::TypeIdClass()));
+		if (!terrain || !terrain->IsLoaded() || !camera)
+			return;
+
+		const ImGuiIO& io = ImGui::GetIO();
+		const float ndcX = io.MousePos.x / io.DisplaySize.x * 2.0f - 1.0f;
+		const float ndcY = 1.0f - io.MousePos.y / io.DisplaySize.y * 2.0f;
+		const XMMATRIX invViewProjection = XMMatrixInverse(nullptr, camera->ViewProjectionMatrix());
+		XMFLOAT3 start, end;
+		XMStoreFloat3(&start, XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 0.0f, 1.0f), invViewProjection));
+		XMStoreFloat3(&end, XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 1.0f, 1.0f), invViewProjection));
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		mIsTerrainPicked = terrain->IsColliding(start, end, &mTerrainPickedPosition);
+		auto endTime = std::chrono::high_resolution_clock::now();
+		mTerrainPickTime = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+	}
+
+	void ER_Editor::ShowTerrainPicking()
+	{
+		ImGui::Checkbox("Pick with middle mouse button", &mIsTerrainPickingEnabled);
+		if (!mIsTerrainPicked)
+		{
+			ImGui::Text("Nothing picked");
+			return;
+		}
+
+		ImGui::Text("Picked: (%.2f, %.2f, %.2f) in %.3f ms", mTerrainPickedPosition.x, mTerrainPickedPosition.y, mTerrainPickedPosition.z, mTerrainPickTime);
+		ER_RenderingObject* object = mScene->GetRenderingObject(mSelectedObject);
+		if (object && !object->IsInstanced() && ImGui::Button("Move selected object to the picked point"))
+		{
+			XMMATRIX transform = object->GetTransformationMatrix();
+			ER_MatrixHelper::SetTranslation(transform, mTerrainPickedPosition);
+			object->SetTransformationMatrix(transform);
+		}
 	}
 
 	void ER_Editor::Update(const ER_CoreTime& gameTime)
@@ -64,44 +228,73 @@ namespace EveryRay_Core
 				ImGui::SliderFloat("LOD #1 distance", &ER_Utility::DistancesLOD[1], ER_Utility::DistancesLOD[0], 1000.0f);
 				ImGui::SliderFloat("LOD #2 distance", &ER_Utility::DistancesLOD[2], ER_Utility::DistancesLOD[1], 5000.0f);
 				//add more if needed
+				ImGui::Text("Instances binning (CPU culling + LODs): %d objects, %d instances, %d thread(s), %.3f ms", mScene->GetInstanceBinningObjectsCount(),
+					mScene->GetInstanceBinningInstancesCount(), mScene->GetInstanceBinningThreadsCount(), mScene->GetInstanceBinningTime());
 			}
 			if (ImGui::Button("Save transforms")) {
 				mScene->SaveRenderingObjectsTransforms();
 			}
-
-			int objectIndex = 0;
-			int objectsSize = 0;
-			for (auto& object : mScene->objects) {
-				if (object.second->IsAvailableInEditor())
+			if (ImGui::CollapsingHeader("Objects Memory"))
+			{
+				RenderingObjectMemoryReport totalReport;
+				UINT64 largestObjectMemory = 0;
+				std::string largestObjectName;
+				for (auto& object : mScene->GetRenderingObjects())
 				{
-					editorObjectsNames[objectIndex] = object.first.c_str();
-					objectIndex++;
+					const RenderingObjectMemoryReport report = object.second->GetMemoryReport();
+					totalReport.Object += report.Object;
+					totalReport.InstanceData += report.InstanceData;
+					totalReport.MeshData += report.MeshData;
+					totalReport.EditorData += report.EditorData;
+					if (report.GetTotal() > largestObjectMemory)
+					{
+						largestObjectMemory = report.GetTotal();
+						largestObjectName = object.first;
+					}
 				}
+				ImGui::Text("Objects: %d, CPU memory: %.2f MB", static_cast<int>(mScene->GetRenderingObjects().size()), totalReport.GetTotal() / (1024.0f * 1024.0f));
+				ImGui::Text("Object: %.2f MB, instances: %.2f MB, meshes: %.2f MB, editor: %.2f MB", totalReport.Object / (1024.0f * 1024.0f),
+					totalReport.InstanceData / (1024.0f * 1024.0f), totalReport.MeshData / (1024.0f * 1024.0f), totalReport.EditorData / (1024.0f * 1024.0f));
+				if (!largestObjectName.empty())
+					ImGui::Text("Largest: %s (%.1f KB)", largestObjectName.c_str(), largestObjectMemory / 1024.0f);
 			}
-			objectsSize = objectIndex;
-
-			ImGui::PushItemWidth(-1);
-			if (ImGui::Button("Deselect")) {
-				selectedObjectIndex = -1;
+			if (ImGui::CollapsingHeader("Transform Hierarchy"))
+			{
+				const ER_TransformHierarchy& hierarchy = mScene->GetTransformHierarchy();
+				ImGui::Text("Nodes: %d, updated in the last frame: %d", hierarchy.GetNodesCount(), static_cast<int>(hierarchy.GetChangedNodes().size()));
+				if (ImGui::Button("Run benchmark (100k nodes, 1% dirty)"))
+					ER_SelfTests::Run(ER_SELF_TEST_TRANSFORM_HIERARCHY, mTransformHierarchyBenchmarkResult);
+				if (!mTransformHierarchyBenchmarkResult.empty())
+					ImGui::TextWrapped(mTransformHierarchyBenchmarkResult.c_str());
 			}
-			ImGui::ListBox("##empty", &selectedObjectIndex, editorObjectsNames, objectsSize);
 
-			for (size_t i = 0; i < objectsSize; i++)
+			if (ImGui::CollapsingHeader("Compact Instance Data"))
 			{
-				if (i == selectedObjectIndex)
-				{
-					auto renderingObject = mScene->FindRenderingObjectByName(editorObjectsNames[selectedObjectIndex]);
-					if (renderingObject)
-						renderingObject->SetSelected(true);
-				}
-				else
+				int compactObjectsCount = 0;
+				int instancedObjectsCount = 0;
+				for (auto& object : mScene->GetRenderingObjects())
 				{
-					auto renderingObject = mScene->FindRenderingObjectByName(editorObjectsNames[i]);
-					if (renderingObject)
-						renderingObject->SetSelected(false);
+					if (!object.second->IsInstanced())
+						continue;
+					instancedObjectsCount++;
+					if (object.second->IsCompactInstanceData())
+						compactObjectsCount++;
 				}
+				ImGui::Text("Instanced objects with compact data: %d/%d (%d bytes per instance instead of %d)", compactObjectsCount, instancedObjectsCount,
+					static_cast<int>(sizeof(InstancedDataCompact)), static_cast<int>(sizeof(InstancedData)));
+				if (ImGui::Button("Run precision check (100k random transforms)"))
+					ER_SelfTests::Run(ER_SELF_TEST_COMPACT_INSTANCE_DATA, mCompactInstanceDataCheckResult);
+				if (!mCompactInstanceDataCheckResult.empty())
+					ImGui::TextWrapped(mCompactInstanceDataCheckResult.c_str());
 			}
 
+			if (ImGui::CollapsingHeader("Terrain Picking"))
+				ShowTerrainPicking();
+			if (mIsTerrainPickingEnabled && ImGui::IsMouseClicked(2) && !ImGui::GetIO().WantCaptureMouse)
+				PickTerrain();
+
+			ShowObjectsList();
+
 			ImGui::End();
 		}
 
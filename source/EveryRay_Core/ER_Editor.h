@@ -2,8 +2,10 @@
 #pragma once
 
 #include "ER_CoreComponent.h"
-#define MAX_OBJECTS_COUNT 1000
+#include "ER_RenderingObjectRegistry.h"
 #define MAX_LOD 3
+#define ER_EDITOR_FILTER_MAX_LENGTH 128
+#define ER_EDITOR_LIST_HEIGHT_IN_ITEMS 12
 
 namespace EveryRay_Core
 {
@@ -11,6 +13,14 @@ namespace EveryRay_Core
 	class ER_CoreTime;
 	class ER_Scene;
 
+	// Object of the editor's list: the list is sorted by name and only rebuilt when the scene's objects change
+	struct EditorObjectEntry
+	{
+		std::string Name;
+		std::string LowercaseName; // for the filter
+		ER_RenderingObjectHandle Handle;
+	};
+
 	class ER_Editor : public ER_CoreComponent
 	{
 		RTTI_DECLARATIONS(ER_Editor, ER_CoreComponent)
@@ -34,12 +44,34 @@ namespace EveryRay_Core
 		ER_Editor(const ER_Editor& rhs);
 		ER_Editor& operator=(const ER_Editor& rhs);
 
-		const char* editorObjectsNames[MAX_OBJECTS_COUNT];
+		void RebuildObjectsList();
+		void UpdateObjectsFilter(bool aForceFullSearch);
+		void SelectObject(const ER_RenderingObjectHandle& aHandle);
+		void ShowObjectsList();
+		void PickTerrain();
+		void ShowTerrainPicking();
+
+		std::vector<EditorObjectEntry> mEditorObjects;
+		std::vector<int> mEditorFilteredObjects; // into mEditorObjects
+		char mEditorFilter[ER_EDITOR_FILTER_MAX_LENGTH] = {};
+		std::string mEditorAppliedFilter; // lowercase, the one mEditorFilteredObjects were built with
+		UINT mEditorObjectsVersion = 0; // of the registry
+		bool mIsEditorObjectsListDirty = true;
+		float mEditorObjectsListUpdateTime = 0.0f; // ms, last rebuild or filter
+		ER_RenderingObjectHandle mSelectedObject;
+
+		XMFLOAT3 mTerrainPickedPosition = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float mTerrainPickTime = 0.0f; // ms
+		bool mIsTerrainPicked = false;
+		bool mIsTerrainPickingEnabled = false;
 
 		bool mUseCustomSkyboxColor = true;
 		float mBottomColorSky[4] = {245.0f / 255.0f, 245.0f / 255.0f, 245.0f / 255.0f, 1.0f};
 		float mTopColorSky[4] = { 0.0f / 255.0f, 133.0f / 255.0f, 191.0f / 255.0f, 1.0f };
 		float mSkyMinHeight = 0.191f;
 		float mSkyMaxHeight = 4.2f;
+
+		std::string mTransformHierarchyBenchmarkResult;
+		std::string mCompactInstanceDataCheckResult;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+
+#include "ER_FoliageDensityBudget.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	ER_FoliageDensityBudget::ER_FoliageDensityBudget()
+	{
+	}
+
+	ER_FoliageDensityBudget::~ER_FoliageDensityBudget()
+	{
+	}
+
+	float ER_FoliageDensityBudget::GetWeight(const FoliageBudgetZoneInput& aZone)
+	{
+		// never 0, so that a zone with candidates always gets something when there is budget left
+		const float distanceFactor = 1.0f / (1.0f + std::max(0.0f, aZone.Distance) / FOLIAGE_BUDGET_DISTANCE_FALLOFF);
+		return std::max(aZone.ScreenCoverage, 1e-6f) * distanceFactor;
+	}
+
+	void ER_FoliageDensityBudget::Solve(const FoliageBudgetZoneInput* aZones, int aZonesCount, int aBudget, float* aOutScales)
+	{
+		UINT64 requested = 0;
+		for (int i = 0; i < aZonesCount; i++)
+		{
+			aOutScales[i] = 1.0f;
+			requested += std::max(0, aZones[i].CandidateInstances);
+		}
+		if (requested <= static_cast<UINT64>(std::max(0, aBudget)))
+			return;
+
+		// Zones in the order they get saturated (candidates / weight ascending): while a zone needs less than its share, it takes all it needs
+		// and the rest is split between the remaining ones. Once a zone needs more, so do all the following ones: they share the rest by weight.
+		std::vector<int> zones;
+		std::vector<float> weights(aZonesCount);
+		double remainingWeight = 0.0;
+		for (int i = 0; i < aZonesCount; i++)
+		{
+			weights[i] = GetWeight(aZones[i]);
+			if (aZones[i].CandidateInstances > 0)
+			{
+				zones.push_back(i);
+				remainingWeight += weights[i];
+			}
+		}
+		std::sort(zones.begin(), zones.end(), [&](int a, int b)
+		{
+			const double keyA = aZones[a].CandidateInstances / static_cast<double>(weights[a]);
+			const double keyB = aZones[b].CandidateInstances / static_cast<double>(weights[b]);
+			return (keyA != keyB) ? keyA < keyB : a < b;
+		});
+
+		double remainingBudget = static_cast<double>(std::max(0, aBudget));
+		for (int zone : zones)
+		{
+			const double candidates = static_cast<double>(aZones[zone].CandidateInstances);
+			const double share = remainingBudget * weights[zone] / remainingWeight;
+			const double allocated = std::min(candidates, share);
+
+			aOutScales[zone] = std::min(1.0f, std::max(0.0f, static_cast<float>(allocated / candidates)));
+			remainingBudget = std::max(0.0, remainingBudget - allocated);
+			remainingWeight -= weights[zone];
+			if (remainingWeight <= 0.0)
+				remainingWeight = 1e-12;
+		}
+	}
+
+	void ER_FoliageDensityBudget::Update(const std::vector<FoliageBudgetZoneInput>& aZones, float aDeltaTime)
+	{
+		const int zonesCount = static_cast<int>(aZones.size());
+		if (static_cast<int>(mScales.size()) != zonesCount)
+			mScales.resize(zonesCount, 1.0f);
+		mTargetScales.resize(zonesCount);
+
+		mRequestedInstances = 0;
+		for (const auto& zone : aZones)
+			mRequestedInstances += zone.CandidateInstances;
+
+		if (zonesCount == 0)
+			return;
+		Solve(aZones.data(), zonesCount, mBudget, mTargetScales.data());
+
+		const float maxDown = FOLIAGE_BUDGET_SCALE_DOWN_RATE * aDeltaTime;
+		const float maxUp = FOLIAGE_BUDGET_SCALE_UP_RATE * aDeltaTime;
+		for (int i = 0; i < zonesCount; i++)
+		{
+			const float target = mTargetScales[i];
+			float& scale = mScales[i];
+			if (aZones[i].CandidateInstances == 0)
+				scale = target; // nothing visible, nothing to pop
+			else if (target < scale)
+				scale = std::max(target, scale - maxDown);
+			else if (target >= 1.0f || target > scale + FOLIAGE_BUDGET_HYSTERESIS)
+				scale = std::min(target, scale + maxUp);
+		}
+	}
+
+	// Solves random synthetic zone layouts (same seed every time): the budget must never be exceeded, must be used completely when it is not enough
+	// and the result must not depend on the order of the zones
+	bool ER_FoliageDensityBudget::RunSolverCheck(int aLayoutsCount, std::string& aOutReport)
+	{
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		std::vector<FoliageBudgetZoneInput> zones, zonesReversed;
+		std::vector<float> scales, scalesReversed;
+		int failedLayouts = 0;
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int layout = 0; layout < aLayoutsCount; layout++)
+		{
+			const int zonesCount = random.NextInt(1, 256);
+			const int budget = random.NextInt(0, 2000000);
+			zones.resize(zonesCount);
+			for (auto& zone : zones)
+			{
+				zone.CandidateInstances = random.NextInt(0, 100000);
+				zone.ScreenCoverage = random.NextFloat();
+				zone.Distance = random.NextFloat(0.0f, 1500.0f);
+			}
+			zonesReversed.assign(zones.rbegin(), zones.rend());
+
+			scales.resize(zonesCount);
+			scalesReversed.resize(zonesCount);
+			Solve(zones.data(), zonesCount, budget, scales.data());
+			Solve(zonesReversed.data(), zonesCount, budget, scalesReversed.data());
+
+			double requested = 0.0, allocated = 0.0;
+			bool isOrderIndependent = true;
+			for (int i = 0; i < zonesCount; i++)
+			{
+				requested += zones[i].CandidateInstances;
+				allocated += zones[i].CandidateInstances * static_cast<double>(scales[i]);
+				isOrderIndependent = isOrderIndependent && fabs(scales[i] - scalesReversed[zonesCount - 1 - i]) <= 1e-5f;
+			}
+			const double expected = std::min(requested, static_cast<double>(budget));
+			if (!isOrderIndependent || allocated > budget + 1.0 || allocated < expected * 0.999 - 1.0)
+				failedLayouts++;
+		}
+		auto endTime = std::chrono::high_resolution_clock::now();
+
+		aOutReport = std::to_string(aLayoutsCount) + " layouts, failed: " + std::to_string(failedLayouts) + " (" +
+			std::to_string(std::chrono::duration<double, std::milli>(endTime - startTime).count()) + " ms)";
+		return failedLayouts == 0;
+	}
+}
\ No newline at end of file
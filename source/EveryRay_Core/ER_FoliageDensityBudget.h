@@ -0,0 +1,54 @@
+#pragma once
+#include "Common.h"
+
+// Default amount of foliage instances drawn per frame (all zones together) on the highest quality preset
+#define FOLIAGE_DEFAULT_INSTANCE_BUDGET 400000
+// Distance at which the zone's weight (on top of its screen coverage) is halved
+#define FOLIAGE_BUDGET_DISTANCE_FALLOFF 200.0f
+// Density scale only grows when the target is higher than the current scale by this much (or when the zone gets its full density back)
+#define FOLIAGE_BUDGET_HYSTERESIS 0.05f
+// Max change of the density scale per second (reducing is faster, so that the budget is not exceeded for long)
+#define FOLIAGE_BUDGET_SCALE_UP_RATE 0.5f
+#define FOLIAGE_BUDGET_SCALE_DOWN_RATE 4.0f
+
+namespace EveryRay_Core
+{
+	struct FoliageBudgetZoneInput
+	{
+		int CandidateInstances = 0; // visible instances of the zone after culling and distance LOD (at full density)
+		float ScreenCoverage = 0.0f; // [0-1] part of the screen covered by the visible cells
+		float Distance = 0.0f; // from the camera to the closest visible cell
+	};
+
+	// Distributes a global per-frame instance budget between the visible foliage zones.
+	// CPU only and deterministic: the same inputs always give the same scales (the solver does not depend on the order of equal zones).
+	class ER_FoliageDensityBudget
+	{
+	public:
+		ER_FoliageDensityBudget();
+		~ER_FoliageDensityBudget();
+
+		// Water-filling: every zone gets a share of the budget proportional to its weight, capped by its candidates; leftovers go to the other zones.
+		// Writes the target density scale [0-1] of every zone. The sum of (candidates * scale) never exceeds the budget.
+		static void Solve(const FoliageBudgetZoneInput* aZones, int aZonesCount, int aBudget, float* aOutScales);
+		static float GetWeight(const FoliageBudgetZoneInput& aZone);
+		// Random synthetic layouts: Solve() never exceeds the budget, uses it completely when it is not enough and does not depend on the order of the zones
+		static bool RunSolverCheck(int aLayoutsCount, std::string& aOutReport);
+
+		// Solves the targets and moves the current scales towards them (with hysteresis), aZones are indexed the same way every frame
+		void Update(const std::vector<FoliageBudgetZoneInput>& aZones, float aDeltaTime);
+		void Reset() { mScales.clear(); mTargetScales.clear(); }
+
+		float GetDensityScale(int aZoneIndex) const { return (aZoneIndex < static_cast<int>(mScales.size())) ? mScales[aZoneIndex] : 1.0f; }
+		float GetTargetDensityScale(int aZoneIndex) const { return (aZoneIndex < static_cast<int>(mTargetScales.size())) ? mTargetScales[aZoneIndex] : 1.0f; }
+
+		void SetBudget(int aBudget) { mBudget = std::max(0, aBudget); }
+		int GetBudget() const { return mBudget; }
+		int GetRequestedInstancesCount() const { return mRequestedInstances; } // candidates of all zones in the last update
+	private:
+		std::vector<float> mScales;
+		std::vector<float> mTargetScales;
+		int mBudget = FOLIAGE_DEFAULT_INSTANCE_BUDGET;
+		int mRequestedInstances = 0;
+	};
+}
@@ -12,9 +12,10 @@
 #include "ER_PostProcessingStack.h"
 #include "ER_Illumination.h"
 #include "ER_Camera.h"
-#include "ER_RenderableAABB.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Terrain.h"
 #include "ER_GBuffer.h"
+#include "ER_SelfTests.h"
 
 #define FOLIAGE_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
 #define FOLIAGE_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX 1
@@ -24,6 +25,31 @@ namespace EveryRay_Core
 	static int currentSplatChannnel = (int)TerrainSplatChannels::NONE;
 	static const float blendFactor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
 
+	// Same test as in ER_Frustum: the AABB is outside if its most "inner" vertex is in front of any plane
+	static bool IsAABBOutsideFrustum(const XMFLOAT4* aPlanes, const ER_AABB& aAABB)
+	{
+		for (int planeID = 0; planeID < 6; planeID++)
+		{
+			const XMFLOAT4& plane = aPlanes[planeID];
+			float x = plane.x > 0.0f ? aAABB.first.x : aAABB.second.x;
+			float y = plane.y > 0.0f ? aAABB.first.y : aAABB.second.y;
+			float z = plane.z > 0.0f ? aAABB.first.z : aAABB.second.z;
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w > 0.0f)
+				return true;
+		}
+		return false;
+	}
+
+	// Foliage patches are only scaled (uniformly) and translated, rotation towards the camera is done in the shader
+	static void SetFoliageInstance(GPUFoliageInstanceData& aOutData, const XMFLOAT3& aPosition, float aScale)
+	{
+#if FOLIAGE_USE_COMPACT_INSTANCE_DATA
+		ER_CompactInstanceData::Encode(aPosition, aScale, aOutData);
+#else
+		aOutData.worldMatrix = XMMatrixScaling(aScale, aScale, aScale) * XMMatrixTranslation(aPosition.x, aPosition.y, aPosition.z);
+#endif
+	}
+
 	ER_FoliageManager::ER_FoliageManager(ER_Core& pCore, ER_Scene* aScene, ER_DirectionalLight& light, FoliageQuality aQuality)
 		: ER_CoreComponent(pCore), mScene(aScene), mCurrentFoliageQuality(aQuality)
 	{
@@ -98,8 +124,32 @@ namespace EveryRay_Core
 
 				foliage->SetWindParams(gustDistance, strength, frequency);
 				foliage->Update(gameTime);
-				foliage->PerformCPUFrustumCulling((ER_Utility::IsMainCameraCPUFrustumCulling && mEnableCulling) ? camera : nullptr);
 			}
+
+			mBytesUploadedLastFrame = 0;
+			auto startCullingTime = std::chrono::high_resolution_clock::now();
+
+			// all zones are culled first, so that the global instance budget can be split between the visible ones
+			mBudgetZones.resize(mFoliageCollection.size());
+			for (int i = 0; i < mFoliageCollection.size(); i++)
+			{
+				ER_Foliage* foliage = mFoliageCollection[i];
+				bool isCulled = foliage->PerformCPUFrustumCulling((ER_Utility::IsMainCameraCPUFrustumCulling && mEnableCulling) ? camera : nullptr);
+				mBudgetZones[i].CandidateInstances = isCulled ? 0 : foliage->GetCandidateInstancesCount();
+				mBudgetZones[i].ScreenCoverage = foliage->GetScreenCoverage();
+				mBudgetZones[i].Distance = foliage->GetClosestVisibleDistance();
+			}
+
+			mDensityBudget.SetBudget(mInstanceBudget);
+			mDensityBudget.Update(mBudgetZones, static_cast<float>(gameTime.ElapsedCoreTime()));
+
+			for (int i = 0; i < mFoliageCollection.size(); i++)
+			{
+				mFoliageCollection[i]->UpdateVisibleInstances(mEnableBudget ? mDensityBudget.GetDensityScale(i) : 1.0f);
+				mBytesUploadedLastFrame += mFoliageCollection[i]->GetBytesUploaded();
+			}
+			auto endCullingTime = std::chrono::high_resolution_clock::now();
+			mCullingTimeMs = std::chrono::duration<double, std::milli>(endCullingTime - startCullingTime).count();
 		}
 		UpdateImGui();
 	}
@@ -117,11 +167,11 @@ namespace EveryRay_Core
 			object->Draw(gameTime, worldShadowMapper, renderPass, aGbufferTextures, aDepthTarget, mRootSignature);
 	}
 
-	void ER_FoliageManager::DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void ER_FoliageManager::DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer)
 	{
 		if (ER_Utility::IsEditorMode && ER_Utility::IsFoliageEditor)
 			for (auto& object : mFoliageCollection)
-				object->DrawDebugGizmos(aRenderTarget, aDepth, rs);
+				object->DrawDebugGizmos(aDebugRenderer);
 	}
 
 	void ER_FoliageManager::AddFoliage(ER_Foliage* foliage)
@@ -149,7 +199,32 @@ namespace EveryRay_Core
 		ImGui::Checkbox("CPU frustum cull", &mEnableCulling);
 		ImGui::SliderFloat("Max LOD distance", &mMaxDistanceToCamera, 150.0f, 1500.0f);
 		ImGui::SliderFloat("Delta LOD distance", &mDeltaDistanceToCamera, 15.0f, 150.0f);
+		ImGui::Checkbox("Instance budget", &mEnableBudget);
+		ImGui::SliderInt("Max instances per frame", &mInstanceBudget, 10000, 2000000);
 		ImGui::Checkbox("Enable foliage editor", &ER_Utility::IsFoliageEditor);
+
+		int visibleInstances = 0, totalInstances = 0, visibleCells = 0, totalCells = 0;
+		for (auto& foliage : mFoliageCollection)
+		{
+			visibleInstances += foliage->IsCulled() ? 0 : foliage->GetPatchesCountToRender();
+			totalInstances += foliage->GetPatchesCount();
+			visibleCells += foliage->IsCulled() ? 0 : foliage->GetVisibleCellsCount();
+			totalCells += foliage->GetGridCellsCount();
+		}
+		std::string instancesText = "Visible instances: " + std::to_string(visibleInstances) + "/" + std::to_string(totalInstances) +
+			", visible cells: " + std::to_string(visibleCells) + "/" + std::to_string(totalCells);
+		ImGui::Text(instancesText.c_str());
+		std::string cullingTimeText = "Culling + LOD (CPU): " + std::to_string(mCullingTimeMs) + " ms";
+		ImGui::Text(cullingTimeText.c_str());
+		std::string uploadText = "Instance data uploaded: " + std::to_string(mBytesUploadedLastFrame / 1024) + " KB (this frame)";
+		ImGui::Text(uploadText.c_str());
+		std::string budgetText = "Budget: " + std::to_string(mDensityBudget.GetRequestedInstancesCount()) + " requested instances, " + std::to_string(mDensityBudget.GetBudget()) + " allowed";
+		ImGui::Text(budgetText.c_str());
+		if (ImGui::Button("Check budget solver (synthetic zones)"))
+			ER_SelfTests::Run(ER_SELF_TEST_FOLIAGE_DENSITY_BUDGET, mBudgetSolverCheckResult);
+		if (!mBudgetSolverCheckResult.empty())
+			ImGui::Text(mBudgetSolverCheckResult.c_str());
+
 		if (ImGui::Button("Save foliage changes"))
 			mScene->SaveFoliageZonesTransforms(mFoliageCollection);
 
@@ -187,8 +262,22 @@ namespace EveryRay_Core
 	{
 		auto rhi = mCore.GetRHI();
 
+		mRandomSeed = ER_Utility::HashBytes(mTextureName.data(), mTextureName.size());
+		mRandomSeed = ER_Utility::HashBytes(&mPatchesCount, sizeof(mPatchesCount), mRandomSeed);
+		mRandomSeed = ER_Utility::HashBytes(&mDistributionCenter, sizeof(mDistributionCenter), mRandomSeed);
+
 		//shaders
 		{
+#if FOLIAGE_USE_COMPACT_INSTANCE_DATA
+			ER_RHI_INPUT_ELEMENT_DESC inputElementDescriptions[3 + ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS] =
+			{
+				{ "POSITION", 0, ER_FORMAT_R32G32B32A32_FLOAT, 0, 0, true, 0 },
+				{ "TEXCOORD", 0, ER_FORMAT_R32G32_FLOAT, 0, 0xffffffff, true, 0 },
+				{ "NORMAL", 0, ER_FORMAT_R32G32B32_FLOAT, 0, 0xffffffff, true, 0 }
+			};
+			ER_CompactInstanceData::GetInputElements(1, &inputElementDescriptions[3]);
+			const std::string vertexEntry = "VSMain_compact";
+#else
 			ER_RHI_INPUT_ELEMENT_DESC inputElementDescriptions[] =
 			{
 				{ "POSITION", 0, ER_FORMAT_R32G32B32A32_FLOAT, 0, 0, true, 0 },
@@ -199,10 +288,12 @@ namespace EveryRay_Core
 				{ "WORLD", 2, ER_FORMAT_R32G32B32A32_FLOAT, 1, 32, false, 1 },
 				{ "WORLD", 3, ER_FORMAT_R32G32B32A32_FLOAT, 1, 48, false, 1 }
 			};
+			const std::string vertexEntry = "VSMain";
+#endif
 			mInputLayout = rhi->CreateInputLayout(inputElementDescriptions, ARRAYSIZE(inputElementDescriptions));
 
 			mVS = rhi->CreateGPUShader();
-			mVS->CompileShader(rhi, "content\\shaders\\Foliage.hlsl", "VSMain", ER_VERTEX, mInputLayout);
+			mVS->CompileShader(rhi, "content\\shaders\\Foliage.hlsl", vertexEntry, ER_VERTEX, mInputLayout);
 
 			mGS = rhi->CreateGPUShader();
 			mGS->CompileShader(rhi, "content\\shaders\\Foliage.hlsl", "GSMain", ER_GEOMETRY);
@@ -237,18 +328,14 @@ namespace EveryRay_Core
 		DeleteObject(mInstanceBuffer);
 		DeleteObject(mIndexBuffer);
 		DeleteObject(mAlbedoTexture);
-		DeleteObjects(mPatchesBufferCPU);
 		DeleteObjects(mCurrentPositions);
 		DeleteObjects(mPatchesBufferGPU);
-		DeleteObject(mDebugGizmoAABB);
 		DeleteObject(mInputLayout);
 		DeleteObject(mVS);
 		DeleteObject(mGS);
 		DeleteObject(mPS);
 		DeleteObject(mPS_GBuffer);
 		DeleteObject(mPS_Voxelization);
-		DeleteObject(mInputPositionsOnTerrainBuffer);
-		DeleteObject(mOutputPositionsOnTerrainBuffer);
 		mFoliageConstantBuffer.Release();
 	}
 
@@ -294,47 +381,20 @@ namespace EveryRay_Core
 		mFoliageConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: Foliage CB");
 		InitializeBuffersCPU();
 		InitializeBuffersGPU(mPatchesCount);
+		BuildGrid();
+		UpdateAABB();
 
-		float radius = mDistributionRadius * 0.5f + mAABBExtentXZ;
-		XMFLOAT3 minP = XMFLOAT3(mDistributionCenter.x - radius, mDistributionCenter.y - mAABBExtentY, mDistributionCenter.z - radius);
-		XMFLOAT3 maxP = XMFLOAT3(mDistributionCenter.x + radius, mDistributionCenter.y + mAABBExtentY, mDistributionCenter.z + radius);
-		mAABB = ER_AABB(minP, maxP);
-
-		mDebugGizmoAABB = new ER_RenderableAABB(mCore, XMFLOAT4(0.0, 0.0, 1.0, 1.0));
-		mDebugGizmoAABB->InitializeGeometry({ mAABB.first, mAABB.second });
-
-		if (mIsPlacedOnTerrain)
+		if (mIsPlacedOnTerrain && !mIsLoadedFromPlacementCache)
 		{
 			ER_Terrain* terrain = mCore.GetLevel()->mTerrain;
 			assert(terrain);
 			if (terrain && terrain->IsLoaded())
 			{
-				DeleteObject(mInputPositionsOnTerrainBuffer);
-				DeleteObject(mOutputPositionsOnTerrainBuffer);
-
-				mInputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: On-terrain placement input positions buffer");
-				mInputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mCurrentPositions, mPatchesCount, sizeof(XMFLOAT4), false, ER_BIND_UNORDERED_ACCESS, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-				mOutputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: On-terrain placement output positions buffer");
-				mOutputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mCurrentPositions, mPatchesCount, sizeof(XMFLOAT4), false, ER_BIND_NONE, 0x10000L | 0x20000L /*legacy from DX11*/, ER_RESOURCE_MISC_BUFFER_STRUCTURED); //should be STAGING
-
-				terrain->PlaceOnTerrain(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mCurrentPositions, mPatchesCount, (TerrainSplatChannels)mTerrainSplatChannel, nullptr, 0, mPlacementHeightDelta);
-#ifndef ER_PLATFORM_WIN64_DX11
-				std::string eventName = "On-terrain placement callback - initialization of foliage: " + mName;
-				terrain->ReadbackPlacedPositionsOnInitEvent->AddListener(eventName, [&](ER_Terrain* aTerrain)
-					{ 
-						assert(aTerrain);
-						aTerrain->ReadbackPlacedPositions(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mCurrentPositions, mPatchesCount);
-						UpdateBuffersCPU();
-						UpdateBuffersGPU();
-						UpdateAABB();
-					}
-				);
-#else
+				terrain->PlaceOnTerrainCPU(mCurrentPositions, mPatchesCount, (TerrainSplatChannels)mTerrainSplatChannel, mPlacementHeightDelta);
+				terrain->WritePlacementCache("foliage_" + mOriginalName, CalculateTerrainPlacementHash(terrain), mCurrentPositions, sizeof(XMFLOAT4), mPatchesCount);
 				UpdateBuffersCPU();
 				UpdateBuffersGPU();
 				UpdateAABB();
-#endif
-
 			}
 		}
 
@@ -352,38 +412,91 @@ namespace EveryRay_Core
 		int instanceCount = count;
 		mPatchesBufferGPU = new GPUFoliageInstanceData[instanceCount];
 
+		std::vector<float> randomScales(instanceCount);
+		mRandom.Seed(mRandomSeed, 2);
+		mRandom.FillFloat(randomScales.data(), randomScales.size(), mScale - 1.0f, mScale + 1.0f);
+
+		mPatchesCPU.Scales.resize(instanceCount);
 		for (int i = 0; i < instanceCount; i++)
 		{
-			float randomScale = ER_Utility::RandomFloat(mScale - 1.0f, mScale + 1.0f);
-			mPatchesBufferCPU[i].scale = randomScale;
-			mPatchesBufferGPU[i].worldMatrix = XMMatrixScaling(randomScale, randomScale, randomScale) * XMMatrixTranslation(mPatchesBufferCPU[i].xPos, mPatchesBufferCPU[i].yPos, mPatchesBufferCPU[i].zPos);
-			//mPatchesBufferGPU[i].color = XMFLOAT3(mPatchesBufferCPU[i].r, mPatchesBufferCPU[i].g, mPatchesBufferCPU[i].b);
-			mCurrentPositions[i] = XMFLOAT4(mPatchesBufferCPU[i].xPos, mPatchesBufferCPU[i].yPos, mPatchesBufferCPU[i].zPos, 1.0f);
+			float randomScale = randomScales[i];
+			const XMFLOAT3& position = mPatchesCPU.Positions[i];
+			mPatchesCPU.Scales[i] = randomScale;
+			SetFoliageInstance(mPatchesBufferGPU[i], position, randomScale);
+			//mPatchesBufferGPU[i].color = mPatchesCPU.Colors[i];
+			mCurrentPositions[i] = XMFLOAT4(position.x, position.y, position.z, 1.0f);
 		}
 
+		// the buffer starts with all patches in their original order
+		mVisibleInstancesGPU.assign(mPatchesBufferGPU, mPatchesBufferGPU + instanceCount);
+		mSlotPatchIndices.resize(instanceCount);
+		for (int i = 0; i < instanceCount; i++)
+			mSlotPatchIndices[i] = i;
+		mPatchDirtyFlags.assign(instanceCount, 0);
+
+		// not dynamic: only the changed ranges are uploaded after culling (see PerformCPUFrustumCulling())
 		mInstanceBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Foliage instance buffer");
-		mInstanceBuffer->CreateGPUBufferResource(mCore.GetRHI(), mPatchesBufferGPU, instanceCount, sizeof(GPUFoliageInstanceData), true, ER_BIND_VERTEX_BUFFER);
+		mInstanceBuffer->CreateGPUBufferResource(mCore.GetRHI(), mPatchesBufferGPU, instanceCount, sizeof(GPUFoliageInstanceData), false, ER_BIND_VERTEX_BUFFER);
 	}
 
 	void ER_Foliage::InitializeBuffersCPU()
 	{
-		// randomly generate positions and color
-		mPatchesBufferCPU = new CPUFoliageData[mPatchesCount];
+		// randomly generate positions (or read the already placed ones from the cache) and color
+		mPatchesCPU.Positions.resize(mPatchesCount);
+		mPatchesCPU.Colors.resize(mPatchesCount);
 		mCurrentPositions = new XMFLOAT4[mPatchesCount];
 
-		for (int i = 0; i < mPatchesCount; i++)
+		mIsLoadedFromPlacementCache = false;
+		if (mIsPlacedOnTerrain)
 		{
-			mPatchesBufferCPU[i].xPos = mDistributionCenter.x + ((float)rand() / (float)(RAND_MAX)) * mDistributionRadius - mDistributionRadius /2;
-			mPatchesBufferCPU[i].yPos = mDistributionCenter.y;
-			mPatchesBufferCPU[i].zPos = mDistributionCenter.z + ((float)rand() / (float)(RAND_MAX)) * mDistributionRadius - mDistributionRadius /2;
-			mCurrentPositions[i] = XMFLOAT4(mPatchesBufferCPU[i].xPos, mPatchesBufferCPU[i].yPos, mPatchesBufferCPU[i].zPos, 1.0f);
+			ER_Terrain* terrain = mCore.GetLevel()->mTerrain;
+			if (terrain && terrain->IsLoaded())
+				mIsLoadedFromPlacementCache = terrain->ReadPlacementCache("foliage_" + mOriginalName, CalculateTerrainPlacementHash(terrain), mCurrentPositions, sizeof(XMFLOAT4), mPatchesCount);
+		}
+		if (!mIsLoadedFromPlacementCache)
+			GenerateDistributionPositions();
 
-			mPatchesBufferCPU[i].r = ((float)rand() / (float)(RAND_MAX)) * 1.0f + 1.0f;
-			mPatchesBufferCPU[i].g = ((float)rand() / (float)(RAND_MAX)) * 1.0f + 0.5f;
-			mPatchesBufferCPU[i].b = 0.0f;
+		std::vector<float> randomColors(mPatchesCount * 2);
+		mRandom.Seed(mRandomSeed, 1);
+		mRandom.FillFloat(randomColors.data(), randomColors.size());
+
+		for (int i = 0; i < mPatchesCount; i++)
+		{
+			mPatchesCPU.Positions[i] = XMFLOAT3(mCurrentPositions[i].x, mCurrentPositions[i].y, mCurrentPositions[i].z);
+			mPatchesCPU.Colors[i] = XMFLOAT3(randomColors[i * 2 + 0] * 1.0f + 1.0f, randomColors[i * 2 + 1] * 1.0f + 0.5f, 0.0f);
 		}
 	}
 
+	// Key of the zone's placement cache: everything the placed positions depend on (zone's parameters from the level file, seed and terrain data)
+	UINT64 ER_Foliage::CalculateTerrainPlacementHash(ER_Terrain* aTerrain)
+	{
+		assert(aTerrain);
+
+		const float placementParams[] = {
+			mDistributionCenter.x, mDistributionCenter.y, mDistributionCenter.z, mDistributionRadius,
+			mPlacementHeightDelta, aTerrain->GetHeightScale()
+		};
+		const int zoneParams[] = { mPatchesCount, mTerrainSplatChannel };
+		const UINT64 terrainHash = aTerrain->GetTerrainDataHash();
+
+		UINT64 hash = ER_Utility::HashBytes(&terrainHash, sizeof(terrainHash));
+		hash = ER_Utility::HashBytes(&mRandomSeed, sizeof(mRandomSeed), hash);
+		hash = ER_Utility::HashBytes(placementParams, sizeof(placementParams), hash);
+		hash = ER_Utility::HashBytes(zoneParams, sizeof(zoneParams), hash);
+		return hash;
+	}
+
+	// Random positions in the zone's square, always the same ones relative to the center (so that the zone keeps its look while being moved in the editor)
+	void ER_Foliage::GenerateDistributionPositions()
+	{
+		std::vector<float> offsets(mPatchesCount * 2);
+		mRandom.Seed(mRandomSeed, 0);
+		mRandom.FillFloat(offsets.data(), offsets.size(), -mDistributionRadius / 2, mDistributionRadius / 2);
+
+		for (int i = 0; i < mPatchesCount; i++)
+			mCurrentPositions[i] = XMFLOAT4(mDistributionCenter.x + offsets[i * 2 + 0], mDistributionCenter.y, mDistributionCenter.z + offsets[i * 2 + 1], 1.0f);
+	}
+
 	void ER_Foliage::PrepareRendering(const ER_CoreTime& gameTime, const ER_ShadowMapper* worldShadowMapper, ER_RHI_GPURootSignature* rs)
 	{
 		auto rhi = mCore.GetRHI();
@@ -485,10 +598,10 @@ namespace EveryRay_Core
 		rhi->UnbindResourcesFromShader(ER_PIXEL);
 	}
 
-	void ER_Foliage::DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void ER_Foliage::DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer)
 	{
-		if (mDebugGizmoAABB && mIsSelectedInEditor)
-			mDebugGizmoAABB->Draw(aRenderTarget, aDepth, rs);
+		if (mIsSelectedInEditor)
+			aDebugRenderer->AddAABB(mAABB, XMFLOAT4(0.0, 0.0, 1.0, 1.0));
 	}
 
 	void ER_Foliage::Update(const ER_CoreTime& gameTime)
@@ -499,31 +612,12 @@ namespace EveryRay_Core
 		if (editable)
 		{
 			mDistributionCenter = XMFLOAT3(mMatrixTranslation[0], mMatrixTranslation[1], mMatrixTranslation[2]);
-			for (int i = 0; i < mPatchesCount; i++)
-			{
-				mCurrentPositions[i] = XMFLOAT4(
-					mDistributionCenter.x + ((float)rand() / (float)(RAND_MAX)) * mDistributionRadius - mDistributionRadius / 2,
-					mDistributionCenter.y,
-					mDistributionCenter.z + ((float)rand() / (float)(RAND_MAX)) * mDistributionRadius - mDistributionRadius / 2, 1.0f);
-			}
+			GenerateDistributionPositions();
 			UpdateBuffersCPU();
 			UpdateBuffersGPU();
 			UpdateAABB();
 		}
 
-		XMFLOAT3 toCam = { mDistributionCenter.x - mCamera.Position().x, mDistributionCenter.y - mCamera.Position().y, mDistributionCenter.z - mCamera.Position().z };
-		float distanceToCam = sqrt(toCam.x * toCam.x + toCam.y * toCam.y + toCam.z * toCam.z);
-
-		//UpdateBufferGPU();
-		CalculateDynamicLOD(distanceToCam);
-
-		// adjust patches count based on quality factor
-		if (mPatchesCount > MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD && mPatchesCountToRender > MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD)
-			mPatchesCountToRender = static_cast<int>(static_cast<float>(mPatchesCountToRender) * mCore.GetLevel()->mFoliageSystem->GetQualityFactor());
-
-		if (mDebugGizmoAABB)
-			mDebugGizmoAABB->Update(mAABB);
-
 		//imgui
 		if (editable)
 		{
@@ -567,32 +661,11 @@ namespace EveryRay_Core
 					ER_Terrain* terrain = mCore.GetLevel()->mTerrain;
 					if (ImGui::Button("Place patch on terrain") && terrain && terrain->IsLoaded())
 					{
-						DeleteObject(mInputPositionsOnTerrainBuffer);
-						DeleteObject(mOutputPositionsOnTerrainBuffer);
-
-						mInputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: foliage on-terrain placement input positions buffer");
-						mInputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mCurrentPositions, mPatchesCount, sizeof(XMFLOAT4), false, ER_BIND_UNORDERED_ACCESS, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-						mOutputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: foliage on-terrain placement output positions buffer");
-						mOutputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mCurrentPositions, mPatchesCount, sizeof(XMFLOAT4), false, ER_BIND_NONE, 0x10000L | 0x20000L /*legacy from DX11*/, ER_RESOURCE_MISC_BUFFER_STRUCTURED); //should be STAGING
-
-						terrain->PlaceOnTerrain(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mCurrentPositions, mPatchesCount, currentChannel, nullptr, 0, mPlacementHeightDelta);
-#ifndef ER_PLATFORM_WIN64_DX11
-						std::string eventName = "On-terrain placement callback - update of foliage: " + mName;
-						terrain->ReadbackPlacedPositionsOnUpdateEvent->AddListener(eventName, [&](ER_Terrain* aTerrain)
-							{
-								assert(aTerrain);
-								aTerrain->ReadbackPlacedPositions(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mCurrentPositions, mPatchesCount); 
-								UpdateBuffersCPU();
-								UpdateBuffersGPU();
-								UpdateAABB();
-							}
-						);
-#else
+						terrain->PlaceOnTerrainCPU(mCurrentPositions, mPatchesCount, currentChannel, mPlacementHeightDelta);
 						UpdateBuffersCPU();
 						UpdateBuffersGPU();
 						UpdateAABB();
-#endif
-						
+
 						ER_Utility::IsFoliageEditor = false;
 					}
 				}
@@ -616,89 +689,250 @@ namespace EveryRay_Core
 		mName = mIsCulled ? mOriginalName + " (Culled)" : mOriginalName;
 	}
 
-	// updating world matrices of visible patches
+	// updating world matrices of the changed patches (visible ones are uploaded after culling)
 	void ER_Foliage::UpdateBuffersGPU() 
 	{
-		ER_RHI* rhi = mCore.GetRHI();
+		if (!mHasDirtyPatches)
+			return;
 
-		XMMATRIX translationMatrix;
 		for (int i = 0; i < mPatchesCount; i++)
 		{
-			translationMatrix = XMMatrixTranslation(mPatchesBufferCPU[i].xPos, mPatchesBufferCPU[i].yPos, mPatchesBufferCPU[i].zPos);
-			mPatchesBufferGPU[i].worldMatrix = XMMatrixScaling(mPatchesBufferCPU[i].scale, mPatchesBufferCPU[i].scale, mPatchesBufferCPU[i].scale) * translationMatrix;
-		}
+			if (!mPatchDirtyFlags[i])
+				continue;
 
-		rhi->UpdateBuffer(mInstanceBuffer, (void*)mPatchesBufferGPU, (sizeof(GPUFoliageInstanceData) * mPatchesCount), mIsPlacedOnTerrain /* otherwise we won't have placed foliage in some frames */);
+			SetFoliageInstance(mPatchesBufferGPU[i], mPatchesCPU.Positions[i], mPatchesCPU.Scales[i]);
+		}
+		mAreMatricesDirty = false;
 	}
 
+	// copies the current positions into the patches and marks the ones that actually moved
 	void ER_Foliage::UpdateBuffersCPU()
 	{
+		bool isChanged = false;
 		for (int i = 0; i < mPatchesCount; i++)
 		{
-			mPatchesBufferCPU[i].xPos = mCurrentPositions[i].x;
-			mPatchesBufferCPU[i].yPos = mCurrentPositions[i].y;
-			mPatchesBufferCPU[i].zPos = mCurrentPositions[i].z;
+			XMFLOAT3& position = mPatchesCPU.Positions[i];
+			if (position.x == mCurrentPositions[i].x && position.y == mCurrentPositions[i].y && position.z == mCurrentPositions[i].z)
+				continue;
+
+			position = XMFLOAT3(mCurrentPositions[i].x, mCurrentPositions[i].y, mCurrentPositions[i].z);
+			MarkPatchesDirty(i, 1);
+			isChanged = true;
+		}
+
+		if (isChanged)
+			BuildGrid();
+	}
+
+	void ER_Foliage::MarkPatchesDirty(int aFirstPatch, int aCount)
+	{
+		assert(aFirstPatch >= 0 && aFirstPatch + aCount <= mPatchesCount);
+		memset(mPatchDirtyFlags.data() + aFirstPatch, 1, aCount);
+		mHasDirtyPatches = true;
+		mAreMatricesDirty = true;
+	}
+
+	// Counting sort of the patches into the cells of the zone's grid + bounds of every cell from its patches
+	void ER_Foliage::BuildGrid()
+	{
+		const float zoneSize = std::max(mDistributionRadius, 0.001f); // patches are in [center - radius / 2, center + radius / 2]
+		mGridCellsPerSide = std::max(1, std::min(FOLIAGE_GRID_MAX_CELLS_PER_SIDE, static_cast<int>(ceil(zoneSize / FOLIAGE_GRID_CELL_SIZE))));
+		const float cellSize = zoneSize / static_cast<float>(mGridCellsPerSide);
+		const float gridOriginX = mDistributionCenter.x - zoneSize * 0.5f;
+		const float gridOriginZ = mDistributionCenter.z - zoneSize * 0.5f;
+
+		mGridCells.clear();
+		mGridCells.resize(mGridCellsPerSide * mGridCellsPerSide);
+		for (auto& cell : mGridCells)
+			cell.AABB = ER_AABB(XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+		std::vector<int> patchCells(mPatchesCount);
+		for (int i = 0; i < mPatchesCount; i++)
+		{
+			const XMFLOAT3& position = mPatchesCPU.Positions[i];
+			int cellX = std::max(0, std::min(mGridCellsPerSide - 1, static_cast<int>((position.x - gridOriginX) / cellSize)));
+			int cellZ = std::max(0, std::min(mGridCellsPerSide - 1, static_cast<int>((position.z - gridOriginZ) / cellSize)));
+			patchCells[i] = cellZ * mGridCellsPerSide + cellX;
+
+			FoliageGridCell& cell = mGridCells[patchCells[i]];
+			cell.PatchCount++;
+			cell.AABB.first = XMFLOAT3(std::min(cell.AABB.first.x, position.x), std::min(cell.AABB.first.y, position.y), std::min(cell.AABB.first.z, position.z));
+			cell.AABB.second = XMFLOAT3(std::max(cell.AABB.second.x, position.x), std::max(cell.AABB.second.y, position.y), std::max(cell.AABB.second.z, position.z));
+		}
+
+		int offset = 0;
+		for (auto& cell : mGridCells)
+		{
+			cell.FirstPatch = offset;
+			offset += cell.PatchCount;
+			cell.PatchCount = 0; // filled again below
+
+			// billboards are not points
+			cell.AABB.first = XMFLOAT3(cell.AABB.first.x - mAABBExtentXZ, cell.AABB.first.y - mAABBExtentY, cell.AABB.first.z - mAABBExtentXZ);
+			cell.AABB.second = XMFLOAT3(cell.AABB.second.x + mAABBExtentXZ, cell.AABB.second.y + mAABBExtentY, cell.AABB.second.z + mAABBExtentXZ);
+		}
+
+		mGridPatchIndices.resize(mPatchesCount);
+		for (int i = 0; i < mPatchesCount; i++)
+		{
+			FoliageGridCell& cell = mGridCells[patchCells[i]];
+			mGridPatchIndices[cell.FirstPatch + cell.PatchCount++] = i;
 		}
 	}
 
 	void ER_Foliage::UpdateAABB()
 	{
-		//update AABB based on the first patch Y position (not accurate, but fast)
-		float radius = mDistributionRadius * 0.5f + mAABBExtentXZ;
-		XMFLOAT3 minP = XMFLOAT3(mDistributionCenter.x - radius, mPatchesBufferCPU[0].yPos - mAABBExtentY, mDistributionCenter.z - radius);
-		XMFLOAT3 maxP = XMFLOAT3(mDistributionCenter.x + radius, mPatchesBufferCPU[0].yPos + mAABBExtentY, mDistributionCenter.z + radius);
+		// union of the grid cells (they already have the extents of the billboards)
+		XMFLOAT3 minP = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		XMFLOAT3 maxP = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (auto& cell : mGridCells)
+		{
+			if (cell.PatchCount == 0)
+				continue;
+			minP = XMFLOAT3(std::min(minP.x, cell.AABB.first.x), std::min(minP.y, cell.AABB.first.y), std::min(minP.z, cell.AABB.first.z));
+			maxP = XMFLOAT3(std::max(maxP.x, cell.AABB.second.x), std::max(maxP.y, cell.AABB.second.y), std::max(maxP.z, cell.AABB.second.z));
+		}
+
+		if (minP.x > maxP.x) // no patches
+		{
+			minP = XMFLOAT3(mDistributionCenter.x - mAABBExtentXZ, mDistributionCenter.y - mAABBExtentY, mDistributionCenter.z - mAABBExtentXZ);
+			maxP = XMFLOAT3(mDistributionCenter.x + mAABBExtentXZ, mDistributionCenter.y + mAABBExtentY, mDistributionCenter.z + mAABBExtentXZ);
+		}
 		mAABB = ER_AABB(minP, maxP);
 	}
 
 	bool ER_Foliage::PerformCPUFrustumCulling(ER_Camera* camera)
 	{
-		if (!camera)
+		XMFLOAT4 planes[6];
+		if (camera)
 		{
-			mIsCulled = false;
-			return mIsCulled;
+			auto frustum = camera->GetFrustum();
+			memcpy(planes, frustum.Planes(), sizeof(planes));
 		}
 
-		auto frustum = camera->GetFrustum();
-		bool culled = false;
-		// start a loop through all frustum planes
-		for (int planeID = 0; planeID < 6; ++planeID)
+		if (mIsGridDirty)
 		{
-			XMVECTOR planeNormal = XMVectorSet(frustum.Planes()[planeID].x, frustum.Planes()[planeID].y, frustum.Planes()[planeID].z, 0.0f);
-			float planeConstant = frustum.Planes()[planeID].w;
+			BuildGrid();
+			UpdateAABB();
+			mIsGridDirty = false;
+		}
+		if (mAreMatricesDirty)
+			UpdateBuffersGPU();
 
-			XMFLOAT3 axisVert;
+		mIsCulled = camera && IsAABBOutsideFrustum(planes, mAABB);
+		mCandidateInstancesCount = 0;
+		mScreenCoverage = 0.0f;
+		mClosestVisibleDistance = FLT_MAX;
+		mCellCandidateCounts.assign(mGridCells.size(), 0);
+		if (mIsCulled)
+			return mIsCulled;
 
-			// x-axis
-			if (frustum.Planes()[planeID].x > 0.0f)
-				axisVert.x = mAABB.first.x;
-			else
-				axisVert.x = mAABB.second.x;
+		// adjust patches count based on quality factor (candidates of all zones are then thinned to fit into the global instance budget)
+		const float qualityFactor = (mPatchesCount > MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD) ? mCore.GetLevel()->mFoliageSystem->GetQualityFactor() : 1.0f;
+		const XMFLOAT3 cameraPosition = mCamera.Position();
+		const XMFLOAT4X4 projection = mCamera.ProjectionMatrix4X4();
 
-			// y-axis
-			if (frustum.Planes()[planeID].y > 0.0f)
-				axisVert.y = mAABB.first.y;
-			else
-				axisVert.y = mAABB.second.y;
+		// cells are accepted/rejected as a whole
+		for (int cellIndex = 0; cellIndex < static_cast<int>(mGridCells.size()); cellIndex++)
+		{
+			const FoliageGridCell& cell = mGridCells[cellIndex];
+			if (cell.PatchCount == 0 || (camera && IsAABBOutsideFrustum(planes, cell.AABB)))
+				continue;
+
+			float dx = std::max(cell.AABB.first.x - cameraPosition.x, std::max(0.0f, cameraPosition.x - cell.AABB.second.x));
+			float dy = std::max(cell.AABB.first.y - cameraPosition.y, std::max(0.0f, cameraPosition.y - cell.AABB.second.y));
+			float dz = std::max(cell.AABB.first.z - cameraPosition.z, std::max(0.0f, cameraPosition.z - cell.AABB.second.z));
+			const float distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+			int count = std::min(cell.PatchCount, static_cast<int>(ceil(static_cast<float>(cell.PatchCount) * CalculateDynamicLOD(distance) * qualityFactor)));
+			if (count == 0)
+				continue;
+
+			// screen coverage of the cell's bounding sphere (part of the [-1, 1] x [-1, 1] NDC square)
+			float extentX = (cell.AABB.second.x - cell.AABB.first.x) * 0.5f;
+			float extentY = (cell.AABB.second.y - cell.AABB.first.y) * 0.5f;
+			float extentZ = (cell.AABB.second.z - cell.AABB.first.z) * 0.5f;
+			float radius = sqrt(extentX * extentX + extentY * extentY + extentZ * extentZ);
+			float centerDistance = std::max(radius, distance + radius);
+			float coverage = XM_PI * (radius * projection._11 / centerDistance) * (radius * projection._22 / centerDistance) * 0.25f;
+
+			mCellCandidateCounts[cellIndex] = count;
+			mCandidateInstancesCount += count;
+			mScreenCoverage += coverage;
+			mClosestVisibleDistance = std::min(mClosestVisibleDistance, distance);
+		}
+		mScreenCoverage = std::min(mScreenCoverage, 1.0f);
+		if (mCandidateInstancesCount == 0)
+			mClosestVisibleDistance = 0.0f;
 
-			// z-axis
-			if (frustum.Planes()[planeID].z > 0.0f)
-				axisVert.z = mAABB.first.z;
-			else
-				axisVert.z = mAABB.second.z;
+		return mIsCulled;
+	}
 
+	void ER_Foliage::UpdateVisibleInstances(float aDensityScale)
+	{
+		mPatchesCountToRender = 0;
+		mVisibleCellsCount = 0;
+		mBytesUploaded = 0;
+		if (mIsCulled)
+			return; // dirty patches stay dirty until the zone is visible again
+
+		// instances of the visible cells are compacted into one list (prefix of every cell, so any density is an even thinning of it).
+		// The GPU buffer keeps its content between frames, so only the slots that now hold another patch, or a patch that has changed, are uploaded.
+		mDirtyRegions.clear();
+		int rangeStart = -1, rangeEnd = -1; // current [start, end) range of changed slots
+		for (int cellIndex = 0; cellIndex < static_cast<int>(mGridCells.size()); cellIndex++)
+		{
+			const FoliageGridCell& cell = mGridCells[cellIndex];
+			const int candidates = mCellCandidateCounts[cellIndex];
+			int count = std::min(candidates, static_cast<int>(static_cast<float>(candidates) * aDensityScale + 0.5f));
+			if (count == 0)
+				continue;
 
-			if (XMVectorGetX(XMVector3Dot(planeNormal, XMLoadFloat3(&axisVert))) + planeConstant > 0.0f)
+			for (int i = 0; i < count; i++)
 			{
-				culled = true;
-				// Skip remaining planes to check and move on 
-				break;
+				const int slot = mPatchesCountToRender + i;
+				const int patch = mGridPatchIndices[cell.FirstPatch + i];
+				if (mSlotPatchIndices[slot] == patch && !mPatchDirtyFlags[patch])
+					continue;
+
+				mSlotPatchIndices[slot] = patch;
+				mVisibleInstancesGPU[slot] = mPatchesBufferGPU[patch];
+				if (rangeStart >= 0 && slot - rangeEnd <= FOLIAGE_DIRTY_RANGE_MERGE_GAP)
+					rangeEnd = slot + 1;
+				else
+				{
+					if (rangeStart >= 0)
+						mDirtyRegions.push_back({ static_cast<UINT>(rangeStart * sizeof(GPUFoliageInstanceData)), static_cast<UINT>((rangeEnd - rangeStart) * sizeof(GPUFoliageInstanceData)) });
+					rangeStart = slot;
+					rangeEnd = slot + 1;
+				}
 			}
+			mPatchesCountToRender += count;
+			mVisibleCellsCount++;
+		}
+		if (rangeStart >= 0)
+			mDirtyRegions.push_back({ static_cast<UINT>(rangeStart * sizeof(GPUFoliageInstanceData)), static_cast<UINT>((rangeEnd - rangeStart) * sizeof(GPUFoliageInstanceData)) });
+
+		if (!mDirtyRegions.empty())
+		{
+			// regions are relative to the beginning of the buffer, merged gaps are re-uploaded with their (unchanged) data
+			mCore.GetRHI()->UpdateBufferRegions(mInstanceBuffer, mVisibleInstancesGPU.data(), mDirtyRegions.data(), static_cast<UINT>(mDirtyRegions.size()));
+			for (const auto& region : mDirtyRegions)
+				mBytesUploaded += region.Size;
+		}
+
+		if (mHasDirtyPatches)
+		{
+			// every visible slot is up to date now; slots after them may still reference changed patches, so forget them
+			for (int slot = mPatchesCountToRender; slot < mPatchesCount; slot++)
+				mSlotPatchIndices[slot] = -1;
+			std::fill(mPatchDirtyFlags.begin(), mPatchDirtyFlags.end(), 0);
+			mHasDirtyPatches = false;
 		}
-		mIsCulled = culled;
-		return culled;
 	}
 
-	void ER_Foliage::CalculateDynamicLOD(float distanceToCam)
+	// returns the density [0-1] of patches at the given distance
+	float ER_Foliage::CalculateDynamicLOD(float distanceToCam)
 	{
 		float factor = (distanceToCam - mDeltaDistanceToCamera) / mMaxDistanceToCamera;
 
@@ -707,7 +941,7 @@ namespace EveryRay_Core
 		else if (factor < 0.0f)
 			factor = 0.0f;
 
-		mPatchesCountToRender = static_cast<int>(static_cast<float>(mPatchesCount) * (1.0f - factor));
+		return 1.0f - factor;
 	}
 
 }
\ No newline at end of file
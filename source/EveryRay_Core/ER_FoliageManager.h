@@ -3,13 +3,27 @@
 #include "ER_CoreComponent.h"
 #include "ER_GenericEvent.h"
 #include "RHI/ER_RHI.h"
+#include "ER_Random.h"
+#include "ER_FoliageDensityBudget.h"
+#include "ER_CompactInstanceData.h"
 
 #define MAX_FOLIAGE_ZONES 4096
 
+// Patches of every zone are bucketed into a uniform XZ grid: culling and distance LOD are done per cell (not per zone or per patch).
+#define FOLIAGE_GRID_CELL_SIZE 32.0f
+#define FOLIAGE_GRID_MAX_CELLS_PER_SIDE 16
+
+// Changed instances of the compacted instance buffer are uploaded in ranges: ranges closer than this (in instances) are merged into one upload.
+#define FOLIAGE_DIRTY_RANGE_MERGE_GAP 16
+
+// Instance buffer stores InstancedDataCompact (32 bytes, see ER_CompactInstanceData.h) instead of a world matrix per patch.
+#define FOLIAGE_USE_COMPACT_INSTANCE_DATA 1
+
 // Minimum amount of drawn patches/instances before we start applying graphics config's "quality" factor.
 // In other words, for example, our foliage zone has N patches to render (after culling or without it).
 // If N > MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD, then we apply a "quality" factor that will reduce the amount of patches.
 // If N <= MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD, then we assume that any graphics config can handle that amount of geometry.
+// The global instance budget (ER_FoliageDensityBudget) is applied on top of that.
 #define MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD 1000
 
 namespace EveryRay_Core
@@ -20,7 +34,7 @@ namespace EveryRay_Core
 	class ER_ShadowMapper;
 	class ER_PostProcessingStack;
 	class ER_Illumination;
-	class ER_RenderableAABB;
+	class ER_DebugRenderer;
 	class ER_Terrain;
 
 	namespace FoliageCBufferData {
@@ -75,16 +89,30 @@ namespace EveryRay_Core
 		XMFLOAT3 normals;
 	};
 
+#if FOLIAGE_USE_COMPACT_INSTANCE_DATA
+	typedef InstancedDataCompact GPUFoliageInstanceData; //for GPU instance buffer
+#else
 	struct ER_ALIGN_GPU_BUFFER GPUFoliageInstanceData //for GPU instance buffer
 	{
 		XMMATRIX worldMatrix = XMMatrixIdentity();
 	};
+#endif
 
-	struct CPUFoliageData //for CPU buffer
+	// CPU data of the patches as separate streams: culling/grid/matrices only touch the hot ones
+	struct FoliagePatchesData
 	{
-		float xPos, yPos, zPos;
-		float r, g, b;
-		float scale;
+		// hot
+		std::vector<XMFLOAT3> Positions;
+		std::vector<float> Scales;
+		// cold
+		std::vector<XMFLOAT3> Colors;
+	};
+
+	struct FoliageGridCell
+	{
+		ER_AABB AABB;
+		int FirstPatch = 0; // into the zone's cell-sorted patch indices
+		int PatchCount = 0;
 	};
 
 	class ER_Foliage
@@ -98,7 +126,7 @@ namespace EveryRay_Core
 		void Initialize();
 		void Draw(const ER_CoreTime& gameTime, const ER_ShadowMapper* worldShadowMapper, FoliageRenderingPass renderPass, 
 			const std::vector<ER_RHI_GPUTexture*>& aGbufferTextures, ER_RHI_GPUTexture* aDepthTarget, ER_RHI_GPURootSignature* rs);
-		void DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer);
 		void Update(const ER_CoreTime& gameTime);
 
 		bool IsSelected() { return mIsSelectedInEditor; }
@@ -117,13 +145,13 @@ namespace EveryRay_Core
 
 		int GetPatchesCount() { return mPatchesCount; }
 		void SetPatchPosition(int i, float x, float y, float z) {
-			mPatchesBufferCPU[i].xPos = x;
-			mPatchesBufferCPU[i].yPos = y;
-			mPatchesBufferCPU[i].zPos = z;
+			mPatchesCPU.Positions[i] = XMFLOAT3(x, y, z);
+			MarkPatchesDirty(i, 1);
+			mIsGridDirty = true;
 		}
-		float GetPatchPositionX(int i) { return mPatchesBufferCPU[i].xPos; }
-		float GetPatchPositionY(int i) { return mPatchesBufferCPU[i].yPos; }
-		float GetPatchPositionZ(int i) { return mPatchesBufferCPU[i].zPos; }
+		float GetPatchPositionX(int i) { return mPatchesCPU.Positions[i].x; }
+		float GetPatchPositionY(int i) { return mPatchesCPU.Positions[i].y; }
+		float GetPatchPositionZ(int i) { return mPatchesCPU.Positions[i].z; }
 		const XMFLOAT3& GetDistributionCenter() { return mDistributionCenter; }
 
 		void UpdateBuffersGPU();
@@ -137,7 +165,17 @@ namespace EveryRay_Core
 			mVoxelTextureDimension = voxelTexDimension;
 		}
 
+		// Culls the zone and its grid cells and applies distance LOD per cell (results are the zone's input for the density budget)
 		bool PerformCPUFrustumCulling(ER_Camera* camera);
+		// Compacts the instances of the visible cells (scaled by the zone's share of the budget) and uploads the changed ones
+		void UpdateVisibleInstances(float aDensityScale);
+		int GetCandidateInstancesCount() { return mCandidateInstancesCount; }
+		float GetScreenCoverage() { return mScreenCoverage; }
+		float GetClosestVisibleDistance() { return mClosestVisibleDistance; }
+		int GetPatchesCountToRender() { return mPatchesCountToRender; }
+		int GetVisibleCellsCount() { return mVisibleCellsCount; }
+		int GetGridCellsCount() { return static_cast<int>(mGridCells.size()); }
+		UINT64 GetBytesUploaded() { return mBytesUploaded; } // instance data uploaded in the last culling pass
 
 		void SetName(const std::string& name) { mName = name; mOriginalName = name; }
 		const std::string& GetName() { return mName; }
@@ -148,8 +186,12 @@ namespace EveryRay_Core
 		void PrepareRendering(const ER_CoreTime& gameTime, const ER_ShadowMapper* worldShadowMapper, ER_RHI_GPURootSignature* rs);
 		void InitializeBuffersGPU(int count);
 		void InitializeBuffersCPU();
+		void GenerateDistributionPositions();
+		void BuildGrid();
+		UINT64 CalculateTerrainPlacementHash(ER_Terrain* aTerrain);
+		void MarkPatchesDirty(int aFirstPatch, int aCount);
 		void LoadBillboardModel(FoliageBillboardType bType);
-		void CalculateDynamicLOD(float distanceToCam);
+		float CalculateDynamicLOD(float distanceToCam);
 
 		ER_Core& mCore;
 		ER_Camera& mCamera;
@@ -177,19 +219,37 @@ namespace EveryRay_Core
 		ER_RHI_GPUTexture* mVoxelizationTexture = nullptr;
 
 		GPUFoliageInstanceData* mPatchesBufferGPU = nullptr;
-		CPUFoliageData* mPatchesBufferCPU = nullptr;
+		FoliagePatchesData mPatchesCPU;
 		XMFLOAT4* mCurrentPositions = nullptr;
 
-		ER_RHI_GPUBuffer* mInputPositionsOnTerrainBuffer = nullptr; //input positions for on-terrain placement pass
-		ER_RHI_GPUBuffer* mOutputPositionsOnTerrainBuffer = nullptr; //output positions for on-terrain placement pass
+		std::vector<unsigned char> mPatchDirtyFlags; // patches changed since their instance was last uploaded
+		bool mHasDirtyPatches = false;
+		bool mAreMatricesDirty = false; // world matrices of the dirty patches have not been recalculated yet
+		bool mIsGridDirty = false;
+
+		std::vector<FoliageGridCell> mGridCells;
+		std::vector<int> mGridPatchIndices; // patch indices sorted by cell (random order inside a cell, so any prefix is an even thinning of the cell)
+		std::vector<GPUFoliageInstanceData> mVisibleInstancesGPU; // compacted instances of visible cells (after LOD)
+		std::vector<int> mSlotPatchIndices; // patch currently stored in every slot of the GPU instance buffer (-1 - unknown)
+		std::vector<ER_RHI_BUFFER_REGION> mDirtyRegions;
+		UINT64 mBytesUploaded = 0;
+		std::vector<int> mCellCandidateCounts; // instances of every cell after culling and distance LOD (0 - culled)
+		int mGridCellsPerSide = 1;
+		int mVisibleCellsCount = 0;
+		int mCandidateInstancesCount = 0;
+		float mScreenCoverage = 0.0f;
+		float mClosestVisibleDistance = 0.0f;
+
+		ER_Random mRandom;
+		UINT64 mRandomSeed = 0; // from the zone's parameters, so that the zone is always generated the same way
 
 		FoliageBillboardType mType;
 
 		int mTerrainSplatChannel = 4;
 		bool mIsPlacedOnTerrain = false;
+		bool mIsLoadedFromPlacementCache = false; // final (placed) positions were read from the terrain's placement cache
 		float mPlacementHeightDelta = 0.0;
 
-		ER_RenderableAABB* mDebugGizmoAABB = nullptr;
 		ER_AABB mAABB;
 		const float mAABBExtentY = 25.0f;
 		const float mAABBExtentXZ = 1.0f;
@@ -248,7 +308,7 @@ namespace EveryRay_Core
 		void Update(const ER_CoreTime& gameTime, float gustDistance, float strength, float frequency);
 		void Draw(const ER_CoreTime& gameTime, const ER_ShadowMapper* worldShadowMapper, FoliageRenderingPass renderPass,
 			const std::vector<ER_RHI_GPUTexture*>& aGbufferTextures, ER_RHI_GPUTexture* aDepthTarget = nullptr);
-		void DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer);
 		void Config() { mShowDebug = !mShowDebug; }
 
 		void AddFoliage(ER_Foliage* foliage);
@@ -261,12 +321,16 @@ namespace EveryRay_Core
 	private:
 		void UpdateImGui();
 		std::vector<ER_Foliage*> mFoliageCollection;
+		std::vector<FoliageBudgetZoneInput> mBudgetZones;
+		ER_FoliageDensityBudget mDensityBudget;
 		ER_Scene* mScene = nullptr;
 
 		ER_RHI_GPURootSignature* mRootSignature = nullptr;
 
 		FoliageQuality mCurrentFoliageQuality = FoliageQuality::FOLIAGE_HIGH;
 		float mCurrentFoliageQualityFactor = 1.0f; // percentage of drawn foliage patches/instances based on quality preset (only active when > MIN_FOLIAGE_PATCHES_QUALITY_THRESHOLD)
+		int mInstanceBudget = FOLIAGE_DEFAULT_INSTANCE_BUDGET;
+		bool mEnableBudget = true;
 
 		const char* mFoliageZonesNamesUI[MAX_FOLIAGE_ZONES];
 
@@ -278,5 +342,9 @@ namespace EveryRay_Core
 		bool mShowDebug = false;
 		bool mEnabled = true;
 		bool mEnableCulling = true;
+
+		double mCullingTimeMs = 0.0;
+		UINT64 mBytesUploadedLastFrame = 0;
+		std::string mBudgetSolverCheckResult;
 	};
 }
\ No newline at end of file
@@ -16,7 +16,7 @@ namespace EveryRay_Core {
 	static std::string psoNameInstancedWireframe = "ER_RHI_GPUPipelineStateObject: GBufferMaterial w/ Instancing (Wireframe)";
 
 	ER_GBuffer::ER_GBuffer(ER_Core& game, ER_Camera& camera, int width, int height):
-		ER_CoreComponent(game), mWidth(width), mHeight(height)
+		ER_CoreComponent(game), mCamera(camera), mWidth(width), mHeight(height)
 	{
 	}
 
@@ -103,21 +103,96 @@ namespace EveryRay_Core {
 		rhi->SetRootSignature(mRootSignature);
 		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-		ER_MaterialSystems materialSystems;
-		for (auto renderingObjectInfo = scene->objects.begin(); renderingObjectInfo != scene->objects.end(); renderingObjectInfo++)
+		// sorted draw list: the PSO is only set when it changes (and opaque objects are drawn front to back)
+		mDrawList.Clear();
+		const UINT rootSignatureID = mDrawList.GetRootSignatureID(mRootSignature);
+		const UINT materialID = mDrawList.GetMaterialID(ER_MaterialHelper::gbufferMaterialName);
+		for (auto renderingObjectInfo = scene->GetRenderingObjects().begin(); renderingObjectInfo != scene->GetRenderingObjects().end(); renderingObjectInfo++)
 		{
 			ER_RenderingObject* renderingObject = renderingObjectInfo->second;
 			if (renderingObject->IsCulled())
 				continue;
 
-			std::string& psoName = ER_Utility::IsWireframe ? psoNameNonInstancedWireframe : psoNameNonInstanced;
+			auto materialInfo = renderingObject->GetMaterials().find(ER_MaterialHelper::gbufferMaterialName);
+			if (materialInfo == renderingObject->GetMaterials().end())
+				continue;
+
+			ER_DrawItem item;
+			item.Object = renderingObject;
+			item.MaterialName = &materialInfo->first;
+			item.RootSignature = mRootSignature;
 			if (renderingObject->IsInstanced())
-				psoName = ER_Utility::IsWireframe ? psoNameInstancedWireframe : psoNameInstanced;
+				item.PSOName = ER_Utility::IsWireframe ? &psoNameInstancedWireframe : &psoNameInstanced;
+			else
+				item.PSOName = ER_Utility::IsWireframe ? &psoNameNonInstancedWireframe : &psoNameNonInstanced;
+			item.SortKey = ER_DrawList::MakeSortKey(ER_DRAW_LIST_PASS_GBUFFER, rootSignatureID, mDrawList.GetPSOID(*item.PSOName), materialID,
+				ER_DrawList::GetNormalizedDepth(mCamera.Position(), mCamera.FarPlaneDistance(), renderingObject->GetGlobalAABB()));
+			mDrawList.Add(item);
+		}
+		mDrawList.Sort();
+		TransitionIndirectBuffers();
 
-			auto materialInfo = renderingObject->GetMaterials().find(ER_MaterialHelper::gbufferMaterialName);
-			if (materialInfo != renderingObject->GetMaterials().end())
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		const UINT drawsCount = static_cast<UINT>(mDrawList.GetItems().size());
+		const int commandListsCount = std::min(rhi->GetMaxParallelGraphicsCommandListsCount(), static_cast<int>(drawsCount / ER_GBUFFER_PARALLEL_MIN_DRAWS_PER_LIST));
+		if (mRecordInParallel && mWasRecordedOnce && commandListsCount > 1)
+			DrawItemsInParallel(commandListsCount);
+		else
+		{
+			DrawItems(0, drawsCount);
+			rhi->UnsetPSO();
+			mRecordedCommandListsCount = 1;
+		}
+		mWasRecordedOnce = true;
+
+		auto endTime = std::chrono::high_resolution_clock::now();
+		mRecordTimeMs = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
+	}
+
+	// Indirectly rendered objects share the instance and args buffers of ER_GPUCuller (left as UAVs after the culling): they are transitioned
+	// once on the current list, so that the draws (which may be recorded in parallel) do not transition shared resources (see ER_GBufferMaterial)
+	void ER_GBuffer::TransitionIndirectBuffers()
+	{
+		std::vector<ER_RHI_GPUResource*> instanceBuffers;
+		std::vector<ER_RHI_GPUResource*> argsBuffers;
+		for (const ER_DrawItem& item : mDrawList.GetItems())
+		{
+			ER_RenderingObject* renderingObject = item.Object;
+			if (!renderingObject->IsGPUIndirectlyRendered())
+				continue;
+
+			ER_RHI_GPUResource* instanceBuffer = renderingObject->GetIndirectNewInstanceBuffer();
+			ER_RHI_GPUResource* argsBuffer = renderingObject->GetIndirectArgsBuffer();
+			if (instanceBuffer && std::find(instanceBuffers.begin(), instanceBuffers.end(), instanceBuffer) == instanceBuffers.end())
+				instanceBuffers.push_back(instanceBuffer);
+			if (argsBuffer && std::find(argsBuffers.begin(), argsBuffers.end(), argsBuffer) == argsBuffers.end())
+				argsBuffers.push_back(argsBuffer);
+		}
+
+		auto rhi = GetCore()->GetRHI();
+		const int commandListIndex = rhi->GetCurrentGraphicsCommandListIndex();
+		if (!instanceBuffers.empty())
+			rhi->TransitionResources(instanceBuffers, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, commandListIndex);
+		if (!argsBuffers.empty())
+			rhi->TransitionResources(argsBuffers, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT, commandListIndex);
+	}
+
+	void ER_GBuffer::DrawItems(UINT aBegin, UINT aEnd)
+	{
+		auto rhi = GetCore()->GetRHI();
+		const std::vector<ER_DrawItem>& items = mDrawList.GetItems();
+
+		ER_MaterialSystems materialSystems;
+		const std::string* currentPSOName = nullptr;
+		for (UINT i = aBegin; i < aEnd; i++)
+		{
+			const ER_DrawItem& item = items[i];
+			ER_RenderingObject* renderingObject = item.Object;
+			ER_GBufferMaterial* material = static_cast<ER_GBufferMaterial*>(renderingObject->GetMaterials().at(*item.MaterialName));
+			if (item.PSOName != currentPSOName)
 			{
-				ER_GBufferMaterial* material = static_cast<ER_GBufferMaterial*>(materialInfo->second);
+				const std::string& psoName = *item.PSOName;
 				if (!rhi->IsPSOReady(psoName))
 				{
 					rhi->InitializePSO(psoName);
@@ -131,14 +206,48 @@ namespace EveryRay_Core {
 					rhi->FinalizePSO(psoName);
 				}
 				rhi->SetPSO(psoName);
-				for (int meshIndex = 0; meshIndex < renderingObject->GetMeshCount(); meshIndex++)
-				{
-					material->PrepareForRendering(materialSystems, renderingObject, meshIndex, mRootSignature);
-					renderingObject->Draw(ER_MaterialHelper::gbufferMaterialName, true, meshIndex);
-				}
+				currentPSOName = item.PSOName;
 			}
+			for (int meshIndex = 0; meshIndex < renderingObject->GetMeshCount(); meshIndex++)
+			{
+				material->PrepareForRendering(materialSystems, renderingObject, meshIndex, mRootSignature);
+				renderingObject->Draw(ER_MaterialHelper::gbufferMaterialName, true, meshIndex);
+			}
+		}
+	}
+
+	// Splits the sorted draws into contiguous chunks (each keeps the sorted order, so PSO changes only grow by the number of chunks)
+	// and records every chunk into its own command list. The lists are executed in the order of the chunks.
+	void ER_GBuffer::DrawItemsInParallel(int aCommandListsCount)
+	{
+		auto rhi = GetCore()->GetRHI();
+		const UINT drawsCount = static_cast<UINT>(mDrawList.GetItems().size());
+		const UINT drawsPerList = (drawsCount + aCommandListsCount - 1) / aCommandListsCount;
+
+		std::vector<std::function<void(int)>> tasks;
+		tasks.reserve(aCommandListsCount);
+		for (int i = 0; i < aCommandListsCount; i++)
+		{
+			const UINT begin = i * drawsPerList;
+			const UINT end = std::min(begin + drawsPerList, drawsCount);
+			if (begin >= end)
+				break;
+
+			tasks.push_back([this, rhi, begin, end](int aCommandListIndex)
+			{
+				rhi->SetRenderTargets({ mAlbedoBuffer, mNormalBuffer, mPositionsBuffer, mExtraBuffer, mExtra2Buffer }, mDepthBuffer);
+				rhi->SetRootSignature(mRootSignature);
+				rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+				DrawItems(begin, end);
+				rhi->UnsetPSO();
+			});
 		}
-		rhi->UnsetPSO();
+		rhi->RecordParallelGraphicsCommandLists(tasks);
+		mRecordedCommandListsCount = static_cast<int>(tasks.size());
+
+		// the current command list was reopened without our state
+		rhi->SetRenderTargets({ mAlbedoBuffer, mNormalBuffer, mPositionsBuffer, mExtraBuffer, mExtra2Buffer }, mDepthBuffer);
+		rhi->SetRootSignature(mRootSignature);
 	}
 
 	void ER_GBuffer::UpdateImGui()
@@ -148,6 +257,11 @@ namespace EveryRay_Core {
 
 		ImGui::Begin("GBuffer");
 		ImGui::Checkbox("Enabled", &mIsEnabled);
+		const ER_DrawListStats& unsortedStats = mDrawList.GetUnsortedStats();
+		const ER_DrawListStats& sortedStats = mDrawList.GetSortedStats();
+		ImGui::Text("Draws: %d, PSO changes: %d (unsorted: %d), sort: %.3f ms", sortedStats.Draws, sortedStats.PSOChanges, unsortedStats.PSOChanges, mDrawList.GetSortTime());
+		ImGui::Checkbox("Record in parallel", &mRecordInParallel);
+		ImGui::Text("Command lists: %d, recording: %.3f ms", mRecordedCommandListsCount, mRecordTimeMs);
 		ImGui::End();
 	}
 
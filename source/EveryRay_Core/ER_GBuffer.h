@@ -3,6 +3,9 @@
 #include "Common.h"
 #include "ER_CoreComponent.h"
 #include "RHI/ER_RHI.h"
+#include "ER_DrawList.h"
+
+#define ER_GBUFFER_PARALLEL_MIN_DRAWS_PER_LIST 64 // fewer draws are not worth a command list (and a thread) of their own
 
 namespace EveryRay_Core
 {
@@ -33,8 +36,13 @@ namespace EveryRay_Core
 
 	private:
 		void UpdateImGui();
+		void DrawItems(UINT aBegin, UINT aEnd); // of the sorted draw list (PSOs are set when they change)
+		void DrawItemsInParallel(int aCommandListsCount);
+		void TransitionIndirectBuffers();
 
+		ER_Camera& mCamera;
 		ER_RHI_GPURootSignature* mRootSignature = nullptr;
+		ER_DrawList mDrawList; // objects sorted by PSO (instanced/non-instanced) and front to back
 
 		ER_RHI_GPUTexture* mDepthBuffer = nullptr;
 		ER_RHI_GPUTexture* mAlbedoBuffer= nullptr;
@@ -45,7 +53,11 @@ namespace EveryRay_Core
 
 		int mWidth;
 		int mHeight;
+		int mRecordedCommandListsCount = 1;
+		float mRecordTimeMs = 0.0f;
 		bool mIsEnabled = true;
 		bool mShowDebug = false;
+		bool mRecordInParallel = true;
+		bool mWasRecordedOnce = false; // the first frame is recorded on one thread (object textures are transitioned to SRVs there)
 	};
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 #include "ER_Scene.h"
 #include "ER_RenderingObject.h"
 #include "ER_Utility.h"
+#include "ER_Random.h"
+#include "ER_SelfTests.h"
 
 #define GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
 #define GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX 1
@@ -21,6 +23,25 @@
 
 namespace EveryRay_Core
 {
+	// Outward planes (culled if dot(normal, point) + w > 0, as in ER_Frustum) of a camera looking along yaw/pitch
+	static void BuildBenchmarkFrustum(const XMFLOAT3& aPosition, float aYaw, float aPitch, float aNear, float aFar, float aTanHalfFovY, float aAspectRatio, XMFLOAT4* aOutPlanes)
+	{
+		const XMFLOAT3 forward(cosf(aPitch) * sinf(aYaw), sinf(aPitch), cosf(aPitch) * cosf(aYaw));
+		const float rightLength = sqrtf(forward.z * forward.z + forward.x * forward.x);
+		const XMFLOAT3 right(forward.z / rightLength, 0.0f, -forward.x / rightLength);
+		const XMFLOAT3 up(forward.y * right.z - forward.z * right.y, forward.z * right.x - forward.x * right.z, forward.x * right.y - forward.y * right.x);
+		const float tanHalfFovX = aTanHalfFovY * aAspectRatio;
+
+		auto makePlane = [&aPosition](float x, float y, float z, float aDistance) {
+			return XMFLOAT4(x, y, z, -(x * aPosition.x + y * aPosition.y + z * aPosition.z) - aDistance);
+		};
+		aOutPlanes[0] = makePlane(-forward.x, -forward.y, -forward.z, -aNear);
+		aOutPlanes[1] = makePlane(forward.x, forward.y, forward.z, aFar);
+		aOutPlanes[2] = makePlane(-right.x - tanHalfFovX * forward.x, -right.y - tanHalfFovX * forward.y, -right.z - tanHalfFovX * forward.z, 0.0f);
+		aOutPlanes[3] = makePlane(right.x - tanHalfFovX * forward.x, right.y - tanHalfFovX * forward.y, right.z - tanHalfFovX * forward.z, 0.0f);
+		aOutPlanes[4] = makePlane(-up.x - aTanHalfFovY * forward.x, -up.y - aTanHalfFovY * forward.y, -up.z - aTanHalfFovY * forward.z, 0.0f);
+		aOutPlanes[5] = makePlane(up.x - aTanHalfFovY * forward.x, up.y - aTanHalfFovY * forward.y, up.z - aTanHalfFovY * forward.z, 0.0f);
+	}
 
 	ER_GPUCuller::ER_GPUCuller(ER_Core& game, ER_Camera& camera)
 		: mCamera(camera), mCore(game)
@@ -34,10 +55,8 @@ namespace EveryRay_Core
 		DeleteObject(mIndirectCullingClearCS);
 		DeleteObject(mIndirectCullingClearRS);
 
-#if ER_PLATFORM_WIN64_DX11
-		mMeshConstantBuffer.Release();
-#endif
-		mCameraConstantBuffer.Release();
+		ReleaseSharedBuffers();
+		mCullingConstantBuffer.Release();
 	}
 
 	void ER_GPUCuller::Initialize()
@@ -54,8 +73,8 @@ namespace EveryRay_Core
 		if (mIndirectCullingRS)
 		{
 			mIndirectCullingRS->InitDescriptorTable(rhi, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_UAV }, { 0 }, { 2 });
-			mIndirectCullingRS->InitDescriptorTable(rhi, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_SRV }, { 0 }, { 1 });
-			mIndirectCullingRS->InitDescriptorTable(rhi, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 2 });
+			mIndirectCullingRS->InitDescriptorTable(rhi, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_SRV }, { 0 }, { 3 });
+			mIndirectCullingRS->InitDescriptorTable(rhi, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 1 });
 			mIndirectCullingRS->Finalize(rhi, "ER_RHI_GPURootSignature: Indirect Culling Main");
 		}
 
@@ -68,15 +87,164 @@ namespace EveryRay_Core
 		}
 
 		//cbuffers
-#if ER_PLATFORM_WIN64_DX11
-		mMeshConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: GPU Culler Mesh CB");
-#endif
-		mCameraConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: GPU Culler Camera CB");
+		mCullingConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: GPU Culler CB");
+
+		mIndirectArgs.Initialize(rhi);
 	}
 
-	void ER_GPUCuller::ClearCounters(ER_Scene* aScene)
+	void ER_GPUCuller::Update(const ER_CoreTime& time)
+	{
+		UpdateImGui();
+	}
+
+	void ER_GPUCuller::UpdateImGui()
+	{
+		if (!mShowDebug)
+			return;
+
+		ImGui::Begin("GPU Culler");
+		ImGui::Text("Objects: %d, instances: %d", static_cast<int>(mObjects.size()), static_cast<int>(mInstancesCount));
+		ImGui::Text("Dispatches: %d", mIndirectCullsCounterPerFrame);
+		ImGui::Text("Indirect count buffer: %s", mCore.GetRHI()->IsIndirectCountSupported() ? "supported" : "emulated (empty draws)");
+		if (ImGui::Button("Indirect args self-test"))
+			ER_SelfTests::Run(ER_SELF_TEST_INDIRECT_ARGS, mIndirectArgsSelfTestResult);
+		if (!mIndirectArgsSelfTestResult.empty())
+			ImGui::Text("%s", mIndirectArgsSelfTestResult.c_str());
+		if (ImGui::Button("CPU culling benchmark"))
+			ER_SelfTests::Run(ER_SELF_TEST_GPU_CULLER, mBenchmarkResult);
+		if (!mBenchmarkResult.empty())
+			ImGui::Text("%s", mBenchmarkResult.c_str());
+		ImGui::End();
+	}
+
+	void ER_GPUCuller::ReleaseSharedBuffers()
+	{
+		for (ER_RenderingObject* obj : mObjects)
+			obj->SetIndirectCullingRange(nullptr, 0, nullptr, 0);
+		mObjects.clear();
+		mInstancesCount = 0;
+
+		DeleteObject(mInstancesBuffer);
+		DeleteObject(mInstanceObjectsBuffer);
+		DeleteObject(mObjectsBuffer);
+		DeleteObject(mBaseArgsBuffer);
+		DeleteObject(mCulledInstancesBuffer);
+		DeleteObject(mInstanceCountsBuffer);
+		DeleteObject(mArgsBuffer);
+		DeleteObject(mCountBuffer);
+	}
+
+	// Gathers all ready objects into the shared buffers (objects become ready after their first update, so this happens while the level loads)
+	bool ER_GPUCuller::UpdateSharedBuffers(ER_Scene* aScene)
+	{
+		auto rhi = mCore.GetRHI();
+
+		size_t readyObjectsCount = 0;
+		for (const ER_SceneObject& obPair : aScene->GetRenderingObjects())
+		{
+			if (obPair.second->IsGPUIndirectlyRendered() && obPair.second->IsIndirectInstanceDataReady())
+				readyObjectsCount++;
+		}
+		if (readyObjectsCount == mObjects.size())
+			return !mObjects.empty();
+
+		// initial data is uploaded with the graphics command list
+		if (rhi->GetAPI() == DX12 && rhi->GetCurrentGraphicsCommandListIndex() == -1)
+			return !mObjects.empty();
+
+		if (!mObjects.empty())
+			rhi->WaitForGpuOnGraphicsFence(); // previous frames might still use the old buffers
+		ReleaseSharedBuffers();
+
+		const ER_SceneDataStore& dataStore = aScene->GetDataStore();
+		std::vector<ER_GPUCullerInstance> instances;
+		std::vector<UINT> instanceObjects;
+		std::vector<ER_GPUCullerObject> objects;
+		std::vector<ER_IndirectDrawBaseArgs> baseArgs;
+		for (const ER_SceneObject& obPair : aScene->GetRenderingObjects())
+		{
+			ER_RenderingObject* aObj = obPair.second;
+			if (!aObj->IsGPUIndirectlyRendered() || !aObj->IsIndirectInstanceDataReady())
+				continue;
+
+			ER_GPUCullerObject object;
+			object.FirstInstance = static_cast<UINT>(instances.size());
+			object.InstancesCount = aObj->GetInstanceCount();
+			object.LODsCount = static_cast<UINT>(std::min(aObj->GetLODCount(), MAX_LOD));
+
+			const std::vector<InstancedData>& instancesData = aObj->GetInstancesData();
+			for (UINT i = 0; i < object.InstancesCount; i++)
+			{
+				const ER_AABB instanceAABB = dataStore.GetWorldAABB(aObj->GetDataStoreFirstEntry() + i);
+
+				ER_GPUCullerInstance instance;
+				instance.WorldMat = instancesData[i].World;
+				instance.AABBmin = XMFLOAT4(instanceAABB.first.x, instanceAABB.first.y, instanceAABB.first.z, 1.0f);
+				instance.AABBmax = XMFLOAT4(instanceAABB.second.x, instanceAABB.second.y, instanceAABB.second.z, 1.0f);
+				instances.push_back(instance);
+				instanceObjects.push_back(static_cast<UINT>(objects.size()));
+			}
+
+			const XMINT4* drawArgs = aObj->GetIndirectDrawArgsArray();
+			for (int draw = 0; draw < MAX_LOD * MAX_MESH_COUNT; draw++)
+			{
+				ER_IndirectDrawBaseArgs args;
+				args.IndexCountPerInstance = static_cast<UINT>(drawArgs[draw].x);
+				args.StartIndexLocation = static_cast<UINT>(drawArgs[draw].y);
+				args.BaseVertexLocation = drawArgs[draw].z;
+				args.StartInstanceLocation = static_cast<UINT>(drawArgs[draw].w);
+				baseArgs.push_back(args);
+			}
+
+			objects.push_back(object);
+			mObjects.push_back(aObj);
+		}
+		mInstancesCount = static_cast<UINT>(instances.size());
+		if (mInstancesCount == 0)
+		{
+			mObjects.clear();
+			return false;
+		}
+
+		const UINT objectsCount = static_cast<UINT>(objects.size());
+		const UINT drawsCount = objectsCount * MAX_LOD * MAX_MESH_COUNT;
+
+		mInstancesBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Instances Buffer");
+		mInstancesBuffer->CreateGPUBufferResource(rhi, &instances[0], mInstancesCount, sizeof(ER_GPUCullerInstance), false,
+			ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
+		mInstanceObjectsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Instance Objects Buffer");
+		mInstanceObjectsBuffer->CreateGPUBufferResource(rhi, &instanceObjects[0], mInstancesCount, sizeof(UINT), false,
+			ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_NONE, ER_RHI_FORMAT::ER_FORMAT_R32_UINT);
+		mObjectsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Objects Buffer");
+		mObjectsBuffer->CreateGPUBufferResource(rhi, &objects[0], objectsCount, sizeof(ER_GPUCullerObject), false,
+			ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
+		mBaseArgsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Base Args Buffer");
+		mBaseArgsBuffer->CreateGPUBufferResource(rhi, &baseArgs[0], drawsCount, sizeof(ER_IndirectDrawBaseArgs), false,
+			ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
+
+		mCulledInstancesBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Culled Instances Buffer");
+		mCulledInstancesBuffer->CreateGPUBufferResource(rhi, nullptr, mInstancesCount * MAX_LOD, sizeof(ER_GPUCullerInstance), false,
+			ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED, ER_FORMAT_UNKNOWN);
+		mInstanceCountsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Instance Counts Buffer");
+		mInstanceCountsBuffer->CreateGPUBufferResource(rhi, nullptr, objectsCount * MAX_LOD, sizeof(UINT), false,
+			ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_NONE, ER_RHI_FORMAT::ER_FORMAT_R32_UINT);
+		mArgsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Indirect Args Buffer");
+		mArgsBuffer->CreateGPUBufferResource(rhi, nullptr, drawsCount * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT, sizeof(UINT), false,
+			ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_DRAWINDIRECT_ARGS, ER_RHI_FORMAT::ER_FORMAT_R32_UINT);
+		mCountBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: GPU Culler - Indirect Count Buffer");
+		mCountBuffer->CreateGPUBufferResource(rhi, nullptr, ER_INDIRECT_ARGS_COUNT_ARGS_COUNT, sizeof(UINT), false,
+			ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_DRAWINDIRECT_ARGS, ER_RHI_FORMAT::ER_FORMAT_R32_UINT);
+
+		for (UINT i = 0; i < objectsCount; i++)
+			mObjects[i]->SetIndirectCullingRange(mCulledInstancesBuffer, objects[i].FirstInstance * MAX_LOD, mArgsBuffer, i * MAX_LOD * MAX_MESH_COUNT);
+
+		std::wstring msg = L"[ER Logger][ER_GPUCuller] Shared buffers: " + std::to_wstring(objectsCount) + L" objects, " + std::to_wstring(mInstancesCount) + L" instances\n";
+		ER_OUTPUT_LOG(msg.c_str());
+		return true;
+	}
+
+	void ER_GPUCuller::ClearCounters()
 	{
-		assert(aScene);
 		auto rhi = mCore.GetRHI();
 
 		rhi->SetRootSignature(mIndirectCullingClearRS, true);
@@ -89,46 +257,40 @@ namespace EveryRay_Core
 		}
 		rhi->SetPSO(mPSOClearName, true);
 
-		for (ER_SceneObject& obPair : aScene->objects)
-		{
-			ER_RenderingObject* aObj = obPair.second;
+		rhi->SetUnorderedAccessResources(ER_COMPUTE, { mInstanceCountsBuffer }, 0, mIndirectCullingClearRS, GPU_CULL_CLEAR_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
+		rhi->SetConstantBuffers(ER_COMPUTE, { mCullingConstantBuffer.Buffer() }, 0, mIndirectCullingClearRS, GPU_CULL_CLEAR_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
+		rhi->Dispatch(ER_DivideByMultiple(mCullingConstantBuffer.Data.CountersCount, static_cast<UINT>(ER_GPU_CULLER_GROUP_SIZE)), 1u, 1u);
+		mIndirectCullsCounterPerFrame++;
 
-			if (!aObj->IsGPUIndirectlyRendered())
-				continue;
-
-			if (!aObj->GetIndirectArgsBuffer() || !aObj->GetIndirectNewInstanceBuffer())
-				continue;
-
-			rhi->ClearUAV(aObj->GetIndirectNewInstanceBuffer(), 0);
-
-			rhi->SetUnorderedAccessResources(ER_COMPUTE,
-				{
-					aObj->GetIndirectArgsBuffer()
-				}, 0, mIndirectCullingRS, GPU_CULL_CLEAR_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
-
-			ER_RHI_GPUBuffer* meshConstants = nullptr;
-#if ER_PLATFORM_WIN64_DX11
-			UpdateMeshesConstantBuffer(aObj);
-			meshConstants = mMeshConstantBuffer.Buffer();
-#else
-			meshConstants = aObj->GetIndirectMeshConstantBuffer();
-#endif
-			rhi->SetConstantBuffers(ER_COMPUTE, { meshConstants }, 0, mIndirectCullingClearRS, GPU_CULL_CLEAR_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
-
-			rhi->Dispatch(1u, 1u, 1u);
-		}
 		rhi->UnsetPSO();
 		rhi->UnbindResourcesFromShader(ER_COMPUTE);
 	}
 
+	// Clear of the counters, one cull of all instances and one generation of the draw args of all objects (no matter how many objects there are)
 	void ER_GPUCuller::PerformCull(ER_Scene* aScene)
 	{
 		assert(aScene);
 
-		ClearCounters(aScene);
-
 		mIndirectCullsCounterPerFrame = 0;
+		if (!UpdateSharedBuffers(aScene))
+			return;
+
 		auto rhi = mCore.GetRHI();
+		const UINT objectsCount = static_cast<UINT>(mObjects.size());
+
+		for (int i = 0; i < 6; ++i)
+			mCullingConstantBuffer.Data.FrustumPlanes[i] = mCamera.GetFrustum().Planes()[i];
+		mCullingConstantBuffer.Data.LodCameraDistances = XMFLOAT4(
+			ER_Utility::DistancesLOD[0] * ER_Utility::DistancesLOD[0],
+			ER_Utility::DistancesLOD[1] * ER_Utility::DistancesLOD[1],
+			ER_Utility::DistancesLOD[2] * ER_Utility::DistancesLOD[2], 0.0f);
+		mCullingConstantBuffer.Data.CameraPos = XMFLOAT4(mCamera.Position().x, mCamera.Position().y, mCamera.Position().z, 1.0f);
+		mCullingConstantBuffer.Data.InstancesCount = mInstancesCount;
+		mCullingConstantBuffer.Data.CountersCount = objectsCount * MAX_LOD;
+		mCullingConstantBuffer.Data.pad = XMUINT2(0, 0);
+		mCullingConstantBuffer.ApplyChanges(rhi);
+
+		ClearCounters();
 
 		rhi->SetRootSignature(mIndirectCullingRS, true);
 		if (!rhi->IsPSOReady(mPSOName, true))
@@ -140,60 +302,215 @@ namespace EveryRay_Core
 		}
 		rhi->SetPSO(mPSOName, true);
 
-		for (int i = 0; i < 6; ++i)
-			mCameraConstantBuffer.Data.FrustumPlanes[i] = mCamera.GetFrustum().Planes()[i];
-		mCameraConstantBuffer.Data.LodCameraDistances = XMFLOAT4(
-			ER_Utility::DistancesLOD[0] * ER_Utility::DistancesLOD[0], 
-			ER_Utility::DistancesLOD[1] * ER_Utility::DistancesLOD[1],
-			ER_Utility::DistancesLOD[2] * ER_Utility::DistancesLOD[2], 0.0f);
-		mCameraConstantBuffer.Data.CameraPos = XMFLOAT4(mCamera.Position().x, mCamera.Position().y, mCamera.Position().z, 1.0f);
-		mCameraConstantBuffer.ApplyChanges(rhi);
+		rhi->SetShaderResources(ER_COMPUTE, { mInstancesBuffer, mInstanceObjectsBuffer, mObjectsBuffer }, 0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, true);
+		rhi->SetUnorderedAccessResources(ER_COMPUTE, { mCulledInstancesBuffer, mInstanceCountsBuffer }, 0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
+		rhi->SetConstantBuffers(ER_COMPUTE, { mCullingConstantBuffer.Buffer() }, 0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
+		rhi->Dispatch(ER_DivideByMultiple(mInstancesCount, static_cast<UINT>(ER_GPU_CULLER_GROUP_SIZE)), 1u, 1u);
+		mIndirectCullsCounterPerFrame++;
 
-		for (ER_SceneObject& obPair : aScene->objects)
+		rhi->UnsetPSO();
+		rhi->UnbindResourcesFromShader(ER_COMPUTE);
+
+		// all meshes of an object's LOD share its counter
+		mIndirectArgs.Generate(rhi, mBaseArgsBuffer, mInstanceCountsBuffer, mArgsBuffer, mCountBuffer, objectsCount * MAX_LOD * MAX_MESH_COUNT, false,
+			ER_GPU_CULLER_GROUP_SIZE, MAX_MESH_COUNT);
+		mIndirectCullsCounterPerFrame++;
+	}
+
+	bool ER_GPUCuller::IsCulled(const XMFLOAT4* aFrustumPlanes, const XMFLOAT4& aAABBMin, const XMFLOAT4& aAABBMax)
+	{
+		for (int planeID = 0; planeID < 6; ++planeID)
 		{
-			ER_RenderingObject* aObj = obPair.second;
+			const XMFLOAT4& plane = aFrustumPlanes[planeID];
+			const float x = (plane.x > 0.0f) ? aAABBMin.x : aAABBMax.x;
+			const float y = (plane.y > 0.0f) ? aAABBMin.y : aAABBMax.y;
+			const float z = (plane.z > 0.0f) ? aAABBMin.z : aAABBMax.z;
 
-			if (!aObj->IsGPUIndirectlyRendered())
+			if ((plane.x * x + plane.y * y + plane.z * z) + plane.w > 0.0f)
+				return true;
+		}
+		return false;
+	}
+
+	int ER_GPUCuller::GetLODIndex(const XMFLOAT4X4& aWorldMat, const XMFLOAT4& aCameraPos, const XMFLOAT4& aLODCameraSqrDistances)
+	{
+		// translation (worldMat[0][3], worldMat[1][3], worldMat[2][3] in the column-major shader)
+		const float x = aWorldMat._41;
+		const float y = aWorldMat._42;
+		const float z = aWorldMat._43;
+
+		const float distanceToCameraSqr =
+			(aCameraPos.x - x) * (aCameraPos.x - x) +
+			(aCameraPos.y - y) * (aCameraPos.y - y) +
+			(aCameraPos.z - z) * (aCameraPos.z - z);
+
+		if (distanceToCameraSqr <= aLODCameraSqrDistances.x)
+			return 0;
+		else if (aLODCameraSqrDistances.x < distanceToCameraSqr && distanceToCameraSqr <= aLODCameraSqrDistances.y)
+			return 1;
+		else if (aLODCameraSqrDistances.y < distanceToCameraSqr && distanceToCameraSqr <= aLODCameraSqrDistances.z)
+			return 2;
+
+		return -1;
+	}
+
+	void ER_GPUCuller::CullInstances(const IndirectCullingCBufferData::CullingConstants& aConstants, const ER_GPUCullerInstance* aInstances, const UINT* aInstanceObjects,
+		const ER_GPUCullerObject* aObjects, UINT* aOutCounts, int* aOutLODs, ER_GPUCullerInstance* aOutInstances)
+	{
+		for (UINT index = 0; index < aConstants.InstancesCount; index++)
+		{
+			aOutLODs[index] = -1;
+
+			const ER_GPUCullerInstance& data = aInstances[index];
+			if (IsCulled(aConstants.FrustumPlanes, data.AABBmin, data.AABBmax))
 				continue;
 
-			if (!aObj->GetIndirectArgsBuffer() || !aObj->GetIndirectNewInstanceBuffer() || !aObj->GetIndirectOriginalInstanceBuffer())
+			const int lod = GetLODIndex(data.WorldMat, aConstants.CameraPos, aConstants.LodCameraDistances);
+			const UINT objectIndex = aInstanceObjects[index];
+			const ER_GPUCullerObject& object = aObjects[objectIndex];
+			if (lod == -1 || lod >= static_cast<int>(object.LODsCount))
 				continue;
 
-			rhi->SetShaderResources(ER_COMPUTE, { aObj->GetIndirectOriginalInstanceBuffer() }, 0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, true);
-			
-			rhi->SetUnorderedAccessResources(ER_COMPUTE,
-				{ 
-					aObj->GetIndirectNewInstanceBuffer(),
-					aObj->GetIndirectArgsBuffer()
-				}, 0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
-
-			ER_RHI_GPUBuffer* meshConstants = nullptr;
-#if ER_PLATFORM_WIN64_DX11
-			UpdateMeshesConstantBuffer(aObj);
-			meshConstants = mMeshConstantBuffer.Buffer();
-#else
-			meshConstants = aObj->GetIndirectMeshConstantBuffer();
-#endif
-			rhi->SetConstantBuffers(ER_COMPUTE, { meshConstants, mCameraConstantBuffer.Buffer() },
-				0, mIndirectCullingRS, GPU_CULL_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
-
-			rhi->Dispatch(ER_DivideByMultiple(static_cast<UINT>(aObj->GetInstanceCount()), 64u), 1u, 1u);
-			mIndirectCullsCounterPerFrame++;
+			const UINT outIndex = aOutCounts[objectIndex * MAX_LOD + lod]++;
+			aOutLODs[index] = lod;
+			if (aOutInstances)
+				aOutInstances[object.FirstInstance * MAX_LOD + object.InstancesCount * lod + outIndex] = data;
 		}
-		rhi->UnsetPSO();
-		rhi->UnbindResourcesFromShader(ER_COMPUTE);
 	}
 
-#if ER_PLATFORM_WIN64_DX11
-	void ER_GPUCuller::UpdateMeshesConstantBuffer(const ER_RenderingObject* aObj)
+	bool ER_GPUCuller::RunBenchmark(int aObjectsCount, int aInstancesPerObject, int aFramesCount, std::string& aOutReport)
 	{
-		auto rhi = mCore.GetRHI();
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		const float fieldSize = ER_Utility::DistancesLOD[MAX_LOD - 1] * 1.5f; // instances of all LODs and beyond
+
+		// clusters of instances (i.e. foliage, rocks) with a random LODs count per object
+		std::vector<ER_GPUCullerObject> objects(aObjectsCount);
+		std::vector<ER_GPUCullerInstance> instances;
+		std::vector<UINT> instanceObjects;
+		for (int o = 0; o < aObjectsCount; o++)
+		{
+			objects[o].FirstInstance = static_cast<UINT>(instances.size());
+			objects[o].InstancesCount = static_cast<UINT>(random.NextInt(1, std::max(2, 2 * aInstancesPerObject)));
+			objects[o].LODsCount = static_cast<UINT>(random.NextInt(1, MAX_LOD + 1));
+
+			const XMFLOAT3 center(random.NextFloat(-fieldSize, fieldSize), 0.0f, random.NextFloat(-fieldSize, fieldSize));
+			const float radius = random.NextFloat(10.0f, 200.0f);
+			for (UINT i = 0; i < objects[o].InstancesCount; i++)
+			{
+				const XMFLOAT3 position(center.x + random.NextFloat(-radius, radius), random.NextFloat(0.0f, 10.0f), center.z + random.NextFloat(-radius, radius));
+				const float extent = random.NextFloat(0.5f, 5.0f);
+
+				ER_GPUCullerInstance instance;
+				instance.WorldMat = XMFLOAT4X4(
+					1.0f, 0.0f, 0.0f, 0.0f,
+					0.0f, 1.0f, 0.0f, 0.0f,
+					0.0f, 0.0f, 1.0f, 0.0f,
+					position.x, position.y, position.z, 1.0f);
+				instance.AABBmin = XMFLOAT4(position.x - extent, position.y - extent, position.z - extent, 1.0f);
+				instance.AABBmax = XMFLOAT4(position.x + extent, position.y + extent, position.z + extent, 1.0f);
+				instances.push_back(instance);
+				instanceObjects.push_back(static_cast<UINT>(o));
+			}
+		}
+		const UINT instancesCount = static_cast<UINT>(instances.size());
+
+		IndirectCullingCBufferData::CullingConstants constants;
+		constants.LodCameraDistances = XMFLOAT4(
+			ER_Utility::DistancesLOD[0] * ER_Utility::DistancesLOD[0],
+			ER_Utility::DistancesLOD[1] * ER_Utility::DistancesLOD[1],
+			ER_Utility::DistancesLOD[2] * ER_Utility::DistancesLOD[2], 0.0f);
+		constants.InstancesCount = instancesCount;
+		constants.CountersCount = static_cast<UINT>(aObjectsCount) * MAX_LOD;
+		constants.pad = XMUINT2(0, 0);
+
+		std::vector<UINT> counts(constants.CountersCount), perObjectCounts(constants.CountersCount);
+		std::vector<int> lods(instancesCount), perObjectLODs(instancesCount);
+		std::vector<ER_GPUCullerInstance> culledInstances(instancesCount * MAX_LOD), perObjectCulledInstances(instancesCount * MAX_LOD);
+
+		std::vector<ER_GPUCullerInstance> expectedInstances, rangeInstances;
+		auto isInstanceLess = [](const ER_GPUCullerInstance& a, const ER_GPUCullerInstance& b) { return memcmp(&a, &b, sizeof(ER_GPUCullerInstance)) < 0; };
+
+		double batchedTime = 0.0;
+		double perObjectTime = 0.0;
+		int mismatches = 0;
+		int errors = 0;
+		UINT64 visibleInstances = 0;
+		UINT64 visibleInstancesPerLOD[MAX_LOD] = {};
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			const XMFLOAT3 cameraPosition(random.NextFloat(-fieldSize, fieldSize), random.NextFloat(2.0f, 50.0f), random.NextFloat(-fieldSize, fieldSize));
+			BuildBenchmarkFrustum(cameraPosition, random.NextFloat(0.0f, 6.2831853f), random.NextFloat(-0.3f, 0.1f), 0.1f, 5000.0f, 0.57735f, 16.0f / 9.0f, constants.FrustumPlanes);
+			constants.CameraPos = XMFLOAT4(cameraPosition.x, cameraPosition.y, cameraPosition.z, 1.0f);
+
+			// one pass over all objects (the batched dispatch)
+			auto startTime = std::chrono::high_resolution_clock::now();
+			std::fill(counts.begin(), counts.end(), 0u);
+			CullInstances(constants, instances.data(), instanceObjects.data(), objects.data(), counts.data(), lods.data(), culledInstances.data());
+			auto endTime = std::chrono::high_resolution_clock::now();
+			batchedTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+			// one clear and one pass per object (the previous dispatch layout)
+			startTime = std::chrono::high_resolution_clock::now();
+			for (int o = 0; o < aObjectsCount; o++)
+			{
+				const ER_GPUCullerObject& object = objects[o];
+				std::fill(perObjectCounts.begin() + o * MAX_LOD, perObjectCounts.begin() + (o + 1) * MAX_LOD, 0u);
+
+				IndirectCullingCBufferData::CullingConstants objectConstants = constants;
+				objectConstants.InstancesCount = object.InstancesCount;
+				CullInstances(objectConstants, instances.data() + object.FirstInstance, instanceObjects.data() + object.FirstInstance, objects.data(),
+					perObjectCounts.data(), perObjectLODs.data() + object.FirstInstance, perObjectCulledInstances.data());
+			}
+			endTime = std::chrono::high_resolution_clock::now();
+			perObjectTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+			if (counts != perObjectCounts || lods != perObjectLODs)
+				mismatches++;
+
+			// every object/LOD range holds exactly the visible instances of that LOD. Ranges are compared as sets: on GPU the slots come from
+			// InterlockedAdd, so only the counts and the instances of a range are deterministic, not their order.
+			for (int o = 0; o < aObjectsCount; o++)
+			{
+				const ER_GPUCullerObject& object = objects[o];
+				for (int lod = 0; lod < MAX_LOD; lod++)
+				{
+					expectedInstances.clear();
+					for (UINT i = object.FirstInstance; i < object.FirstInstance + object.InstancesCount; i++)
+					{
+						if (lods[i] == lod)
+							expectedInstances.push_back(instances[i]);
+					}
+					std::sort(expectedInstances.begin(), expectedInstances.end(), isInstanceLess);
+
+					const UINT count = counts[o * MAX_LOD + lod];
+					if (count != static_cast<UINT>(expectedInstances.size()))
+					{
+						errors++;
+						continue;
+					}
+
+					const UINT first = object.FirstInstance * MAX_LOD + object.InstancesCount * lod;
+					for (const std::vector<ER_GPUCullerInstance>* output : { &culledInstances, &perObjectCulledInstances })
+					{
+						rangeInstances.assign(output->begin() + first, output->begin() + first + count);
+						std::sort(rangeInstances.begin(), rangeInstances.end(), isInstanceLess);
+						if (count > 0 && memcmp(rangeInstances.data(), expectedInstances.data(), count * sizeof(ER_GPUCullerInstance)) != 0)
+							errors++;
+					}
+
+					visibleInstances += count;
+					visibleInstancesPerLOD[lod] += count;
+				}
+			}
+		}
 
-		const XMINT4* argsArray = aObj->GetIndirectDrawArgsArray();
-		memcpy(mMeshConstantBuffer.Data.IndexCount_StartIndexLoc_BaseVtxLoc_StartInstLoc, argsArray, sizeof(XMINT4) * MAX_LOD * MAX_MESH_COUNT);
-		mMeshConstantBuffer.Data.OriginalInstancesCount = aObj->GetInstanceCount();
-		mMeshConstantBuffer.Data.pad = XMINT3(0,0,0);
-		mMeshConstantBuffer.ApplyChanges(rhi);
+		const UINT64 frames = static_cast<UINT64>(std::max(1, aFramesCount));
+		aOutReport = std::to_string(aObjectsCount) + " objects, " + std::to_string(instancesCount) + " instances, " + std::to_string(aFramesCount) + " frames\n" +
+			"visible instances: " + std::to_string(visibleInstances / frames) + " (LODs: " + std::to_string(visibleInstancesPerLOD[0] / frames) + "/" +
+			std::to_string(visibleInstancesPerLOD[1] / frames) + "/" + std::to_string(visibleInstancesPerLOD[2] / frames) + ")\n" +
+			"CPU reference: batched " + std::to_string(batchedTime / aFramesCount) + " ms, per object " + std::to_string(perObjectTime / aFramesCount) + " ms\n" +
+			"GPU commands: batched 3 dispatches, per object " + std::to_string(2 * aObjectsCount) + " dispatches and " + std::to_string(aObjectsCount) + " UAV clears\n" +
+			"counts/LODs mismatches: " + std::to_string(mismatches) + ", instance set errors: " + std::to_string(errors);
+		return mismatches == 0 && errors == 0;
 	}
-#endif
-}
\ No newline at end of file
+}
@@ -2,6 +2,12 @@
 #include "Common.h"
 #include "ER_CoreComponent.h"
 #include "RHI/ER_RHI.h"
+#include "ER_IndirectArgs.h"
+
+#define ER_GPU_CULLER_GROUP_SIZE 64 // must match IndirectCulling.hlsl and IndirectCullingClear.hlsl
+#define ER_GPU_CULLER_BENCHMARK_OBJECTS 1000
+#define ER_GPU_CULLER_BENCHMARK_INSTANCES 64 // average per object
+#define ER_GPU_CULLER_BENCHMARK_FRAMES 20
 
 namespace EveryRay_Core
 {
@@ -11,23 +17,41 @@ namespace EveryRay_Core
 
 	namespace IndirectCullingCBufferData
 	{
-#if ER_PLATFORM_WIN64_DX11
-		struct ER_ALIGN_GPU_BUFFER MeshConstants
-		{
-			XMINT4 IndexCount_StartIndexLoc_BaseVtxLoc_StartInstLoc[MAX_LOD * MAX_MESH_COUNT];
-			UINT OriginalInstancesCount;
-			XMINT3 pad;
-		};
-#endif
-
-		struct ER_ALIGN_GPU_BUFFER CameraConstants
+		struct ER_ALIGN_GPU_BUFFER CullingConstants
 		{
 			XMFLOAT4 FrustumPlanes[6];
-			XMFLOAT4 LodCameraDistances;
+			XMFLOAT4 LodCameraDistances; // squared
 			XMFLOAT4 CameraPos;
+			UINT InstancesCount;
+			UINT CountersCount; // objects * MAX_LOD
+			XMUINT2 pad;
 		};
 	}
 
+	// Same layout as 'Instance' in IndirectCulling.hlsli
+	struct ER_GPUCullerInstance
+	{
+		XMFLOAT4X4 WorldMat;
+		XMFLOAT4 AABBmin;
+		XMFLOAT4 AABBmax;
+	};
+
+	// Range of an object in the shared buffers, same layout as 'CulledObject' in IndirectCulling.hlsli.
+	// Its culled instances of LOD 'l' are at FirstInstance * MAX_LOD + InstancesCount * l, its draws at (object * MAX_LOD + l) * MAX_MESH_COUNT + mesh.
+	struct ER_GPUCullerObject
+	{
+		UINT FirstInstance = 0;
+		UINT InstancesCount = 0;
+		UINT LODsCount = 0;
+		UINT pad = 0;
+	};
+
+	// Culls the instances of all GPU indirectly rendered objects in one dispatch: their instances, AABBs and draw args live in shared buffers
+	// (rebuilt when objects become ready), counters are cleared in one dispatch and the draw args of all objects are written in one dispatch
+	// (ER_IndirectArgs). The objects draw from their ranges of the shared buffers (see ER_RenderingObject::SetIndirectCullingRange()).
+	// The static part is the CPU reference of IndirectCulling.hlsl (same culling and LOD selection), so the results can be verified and
+	// benchmarked without a device (see RunBenchmark() and ER_SELF_TEST_GPU_CULLER). It is not bit-exact with the GPU output: there the slots
+	// of the visible instances come from InterlockedAdd, so only the per-object/LOD counts and the sets of instances in each range match.
 	class ER_GPUCuller : public ER_CoreComponent
 	{
 	public:
@@ -35,25 +59,57 @@ namespace EveryRay_Core
 		~ER_GPUCuller();
 
 		void Initialize();
+		void Update(const ER_CoreTime& time);
 		void PerformCull(ER_Scene* aScene);
-		void ClearCounters(ER_Scene* aScene);
 
+		void Config() { mShowDebug = !mShowDebug; }
+
+		// CPU reference of IndirectCulling.hlsl: aOutCounts (aObjectsCount * MAX_LOD) must be cleared, aOutLODs gets the LOD of every instance (-1 if culled),
+		// aOutInstances (optional, FirstInstance * MAX_LOD + InstancesCount * LOD of each object) gets the visible instances in their order (on GPU in the order
+		// of InterlockedAdd, which is not deterministic)
+		static void CullInstances(const IndirectCullingCBufferData::CullingConstants& aConstants, const ER_GPUCullerInstance* aInstances, const UINT* aInstanceObjects,
+			const ER_GPUCullerObject* aObjects, UINT* aOutCounts, int* aOutLODs, ER_GPUCullerInstance* aOutInstances = nullptr);
+		static bool IsCulled(const XMFLOAT4* aFrustumPlanes, const XMFLOAT4& aAABBMin, const XMFLOAT4& aAABBMax);
+		static int GetLODIndex(const XMFLOAT4X4& aWorldMat, const XMFLOAT4& aCameraPos, const XMFLOAT4& aLODCameraSqrDistances);
+
+		// Random objects and cameras: the batched pass against one pass per object (the previous dispatch layout) on CPU (timings, visible instances,
+		// GPU commands of both layouts). Fails if the per-object/LOD counts or LODs differ, or if a range does not hold exactly the set of its visible
+		// instances (compared in any order, as on GPU)
+		static bool RunBenchmark(int aObjectsCount, int aInstancesPerObject, int aFramesCount, std::string& aOutReport);
 	private:
+		void UpdateImGui();
+		bool UpdateSharedBuffers(ER_Scene* aScene); // returns false if there is nothing to cull
+		void ReleaseSharedBuffers();
+		void ClearCounters();
+
 		ER_Core& mCore;
 		ER_Camera& mCamera;
 
 		ER_RHI_GPUShader* mIndirectCullingCS = nullptr;
 		ER_RHI_GPUShader* mIndirectCullingClearCS = nullptr;
-#if ER_PLATFORM_WIN64_DX11
-		void UpdateMeshesConstantBuffer(const ER_RenderingObject* aObj);
-		ER_RHI_GPUConstantBuffer<IndirectCullingCBufferData::MeshConstants> mMeshConstantBuffer;
-#endif
-		ER_RHI_GPUConstantBuffer<IndirectCullingCBufferData::CameraConstants> mCameraConstantBuffer;
+		ER_RHI_GPUConstantBuffer<IndirectCullingCBufferData::CullingConstants> mCullingConstantBuffer;
 		ER_RHI_GPURootSignature* mIndirectCullingRS = nullptr;
 		ER_RHI_GPURootSignature* mIndirectCullingClearRS = nullptr;
 		const std::string mPSOName = "ER_RHI_GPUPipelineStateObject: Indirect Cull Pass";
 		const std::string mPSOClearName = "ER_RHI_GPUPipelineStateObject: Indirect Cull Pass Clear";
-		
-		int mIndirectCullsCounterPerFrame = 0;
+
+		ER_IndirectArgs mIndirectArgs;
+
+		// shared buffers of all culled objects
+		std::vector<ER_RenderingObject*> mObjects;
+		ER_RHI_GPUBuffer* mInstancesBuffer = nullptr; // ER_GPUCullerInstance
+		ER_RHI_GPUBuffer* mInstanceObjectsBuffer = nullptr; // object index of every instance
+		ER_RHI_GPUBuffer* mObjectsBuffer = nullptr; // ER_GPUCullerObject
+		ER_RHI_GPUBuffer* mBaseArgsBuffer = nullptr; // ER_IndirectDrawBaseArgs of every draw
+		ER_RHI_GPUBuffer* mCulledInstancesBuffer = nullptr; // ER_GPUCullerInstance of every LOD
+		ER_RHI_GPUBuffer* mInstanceCountsBuffer = nullptr; // visible instances of every object's LOD
+		ER_RHI_GPUBuffer* mArgsBuffer = nullptr;
+		ER_RHI_GPUBuffer* mCountBuffer = nullptr;
+		UINT mInstancesCount = 0;
+
+		int mIndirectCullsCounterPerFrame = 0; // dispatches
+		bool mShowDebug = false;
+		std::string mIndirectArgsSelfTestResult;
+		std::string mBenchmarkResult;
 	};
-}
\ No newline at end of file
+}
@@ -20,12 +20,13 @@
 #include "ER_GBuffer.h"
 #include "ER_ShadowMapper.h"
 #include "ER_FoliageManager.h"
-#include "ER_RenderableAABB.h"
+#include "ER_DebugRenderer.h"
 #include "ER_LightProbe.h"
 #include "ER_MaterialsCallbacks.h"
 #include "ER_RenderingObject.h"
 #include "ER_Skybox.h"
 #include "ER_VolumetricFog.h"
+#include "ER_SelfTests.h"
 
 static float clearColorBlack[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 
@@ -106,7 +107,6 @@ namespace EveryRay_Core {
 		for (int i = 0; i < NUM_VOXEL_GI_CASCADES; i++)
 		{
 			DeleteObject(mVCTVoxelCascades3DRTs[i]);
-			DeleteObject(mDebugVoxelZonesGizmos[i]);
 		}
 		DeleteObject(mVCTVoxelizationDebugRT);
 		DeleteObject(mVCTMainRT);
@@ -233,11 +233,9 @@ namespace EveryRay_Core {
 
 					mVoxelCameraPositions[i] = XMFLOAT4(mCamera.Position().x, mCamera.Position().y, mCamera.Position().z, 1.0f);
 
-					mDebugVoxelZonesGizmos[i] = new ER_RenderableAABB(*mCore, XMFLOAT4(0.1f, 0.34f, 0.1f, 1.0f));
 					float maxBB = voxelCascadesSizes[i] / mWorldVoxelScales[i] * 0.5f;
 					mLocalVoxelCascadesAABBs[i].first = XMFLOAT3(-maxBB, -maxBB, -maxBB);
 					mLocalVoxelCascadesAABBs[i].second = XMFLOAT3(maxBB, maxBB, maxBB);
-					mDebugVoxelZonesGizmos[i]->InitializeGeometry({ mLocalVoxelCascadesAABBs[i].first, mLocalVoxelCascadesAABBs[i].second });
 				}
 				mVCTMainRT = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Voxel Cone Tracing Main RT");
 				mVCTMainRT->CreateGPUTextureResource(rhi, static_cast<UINT>(mCore->ScreenWidth()) * mVCTDownscaleFactor, static_cast<UINT>(mCore->ScreenHeight()) * mVCTDownscaleFactor, 1u,
@@ -360,10 +358,10 @@ namespace EveryRay_Core {
 		materialSystems.mShadowMapper = &mShadowMapper;
 		materialSystems.mProbesManager = mProbesManager;
 
-		for (auto& obj : scene->objects)
+		for (auto& obj : scene->GetRenderingObjects())
 		{
 			if (obj.second->IsForwardShading())
-				mForwardPassObjects.emplace(obj);
+				mForwardPassObjects.push_back(obj.second->GetHandle());
 		}
 	}
 
@@ -421,6 +419,9 @@ namespace EveryRay_Core {
 
 		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
+		auto scene = mCore->GetLevel()->mScene;
+		assert(scene);
+
 		//voxelization
 		{
 			rhi->SetRootSignature(mVoxelizationRS);
@@ -442,17 +443,17 @@ namespace EveryRay_Core {
 				std::string materialName = ER_MaterialHelper::voxelizationMaterialName + "_" + std::to_string(cascade);
 				const std::string& psoName = voxelizationPSONames[cascade];
 
-				for (auto& obj : mVoxelizationObjects[cascade])
+				for (auto& objectHandle : mVoxelizationObjects[cascade])
 				{
-					if (!obj.second->IsInVoxelization())
+					ER_RenderingObject* renderingObject = scene->GetRenderingObject(objectHandle);
+					if (!renderingObject || !renderingObject->IsInVoxelization())
 						continue;
 
-					ER_RenderingObject* renderingObject = obj.second;
 					auto materialInfo = renderingObject->GetMaterials().find(materialName);
 					if (materialInfo != renderingObject->GetMaterials().end())
 					{
 						ER_Material* material = materialInfo->second;
-						for (int meshIndex = 0; meshIndex < obj.second->GetMeshCount(); meshIndex++)
+						for (int meshIndex = 0; meshIndex < renderingObject->GetMeshCount(); meshIndex++)
 						{
 							if (!rhi->IsPSOReady(psoName))
 							{
@@ -467,7 +468,7 @@ namespace EveryRay_Core {
 							rhi->SetPSO(psoName);
 							static_cast<ER_VoxelizationMaterial*>(material)->PrepareForRendering(materialSystems, renderingObject, meshIndex,
 								mWorldVoxelScales[cascade], voxelCascadesSizes[cascade], mVoxelCameraPositions[cascade], mVoxelizationRS);
-							renderingObject->Draw(materialName, true, meshIndex);
+							renderingObject->DrawVoxelization(materialName, meshIndex, cascade);
 							rhi->UnsetPSO();
 						}
 					}
@@ -653,7 +654,7 @@ namespace EveryRay_Core {
 		rhi->UnbindResourcesFromShader(ER_COMPUTE);
 	}
 
-	void ER_Illumination::DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void ER_Illumination::DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer)
 	{
 		if (mCurrentGIQuality == GIQuality::GI_LOW)
 			return;
@@ -663,7 +664,7 @@ namespace EveryRay_Core {
 		{
 			for (int i = 0; i < NUM_VOXEL_GI_CASCADES; i++)
 			{
-				mDebugVoxelZonesGizmos[i]->Draw(aRenderTarget, aDepth, rs);
+				aDebugRenderer->AddAABB(mWorldVoxelCascadesAABBs[i], XMFLOAT4(0.1f, 0.34f, 0.1f, 1.0f));
 			}
 		}
 
@@ -688,7 +689,7 @@ namespace EveryRay_Core {
 	{
 		//check SSS culling
 		{
-			for (auto& objectInfo : scene->objects)
+			for (auto& objectInfo : scene->GetRenderingObjects())
 			{
 				if (!objectInfo.second->IsCulled() && objectInfo.second->IsRendered() && objectInfo.second->IsSeparableSubsurfaceScattering())
 				{
@@ -754,6 +755,20 @@ namespace EveryRay_Core {
 			}
 		}
 		
+		if (ImGui::CollapsingHeader("Forward Pass Draw List"))
+		{
+			const ER_DrawListStats& unsortedStats = mForwardDrawList.GetUnsortedStats();
+			const ER_DrawListStats& sortedStats = mForwardDrawList.GetSortedStats();
+			ImGui::Text("Draws: %d, sort: %.3f ms", sortedStats.Draws, mForwardDrawList.GetSortTime());
+			ImGui::Text("Root signature changes: %d (unsorted: %d)", sortedStats.RootSignatureChanges, unsortedStats.RootSignatureChanges);
+			ImGui::Text("PSO changes: %d (unsorted: %d)", sortedStats.PSOChanges, unsortedStats.PSOChanges);
+			ImGui::Text("Material changes: %d (unsorted: %d)", sortedStats.MaterialChanges, unsortedStats.MaterialChanges);
+			if (ImGui::Button("Run sort benchmark (10k draws)"))
+				ER_SelfTests::Run(ER_SELF_TEST_DRAW_LIST, mDrawListBenchmarkResult);
+			if (!mDrawListBenchmarkResult.empty())
+				ImGui::TextWrapped(mDrawListBenchmarkResult.c_str());
+		}
+
 		// if (ImGui::CollapsingHeader("Shadow Properties"))
 		// {
 		// 	ImGui::SliderFloat("Cascade #0 distance", &ER_Utility::ShadowCascadeDistances[0], 0.0f, 300.0f);
@@ -792,9 +807,6 @@ namespace EveryRay_Core {
 			{
 				mVoxelCameraPositions[i] = XMFLOAT4(mCamera.Position().x, mCamera.Position().y, mCamera.Position().z, 1.0f);
 				mIsVCTVoxelCameraPositionsUpdated = true;
-
-				if (mDebugVoxelZonesGizmos[i])
-					mDebugVoxelZonesGizmos[i]->Update(mWorldVoxelCascadesAABBs[i]);
 			}
 			else
 				mIsVCTVoxelCameraPositionsUpdated = false;
@@ -900,51 +912,96 @@ namespace EveryRay_Core {
 			return;
 
 		rhi->SetRenderTargets({ aRenderTarget }, gbuffer->GetDepth());
-		rhi->SetRootSignature(mForwardLightingRS);
 		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-		for (auto& obj : mForwardPassObjects)
-			obj.second->Draw(ER_MaterialHelper::forwardLightingNonMaterialName);
-
-		rhi->UnsetPSO();
-
 		auto scene = mCore->GetLevel()->mScene;
 		assert(scene);
+
+		const XMFLOAT3& cameraPosition = mCamera.Position();
+		const float farPlaneDistance = mCamera.FarPlaneDistance();
+		mForwardDrawList.Clear();
+
+		// forward shaded objects: opaque ones front to back, transparent ones back to front
+		const UINT forwardRootSignatureID = mForwardDrawList.GetRootSignatureID(mForwardLightingRS);
+		const UINT forwardMaterialID = mForwardDrawList.GetMaterialID(ER_MaterialHelper::forwardLightingNonMaterialName);
+		for (auto& objectHandle : mForwardPassObjects)
+		{
+			ER_RenderingObject* renderingObject = scene->GetRenderingObject(objectHandle);
+			if (!renderingObject)
+				continue;
+
+			ER_DrawItem item;
+			item.Object = renderingObject;
+			item.MaterialName = &ER_MaterialHelper::forwardLightingNonMaterialName;
+			item.PSOName = &GetForwardLightingPSOName(renderingObject);
+			item.RootSignature = mForwardLightingRS;
+			const bool isTransparent = renderingObject->IsTransparent();
+			item.SortKey = ER_DrawList::MakeSortKey(isTransparent ? ER_DRAW_LIST_PASS_FORWARD_TRANSPARENT : ER_DRAW_LIST_PASS_FORWARD, forwardRootSignatureID,
+				mForwardDrawList.GetPSOID(*item.PSOName), forwardMaterialID, ER_DrawList::GetNormalizedDepth(cameraPosition, farPlaneDistance, renderingObject->GetGlobalAABB()));
+			mForwardDrawList.Add(item);
+		}
+
 		// Passes for all other materials (which are called "standard") that are rendered in "Forward" way into local illumination RT.
 		// This can be used for all kinds of materials that are layered onto each other (transparent ones can also be rendered here).
-		// TODO: We'd better render objects in batches per material in order to reduce SetRootSignature()/SetPSO() calls etc. Code below is not optimal
-		for (auto& it = scene->objects.begin(); it != scene->objects.end(); it++)
+		// They set their own root signatures and PSOs (one per material and instancing), so the key only groups them by these.
+		for (auto& it = scene->GetRenderingObjects().begin(); it != scene->GetRenderingObjects().end(); it++)
 		{
 			for (auto& mat : it->second->GetMaterials())
 			{
-				if (mat.second->IsStandard())
-				{
-					it->second->Draw(mat.first);
-					rhi->UnsetPSO();
-				}
+				if (!mat.second->IsStandard())
+					continue;
+
+				ER_DrawItem item;
+				item.Object = it->second;
+				item.MaterialName = &mat.first;
+				item.RootSignature = scene->GetStandardMaterialRootSignature(mat.first);
+				item.SortKey = ER_DrawList::MakeSortKey(ER_DRAW_LIST_PASS_FORWARD_LAYERED, mForwardDrawList.GetRootSignatureID(item.RootSignature),
+					it->second->IsInstanced() ? 1 : 0, mForwardDrawList.GetMaterialID(mat.first),
+					ER_DrawList::GetNormalizedDepth(cameraPosition, farPlaneDistance, it->second->GetGlobalAABB()));
+				mForwardDrawList.Add(item);
 			}
 		}
+		mForwardDrawList.Sort();
+
+		// state is only reset between batches (same pass, root signature and PSO); blended passes are in depth order, so their batches are shorter
+		UINT64 currentStateKey = ~0ull;
+		for (const ER_DrawItem& item : mForwardDrawList.GetItems())
+		{
+			const UINT64 stateKey = ER_DrawList::GetStateKey(item.SortKey) >> ER_DRAW_LIST_KEY_MATERIAL_SHIFT;
+			if (stateKey != currentStateKey)
+			{
+				rhi->UnsetPSO();
+				if (item.PSOName)
+					rhi->SetRootSignature(item.RootSignature);
+				currentStateKey = stateKey;
+			}
+			item.Object->Draw(*item.MaterialName);
+		}
+		rhi->UnsetPSO();
 	}
 
-	void ER_Illumination::PreparePipelineForForwardLighting(ER_RenderingObject* aObj)
+	const std::string& ER_Illumination::GetForwardLightingPSOName(ER_RenderingObject* aObj) const
 	{
-		auto rhi = mCore->GetRHI();
-
-		std::string& psoName = mForwardLightingPSOName;
 		if (!aObj->IsTransparent())
 		{
 			if (aObj->IsInstanced())
-				psoName = !ER_Utility::IsWireframe ? mForwardLightingInstancingPSOName : mForwardLightingInstancingWireframePSOName;
+				return !ER_Utility::IsWireframe ? mForwardLightingInstancingPSOName : mForwardLightingInstancingWireframePSOName;
 			else
-				psoName = !ER_Utility::IsWireframe ? mForwardLightingPSOName : mForwardLightingWireframePSOName;
+				return !ER_Utility::IsWireframe ? mForwardLightingPSOName : mForwardLightingWireframePSOName;
 		}
 		else
 		{
 			if (aObj->IsInstanced())
-				psoName = !ER_Utility::IsWireframe ? mForwardLightingTransparentInstancingPSOName : mForwardLightingTransparentInstancingWireframePSOName;
+				return !ER_Utility::IsWireframe ? mForwardLightingTransparentInstancingPSOName : mForwardLightingTransparentInstancingWireframePSOName;
 			else
-				psoName = !ER_Utility::IsWireframe ? mForwardLightingTransparentPSOName : mForwardLightingTransparentWireframePSOName;
+				return !ER_Utility::IsWireframe ? mForwardLightingTransparentPSOName : mForwardLightingTransparentWireframePSOName;
 		}
+	}
+
+	void ER_Illumination::PreparePipelineForForwardLighting(ER_RenderingObject* aObj)
+	{
+		auto rhi = mCore->GetRHI();
 
+		const std::string& psoName = GetForwardLightingPSOName(aObj);
 		if (!rhi->IsPSOReady(psoName))
 		{
 			rhi->InitializePSO(psoName);
@@ -1041,7 +1098,7 @@ namespace EveryRay_Core {
 				rhi->SetShaderResources(ER_PIXEL, resources, 0, mForwardLightingRS, FORWARD_LIGHTING_PASS_ROOT_DESCRIPTOR_TABLE_PIXEL_SRV_INDEX);
 			}
 
-			if (aObj->IsGPUIndirectlyRendered())
+			if (aObj->IsGPUIndirectlyRendered() && aObj->GetIndirectNewInstanceBuffer())
 				rhi->SetShaderResources(ER_VERTEX, { aObj->GetIndirectNewInstanceBuffer() }, static_cast<int>(resources.size()), mForwardLightingRS, FORWARD_LIGHTING_PASS_ROOT_DESCRIPTOR_TABLE_VERTEX_SRV_INDEX);
 
 			// we unset PSO after all objects are rendered
@@ -1053,43 +1110,29 @@ namespace EveryRay_Core {
 		return mGbuffer->GetDepth();
 	}
 
+	// Per-cascade bitsets of the scene's data store entries (objects and their instances) overlapping the cascade; computed in parallel
+	// on the scene's worker pool, one task per cascade (only reads the store). Instanced objects then upload just their overlapping instances for voxelization.
 	void ER_Illumination::CPUCullObjectsAgainstVoxelCascades(const ER_Scene* scene)
 	{
 		if (mCurrentGIQuality == GIQuality::GI_LOW)
 			return;
 
-		//TODO add instancing support
 		//TODO fix repetition checks when the object AABB is bigger than the lower cascade (i.e. sponza)
 		//TODO add optimization for culling objects by checking its volume size in second+ cascades
 		//TODO add indirect drawing support (GPU cull)
-		//TODO add multithreading per cascade
+		const ER_SceneDataStore& dataStore = scene->GetDataStore();
+		scene->GetWorkerPool().Run(NUM_VOXEL_GI_CASCADES, [&](int aCascade) { dataStore.OverlapAABB(mWorldVoxelCascadesAABBs[aCascade], mVoxelCascadesOverlapBits[aCascade]); });
+
 		for (int cascade = 0; cascade < NUM_VOXEL_GI_CASCADES; cascade++)
 		{
-			for (auto& objectInfo : scene->objects)
+			mVoxelizationObjects[cascade].clear();
+			for (auto& objectInfo : scene->GetRenderingObjects())
 			{
 				if (!objectInfo.second->IsInVoxelization())
 					continue;
 
-				auto aabbObj = objectInfo.second->GetLocalAABB();
-				XMFLOAT3 position;
-				ER_MatrixHelper::GetTranslation(objectInfo.second->GetTransformationMatrix(), position);
-				aabbObj.first.x += position.x;
-				aabbObj.first.y += position.y;
-				aabbObj.first.z += position.z;
-				aabbObj.second.x += position.x;
-				aabbObj.second.y += position.y;
-				aabbObj.second.z += position.z;
-
-				bool isColliding =
-					(aabbObj.first.x <= mWorldVoxelCascadesAABBs[cascade].second.x && aabbObj.second.x >= mWorldVoxelCascadesAABBs[cascade].first.x) &&
-					(aabbObj.first.y <= mWorldVoxelCascadesAABBs[cascade].second.y && aabbObj.second.y >= mWorldVoxelCascadesAABBs[cascade].first.y) &&
-					(aabbObj.first.z <= mWorldVoxelCascadesAABBs[cascade].second.z && aabbObj.second.z >= mWorldVoxelCascadesAABBs[cascade].first.z);
-
-				auto it = mVoxelizationObjects[cascade].find(objectInfo.first);
-				if (isColliding && (it == mVoxelizationObjects[cascade].end()))
-					mVoxelizationObjects[cascade].insert(objectInfo);
-				else if (!isColliding && (it != mVoxelizationObjects[cascade].end()))
-					mVoxelizationObjects[cascade].erase(it);
+				if (objectInfo.second->UpdateVoxelizationInstances(cascade, mVoxelCascadesOverlapBits[cascade]))
+					mVoxelizationObjects[cascade].push_back(objectInfo.second->GetHandle());
 			}
 		}
 	}
@@ -4,6 +4,8 @@
 #include "ER_LightProbesManager.h"
 
 #include "RHI/ER_RHI.h"
+#include "ER_RenderingObjectRegistry.h"
+#include "ER_DrawList.h"
 
 #define NUM_VOXEL_GI_CASCADES 2
 #define NUM_VOXEL_GI_TEX_MIPS 6
@@ -17,7 +19,7 @@ namespace EveryRay_Core
 	class ER_GBuffer;
 	class ER_ShadowMapper;
 	class ER_FoliageManager;
-	class ER_RenderableAABB;
+	class ER_DebugRenderer;
 	class ER_RenderingObject;
 	class ER_Skybox;
 	class ER_VolumetricFog;
@@ -112,7 +114,7 @@ namespace EveryRay_Core
 		void DrawDynamicGlobalIllumination(ER_GBuffer* gbuffer, const ER_CoreTime& gameTime);
 		void CompositeTotalIllumination();
 
-		void DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer);
 		void DrawDebugProbes(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth);
 
 		void Update(const ER_CoreTime& gameTime, const ER_Scene* scene);
@@ -123,6 +125,7 @@ namespace EveryRay_Core
 		void SetProbesManager(ER_LightProbesManager* manager) { mProbesManager = manager; }
 
 		void PreparePipelineForForwardLighting(ER_RenderingObject* aObj);
+		const std::string& GetForwardLightingPSOName(ER_RenderingObject* aObj) const;
 		void PrepareResourcesForForwardLighting(ER_RenderingObject* aObj, int meshIndex, int lod);
 
 		ER_RHI_GPUTexture* GetLocalIlluminationRT() const { return mLocalIlluminationRT; }
@@ -159,8 +162,9 @@ namespace EveryRay_Core
 		ER_VolumetricFog* mVolumetricFog = nullptr;
 		ER_GBuffer* mGbuffer = nullptr;
 
-		using RenderingObjectInfo = std::map<std::string, ER_RenderingObject*>;
+		using RenderingObjectInfo = std::vector<ER_RenderingObjectHandle>; // resolved through the scene's registry (stale ones are skipped)
 		RenderingObjectInfo mVoxelizationObjects[NUM_VOXEL_GI_CASCADES];
+		std::vector<UINT64> mVoxelCascadesOverlapBits[NUM_VOXEL_GI_CASCADES]; // scene's data store entries overlapping the cascades (kept between frames)
 
 		ER_RHI_GPUConstantBuffer<IlluminationCBufferData::VoxelizationDebugCB> mVoxelizationDebugConstantBuffer;
 		ER_RHI_GPUConstantBuffer<IlluminationCBufferData::VoxelConeTracingMainCB> mVoxelConeTracingMainConstantBuffer;
@@ -221,6 +225,8 @@ namespace EveryRay_Core
 		std::string mForwardLightingTransparentInstancingPSOName = "ER_RHI_GPUPipelineStateObject: Forward Lighting (Instancing) Pass (Transparent)";
 		std::string mForwardLightingTransparentInstancingWireframePSOName = "ER_RHI_GPUPipelineStateObject: Forward Lighting (Wireframe)(Instancing) Pass (Transparent)";
 		ER_RHI_GPURootSignature* mForwardLightingRS = nullptr;
+		ER_DrawList mForwardDrawList; // forward shaded objects and standard materials, sorted by pass, root signature, PSO, material and depth
+		std::string mDrawListBenchmarkResult;
 
 		ER_RHI_GPUShader* mForwardLightingDiffuseProbesPS = nullptr;
 		std::string mForwardLightingDiffuseProbesPSOName = "ER_RHI_GPUPipelineStateObject: Forward Lighting Diffuse Probes Pass";
@@ -237,7 +243,6 @@ namespace EveryRay_Core
 		XMFLOAT4 mVoxelCameraPositions[NUM_VOXEL_GI_CASCADES];
 		ER_AABB mLocalVoxelCascadesAABBs[NUM_VOXEL_GI_CASCADES]; // constant, must not change after initialization
 		ER_AABB mWorldVoxelCascadesAABBs[NUM_VOXEL_GI_CASCADES]; // dynamic, changes with camera movement (not in every frame probably in order to save perf)
-		ER_RenderableAABB* mDebugVoxelZonesGizmos[NUM_VOXEL_GI_CASCADES] = { nullptr, nullptr };
 		float mWorldVoxelScales[NUM_VOXEL_GI_CASCADES] = { 2.0f, 0.5f };
 
 		float mVCTIndirectDiffuseStrength = 0.2f;
@@ -0,0 +1,266 @@
+#include "stdafx.h"
+
+#include "ER_IndirectArgs.h"
+#include "ER_Random.h"
+
+#define INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
+#define INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX 1
+#define INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX 2
+
+namespace EveryRay_Core
+{
+	ER_IndirectArgs::ER_IndirectArgs()
+	{
+	}
+
+	ER_IndirectArgs::~ER_IndirectArgs()
+	{
+		DeleteObject(mArgsGenerationCS);
+		DeleteObject(mArgsGenerationRS);
+		mConstantBuffer.Release();
+	}
+
+	void ER_IndirectArgs::Initialize(ER_RHI* aRHI)
+	{
+		assert(aRHI);
+
+		mArgsGenerationCS = aRHI->CreateGPUShader();
+		mArgsGenerationCS->CompileShader(aRHI, "content\\shaders\\IndirectArgsGeneration.hlsl", "CSMain", ER_COMPUTE);
+
+		mArgsGenerationRS = aRHI->CreateRootSignature(3, 0);
+		if (mArgsGenerationRS)
+		{
+			mArgsGenerationRS->InitDescriptorTable(aRHI, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_SRV }, { 0 }, { 2 });
+			mArgsGenerationRS->InitDescriptorTable(aRHI, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_UAV }, { 0 }, { 2 });
+			mArgsGenerationRS->InitDescriptorTable(aRHI, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 1 });
+			mArgsGenerationRS->Finalize(aRHI, "ER_RHI_GPURootSignature: Indirect Args Generation");
+		}
+
+		mConstantBuffer.Initialize(aRHI, "ER_RHI_GPUBuffer: Indirect Args Generation CB");
+	}
+
+	void ER_IndirectArgs::Generate(ER_RHI* aRHI, ER_RHI_GPUBuffer* aBaseArgsBuffer, ER_RHI_GPUBuffer* aInstanceCountsBuffer, ER_RHI_GPUBuffer* aArgsBuffer, ER_RHI_GPUBuffer* aCountBuffer,
+		UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize, UINT aDrawsPerInstanceCount)
+	{
+		assert(aRHI && aBaseArgsBuffer && aInstanceCountsBuffer && aArgsBuffer && aCountBuffer);
+		assert(aDispatchGroupSize > 0 && aDrawsPerInstanceCount > 0);
+
+		if (aDrawsCount == 0)
+			return;
+
+		aRHI->SetRootSignature(mArgsGenerationRS, true);
+		if (!aRHI->IsPSOReady(mPSOName, true))
+		{
+			aRHI->InitializePSO(mPSOName, true);
+			aRHI->SetShader(mArgsGenerationCS);
+			aRHI->SetRootSignatureToPSO(mPSOName, mArgsGenerationRS, true);
+			aRHI->FinalizePSO(mPSOName, true);
+		}
+		aRHI->SetPSO(mPSOName, true);
+
+		mConstantBuffer.Data.DrawsCount = aDrawsCount;
+		mConstantBuffer.Data.IsCompacted = aCompacted ? 1 : 0;
+		mConstantBuffer.Data.DispatchGroupSize = aDispatchGroupSize;
+		mConstantBuffer.Data.DrawsPerInstanceCount = aDrawsPerInstanceCount;
+		mConstantBuffer.ApplyChanges(aRHI);
+
+		aRHI->SetShaderResources(ER_COMPUTE, { aBaseArgsBuffer, aInstanceCountsBuffer }, 0, mArgsGenerationRS, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, true);
+		aRHI->SetUnorderedAccessResources(ER_COMPUTE, { aArgsBuffer, aCountBuffer }, 0, mArgsGenerationRS, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
+		aRHI->SetConstantBuffers(ER_COMPUTE, { mConstantBuffer.Buffer() }, 0, mArgsGenerationRS, INDIRECT_ARGS_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
+
+		// one group loops over all draws (the scan of the visibility needs the totals of the previous chunks)
+		aRHI->Dispatch(1u, 1u, 1u);
+
+		aRHI->UnsetPSO();
+		aRHI->UnbindResourcesFromShader(ER_COMPUTE);
+	}
+
+	void ER_IndirectArgs::WriteDrawArgs(const ER_IndirectDrawBaseArgs& aBaseArgs, UINT aInstanceCount, UINT* aOutArgs)
+	{
+		aOutArgs[0] = aBaseArgs.IndexCountPerInstance;
+		aOutArgs[1] = aInstanceCount;
+		aOutArgs[2] = aBaseArgs.StartIndexLocation;
+		aOutArgs[3] = static_cast<UINT>(aBaseArgs.BaseVertexLocation);
+		aOutArgs[4] = aBaseArgs.StartInstanceLocation;
+	}
+
+	UINT ER_IndirectArgs::GenerateDrawArgs(const ER_IndirectDrawBaseArgs* aBaseArgs, const UINT* aInstanceCounts, UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize,
+		UINT* aOutArgs, UINT* aOutCountArgs, UINT aDrawsPerInstanceCount)
+	{
+		assert(aDispatchGroupSize > 0 && aDrawsPerInstanceCount > 0);
+
+		UINT drawsCount = 0;
+		UINT instancesCount = 0;
+		for (UINT i = 0; i < aDrawsCount; i++)
+		{
+			const UINT count = aInstanceCounts[i / aDrawsPerInstanceCount];
+			instancesCount += count;
+			if (!aCompacted)
+				WriteDrawArgs(aBaseArgs[i], count, aOutArgs + i * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT);
+			else if (count > 0)
+				WriteDrawArgs(aBaseArgs[i], count, aOutArgs + (drawsCount++) * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT);
+		}
+
+		if (aCompacted)
+		{
+			// empty draws in the tail, so that the args are also valid for a multi-draw of aDrawsCount without the count buffer
+			std::fill(aOutArgs + drawsCount * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT, aOutArgs + aDrawsCount * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT, 0u);
+		}
+		else
+			drawsCount = aDrawsCount;
+
+		aOutCountArgs[0] = drawsCount;
+		aOutCountArgs[1] = (instancesCount + aDispatchGroupSize - 1) / aDispatchGroupSize;
+		aOutCountArgs[2] = 1;
+		aOutCountArgs[3] = 1;
+		return drawsCount;
+	}
+
+	UINT ER_IndirectArgs::GenerateDrawArgsGroupScan(const ER_IndirectDrawBaseArgs* aBaseArgs, const UINT* aInstanceCounts, UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize,
+		UINT* aOutArgs, UINT* aOutCountArgs, UINT aDrawsPerInstanceCount)
+	{
+		const UINT groupSize = ER_INDIRECT_ARGS_GENERATION_GROUP_SIZE;
+		UINT scan[2][groupSize];
+		UINT groupInstances = 0;
+		UINT visibleOffset = 0;
+
+		for (UINT chunk = 0; chunk < aDrawsCount; chunk += groupSize)
+		{
+			for (UINT thread = 0; thread < groupSize; thread++)
+			{
+				const UINT draw = chunk + thread;
+				scan[0][thread] = (draw < aDrawsCount && aInstanceCounts[draw / aDrawsPerInstanceCount] > 0) ? 1 : 0;
+			}
+
+			// the scan is only needed for the compacted slots
+			int src = 0;
+			for (UINT stride = 1; aCompacted && stride < groupSize; stride <<= 1)
+			{
+				for (UINT thread = 0; thread < groupSize; thread++)
+					scan[1 - src][thread] = scan[src][thread] + ((thread >= stride) ? scan[src][thread - stride] : 0);
+				src = 1 - src;
+			}
+
+			for (UINT thread = 0; thread < groupSize; thread++)
+			{
+				const UINT draw = chunk + thread;
+				if (draw >= aDrawsCount)
+					continue;
+
+				const UINT count = aInstanceCounts[draw / aDrawsPerInstanceCount];
+				const UINT visible = count > 0 ? 1 : 0;
+				groupInstances += count;
+
+				const UINT slot = aCompacted ? visibleOffset + scan[src][thread] - visible : draw;
+				if (!aCompacted || visible)
+					WriteDrawArgs(aBaseArgs[draw], count, aOutArgs + slot * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT);
+			}
+			if (aCompacted)
+				visibleOffset += scan[src][groupSize - 1];
+		}
+
+		if (aCompacted)
+		{
+			for (UINT thread = 0; thread < groupSize; thread++)
+			{
+				for (UINT draw = visibleOffset + thread; draw < aDrawsCount; draw += groupSize)
+				{
+					for (int arg = 0; arg < ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT; arg++)
+						aOutArgs[draw * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT + arg] = 0;
+				}
+			}
+		}
+
+		aOutCountArgs[0] = aCompacted ? visibleOffset : aDrawsCount;
+		aOutCountArgs[1] = (groupInstances + aDispatchGroupSize - 1) / aDispatchGroupSize;
+		aOutCountArgs[2] = 1;
+		aOutCountArgs[3] = 1;
+		return aOutCountArgs[0];
+	}
+
+	bool ER_IndirectArgs::RunSelfTest(int aDrawsCount, int aFramesCount, std::string& aOutReport)
+	{
+		const UINT dispatchGroupSize = 64;
+		const int argsCount = ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT;
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+
+		std::vector<ER_IndirectDrawBaseArgs> baseArgs(aDrawsCount);
+		for (int i = 0; i < aDrawsCount; i++)
+		{
+			baseArgs[i].IndexCountPerInstance = static_cast<UINT>(random.NextInt(3, 65536));
+			baseArgs[i].StartIndexLocation = static_cast<UINT>(random.NextInt(0, 1 << 20));
+			baseArgs[i].BaseVertexLocation = random.NextInt(-1024, 1 << 20);
+			baseArgs[i].StartInstanceLocation = static_cast<UINT>(random.NextInt(0, 1 << 16));
+		}
+
+		std::vector<UINT> instanceCounts(aDrawsCount);
+		std::vector<UINT> args(aDrawsCount * argsCount), scanArgs(aDrawsCount * argsCount);
+		UINT countArgs[ER_INDIRECT_ARGS_COUNT_ARGS_COUNT], scanCountArgs[ER_INDIRECT_ARGS_COUNT_ARGS_COUNT];
+
+		double referenceTime[2] = { 0.0, 0.0 };
+		int mismatches = 0;
+		int errors = 0;
+		UINT64 visibleDraws = 0;
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			// culled ratio changes per frame (everything and nothing visible included), every other frame the counts are shared by a few draws
+			const int culledPercent = (frame == 0) ? 100 : (frame == 1) ? 0 : random.NextInt(0, 100);
+			const UINT drawsPerCount = (frame % 2 == 0) ? 1 : static_cast<UINT>(random.NextInt(2, 8));
+			for (int i = 0; i < aDrawsCount; i++)
+				instanceCounts[i] = (random.NextInt(0, 100) < culledPercent) ? 0 : static_cast<UINT>(random.NextInt(1, 512));
+
+			UINT instancesCount = 0;
+			for (int i = 0; i < aDrawsCount; i++)
+				instancesCount += instanceCounts[i / drawsPerCount];
+
+			for (int mode = 0; mode < 2; mode++)
+			{
+				const bool compacted = mode == 1;
+				std::fill(args.begin(), args.end(), 0xffffffffu);
+				std::fill(scanArgs.begin(), scanArgs.end(), 0xffffffffu);
+
+				auto startTime = std::chrono::high_resolution_clock::now();
+				const UINT drawsCount = GenerateDrawArgs(baseArgs.data(), instanceCounts.data(), static_cast<UINT>(aDrawsCount), compacted, dispatchGroupSize, args.data(), countArgs, drawsPerCount);
+				auto endTime = std::chrono::high_resolution_clock::now();
+				referenceTime[mode] += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+				GenerateDrawArgsGroupScan(baseArgs.data(), instanceCounts.data(), static_cast<UINT>(aDrawsCount), compacted, dispatchGroupSize, scanArgs.data(), scanCountArgs, drawsPerCount);
+				if (args != scanArgs || memcmp(countArgs, scanCountArgs, sizeof(countArgs)) != 0)
+					mismatches++;
+
+				// every visible draw once and in its order, culled draws are empty, the dispatch covers all visible instances
+				UINT drawInstances = 0;
+				int slot = 0;
+				for (int i = 0; i < aDrawsCount; i++)
+				{
+					const UINT count = instanceCounts[i / drawsPerCount];
+					if (compacted && count == 0)
+						continue;
+
+					const UINT* drawArgs = &args[slot * argsCount];
+					if (drawArgs[0] != baseArgs[i].IndexCountPerInstance || drawArgs[1] != count || drawArgs[2] != baseArgs[i].StartIndexLocation ||
+						drawArgs[3] != static_cast<UINT>(baseArgs[i].BaseVertexLocation) || drawArgs[4] != baseArgs[i].StartInstanceLocation)
+						errors++;
+					drawInstances += drawArgs[1];
+					slot++;
+				}
+				for (int i = slot * argsCount; i < aDrawsCount * argsCount; i++)
+				{
+					if (args[i] != 0)
+						errors++;
+				}
+				if (drawsCount != static_cast<UINT>(slot) || drawInstances != instancesCount || countArgs[1] * dispatchGroupSize < instancesCount ||
+					(countArgs[1] > 0 && (countArgs[1] - 1) * dispatchGroupSize >= instancesCount) || countArgs[2] != 1 || countArgs[3] != 1)
+					errors++;
+
+				if (compacted)
+					visibleDraws += drawsCount;
+			}
+		}
+
+		aOutReport = std::to_string(aDrawsCount) + " draws, " + std::to_string(aFramesCount) + " frames, " + std::to_string(visibleDraws / std::max(1, aFramesCount)) + " visible draws per frame\n" +
+			"CPU reference: " + std::to_string(referenceTime[0] / aFramesCount) + " ms, compacted: " + std::to_string(referenceTime[1] / aFramesCount) + " ms\n" +
+			"group scan mismatches: " + std::to_string(mismatches) + ", errors: " + std::to_string(errors);
+		return mismatches == 0 && errors == 0;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "Common.h"
+#include "RHI/ER_RHI.h"
+
+#define ER_INDIRECT_ARGS_GENERATION_GROUP_SIZE 256 // must match GROUP_SIZE in IndirectArgsGeneration.hlsl
+#define ER_INDIRECT_ARGS_COUNT_ARGS_COUNT 4 // count buffer: draws count (for ExecuteIndirect) followed by the args of a dispatch over the visible instances
+#define ER_INDIRECT_ARGS_SELF_TEST_DRAWS 4096
+#define ER_INDIRECT_ARGS_SELF_TEST_FRAMES 100
+
+namespace EveryRay_Core
+{
+	// Base arguments of a draw: same order as ER_RenderingObject::GetIndirectDrawArgsArray() (XMINT4)
+	struct ER_IndirectDrawBaseArgs
+	{
+		UINT IndexCountPerInstance = 0;
+		UINT StartIndexLocation = 0;
+		INT BaseVertexLocation = 0;
+		UINT StartInstanceLocation = 0;
+	};
+
+	namespace IndirectArgsCBufferData
+	{
+		struct ER_ALIGN_GPU_BUFFER ArgsGenerationConstants
+		{
+			UINT DrawsCount;
+			UINT IsCompacted;
+			UINT DispatchGroupSize;
+			UINT DrawsPerInstanceCount;
+		};
+	}
+
+	// Builds the arguments of DrawIndexedInstancedIndirect() on the GPU from the base arguments of the draws and their instance counts
+	// (i.e. written by a culling pass), in one dispatch for any number of draws. Non-compacted: draw i of the args buffer is draw i (with 0 instances
+	// if it is not visible). Compacted: only visible draws are written, in their order, followed by empty draws, so that the args can be consumed
+	// by one multi-draw with the count buffer (or without it, see ER_RHI::IsIndirectCountSupported()) if the draws share their state.
+	// The static part is the CPU reference of the shader and does not touch the RHI, so it can be tested without a device (see RunSelfTest()).
+	class ER_IndirectArgs
+	{
+	public:
+		ER_IndirectArgs();
+		~ER_IndirectArgs();
+
+		void Initialize(ER_RHI* aRHI);
+
+		// aBaseArgsBuffer: structured buffer of ER_IndirectDrawBaseArgs, aInstanceCountsBuffer: R32_UINT buffer (one count per aDrawsPerInstanceCount
+		// consecutive draws, i.e. meshes of the same LOD), aArgsBuffer: R32_UINT buffer of ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT * aDrawsCount,
+		// aCountBuffer: R32_UINT buffer of ER_INDIRECT_ARGS_COUNT_ARGS_COUNT
+		void Generate(ER_RHI* aRHI, ER_RHI_GPUBuffer* aBaseArgsBuffer, ER_RHI_GPUBuffer* aInstanceCountsBuffer, ER_RHI_GPUBuffer* aArgsBuffer, ER_RHI_GPUBuffer* aCountBuffer,
+			UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize = 64, UINT aDrawsPerInstanceCount = 1);
+
+		// CPU reference: writes ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT * aDrawsCount args and ER_INDIRECT_ARGS_COUNT_ARGS_COUNT count args, returns the draws count
+		static UINT GenerateDrawArgs(const ER_IndirectDrawBaseArgs* aBaseArgs, const UINT* aInstanceCounts, UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize,
+			UINT* aOutArgs, UINT* aOutCountArgs, UINT aDrawsPerInstanceCount = 1);
+
+		// Random draws (with culled ones) in both modes: the CPU reference against the emulated group scan of the shader (must be bit-exact)
+		// and against the expected properties of the args (results and timings)
+		static bool RunSelfTest(int aDrawsCount, int aFramesCount, std::string& aOutReport);
+	private:
+		// Same steps as IndirectArgsGeneration.hlsl: chunks of ER_INDIRECT_ARGS_GENERATION_GROUP_SIZE draws with a Hillis-Steele scan of the visibility
+		static UINT GenerateDrawArgsGroupScan(const ER_IndirectDrawBaseArgs* aBaseArgs, const UINT* aInstanceCounts, UINT aDrawsCount, bool aCompacted, UINT aDispatchGroupSize,
+			UINT* aOutArgs, UINT* aOutCountArgs, UINT aDrawsPerInstanceCount);
+		static void WriteDrawArgs(const ER_IndirectDrawBaseArgs& aBaseArgs, UINT aInstanceCount, UINT* aOutArgs);
+
+		ER_RHI_GPUShader* mArgsGenerationCS = nullptr;
+		ER_RHI_GPURootSignature* mArgsGenerationRS = nullptr;
+		ER_RHI_GPUConstantBuffer<IndirectArgsCBufferData::ArgsGenerationConstants> mConstantBuffer;
+		const std::string mPSOName = "ER_RHI_GPUPipelineStateObject: Indirect Args Generation Pass";
+	};
+}
@@ -10,7 +10,6 @@
 #include "ER_RenderingObject.h"
 #include "ER_Model.h"
 #include "ER_Scene.h"
-#include "ER_RenderableAABB.h"
 #include "ER_QuadRenderer.h"
 #include "ER_DebugLightProbeMaterial.h"
 #include "ER_MaterialsCallbacks.h"
@@ -237,13 +236,13 @@ namespace EveryRay_Core
 		DeleteObjects(diffuseProbeCellsIndicesCPUBuffer);
 		
 		std::string name = "Debug diffuse lightprobes ";
-		scene->objects.emplace_back(name, new ER_RenderingObject(name, scene->objects.size(), core, camera,
+		ER_RenderingObjectHandle probesObjectHandle = scene->AddRenderingObject(name, new ER_RenderingObject(name, scene->GetRenderingObjects().size(), core, camera,
 			ER_Utility::GetFilePath("content\\models\\sphere_lowpoly.fbx"), false, true));
 
 		MaterialShaderEntries shaderEntries;
 		shaderEntries.vertexEntry += "_instancing";
 
-		mDiffuseProbeRenderingObject = scene->objects[static_cast<int>(scene->objects.size()) - 1].second;
+		mDiffuseProbeRenderingObject = scene->GetRenderingObject(probesObjectHandle);
 		mDiffuseProbeRenderingObject->LoadMaterial(new ER_DebugLightProbeMaterial(core, shaderEntries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, true), ER_MaterialHelper::debugLightProbeMaterialName);
 		mDiffuseProbeRenderingObject->LoadRenderBuffers();
 		mDiffuseProbeRenderingObject->LoadInstanceBuffers();
@@ -254,7 +253,7 @@ namespace EveryRay_Core
 			mDiffuseProbeRenderingObject->AddInstanceData(worldT);
 		}
 		mDiffuseProbeRenderingObject->UpdateInstanceBuffer(mDiffuseProbeRenderingObject->GetInstancesData());
-		std::partition(scene->objects.begin(), scene->objects.end(), [](const ER_SceneObject& obj) {	return obj.second->IsInstanced(); });
+		scene->SortRenderingObjects();
 	}
 
 	void ER_LightProbesManager::SetupSpecularProbes(ER_Core& game, ER_Camera& camera, ER_Scene* scene, ER_DirectionalLight* light, ER_ShadowMapper* shadowMapper)
@@ -362,13 +361,13 @@ namespace EveryRay_Core
 		mSpecularProbesTexArrayIndicesGPUBuffer->CreateGPUBufferResource(rhi, mSpecularProbesTexArrayIndicesCPUBuffer, mSpecularProbesCountTotal, sizeof(int), true, ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
 
 		std::string name = "Debug specular lightprobes ";
-		scene->objects.emplace_back(name, new ER_RenderingObject(name, scene->objects.size(), game, camera,
+		ER_RenderingObjectHandle probesObjectHandle = scene->AddRenderingObject(name, new ER_RenderingObject(name, scene->GetRenderingObjects().size(), game, camera,
 			ER_Utility::GetFilePath("content\\models\\sphere_lowpoly.fbx"), false, true));
 		
 		MaterialShaderEntries shaderEntries;
 		shaderEntries.vertexEntry += "_instancing";
 
-		mSpecularProbeRenderingObject = scene->objects[static_cast<int>(scene->objects.size()) - 1].second;
+		mSpecularProbeRenderingObject = scene->GetRenderingObject(probesObjectHandle);
 		mSpecularProbeRenderingObject->LoadMaterial(new ER_DebugLightProbeMaterial(game, shaderEntries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, true), ER_MaterialHelper::debugLightProbeMaterialName);
 		mSpecularProbeRenderingObject->LoadRenderBuffers();
 		mSpecularProbeRenderingObject->LoadInstanceBuffers();
@@ -379,7 +378,7 @@ namespace EveryRay_Core
 			mSpecularProbeRenderingObject->AddInstanceData(worldT);
 		}
 		mSpecularProbeRenderingObject->UpdateInstanceBuffer(mSpecularProbeRenderingObject->GetInstancesData());
-		std::partition(scene->objects.begin(), scene->objects.end(), [](const ER_SceneObject& obj) {	return obj.second->IsInstanced(); });
+		scene->SortRenderingObjects();
 
 		mSpecularCubemapArrayRT = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Specular Cubemap Array RT");
 		mSpecularCubemapArrayRT->CreateGPUTextureResource(rhi, SPECULAR_PROBE_SIZE, SPECULAR_PROBE_SIZE, 1, ER_FORMAT_R8G8B8A8_UNORM, ER_BIND_SHADER_RESOURCE, SPECULAR_PROBE_MIP_COUNT, -1, CUBEMAP_FACES_COUNT, true, mMaxSpecularProbesInVolumeCount);
@@ -504,7 +503,7 @@ namespace EveryRay_Core
 				(pos.z <= (maxBounds.z + epsilon) && pos.z >= (minBounds.z - epsilon));
 	}
 
-	void ER_LightProbesManager::ComputeOrLoadGlobalProbes(ER_Core& game, ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox)
+	void ER_LightProbesManager::ComputeOrLoadGlobalProbes(ER_Core& game, const ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox)
 	{
 		assert(skybox);
 
@@ -545,38 +544,17 @@ namespace EveryRay_Core
 		}
 	}
 
-	void ER_LightProbesManager::ComputeOrLoadLocalProbes(ER_Core& game, ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox)
+	void ER_LightProbesManager::ComputeOrLoadLocalProbes(ER_Core& game, const ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox)
 	{
 		ER_RHI* rhi = game.GetRHI();
 
-		int numThreads = std::thread::hardware_concurrency();
-		if (game.GetRHI()->GetAPI() != ER_GRAPHICS_API::DX11)
-			numThreads = 1; //TODO fix this on DX12 (need to support multiple command lists)
-
-		assert(numThreads > 0);
-
 		if (mDistanceBetweenDiffuseProbes <= 0.0)
 			mDiffuseProbesReady = true;
 
 		if (!mDiffuseProbesReady && mDistanceBetweenDiffuseProbes > 0)
 		{
 			std::wstring diffuseProbesPath = mLevelPath + L"diffuse_probes\\";
-			
-			std::vector<std::thread> threads;
-			threads.reserve(numThreads);
-
-			int probesPerThread = mDiffuseProbes.size() / numThreads;
-
-			for (int i = 0; i < numThreads; i++)
-			{
-				threads.push_back(std::thread([&, diffuseProbesPath, i]
-				{ 
-					int endRange = (i < numThreads - 1) ? (i + 1) * probesPerThread : mDiffuseProbes.size();
-					for (int j = i * probesPerThread; j < endRange; j++)
-						mDiffuseProbes[j].LoadProbeFromDisk(game, diffuseProbesPath);
-				}));
-			}
-			for (auto& t : threads) t.join();
+			LoadLocalProbesFromDisk(game, mDiffuseProbes, diffuseProbesPath);
 
 			for (auto& probe : mDiffuseProbes)
 			{
@@ -616,26 +594,7 @@ namespace EveryRay_Core
 		if (!mSpecularProbesReady && mDistanceBetweenSpecularProbes > 0)
 		{
 			std::wstring specularProbesPath = mLevelPath + L"specular_probes\\";
-
-			std::vector<std::thread> threads;
-			int numThreads = std::thread::hardware_concurrency();
-			if (game.GetRHI()->GetAPI() != ER_GRAPHICS_API::DX11)
-				numThreads = 1; //TODO fix this on DX12 (need to support multiple command lists)
-
-			threads.reserve(numThreads);
-
-			int probesPerThread = mSpecularProbes.size() / numThreads;
-
-			for (int i = 0; i < numThreads; i++)
-			{
-				threads.push_back(std::thread([&, specularProbesPath, i]
-				{
-					int endRange = (i < numThreads - 1) ? (i + 1) * probesPerThread : mSpecularProbes.size();
-					for (int j = i * probesPerThread; j < endRange; j++)
-						mSpecularProbes[j].LoadProbeFromDisk(game, specularProbesPath);
-				}));
-			}
-			for (auto& t : threads) t.join();
+			LoadLocalProbesFromDisk(game, mSpecularProbes, specularProbesPath);
 
 			for (auto& probe : mSpecularProbes)
 			{
@@ -656,6 +615,42 @@ namespace EveryRay_Core
 		}
 	}
 
+	// Probes are split between threads; on DX12 every thread records the uploads of its probes' textures into its own command list
+	void ER_LightProbesManager::LoadLocalProbesFromDisk(ER_Core& game, std::vector<ER_LightProbe>& aProbes, const std::wstring& aPath)
+	{
+		ER_RHI* rhi = game.GetRHI();
+
+		int numThreads = std::thread::hardware_concurrency();
+		if (rhi->GetAPI() != ER_GRAPHICS_API::DX11)
+			numThreads = std::min(numThreads, rhi->GetMaxParallelGraphicsCommandListsCount());
+		numThreads = std::max(1, std::min(numThreads, static_cast<int>(aProbes.size())));
+
+		int probesPerThread = static_cast<int>(aProbes.size()) / numThreads;
+		auto loadProbes = [&](int i)
+		{
+			int endRange = (i < numThreads - 1) ? (i + 1) * probesPerThread : static_cast<int>(aProbes.size());
+			for (int j = i * probesPerThread; j < endRange; j++)
+				aProbes[j].LoadProbeFromDisk(game, aPath);
+		};
+
+		if (rhi->GetAPI() == ER_GRAPHICS_API::DX11)
+		{
+			std::vector<std::thread> threads;
+			threads.reserve(numThreads);
+			for (int i = 0; i < numThreads; i++)
+				threads.push_back(std::thread(loadProbes, i));
+			for (auto& t : threads) t.join();
+		}
+		else
+		{
+			std::vector<std::function<void(int)>> tasks;
+			tasks.reserve(numThreads);
+			for (int i = 0; i < numThreads; i++)
+				tasks.push_back([&loadProbes, i](int aCommandListIndex) { loadProbes(i); });
+			rhi->RecordParallelGraphicsCommandLists(tasks);
+		}
+	}
+
 	void ER_LightProbesManager::DrawDebugProbes(ER_RHI* rhi, ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_ProbeType aType, ER_RHI_GPURootSignature* rs)
 	{
 		assert(aRenderTarget);
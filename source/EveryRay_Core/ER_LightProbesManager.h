@@ -26,7 +26,6 @@ namespace EveryRay_Core
 	class ER_CoreTime;
 	class ER_QuadRenderer;
 	class ER_Scene;
-	class ER_RenderableAABB;
 
 	enum ER_ProbeType
 	{
@@ -51,8 +50,8 @@ namespace EveryRay_Core
 
 		bool AreProbesReady() { return mDiffuseProbesReady && mSpecularProbesReady; }
 		void SetLevelPath(const std::wstring& aPath) { mLevelPath = aPath; };
-		void ComputeOrLoadLocalProbes(ER_Core& game, ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox = nullptr);
-		void ComputeOrLoadGlobalProbes(ER_Core& game, ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox);
+		void ComputeOrLoadLocalProbes(ER_Core& game, const ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox = nullptr);
+		void ComputeOrLoadGlobalProbes(ER_Core& game, const ProbesRenderingObjectsInfo& aObjects, ER_Skybox* skybox);
 		void DrawDebugProbes(ER_RHI* rhi, ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_ProbeType aType, ER_RHI_GPURootSignature* rs);
 		void UpdateProbes(ER_Core& game);
 		int GetCellIndex(const XMFLOAT3& pos, ER_ProbeType aType);
@@ -90,6 +89,7 @@ namespace EveryRay_Core
 		void AddProbeToCells(ER_LightProbe& aProbe, ER_ProbeType aType, const XMFLOAT3& minBounds, const XMFLOAT3& maxBounds);
 		bool IsProbeInCell(ER_LightProbe& aProbe, ER_LightProbeCell& aCell, ER_AABB& aCellBounds);
 		void UpdateProbesByType(ER_Core& game, ER_ProbeType aType);
+		void LoadLocalProbesFromDisk(ER_Core& game, std::vector<ER_LightProbe>& aProbes, const std::wstring& aPath);
 		
 		ER_QuadRenderer* mQuadRenderer = nullptr;
 		ER_Camera& mMainCamera;
@@ -7,6 +7,7 @@
 #include "ER_RenderingObject.h"
 #include "ER_Utility.h"
 #include "ER_MaterialsCallbacks.h"
+#include "ER_CompactInstanceData.h"
 
 namespace EveryRay_Core
 {
@@ -55,6 +56,28 @@ namespace EveryRay_Core
 	{
 		ER_RHI* rhi = GetCore()->GetRHI();
 
+		// replace the per-instance world matrix of the instanced layout with the compact instance data (same input slot)
+		std::vector<ER_RHI_INPUT_ELEMENT_DESC> compactInputElementDescriptions;
+		if (mShaderFlags & USE_COMPACT_INSTANCE_DATA)
+		{
+			UINT instanceSlot = 0;
+			for (UINT i = 0; i < inputElementDescriptionCount; i++)
+			{
+				if (strcmp(inputElementDescriptions[i].SemanticName, "WORLD") == 0)
+					instanceSlot = inputElementDescriptions[i].InputSlot;
+				else
+					compactInputElementDescriptions.push_back(inputElementDescriptions[i]);
+			}
+			assert(instanceSlot > 0);
+
+			ER_RHI_INPUT_ELEMENT_DESC instanceElements[ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS];
+			ER_CompactInstanceData::GetInputElements(instanceSlot, instanceElements);
+			compactInputElementDescriptions.insert(compactInputElementDescriptions.end(), instanceElements, instanceElements + ER_COMPACT_INSTANCE_DATA_INPUT_ELEMENTS);
+
+			inputElementDescriptions = compactInputElementDescriptions.data();
+			inputElementDescriptionCount = static_cast<UINT>(compactInputElementDescriptions.size());
+		}
+
 		mInputLayout = rhi->CreateInputLayout(inputElementDescriptions, inputElementDescriptionCount);
 		mVertexShader = rhi->CreateGPUShader();
 		mVertexShader->CompileShader(GetCore()->GetRHI(), path, mShaderEntries.vertexEntry, ER_VERTEX, mInputLayout);
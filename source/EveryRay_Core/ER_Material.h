@@ -27,7 +27,8 @@ namespace EveryRay_Core
 		HAS_VERTEX_SHADER		= 0x1L,
 		HAS_PIXEL_SHADER		= 0x2L,
 		HAS_GEOMETRY_SHADER		= 0x4L,
-		HAS_TESSELLATION_SHADER = 0x8L
+		HAS_TESSELLATION_SHADER = 0x8L,
+		USE_COMPACT_INSTANCE_DATA = 0x10L // instanced layouts use InstancedDataCompact instead of the "WORLD" matrix (see ER_CompactInstanceData.h)
 	};
 
 	class ER_Material : public ER_CoreComponent
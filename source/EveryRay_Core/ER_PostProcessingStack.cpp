@@ -10,8 +10,10 @@
 #include "ER_VolumetricFog.h"
 #include "ER_Illumination.h"
 #include "ER_Settings.h"
-#include "ER_RenderableAABB.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Scene.h"
+#include "ER_Random.h"
+#include "ER_SelfTests.h"
 
 #define LINEARFOG_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
 #define LINEARFOG_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX 1
@@ -265,11 +267,14 @@ namespace EveryRay_Core {
 		mPostEffectsVolumes.reserve(count);
 	}
 
-	bool ER_PostProcessingStack::AddPostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName)
+	bool ER_PostProcessingStack::AddPostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName, int aPriority, float aBlendDistance)
 	{
 		if (mPostEffectsVolumes.size() < MAX_POST_EFFECT_VOLUMES)
 		{
-			mPostEffectsVolumes.emplace_back(mCore, aTransform, aValues, aName);
+			mPostEffectsVolumes.emplace_back(aTransform, aValues, aName);
+			mPostEffectsVolumes.back().priority = aPriority;
+			mPostEffectsVolumes.back().blendDistance = std::max(aBlendDistance, 0.0f);
+			mIsPostEffectsVolumesGridDirty = true;
 
 			std::string message = "[ER Logger][ER_PostProcessingStack] Added a new volume: " + aName + "\n";
 			ER_OUTPUT_LOG(ER_Utility::ToWideString(message).c_str());
@@ -362,6 +367,20 @@ namespace EveryRay_Core {
 		ImGui::TextWrapped("Note: saving the values from above to the volume is not yet supported!");
 		ImGui::Checkbox("Show debug gizmo volumes", &mShowDebugVolumes);
 		ImGui::Checkbox("Enable volume editor", &ER_Utility::IsPostEffectsVolumeEditor);
+
+		std::string volumesText = "Volumes: " + std::to_string(mPostEffectsVolumes.size()) + ", grid cells: " + std::to_string(mPostEffectsVolumesGrid.GetCellsCount()) +
+			", candidates: " + std::to_string(mPostEffectsVolumesCandidates.size());
+		ImGui::Text(volumesText.c_str());
+		for (const auto& activeVolume : mActivePostEffectsVolumes)
+		{
+			const PostEffectsVolume& volume = mPostEffectsVolumes[activeVolume.first];
+			std::string activeText = volume.name + " (priority " + std::to_string(volume.priority) + "): " + std::to_string(activeVolume.second);
+			ImGui::Text(activeText.c_str());
+		}
+		if (ImGui::Button("Volumes lookup benchmark"))
+			ER_SelfTests::Run(ER_SELF_TEST_POST_EFFECTS_VOLUMES, mVolumesBenchmarkResult);
+		if (!mVolumesBenchmarkResult.empty())
+			ImGui::Text(mVolumesBenchmarkResult.c_str());
 		
 		if (ImGui::Button("Save volume changes"))
 			mCore.GetLevel()->mScene->SavePostProcessingVolumes();
@@ -415,6 +434,9 @@ namespace EveryRay_Core {
 				ImGuizmo::RecomposeMatrixFromComponents(mEditorPostEffectsVolumeMatrixTranslation,
 					mEditorPostEffectsVolumeMatrixRotation, mEditorPostEffectsVolumeMatrixScale, mEditorCurrentPostEffectsVolumeTransformMatrix);
 				ImGui::Checkbox("Volume enabled", &(mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].isEnabled));
+				ImGui::InputInt("Priority", &(mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].priority));
+				if (ImGui::SliderFloat("Blend distance", &(mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].blendDistance), 0.0f, 100.0f))
+					mIsPostEffectsVolumesGridDirty = true;
 				ImGui::End();
 
 				ImGuiIO& io = ImGui::GetIO();
@@ -423,7 +445,11 @@ namespace EveryRay_Core {
 					NULL, useSnap ? &snap[0] : NULL, boundSizing ? bounds : NULL, boundSizingSnap ? boundsSnap : NULL);
 
 				XMFLOAT4X4 mat(mEditorCurrentPostEffectsVolumeTransformMatrix);
-				mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].SetTransform(mat, true);
+				if (memcmp(&mat, &mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].GetTransform(), sizeof(XMFLOAT4X4)) != 0)
+				{
+					mPostEffectsVolumes[mSelectedEditorPostEffectsVolumeIndex].SetTransform(mat, true);
+					mIsPostEffectsVolumesGridDirty = true;
+				}
 			}
 			else
 				ImGui::End();
@@ -481,75 +507,299 @@ namespace EveryRay_Core {
 		rhi->UnbindResourcesFromShader(ER_PIXEL);
 	}
 
+	void ER_PostProcessingStack::UpdatePostEffectsVolumesGrid()
+	{
+		std::vector<ER_AABB> bounds(mPostEffectsVolumes.size());
+		for (size_t i = 0; i < mPostEffectsVolumes.size(); i++)
+		{
+			const ER_AABB& aabb = mPostEffectsVolumes[i].aabb;
+			const float blendDistance = mPostEffectsVolumes[i].blendDistance;
+			bounds[i].first = XMFLOAT3(aabb.first.x - blendDistance, aabb.first.y - blendDistance, aabb.first.z - blendDistance);
+			bounds[i].second = XMFLOAT3(aabb.second.x + blendDistance, aabb.second.y + blendDistance, aabb.second.z + blendDistance);
+		}
+		mPostEffectsVolumesGrid.Build(bounds);
+		mIsPostEffectsVolumesGridDirty = false;
+	}
+
 	void ER_PostProcessingStack::UpdatePostEffectsVolumes()
 	{
-		mCurrentActivePostEffectsVolumeIndex = -1;
-		// TODO: add priority system at some point
-		for (int i = 0; i < static_cast<int>(mPostEffectsVolumes.size()); i++)
+		if (mIsPostEffectsVolumesGridDirty)
+			UpdatePostEffectsVolumesGrid();
+
+		const XMFLOAT3& cameraPosition = mCamera.Position();
+
+		mPostEffectsVolumesCandidates.clear();
+		mPostEffectsVolumesGrid.GetCandidates(cameraPosition, mPostEffectsVolumesCandidates);
+
+		mActivePostEffectsVolumes.clear();
+		for (int index : mPostEffectsVolumesCandidates)
 		{
-			if (!mPostEffectsVolumes[i].isEnabled)
+			const PostEffectsVolume& volume = mPostEffectsVolumes[index];
+			if (!volume.isEnabled)
 				continue;
 
-			ER_AABB& aabb = mPostEffectsVolumes[i].aabb;
+			const float weight = GetVolumeBlendWeight(volume.aabb, volume.blendDistance, cameraPosition);
+			if (weight > 0.0f)
+				mActivePostEffectsVolumes.push_back(std::make_pair(index, weight));
+		}
 
-			bool isColliding =
-				(mCamera.Position().x <= aabb.second.x && mCamera.Position().x >= aabb.first.x) &&
-				(mCamera.Position().y <= aabb.second.y && mCamera.Position().y >= aabb.first.y) &&
-				(mCamera.Position().z <= aabb.second.z && mCamera.Position().z >= aabb.first.z);
+		// lower priorities are blended first; with equal priorities the first volume is blended last (wins, as before priorities)
+		std::sort(mActivePostEffectsVolumes.begin(), mActivePostEffectsVolumes.end(), [this](const std::pair<int, float>& a, const std::pair<int, float>& b)
+		{
+			const int priorityA = mPostEffectsVolumes[a.first].priority;
+			const int priorityB = mPostEffectsVolumes[b.first].priority;
+			return (priorityA != priorityB) ? (priorityA < priorityB) : (a.first > b.first);
+		});
+		if (mActivePostEffectsVolumes.size() > POST_EFFECT_VOLUMES_MAX_BLENDED)
+			mActivePostEffectsVolumes.erase(mActivePostEffectsVolumes.begin(), mActivePostEffectsVolumes.end() - POST_EFFECT_VOLUMES_MAX_BLENDED);
 
-			if (isColliding)
+		mCurrentActivePostEffectsVolumeIndex = -1;
+		for (auto it = mActivePostEffectsVolumes.rbegin(); it != mActivePostEffectsVolumes.rend(); ++it)
+		{
+			if (it->second >= 1.0f)
 			{
-				mCurrentActivePostEffectsVolumeIndex = i;
+				mCurrentActivePostEffectsVolumeIndex = it->first;
 				break;
 			}
 		}
 
-		SetPostEffectsValuesFromVolume(mCurrentActivePostEffectsVolumeIndex);
+		PostEffectsVolumeValues values = GetDefaultPostEffectsValues();
+		for (const auto& activeVolume : mActivePostEffectsVolumes)
+			BlendPostEffectsValues(values, mPostEffectsVolumes[activeVolume.first].values, activeVolume.second);
+		SetPostEffectsValues(values);
+	}
+
+	PostEffectsVolumeValues ER_PostProcessingStack::GetDefaultPostEffectsValues() const
+	{
+		PostEffectsVolumeValues values = {};
+
+		values.linearFogEnable = mUseLinearFogDefault;
+		values.linearFogColor[0] = mLinearFogColorDefault[0];
+		values.linearFogColor[1] = mLinearFogColorDefault[1];
+		values.linearFogColor[2] = mLinearFogColorDefault[2];
+		values.linearFogDensity = mLinearFogDensityDefault;
+
+		values.tonemappingEnable = mUseTonemapDefault;
+		values.ssrEnable = mUseSSRDefault;
+		values.sssEnable = mUseSSSDefault;
+
+		values.vignetteEnable = mUseVignetteDefault;
+		values.vignetteSoftness = mVignetteSoftnessDefault;
+		values.vignetteRadius = mVignetteRadiusDefault;
+
+		values.colorGradingEnable = mUseColorGradingDefault;
+		values.colorGradingLUTIndex = static_cast<int>(mColorGradingCurrentLUTIndexDefault);
+
+		return values;
+	}
+
+	void ER_PostProcessingStack::SetPostEffectsValues(const PostEffectsVolumeValues& aValues)
+	{
+		mUseLinearFog = aValues.linearFogEnable;
+		mLinearFogColor[0] = aValues.linearFogColor[0];
+		mLinearFogColor[1] = aValues.linearFogColor[1];
+		mLinearFogColor[2] = aValues.linearFogColor[2];
+		mLinearFogDensity = aValues.linearFogDensity;
+
+		mUseTonemap = aValues.tonemappingEnable;
+		mUseSSR = aValues.ssrEnable;
+		mUseSSS = aValues.sssEnable;
+
+		mUseVignette = aValues.vignetteEnable;
+		mVignetteSoftness = aValues.vignetteSoftness;
+		mVignetteRadius = aValues.vignetteRadius;
+
+		mUseColorGrading = aValues.colorGradingEnable;
+		mColorGradingCurrentLUTIndex = static_cast<UINT>(aValues.colorGradingLUTIndex);
+	}
+
+	float ER_PostProcessingStack::GetVolumeBlendWeight(const ER_AABB& aAABB, float aBlendDistance, const XMFLOAT3& aPoint)
+	{
+		const float dx = std::max(std::max(aAABB.first.x - aPoint.x, aPoint.x - aAABB.second.x), 0.0f);
+		const float dy = std::max(std::max(aAABB.first.y - aPoint.y, aPoint.y - aAABB.second.y), 0.0f);
+		const float dz = std::max(std::max(aAABB.first.z - aPoint.z, aPoint.z - aAABB.second.z), 0.0f);
+		const float distanceSqr = dx * dx + dy * dy + dz * dz;
+
+		if (distanceSqr == 0.0f)
+			return 1.0f;
+		if (aBlendDistance <= 0.0f || distanceSqr >= aBlendDistance * aBlendDistance)
+			return 0.0f;
+
+		return 1.0f - sqrtf(distanceSqr) / aBlendDistance;
+	}
+
+	void ER_PostProcessingStack::BlendPostEffectsValues(PostEffectsVolumeValues& aInOutValues, const PostEffectsVolumeValues& aVolumeValues, float aWeight)
+	{
+		auto lerp = [aWeight](float a, float b) { return a + (b - a) * aWeight; };
+
+		for (int i = 0; i < 3; i++)
+			aInOutValues.linearFogColor[i] = lerp(aInOutValues.linearFogColor[i], aVolumeValues.linearFogColor[i]);
+		aInOutValues.linearFogDensity = lerp(aInOutValues.linearFogDensity, aVolumeValues.linearFogDensity);
+		aInOutValues.vignetteSoftness = lerp(aInOutValues.vignetteSoftness, aVolumeValues.vignetteSoftness);
+		aInOutValues.vignetteRadius = lerp(aInOutValues.vignetteRadius, aVolumeValues.vignetteRadius);
+
+		if (aWeight >= 0.5f)
+		{
+			aInOutValues.linearFogEnable = aVolumeValues.linearFogEnable;
+			aInOutValues.vignetteEnable = aVolumeValues.vignetteEnable;
+			aInOutValues.tonemappingEnable = aVolumeValues.tonemappingEnable;
+			aInOutValues.colorGradingEnable = aVolumeValues.colorGradingEnable;
+			aInOutValues.colorGradingLUTIndex = aVolumeValues.colorGradingLUTIndex;
+			aInOutValues.sssEnable = aVolumeValues.sssEnable;
+			aInOutValues.ssrEnable = aVolumeValues.ssrEnable;
+		}
 	}
 
-	void ER_PostProcessingStack::SetPostEffectsValuesFromVolume(int index /*= -1*/)
+	bool ER_PostProcessingStack::RunVolumesBenchmark(int aVolumesCount, int aQueriesCount, std::string& aOutReport)
 	{
-		if (index == -1 || !mPostEffectsVolumes[index].isEnabled)
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		const float fieldSize = 2000.0f;
+
+		std::vector<ER_AABB> volumes(aVolumesCount);
+		std::vector<float> blendDistances(aVolumesCount);
+		std::vector<ER_AABB> bounds(aVolumesCount);
+		for (int i = 0; i < aVolumesCount; i++)
 		{
-			//set defaults
-			mUseLinearFog = mUseLinearFogDefault;
-			mLinearFogColor[0] = mLinearFogColorDefault[0];
-			mLinearFogColor[1] = mLinearFogColorDefault[1];
-			mLinearFogColor[2] = mLinearFogColorDefault[2];
-			mLinearFogDensity = mLinearFogDensityDefault;
+			const XMFLOAT3 center(random.NextFloat(-fieldSize, fieldSize), random.NextFloat(0.0f, 50.0f), random.NextFloat(-fieldSize, fieldSize));
+			const XMFLOAT3 extent(random.NextFloat(5.0f, 60.0f), random.NextFloat(5.0f, 30.0f), random.NextFloat(5.0f, 60.0f));
+			volumes[i] = { XMFLOAT3(center.x - extent.x, center.y - extent.y, center.z - extent.z), XMFLOAT3(center.x + extent.x, center.y + extent.y, center.z + extent.z) };
+			blendDistances[i] = random.NextFloat(0.0f, 20.0f);
+			bounds[i] = { XMFLOAT3(volumes[i].first.x - blendDistances[i], volumes[i].first.y - blendDistances[i], volumes[i].first.z - blendDistances[i]),
+				XMFLOAT3(volumes[i].second.x + blendDistances[i], volumes[i].second.y + blendDistances[i], volumes[i].second.z + blendDistances[i]) };
+		}
 
-			mUseTonemap = mUseTonemapDefault;
-			mUseSSR = mUseSSRDefault;
-			mUseSSS = mUseSSSDefault;
+		// half of the points around the volumes, half anywhere
+		std::vector<XMFLOAT3> points(aQueriesCount);
+		for (int i = 0; i < aQueriesCount; i++)
+		{
+			if (aVolumesCount > 0 && (i & 1))
+			{
+				const ER_AABB& bound = bounds[random.NextInt(0, aVolumesCount)];
+				points[i] = XMFLOAT3(random.NextFloat(bound.first.x, bound.second.x), random.NextFloat(bound.first.y, bound.second.y), random.NextFloat(bound.first.z, bound.second.z));
+			}
+			else
+				points[i] = XMFLOAT3(random.NextFloat(-fieldSize, fieldSize), random.NextFloat(0.0f, 50.0f), random.NextFloat(-fieldSize, fieldSize));
+		}
 
-			mUseVignette = mUseVignetteDefault;
-			mVignetteSoftness = mVignetteSoftnessDefault;
-			mVignetteRadius = mVignetteRadiusDefault;
+		PostEffectsVolumesGrid grid;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		grid.Build(bounds);
+		auto endTime = std::chrono::high_resolution_clock::now();
+		const double buildTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
 
-			mUseColorGrading = mUseColorGradingDefault;
-			mColorGradingCurrentLUTIndex = mColorGradingCurrentLUTIndexDefault;
+		std::vector<std::vector<std::pair<int, float>>> linearResults(aQueriesCount);
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int q = 0; q < aQueriesCount; q++)
+		{
+			for (int i = 0; i < aVolumesCount; i++)
+			{
+				const float weight = GetVolumeBlendWeight(volumes[i], blendDistances[i], points[q]);
+				if (weight > 0.0f)
+					linearResults[q].push_back(std::make_pair(i, weight));
+			}
 		}
-		else
+		endTime = std::chrono::high_resolution_clock::now();
+		const double linearTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+		std::vector<std::vector<std::pair<int, float>>> gridResults(aQueriesCount);
+		std::vector<int> candidates;
+		UINT64 candidatesCount = 0;
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int q = 0; q < aQueriesCount; q++)
 		{
-			PostEffectsVolume& currentVolume = mPostEffectsVolumes[index];
+			candidates.clear();
+			grid.GetCandidates(points[q], candidates);
+			candidatesCount += candidates.size();
+			for (int i : candidates)
+			{
+				const float weight = GetVolumeBlendWeight(volumes[i], blendDistances[i], points[q]);
+				if (weight > 0.0f)
+					gridResults[q].push_back(std::make_pair(i, weight));
+			}
+		}
+		endTime = std::chrono::high_resolution_clock::now();
+		const double gridTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
 
-			mUseLinearFog = currentVolume.values.linearFogEnable;
-			mLinearFogColor[0] = currentVolume.values.linearFogColor[0];
-			mLinearFogColor[1] = currentVolume.values.linearFogColor[1];
-			mLinearFogColor[2] = currentVolume.values.linearFogColor[2];
-			mLinearFogDensity = currentVolume.values.linearFogDensity;
+		int mismatches = 0;
+		UINT64 hitsCount = 0;
+		for (int q = 0; q < aQueriesCount; q++)
+		{
+			if (linearResults[q] != gridResults[q])
+				mismatches++;
+			hitsCount += linearResults[q].size();
+		}
 
-			mUseTonemap = currentVolume.values.tonemappingEnable;
-			mUseSSR = currentVolume.values.ssrEnable;
-			mUseSSS = currentVolume.values.sssEnable;
+		const UINT64 queries = static_cast<UINT64>(std::max(1, aQueriesCount));
+		aOutReport = std::to_string(aVolumesCount) + " volumes, " + std::to_string(aQueriesCount) + " queries, " + std::to_string(grid.GetCellsCount()) + " cells (build " +
+			std::to_string(buildTime) + " ms)\n" +
+			"linear: " + std::to_string(linearTime) + " ms, grid: " + std::to_string(gridTime) + " ms\n" +
+			"candidates per query: " + std::to_string(static_cast<double>(candidatesCount) / queries) + ", affecting volumes per query: " +
+			std::to_string(static_cast<double>(hitsCount) / queries) + "\n" +
+			"mismatches: " + std::to_string(mismatches);
+		return mismatches == 0;
+	}
 
-			mUseVignette = currentVolume.values.vignetteEnable;
-			mVignetteSoftness = currentVolume.values.vignetteSoftness;
-			mVignetteRadius = currentVolume.values.vignetteRadius;
+	void PostEffectsVolumesGrid::Build(const std::vector<ER_AABB>& aBounds)
+	{
+		mCellsFirstIndex.assign(1, 0);
+		mIndices.clear();
+		mCellsPerSide = 0;
+		if (aBounds.empty())
+			return;
 
-			mUseColorGrading = currentVolume.values.colorGradingEnable;
-			mColorGradingCurrentLUTIndex = currentVolume.values.colorGradingLUTIndex;
+		mMin = XMFLOAT2(FLT_MAX, FLT_MAX);
+		XMFLOAT2 max(-FLT_MAX, -FLT_MAX);
+		for (const ER_AABB& bound : aBounds)
+		{
+			mMin.x = std::min(mMin.x, bound.first.x);
+			mMin.y = std::min(mMin.y, bound.first.z);
+			max.x = std::max(max.x, bound.second.x);
+			max.y = std::max(max.y, bound.second.z);
 		}
+
+		// about one volume per cell
+		mCellsPerSide = std::min(std::max(static_cast<int>(ceilf(sqrtf(static_cast<float>(aBounds.size())))), 1), POST_EFFECT_VOLUMES_GRID_MAX_CELLS_PER_SIDE);
+		mCellSize = std::max(std::max(max.x - mMin.x, max.y - mMin.y) / static_cast<float>(mCellsPerSide), 0.001f);
+
+		// counting sort of the (volume, cell) pairs by cell
+		const int cellsCount = mCellsPerSide * mCellsPerSide;
+		mCellsFirstIndex.assign(cellsCount + 1, 0);
+		for (const ER_AABB& bound : aBounds)
+		{
+			for (int z = GetCellIndex(bound.first.z, mMin.y); z <= GetCellIndex(bound.second.z, mMin.y); z++)
+				for (int x = GetCellIndex(bound.first.x, mMin.x); x <= GetCellIndex(bound.second.x, mMin.x); x++)
+					mCellsFirstIndex[z * mCellsPerSide + x + 1]++;
+		}
+		for (int cell = 0; cell < cellsCount; cell++)
+			mCellsFirstIndex[cell + 1] += mCellsFirstIndex[cell];
+
+		mIndices.resize(mCellsFirstIndex[cellsCount]);
+		std::vector<int> cellsCursor(mCellsFirstIndex.begin(), mCellsFirstIndex.end() - 1);
+		for (int i = 0; i < static_cast<int>(aBounds.size()); i++)
+		{
+			const ER_AABB& bound = aBounds[i];
+			for (int z = GetCellIndex(bound.first.z, mMin.y); z <= GetCellIndex(bound.second.z, mMin.y); z++)
+				for (int x = GetCellIndex(bound.first.x, mMin.x); x <= GetCellIndex(bound.second.x, mMin.x); x++)
+					mIndices[cellsCursor[z * mCellsPerSide + x]++] = i;
+		}
+	}
+
+	void PostEffectsVolumesGrid::GetCandidates(const XMFLOAT3& aPoint, std::vector<int>& aOutIndices) const
+	{
+		if (mCellsPerSide == 0)
+			return;
+
+		const float size = mCellSize * static_cast<float>(mCellsPerSide);
+		if (aPoint.x < mMin.x || aPoint.z < mMin.y || aPoint.x > mMin.x + size || aPoint.z > mMin.y + size)
+			return;
+
+		const int cell = GetCellIndex(aPoint.z, mMin.y) * mCellsPerSide + GetCellIndex(aPoint.x, mMin.x);
+		aOutIndices.insert(aOutIndices.end(), mIndices.begin() + mCellsFirstIndex[cell], mIndices.begin() + mCellsFirstIndex[cell + 1]);
+	}
+
+	int PostEffectsVolumesGrid::GetCellIndex(float aPosition, float aMin) const
+	{
+		return std::min(std::max(static_cast<int>((aPosition - aMin) / mCellSize), 0), mCellsPerSide - 1);
 	}
 
 	void ER_PostProcessingStack::PrepareDrawingTonemapping(ER_RHI_GPUTexture* aInputTexture, ER_GBuffer* gbuffer)
@@ -923,28 +1173,20 @@ namespace EveryRay_Core {
 		}
 	}
 
-	void ER_PostProcessingStack::DrawPostEffectsVolumesDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void ER_PostProcessingStack::DrawPostEffectsVolumesDebugGizmos(ER_DebugRenderer* aDebugRenderer)
 	{
 		if (!mShowDebugVolumes)
 			return;
 
 		for (auto& volume : mPostEffectsVolumes)
-			volume.DrawDebugVolume(aRenderTarget, aDepth, rs);
+			volume.DrawDebugVolume(aDebugRenderer);
 	}
 
-	PostEffectsVolume::PostEffectsVolume(ER_Core& pCore, const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName)
+	PostEffectsVolume::PostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName)
 		: worldTransform(aTransform), values(aValues), name(aName)
 	{
 		aabb = { XMFLOAT3(-1.0, -1.0, -1.0), XMFLOAT3(1.0, 1.0, 1.0) };
 		UpdateDebugVolumeAABB();
-
-		debugGizmoAABB = new ER_RenderableAABB(pCore, DebugPostEffectsVolumeColor);
-		debugGizmoAABB->InitializeGeometry({ aabb.first, aabb.second });
-	}
-
-	PostEffectsVolume::~PostEffectsVolume()
-	{
-		DeleteObject(debugGizmoAABB);
 	}
 
 	void PostEffectsVolume::UpdateDebugVolumeAABB()
@@ -984,14 +1226,12 @@ namespace EveryRay_Core {
 		}
 
 		aabb = ER_AABB(minVertex, maxVertex);
-		if (debugGizmoAABB)
-			debugGizmoAABB->Update(aabb);
 	}
 
-	void PostEffectsVolume::DrawDebugVolume(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void PostEffectsVolume::DrawDebugVolume(ER_DebugRenderer* aDebugRenderer)
 	{
-		if (debugGizmoAABB && isEnabled)
-			debugGizmoAABB->Draw(aRenderTarget, aDepth, rs);
+		if (isEnabled)
+			aDebugRenderer->AddAABB(aabb, DebugPostEffectsVolumeColor);
 	}
 
 	void PostEffectsVolume::SetTransform(const XMFLOAT4X4& aTransform, bool updateAABB /*= true*/)
@@ -3,7 +3,12 @@
 #include "ER_Core.h"
 #include "ER_CoreTime.h"
 
-#define MAX_POST_EFFECT_VOLUMES 64
+#define MAX_POST_EFFECT_VOLUMES 1024
+// Volumes (expanded by their blend distance) are bucketed into a uniform XZ grid, so only the volumes of the camera's cell are tested
+#define POST_EFFECT_VOLUMES_GRID_MAX_CELLS_PER_SIDE 32
+#define POST_EFFECT_VOLUMES_MAX_BLENDED 16 // volumes affecting one point (highest priorities are kept)
+#define POST_EFFECT_VOLUMES_BENCHMARK_VOLUMES 1024
+#define POST_EFFECT_VOLUMES_BENCHMARK_QUERIES 100000
 
 namespace EveryRay_Core
 {
@@ -13,7 +18,7 @@ namespace EveryRay_Core
 	class ER_GBuffer;
 	class ER_VolumetricClouds;
 	class ER_VolumetricFog;
-	class ER_RenderableAABB;
+	class ER_DebugRenderer;
 
 	namespace PostEffectsCBuffers
 	{
@@ -71,11 +76,10 @@ namespace EveryRay_Core
 	};
 	struct PostEffectsVolume
 	{
-		PostEffectsVolume(ER_Core& pCore, const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName);
-		~PostEffectsVolume();
+		PostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName);
 
 		void UpdateDebugVolumeAABB();
-		void DrawDebugVolume(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawDebugVolume(ER_DebugRenderer* aDebugRenderer);
 
 		void SetTransform(const XMFLOAT4X4& aTransform, bool updateAABB = true);
 		const XMFLOAT4X4& GetTransform() const { return worldTransform; }
@@ -91,13 +95,35 @@ namespace EveryRay_Core
 		};
 		XMFLOAT3 currentAABBVertices[8];
 
-		ER_RenderableAABB* debugGizmoAABB = nullptr;
 		ER_AABB aabb;
 
 		std::string name;
+		int priority = 0; // higher priority volumes are blended over lower ones
+		float blendDistance = 0.0f; // weight fades from 1 at the AABB to 0 at this distance from it
 		bool isEnabled = true;
 	};
 
+	// Uniform XZ grid over the AABBs of the volumes (expanded by their blend distance) with cell-sorted volume indices.
+	// A volume is listed in every cell it overlaps, so a query returns all volumes that can affect the point (and some that do not).
+	class PostEffectsVolumesGrid
+	{
+	public:
+		void Build(const std::vector<ER_AABB>& aBounds);
+		// Appends the candidates of the point's cell (nothing if it is outside of the grid)
+		void GetCandidates(const XMFLOAT3& aPoint, std::vector<int>& aOutIndices) const;
+
+		int GetCellsCount() const { return mCellsPerSide * mCellsPerSide; }
+		int GetCellsPerSide() const { return mCellsPerSide; }
+	private:
+		int GetCellIndex(float aPosition, float aMin) const;
+
+		std::vector<int> mCellsFirstIndex; // into mIndices, cells count + 1
+		std::vector<int> mIndices;
+		XMFLOAT2 mMin = { 0.0f, 0.0f };
+		float mCellSize = 1.0f;
+		int mCellsPerSide = 0;
+	};
+
 	class ER_PostProcessingStack
 	{
 	public:
@@ -111,7 +137,7 @@ namespace EveryRay_Core
 
 		void DrawEffects(const ER_CoreTime& gameTime, ER_QuadRenderer* quad, ER_GBuffer* gbuffer, 
 			ER_VolumetricClouds* aVolumetricClouds = nullptr, ER_VolumetricFog* aVolumetricFog = nullptr);
-		void DrawPostEffectsVolumesDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawPostEffectsVolumesDebugGizmos(ER_DebugRenderer* aDebugRenderer);
 
 		void Update();
 		void Config() { mShowDebug = !mShowDebug; }
@@ -134,14 +160,24 @@ namespace EveryRay_Core
 		void SetUseTonemapping(bool value) { mUseTonemap = value; }
 
 		void ReservePostEffectsVolumes(int count);
-		bool AddPostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName);
+		bool AddPostEffectsVolume(const XMFLOAT4X4& aTransform, const PostEffectsVolumeValues& aValues, const std::string& aName, int aPriority = 0, float aBlendDistance = 0.0f);
 		int GetPostEffectsVolumesCount() const { return static_cast<int>(mPostEffectsVolumes.size()); }
 		const PostEffectsVolume& GetPostEffectsVolume(int index) const { return mPostEffectsVolumes[index]; }
 
+		// 1 inside of the AABB, fades to 0 at aBlendDistance from it
+		static float GetVolumeBlendWeight(const ER_AABB& aAABB, float aBlendDistance, const XMFLOAT3& aPoint);
+		// Numeric values are interpolated, toggles and indices switch at half weight
+		static void BlendPostEffectsValues(PostEffectsVolumeValues& aInOutValues, const PostEffectsVolumeValues& aVolumeValues, float aWeight);
+
+		// Random volumes and points: grid lookups against the linear scan (timings and mismatches, which must be 0)
+		static bool RunVolumesBenchmark(int aVolumesCount, int aQueriesCount, std::string& aOutReport);
+
 		bool isWindowOpened = false;
 	private:
 		void UpdatePostEffectsVolumes();
-		void SetPostEffectsValuesFromVolume(int index = -1);
+		void UpdatePostEffectsVolumesGrid();
+		void SetPostEffectsValues(const PostEffectsVolumeValues& aValues);
+		PostEffectsVolumeValues GetDefaultPostEffectsValues() const;
 
 		void PrepareDrawingTonemapping(ER_RHI_GPUTexture* aInputTexture, ER_GBuffer* gbuffer);
 		void PrepareDrawingSSR(const ER_CoreTime& gameTime, ER_RHI_GPUTexture* aInputTexture, ER_GBuffer* gbuffer);
@@ -158,7 +194,11 @@ namespace EveryRay_Core
 
 		// volumes
 		std::vector<PostEffectsVolume> mPostEffectsVolumes;
-		int mCurrentActivePostEffectsVolumeIndex = -1; // the one we are currently in
+		PostEffectsVolumesGrid mPostEffectsVolumesGrid;
+		std::vector<int> mPostEffectsVolumesCandidates; // of the camera's cell
+		std::vector<std::pair<int, float>> mActivePostEffectsVolumes; // index and weight, in blending order
+		bool mIsPostEffectsVolumesGridDirty = true;
+		int mCurrentActivePostEffectsVolumeIndex = -1; // the highest priority one we are currently in
 		int mSelectedEditorPostEffectsVolumeIndex = -1; // the one selected for editing via ImGui
 		float mEditorPostEffectsVolumeMatrixTranslation[3];
 		float mEditorPostEffectsVolumeMatrixRotation[3];
@@ -172,6 +212,7 @@ namespace EveryRay_Core
 		};
 		const char* mEditorPostEffectsVolumesNames[MAX_POST_EFFECT_VOLUMES] = { nullptr };
 		bool mShowDebugVolumes = true;
+		std::string mVolumesBenchmarkResult;
 
 		// Tonemap
 		ER_RHI_GPUTexture* mTonemappingRT = nullptr;
@@ -0,0 +1,341 @@
+#include "stdafx.h"
+
+#include "ER_Random.h"
+
+#if ER_RANDOM_USE_SIMD
+#include <emmintrin.h>
+#endif
+
+namespace EveryRay_Core
+{
+	// First values of some seeds and streams (checked against an independent xoshiro128+ implementation): they must never change,
+	// as generated content (foliage, test scenes etc.) depends on them
+	static const UINT64 RandomReferenceSeeds[][2] =
+	{
+		{ ER_RANDOM_DEFAULT_SEED, 0 },
+		{ ER_RANDOM_DEFAULT_SEED, 1 },
+		{ ER_RANDOM_DEFAULT_SEED, 1000 },
+		{ 0, 0 },
+		{ 1, 0 },
+		{ 0xFFFFFFFFFFFFFFFFULL, 7 }
+	};
+	static const UINT RandomReferenceValues[][8] =
+	{
+		{ 0x2E3E2C03, 0x217BDE30, 0x65D6B362, 0x0CD3D8EF, 0x2FE7B3BA, 0xAD9282EA, 0xAE9B1A83, 0x7AABB007 },
+		{ 0xEF62780B, 0x91A5D60B, 0xBABF4BBE, 0x0425685A, 0x8EB2D8A9, 0x4BBA4B71, 0xE2A7D6B5, 0x76B540C4 },
+		{ 0xF4D11B45, 0x4481DD0D, 0xE7CD48BD, 0x1FCEC453, 0xAC674E6E, 0x0034EDE5, 0x9B69E2FF, 0xC7FD4086 },
+		{ 0xE9966C19, 0x7894FDF7, 0xA57413A7, 0xE4C9461B, 0xB8F8985E, 0xFD7428F1, 0xAA0D9544, 0x2A8FE2AD },
+		{ 0x47EDEA62, 0x6CF3DBEE, 0x944EC1B8, 0x5D1DF7B4, 0xB3E6660B, 0x0384656A, 0x16F12835, 0xA50386F1 },
+		{ 0xAF2CB57B, 0x938FBB68, 0x12F2DBE2, 0x92FB706F, 0x9A67C8F0, 0x268571AB, 0x411C76C8, 0x141A75ED }
+	};
+
+	static UINT64 SplitMix64(UINT64& aState)
+	{
+		UINT64 z = (aState += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	static inline float ToUnitFloat(UINT aValue)
+	{
+		// top 24 bits: exactly representable, so the conversion is the same everywhere
+		return static_cast<float>(aValue >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static inline int ToRange(UINT aValue, int aMin, UINT aRange)
+	{
+		return aMin + static_cast<int>((static_cast<UINT64>(aValue) * aRange) >> 32);
+	}
+
+	ER_Random::ER_Random(UINT64 aSeed, UINT64 aStream)
+	{
+		Seed(aSeed, aStream);
+	}
+
+	void ER_Random::Seed(UINT64 aSeed, UINT64 aStream)
+	{
+		UINT64 seedState = aSeed ^ (aStream * 0xD1B54A32D192ED03ULL);
+		for (int stream = 0; stream < 4; stream++)
+		{
+			UINT64 a = SplitMix64(seedState);
+			UINT64 b = SplitMix64(seedState);
+			mState[0][stream] = static_cast<UINT>(a);
+			mState[1][stream] = static_cast<UINT>(a >> 32);
+			mState[2][stream] = static_cast<UINT>(b);
+			mState[3][stream] = static_cast<UINT>(b >> 32);
+			if ((a | b) == 0) // all-zero state is the only invalid one
+				mState[0][stream] = 1;
+		}
+		mBufferPosition = 4;
+	}
+
+	void ER_Random::Step(UINT* aOut)
+	{
+#if ER_RANDOM_USE_SIMD
+		__m128i s0 = _mm_load_si128(reinterpret_cast<const __m128i*>(mState[0]));
+		__m128i s1 = _mm_load_si128(reinterpret_cast<const __m128i*>(mState[1]));
+		__m128i s2 = _mm_load_si128(reinterpret_cast<const __m128i*>(mState[2]));
+		__m128i s3 = _mm_load_si128(reinterpret_cast<const __m128i*>(mState[3]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(aOut), _mm_add_epi32(s0, s3));
+
+		__m128i t = _mm_slli_epi32(s1, 9);
+		s2 = _mm_xor_si128(s2, s0);
+		s3 = _mm_xor_si128(s3, s1);
+		s1 = _mm_xor_si128(s1, s2);
+		s0 = _mm_xor_si128(s0, s3);
+		s2 = _mm_xor_si128(s2, t);
+		s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+		_mm_store_si128(reinterpret_cast<__m128i*>(mState[0]), s0);
+		_mm_store_si128(reinterpret_cast<__m128i*>(mState[1]), s1);
+		_mm_store_si128(reinterpret_cast<__m128i*>(mState[2]), s2);
+		_mm_store_si128(reinterpret_cast<__m128i*>(mState[3]), s3);
+#else
+		for (int stream = 0; stream < 4; stream++)
+		{
+			UINT s0 = mState[0][stream];
+			UINT s1 = mState[1][stream];
+			UINT s2 = mState[2][stream];
+			UINT s3 = mState[3][stream];
+
+			aOut[stream] = s0 + s3;
+
+			UINT t = s1 << 9;
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= t;
+			s3 = (s3 << 11) | (s3 >> 21);
+
+			mState[0][stream] = s0;
+			mState[1][stream] = s1;
+			mState[2][stream] = s2;
+			mState[3][stream] = s3;
+		}
+#endif
+	}
+
+	void ER_Random::Refill()
+	{
+		Step(mBuffer);
+		mBufferPosition = 0;
+	}
+
+	UINT ER_Random::NextUInt()
+	{
+		if (mBufferPosition == 4)
+			Refill();
+		return mBuffer[mBufferPosition++];
+	}
+
+	float ER_Random::NextFloat()
+	{
+		return ToUnitFloat(NextUInt());
+	}
+
+	float ER_Random::NextFloat(float aMin, float aMax)
+	{
+		const float range = aMax - aMin;
+		return aMin + ToUnitFloat(NextUInt()) * range;
+	}
+
+	int ER_Random::NextInt(int aMin, int aMax)
+	{
+		assert(aMax > aMin);
+		return ToRange(NextUInt(), aMin, static_cast<UINT>(aMax - aMin));
+	}
+
+	// Bulk fills: leftovers of the buffer first, then whole steps straight into the output, the tail goes through the buffer again.
+	// That keeps the sequence identical to the single value calls.
+	void ER_Random::FillUInt(UINT* aOut, size_t aCount)
+	{
+		size_t i = 0;
+		for (; i < aCount && mBufferPosition < 4; i++)
+			aOut[i] = mBuffer[mBufferPosition++];
+		for (; i + 4 <= aCount; i += 4)
+			Step(aOut + i);
+		for (; i < aCount; i++)
+			aOut[i] = NextUInt();
+	}
+
+	void ER_Random::FillFloat(float* aOut, size_t aCount)
+	{
+		FillFloat(aOut, aCount, 0.0f, 1.0f);
+	}
+
+	void ER_Random::FillFloat(float* aOut, size_t aCount, float aMin, float aMax)
+	{
+		const float range = aMax - aMin;
+
+		size_t i = 0;
+		for (; i < aCount && mBufferPosition < 4; i++)
+			aOut[i] = aMin + ToUnitFloat(mBuffer[mBufferPosition++]) * range;
+
+		ER_ALIGN16 UINT values[4];
+#if ER_RANDOM_USE_SIMD
+		const __m128 minV = _mm_set1_ps(aMin);
+		const __m128 rangeV = _mm_set1_ps(range);
+		const __m128 scaleV = _mm_set1_ps(1.0f / 16777216.0f);
+		for (; i + 4 <= aCount; i += 4)
+		{
+			Step(values);
+			__m128i v = _mm_srli_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(values)), 8);
+			__m128 unit = _mm_mul_ps(_mm_cvtepi32_ps(v), scaleV);
+			_mm_storeu_ps(aOut + i, _mm_add_ps(minV, _mm_mul_ps(unit, rangeV)));
+		}
+#else
+		for (; i + 4 <= aCount; i += 4)
+		{
+			Step(values);
+			for (int j = 0; j < 4; j++)
+				aOut[i + j] = aMin + ToUnitFloat(values[j]) * range;
+		}
+#endif
+		for (; i < aCount; i++)
+			aOut[i] = aMin + ToUnitFloat(NextUInt()) * range;
+	}
+
+	void ER_Random::FillInt(int* aOut, size_t aCount, int aMin, int aMax)
+	{
+		assert(aMax > aMin);
+		const UINT range = static_cast<UINT>(aMax - aMin);
+
+		size_t i = 0;
+		for (; i < aCount && mBufferPosition < 4; i++)
+			aOut[i] = ToRange(mBuffer[mBufferPosition++], aMin, range);
+
+		ER_ALIGN16 UINT values[4];
+#if ER_RANDOM_USE_SIMD
+		// high 32 bits of (value * range): _mm_mul_epu32 only multiplies the even lanes, so the odd ones are shifted down first
+		const __m128i minV = _mm_set1_epi32(aMin);
+		const __m128i rangeV = _mm_set1_epi32(static_cast<int>(range));
+		const __m128i oddMask = _mm_set_epi32(-1, 0, -1, 0);
+		for (; i + 4 <= aCount; i += 4)
+		{
+			Step(values);
+			__m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(values));
+			__m128i even = _mm_srli_epi64(_mm_mul_epu32(v, rangeV), 32);
+			__m128i odd = _mm_and_si128(_mm_mul_epu32(_mm_srli_epi64(v, 32), rangeV), oddMask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(aOut + i), _mm_add_epi32(minV, _mm_or_si128(even, odd)));
+		}
+#else
+		for (; i + 4 <= aCount; i += 4)
+		{
+			Step(values);
+			for (int j = 0; j < 4; j++)
+				aOut[i + j] = ToRange(values[j], aMin, range);
+		}
+#endif
+		for (; i < aCount; i++)
+			aOut[i] = ToRange(NextUInt(), aMin, range);
+	}
+
+	bool ER_Random::RunSelfTest(std::string& aOutReport)
+	{
+		const int seedsCount = static_cast<int>(sizeof(RandomReferenceSeeds) / sizeof(RandomReferenceSeeds[0]));
+		int referenceErrors = 0;
+		for (int seed = 0; seed < seedsCount; seed++)
+		{
+			ER_Random random(RandomReferenceSeeds[seed][0], RandomReferenceSeeds[seed][1]);
+			for (int i = 0; i < 8; i++)
+				if (random.NextUInt() != RandomReferenceValues[seed][i])
+					referenceErrors++;
+
+			UINT values[8];
+			random.Seed(RandomReferenceSeeds[seed][0], RandomReferenceSeeds[seed][1]);
+			random.FillUInt(values, 8);
+			for (int i = 0; i < 8; i++)
+				if (values[i] != RandomReferenceValues[seed][i])
+					referenceErrors++;
+		}
+
+		// bulk fills from every buffer position, with counts that are not multiples of 4 too; the next value checks that both generators are in the same state
+		const size_t counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 13, 64, 67 };
+		int fillErrors = 0;
+		for (int skipped = 0; skipped < 4; skipped++)
+		{
+			for (size_t count : counts)
+			{
+				UINT bulkUInts[67];
+				float bulkFloats[67], bulkRangeFloats[67];
+				int bulkInts[67];
+
+				ER_Random bulk(ER_RANDOM_DEFAULT_SEED, count);
+				ER_Random single(ER_RANDOM_DEFAULT_SEED, count);
+				for (int i = 0; i < skipped; i++)
+				{
+					bulk.NextUInt();
+					single.NextUInt();
+				}
+
+				bulk.FillUInt(bulkUInts, count);
+				bulk.FillFloat(bulkFloats, count);
+				bulk.FillFloat(bulkRangeFloats, count, -2.5f, 7.25f);
+				bulk.FillInt(bulkInts, count, -1000, 1000);
+				for (size_t i = 0; i < count; i++)
+					if (bulkUInts[i] != single.NextUInt())
+						fillErrors++;
+				for (size_t i = 0; i < count; i++)
+					if (bulkFloats[i] != single.NextFloat())
+						fillErrors++;
+				for (size_t i = 0; i < count; i++)
+					if (bulkRangeFloats[i] != single.NextFloat(-2.5f, 7.25f))
+						fillErrors++;
+				for (size_t i = 0; i < count; i++)
+					if (bulkInts[i] != single.NextInt(-1000, 1000))
+						fillErrors++;
+				if (bulk.NextUInt() != single.NextUInt())
+					fillErrors++;
+			}
+		}
+
+		// every value of small integer ranges should come up too
+		const int valuesCount = 100000;
+		int rangeErrors = 0;
+		int missingValues = 0;
+		ER_Random random;
+		for (int i = 0; i < valuesCount; i++)
+		{
+			const float unit = random.NextFloat();
+			if (unit < 0.0f || unit >= 1.0f)
+				rangeErrors++;
+			const float value = random.NextFloat(-2.5f, 7.25f);
+			if (value < -2.5f || value > 7.25f)
+				rangeErrors++;
+			const float narrowValue = random.NextFloat(1000.0f, 1000.5f);
+			if (narrowValue < 1000.0f || narrowValue > 1000.5f)
+				rangeErrors++;
+			if (random.NextInt(0, 1) != 0)
+				rangeErrors++;
+			const int largeValue = random.NextInt(-(1 << 30), 1 << 30);
+			if (largeValue < -(1 << 30) || largeValue >= (1 << 30))
+				rangeErrors++;
+		}
+
+		int hits[7] = {};
+		int bulkValues[1000];
+		for (int i = 0; i < valuesCount / 1000; i++)
+		{
+			random.FillInt(bulkValues, 1000, -3, 4);
+			for (int value : bulkValues)
+			{
+				if (value < -3 || value >= 4)
+					rangeErrors++;
+				else
+					hits[value + 3]++;
+			}
+		}
+		for (int value = -3; value < 4; value++)
+			if (hits[value + 3] == 0)
+				missingValues++;
+
+		aOutReport = std::to_string(seedsCount) + " reference seeds/streams" + (ER_RANDOM_USE_SIMD ? " (SIMD)" : " (scalar)") + ", reference mismatches: " +
+			std::to_string(referenceErrors) + "\n" +
+			"bulk vs single value mismatches: " + std::to_string(fillErrors) + "\n" +
+			"out of range values: " + std::to_string(rangeErrors) + " (of " + std::to_string(valuesCount * 6) + "), missing integer values: " + std::to_string(missingValues);
+		return referenceErrors == 0 && fillErrors == 0 && rangeErrors == 0 && missingValues == 0;
+	}
+}
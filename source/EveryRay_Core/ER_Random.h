@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Common.h"
+
+#define ER_RANDOM_USE_SIMD 1 // set to 0 to generate with the scalar path only (output is the same)
+#define ER_RANDOM_DEFAULT_SEED 0x45526179ULL
+
+namespace EveryRay_Core
+{
+	// Seedable random number generator: 4 interleaved xoshiro128+ streams (https://prng.di.unimi.it/), stepped together with SSE2.
+	// Output only depends on the seed (integer math, exact float conversions), so it is identical on every platform and for every thread count.
+	// Instances are not thread-safe: use one generator per system/thread, or for parallel work one generator per work chunk
+	// (seeded with the same seed and the chunk index as a stream), so that the result does not depend on how chunks are spread over threads.
+	class ER_Random
+	{
+	public:
+		explicit ER_Random(UINT64 aSeed = ER_RANDOM_DEFAULT_SEED, UINT64 aStream = 0);
+
+		void Seed(UINT64 aSeed, UINT64 aStream = 0);
+
+		UINT NextUInt();
+		float NextFloat(); // [0, 1)
+		float NextFloat(float aMin, float aMax); // [aMin, aMax] (aMax only through rounding)
+		int NextInt(int aMin, int aMax); // [aMin, aMax)
+
+		// Bulk versions, same sequence as calling the single value versions aCount times
+		void FillUInt(UINT* aOut, size_t aCount);
+		void FillFloat(float* aOut, size_t aCount);
+		void FillFloat(float* aOut, size_t aCount, float aMin, float aMax);
+		void FillInt(int* aOut, size_t aCount, int aMin, int aMax);
+
+		// Checks the first values of a few seeds/streams against the reference ones, the bulk versions against the single value ones
+		// (for every buffer position and count) and the value ranges: fails if the generator's output is not the expected one
+		static bool RunSelfTest(std::string& aOutReport);
+	private:
+		void Step(UINT* aOut); // advances all streams, writes 4 values
+		void Refill();
+
+		ER_ALIGN16 UINT mState[4][4]; // [state word][stream]
+		ER_ALIGN16 UINT mBuffer[4];
+		int mBufferPosition = 4;
+	};
+}
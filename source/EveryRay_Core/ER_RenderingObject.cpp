@@ -9,8 +9,9 @@
 #include "ER_Model.h"
 #include "ER_Mesh.h"
 #include "ER_Utility.h"
+#include "ER_Random.h"
 #include "ER_Illumination.h"
-#include "ER_RenderableAABB.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Material.h"
 #include "ER_Camera.h"
 #include "ER_MatrixHelper.h"
@@ -30,13 +31,36 @@ namespace EveryRay_Core
 		mCamera(pCamera),
 		mMeshesReflectionFactors(0),
 		mName(pName),
-		mDebugGizmoAABB(nullptr),
-		mIsAvailableInEditorMode(availableInEditor),
 		mTransformationMatrix(XMMatrixIdentity()),
+		mIndexInScene(index),
+		mCurrentTextureQuality((RenderingObjectTextureQuality)ER_Settings::TexturesQuality),
+		mIsLoaded(false),
+		mIsIndirectlyRendered(false),
+		mIsTerrainPlacementFinished(false),
+		mIsTerrainPlacement(false),
+		mIsDataStoreDirty(true),
+		mIsAABBDebugEnabled(true),
+		mIsAvailableInEditorMode(availableInEditor),
+		mIsSelected(false),
+		mIsRendered(true),
 		mIsInstanced(isInstanced),
 		mIsCastShadow(isCastShadow),
-		mIndexInScene(index),
-		mCurrentTextureQuality((RenderingObjectTextureQuality)ER_Settings::TexturesQuality)
+		mIsForwardShading(false),
+		mIsPOM(false),
+		mIsCulled(false),
+		mIsMarkedAsFoliage(false),
+		mIsInLightProbe(false),
+		mIsSeparableSubsurfaceScattering(false),
+		mIsInVoxelization(false),
+		mIsInGbuffer(false),
+		mUseIndirectGlobalLightProbe(false),
+		mIsUsedForGlobalLightProbeRendering(false),
+		mIsSkippedIndirectSpecular(false),
+		mIsSkippedIndirectDiffuse(false),
+		mIsReflective(false),
+		mIsTransparent(false),
+		mIsTriplanarMapped(false),
+		mIsCompactInstanceData(false)
 	{
 		mModel = mCore->AddOrGet3DModelFromCache(pModelPath, nullptr, true);
 		if (!mModel)
@@ -46,13 +70,10 @@ namespace EveryRay_Core
 		}
 
 		mMeshesCount.push_back(0); // main LOD
-		mMeshVertices.push_back({}); // main LOD
-		mMeshAllVertices.push_back({}); // main LOD
 
 		mMeshesCount[0] = static_cast<int>(mModel->Meshes().size());
 		for (int i = 0; i < mMeshesCount[0]; i++)
 		{
-			mMeshVertices[0].push_back(mModel->GetMesh(i).Vertices());
 			mMeshesTextureBuffers.push_back(TextureData());
 			mMeshesReflectionFactors.push_back(0.0f);
 
@@ -64,22 +85,10 @@ namespace EveryRay_Core
 			mCustomReflectionMaskTextures.push_back("");
 		}
 
-		for (size_t i = 0; i < mMeshVertices[0].size(); i++)
-		{
-			for (size_t j = 0; j < mMeshVertices[0][i].size(); j++)
-			{
-				mMeshAllVertices[0].push_back(mMeshVertices[0][i][j]);
-			}
-		}
-
+		// no CPU copies of vertices are kept in the object: the model cache owns them (see GetVertexCount())
 		mLocalAABB = mModel->GenerateAABB();
 		mGlobalAABB = mLocalAABB;
 
-		if (mIsAvailableInEditorMode) {
-			mDebugGizmoAABB = new ER_RenderableAABB(*mCore, XMFLOAT4{ 0.0f, 0.0f, 1.0f, 1.0f });
-			mDebugGizmoAABB->InitializeGeometry({ mLocalAABB.first, mLocalAABB.second });
-		}
-
 		XMFLOAT4X4 transform = XMFLOAT4X4( mCurrentObjectTransformMatrix );
 		mTransformationMatrix = XMLoadFloat4x4(&transform);
 
@@ -111,26 +120,15 @@ namespace EveryRay_Core
 		for (auto& meshesInstanceBuffersLOD : mMeshesInstanceBuffers)
 			DeletePointerCollection(meshesInstanceBuffersLOD);
 		mMeshesInstanceBuffers.clear();
+		DeletePointerCollection(mVoxelizationInstanceBuffers);
+		DeletePointerCollection(mShadowCascadeInstanceBuffers);
 
 		mMeshesTextureBuffers.clear();
 
-		DeleteObject(mDebugGizmoAABB);
-		DeleteObject(mInputPositionsOnTerrainBuffer);
-		DeleteObject(mOutputPositionsOnTerrainBuffer);
 		DeleteObjects(mTempInstancesPositions);
 
 		mObjectConstantBuffer.Release();
 		mObjectFakeRootConstantBuffer.Release();
-
-		if (mIsIndirectlyRendered)
-		{
-#if !ER_PLATFORM_WIN64_DX11
-			mIndirectMeshConstants.Release();
-#endif
-			DeleteObject(mIndirectArgsBuffer);
-			DeleteObject(mIndirectNewInstanceDataBuffer);
-			DeleteObject(mIndirectOriginalInstanceDataBuffer);
-		}
 	}
 
 	void ER_RenderingObject::LoadMaterial(ER_Material* pMaterial, const std::string& materialName)
@@ -388,15 +386,6 @@ namespace EveryRay_Core
 		mMeshRenderBuffers.push_back({});
 		assert(mMeshRenderBuffers.size() - 1 == lod);
 
-		if (!mIndirectArgsBuffer && mIsIndirectlyRendered)
-		{
-			const int numArgs = 5; // number of args for DrawIndexedInstanced
-			int size = numArgs * MAX_MESH_COUNT * MAX_LOD; // we always assume that all lods have same mesh count...
-			mIndirectArgsBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - Indirect Args Buffer : " + mName);
-			mIndirectArgsBuffer->CreateGPUBufferResource(rhi, nullptr, size, sizeof(UINT), false,
-				ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_DRAWINDIRECT_ARGS, ER_RHI_FORMAT::ER_FORMAT_R32_UINT);
-		}
-
 		auto createIndexBuffer = [this, rhi](const ER_Mesh& aMesh, int meshIndex, int lod) {
 			mMeshRenderBuffers[lod][meshIndex]->IndexBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - Index Buffer: " + mName + ", lod: " + std::to_string(lod) + ", mesh: " + std::to_string(meshIndex));
 			aMesh.CreateIndexBuffer(mMeshRenderBuffers[lod][meshIndex]->IndexBuffer);
@@ -437,7 +426,40 @@ namespace EveryRay_Core
 			DrawLOD(materialName, toDepth, meshIndex, mCurrentLODIndex);
 	}
 
-	void ER_RenderingObject::DrawLOD(const std::string& materialName, bool toDepth, int meshIndex, int lod, bool skipCulling)
+	// Voxelization of instanced objects only draws the instances overlapping the cascade (see UpdateVoxelizationInstances())
+	void ER_RenderingObject::DrawVoxelization(const std::string& materialName, int meshIndex, int cascade)
+	{
+		if (!mIsLoaded)
+			return;
+
+		if (mIsInstanced && !mIsIndirectlyRendered)
+		{
+			if (cascade < static_cast<int>(mVoxelizationInstanceBuffers.size()) && mVoxelizationInstanceBuffers[cascade])
+				DrawLOD(materialName, true, meshIndex, 0, false, mVoxelizationInstanceBuffers[cascade]);
+		}
+		else
+			Draw(materialName, true, meshIndex);
+	}
+
+	// Cached shadow cascades draw the instances overlapping the cascade (see UpdateShadowCascadeInstances()) regardless of the camera's culling
+	// and LODs, with the highest LOD (like the other cascades)
+	void ER_RenderingObject::DrawShadowCascade(const std::string& materialName, int meshIndex, int cascade)
+	{
+		if (!mIsLoaded)
+			return;
+
+		if (mIsInstanced && !mIsIndirectlyRendered)
+		{
+			if (cascade < static_cast<int>(mShadowCascadeInstanceBuffers.size()) && mShadowCascadeInstanceBuffers[cascade])
+				DrawLOD(materialName, true, meshIndex, GetLODCount() - 1, true, mShadowCascadeInstanceBuffers[cascade]);
+		}
+		else if (mIsInstanced)
+			Draw(materialName, true, meshIndex);
+		else
+			DrawLOD(materialName, true, meshIndex, GetLODCount() - 1, true);
+	}
+
+	void ER_RenderingObject::DrawLOD(const std::string& materialName, bool toDepth, int meshIndex, int lod, bool skipCulling, const CascadeInstanceBufferData* aCascadeInstances)
 	{
 		if (!mIsLoaded)
 			return;
@@ -451,8 +473,10 @@ namespace EveryRay_Core
 
 		if (mMaterials.find(materialName) == mMaterials.end() && !isForwardPass)
 			return;
+
+		const CascadeInstanceBufferData* cascadeInstances = (mIsInstanced && !mIsIndirectlyRendered) ? aCascadeInstances : nullptr;
 		
-		if (mIsRendered && (skipCulling || !mIsCulled) && mCurrentLODIndex != -1)
+		if (mIsRendered && (skipCulling || (!mIsCulled && mCurrentLODIndex != -1)))
 		{
 			if (!isForwardPass && (!mMaterials.size() || mMeshRenderBuffers[lod].size() == 0))
 				return;
@@ -465,6 +489,7 @@ namespace EveryRay_Core
 				mObjectConstantBuffer.Data.CustomAlphaDiscard = mCustomAlphaDiscard;
 				mObjectConstantBuffer.Data.OriginalInstanceCount = mInstanceCount;
 				mObjectConstantBuffer.Data.RenderingObjectFlags = mObjectShaderBitmaskFlags;
+				mObjectConstantBuffer.Data.IndirectFirstInstance = mIndirectFirstInstance;
 				mObjectConstantBuffer.ApplyChanges(rhi);
 
 				mObjectFakeRootConstantBuffer.Data.CurrentLOD = lod;
@@ -485,6 +510,8 @@ namespace EveryRay_Core
 						//WARNING: Make sure the system actually sets that buffer!
 						rhi->SetVertexBuffers({ mMeshRenderBuffers[lod][meshI]->VertexBuffer });
 					}
+					else if (cascadeInstances)
+						rhi->SetVertexBuffers({ mMeshRenderBuffers[lod][meshI]->VertexBuffer, cascadeInstances->InstanceBuffer });
 					else
 						rhi->SetVertexBuffers({ mMeshRenderBuffers[lod][meshI]->VertexBuffer, mMeshesInstanceBuffers[lod][meshI]->InstanceBuffer });
 				}
@@ -504,18 +531,22 @@ namespace EveryRay_Core
 
 				if (mIsInstanced)
 				{
-					if (mIsIndirectlyRendered && mIndirectArgsBuffer)
+					if (mIsIndirectlyRendered)
 					{
+						if (!mIndirectArgsBuffer) // not culled yet (see ER_GPUCuller)
+							continue;
+
 						if (!isForwardPass)
 							mMaterials[materialName]->SetRootConstantForMaterial(static_cast<UINT>(lod));
 
-						const int offset = (MAX_MESH_COUNT * lod + meshI) * 5 * sizeof(UINT); //5 is args count of DrawIndexedInstanced()
+						const UINT offset = (mIndirectFirstDraw + MAX_MESH_COUNT * lod + meshI) * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT * sizeof(UINT);
 						rhi->DrawIndexedInstancedIndirect(mIndirectArgsBuffer, offset);
 					}
 					else
 					{
-						if (mInstanceCountToRender[lod] > 0)
-							rhi->DrawIndexedInstanced(mMeshRenderBuffers[lod][meshI]->IndicesCount, mInstanceCountToRender[lod], 0, 0, 0);
+						const UINT instanceCount = cascadeInstances ? cascadeInstances->InstanceCount : mInstanceCountToRender[lod];
+						if (instanceCount > 0)
+							rhi->DrawIndexedInstanced(mMeshRenderBuffers[lod][meshI]->IndicesCount, instanceCount, 0, 0, 0);
 						else
 							continue;
 					}
@@ -526,37 +557,114 @@ namespace EveryRay_Core
 		}
 	}
 
-	void ER_RenderingObject::DrawAABB(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	// Selected instanced objects also show the bounds of every instance (red - culled on CPU)
+	void ER_RenderingObject::DrawAABB(ER_DebugRenderer* aDebugRenderer)
 	{
 		if (!mIsLoaded)
 			return;
 
-		if (mIsSelected && mIsAvailableInEditorMode && mIsAABBDebugEnabled && ER_Utility::IsEditorMode)
-			mDebugGizmoAABB->Draw(aRenderTarget, aDepth, rs);
+		if (!mIsSelected || !mIsAvailableInEditorMode || !mIsAABBDebugEnabled || !ER_Utility::IsEditorMode)
+			return;
+
+		aDebugRenderer->AddAABB(mGlobalAABB, XMFLOAT4{ 0.0f, 0.0f, 1.0f, 1.0f });
+		if (mIsInstanced && mDataStoreFirst >= 0)
+		{
+			const ER_SceneDataStore& dataStore = mCore->GetLevel()->mScene->GetDataStore();
+			for (int entry = mDataStoreFirst; entry < mDataStoreFirst + mDataStoreCount; entry++)
+				aDebugRenderer->AddAABB(dataStore.GetWorldAABB(entry), dataStore.IsCulled(entry) ? XMFLOAT4{ 1.0f, 0.0f, 0.0f, 1.0f } : XMFLOAT4{ 0.0f, 1.0f, 0.0f, 1.0f });
+		}
 	}
 
 	void ER_RenderingObject::SetTransformationMatrix(const XMMATRIX& mat)
 	{
 		mTransformationMatrix = mat;
 		ER_MatrixHelper::SetFloatArray(mTransformationMatrix, mCurrentObjectTransformMatrix);
+		mIsDataStoreDirty = true;
+		UpdateTransformNode();
+	}
+
+	void ER_RenderingObject::SetTransformationMatrixFromHierarchy(const XMFLOAT4X4& aWorld)
+	{
+		mTransformationMatrix = XMLoadFloat4x4(&aWorld);
+		ER_MatrixHelper::SetFloatArray(aWorld, mCurrentObjectTransformMatrix);
+		mIsDataStoreDirty = true;
 	}
 
 	void ER_RenderingObject::SetTranslation(float x, float y, float z)
 	{
 		mTransformationMatrix *= XMMatrixTranslation(x, y, z);
 		ER_MatrixHelper::SetFloatArray(mTransformationMatrix, mCurrentObjectTransformMatrix);
+		mIsDataStoreDirty = true;
+		UpdateTransformNode();
 	}
 
 	void ER_RenderingObject::SetScale(float x, float y, float z)
 	{
 		mTransformationMatrix *= XMMatrixScaling(x, y, z);
 		ER_MatrixHelper::SetFloatArray(mTransformationMatrix, mCurrentObjectTransformMatrix);
+		mIsDataStoreDirty = true;
+		UpdateTransformNode();
 	}
 
 	void ER_RenderingObject::SetRotation(float x, float y, float z)
 	{
 		mTransformationMatrix *= XMMatrixRotationRollPitchYaw(x, y, z);
 		ER_MatrixHelper::SetFloatArray(mTransformationMatrix, mCurrentObjectTransformMatrix);
+		mIsDataStoreDirty = true;
+		UpdateTransformNode();
+	}
+
+	// Object's transform is in world space, so the hierarchy derives the local one (children follow in the next ER_Scene::UpdateDataStore())
+	void ER_RenderingObject::UpdateTransformNode()
+	{
+		if (mTransformNode < 0)
+			return;
+
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world, mTransformationMatrix);
+		mCore->GetLevel()->mScene->GetTransformHierarchy().SetWorldTransform(mTransformNode, world);
+	}
+
+	// Keeps the object's range in the scene's data store (1 entry or 1 entry per instance) in sync with its transforms.
+	// Bounds, CPU frustum culling and LODs of the entries are then calculated by the store in bulk for the whole scene.
+	void ER_RenderingObject::SyncDataStore(ER_SceneDataStore& aDataStore)
+	{
+		if (!mIsLoaded)
+			return;
+
+		if (mIsInstanced && mInstanceData[0].size() != mInstanceCount)
+			return; // instances are not added yet
+
+		const int entriesCount = mIsInstanced ? static_cast<int>(mInstanceCount) : 1;
+		if (entriesCount != mDataStoreCount)
+		{
+			if (mDataStoreFirst >= 0)
+				aDataStore.Release(mDataStoreFirst, mDataStoreCount);
+			mDataStoreFirst = (entriesCount > 0) ? aDataStore.Allocate(entriesCount, mLocalAABB) : -1;
+			mDataStoreCount = entriesCount;
+			mIsDataStoreDirty = true;
+		}
+
+		if (!mIsDataStoreDirty || mDataStoreFirst < 0)
+			return;
+
+		if (mIsInstanced)
+		{
+			for (int instanceIndex = 0; instanceIndex < mDataStoreCount; instanceIndex++)
+				aDataStore.SetWorldMatrix(mDataStoreFirst + instanceIndex, mInstanceData[0][instanceIndex].World);
+		}
+		else
+			aDataStore.SetWorldMatrix(mDataStoreFirst, mTransformationMatrix);
+
+		mIsDataStoreDirty = false;
+	}
+
+	void ER_RenderingObject::ReleaseDataStore(ER_SceneDataStore& aDataStore)
+	{
+		if (mDataStoreFirst >= 0)
+			aDataStore.Release(mDataStoreFirst, mDataStoreCount);
+		mDataStoreFirst = -1;
+		mDataStoreCount = 0;
 	}
 
 	// new instancing code
@@ -593,7 +701,7 @@ namespace EveryRay_Core
 			mMeshesInstanceBuffers[lod].push_back(new InstanceBufferData());
 			mMeshesInstanceBuffers[lod][i]->InstanceBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - Instance Buffer: " + mName + ", lod: " + std::to_string(lod) + ", mesh: " + std::to_string(i));
 			CreateInstanceBuffer(&mInstanceData[lod][0], MAX_DIRECT_INSTANCE_COUNT, mMeshesInstanceBuffers[lod][i]->InstanceBuffer);
-			mMeshesInstanceBuffers[lod][i]->Stride = sizeof(InstancedData);
+			mMeshesInstanceBuffers[lod][i]->Stride = InstanceSize();
 		}
 	}
 	// new instancing code
@@ -606,7 +714,19 @@ namespace EveryRay_Core
 			throw ER_CoreException("Instances count limit is exceeded!");
 
 		assert(instanceBuffer);
-		instanceBuffer->CreateGPUBufferResource(mCore->GetRHI(), instanceData, MAX_DIRECT_INSTANCE_COUNT, InstanceSize(), true, ER_BIND_VERTEX_BUFFER);
+		instanceBuffer->CreateGPUBufferResource(mCore->GetRHI(), GetInstanceBufferData(instanceData, MAX_DIRECT_INSTANCE_COUNT), MAX_DIRECT_INSTANCE_COUNT, InstanceSize(), true, ER_BIND_VERTEX_BUFFER);
+	}
+
+	// Returns instance data in the layout of the instance buffers (encoded into a temp buffer when compact instance data is used)
+	void* ER_RenderingObject::GetInstanceBufferData(InstancedData* instanceData, UINT instanceCount)
+	{
+		if (!mIsCompactInstanceData)
+			return instanceData;
+
+		mTempCompactInstanceData.resize(instanceCount);
+		for (UINT i = 0; i < instanceCount; i++)
+			ER_CompactInstanceData::Encode(instanceData[i].World, mTempCompactInstanceData[i]);
+		return mTempCompactInstanceData.data();
 	}
 
 	// new instancing code
@@ -622,96 +742,166 @@ namespace EveryRay_Core
 
 		assert(lod < mMeshesInstanceBuffers.size());
 
+		const UINT instanceCount = static_cast<UINT>(instanceData.size());
+		UploadInstanceBuffer(instanceCount == 0 ? nullptr : GetInstanceBufferData(&instanceData[0], instanceCount), instanceCount, lod);
+	}
+
+	// bufferData is already in the layout of the instance buffers (see GetInstanceBufferData())
+	void ER_RenderingObject::UploadInstanceBuffer(void* bufferData, UINT instanceCount, int lod)
+	{
+		assert(lod < mMeshesInstanceBuffers.size());
+		assert(instanceCount <= MAX_DIRECT_INSTANCE_COUNT);
+
+		mInstanceCountToRender[lod] = instanceCount;
 		for (size_t i = 0; i < mMeshesCount[lod]; i++)
 		{
-			//CreateInstanceBuffer(instanceData);
-			mInstanceCountToRender[lod] = static_cast<UINT>(instanceData.size());
-
 			// dynamically update instance buffer
-			mCore->GetRHI()->UpdateBuffer(mMeshesInstanceBuffers[lod][i]->InstanceBuffer, mInstanceCountToRender[lod] == 0 ? nullptr : &instanceData[0], InstanceSize() * mInstanceCountToRender[lod]);
+			mCore->GetRHI()->UpdateBuffer(mMeshesInstanceBuffers[lod][i]->InstanceBuffer, bufferData, InstanceSize() * instanceCount);
 		}
 	}
 
-	UINT ER_RenderingObject::InstanceSize() const
+	// Groups visible instances by LOD (culling and LODs are already calculated in the scene's data store) and gathers their transforms
+	// (encoded if needed) into arrays which are uploaded as they are in UpdateBinnedInstanceBuffers(). Called from worker threads (ER_Scene::BinInstances()).
+	void ER_RenderingObject::BinInstances(const ER_SceneDataStore& aDataStore)
 	{
-		return sizeof(InstancedData);
-	}
+		static_assert(ER_SCENE_DATA_STORE_LOD_COUNT <= MAX_LOD, "mBinnedInstanceOffsets is too small");
 
-	// This method culls the object (or its instances) on CPU 
-	// Note: for instanced objects consider using indirect rendering instead (culling will happen on GPU and not in this method)
-	void ER_RenderingObject::PerformCPUFrustumCull(ER_Camera* camera)
-	{
-		if (!mIsLoaded)
-			return;
+		mBinnedLODCount = 0;
+		if (!IsInstanceBinningNeeded() || mDataStoreCount != static_cast<int>(mInstanceCount) || mInstanceData[0].size() != mInstanceCount)
+			return; // not synced with the data store yet
 
-		assert(!mIsIndirectlyRendered);
+		if (mBinnedInstanceIndices.size() != mInstanceCount)
+		{
+			mBinnedInstanceIndices.resize(mInstanceCount);
+			if (mIsCompactInstanceData)
+				mBinnedCompactInstanceData.resize(mInstanceCount);
+			else
+				mBinnedInstanceData.resize(mInstanceCount);
+		}
 
-		auto frustum = camera->GetFrustum();
-		auto cullFunction = [&frustum](ER_AABB& aabb) {
-			bool culled = false;
-			// start a loop through all frustum planes
-			for (int planeID = 0; planeID < 6; ++planeID)
-			{
-				XMVECTOR planeNormal = XMVectorSet(frustum.Planes()[planeID].x, frustum.Planes()[planeID].y, frustum.Planes()[planeID].z, 0.0f);
-				float planeConstant = frustum.Planes()[planeID].w;
+		const int lodCount = std::min(GetLODCount(), ER_SCENE_DATA_STORE_LOD_COUNT);
+		aDataStore.BinByLOD(mDataStoreFirst, mDataStoreCount, lodCount, mBinnedInstanceOffsets, mBinnedInstanceIndices.data());
 
-				XMFLOAT3 axisVert;
+		const UINT visibleCount = mBinnedInstanceOffsets[lodCount];
+		const InstancedData* instanceData = mInstanceData[0].data();
+		if (mIsCompactInstanceData)
+		{
+			for (UINT i = 0; i < visibleCount; i++)
+				ER_CompactInstanceData::Encode(instanceData[mBinnedInstanceIndices[i]].World, mBinnedCompactInstanceData[i]);
+		}
+		else
+		{
+			for (UINT i = 0; i < visibleCount; i++)
+				mBinnedInstanceData[i] = instanceData[mBinnedInstanceIndices[i]];
+		}
 
-				// x-axis
-				if (frustum.Planes()[planeID].x > 0.0f)
-					axisVert.x = aabb.first.x;
-				else
-					axisVert.x = aabb.second.x;
+		mBinnedLODCount = lodCount;
+	}
 
-				// y-axis
-				if (frustum.Planes()[planeID].y > 0.0f)
-					axisVert.y = aabb.first.y;
-				else
-					axisVert.y = aabb.second.y;
+	bool ER_RenderingObject::UpdateVoxelizationInstances(int cascade, const std::vector<UINT64>& aOverlapBits)
+	{
+		return UpdateCascadeInstances(mVoxelizationInstanceBuffers, cascade, aOverlapBits, "Voxelization Instance Buffer");
+	}
 
-				// z-axis
-				if (frustum.Planes()[planeID].z > 0.0f)
-					axisVert.z = aabb.first.z;
-				else
-					axisVert.z = aabb.second.z;
+	bool ER_RenderingObject::UpdateShadowCascadeInstances(int cascade, const std::vector<UINT64>& aOverlapBits)
+	{
+		return UpdateCascadeInstances(mShadowCascadeInstanceBuffers, cascade, aOverlapBits, "Shadow Cascade Instance Buffer");
+	}
 
+	// Also works for the whole object (non-instanced or indirectly rendered: their instances are culled on GPU)
+	bool ER_RenderingObject::UpdateCascadeInstances(std::vector<CascadeInstanceBufferData*>& aBuffers, int aCascade, const std::vector<UINT64>& aOverlapBits,
+		const std::string& aBufferName)
+	{
+		if (!mIsLoaded || mDataStoreFirst < 0)
+			return false;
 
-				if (XMVectorGetX(XMVector3Dot(planeNormal, XMLoadFloat3(&axisVert))) + planeConstant > 0.0f)
-				{
-					culled = true;
-					// Skip remaining planes to check and move on 
-					break;
-				}
+		const int lastEntry = mDataStoreFirst + mDataStoreCount;
+		if (!mIsInstanced || mIsIndirectlyRendered)
+		{
+			for (int entry = mDataStoreFirst; entry < lastEntry; entry++)
+			{
+				if (ER_SceneDataStore::IsOverlapBitSet(aOverlapBits, entry))
+					return true;
 			}
-			return culled;
-		};
+			return false;
+		}
 
-		assert(mInstanceCullingFlags.size() == mInstanceCount);
+		if (mDataStoreCount != static_cast<int>(mInstanceCount) || mInstanceData[0].size() != mInstanceCount)
+			return false; // not synced with the data store yet
 
-		if (mIsInstanced)
-		{
-			XMMATRIX instanceWorldMatrix = XMMatrixIdentity();
-			const int currentLOD = 0; // no need to iterate through LODs (AABBs are shared between LODs, so culling results will be identical)
+		if (aCascade >= static_cast<int>(aBuffers.size()))
+			aBuffers.resize(aCascade + 1, nullptr);
+		if (!aBuffers[aCascade])
+			aBuffers[aCascade] = new CascadeInstanceBufferData();
+		CascadeInstanceBufferData* instances = aBuffers[aCascade];
 
-			mTempPostCullingInstanceData.clear();
+		// gather overlapping instances (empty 64-entry words are skipped)
+		if (mTempCascadeInstanceData.size() != mInstanceCount)
+			mTempCascadeInstanceData.resize(mInstanceCount);
+		UINT count = 0;
+		for (int entry = mDataStoreFirst; entry < lastEntry;)
+		{
+			const UINT64 bits = aOverlapBits[entry >> 6] >> (entry & 63);
+			if (bits == 0)
 			{
-				std::vector<InstancedData> newInstanceData;
-				for (int instanceIndex = 0; instanceIndex < static_cast<int>(mInstanceCount); instanceIndex++)
-				{
-					instanceWorldMatrix = XMLoadFloat4x4(&(mInstanceData[currentLOD][instanceIndex].World));
-					mInstanceCullingFlags[instanceIndex] = cullFunction(mInstanceAABBs[instanceIndex]);
-					if (!mInstanceCullingFlags[instanceIndex])
-						newInstanceData.push_back(instanceWorldMatrix);
-				}
-				mTempPostCullingInstanceData = newInstanceData; //we store a copy for future usages
-
-				// if we have lods, we will update instance buffers later in UpdateLODs()
-				if (GetLODCount() <= 1)
-					UpdateInstanceBuffer(mTempPostCullingInstanceData, 0);
+				entry = (entry | 63) + 1;
+				continue;
 			}
+			if (bits & 1)
+				mTempCascadeInstanceData[count++] = mInstanceData[0][entry - mDataStoreFirst];
+			entry++;
 		}
-		else
-			mIsCulled = cullFunction(mGlobalAABB);
+
+		instances->InstanceCount = count;
+		if (count == 0)
+			return false;
+
+		ER_RHI* rhi = mCore->GetRHI();
+		if (instances->Capacity < mInstanceCount)
+		{
+			DeleteObject(instances->InstanceBuffer);
+			instances->InstanceBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - " + aBufferName + ": " + mName + ", cascade: " + std::to_string(aCascade));
+			instances->InstanceBuffer->CreateGPUBufferResource(rhi, GetInstanceBufferData(&mInstanceData[0][0], mInstanceCount), mInstanceCount, InstanceSize(), true, ER_BIND_VERTEX_BUFFER);
+			instances->Capacity = mInstanceCount;
+		}
+		rhi->UpdateBuffer(instances->InstanceBuffer, GetInstanceBufferData(mTempCascadeInstanceData.data(), count), InstanceSize() * count);
+		return true;
+	}
+
+	void ER_RenderingObject::UpdateBinnedInstanceBuffers()
+	{
+		assert(mBinnedLODCount > 0);
+
+		for (int lod = 0; lod < GetLODCount(); lod++)
+		{
+			const UINT first = (lod < mBinnedLODCount) ? mBinnedInstanceOffsets[lod] : 0;
+			const UINT count = (lod < mBinnedLODCount) ? mBinnedInstanceOffsets[lod + 1] - first : 0;
+			void* bufferData = nullptr;
+			if (count > 0)
+				bufferData = mIsCompactInstanceData ? static_cast<void*>(&mBinnedCompactInstanceData[first]) : static_cast<void*>(&mBinnedInstanceData[first]);
+			UploadInstanceBuffer(bufferData, count, lod);
+		}
+		mBinnedLODCount = 0;
+	}
+
+	UINT ER_RenderingObject::InstanceSize() const
+	{
+		return mIsCompactInstanceData ? sizeof(InstancedDataCompact) : sizeof(InstancedData);
+	}
+
+	// This method culls the object on CPU 
+	// Note: instances of instanced objects are culled in BinInstances() (or on GPU with indirect rendering)
+	void ER_RenderingObject::PerformCPUFrustumCull(ER_Camera* camera)
+	{
+		if (!mIsLoaded)
+			return;
+
+		assert(!mIsIndirectlyRendered && !mIsInstanced);
+
+		// culling itself was already done for the whole scene in ER_SceneDataStore::CullFrustum()
+		if (mDataStoreFirst < 0)
+			return;
+		mIsCulled = mCore->GetLevel()->mScene->GetDataStore().IsCulled(mDataStoreFirst);
 	}
 
 	void ER_RenderingObject::StoreInstanceDataAfterTerrainPlacement()
@@ -720,23 +910,49 @@ namespace EveryRay_Core
 			return;
 
 		assert(mTempInstancesPositions);
+		// seeded by the object's name (stream 1, positions use stream 0), so that the placement is the same on every machine
+		ER_Random random(ER_Utility::HashBytes(mName.data(), mName.size()), 1);
 		XMMATRIX worldMatrix = XMMatrixIdentity();
-		for (int lod = 0; lod < GetLODCount(); lod++)
+		for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
 		{
-			for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
-			{
-				float scale = ER_Utility::RandomFloat(mTerrainProceduralObjectMinScale, mTerrainProceduralObjectMaxScale);
-				float roll = ER_Utility::RandomFloat(mTerrainProceduralObjectMinRoll, mTerrainProceduralObjectMaxRoll);
-				float pitch = ER_Utility::RandomFloat(mTerrainProceduralObjectMinPitch, mTerrainProceduralObjectMaxPitch);
-				float yaw = ER_Utility::RandomFloat(mTerrainProceduralObjectMinYaw, mTerrainProceduralObjectMaxYaw);
+			float scale = random.NextFloat(mTerrainProceduralObjectMinScale, mTerrainProceduralObjectMaxScale);
+			float roll = random.NextFloat(mTerrainProceduralObjectMinRoll, mTerrainProceduralObjectMaxRoll);
+			float pitch = random.NextFloat(mTerrainProceduralObjectMinPitch, mTerrainProceduralObjectMaxPitch);
+			float yaw = random.NextFloat(mTerrainProceduralObjectMinYaw, mTerrainProceduralObjectMaxYaw);
 
-				worldMatrix = XMMatrixScaling(scale, scale, scale) * XMMatrixRotationRollPitchYaw(pitch, yaw, roll);
-				ER_MatrixHelper::SetTranslation(worldMatrix, XMFLOAT3(mTempInstancesPositions[instanceI].x, mTempInstancesPositions[instanceI].y, mTempInstancesPositions[instanceI].z));
+			worldMatrix = XMMatrixScaling(scale, scale, scale) * XMMatrixRotationRollPitchYaw(pitch, yaw, roll);
+			ER_MatrixHelper::SetTranslation(worldMatrix, XMFLOAT3(mTempInstancesPositions[instanceI].x, mTempInstancesPositions[instanceI].y, mTempInstancesPositions[instanceI].z));
+
+			// same transform for all LODs of the instance
+			for (int lod = 0; lod < GetLODCount(); lod++)
 				XMStoreFloat4x4(&(mInstanceData[lod][instanceI].World), worldMatrix);
-				worldMatrix = XMMatrixIdentity();
-			}
-			UpdateInstanceBuffer(mInstanceData[lod], lod);
 		}
+		mIsDataStoreDirty = true;
+
+		for (int lod = 0; lod < GetLODCount(); lod++)
+			UpdateInstanceBuffer(mInstanceData[lod], lod);
+	}
+
+	// Hash of everything that affects procedural on-terrain placement of this object (used as a key for the placement cache)
+	UINT64 ER_RenderingObject::CalculateTerrainPlacementHash(ER_Terrain* aTerrain)
+	{
+		assert(aTerrain);
+
+		const float placementParams[] = {
+			mTerrainProceduralZoneCenterPos.x, mTerrainProceduralZoneCenterPos.y, mTerrainProceduralZoneCenterPos.z, mTerrainProceduralZoneRadius,
+			mTerrainProceduralObjectMinScale, mTerrainProceduralObjectMaxScale,
+			mTerrainProceduralObjectMinRoll, mTerrainProceduralObjectMaxRoll,
+			mTerrainProceduralObjectMinPitch, mTerrainProceduralObjectMaxPitch,
+			mTerrainProceduralObjectMinYaw, mTerrainProceduralObjectMaxYaw,
+			mTerrainProceduralPlacementHeightDelta, aTerrain->GetPlacementHeightDelta(), aTerrain->GetHeightScale()
+		};
+		const UINT64 terrainHash = aTerrain->GetTerrainDataHash();
+
+		UINT64 hash = ER_Utility::HashBytes(&terrainHash, sizeof(terrainHash));
+		hash = ER_Utility::HashBytes(placementParams, sizeof(placementParams), hash);
+		hash = ER_Utility::HashBytes(&mTerrainProceduralPlacementSplatChannel, sizeof(mTerrainProceduralPlacementSplatChannel), hash);
+		hash = ER_Utility::HashBytes(&mInstanceCount, sizeof(mInstanceCount), hash);
+		return hash;
 	}
 
 	XMFLOAT4 ER_RenderingObject::GetFurGravityStrength()
@@ -746,18 +962,19 @@ namespace EveryRay_Core
 	}
 
 	// Placement on terrain based on object's properties defined in level file (instance count, terrain splat, object scale variation, etc.)
-	// This method is not supposed to run every frame, but during initialization or on request
+	// This method is not supposed to run every frame, but during initialization or on request.
+	// Placement is done on CPU (no GPU readback). Final instance transforms are cached on disk and reused, until the terrain or placement properties change.
 	void ER_RenderingObject::PlaceProcedurallyOnTerrain(bool isOnInit)
 	{
 		if (!mIsLoaded)
 			return;
 
-		auto rhi = mCore->GetRHI();
-
 		ER_Terrain* terrain = mCore->GetLevel()->mTerrain;
 		if (!terrain || !terrain->IsLoaded() || !mIsTerrainPlacement)
 			return;
 
+		const float heightDelta = abs(mTerrainProceduralPlacementHeightDelta) < std::numeric_limits<float>::epsilon() ? FLT_MAX : mTerrainProceduralPlacementHeightDelta;
+
 		if (!mIsInstanced)
 		{
 			XMFLOAT4 currentPos;
@@ -765,32 +982,9 @@ namespace EveryRay_Core
 
 			if (isOnInit)
 			{
-				DeleteObject(mInputPositionsOnTerrainBuffer);
-				DeleteObject(mOutputPositionsOnTerrainBuffer);
-
-				mInputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject on-terrain placement input positions buffer: " + mName);
-				mInputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, &currentPos, 1, sizeof(XMFLOAT4), false, ER_BIND_UNORDERED_ACCESS, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-				mOutputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject on-terrain placement output positions buffer: " + mName);
-				mOutputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, &currentPos, 1, sizeof(XMFLOAT4), false, ER_BIND_NONE, 0x10000L | 0x20000L /*legacy from DX11*/, ER_RESOURCE_MISC_BUFFER_STRUCTURED); //should be STAGING
-
-				terrain->PlaceOnTerrain(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, &currentPos, 1, (TerrainSplatChannels)mTerrainProceduralPlacementSplatChannel,
-					nullptr, 0, abs(mTerrainProceduralPlacementHeightDelta) < std::numeric_limits<float>::epsilon() ? FLT_MAX : mTerrainProceduralPlacementHeightDelta);
-			
-#ifndef ER_PLATFORM_WIN64_DX11
-				std::string eventName = "On-terrain placement callback - initialization of ER_RenderingObject: " + mName;
-				terrain->ReadbackPlacedPositionsOnInitEvent->AddListener(eventName, [&](ER_Terrain* aTerrain)
-					{
-						assert(aTerrain);
-						XMFLOAT4 currentPos;
-						aTerrain->ReadbackPlacedPositions(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, &currentPos, 1);
-						ER_MatrixHelper::SetTranslation(mTransformationMatrix, XMFLOAT3(currentPos.x, currentPos.y, currentPos.z));
-						SetTransformationMatrix(mTransformationMatrix);
-					}
-				);
-#else
+				terrain->PlaceOnTerrainCPU(&currentPos, 1, (TerrainSplatChannels)mTerrainProceduralPlacementSplatChannel, heightDelta);
 				ER_MatrixHelper::SetTranslation(mTransformationMatrix, XMFLOAT3(currentPos.x, currentPos.y, currentPos.z));
 				SetTransformationMatrix(mTransformationMatrix);
-#endif
 			}
 			else
 			{
@@ -801,39 +995,46 @@ namespace EveryRay_Core
 		{
 			if (isOnInit)
 			{
-				DeleteObjects(mTempInstancesPositions);
-				mTempInstancesPositions = new XMFLOAT4[mInstanceCount];
+				const UINT64 placementHash = CalculateTerrainPlacementHash(terrain);
+				std::vector<XMFLOAT4X4> placedTransforms(mInstanceCount);
 
-				for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
+				if (mInstanceCount > 0 && terrain->ReadPlacementCache(mName, placementHash, placedTransforms.data(), sizeof(XMFLOAT4X4), mInstanceCount))
 				{
-					mTempInstancesPositions[instanceI] = XMFLOAT4(
-						mTerrainProceduralZoneCenterPos.x + ER_Utility::RandomFloat(-mTerrainProceduralZoneRadius, mTerrainProceduralZoneRadius),
-						mTerrainProceduralZoneCenterPos.y,
-						mTerrainProceduralZoneCenterPos.z + ER_Utility::RandomFloat(-mTerrainProceduralZoneRadius, mTerrainProceduralZoneRadius), 1.0f);
+					for (int lod = 0; lod < GetLODCount(); lod++)
+					{
+						for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
+							mInstanceData[lod][instanceI].World = placedTransforms[instanceI];
+						UpdateInstanceBuffer(mInstanceData[lod], lod);
+					}
+					mIsDataStoreDirty = true;
 				}
+				else
+				{
+					DeleteObjects(mTempInstancesPositions);
+					mTempInstancesPositions = new XMFLOAT4[mInstanceCount];
 
-				DeleteObject(mInputPositionsOnTerrainBuffer);
-				DeleteObject(mOutputPositionsOnTerrainBuffer);
+					std::vector<float> offsets(mInstanceCount * 2);
+					ER_Random random(ER_Utility::HashBytes(mName.data(), mName.size()), 0);
+					random.FillFloat(offsets.data(), offsets.size(), -mTerrainProceduralZoneRadius, mTerrainProceduralZoneRadius);
+					for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
+					{
+						mTempInstancesPositions[instanceI] = XMFLOAT4(
+							mTerrainProceduralZoneCenterPos.x + offsets[instanceI * 2 + 0],
+							mTerrainProceduralZoneCenterPos.y,
+							mTerrainProceduralZoneCenterPos.z + offsets[instanceI * 2 + 1], 1.0f);
+					}
 
-				mInputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject on-terrain placement input positions buffer: " + mName);
-				mInputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mTempInstancesPositions, mInstanceCount, sizeof(XMFLOAT4), false, ER_BIND_UNORDERED_ACCESS, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-				mOutputPositionsOnTerrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject on-terrain placement input positions buffer: " + mName);
-				mOutputPositionsOnTerrainBuffer->CreateGPUBufferResource(rhi, mTempInstancesPositions, mInstanceCount, sizeof(XMFLOAT4), false, ER_BIND_NONE, 0x10000L | 0x20000L /*legacy from DX11*/, ER_RESOURCE_MISC_BUFFER_STRUCTURED); //should be STAGING
-				terrain->PlaceOnTerrain(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mTempInstancesPositions, mInstanceCount, (TerrainSplatChannels)mTerrainProceduralPlacementSplatChannel,
-					nullptr, 0, abs(mTerrainProceduralPlacementHeightDelta) < std::numeric_limits<float>::epsilon() ? FLT_MAX : mTerrainProceduralPlacementHeightDelta);
-				
-#ifndef ER_PLATFORM_WIN64_DX11
-				std::string eventName = "On-terrain placement callback - initialization of ER_RenderingObject: " + mName;
-				terrain->ReadbackPlacedPositionsOnInitEvent->AddListener(eventName, [&](ER_Terrain* aTerrain)
+					terrain->PlaceOnTerrainCPU(mTempInstancesPositions, mInstanceCount, (TerrainSplatChannels)mTerrainProceduralPlacementSplatChannel, heightDelta);
+					StoreInstanceDataAfterTerrainPlacement();
+					DeleteObjects(mTempInstancesPositions);
+
+					if (mInstanceCount > 0)
 					{
-						assert(aTerrain);
-						aTerrain->ReadbackPlacedPositions(mOutputPositionsOnTerrainBuffer, mInputPositionsOnTerrainBuffer, mTempInstancesPositions, mInstanceCount);
-						StoreInstanceDataAfterTerrainPlacement();
+						for (int instanceI = 0; instanceI < static_cast<int>(mInstanceCount); instanceI++)
+							placedTransforms[instanceI] = mInstanceData[0][instanceI].World;
+						terrain->WritePlacementCache(mName, placementHash, placedTransforms.data(), sizeof(XMFLOAT4X4), mInstanceCount);
 					}
-				);
-#else
-				StoreInstanceDataAfterTerrainPlacement();
-#endif
+				}
 			}
 			else
 			{
@@ -864,41 +1065,31 @@ namespace EveryRay_Core
 		//if (mIsTerrainPlacement && !mIsTerrainPlacementFinished)
 		//	PlaceProcedurallyOnTerrain();
 
-		//update AABBs (global and instanced)
+		//update global AABB (AABBs of the object or its instances are calculated in the scene's data store)
+		if (!mIsInstanced && mDataStoreFirst >= 0)
+			mGlobalAABB = mCore->GetLevel()->mScene->GetDataStore().GetWorldAABB(mDataStoreFirst);
+		else
 		{
 			mGlobalAABB = mLocalAABB;
 			UpdateAABB(mGlobalAABB, mTransformationMatrix);
-
-			if (mIsInstanced && (!mIsIndirectlyRendered || (mIsIndirectlyRendered && !mIndirectOriginalInstanceDataBuffer)))
-			{
-				XMMATRIX instanceWorldMatrix = XMMatrixIdentity();
-				for (int instanceIndex = 0; instanceIndex < static_cast<int>(mInstanceCount); instanceIndex++)
-				{
-					instanceWorldMatrix = XMLoadFloat4x4(&(mInstanceData[0][instanceIndex].World));
-					mInstanceAABBs[instanceIndex] = mLocalAABB;
-					UpdateAABB(mInstanceAABBs[instanceIndex], instanceWorldMatrix);
-				}
-			}
 		}
 
 		if (mIsIndirectlyRendered)
 			CreateIndirectInstanceData(); // only happens once but we need to do it after the first update (i.e. after we placed the instances and calculated their AABBs)
-		else // fallback for old CPU frustum culling (i.e., makes sense for non-instanced objects)
+		else if (mIsInstanced)
 		{
-			if (ER_Utility::IsMainCameraCPUFrustumCulling && camera)
-				PerformCPUFrustumCull(camera);
+			// instances culled on CPU (if enabled) and grouped by LOD in ER_Scene::BinInstances() (i.e., for objects which do not use indirect rendering)
+			if (mBinnedLODCount > 0)
+				UpdateBinnedInstanceBuffers();
 			else
 			{
-				// you can still use CPU culling of instances with buffer updates (for objects which do not use indirect rendering)
-				// however, this is left here mainly for legacy reason and potential debugging of indirect culling/rendering bugs
-				if (mIsInstanced)
-				{
-					//just updating transforms (that could be changed in a previous frame); this is not optimal (GPU buffer map() every frame...)
-					for (int lod = 0; lod < GetLODCount(); lod++)
-						UpdateInstanceBuffer(mInstanceData[lod], lod);
-				}
+				//not binned this frame (not synced with the scene's data store yet): just updating all transforms
+				for (int lod = 0; lod < GetLODCount(); lod++)
+					UpdateInstanceBuffer(mInstanceData[lod], lod);
 			}
 		}
+		else if (ER_Utility::IsMainCameraCPUFrustumCulling && camera) // fallback for old CPU frustum culling (i.e., makes sense for non-instanced objects)
+			PerformCPUFrustumCull(camera);
 
 		if (GetLODCount() > 1)
 			UpdateLODs();
@@ -907,28 +1098,27 @@ namespace EveryRay_Core
 		{
 			UpdateGizmos();
 			ShowInstancesListWindow();
-			if (mIsAABBDebugEnabled)
-				mDebugGizmoAABB->Update(mGlobalAABB);
 		}
 	}
 
 	void ER_RenderingObject::UpdateAABB(ER_AABB& aabb, const XMMATRIX& transformMatrix)
 	{
 		// computing AABB from the non-axis aligned BB
-		mCurrentGlobalAABBVertices[0] = (XMFLOAT3(aabb.first.x, aabb.second.y, aabb.first.z));
-		mCurrentGlobalAABBVertices[1] = (XMFLOAT3(aabb.second.x, aabb.second.y, aabb.first.z));
-		mCurrentGlobalAABBVertices[2] = (XMFLOAT3(aabb.second.x, aabb.first.y, aabb.first.z));
-		mCurrentGlobalAABBVertices[3] = (XMFLOAT3(aabb.first.x, aabb.first.y, aabb.first.z));
-		mCurrentGlobalAABBVertices[4] = (XMFLOAT3(aabb.first.x, aabb.second.y, aabb.second.z));
-		mCurrentGlobalAABBVertices[5] = (XMFLOAT3(aabb.second.x, aabb.second.y, aabb.second.z));
-		mCurrentGlobalAABBVertices[6] = (XMFLOAT3(aabb.second.x, aabb.first.y, aabb.second.z));
-		mCurrentGlobalAABBVertices[7] = (XMFLOAT3(aabb.first.x, aabb.first.y, aabb.second.z));
+		XMFLOAT3 globalAABBVertices[8];
+		globalAABBVertices[0] = (XMFLOAT3(aabb.first.x, aabb.second.y, aabb.first.z));
+		globalAABBVertices[1] = (XMFLOAT3(aabb.second.x, aabb.second.y, aabb.first.z));
+		globalAABBVertices[2] = (XMFLOAT3(aabb.second.x, aabb.first.y, aabb.first.z));
+		globalAABBVertices[3] = (XMFLOAT3(aabb.first.x, aabb.first.y, aabb.first.z));
+		globalAABBVertices[4] = (XMFLOAT3(aabb.first.x, aabb.second.y, aabb.second.z));
+		globalAABBVertices[5] = (XMFLOAT3(aabb.second.x, aabb.second.y, aabb.second.z));
+		globalAABBVertices[6] = (XMFLOAT3(aabb.second.x, aabb.first.y, aabb.second.z));
+		globalAABBVertices[7] = (XMFLOAT3(aabb.first.x, aabb.first.y, aabb.second.z));
 
 		// non-axis-aligned BB (applying transform)
 		for (size_t i = 0; i < 8; i++)
 		{
-			XMVECTOR point = XMVector3Transform(XMLoadFloat3(&(mCurrentGlobalAABBVertices[i])), transformMatrix);
-			XMStoreFloat3(&(mCurrentGlobalAABBVertices[i]), point);
+			XMVECTOR point = XMVector3Transform(XMLoadFloat3(&(globalAABBVertices[i])), transformMatrix);
+			XMStoreFloat3(&(globalAABBVertices[i]), point);
 		}
 
 		XMFLOAT3 minVertex = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
@@ -937,14 +1127,14 @@ namespace EveryRay_Core
 		for (UINT i = 0; i < 8; i++)
 		{
 			//Get the smallest vertex 
-			minVertex.x = std::min(minVertex.x, mCurrentGlobalAABBVertices[i].x);    // Find smallest x value in model
-			minVertex.y = std::min(minVertex.y, mCurrentGlobalAABBVertices[i].y);    // Find smallest y value in model
-			minVertex.z = std::min(minVertex.z, mCurrentGlobalAABBVertices[i].z);    // Find smallest z value in model
+			minVertex.x = std::min(minVertex.x, globalAABBVertices[i].x);    // Find smallest x value in model
+			minVertex.y = std::min(minVertex.y, globalAABBVertices[i].y);    // Find smallest y value in model
+			minVertex.z = std::min(minVertex.z, globalAABBVertices[i].z);    // Find smallest z value in model
 
 			//Get the largest vertex 
-			maxVertex.x = std::max(maxVertex.x, mCurrentGlobalAABBVertices[i].x);    // Find largest x value in model
-			maxVertex.y = std::max(maxVertex.y, mCurrentGlobalAABBVertices[i].y);    // Find largest y value in model
-			maxVertex.z = std::max(maxVertex.z, mCurrentGlobalAABBVertices[i].z);    // Find largest z value in model
+			maxVertex.x = std::max(maxVertex.x, globalAABBVertices[i].x);    // Find largest x value in model
+			maxVertex.y = std::max(maxVertex.y, globalAABBVertices[i].y);    // Find largest y value in model
+			maxVertex.z = std::max(maxVertex.z, globalAABBVertices[i].z);    // Find largest z value in model
 		}
 
 		aabb = ER_AABB(minVertex, maxVertex);
@@ -955,13 +1145,19 @@ namespace EveryRay_Core
 		if (!(mIsAvailableInEditorMode && mIsSelected))
 			return;
 
-		ER_MatrixHelper::SetFloatArray(mCamera.ViewMatrix4X4(), mCameraViewMatrix);
-		ER_MatrixHelper::SetFloatArray(mCamera.ProjectionMatrix4X4(), mCameraProjectionMatrix);
+		float cameraViewMatrix[16];
+		float cameraProjectionMatrix[16];
+		ER_MatrixHelper::SetFloatArray(mCamera.ViewMatrix4X4(), cameraViewMatrix);
+		ER_MatrixHelper::SetFloatArray(mCamera.ProjectionMatrix4X4(), cameraProjectionMatrix);
 
-		ShowObjectsEditorWindow(mCameraViewMatrix, mCameraProjectionMatrix, mCurrentObjectTransformMatrix);
+		ShowObjectsEditorWindow(cameraViewMatrix, cameraProjectionMatrix, mCurrentObjectTransformMatrix);
 
 		XMFLOAT4X4 mat(mCurrentObjectTransformMatrix);
+		XMFLOAT4X4 previousMat;
+		XMStoreFloat4x4(&previousMat, mTransformationMatrix);
 		mTransformationMatrix = XMLoadFloat4x4(&mat);
+		if (memcmp(&mat, &previousMat, sizeof(XMFLOAT4X4)) != 0)
+			UpdateTransformNode();
 
 		//update instance world transform (from editor's gizmo/UI)
 		if (mIsInstanced && ER_Utility::IsEditorMode)
@@ -969,6 +1165,15 @@ namespace EveryRay_Core
 			for (int lod = 0; lod < GetLODCount(); lod++)
 				mInstanceData[lod][mEditorSelectedInstancedObjectIndex].World = XMFLOAT4X4(mCurrentObjectTransformMatrix);
 		}
+
+		// only the edited entry is written (not the whole object's range)
+		if (mDataStoreFirst >= 0)
+		{
+			if (mIsInstanced && mEditorSelectedInstancedObjectIndex < mDataStoreCount)
+				mCore->GetLevel()->mScene->GetDataStore().SetWorldMatrix(mDataStoreFirst + mEditorSelectedInstancedObjectIndex, mat);
+			else if (!mIsInstanced)
+				mCore->GetLevel()->mScene->GetDataStore().SetWorldMatrix(mDataStoreFirst, mat);
+		}
 	}
 	
 	void ER_RenderingObject::UpdateBitmaskFlags()
@@ -1078,8 +1283,8 @@ namespace EveryRay_Core
 			{
 				if (mIsInstanced)
 				{
-					name = mInstancesNames[mEditorSelectedInstancedObjectIndex];
-					if (mInstanceCullingFlags[mEditorSelectedInstancedObjectIndex]) //showing info for main LOD only in editor
+					name = GetInstanceName(mEditorSelectedInstancedObjectIndex);
+					if (mDataStoreFirst >= 0 && mCore->GetLevel()->mScene->GetDataStore().IsCulled(mDataStoreFirst + mEditorSelectedInstancedObjectIndex)) //showing info for main LOD only in editor
 						name += " (Culled)";
 				}
 				else
@@ -1097,13 +1302,17 @@ namespace EveryRay_Core
 			ImGui::Text(lodCountText.c_str());
 			for (int lodI = 0; lodI < GetLODCount(); lodI++)
 			{
-				std::string vertexCountText = "--> Vertex count LOD#" + std::to_string(lodI) + ": " + std::to_string(GetVertices(lodI).size());
+				std::string vertexCountText = "--> Vertex count LOD#" + std::to_string(lodI) + ": " + std::to_string(GetVertexCount(lodI));
 				ImGui::Text(vertexCountText.c_str());
 			}
 
 			std::string meshCountText = "* Mesh count: " + std::to_string(GetMeshCount());
 			ImGui::Text(meshCountText.c_str());
 
+			const RenderingObjectMemoryReport memoryReport = GetMemoryReport();
+			ImGui::Text("* CPU memory: %.1f KB (object: %.1f, instances: %.1f, meshes: %.1f, editor: %.1f)", memoryReport.GetTotal() / 1024.0f,
+				memoryReport.Object / 1024.0f, memoryReport.InstanceData / 1024.0f, memoryReport.MeshData / 1024.0f, memoryReport.EditorData / 1024.0f);
+
 			std::string instanceCountText = "* Instance count: " + std::to_string(GetInstanceCount());
 			ImGui::Text(instanceCountText.c_str());
 
@@ -1123,9 +1332,16 @@ namespace EveryRay_Core
 			}
 
 			ImGui::Separator();
-			ImGui::Checkbox("Rendered", &mIsRendered);
-			ImGui::Checkbox("Show AABB", &mIsAABBDebugEnabled);
-			ImGui::Checkbox("Skip indirect spec.", &mIsSkippedIndirectSpecular);
+			// flags are bit-fields, so ImGui edits copies
+			bool isRendered = mIsRendered;
+			if (ImGui::Checkbox("Rendered", &isRendered))
+				mIsRendered = isRendered;
+			bool isAABBDebugEnabled = mIsAABBDebugEnabled;
+			if (ImGui::Checkbox("Show AABB", &isAABBDebugEnabled))
+				mIsAABBDebugEnabled = isAABBDebugEnabled;
+			bool isSkippedIndirectSpecular = mIsSkippedIndirectSpecular;
+			if (ImGui::Checkbox("Skip indirect spec.", &isSkippedIndirectSpecular))
+				mIsSkippedIndirectSpecular = isSkippedIndirectSpecular;
 			//ImGui::Checkbox("Skip indirect dif.", &mIsSkippedIndirectDiffuse);
 			if (ImGui::Button("Move camera to"))
 			{
@@ -1173,7 +1389,9 @@ namespace EveryRay_Core
 				ImGui::SliderFloat("Fur Gravity Strength", &mFurGravityStrength, 0.0, 10.0);
 				ImGui::SliderFloat("Fur Wind Frequency", &mFurWindFrequency, 0.0, 10.0);
 			}
-			ImGui::Checkbox("Triplanar mapping", &mIsTriplanarMapped);
+			bool isTriplanarMapped = mIsTriplanarMapped;
+			if (ImGui::Checkbox("Triplanar mapping", &isTriplanarMapped))
+				mIsTriplanarMapped = isTriplanarMapped;
 			//f (mIsTriplanarMapped)
 			//	ImGui::SliderFloat("Triplanar mapping - sharpness", &mTriplanarMappingSharpness, 0.01, 50.0f);
 
@@ -1213,6 +1431,15 @@ namespace EveryRay_Core
 	
 	// Shows an ImGui window for the list of instances.
 	// You can select an instance, read some useful info about it and edit it via "Objects Editor".
+	// Instance names are generated for the visible rows of the list only (nothing is stored per instance)
+	static bool GetInstanceNameUI(void* aObject, int aIndex, const char** aOutText)
+	{
+		static std::string instanceName;
+		instanceName = static_cast<ER_RenderingObject*>(aObject)->GetInstanceName(aIndex);
+		*aOutText = instanceName.c_str();
+		return true;
+	}
+
 	// We do not need to edit per LOD (LODs share same transforms, AABBs, names).
 	// Note: does not work for objects rendered indirectly on the GPU!
 	void ER_RenderingObject::ShowInstancesListWindow()
@@ -1222,111 +1449,36 @@ namespace EveryRay_Core
 
 		assert(mInstanceCount != 0);
 		assert(mInstanceData[0].size() != 0 && mInstanceData[0].size() == mInstanceCount);
-		assert(mInstancesNames.size() == mInstanceCount);
 
 		std::string title = mName + " instances:";
 		ImGui::Begin(title.c_str());
 
-		for (int i = 0; i < mInstanceData[0].size(); i++) {
-			mInstancedNamesUI[i] = mInstancesNames[i].c_str();
-		}
-
 		ImGui::PushItemWidth(-1);
-		ImGui::ListBox("##empty", &mEditorSelectedInstancedObjectIndex, mInstancedNamesUI, static_cast<int>(mInstanceData[0].size()), 15);
+		ImGui::ListBox("##empty", &mEditorSelectedInstancedObjectIndex, GetInstanceNameUI, this, static_cast<int>(mInstanceData[0].size()), 15);
 		ImGui::End();
 	}
 	
-	ER_RHI_GPUBuffer* ER_RenderingObject::GetIndirectMeshConstantBuffer()
+	void ER_RenderingObject::SetIndirectCullingRange(ER_RHI_GPUBuffer* aInstanceBuffer, UINT aFirstInstance, ER_RHI_GPUBuffer* aArgsBuffer, UINT aFirstDraw)
 	{
-		if (!mIsIndirectlyRendered || !mIsLoaded)
-			return nullptr;
-
-		ER_RHI* rhi = mCore->GetRHI();
-
-		if (!mIndirectMeshConstants.IsInitialized() && mIsIndirectlyRendered)
-			mIndirectMeshConstants.Initialize(rhi, "ER_RHI_GPUBuffer: GPU Indirect Mesh CB: " + mName);
-
-		memcpy(mIndirectMeshConstants.Data.IndexCount_StartIndexLoc_BaseVtxLoc_StartInstLoc, mIndirectDrawArgsArray, sizeof(XMINT4) * MAX_LOD * MAX_MESH_COUNT);
-		mIndirectMeshConstants.Data.OriginalInstancesCount = GetInstanceCount();
-		mIndirectMeshConstants.Data.pad = XMINT3(0, 0, 0);
-		mIndirectMeshConstants.ApplyChanges(rhi);
+		assert(mIsIndirectlyRendered);
 
-		return mIndirectMeshConstants.Buffer();
+		mIndirectNewInstanceDataBuffer = aInstanceBuffer;
+		mIndirectFirstInstance = aFirstInstance;
+		mIndirectArgsBuffer = aArgsBuffer;
+		mIndirectFirstDraw = aFirstDraw;
 	}
 
+	// Only for non-instanced objects (instances are grouped by LOD in BinInstances() or in ER_GPUCuller for indirect rendering)
 	void ER_RenderingObject::UpdateLODs()
 	{
-		if (!mIsLoaded)
+		if (!mIsLoaded || mIsInstanced)
 			return;
 
-		const float sqrDistLod0 = ER_Utility::DistancesLOD[0] * ER_Utility::DistancesLOD[0];
-		const float sqrDistLod1 = ER_Utility::DistancesLOD[1] * ER_Utility::DistancesLOD[1];
-		const float sqrDistLod2 = ER_Utility::DistancesLOD[2] * ER_Utility::DistancesLOD[2];
-
-		if (mIsInstanced) {
-			if (!mIsIndirectlyRendered) // LODs are also updated in ER_GPUCuller, so no need to do that here
-				return;
-			if (!ER_Utility::IsMainCameraCPUFrustumCulling && mInstanceData.size() == 0)
-				return;
-			if (ER_Utility::IsMainCameraCPUFrustumCulling && mTempPostCullingInstanceData.size() == 0)
-				return;
+		// LOD from the object's distance to the camera (calculated in ER_SceneDataStore::UpdateLODs(); -1 means culled)
+		if (mDataStoreFirst >= 0)
+			mCurrentLODIndex = mCore->GetLevel()->mScene->GetDataStore().GetLOD(mDataStoreFirst);
 
-			mTempPostLoddingInstanceData.clear();
-			for (int lod = 0; lod < GetLODCount(); lod++)
-				mTempPostLoddingInstanceData.push_back({});
-
-			//traverse through original or culled instance data (sort of "read-only") to rebalance LOD's instance buffers
-			int length = (ER_Utility::IsMainCameraCPUFrustumCulling) ? static_cast<int>(mTempPostCullingInstanceData.size()) : static_cast<int>(mInstanceData[0].size());
-			for (int i = 0; i < length; i++)
-			{
-				XMFLOAT3 pos;
-				XMMATRIX mat = (ER_Utility::IsMainCameraCPUFrustumCulling) ? XMLoadFloat4x4(&mTempPostCullingInstanceData[i].World) : XMLoadFloat4x4(&mInstanceData[0][i].World);
-				ER_MatrixHelper::GetTranslation(mat, pos);
-
-				float distanceToCameraSqr =
-					(mCamera.Position().x - pos.x) * (mCamera.Position().x - pos.x) +
-					(mCamera.Position().y - pos.y) * (mCamera.Position().y - pos.y) +
-					(mCamera.Position().z - pos.z) * (mCamera.Position().z - pos.z);
-
-				//XMMATRIX newMat;
-				if (distanceToCameraSqr <= sqrDistLod0) {
-					mTempPostLoddingInstanceData[0].push_back((ER_Utility::IsMainCameraCPUFrustumCulling) ? mTempPostCullingInstanceData[i].World : mInstanceData[0][i].World);
-				}
-				else if (sqrDistLod0 < distanceToCameraSqr && distanceToCameraSqr <= sqrDistLod1) {
-					mTempPostLoddingInstanceData[1].push_back((ER_Utility::IsMainCameraCPUFrustumCulling) ? mTempPostCullingInstanceData[i].World : mInstanceData[0][i].World);
-				}
-				else if (sqrDistLod1 < distanceToCameraSqr && distanceToCameraSqr <= sqrDistLod2) {
-					mTempPostLoddingInstanceData[2].push_back((ER_Utility::IsMainCameraCPUFrustumCulling) ? mTempPostCullingInstanceData[i].World : mInstanceData[0][i].World);
-				}
-			}
-
-			for (int i = 0; i < GetLODCount(); i++)
-				UpdateInstanceBuffer(mTempPostLoddingInstanceData[i], i);
-		}
-		else
-		{
-			XMFLOAT3 pos;
-			ER_MatrixHelper::GetTranslation(mTransformationMatrix, pos);
-
-			float distanceToCameraSqr =
-				(mCamera.Position().x - pos.x) * (mCamera.Position().x - pos.x) +
-				(mCamera.Position().y - pos.y) * (mCamera.Position().y - pos.y) +
-				(mCamera.Position().z - pos.z) * (mCamera.Position().z - pos.z);
-
-			if (distanceToCameraSqr <= sqrDistLod0) {
-				mCurrentLODIndex = 0;
-			}
-			else if (sqrDistLod0 < distanceToCameraSqr && distanceToCameraSqr <= sqrDistLod1) {
-				mCurrentLODIndex = 1;
-			}
-			else if (sqrDistLod1 < distanceToCameraSqr && distanceToCameraSqr <= sqrDistLod2) {
-				mCurrentLODIndex = 2;
-			}
-			else
-				mCurrentLODIndex = -1; //culled
-
-			mCurrentLODIndex = std::min(mCurrentLODIndex, GetLODCount());
-		}
+		mCurrentLODIndex = std::min(mCurrentLODIndex, GetLODCount());
 	}
 	void ER_RenderingObject::AddLOD(const std::string& pModelLODPath)
 	{
@@ -1339,23 +1491,52 @@ namespace EveryRay_Core
 
 		mMeshesCount.push_back(static_cast<int>(pModel->Meshes().size()));
 		mModelLODs.push_back(pModel);
-		mMeshVertices.push_back({});
-		mMeshAllVertices.push_back({}); 
 
 		int lodIndex = static_cast<int>(mMeshesCount.size()) - 1;
+		LoadRenderBuffers(lodIndex);
+	}
+
+	UINT ER_RenderingObject::GetVertexCount(int lod) const
+	{
+		if (!mIsLoaded)
+			return 0;
 
-		for (int i = 0; i < mMeshesCount[lodIndex]; i++)
-			mMeshVertices[lodIndex].push_back(mModelLODs[lodIndex - 1]->GetMesh(i).Vertices());
+		const ER_Model* model = (lod == 0) ? mModel : mModelLODs[lod - 1];
+		UINT count = 0;
+		for (int meshI = 0; meshI < mMeshesCount[lod]; meshI++)
+			count += static_cast<UINT>(model->GetMesh(meshI).Vertices().size());
+		return count;
+	}
 
-		for (size_t i = 0; i < mMeshVertices[lodIndex].size(); i++)
+	RenderingObjectMemoryReport ER_RenderingObject::GetMemoryReport() const
+	{
+		RenderingObjectMemoryReport report;
+		report.Object = sizeof(ER_RenderingObject);
+
+		for (const auto& lodInstanceData : mInstanceData)
+			report.InstanceData += lodInstanceData.capacity() * sizeof(InstancedData);
+		report.InstanceData += (mTempCompactInstanceData.capacity() + mBinnedCompactInstanceData.capacity()) * sizeof(InstancedDataCompact);
+		report.InstanceData += mBinnedInstanceData.capacity() * sizeof(InstancedData) + mBinnedInstanceIndices.capacity() * sizeof(UINT);
+		report.InstanceData += mTempCascadeInstanceData.capacity() * sizeof(InstancedData);
+		report.InstanceData += (mVoxelizationInstanceBuffers.capacity() + mShadowCascadeInstanceBuffers.capacity()) * (sizeof(CascadeInstanceBufferData*) + sizeof(CascadeInstanceBufferData));
+		report.InstanceData += mInstanceData.capacity() * sizeof(std::vector<InstancedData>);
+		report.InstanceData += mInstanceCountToRender.capacity() * sizeof(UINT);
+
+		report.MeshData += mMeshesTextureBuffers.capacity() * sizeof(TextureData);
+		report.MeshData += mMeshesReflectionFactors.capacity() * sizeof(float) + mMeshesCount.capacity() * sizeof(int) + mModelLODs.capacity() * sizeof(ER_Model*);
+		for (const auto& lodRenderBuffers : mMeshRenderBuffers)
+			report.MeshData += lodRenderBuffers.capacity() * (sizeof(RenderBufferData*) + sizeof(RenderBufferData));
+		for (const auto& lodInstanceBuffers : mMeshesInstanceBuffers)
+			report.MeshData += lodInstanceBuffers.capacity() * (sizeof(InstanceBufferData*) + sizeof(InstanceBufferData));
+		for (const auto* customTextures : { &mCustomAlbedoTextures, &mCustomNormalTextures, &mCustomRoughnessTextures, &mCustomMetalnessTextures, &mCustomHeightTextures, &mCustomReflectionMaskTextures })
 		{
-			for (size_t j = 0; j < mMeshVertices[lodIndex][i].size(); j++)
-			{
-				mMeshAllVertices[lodIndex].push_back(mMeshVertices[lodIndex][i][j]);
-			}
+			report.MeshData += customTextures->capacity() * sizeof(std::string);
+			for (const auto& path : *customTextures)
+				report.MeshData += path.capacity() + 1;
 		}
+		report.MeshData += mMaterials.size() * (sizeof(std::string) + sizeof(ER_Material*) + 4 * sizeof(void*)); // approximate map node
 
-		LoadRenderBuffers(lodIndex);
+		return report;
 	}
 
 	void ER_RenderingObject::ResetInstanceData(int count, bool clear, int lod)
@@ -1370,14 +1551,8 @@ namespace EveryRay_Core
 		if (lod == 0)
 		{
 			mInstanceCount = count;
-			for (int i = 0; i < static_cast<int>(mInstanceCount); i++)
-			{
-				std::string instanceName = mName + " #" + std::to_string(i);
-				mInstancesNames.push_back(instanceName);
-				mInstanceAABBs.push_back(mLocalAABB);
-				mInstanceCullingFlags.push_back(false);
-			}
 		}
+		mIsDataStoreDirty = true;
 
 		if (clear)
 			mInstanceData[lod].clear();
@@ -1387,6 +1562,8 @@ namespace EveryRay_Core
 		if (!mIsLoaded)
 			return;
 
+		mIsDataStoreDirty = true;
+
 		if (lod == -1) {
 			for (int lod = 0; lod < GetLODCount(); lod++)
 				mInstanceData[lod].push_back(InstancedData(worldMatrix));
@@ -1397,50 +1574,19 @@ namespace EveryRay_Core
 		mInstanceData[lod].push_back(InstancedData(worldMatrix));
 	}
 
+	// Instances and draw args are gathered into shared buffers by ER_GPUCuller once the object is ready
 	void ER_RenderingObject::CreateIndirectInstanceData()
 	{
-		if (!mIsLoaded)
-			return;
-
-		ER_RHI* rhi = mCore->GetRHI();
-
-		if (mIndirectOriginalInstanceDataBuffer) // means we already created the buffers
-			return;
-
-		if (rhi->GetAPI() == DX12 && rhi->GetCurrentGraphicsCommandListIndex() == -1)
+		if (!mIsLoaded || mIsIndirectInstanceDataReady)
 			return;
 
 		assert(mIsIndirectlyRendered);
-		assert(!mIndirectNewInstanceDataBuffer);
-		assert(!mIndirectOriginalInstanceDataBuffer);
 		assert(mInstanceCount);
-		assert(mInstanceAABBs.size());
 		assert(mInstanceData[0].size());
 
-		mIndirectNewInstanceDataBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - Indirect New Instance Data Buffer : " + mName);
-		mIndirectOriginalInstanceDataBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: ER_RenderingObject - Indirect Original Instance Data Buffer : " + mName);
-
-		struct IndirectInstanceData 
-		{
-			XMFLOAT4X4 world;
-			XMFLOAT4 aabbMin;
-			XMFLOAT4 aabbMax;
-		};
-
-		std::vector<IndirectInstanceData> data;
-		data.resize(mInstanceCount);
-
-		for (UINT i = 0; i < mInstanceCount; ++i)
-		{
-			data[i].world = mInstanceData[0][i].World;
-			data[i].aabbMin = XMFLOAT4(mInstanceAABBs[i].first.x, mInstanceAABBs[i].first.y, mInstanceAABBs[i].first.z, 1.0f);
-			data[i].aabbMax = XMFLOAT4(mInstanceAABBs[i].second.x, mInstanceAABBs[i].second.y, mInstanceAABBs[i].second.z, 1.0f);
-		}
-
-		mIndirectOriginalInstanceDataBuffer->CreateGPUBufferResource(rhi, &data[0], mInstanceCount, sizeof(IndirectInstanceData), false,
-			ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-		mIndirectNewInstanceDataBuffer->CreateGPUBufferResource(rhi, nullptr, mInstanceCount * MAX_LOD, sizeof(IndirectInstanceData), false,
-			ER_BIND_UNORDERED_ACCESS | ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED, ER_FORMAT_UNKNOWN);
+		// instances' AABBs are calculated in the scene's data store
+		if (mDataStoreCount != static_cast<int>(mInstanceCount))
+			return;
 
 		const int totalObjLodCount = GetLODCount();
 		// update draw args array
@@ -1462,6 +1608,7 @@ namespace EveryRay_Core
 			if (lodI < totalObjLodCount)
 				lastAvailableLod = lodI;
 		}
+		mIsIndirectInstanceDataReady = true;
 	}
 }
 
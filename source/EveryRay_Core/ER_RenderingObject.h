@@ -5,6 +5,8 @@
 #include "ER_ModelMaterial.h"
 
 #include "RHI\ER_RHI.h"
+#include "ER_RenderingObjectRegistry.h"
+#include "ER_CompactInstanceData.h"
 
 const UINT MAX_DIRECT_INSTANCE_COUNT = 20000; // max count for instances which are NOT GPU indirectly drawn
 
@@ -29,9 +31,11 @@ namespace EveryRay_Core
 	class ER_Core;
 	class ER_CoreTime;
 	class ER_Material;
-	class ER_RenderableAABB;
+	class ER_DebugRenderer;
 	class ER_Camera;
 	class ER_Model;
+	class ER_Terrain;
+	class ER_SceneDataStore;
 
 	enum RenderingObjectTextureQuality
 	{
@@ -84,13 +88,7 @@ namespace EveryRay_Core
 		float CustomAlphaDiscard;
 		UINT OriginalInstanceCount;
 		UINT RenderingObjectFlags;
-	};
-
-	struct ER_ALIGN_GPU_BUFFER IndirectMeshCB
-	{
-		XMINT4 IndexCount_StartIndexLoc_BaseVtxLoc_StartInstLoc[MAX_LOD * MAX_MESH_COUNT];
-		UINT OriginalInstancesCount;
-		XMINT3 pad;
+		UINT IndirectFirstInstance; // of the object's culled instances in ER_GPUCuller's shared buffer
 	};
 
 	struct ER_ALIGN_GPU_BUFFER ObjectFakeRootCB
@@ -147,6 +145,30 @@ namespace EveryRay_Core
 		
 	};
 
+	// instances overlapping a voxel GI or a cached shadow cascade (shared by all meshes of the object)
+	struct CascadeInstanceBufferData
+	{
+		ER_RHI_GPUBuffer*	InstanceBuffer = nullptr;
+		UINT				Capacity = 0;
+		UINT				InstanceCount = 0;
+
+		~CascadeInstanceBufferData()
+		{
+			DeleteObject(InstanceBuffer);
+		}
+	};
+
+	// CPU memory owned by a rendering object (GPU resources and the shared model cache are not included)
+	struct RenderingObjectMemoryReport
+	{
+		UINT64 Object = 0; // sizeof(ER_RenderingObject)
+		UINT64 InstanceData = 0; // original and temporary (post culling/LOD) instance transforms
+		UINT64 MeshData = 0; // per mesh/LOD containers (texture data, buffers' descriptions, custom texture paths)
+		UINT64 EditorData = 0; // editor-only allocations (none at the moment: debug AABBs are batched by ER_DebugRenderer)
+
+		UINT64 GetTotal() const { return Object + InstanceData + MeshData + EditorData; }
+	};
+
 	class ER_RenderingObject
 	{
 		using Delegate_MeshMaterialVariablesUpdate = std::function<void(int, int)>; // mesh index & lod index for input
@@ -163,8 +185,11 @@ namespace EveryRay_Core
 		void LoadAssignedMeshTextures(int meshIndex);
 
 		void Draw(const std::string& materialName, bool toDepth = false, int meshIndex = -1);
-		void DrawLOD(const std::string& materialName, bool toDepth, int meshIndex, int lod, bool skipCulling = false);
-		void DrawAABB(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		// skipCulling also ignores the camera's LOD cut-off (-1), aCascadeInstances replaces the instance buffer of instanced objects
+		void DrawLOD(const std::string& materialName, bool toDepth, int meshIndex, int lod, bool skipCulling = false, const CascadeInstanceBufferData* aCascadeInstances = nullptr);
+		void DrawVoxelization(const std::string& materialName, int meshIndex, int cascade);
+		void DrawShadowCascade(const std::string& materialName, int meshIndex, int cascade); // cached cascades only (see UpdateShadowCascadeInstances())
+		void DrawAABB(ER_DebugRenderer* aDebugRenderer);
 		void Update(const ER_CoreTime& time);
 
 		std::map<std::string, ER_Material*>& GetMaterials() { return mMaterials; }
@@ -172,7 +197,9 @@ namespace EveryRay_Core
 		TextureData& GetTextureData(int meshIndex) { return mMeshesTextureBuffers[meshIndex]; }
 		
 		const int GetMeshCount(int lod = 0) const { return mMeshesCount[lod]; }
-		const std::vector<XMFLOAT3>& GetVertices(int lod = 0) { return mMeshAllVertices[lod]; }
+		UINT GetVertexCount(int lod = 0) const;
+		std::string GetInstanceName(int index) const { return mName + " #" + std::to_string(index); } // generated (only needed in editor)
+		RenderingObjectMemoryReport GetMemoryReport() const;
 		const UINT GetInstanceCount(int lod = 0) const { return (mIsInstanced ? static_cast<UINT>(mInstanceData[lod].size()) : 0); }
 		std::vector<InstancedData>& GetInstancesData(int lod = 0) { return mInstanceData[lod]; }
 		const int GetIndexCount(int lod, int mesh) const { return mMeshRenderBuffers[lod][mesh]->IndicesCount; }
@@ -182,9 +209,25 @@ namespace EveryRay_Core
 
 		ER_AABB& GetLocalAABB() { return mLocalAABB; } //local space (no transforms)
 		ER_AABB& GetGlobalAABB() { return mGlobalAABB; } //world space (with transforms)
-		ER_AABB& GetInstanceAABB(int index) { return mInstanceAABBs[index]; } //world space (with transforms)
+		int GetDataStoreFirstEntry() const { return mDataStoreFirst; } // instances' world AABBs, culling and LODs are in the scene's data store (-1 if not synced yet)
+
+		void SyncDataStore(ER_SceneDataStore& aDataStore);
+		void ReleaseDataStore(ER_SceneDataStore& aDataStore);
+
+		// Visible instances grouped by LOD (ER_SceneDataStore::BinByLOD()) and gathered into upload-ready arrays; only touches this object's
+		// data, so different objects can be binned in parallel (ER_Scene::BinInstances()). Instance buffers are then updated in Update().
+		bool IsInstanceBinningNeeded() const { return mIsLoaded && mIsInstanced && !mIsIndirectlyRendered && mDataStoreFirst >= 0; }
+		void BinInstances(const ER_SceneDataStore& aDataStore);
+
+		// Uploads the instances overlapping a voxel GI cascade (aOverlapBits from ER_SceneDataStore::OverlapAABB()) into the cascade's own
+		// instance buffer, so that DrawVoxelization() only draws those. Returns false if no part of the object overlaps the cascade.
+		bool UpdateVoxelizationInstances(int cascade, const std::vector<UINT64>& aOverlapBits);
+		// Same for a cached shadow cascade (aOverlapBits of the cascade's light-space box): its depth is kept for many frames, so it must not
+		// depend on the camera's culling. Indirectly rendered objects are still culled on GPU against the camera.
+		bool UpdateShadowCascadeInstances(int cascade, const std::vector<UINT64>& aOverlapBits);
 
 		void SetTransformationMatrix(const XMMATRIX& mat);
+		void SetTransformationMatrixFromHierarchy(const XMFLOAT4X4& aWorld); // world transform propagated from a parent (ER_Scene::UpdateDataStore())
 		void SetTranslation(float x, float y, float z);
 		void SetScale(float x, float y, float z);
 		void SetRotation(float x, float y, float z);
@@ -194,17 +237,23 @@ namespace EveryRay_Core
 		void ResetInstanceData(int count, bool clear = false, int lod = 0);
 		void AddInstanceData(const XMMATRIX& worldMatrix, int lod = -1);
 		void CreateIndirectInstanceData();
+		bool IsIndirectInstanceDataReady() const { return mIsIndirectInstanceDataReady; }
 		UINT InstanceSize() const;
+
+		// Instance buffers store InstancedDataCompact (32 bytes) instead of InstancedData (64 bytes); needs "_instancing_compact" vertex shaders.
+		// Must be set before the instance buffers are loaded. CPU-side instance data (mInstanceData etc.) always stays in full matrices.
+		void SetCompactInstanceData(bool value) { mIsCompactInstanceData = value; }
+		bool IsCompactInstanceData() const { return mIsCompactInstanceData; }
 		
 		void PerformCPUFrustumCull(ER_Camera* camera);
 
 		void SetGPUIndirectlyRendered(bool value) { mIsIndirectlyRendered = value; }
 		bool IsGPUIndirectlyRendered() { return mIsIndirectlyRendered; }
 		ER_RHI_GPUBuffer* GetIndirectNewInstanceBuffer() { return mIndirectNewInstanceDataBuffer; }
-		ER_RHI_GPUBuffer* GetIndirectOriginalInstanceBuffer() { return mIndirectOriginalInstanceDataBuffer; }
 		ER_RHI_GPUBuffer* GetIndirectArgsBuffer() { return mIndirectArgsBuffer; }
-		ER_RHI_GPUBuffer* GetIndirectMeshConstantBuffer();
 		const XMINT4* GetIndirectDrawArgsArray() const { return mIndirectDrawArgsArray; }
+		// Set by ER_GPUCuller: shared buffers with the object's culled instances (from aFirstInstance) and its draw args (from aFirstDraw, MAX_LOD * MAX_MESH_COUNT draws)
+		void SetIndirectCullingRange(ER_RHI_GPUBuffer* aInstanceBuffer, UINT aFirstInstance, ER_RHI_GPUBuffer* aArgsBuffer, UINT aFirstDraw);
 
 		void Rename(const std::string& name) { mName = name; }
 		const std::string& GetName() { return mName; }
@@ -306,6 +355,11 @@ namespace EveryRay_Core
 		int GetIndexInScene() { return mIndexInScene; }
 		void SetIndexInScene(int index) { mIndexInScene = index; }
 
+		const ER_RenderingObjectHandle& GetHandle() { return mHandle; }
+		void SetHandle(const ER_RenderingObjectHandle& aHandle) { mHandle = aHandle; }
+		int GetTransformNode() const { return mTransformNode; }
+		void SetTransformNode(int aNode) { mTransformNode = aNode; }
+
 		bool IsTriplanarMapped() { return mIsTriplanarMapped; }
 		void SetTriplanarMapping(bool value) { mIsTriplanarMapped = value; }
 		float GetTriplanarMappedSharpness() { return mTriplanarMappingSharpness; }
@@ -361,10 +415,16 @@ namespace EveryRay_Core
 		bool IsLoaded() { return mIsLoaded; }
 	private:
 		void UpdateAABB(ER_AABB& aabb, const XMMATRIX& transformMatrix);
+		UINT64 CalculateTerrainPlacementHash(ER_Terrain* aTerrain);
 		void LoadTexture(ER_RHI_GPUTexture** aTexture, bool* loadStat, const std::wstring& path, int meshIndex, bool isPlaceholder = false);
 		void CreateInstanceBuffer(InstancedData* instanceData, UINT instanceCount, ER_RHI_GPUBuffer* instanceBuffer);
+		void* GetInstanceBufferData(InstancedData* instanceData, UINT instanceCount);
+		void UploadInstanceBuffer(void* bufferData, UINT instanceCount, int lod);
+		void UpdateBinnedInstanceBuffers();
+		bool UpdateCascadeInstances(std::vector<CascadeInstanceBufferData*>& aBuffers, int aCascade, const std::vector<UINT64>& aOverlapBits, const std::string& aBufferName);
 		
 		void UpdateGizmos();
+		void UpdateTransformNode();
 		void UpdateBitmaskFlags();
 		void ShowInstancesListWindow();
 		void ShowObjectsEditorWindow(const float *cameraView, float *cameraProjection, float* matrix);
@@ -380,46 +440,46 @@ namespace EveryRay_Core
 		///****************************************************************************************************************************
 		// *** mesh/model data (buffers, textures, etc.) ***
 		std::vector<TextureData>								mMeshesTextureBuffers;
-		std::vector<std::vector<std::vector<XMFLOAT3>>>			mMeshVertices; // vertices per mesh, per LOD group
 		std::vector<std::vector<RenderBufferData*>>				mMeshRenderBuffers; // vertex/index buffers per mesh, per LOD group
 		std::vector<std::vector<InstanceBufferData*>>			mMeshesInstanceBuffers; // instance buffers per mesh, per LOD group
-		std::vector<std::vector<XMFLOAT3>>						mMeshAllVertices; // vertices of all meshes combined, per LOD group
 		std::vector<float>										mMeshesReflectionFactors; // mesh reflection factors, per LOD group
 		std::vector<int>										mMeshesCount; // mesh count, per LOD group
 		ER_Model*												mModel = nullptr; // just a pointer to the model cache
 		std::vector<ER_Model*>									mModelLODs; // just pointers to the model cache
-		bool													mIsLoaded = false; // whether 3D model was loaded for this object
 		// 
 		///****************************************************************************************************************************
 
 		///****************************************************************************************************************************
 		// *** instancing data (counters, transforms etc.) ***
 		UINT													mInstanceCount = 0;
-		std::vector<std::string>								mInstancesNames; // collection of names of instances (mName + index)
-		std::vector<ER_AABB>									mInstanceAABBs; // collection of AABBs for every instance (shared for LODs)
-		std::vector<bool>										mInstanceCullingFlags; // collection of culling flags for every instance (vector is lame here btw...)
-		std::vector<InstancedData>								mTempPostCullingInstanceData; // temp instance data after CPU culling
-		std::vector<std::vector<InstancedData>>					mTempPostLoddingInstanceData; // temp instance data after lodding (per LOD group)
 		std::vector<UINT>										mInstanceCountToRender; //instance render count  (per LOD group)
 		std::vector<std::vector<InstancedData>>					mInstanceData; //original instance data  (per LOD group)
+		std::vector<InstancedDataCompact>						mTempCompactInstanceData; // encoded instance data before the upload (only with mIsCompactInstanceData)
+		// visible instances after CPU culling and lodding (see BinInstances()), sized once per instance count (no per-frame allocations)
+		std::vector<UINT>										mBinnedInstanceIndices; // instance indices, LOD 0 first
+		std::vector<InstancedData>								mBinnedInstanceData; // gathered transforms (or mBinnedCompactInstanceData with mIsCompactInstanceData)
+		std::vector<InstancedDataCompact>						mBinnedCompactInstanceData;
+		UINT													mBinnedInstanceOffsets[MAX_LOD + 1] = {}; // LOD ranges in the arrays above
+		int														mBinnedLODCount = 0; // 0 - not binned this frame
+		std::vector<CascadeInstanceBufferData*>					mVoxelizationInstanceBuffers; // per voxel GI cascade (instanced objects without indirect rendering)
+		std::vector<CascadeInstanceBufferData*>					mShadowCascadeInstanceBuffers; // per shadow cascade (only cached ones)
+		std::vector<InstancedData>								mTempCascadeInstanceData; // instances overlapping a cascade before the upload
 		XMFLOAT4*												mTempInstancesPositions = nullptr;
 
 		// GPU-driven way of culling and rendering instances without CPU readbacks (new and preferred)
 		// WARNING: Make sure to use this for objects with high instances counts to make this efficient
 		// WARNING: Has nothing to do with indirect lighting!
-		bool													mIsIndirectlyRendered = false; // parsed from the scene file
-		ER_RHI_GPUBuffer*										mIndirectOriginalInstanceDataBuffer = nullptr; //original instance transforms
-		ER_RHI_GPUBuffer*										mIndirectNewInstanceDataBuffer = nullptr; //new instance transforms of all LODs culled and processed in CS
-		ER_RHI_GPUBuffer*										mIndirectArgsBuffer = nullptr; // draw indexed instance indirect args for all meshes (instance count is calculated in CS)
-		ER_RHI_GPUConstantBuffer<IndirectMeshCB>				mIndirectMeshConstants; // not used on DX11-like APIs;
+		ER_RHI_GPUBuffer*										mIndirectNewInstanceDataBuffer = nullptr; //new instance transforms of all LODs culled and processed in CS (shared, owned by ER_GPUCuller)
+		ER_RHI_GPUBuffer*										mIndirectArgsBuffer = nullptr; // draw indexed instance indirect args for all meshes (shared, owned by ER_GPUCuller)
+		UINT													mIndirectFirstInstance = 0;
+		UINT													mIndirectFirstDraw = 0;
 		XMINT4													mIndirectDrawArgsArray[MAX_LOD * MAX_MESH_COUNT];
+		bool													mIsIndirectInstanceDataReady = false; // draw args are set and instances' AABBs are in the scene's data store
 		
 		///****************************************************************************************************************************
 
 		///****************************************************************************************************************************
 		// *** terrain placement & procedural fields ***
-		ER_RHI_GPUBuffer*										mInputPositionsOnTerrainBuffer = nullptr; //input positions for on-terrain placement pass
-		ER_RHI_GPUBuffer*										mOutputPositionsOnTerrainBuffer = nullptr; //output positions for on-terrain placement pass
 		int														mTerrainProceduralPlacementSplatChannel = 4; //TerrainSplatChannel::NONE // on which terrain splat to place
 		float													mTerrainProceduralPlacementHeightDelta = 0.0f; //delta from the object's origin above terrain
 		int														mTerrainProceduralInstanceCount = 0;
@@ -433,8 +493,6 @@ namespace EveryRay_Core
 		float													mTerrainProceduralObjectMaxPitch = 0.0f;
 		float													mTerrainProceduralObjectMinYaw = 0.0f;
 		float													mTerrainProceduralObjectMaxYaw = 0.0f;
-		bool													mIsTerrainPlacementFinished = false;
-		bool													mIsTerrainPlacement = false; //possible/wanted or not
 		///****************************************************************************************************************************
 		
 		///****************************************************************************************************************************
@@ -460,35 +518,15 @@ namespace EveryRay_Core
 
 		ER_AABB													mLocalAABB; //mesh space AABB
 		ER_AABB													mGlobalAABB; //world space AABB
-		XMFLOAT3												mCurrentGlobalAABBVertices[8];
-		ER_RenderableAABB*										mDebugGizmoAABB = nullptr;
 	
 		std::string												mName;
-		const char*												mInstancedNamesUI[MAX_DIRECT_INSTANCE_COUNT];
 		int														mIndexInScene = -1;
+		ER_RenderingObjectHandle								mHandle; // in the scene's registry
+		int														mDataStoreFirst = -1; // first entry in the scene's data store
+		int														mDataStoreCount = 0; // 1 or mInstanceCount
+		int														mTransformNode = -1; // node in the scene's transform hierarchy (only for objects with a parent or children)
 		int														mCurrentLODIndex = 0; //only used for non-instanced object
 		int														mEditorSelectedInstancedObjectIndex = 0;
-		bool													mIsAABBDebugEnabled = true;
-		bool													mIsAvailableInEditorMode = false;
-		bool													mIsSelected = false;
-		bool													mIsRendered = true;
-		bool													mIsInstanced = false;
-		bool													mIsCastShadow = true;
-		bool													mIsForwardShading = false;
-		bool													mIsPOM = false;
-		bool													mIsCulled = false; //only for non-instanced objects
-		bool													mIsMarkedAsFoliage = false;
-		bool													mIsInLightProbe = false;
-		bool													mIsSeparableSubsurfaceScattering = false;
-		bool													mIsInVoxelization = false;
-		bool													mIsInGbuffer = false;
-		bool													mUseIndirectGlobalLightProbe = false;
-		bool													mIsUsedForGlobalLightProbeRendering = false;
-		bool													mIsSkippedIndirectSpecular = false;
-		bool													mIsSkippedIndirectDiffuse = false;
-		bool													mIsReflective = false; //appeared in SSR and such
-		bool													mIsTransparent = false;
-		bool													mIsTriplanarMapped = false;
 		float													mTriplanarMappingSharpness = 1.0f;
 		float													mIOR = 1.52f; // glass IOR by default
 		float													mCustomRoughness = -1.0f;
@@ -496,8 +534,6 @@ namespace EveryRay_Core
 		float													mCustomAlphaDiscard = 0.1f;
 		float													mMinScale = 1.0f;
 		float													mMaxScale = 1.0f;
-		float													mCameraViewMatrix[16];
-		float													mCameraProjectionMatrix[16];
 		XMMATRIX												mTransformationMatrix;
 		float													mMatrixTranslation[3], mMatrixRotation[3], mMatrixScale[3];
 		float													mCurrentObjectTransformMatrix[16] = 
@@ -510,5 +546,36 @@ namespace EveryRay_Core
 
 		RenderingObjectTextureQuality							mCurrentTextureQuality = RenderingObjectTextureQuality::OBJECT_TEXTURE_LOW;
 		UINT													mObjectShaderBitmaskFlags = 0; // "RenderingObjectFlags" in shaders
+
+		///****************************************************************************************************************************
+		// *** flags (packed; bit-fields can not have default member initializers in C++14, so they are initialized in the constructor) ***
+		bool													mIsLoaded : 1; // whether 3D model was loaded for this object
+		bool													mIsIndirectlyRendered : 1; // parsed from the scene file
+		bool													mIsTerrainPlacementFinished : 1;
+		bool													mIsTerrainPlacement : 1; //possible/wanted or not
+		bool													mIsDataStoreDirty : 1; // transforms need to be written to the data store
+		bool													mIsAABBDebugEnabled : 1;
+		bool													mIsAvailableInEditorMode : 1;
+		bool													mIsSelected : 1;
+		bool													mIsRendered : 1;
+		bool													mIsInstanced : 1;
+		bool													mIsCastShadow : 1;
+		bool													mIsForwardShading : 1;
+		bool													mIsPOM : 1;
+		bool													mIsCulled : 1; //only for non-instanced objects
+		bool													mIsMarkedAsFoliage : 1;
+		bool													mIsInLightProbe : 1;
+		bool													mIsSeparableSubsurfaceScattering : 1;
+		bool													mIsInVoxelization : 1;
+		bool													mIsInGbuffer : 1;
+		bool													mUseIndirectGlobalLightProbe : 1;
+		bool													mIsUsedForGlobalLightProbeRendering : 1;
+		bool													mIsSkippedIndirectSpecular : 1;
+		bool													mIsSkippedIndirectDiffuse : 1;
+		bool													mIsReflective : 1; //appeared in SSR and such
+		bool													mIsTransparent : 1;
+		bool													mIsTriplanarMapped : 1;
+		bool													mIsCompactInstanceData : 1; // parsed from the scene file
+		///****************************************************************************************************************************
 	};
 }
\ No newline at end of file
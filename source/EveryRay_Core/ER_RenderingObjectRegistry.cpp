@@ -0,0 +1,135 @@
+#include "stdafx.h"
+
+#include "ER_RenderingObjectRegistry.h"
+#include "ER_Utility.h"
+
+namespace EveryRay_Core
+{
+	ER_RenderingObjectRegistry::ER_RenderingObjectRegistry()
+	{
+	}
+
+	ER_RenderingObjectRegistry::~ER_RenderingObjectRegistry()
+	{
+		Clear();
+	}
+
+	ER_RenderingObjectHandle ER_RenderingObjectRegistry::Add(const std::string& aName, ER_RenderingObject* aObject)
+	{
+		assert(aObject);
+
+		UINT slotIndex = mFirstFreeSlot;
+		if (slotIndex != ER_INVALID_HANDLE_INDEX)
+			mFirstFreeSlot = mSlots[slotIndex].NextFreeSlot;
+		else
+		{
+			slotIndex = static_cast<UINT>(mSlots.size());
+			mSlots.push_back(Slot());
+		}
+
+		Slot& slot = mSlots[slotIndex];
+		slot.DenseIndex = static_cast<int>(mDenseEntries.size());
+		slot.NextFreeSlot = ER_INVALID_HANDLE_INDEX;
+		mDenseEntries.emplace_back(aName, aObject);
+		mDenseSlots.push_back(slotIndex);
+
+		ER_RenderingObjectHandle handle;
+		handle.Index = slotIndex;
+		handle.Generation = slot.Generation;
+		mVersion++;
+
+		if (!mNameIndex.emplace(aName, handle).second)
+		{
+			std::wstring msg = L"[ER Logger][ER_RenderingObjectRegistry] Rendering object name is not unique, lookups by name will return the first one: " + ER_Utility::ToWideString(aName) + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+		}
+		return handle;
+	}
+
+	bool ER_RenderingObjectRegistry::Remove(const ER_RenderingObjectHandle& aHandle)
+	{
+		if (!IsAlive(aHandle))
+			return false;
+
+		Slot& slot = mSlots[aHandle.Index];
+		const int denseIndex = slot.DenseIndex;
+		const int lastDenseIndex = static_cast<int>(mDenseEntries.size()) - 1;
+
+		auto nameIt = mNameIndex.find(mDenseEntries[denseIndex].first);
+		if (nameIt != mNameIndex.end() && nameIt->second == aHandle)
+			mNameIndex.erase(nameIt);
+
+		if (denseIndex != lastDenseIndex)
+		{
+			mDenseEntries[denseIndex] = std::move(mDenseEntries[lastDenseIndex]);
+			mDenseSlots[denseIndex] = mDenseSlots[lastDenseIndex];
+			mSlots[mDenseSlots[denseIndex]].DenseIndex = denseIndex;
+		}
+		mDenseEntries.pop_back();
+		mDenseSlots.pop_back();
+
+		// new generation invalidates all existing handles of this slot
+		slot.Generation++;
+		if (slot.Generation == 0)
+			slot.Generation = 1;
+		slot.DenseIndex = -1;
+		slot.NextFreeSlot = mFirstFreeSlot;
+		mFirstFreeSlot = aHandle.Index;
+		mVersion++;
+		return true;
+	}
+
+	void ER_RenderingObjectRegistry::Clear()
+	{
+		mSlots.clear();
+		mFirstFreeSlot = ER_INVALID_HANDLE_INDEX;
+		mDenseEntries.clear();
+		mDenseSlots.clear();
+		mNameIndex.clear();
+		mVersion++;
+	}
+
+	bool ER_RenderingObjectRegistry::IsAlive(const ER_RenderingObjectHandle& aHandle) const
+	{
+		return aHandle.Index < mSlots.size() && mSlots[aHandle.Index].Generation == aHandle.Generation && mSlots[aHandle.Index].DenseIndex >= 0;
+	}
+
+	ER_RenderingObject* ER_RenderingObjectRegistry::Get(const ER_RenderingObjectHandle& aHandle) const
+	{
+		return IsAlive(aHandle) ? mDenseEntries[mSlots[aHandle.Index].DenseIndex].second : nullptr;
+	}
+
+	ER_RenderingObjectHandle ER_RenderingObjectRegistry::Find(const std::string& aName) const
+	{
+		auto it = mNameIndex.find(aName);
+		return (it != mNameIndex.end()) ? it->second : ER_RenderingObjectHandle();
+	}
+
+	void ER_RenderingObjectRegistry::Partition(const std::function<bool(ER_RenderingObject*)>& aPredicate)
+	{
+		std::vector<int> order(mDenseEntries.size());
+		for (int i = 0; i < static_cast<int>(order.size()); i++)
+			order[i] = i;
+		std::stable_partition(order.begin(), order.end(), [&](int aIndex) { return aPredicate(mDenseEntries[aIndex].second); });
+
+		std::vector<ER_SceneObject> entries(mDenseEntries.size());
+		std::vector<UINT> slots(mDenseSlots.size());
+		for (int i = 0; i < static_cast<int>(order.size()); i++)
+		{
+			entries[i] = std::move(mDenseEntries[order[i]]);
+			slots[i] = mDenseSlots[order[i]];
+			mSlots[slots[i]].DenseIndex = i;
+		}
+		mDenseEntries.swap(entries);
+		mDenseSlots.swap(slots);
+		mVersion++;
+	}
+
+	ER_RenderingObjectHandle ER_RenderingObjectRegistry::GetHandleByDenseIndex(int aIndex) const
+	{
+		ER_RenderingObjectHandle handle;
+		handle.Index = mDenseSlots[aIndex];
+		handle.Generation = mSlots[handle.Index].Generation;
+		return handle;
+	}
+}
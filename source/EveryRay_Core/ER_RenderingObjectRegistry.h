@@ -0,0 +1,68 @@
+#pragma once
+#include "Common.h"
+
+#define ER_INVALID_HANDLE_INDEX 0xffffffff
+
+namespace EveryRay_Core
+{
+	class ER_RenderingObject;
+	using ER_SceneObject = std::pair<std::string, ER_RenderingObject*>;
+
+	// Generational handle of a rendering object: safe to keep across systems and frames, since a handle of a removed object
+	// (even if its slot was reused by another object) never resolves again.
+	struct ER_RenderingObjectHandle
+	{
+		UINT Index = ER_INVALID_HANDLE_INDEX; // slot in the registry
+		UINT Generation = 0;
+
+		bool IsValid() const { return Index != ER_INVALID_HANDLE_INDEX; }
+		bool operator==(const ER_RenderingObjectHandle& aOther) const { return Index == aOther.Index && Generation == aOther.Generation; }
+		bool operator!=(const ER_RenderingObjectHandle& aOther) const { return !(*this == aOther); }
+	};
+
+	// Registry of the scene's rendering objects: objects are stored in dense arrays (iteration without holes),
+	// handles point to slots which point to the dense arrays, names are hashed into an index.
+	// Add, Remove, Get and Find are O(1). The registry does not own the objects.
+	class ER_RenderingObjectRegistry
+	{
+	public:
+		ER_RenderingObjectRegistry();
+		~ER_RenderingObjectRegistry();
+
+		ER_RenderingObjectHandle Add(const std::string& aName, ER_RenderingObject* aObject);
+		bool Remove(const ER_RenderingObjectHandle& aHandle); // swaps the last object into the removed one's place
+		void Clear();
+
+		ER_RenderingObject* Get(const ER_RenderingObjectHandle& aHandle) const; // nullptr for stale/invalid handles
+		bool IsAlive(const ER_RenderingObjectHandle& aHandle) const;
+		ER_RenderingObjectHandle Find(const std::string& aName) const; // invalid handle if not found
+
+		// Dense access (order changes on Remove and Partition)
+		int GetCount() const { return static_cast<int>(mDenseEntries.size()); }
+		ER_RenderingObject* GetObjectByDenseIndex(int aIndex) const { return mDenseEntries[aIndex].second; }
+		ER_RenderingObjectHandle GetHandleByDenseIndex(int aIndex) const;
+		const std::string& GetNameByDenseIndex(int aIndex) const { return mDenseEntries[aIndex].first; }
+		const std::vector<ER_SceneObject>& GetEntries() const { return mDenseEntries; }
+		// Stable reordering of the dense arrays (objects for which aPredicate is true come first), handles stay valid
+		void Partition(const std::function<bool(ER_RenderingObject*)>& aPredicate);
+
+		int GetSlotsCount() const { return static_cast<int>(mSlots.size()); } // handles' indices are always < this (useful for per-object arrays)
+		UINT GetVersion() const { return mVersion; } // changes on every Add, Remove and Clear (to rebuild caches of the objects)
+	private:
+		struct Slot
+		{
+			UINT Generation = 1; // 0 is never alive, so default handles never resolve
+			int DenseIndex = -1; // -1 - free
+			UINT NextFreeSlot = ER_INVALID_HANDLE_INDEX;
+		};
+
+		std::vector<Slot> mSlots;
+		UINT mFirstFreeSlot = ER_INVALID_HANDLE_INDEX;
+
+		std::vector<ER_SceneObject> mDenseEntries; // name, object
+		std::vector<UINT> mDenseSlots;
+
+		std::unordered_map<std::string, ER_RenderingObjectHandle> mNameIndex;
+		UINT mVersion = 0;
+	};
+}
@@ -13,6 +13,7 @@
 #include "ER_Sandbox.h"
 #include "ER_Editor.h"
 #include "ER_QuadRenderer.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Model.h"
 
 #include "..\JsonCpp\include\json\json.h"
@@ -39,7 +40,8 @@ namespace EveryRay_Core
 		mGamepad(nullptr),
 		mShowProfiler(false),
 		mEditor(nullptr),
-		mQuadRenderer(nullptr)
+		mQuadRenderer(nullptr),
+		mDebugRenderer(nullptr)
 	{
 		LoadGraphicsConfig();
 
@@ -97,6 +99,10 @@ namespace EveryRay_Core
 		mCoreEngineComponents.push_back(mQuadRenderer);
 		mServices.AddService(ER_QuadRenderer::TypeIdClass(), mQuadRenderer);
 
+		mDebugRenderer = new ER_DebugRenderer(*this);
+		mCoreEngineComponents.push_back(mDebugRenderer);
+		mServices.AddService(ER_DebugRenderer::TypeIdClass(), mDebugRenderer);
+
 		#pragma region INITIALIZE_IMGUI
 
 		IMGUI_CHECKVERSION();
@@ -411,6 +417,7 @@ namespace EveryRay_Core
 		DeleteObject(mKeyboard);
 		DeleteObject(mEditor);
 		DeleteObject(mQuadRenderer);
+		DeleteObject(mDebugRenderer);
 		DeleteObject(mMouse);
 		DeleteObject(mCamera);
 
@@ -12,6 +12,7 @@ namespace EveryRay_Core
 	class ER_CameraFPS;
 	class ER_Editor;
 	class ER_QuadRenderer;
+	class ER_DebugRenderer;
 	class ER_Model;
 	
 	enum GraphicsQualityPreset
@@ -59,6 +60,7 @@ namespace EveryRay_Core
 		ER_CameraFPS* mCamera = nullptr;
 		ER_Editor* mEditor = nullptr;
 		ER_QuadRenderer* mQuadRenderer = nullptr;
+		ER_DebugRenderer* mDebugRenderer = nullptr;
 
 		ER_RHI_Viewport mMainViewport;
 
@@ -7,6 +7,7 @@
 #include "ER_CoreException.h"
 #include "ER_Editor.h"
 #include "ER_QuadRenderer.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Camera.h"
 #include "ER_DirectionalLight.h"
 #include "ER_Keyboard.h"
@@ -22,6 +23,8 @@
 #include "ER_Illumination.h"
 #include "ER_LightProbesManager.h"
 #include "ER_GPUCuller.h"
+#include "ER_AsyncComputeScheduler.h"
+#include "ER_SelfTests.h"
 
 #include "RHI/ER_RHI.h"
 
@@ -54,6 +57,7 @@ namespace EveryRay_Core {
 		DeleteObject(mLightProbesManager);
 		DeleteObject(mTerrain);
 		DeleteObject(mGPUCuller);
+		DeleteObject(mAsyncComputeScheduler);
 		game.CPUProfiler()->EndCPUTime("Destroying scene: " + mName);
 	}
 
@@ -89,6 +93,12 @@ namespace EveryRay_Core {
 		mQuadRenderer->Init();
 #pragma endregion
 
+		#pragma region INIT_DEBUG_RENDERER
+		mDebugRenderer = (ER_DebugRenderer*)game.GetServices().FindService(ER_DebugRenderer::TypeIdClass());
+		assert(mDebugRenderer);
+		mDebugRenderer->Init();
+#pragma endregion
+
 		#pragma region INIT_GBUFFER
         game.CPUProfiler()->BeginCPUTime("Gbuffer init");
         mGBuffer = new ER_GBuffer(game, camera, game.ScreenWidth(), game.ScreenHeight());
@@ -182,7 +192,7 @@ namespace EveryRay_Core {
 			game.CPUProfiler()->EndCPUTime("Terrain init");
 
 			//place ER_RenderingObjects on terrain (if needed)
-			for (auto& object : mScene->objects)
+			for (auto& object : mScene->GetRenderingObjects())
 			{
 				object.second->PlaceProcedurallyOnTerrain(true);
 			}
@@ -207,6 +217,8 @@ namespace EveryRay_Core {
 		game.CPUProfiler()->EndCPUTime("GPU Culler init");
 #pragma endregion
 
+		InitializeAsyncComputeSchedule(rhi);
+
 
 		#pragma region INIT_MATERIAL_CALLBACKS
 		game.CPUProfiler()->BeginCPUTime("Material callbacks init");
@@ -217,7 +229,7 @@ namespace EveryRay_Core {
 		materialSystems.mProbesManager = mLightProbesManager;
 		materialSystems.mIllumination = mIllumination;
 
-		for (auto& object : mScene->objects) 
+		for (auto& object : mScene->GetRenderingObjects()) 
 		{
 			for (auto& layeredMaterial : object.second->GetMaterials())
 			{
@@ -264,6 +276,7 @@ namespace EveryRay_Core {
 		mSkybox->Update();
 		mSkybox->UpdateSun(gameTime);
 		mGBuffer->Update(gameTime);
+		mGPUCuller->Update(gameTime);
 		mPostProcessingStack->Update();
 		mVolumetricClouds->Update(gameTime);
 		mVolumetricFog->Update(gameTime);
@@ -276,7 +289,8 @@ namespace EveryRay_Core {
 		mShadowMapper->UpdateFrustomSplitWeight(mFrustumSplitWeight);
 		mShadowMapper->UpdateShadowTransitionScale(mShadowTransitionScale);
 		mShadowMapper->SetDebugShadowCascades(mDebugShadowCascade);
-		mShadowMapper->Update(gameTime);
+		mShadowMapper->SetFitToReceivers(mFitShadowCascadesToReceivers);
+		mShadowMapper->SetCachingCascades(mCacheShadowCascades);
 
 		if (mFoliageSystem && mScene->HasFoliage())
 			mFoliageSystem->Update(gameTime, mWindGustDistance, mWindStrength, mWindFrequency);
@@ -284,7 +298,9 @@ namespace EveryRay_Core {
 			((ER_Camera*)game.GetServices().FindService(ER_Camera::TypeIdClass()))->ViewMatrix4X4(),
 			((ER_Camera*)game.GetServices().FindService(ER_Camera::TypeIdClass()))->ProjectionMatrix4X4()); //TODO refactor to DebugRenderer
 
-		for (auto& object : mScene->objects)
+		mScene->UpdateDataStore((ER_Camera*)game.GetServices().FindService(ER_Camera::TypeIdClass()));
+		mShadowMapper->Update(gameTime, mScene, (mTerrain && mScene->HasTerrain()) ? mTerrain : nullptr); // fitted to the receivers of the data store
+		for (auto& object : mScene->GetRenderingObjects())
 			object.second->Update(gameTime);
 
         UpdateImGui();
@@ -306,6 +322,9 @@ namespace EveryRay_Core {
 		if (ImGui::Button("GBuffer") && mGBuffer)
 			mGBuffer->Config();
 
+		if (ImGui::Button("GPU Culler") && mGPUCuller)
+			mGPUCuller->Config();
+
         if (ImGui::Button("Illumination") && mIllumination)
 			mIllumination->Config();
 
@@ -326,6 +345,28 @@ namespace EveryRay_Core {
 			}
 
 			ImGui::SliderFloat("Shadow Transition Scale", &mShadowTransitionScale, 0.0f, 0.6f);
+
+			ImGui::Checkbox("Fit cascades to receivers", &mFitShadowCascadesToReceivers);
+			ImGui::Checkbox("Cache distant cascades", &mCacheShadowCascades);
+			ImGui::Checkbox("Show cascades' boxes", &mDrawShadowCascadesGizmos);
+			for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+			{
+				ImGui::Text("Cascade %d - Texel: %f, Re-fits: %d, Renders: %d%s", i, mShadowMapper->GetCascadeTexelSize(i), mShadowMapper->GetCascadeRefitsCount(i),
+					mShadowMapper->GetCascadeRendersCount(i), mShadowMapper->IsCascadeCached(i) ? (mShadowMapper->IsCascadeRendered(i) ? " (cached, rendered)" : " (cached)") : "");
+			}
+			if (ImGui::Button("Run stability test"))
+				ER_SelfTests::Run(ER_SELF_TEST_SHADOW_CASCADES, mShadowStabilityTestResult);
+			if (!mShadowStabilityTestResult.empty())
+				ImGui::Text("%s", mShadowStabilityTestResult.c_str());
+		}
+
+		if (ImGui::CollapsingHeader("Debug renderer"))
+		{
+			ImGui::Text("Lines: %d (dropped: %d), draws: 1", mDebugRenderer->GetLastFrameLinesCount(), mDebugRenderer->GetLastFrameDroppedLinesCount());
+			if (ImGui::Button("Run benchmark (AABBs of 20000 instances)"))
+				ER_SelfTests::Run(ER_SELF_TEST_DEBUG_RENDERER, mDebugRendererBenchmarkResult);
+			if (!mDebugRendererBenchmarkResult.empty())
+				ImGui::Text("%s", mDebugRendererBenchmarkResult.c_str());
 		}
 
 		//TODO remove from here
@@ -336,6 +377,20 @@ namespace EveryRay_Core {
 			ImGui::SliderFloat("Wind frequency", &mWindFrequency, 0.0f, 100.0f);
 		}
 
+		if (ImGui::CollapsingHeader("Async Compute"))
+		{
+			if (mIsAsyncComputeSupported)
+				ImGui::Checkbox("Use compute queue", &mUseAsyncCompute);
+			else
+				ImGui::Text("Compute queue is not supported by the RHI");
+			ImGui::Text("%s", mAsyncComputeScheduler->GetScheduleString().c_str());
+
+			if (ImGui::Button("Run scheduler self-test"))
+				ER_SelfTests::Run(ER_SELF_TEST_ASYNC_COMPUTE_SCHEDULER, mAsyncComputeSelfTestResult);
+			if (!mAsyncComputeSelfTestResult.empty())
+				ImGui::Text("%s", mAsyncComputeSelfTestResult.c_str());
+		}
+
 		//TODO shadow mapper config
 		//TODO skybox config
 
@@ -344,19 +399,96 @@ namespace EveryRay_Core {
 		
     }
 
+	// Declares the passes of Draw() with the resources they share, estimated costs are rough numbers for a 1080p frame.
+	// Volumetric clouds mix graphics and compute passes, so they stay on the graphics queue.
+	void ER_Sandbox::InitializeAsyncComputeSchedule(ER_RHI* rhi)
+	{
+		mAsyncComputeScheduler = new ER_AsyncComputeScheduler();
+		mIsAsyncComputeSupported = rhi->IsAsyncComputeSupported();
+
+		const int culledInstances = mAsyncComputeScheduler->AddResource("Culled instances");
+		const int gbuffer = mAsyncComputeScheduler->AddResource("GBuffer");
+		const int shadowMap = mAsyncComputeScheduler->AddResource("Shadow map", mShadowMapper->GetShadowTexture(0));
+		const int fogNoise = mAsyncComputeScheduler->AddResource("Fog blue noise", mVolumetricFog->GetBlueNoiseTexture());
+		const int fogInjection0 = mAsyncComputeScheduler->AddResource("Fog injection volume #0", mVolumetricFog->GetTempVoxelInjectionTexture(0));
+		const int fogInjection1 = mAsyncComputeScheduler->AddResource("Fog injection volume #1", mVolumetricFog->GetTempVoxelInjectionTexture(1));
+		const int fogVolume = mAsyncComputeScheduler->AddResource("Fog volume", mVolumetricFog->GetVoxelFogTexture());
+		const int globalIllumination = mAsyncComputeScheduler->AddResource("Global illumination");
+		const int localIllumination = mAsyncComputeScheduler->AddResource("Local illumination", mIllumination->GetLocalIlluminationRT());
+		const int finalIllumination = mAsyncComputeScheduler->AddResource("Final illumination");
+		const int clouds = mAsyncComputeScheduler->AddResource("Clouds");
+
+		mAsyncComputeScheduler->AddPass("GPU Culling", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.2f, {}, { culledInstances });
+		mAsyncComputeScheduler->AddPass("GBuffer", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 2.0f, { culledInstances }, { gbuffer });
+		mAsyncComputeScheduler->AddPass("Shadow Maps", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.5f, { culledInstances }, { shadowMap });
+		mAsyncComputeScheduler->AddPass("Volumetric Fog", ER_ASYNC_COMPUTE_PASS_ASYNC_COMPUTE, 0.8f, { shadowMap, fogNoise }, { fogInjection0, fogInjection1, fogVolume });
+		mAsyncComputeScheduler->AddPass("Global Illumination", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { gbuffer, shadowMap }, { globalIllumination });
+		mAsyncComputeScheduler->AddPass("Local Illumination", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.2f, { gbuffer, shadowMap, globalIllumination }, { localIllumination });
+		mAsyncComputeScheduler->AddPass("Composite Illumination", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 0.2f, { localIllumination, globalIllumination }, { finalIllumination });
+		mAsyncComputeScheduler->AddPass("Volumetric Clouds", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f, { gbuffer }, { clouds });
+		const int postProcessing = mAsyncComputeScheduler->AddPass("Post Processing", ER_ASYNC_COMPUTE_PASS_GRAPHICS, 1.0f,
+			{ gbuffer, finalIllumination, fogVolume, clouds }, { finalIllumination });
+		assert(postProcessing == ER_SANDBOX_PASS_POST_PROCESSING);
+	}
+
+	void ER_Sandbox::BeginScheduledPass(ER_RHI* rhi, ER_SandboxScheduledPass aPass)
+	{
+		const ER_AsyncComputePass& pass = mAsyncComputeScheduler->GetPass(aPass);
+		if (pass.WaitForPass > -1)
+			rhi->WaitForQueueFence(pass.IsOnComputeQueue, mScheduledPassFenceValues[pass.WaitForPass]);
+		if (pass.IsOnComputeQueue)
+			rhi->BeginComputeCommandList(pass.ComputeCommandListIndex);
+	}
+
+	void ER_Sandbox::EndScheduledPass(ER_RHI* rhi, ER_SandboxScheduledPass aPass)
+	{
+		const ER_AsyncComputePass& pass = mAsyncComputeScheduler->GetPass(aPass);
+		for (auto& release : pass.Releases)
+		{
+			if (ER_RHI_GPUResource* resource = mAsyncComputeScheduler->GetResource(release.Resource))
+				rhi->ReleaseResourcesToQueue({ resource }, release.State, pass.IsOnComputeQueue);
+		}
+
+		if (pass.IsOnComputeQueue)
+		{
+			rhi->EndComputeCommandList(pass.ComputeCommandListIndex);
+			rhi->ExecuteCommandLists(pass.ComputeCommandListIndex, true);
+		}
+
+		if (pass.Signals)
+			mScheduledPassFenceValues[aPass] = rhi->SignalQueueFence(pass.IsOnComputeQueue);
+	}
+
 	void ER_Sandbox::Draw(ER_Core& game, const ER_CoreTime& gameTime)
 	{
 		ER_RHI* rhi = game.GetRHI();
 		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+		const bool useComputeQueue = mIsAsyncComputeSupported && mUseAsyncCompute;
+		if (!mIsScheduled || mIsScheduledWithComputeQueue != useComputeQueue)
+		{
+			mAsyncComputeScheduler->Schedule(useComputeQueue);
+			assert(mAsyncComputeScheduler->Validate().empty());
+			mIsScheduledWithComputeQueue = useComputeQueue;
+			mIsScheduled = true;
+		}
+		for (auto& release : mAsyncComputeScheduler->GetFrameBeginReleases())
+		{
+			if (ER_RHI_GPUResource* resource = mAsyncComputeScheduler->GetResource(release.Resource))
+				rhi->ReleaseResourcesToQueue({ resource }, release.State, false);
+		}
 		
 		#pragma region GPU_CULLING
 		rhi->BeginEventTag("EveryRay: GPU Culling");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_GPU_CULLING);
 		mGPUCuller->PerformCull(mScene);
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_GPU_CULLING);
 		rhi->EndEventTag();
 #pragma endregion
 
 		#pragma region DRAW_GBUFFER
 		rhi->BeginEventTag("EveryRay: GBuffer");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_GBUFFER);
 		{
 			mGBuffer->Start();
 
@@ -382,18 +514,33 @@ namespace EveryRay_Core {
 
 			mGBuffer->End();
 		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_GBUFFER);
 		rhi->EndEventTag();
 #pragma endregion
 		
 		#pragma region DRAW_SHADOWS
 		rhi->BeginEventTag("EveryRay: Shadow Maps");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_SHADOWS);
 		{
 			mShadowMapper->Draw(mScene, mTerrain);
 		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_SHADOWS);
+		rhi->EndEventTag();
+#pragma endregion
+
+		// only needs the shadow map, so that it can overlap the illumination passes on the compute queue
+		#pragma region DRAW_VOLUMETRIC_FOG
+		rhi->BeginEventTag("EveryRay: Volumetric Fog");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_VOLUMETRIC_FOG);
+		{
+			mVolumetricFog->Draw();
+		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_VOLUMETRIC_FOG);
 		rhi->EndEventTag();
 #pragma endregion
 		
 		#pragma region DRAW_GLOBAL_ILLUMINATION
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_GLOBAL_ILLUMINATION);
 		rhi->BeginEventTag("EveryRay: Compute/load light probes");
 		{
 			// compute static GI (load probes if they exist on disk, otherwise - compute them)
@@ -401,12 +548,12 @@ namespace EveryRay_Core {
 				if (mScene->HasLightProbesSupport() && !mLightProbesManager->AreProbesReady())
 				{
 					game.CPUProfiler()->BeginCPUTime("Compute or load light probes");
-					mLightProbesManager->ComputeOrLoadLocalProbes(game, mScene->objects, mSkybox);
-					mLightProbesManager->ComputeOrLoadGlobalProbes(game, mScene->objects, mSkybox);
+					mLightProbesManager->ComputeOrLoadLocalProbes(game, mScene->GetRenderingObjects(), mSkybox);
+					mLightProbesManager->ComputeOrLoadGlobalProbes(game, mScene->GetRenderingObjects(), mSkybox);
 					game.CPUProfiler()->EndCPUTime("Compute or load light probes");
 				}
 				else if (!mLightProbesManager->IsEnabled() && !mLightProbesManager->AreGlobalProbesReady())
-					mLightProbesManager->ComputeOrLoadGlobalProbes(game, mScene->objects, mSkybox);
+					mLightProbesManager->ComputeOrLoadGlobalProbes(game, mScene->GetRenderingObjects(), mSkybox);
 			}
 		}
 		rhi->EndEventTag();
@@ -417,9 +564,11 @@ namespace EveryRay_Core {
 			mIllumination->DrawDynamicGlobalIllumination(mGBuffer, gameTime);
 		}
 		rhi->EndEventTag();
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_GLOBAL_ILLUMINATION);
 #pragma endregion
 
 		#pragma region DRAW_LOCAL_ILLUMINATION
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_LOCAL_ILLUMINATION);
 		rhi->BeginEventTag("EveryRay: Local Illumination");
 		{
 			mIllumination->DrawLocalIllumination(mGBuffer, mSkybox);
@@ -438,7 +587,7 @@ namespace EveryRay_Core {
 #pragma endregion
 
 		#pragma region DRAW_DEBUG_GIZMOS
-		// TODO: consider moving all debug gizmos to a separate debug renderer system
+		// lines of all systems are batched by the debug renderer (one draw), proxy models are still meshes
 		if (ER_Utility::IsEditorMode)
 		{
 			rhi->BeginEventTag("EveryRay: Debug gizmos");
@@ -450,58 +599,66 @@ namespace EveryRay_Core {
 				rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_LINELIST);
 				ER_RHI_GPURootSignature* debugGizmoRootSignature = mScene->GetStandardMaterialRootSignature(ER_MaterialHelper::basicColorMaterialName);
 				rhi->SetRootSignature(debugGizmoRootSignature);
-				{
-					mIllumination->DrawDebugGizmos(localRT, mGBuffer->GetDepth(), debugGizmoRootSignature);
-					mDirectionalLight->DrawProxyModel(localRT, mGBuffer->GetDepth(), gameTime, debugGizmoRootSignature);
-					if (mTerrain)
-						mTerrain->DrawDebugGizmos(localRT, mGBuffer->GetDepth(), debugGizmoRootSignature);
-					if (mFoliageSystem)
-						mFoliageSystem->DrawDebugGizmos(localRT, mGBuffer->GetDepth(), debugGizmoRootSignature);
-					if (mPostProcessingStack)
-						mPostProcessingStack->DrawPostEffectsVolumesDebugGizmos(localRT, mGBuffer->GetDepth(), debugGizmoRootSignature);
-					for (auto& it = mScene->objects.begin(); it != mScene->objects.end(); it++)
-						it->second->DrawAABB(localRT, mGBuffer->GetDepth(), debugGizmoRootSignature);
-				}
+				mDirectionalLight->DrawProxyModel(localRT, mGBuffer->GetDepth(), gameTime, debugGizmoRootSignature);
+
+				mIllumination->DrawDebugGizmos(mDebugRenderer);
+				if (mTerrain)
+					mTerrain->DrawDebugGizmos(mDebugRenderer);
+				if (mFoliageSystem)
+					mFoliageSystem->DrawDebugGizmos(mDebugRenderer);
+				if (mPostProcessingStack)
+					mPostProcessingStack->DrawPostEffectsVolumesDebugGizmos(mDebugRenderer);
+				if (mDrawShadowCascadesGizmos)
+					mShadowMapper->DrawDebugGizmos(mDebugRenderer);
+				for (auto& it = mScene->GetRenderingObjects().begin(); it != mScene->GetRenderingObjects().end(); it++)
+					it->second->DrawAABB(mDebugRenderer);
+				mDebugRenderer->Draw(localRT, mGBuffer->GetDepth());
+
 				rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 			}
 			rhi->EndEventTag();
 		}
+		else
+			mDebugRenderer->Clear();
 #pragma endregion
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_LOCAL_ILLUMINATION);
 		
 		// combine the results of local and global illumination
 		rhi->BeginEventTag("EveryRay: Composite Illumination");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_COMPOSITE_ILLUMINATION);
 		{
 			mIllumination->CompositeTotalIllumination();
 		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_COMPOSITE_ILLUMINATION);
 		rhi->EndEventTag();
 
-		#pragma region DRAW_VOLUMETRIC_FOG
-		rhi->BeginEventTag("EveryRay: Volumetric Fog");
-		{
-			mVolumetricFog->Draw();
-		}
-		rhi->EndEventTag();
-#pragma endregion
-
 		#pragma region DRAW_VOLUMETRIC_CLOUDS
 		rhi->BeginEventTag("EveryRay: Volumetric Clouds");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_VOLUMETRIC_CLOUDS);
 		{
 			mVolumetricClouds->Draw(gameTime);
 		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_VOLUMETRIC_CLOUDS);
 		rhi->EndEventTag();
 #pragma endregion	
 
 		#pragma region DRAW_POSTPROCESSING
 		rhi->BeginEventTag("EveryRay: Post Processing");
+		BeginScheduledPass(rhi, ER_SANDBOX_PASS_POST_PROCESSING);
 		{
 			auto quad = (ER_QuadRenderer*)game.GetServices().FindService(ER_QuadRenderer::TypeIdClass());
 			mPostProcessingStack->Begin(mIllumination->GetFinalIlluminationRT(), mGBuffer->GetDepth());
 			mPostProcessingStack->DrawEffects(gameTime, quad, mGBuffer, mVolumetricClouds, mVolumetricFog);
 			mPostProcessingStack->End();
 		}
+		EndScheduledPass(rhi, ER_SANDBOX_PASS_POST_PROCESSING);
 		rhi->EndEventTag();
 #pragma endregion
 
+		// compute work of the frame has to be finished with it
+		if (mAsyncComputeScheduler->GetFrameEndWaitForPass() > -1)
+			rhi->WaitForQueueFence(false, mScheduledPassFenceValues[mAsyncComputeScheduler->GetFrameEndWaitForPass()]);
+
 		// reset back to main RT before UI rendering
 		rhi->SetMainRenderTargets();
 
@@ -21,7 +21,25 @@ namespace EveryRay_Core
     class ER_LightProbesManager;
     class ER_PostProcessingStack;
     class ER_QuadRenderer;
+    class ER_DebugRenderer;
     class ER_GPUCuller;
+    class ER_AsyncComputeScheduler;
+    class ER_RHI;
+
+    // Passes of the frame in their submission order (see ER_AsyncComputeScheduler)
+    enum ER_SandboxScheduledPass
+    {
+        ER_SANDBOX_PASS_GPU_CULLING = 0,
+        ER_SANDBOX_PASS_GBUFFER,
+        ER_SANDBOX_PASS_SHADOWS,
+        ER_SANDBOX_PASS_VOLUMETRIC_FOG,
+        ER_SANDBOX_PASS_GLOBAL_ILLUMINATION,
+        ER_SANDBOX_PASS_LOCAL_ILLUMINATION,
+        ER_SANDBOX_PASS_COMPOSITE_ILLUMINATION,
+        ER_SANDBOX_PASS_VOLUMETRIC_CLOUDS,
+        ER_SANDBOX_PASS_POST_PROCESSING,
+        ER_SANDBOX_PASS_COUNT
+    };
 
 	class ER_Sandbox
 	{
@@ -49,11 +67,23 @@ namespace EveryRay_Core
         ER_Terrain* mTerrain = nullptr;
         ER_PostProcessingStack* mPostProcessingStack = nullptr;
         ER_QuadRenderer* mQuadRenderer = nullptr;
+        ER_DebugRenderer* mDebugRenderer = nullptr;
         ER_GPUCuller* mGPUCuller = nullptr;
     private:
         void UpdateImGui();
+        void InitializeAsyncComputeSchedule(ER_RHI* rhi);
+        void BeginScheduledPass(ER_RHI* rhi, ER_SandboxScheduledPass aPass);
+        void EndScheduledPass(ER_RHI* rhi, ER_SandboxScheduledPass aPass);
         std::string mName;
 
+        ER_AsyncComputeScheduler* mAsyncComputeScheduler = nullptr;
+        UINT64 mScheduledPassFenceValues[ER_SANDBOX_PASS_COUNT] = {};
+        bool mIsAsyncComputeSupported = false;
+        bool mUseAsyncCompute = true;
+        bool mIsScheduledWithComputeQueue = false;
+        bool mIsScheduled = false;
+        std::string mAsyncComputeSelfTestResult;
+
         XMMATRIX mDefaultSunRotationMatrix;
 
 		float mWindStrength = 1.0f;
@@ -61,9 +91,14 @@ namespace EveryRay_Core
 		float mWindGustDistance = 1.0f;
 		float mFrustumSplitWeight = 0.04f;
 		float mShadowTransitionScale = 0.1f;
+		bool mFitShadowCascadesToReceivers = true;
+		bool mCacheShadowCascades = true;
+		std::string mShadowStabilityTestResult;
+		std::string mDebugRendererBenchmarkResult;
 
 		//debug
 		bool mDebugShadowCascade = false;
+		bool mDrawShadowCascadesGizmos = false;
 	};
 
 }
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <fstream>
 #include <iostream>
+#include <atomic>
 
 #include "ER_Scene.h"
 #include "ER_Core.h"
@@ -153,7 +154,7 @@ namespace EveryRay_Core
 			// add rendering objects to scene
 			unsigned int numRenderingObjects = mSceneJsonRoot["rendering_objects"].size();
 			for (Json::Value::ArrayIndex i = 0; i != numRenderingObjects; i++) {
-				objects.emplace_back(
+				AddRenderingObject(
 					mSceneJsonRoot["rendering_objects"][i]["name"].asString(), 
 					new ER_RenderingObject(mSceneJsonRoot["rendering_objects"][i]["name"].asString(), i, *mCore, mCamera, 
 						ER_Utility::GetFilePath(mSceneJsonRoot["rendering_objects"][i]["model_path"].asString()),
@@ -161,8 +162,8 @@ namespace EveryRay_Core
 						mSceneJsonRoot["rendering_objects"][i]["castShadow"].asBool())
 				);
 			}
-			std::partition(objects.begin(), objects.end(), [](const ER_SceneObject& obj) {	return obj.second->IsInstanced(); });
-			assert(numRenderingObjects == objects.size());
+			SortRenderingObjects();
+			assert(numRenderingObjects == GetRenderingObjects().size());
 
 #if MULTITHREADED_SCENE_LOAD && !ER_PLATFORM_WIN64_DX12
 			int numThreads = std::thread::hardware_concurrency();
@@ -187,16 +188,16 @@ namespace EveryRay_Core
 
 					for (int j = i * objectsPerThread; j < endRange; j++)
 					{
-						auto objectI = objects.begin();
-						std::advance(objectI, j);
-						LoadRenderingObjectData(objectI->second);
+						LoadRenderingObjectData(GetRenderingObjects()[j].second);
 					}
 				}));
 			}
 			for (auto& t : threads) t.join();
 
-			for (auto& obj : objects)
+			for (auto& obj : GetRenderingObjects())
 				LoadRenderingObjectInstancedData(obj.second);
+
+			LoadTransformHierarchy();
 		}
 
 		{
@@ -207,12 +208,16 @@ namespace EveryRay_Core
 
 	ER_Scene::~ER_Scene()
 	{
-		for (auto& object : objects)
+		for (auto& object : GetRenderingObjects())
 		{
-			object.second->MeshMaterialVariablesUpdateEvent->RemoveAllListeners();
-			DeleteObject(object.second);
+			ER_RenderingObject* renderingObject = object.second;
+			renderingObject->MeshMaterialVariablesUpdateEvent->RemoveAllListeners();
+			DeleteObject(renderingObject);
 		}
-		objects.clear();
+		mRenderingObjectsRegistry.Clear();
+		mDataStore.Clear();
+		mTransformHierarchy.Clear();
+		mTransformNodesObjects.clear();
 
 		for (auto& rs : mStandardMaterialsRootSignatures)
 		{
@@ -282,6 +287,7 @@ namespace EveryRay_Core
 		int i = aObject->GetIndexInScene();
 		bool isInstanced = aObject->IsInstanced();
 		bool hasLODs = false;
+		bool isCompactInstanced = false;
 
 		// load flags
 		{
@@ -332,6 +338,21 @@ namespace EveryRay_Core
 			//if (mSceneJsonRoot["rendering_objects"][i].isMember("triplanar_mapping_sharpness"))
 			//	aObject->SetTriplanarMappedSharpness(mSceneJsonRoot["rendering_objects"][i]["triplanar_mapping_sharpness"].asFloat());
 
+			if (isInstanced && mSceneJsonRoot["rendering_objects"][i].isMember("compact_instances") && mSceneJsonRoot["rendering_objects"][i]["compact_instances"].asBool())
+			{
+				// forward shading uses a shared input layout with world matrices (ER_Illumination) and indirect rendering reads instances from ER_GPUCuller
+				if (aObject->IsForwardShading() || aObject->IsGPUIndirectlyRendered())
+				{
+					std::wstring msg = L"[ER Logger][ER_Scene] Compact instance data is not supported with forward shading or GPU indirect rendering, using full matrices for: " + ER_Utility::ToWideString(aObject->GetName()) + L"\n";
+					ER_OUTPUT_LOG(msg.c_str());
+				}
+				else
+				{
+					aObject->SetCompactInstanceData(true);
+					isCompactInstanced = true;
+				}
+			}
+
 			//fur
 			if (mSceneJsonRoot["rendering_objects"][i].isMember("fur_layers_count"))
 				aObject->SetFurLayersCount(mSceneJsonRoot["rendering_objects"][i]["fur_layers_count"].asInt());
@@ -436,7 +457,7 @@ namespace EveryRay_Core
 						shaderEntries.pixelEntry = mSceneJsonRoot["rendering_objects"][i]["new_materials"][matIndex]["pixelEntry"].asString();
 
 					if (isInstanced) //be careful with the instancing support in shaders of the materials! (i.e., maybe the material does not have instancing entry point/support)
-						shaderEntries.vertexEntry = shaderEntries.vertexEntry + "_instancing";
+						shaderEntries.vertexEntry = shaderEntries.vertexEntry + (isCompactInstanced ? "_instancing_compact" : "_instancing");
 					
 					if (name == ER_MaterialHelper::gbufferMaterialName)
 						aObject->SetInGBuffer(true);
@@ -448,7 +469,7 @@ namespace EveryRay_Core
 						for (int cascade = 0; cascade < NUM_SHADOW_CASCADES; cascade++)
 						{
 							std::string cascadedname = ER_MaterialHelper::shadowMapMaterialName + " " + std::to_string(cascade);
-							aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced), cascadedname);
+							aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, -1, isCompactInstanced), cascadedname);
 						}
 					}
 					else if (name == ER_MaterialHelper::voxelizationMaterialName)
@@ -457,7 +478,7 @@ namespace EveryRay_Core
 						for (int cascade = 0; cascade < NUM_VOXEL_GI_CASCADES; cascade++)
 						{
 							const std::string fullname = ER_MaterialHelper::voxelizationMaterialName + "_" + std::to_string(cascade);
-							aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced), fullname);
+							aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, -1, isCompactInstanced), fullname);
 						}
 					}
 					else if (name == ER_MaterialHelper::furShellMaterialName)
@@ -469,7 +490,7 @@ namespace EveryRay_Core
 							for (int layer = 0; layer < layerCount; layer++)
 							{
 								const std::string fullname = ER_MaterialHelper::furShellMaterialName + "_" + std::to_string(layer);
-								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, layer), fullname);
+								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, layer, isCompactInstanced), fullname);
 								if (rs)
 									mStandardMaterialsRootSignatures.emplace(fullname, rs);
 							}
@@ -486,18 +507,18 @@ namespace EveryRay_Core
 							{
 								shaderEntries.pixelEntry = originalPSEntry + "_DiffuseProbes";
 								newName = "diffuse_" + ER_MaterialHelper::renderToLightProbeMaterialName + "_" + std::to_string(cubemapFaceIndex);
-								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced), newName);
+								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, -1, isCompactInstanced), newName);
 							}
 							//specular
 							{
 								shaderEntries.pixelEntry = originalPSEntry + "_SpecularProbes";
 								newName = "specular_" + ER_MaterialHelper::renderToLightProbeMaterialName + "_" + std::to_string(cubemapFaceIndex);
-								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced), newName);
+								aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, -1, isCompactInstanced), newName);
 							}
 						}
 					}
 					else //other standard materials
-						aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced), name);
+						aObject->LoadMaterial(GetMaterialByName(name, shaderEntries, isInstanced, -1, isCompactInstanced), name);
 				}
 			}
 
@@ -821,7 +842,14 @@ namespace EveryRay_Core
 					if (mSceneJsonRoot["posteffects_volumes"][i].isMember("volume_name"))
 						name = mSceneJsonRoot["posteffects_volumes"][i]["volume_name"].asString();
 
-					pp->AddPostEffectsVolume(transform, values, name);
+					int priority = 0;
+					if (mSceneJsonRoot["posteffects_volumes"][i].isMember("volume_priority"))
+						priority = mSceneJsonRoot["posteffects_volumes"][i]["volume_priority"].asInt();
+					float blendDistance = 0.0f;
+					if (mSceneJsonRoot["posteffects_volumes"][i].isMember("volume_blend_distance"))
+						blendDistance = mSceneJsonRoot["posteffects_volumes"][i]["volume_blend_distance"].asFloat();
+
+					pp->AddPostEffectsVolume(transform, values, name, priority, blendDistance);
 				}
 			}
 		}
@@ -844,6 +872,9 @@ namespace EveryRay_Core
 			assert(pp->GetPostEffectsVolumesCount() == mSceneJsonRoot["posteffects_volumes"].size());
 			for (Json::Value::ArrayIndex i = 0; i != mSceneJsonRoot["posteffects_volumes"].size(); i++)
 			{
+				mSceneJsonRoot["posteffects_volumes"][i]["volume_priority"] = pp->GetPostEffectsVolume(i).priority;
+				mSceneJsonRoot["posteffects_volumes"][i]["volume_blend_distance"] = pp->GetPostEffectsVolume(i).blendDistance;
+
 				Json::Value content(Json::arrayValue);
 				if (mSceneJsonRoot["posteffects_volumes"][i].isMember("volume_transform"))
 				{
@@ -953,30 +984,31 @@ namespace EveryRay_Core
 
 	// We cant do reflection in C++, that is why we check every materials name and create a material out of it (and root-signature if needed)
 	// "layerIndex" is used when we need to render multiple layers/copies of the material and keep track of each index
-	ER_Material* ER_Scene::GetMaterialByName(const std::string& matName, const MaterialShaderEntries& entries, bool instanced, int layerIndex)
+	ER_Material* ER_Scene::GetMaterialByName(const std::string& matName, const MaterialShaderEntries& entries, bool instanced, int layerIndex, bool compactInstanced)
 	{
 		ER_Core* core = GetCore();
 		assert(core);
 		ER_RHI* rhi = core->GetRHI();
 
 		ER_Material* material = nullptr;
+		const unsigned int instanceFlags = (instanced && compactInstanced) ? USE_COMPACT_INSTANCE_DATA : 0;
 
 		if (matName == "BasicColorMaterial")
 			material = new ER_BasicColorMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER /*TODO instanced support*/);
 		else if (matName == "ShadowMapMaterial")
-			material = new ER_ShadowMapMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_ShadowMapMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "GBufferMaterial")
-			material = new ER_GBufferMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_GBufferMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "RenderToLightProbeMaterial")
-			material = new ER_RenderToLightProbeMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_RenderToLightProbeMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "VoxelizationMaterial")
-			material = new ER_VoxelizationMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_GEOMETRY_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_VoxelizationMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_GEOMETRY_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "SnowMaterial")
-			material = new ER_SimpleSnowMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_SimpleSnowMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "FresnelOutlineMaterial")
-			material = new ER_FresnelOutlineMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced);
+			material = new ER_FresnelOutlineMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced);
 		else if (matName == "FurShellMaterial")
-			material = new ER_FurShellMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER, instanced, layerIndex);
+			material = new ER_FurShellMaterial(*core, entries, HAS_VERTEX_SHADER | HAS_PIXEL_SHADER | instanceFlags, instanced, layerIndex);
 		else
 			material = nullptr;
 
@@ -995,16 +1027,175 @@ namespace EveryRay_Core
 			return nullptr;
 	}
 
+	ER_RenderingObjectHandle ER_Scene::AddRenderingObject(const std::string& aName, ER_RenderingObject* aObject)
+	{
+		assert(aObject);
+		ER_RenderingObjectHandle handle = mRenderingObjectsRegistry.Add(aName, aObject);
+		aObject->SetHandle(handle);
+		return handle;
+	}
+
+	// Children of the removed object are detached from the hierarchy (they keep their current world transforms).
+	// Not supposed to run every frame (i.e. from the editor): waits for the GPU before the object's resources are released.
+	bool ER_Scene::RemoveRenderingObject(const ER_RenderingObjectHandle& aHandle)
+	{
+		ER_RenderingObject* object = mRenderingObjectsRegistry.Get(aHandle);
+		if (!object)
+			return false;
+
+		if (object->GetTransformNode() >= 0)
+		{
+			mTransformHierarchy.RemoveNode(object->GetTransformNode()); // removes the whole subtree
+			for (int node = 0; node < static_cast<int>(mTransformNodesObjects.size()); node++)
+			{
+				if (mTransformHierarchy.IsValidNode(node) || !mTransformNodesObjects[node].IsValid())
+					continue;
+				if (ER_RenderingObject* nodeObject = GetRenderingObject(mTransformNodesObjects[node]))
+					nodeObject->SetTransformNode(-1);
+				mTransformNodesObjects[node] = ER_RenderingObjectHandle();
+			}
+		}
+
+		object->ReleaseDataStore(mDataStore);
+		mRenderingObjectsRegistry.Remove(aHandle);
+		SortRenderingObjects(); // the last object was swapped into the removed one's place
+
+		mCore->GetRHI()->WaitForGpuOnGraphicsFence(); // previous frames might still use the object's buffers
+		object->MeshMaterialVariablesUpdateEvent->RemoveAllListeners();
+		DeleteObject(object);
+		return true;
+	}
+
+	void ER_Scene::SortRenderingObjects()
+	{
+		mRenderingObjectsRegistry.Partition([](ER_RenderingObject* aObject) { return aObject->IsInstanced(); });
+	}
+
 	ER_RenderingObject* ER_Scene::FindRenderingObjectByName(const std::string& aName)
 	{
-		for (auto& sceneObj : objects)
+		return mRenderingObjectsRegistry.Get(mRenderingObjectsRegistry.Find(aName));
+	}
+
+	// Builds parent/child links between rendering objects from their optional "parent" field (name of another non-instanced object).
+	// Transforms in the scene file stay in world space: local transforms are derived from them here and are not saved.
+	void ER_Scene::LoadTransformHierarchy()
+	{
+		mTransformHierarchy.Clear();
+		mTransformNodesObjects.clear();
+
+		std::unordered_map<std::string, std::string> parents; // child -> parent
+		unsigned int numRenderingObjects = mSceneJsonRoot["rendering_objects"].size();
+		for (Json::Value::ArrayIndex i = 0; i != numRenderingObjects; i++)
 		{
-			if (sceneObj.first == aName)
-				return sceneObj.second;
-			else
-				continue;
+			if (mSceneJsonRoot["rendering_objects"][i].isMember("parent"))
+				parents.emplace(mSceneJsonRoot["rendering_objects"][i]["name"].asString(), mSceneJsonRoot["rendering_objects"][i]["parent"].asString());
+		}
+		if (parents.empty())
+			return;
+
+		std::unordered_set<std::string> inProgress; // objects whose parents are being added (the current chain of parents)
+		for (auto& child : parents)
+			AddTransformHierarchyNode(child.first, parents, inProgress);
+
+		// world transforms are already correct on load, so the results of this update are not applied to the objects
+		mTransformHierarchy.Update();
+	}
+
+	// Parents are added before their children; an object that is reached again while its own chain of parents is being added closes a cycle
+	int ER_Scene::AddTransformHierarchyNode(const std::string& aName, const std::unordered_map<std::string, std::string>& aParents, std::unordered_set<std::string>& aInProgress)
+	{
+		ER_RenderingObject* object = FindRenderingObjectByName(aName);
+		if (!object || object->IsInstanced())
+		{
+			std::wstring msg = L"[ER Logger][ER_Scene] Rendering object can not be in the transform hierarchy (not found or instanced): " + ER_Utility::ToWideString(aName) + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+			return -1;
+		}
+		if (object->GetTransformNode() >= 0)
+			return object->GetTransformNode();
+		if (aInProgress.find(aName) != aInProgress.end())
+		{
+			std::wstring msg = L"[ER Logger][ER_Scene] Cycle in parents of rendering objects, ignoring the link back to: " + ER_Utility::ToWideString(aName) + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+			return -1;
 		}
 
-		return nullptr;
+		int parentNode = -1;
+		XMMATRIX parentWorldInverse = XMMatrixIdentity();
+		auto parentIt = aParents.find(aName);
+		if (parentIt != aParents.end())
+		{
+			aInProgress.insert(aName);
+			parentNode = AddTransformHierarchyNode(parentIt->second, aParents, aInProgress);
+			aInProgress.erase(aName);
+			if (parentNode >= 0)
+				parentWorldInverse = XMMatrixInverse(nullptr, FindRenderingObjectByName(parentIt->second)->GetTransformationMatrix());
+		}
+
+		XMFLOAT4X4 localTransform;
+		XMStoreFloat4x4(&localTransform, XMMatrixMultiply(object->GetTransformationMatrix(), parentWorldInverse));
+		const int node = mTransformHierarchy.AddNode(parentNode, localTransform);
+		object->SetTransformNode(node);
+		if (node >= static_cast<int>(mTransformNodesObjects.size()))
+			mTransformNodesObjects.resize(node + 1);
+		mTransformNodesObjects[node] = object->GetHandle();
+		return node;
+	}
+
+	void ER_Scene::UpdateDataStore(ER_Camera* aCamera)
+	{
+		assert(aCamera);
+
+		// propagate transforms from parents that were moved (in the previous frame) to their children
+		mTransformHierarchy.Update();
+		for (int node : mTransformHierarchy.GetChangedNodes())
+		{
+			ER_RenderingObject* object = GetRenderingObject(mTransformNodesObjects[node]);
+			if (object)
+				object->SetTransformationMatrixFromHierarchy(mTransformHierarchy.GetWorldTransform(node));
+		}
+
+		for (auto& object : GetRenderingObjects())
+			object.second->SyncDataStore(mDataStore);
+
+		mDataStore.UpdateBounds();
+
+		if (ER_Utility::IsMainCameraCPUFrustumCulling)
+			mDataStore.CullFrustum(aCamera->GetFrustum().Planes());
+		else
+			mDataStore.ResetCulling();
+
+		mDataStore.UpdateLODs(aCamera->Position(), ER_Utility::DistancesLOD);
+
+		BinInstances();
+	}
+
+	// Groups visible instances of (non-indirect) instanced objects by LOD for their instance buffers: every object only reads the data store
+	// and writes its own arrays, so objects are distributed between the scene's worker pool threads (one task per object).
+	void ER_Scene::BinInstances()
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		mBinnedObjects.clear();
+		mBinnedInstancesCount = 0;
+		for (auto& object : GetRenderingObjects())
+		{
+			if (object.second->IsInstanceBinningNeeded())
+			{
+				mBinnedObjects.push_back(object.second);
+				mBinnedInstancesCount += object.second->GetInstanceCount();
+			}
+		}
+
+		const int objectsCount = static_cast<int>(mBinnedObjects.size());
+		int numThreads = 1;
+		if (mBinnedInstancesCount >= ER_SCENE_INSTANCE_BINNING_PARALLEL_MIN_INSTANCES)
+			numThreads = std::min(mWorkerPool.GetMaxThreadsCount(), objectsCount);
+
+		mWorkerPool.Run(objectsCount, [this](int aObjectIndex) { mBinnedObjects[aObjectIndex]->BinInstances(mDataStore); }, numThreads);
+		mInstanceBinningThreadsCount = numThreads;
+
+		auto endTime = std::chrono::high_resolution_clock::now();
+		mInstanceBinningTimeMs = static_cast<float>(std::chrono::duration<double, std::milli>(endTime - startTime).count());
 	}
 }
\ No newline at end of file
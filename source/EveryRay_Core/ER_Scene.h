@@ -4,15 +4,21 @@
 #include "ER_Camera.h"
 #include "ER_ModelMaterial.h"
 #include "ER_Material.h"
+#include "ER_RenderingObjectRegistry.h"
+#include "ER_SceneDataStore.h"
+#include "ER_TransformHierarchy.h"
+#include "ER_WorkerPool.h"
 
 #include "..\JsonCpp\include\json\json.h"
+#include <unordered_set>
+
+#define ER_SCENE_INSTANCE_BINNING_PARALLEL_MIN_INSTANCES 32768 // below that, waking the worker threads costs more than binning
 
 namespace EveryRay_Core
 {
 	class ER_RenderingObject;
 	class ER_DirectionalLight;
 	class ER_Foliage;
-	using ER_SceneObject = std::pair<std::string, ER_RenderingObject*>;
 
 	class ER_Scene : public ER_CoreComponent
 	{
@@ -21,10 +27,32 @@ namespace EveryRay_Core
 		~ER_Scene();
 
 		void SaveRenderingObjectsTransforms();
-		ER_RenderingObject* FindRenderingObjectByName(const std::string& aName);
-		std::vector<ER_SceneObject> objects;
 
-		ER_Material* GetMaterialByName(const std::string& matName, const MaterialShaderEntries& entries, bool instanced, int layerIndex = -1);
+		// The scene owns added objects. Removal releases the object's registry slot, data store entries and transform hierarchy node, then deletes it.
+		ER_RenderingObjectHandle AddRenderingObject(const std::string& aName, ER_RenderingObject* aObject);
+		bool RemoveRenderingObject(const ER_RenderingObjectHandle& aHandle);
+		ER_RenderingObject* FindRenderingObjectByName(const std::string& aName);
+		ER_RenderingObjectHandle FindRenderingObjectHandle(const std::string& aName) const { return mRenderingObjectsRegistry.Find(aName); }
+		ER_RenderingObject* GetRenderingObject(const ER_RenderingObjectHandle& aHandle) const { return mRenderingObjectsRegistry.Get(aHandle); }
+		const ER_RenderingObjectRegistry& GetRenderingObjectsRegistry() const { return mRenderingObjectsRegistry; }
+		// (name, object) of all objects, a view over the registry's dense arrays (instanced objects first, see SortRenderingObjects())
+		const std::vector<ER_SceneObject>& GetRenderingObjects() const { return mRenderingObjectsRegistry.GetEntries(); }
+		void SortRenderingObjects();
+
+		// Propagates the transform hierarchy, syncs objects' transforms to the data store and runs its bulk passes (bounds, CPU frustum culling, LODs); call before objects' Update()
+		void UpdateDataStore(ER_Camera* aCamera);
+		ER_SceneDataStore& GetDataStore() { return mDataStore; }
+		const ER_SceneDataStore& GetDataStore() const { return mDataStore; }
+		ER_TransformHierarchy& GetTransformHierarchy() { return mTransformHierarchy; }
+		ER_WorkerPool& GetWorkerPool() const { return mWorkerPool; } // for per-frame parallel loops over the scene's data (created once with the scene)
+
+		// Stats of the last ER_RenderingObject::BinInstances() pass (run at the end of UpdateDataStore())
+		float GetInstanceBinningTime() const { return mInstanceBinningTimeMs; }
+		UINT GetInstanceBinningObjectsCount() const { return static_cast<UINT>(mBinnedObjects.size()); }
+		UINT GetInstanceBinningInstancesCount() const { return mBinnedInstancesCount; }
+		int GetInstanceBinningThreadsCount() const { return mInstanceBinningThreadsCount; }
+
+		ER_Material* GetMaterialByName(const std::string& matName, const MaterialShaderEntries& entries, bool instanced, int layerIndex = -1, bool compactInstanced = false);
 		ER_RHI_GPURootSignature* GetStandardMaterialRootSignature(const std::string& materialName);
 		
 		ER_Camera& GetCamera() { return mCamera; }
@@ -59,8 +87,21 @@ namespace EveryRay_Core
 		void CreateStandardMaterialsRootSignatures();
 		void LoadRenderingObjectData(ER_RenderingObject* aObject);
 		void LoadRenderingObjectInstancedData(ER_RenderingObject* aObject);
+		void LoadTransformHierarchy();
+		int AddTransformHierarchyNode(const std::string& aName, const std::unordered_map<std::string, std::string>& aParents, std::unordered_set<std::string>& aInProgress);
+		void BinInstances();
 
 		std::map<std::string, ER_RHI_GPURootSignature*> mStandardMaterialsRootSignatures;
+		ER_RenderingObjectRegistry mRenderingObjectsRegistry;
+		ER_SceneDataStore mDataStore;
+		ER_TransformHierarchy mTransformHierarchy; // only for objects with parents/children
+		std::vector<ER_RenderingObjectHandle> mTransformNodesObjects; // by node id
+
+		mutable ER_WorkerPool mWorkerPool; // running jobs does not change the scene
+		std::vector<ER_RenderingObject*> mBinnedObjects; // instanced objects binned in the last frame (tasks of the worker pool, capacity is kept between frames)
+		UINT mBinnedInstancesCount = 0;
+		int mInstanceBinningThreadsCount = 0;
+		float mInstanceBinningTimeMs = 0.0f;
 
 		ER_Camera& mCamera;
 		XMFLOAT3 mCameraPosition;
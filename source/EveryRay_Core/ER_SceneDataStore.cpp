@@ -0,0 +1,434 @@
+#include "stdafx.h"
+
+#include "ER_SceneDataStore.h"
+
+#if ER_SCENE_DATA_STORE_USE_SIMD
+#include <emmintrin.h>
+#endif
+
+namespace EveryRay_Core
+{
+	static const XMFLOAT4X4 IdentityMatrix4X4(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	ER_SceneDataStore::ER_SceneDataStore()
+	{
+	}
+
+	ER_SceneDataStore::~ER_SceneDataStore()
+	{
+	}
+
+	void ER_SceneDataStore::Resize(int aCount)
+	{
+		mCount = aCount;
+		const size_t paddedCount = static_cast<size_t>((aCount + 3) & ~3);
+		if (paddedCount <= mFlags.size())
+			return;
+
+		for (auto* stream : { &mMinX, &mMinY, &mMinZ, &mMaxX, &mMaxY, &mMaxZ, &mPositionX, &mPositionY, &mPositionZ, &mDistancesSqr })
+			stream->resize(paddedCount, 0.0f);
+		mLODs.resize(paddedCount, -1);
+		mFlags.resize(paddedCount, 0);
+		mWorldMatrices.resize(paddedCount, IdentityMatrix4X4);
+		mLocalCenters.resize(paddedCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+		mLocalExtents.resize(paddedCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	}
+
+	int ER_SceneDataStore::Allocate(int aCount, const ER_AABB& aLocalAABB)
+	{
+		assert(aCount > 0);
+
+		int first = -1;
+		for (size_t i = 0; i < mFreeRanges.size(); i++)
+		{
+			if (mFreeRanges[i].second < aCount)
+				continue;
+
+			first = mFreeRanges[i].first;
+			mFreeRanges[i].first += aCount;
+			mFreeRanges[i].second -= aCount;
+			if (mFreeRanges[i].second == 0)
+				mFreeRanges.erase(mFreeRanges.begin() + i);
+			break;
+		}
+		if (first < 0)
+		{
+			first = mCount;
+			Resize(mCount + aCount);
+		}
+
+		for (int i = first; i < first + aCount; i++)
+		{
+			mFlags[i] = SCENE_DATA_ENTRY_ALIVE | SCENE_DATA_ENTRY_DIRTY;
+			mLODs[i] = 0;
+			mWorldMatrices[i] = IdentityMatrix4X4;
+		}
+		SetLocalAABB(first, aCount, aLocalAABB);
+		mAliveCount += aCount;
+		return first;
+	}
+
+	void ER_SceneDataStore::Release(int aFirst, int aCount)
+	{
+		assert(aFirst >= 0 && aFirst + aCount <= mCount);
+		for (int i = aFirst; i < aFirst + aCount; i++)
+			mFlags[i] = 0;
+		mFreeRanges.push_back(std::make_pair(aFirst, aCount));
+		mAliveCount -= aCount;
+		mBoundsVersion++;
+	}
+
+	void ER_SceneDataStore::Clear()
+	{
+		mCount = 0;
+		mAliveCount = 0;
+		mFreeRanges.clear();
+		std::fill(mFlags.begin(), mFlags.end(), 0);
+		mBoundsVersion++;
+	}
+
+	void ER_SceneDataStore::SetWorldMatrix(int aEntry, const XMFLOAT4X4& aWorld)
+	{
+		assert(aEntry >= 0 && aEntry < mCount);
+		mWorldMatrices[aEntry] = aWorld;
+		mFlags[aEntry] |= SCENE_DATA_ENTRY_DIRTY;
+	}
+
+	void ER_SceneDataStore::SetWorldMatrix(int aEntry, const XMMATRIX& aWorld)
+	{
+		assert(aEntry >= 0 && aEntry < mCount);
+		XMStoreFloat4x4(&mWorldMatrices[aEntry], aWorld);
+		mFlags[aEntry] |= SCENE_DATA_ENTRY_DIRTY;
+	}
+
+	void ER_SceneDataStore::SetLocalAABB(int aFirst, int aCount, const ER_AABB& aLocalAABB)
+	{
+		const XMFLOAT3 center = XMFLOAT3((aLocalAABB.first.x + aLocalAABB.second.x) * 0.5f, (aLocalAABB.first.y + aLocalAABB.second.y) * 0.5f, (aLocalAABB.first.z + aLocalAABB.second.z) * 0.5f);
+		const XMFLOAT3 extent = XMFLOAT3((aLocalAABB.second.x - aLocalAABB.first.x) * 0.5f, (aLocalAABB.second.y - aLocalAABB.first.y) * 0.5f, (aLocalAABB.second.z - aLocalAABB.first.z) * 0.5f);
+		for (int i = aFirst; i < aFirst + aCount; i++)
+		{
+			mLocalCenters[i] = center;
+			mLocalExtents[i] = extent;
+			mFlags[i] |= SCENE_DATA_ENTRY_DIRTY;
+		}
+	}
+
+	// World AABB of a transformed local AABB without transforming its 8 corners:
+	// center is transformed as a point, extent by the absolute values of the rotation/scale part (exact for affine transforms)
+	void ER_SceneDataStore::UpdateBounds()
+	{
+		const unsigned char dirtyAlive = SCENE_DATA_ENTRY_ALIVE | SCENE_DATA_ENTRY_DIRTY;
+		bool isChanged = false;
+		for (int i = 0; i < mCount; i++)
+		{
+			if ((mFlags[i] & dirtyAlive) != dirtyAlive)
+				continue;
+			isChanged = true;
+
+			const XMFLOAT4X4& m = mWorldMatrices[i];
+			const XMFLOAT3& c = mLocalCenters[i];
+			const XMFLOAT3& e = mLocalExtents[i];
+
+			const float centerX = c.x * m._11 + c.y * m._21 + c.z * m._31 + m._41;
+			const float centerY = c.x * m._12 + c.y * m._22 + c.z * m._32 + m._42;
+			const float centerZ = c.x * m._13 + c.y * m._23 + c.z * m._33 + m._43;
+			const float extentX = e.x * fabs(m._11) + e.y * fabs(m._21) + e.z * fabs(m._31);
+			const float extentY = e.x * fabs(m._12) + e.y * fabs(m._22) + e.z * fabs(m._32);
+			const float extentZ = e.x * fabs(m._13) + e.y * fabs(m._23) + e.z * fabs(m._33);
+
+			mMinX[i] = centerX - extentX; mMaxX[i] = centerX + extentX;
+			mMinY[i] = centerY - extentY; mMaxY[i] = centerY + extentY;
+			mMinZ[i] = centerZ - extentZ; mMaxZ[i] = centerZ + extentZ;
+			mPositionX[i] = m._41;
+			mPositionY[i] = m._42;
+			mPositionZ[i] = m._43;
+			mFlags[i] &= ~SCENE_DATA_ENTRY_DIRTY;
+		}
+		if (isChanged)
+			mBoundsVersion++;
+	}
+
+	// Same test as ER_RenderingObject's culling: the AABB is culled if its most "inner" vertex is in front of any plane
+	void ER_SceneDataStore::CullFrustum(const XMFLOAT4* aPlanes)
+	{
+		assert(aPlanes);
+
+		const float* vertexX[6];
+		const float* vertexY[6];
+		const float* vertexZ[6];
+		for (int p = 0; p < 6; p++)
+		{
+			vertexX[p] = (aPlanes[p].x > 0.0f) ? mMinX.data() : mMaxX.data();
+			vertexY[p] = (aPlanes[p].y > 0.0f) ? mMinY.data() : mMaxY.data();
+			vertexZ[p] = (aPlanes[p].z > 0.0f) ? mMinZ.data() : mMaxZ.data();
+		}
+
+#if ER_SCENE_DATA_STORE_USE_SIMD
+		for (int i = 0; i < mCount; i += 4)
+		{
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_mul_ps(_mm_set1_ps(aPlanes[p].x), _mm_loadu_ps(vertexX[p] + i));
+				distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(aPlanes[p].y), _mm_loadu_ps(vertexY[p] + i)));
+				distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(aPlanes[p].z), _mm_loadu_ps(vertexZ[p] + i)));
+				distance = _mm_add_ps(distance, _mm_set1_ps(aPlanes[p].w));
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(distance, _mm_setzero_ps()));
+			}
+
+			const int mask = _mm_movemask_ps(outside);
+			for (int k = 0; k < 4; k++)
+			{
+				if (mask & (1 << k))
+					mFlags[i + k] |= SCENE_DATA_ENTRY_CULLED;
+				else
+					mFlags[i + k] &= ~SCENE_DATA_ENTRY_CULLED;
+			}
+		}
+#else
+		for (int i = 0; i < mCount; i++)
+		{
+			bool isOutside = false;
+			for (int p = 0; p < 6 && !isOutside; p++)
+			{
+				float distance = aPlanes[p].x * vertexX[p][i];
+				distance = distance + aPlanes[p].y * vertexY[p][i];
+				distance = distance + aPlanes[p].z * vertexZ[p][i];
+				isOutside = distance + aPlanes[p].w > 0.0f;
+			}
+
+			if (isOutside)
+				mFlags[i] |= SCENE_DATA_ENTRY_CULLED;
+			else
+				mFlags[i] &= ~SCENE_DATA_ENTRY_CULLED;
+		}
+#endif
+	}
+
+	void ER_SceneDataStore::ResetCulling()
+	{
+		for (int i = 0; i < mCount; i++)
+			mFlags[i] &= ~SCENE_DATA_ENTRY_CULLED;
+	}
+
+	// LOD is the amount of LOD distances the entry's position is further than (-1 when further than all of them)
+	void ER_SceneDataStore::UpdateLODs(const XMFLOAT3& aCameraPosition, const float* aLODDistances)
+	{
+		assert(aLODDistances);
+
+		float lodDistancesSqr[ER_SCENE_DATA_STORE_LOD_COUNT];
+		for (int lod = 0; lod < ER_SCENE_DATA_STORE_LOD_COUNT; lod++)
+			lodDistancesSqr[lod] = aLODDistances[lod] * aLODDistances[lod];
+
+#if ER_SCENE_DATA_STORE_USE_SIMD
+		const __m128 cameraX = _mm_set1_ps(aCameraPosition.x);
+		const __m128 cameraY = _mm_set1_ps(aCameraPosition.y);
+		const __m128 cameraZ = _mm_set1_ps(aCameraPosition.z);
+		const __m128i one = _mm_set1_epi32(1);
+		ER_ALIGN16 int lods[4];
+		for (int i = 0; i < mCount; i += 4)
+		{
+			const __m128 dx = _mm_sub_ps(cameraX, _mm_loadu_ps(mPositionX.data() + i));
+			const __m128 dy = _mm_sub_ps(cameraY, _mm_loadu_ps(mPositionY.data() + i));
+			const __m128 dz = _mm_sub_ps(cameraZ, _mm_loadu_ps(mPositionZ.data() + i));
+			const __m128 distanceSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			_mm_storeu_ps(mDistancesSqr.data() + i, distanceSqr);
+
+			__m128i lod = _mm_setzero_si128();
+			for (int l = 0; l < ER_SCENE_DATA_STORE_LOD_COUNT; l++)
+				lod = _mm_add_epi32(lod, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(distanceSqr, _mm_set1_ps(lodDistancesSqr[l]))), one));
+			_mm_store_si128(reinterpret_cast<__m128i*>(lods), lod);
+
+			for (int k = 0; k < 4; k++)
+				mLODs[i + k] = static_cast<char>((lods[k] == ER_SCENE_DATA_STORE_LOD_COUNT) ? -1 : lods[k]);
+		}
+#else
+		for (int i = 0; i < mCount; i++)
+		{
+			const float dx = aCameraPosition.x - mPositionX[i];
+			const float dy = aCameraPosition.y - mPositionY[i];
+			const float dz = aCameraPosition.z - mPositionZ[i];
+			const float distanceSqr = (dx * dx + dy * dy) + dz * dz;
+			mDistancesSqr[i] = distanceSqr;
+
+			int lod = 0;
+			for (int l = 0; l < ER_SCENE_DATA_STORE_LOD_COUNT; l++)
+				lod += (distanceSqr > lodDistancesSqr[l]) ? 1 : 0;
+			mLODs[i] = static_cast<char>((lod == ER_SCENE_DATA_STORE_LOD_COUNT) ? -1 : lod);
+		}
+#endif
+	}
+
+#if ER_SCENE_DATA_STORE_USE_SIMD
+	static inline UINT CountBits16(int aMask)
+	{
+		aMask = aMask - ((aMask >> 1) & 0x5555);
+		aMask = (aMask & 0x3333) + ((aMask >> 2) & 0x3333);
+		aMask = (aMask + (aMask >> 4)) & 0x0f0f;
+		return static_cast<UINT>((aMask + (aMask >> 8)) & 0x1f);
+	}
+
+	// bins of 16 entries: LOD, or -1 if the entry is culled or too far
+	static inline __m128i LoadBins16(const char* aLODs, const unsigned char* aFlags, bool aUseDistances, int aLODCount)
+	{
+		const __m128i culledBit = _mm_set1_epi8(SCENE_DATA_ENTRY_CULLED);
+		const __m128i isCulled = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(aFlags)), culledBit), culledBit);
+		const __m128i lods = aUseDistances ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(aLODs)) : _mm_setzero_si128();
+		const __m128i isTooFar = _mm_cmpgt_epi8(lods, _mm_set1_epi8(static_cast<char>(aLODCount - 1)));
+		return _mm_or_si128(lods, _mm_or_si128(isCulled, isTooFar)); // -1 is all bits set
+	}
+#endif
+
+	void ER_SceneDataStore::BinByLOD(int aFirst, int aCount, int aLODCount, UINT* aOutOffsets, UINT* aOutIndices) const
+	{
+		assert(aFirst >= 0 && aFirst + aCount <= mCount);
+		assert(aLODCount > 0 && aLODCount <= ER_SCENE_DATA_STORE_LOD_COUNT);
+		assert(aOutOffsets && aOutIndices);
+
+		const char* lods = mLODs.data() + aFirst;
+		const unsigned char* flags = mFlags.data() + aFirst;
+		const bool useDistances = aLODCount > 1;
+		auto getBin = [&](int i) -> int
+		{
+			if (flags[i] & SCENE_DATA_ENTRY_CULLED)
+				return -1;
+			const int lod = useDistances ? lods[i] : 0;
+			return (lod < aLODCount) ? lod : -1;
+		};
+
+		// counts per LOD
+		UINT counts[ER_SCENE_DATA_STORE_LOD_COUNT] = {};
+		int i = 0;
+#if ER_SCENE_DATA_STORE_USE_SIMD
+		for (; i + 16 <= aCount; i += 16)
+		{
+			const __m128i bins = LoadBins16(lods + i, flags + i, useDistances, aLODCount);
+			for (int lod = 0; lod < aLODCount; lod++)
+				counts[lod] += CountBits16(_mm_movemask_epi8(_mm_cmpeq_epi8(bins, _mm_set1_epi8(static_cast<char>(lod)))));
+		}
+#endif
+		for (; i < aCount; i++)
+		{
+			const int bin = getBin(i);
+			if (bin >= 0)
+				counts[bin]++;
+		}
+
+		// prefix sum
+		UINT cursors[ER_SCENE_DATA_STORE_LOD_COUNT];
+		aOutOffsets[0] = 0;
+		for (int lod = 0; lod < aLODCount; lod++)
+		{
+			cursors[lod] = aOutOffsets[lod];
+			aOutOffsets[lod + 1] = aOutOffsets[lod] + counts[lod];
+		}
+
+		// scatter (blocks without visible entries are skipped)
+		i = 0;
+#if ER_SCENE_DATA_STORE_USE_SIMD
+		ER_ALIGN16 char bins[16];
+		for (; i + 16 <= aCount; i += 16)
+		{
+			const __m128i binsSIMD = LoadBins16(lods + i, flags + i, useDistances, aLODCount);
+			const int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(binsSIMD, _mm_set1_epi8(-1)));
+			if (mask == 0)
+				continue;
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(bins), binsSIMD);
+			for (int k = 0; k < 16; k++)
+			{
+				if (mask & (1 << k))
+					aOutIndices[cursors[static_cast<int>(bins[k])]++] = static_cast<UINT>(i + k);
+			}
+		}
+#endif
+		for (; i < aCount; i++)
+		{
+			const int bin = getBin(i);
+			if (bin >= 0)
+				aOutIndices[cursors[bin]++] = static_cast<UINT>(i);
+		}
+	}
+
+	void ER_SceneDataStore::OverlapAABB(const ER_AABB& aBox, std::vector<UINT64>& aOutBits) const
+	{
+		const size_t wordsCount = static_cast<size_t>(GetOverlapBitsWordsCount());
+		if (aOutBits.size() < wordsCount)
+			aOutBits.resize(wordsCount);
+		std::fill(aOutBits.begin(), aOutBits.begin() + wordsCount, 0ull);
+
+#if ER_SCENE_DATA_STORE_USE_SIMD
+		const __m128 boxMinX = _mm_set1_ps(aBox.first.x), boxMinY = _mm_set1_ps(aBox.first.y), boxMinZ = _mm_set1_ps(aBox.first.z);
+		const __m128 boxMaxX = _mm_set1_ps(aBox.second.x), boxMaxY = _mm_set1_ps(aBox.second.y), boxMaxZ = _mm_set1_ps(aBox.second.z);
+		for (int i = 0; i < mCount; i += 4)
+		{
+			__m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(mMinX.data() + i), boxMaxX), _mm_cmpge_ps(_mm_loadu_ps(mMaxX.data() + i), boxMinX));
+			overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(mMinY.data() + i), boxMaxY), _mm_cmpge_ps(_mm_loadu_ps(mMaxY.data() + i), boxMinY)));
+			overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(mMinZ.data() + i), boxMaxZ), _mm_cmpge_ps(_mm_loadu_ps(mMaxZ.data() + i), boxMinZ)));
+
+			// i is a multiple of 4, so the 4 bits never cross a word
+			aOutBits[i >> 6] |= static_cast<UINT64>(_mm_movemask_ps(overlap)) << (i & 63);
+		}
+#else
+		for (int i = 0; i < mCount; i++)
+		{
+			const bool isOverlapping =
+				(mMinX[i] <= aBox.second.x && mMaxX[i] >= aBox.first.x) &&
+				(mMinY[i] <= aBox.second.y && mMaxY[i] >= aBox.first.y) &&
+				(mMinZ[i] <= aBox.second.z && mMaxZ[i] >= aBox.first.z);
+			if (isOverlapping)
+				aOutBits[i >> 6] |= 1ull << (i & 63);
+		}
+#endif
+	}
+
+	void ER_SceneDataStore::GetVisibleBoundsByDistance(const XMFLOAT3& aCameraPosition, const float* aNearDistances, const float* aFarDistances, int aRangesCount,
+		ER_AABB* aOutBounds, int* aOutCounts) const
+	{
+		for (int range = 0; range < aRangesCount; range++)
+		{
+			aOutBounds[range] = ER_AABB(XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+			aOutCounts[range] = 0;
+		}
+
+		for (int i = 0; i < mCount; i++)
+		{
+			if ((mFlags[i] & (SCENE_DATA_ENTRY_ALIVE | SCENE_DATA_ENTRY_CULLED)) != SCENE_DATA_ENTRY_ALIVE)
+				continue;
+
+			// closest and farthest points of the AABB
+			const float nearX = std::max(std::max(mMinX[i] - aCameraPosition.x, aCameraPosition.x - mMaxX[i]), 0.0f);
+			const float nearY = std::max(std::max(mMinY[i] - aCameraPosition.y, aCameraPosition.y - mMaxY[i]), 0.0f);
+			const float nearZ = std::max(std::max(mMinZ[i] - aCameraPosition.z, aCameraPosition.z - mMaxZ[i]), 0.0f);
+			const float farX = std::max(fabs(mMinX[i] - aCameraPosition.x), fabs(mMaxX[i] - aCameraPosition.x));
+			const float farY = std::max(fabs(mMinY[i] - aCameraPosition.y), fabs(mMaxY[i] - aCameraPosition.y));
+			const float farZ = std::max(fabs(mMinZ[i] - aCameraPosition.z), fabs(mMaxZ[i] - aCameraPosition.z));
+			const float nearDistanceSqr = nearX * nearX + nearY * nearY + nearZ * nearZ;
+			const float farDistanceSqr = farX * farX + farY * farY + farZ * farZ;
+
+			for (int range = 0; range < aRangesCount; range++)
+			{
+				if (nearDistanceSqr > aFarDistances[range] * aFarDistances[range] || farDistanceSqr < aNearDistances[range] * aNearDistances[range])
+					continue;
+
+				ER_AABB& bounds = aOutBounds[range];
+				bounds.first.x = std::min(bounds.first.x, mMinX[i]); bounds.second.x = std::max(bounds.second.x, mMaxX[i]);
+				bounds.first.y = std::min(bounds.first.y, mMinY[i]); bounds.second.y = std::max(bounds.second.y, mMaxY[i]);
+				bounds.first.z = std::min(bounds.first.z, mMinZ[i]); bounds.second.z = std::max(bounds.second.z, mMaxZ[i]);
+				aOutCounts[range]++;
+			}
+		}
+	}
+
+	ER_AABB ER_SceneDataStore::GetWorldAABB(int aEntry) const
+	{
+		assert(aEntry >= 0 && aEntry < mCount);
+		return ER_AABB(XMFLOAT3(mMinX[aEntry], mMinY[aEntry], mMinZ[aEntry]), XMFLOAT3(mMaxX[aEntry], mMaxY[aEntry], mMaxZ[aEntry]));
+	}
+
+	UINT64 ER_SceneDataStore::GetMemorySize() const
+	{
+		const UINT64 capacity = mFlags.size();
+		return capacity * (10 * sizeof(float) + sizeof(char) + sizeof(unsigned char) + sizeof(XMFLOAT4X4) + 2 * sizeof(XMFLOAT3));
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "Common.h"
+
+#define ER_SCENE_DATA_STORE_USE_SIMD 1 // set to 0 to cull/LOD with the scalar path only (results are the same)
+#define ER_SCENE_DATA_STORE_LOD_COUNT 3 // same as MAX_LOD of the editor (distances in ER_Utility::DistancesLOD)
+
+namespace EveryRay_Core
+{
+	enum SceneDataStoreEntryFlags
+	{
+		SCENE_DATA_ENTRY_ALIVE = 1 << 0,
+		SCENE_DATA_ENTRY_DIRTY = 1 << 1, // world matrix changed, bounds are not recalculated yet
+		SCENE_DATA_ENTRY_CULLED = 1 << 2
+	};
+
+	// Central storage of world transforms and bounds of all rendering objects and their instances.
+	// Every object owns a contiguous range of entries (1 for non-instanced objects, 1 per instance for instanced ones).
+	// Hot data is stored as separate arrays (world AABBs and positions per axis), so that bulk passes (bounds, frustum culling, LOD)
+	// stream through contiguous memory and process 4 entries at a time. Objects only write matrices; everything else is derived here.
+	class ER_SceneDataStore
+	{
+	public:
+		ER_SceneDataStore();
+		~ER_SceneDataStore();
+
+		// Returns the first entry of the range; all entries start with the identity matrix and are dirty
+		int Allocate(int aCount, const ER_AABB& aLocalAABB);
+		void Release(int aFirst, int aCount);
+		void Clear();
+
+		void SetWorldMatrix(int aEntry, const XMFLOAT4X4& aWorld);
+		void SetWorldMatrix(int aEntry, const XMMATRIX& aWorld);
+		const XMFLOAT4X4& GetWorldMatrix(int aEntry) const { return mWorldMatrices[aEntry]; }
+		void SetLocalAABB(int aFirst, int aCount, const ER_AABB& aLocalAABB);
+
+		// Bulk passes (over all alive entries)
+		void UpdateBounds(); // world AABBs and positions of the dirty entries
+		void CullFrustum(const XMFLOAT4* aPlanes); // 6 planes of ER_Frustum
+		void ResetCulling(); // marks all entries as visible
+		void UpdateLODs(const XMFLOAT3& aCameraPosition, const float* aLODDistances); // ER_SCENE_DATA_STORE_LOD_COUNT distances
+
+		// Groups visible entries of [aFirst, aFirst + aCount) by LOD (after CullFrustum() and UpdateLODs()): aOutIndices gets the indices
+		// (relative to aFirst, in their original order) of LOD 0 entries, then of LOD 1 etc., aOutOffsets[lod] is where every LOD starts
+		// (aOutOffsets[aLODCount] is the total). Culled entries and entries further than aLODCount LODs are skipped; with aLODCount == 1
+		// distances are ignored (objects without LODs are visible at any distance). Read-only, so ranges can be binned in parallel.
+		void BinByLOD(int aFirst, int aCount, int aLODCount, UINT* aOutOffsets, UINT* aOutIndices) const;
+
+		// Bitset of the entries whose world AABBs overlap aBox (bit i of word i / 64), grown to GetOverlapBitsWordsCount() words if needed.
+		// Independent of the frustum culling flags and read-only, so several boxes (i.e. voxel cascades) can be tested in parallel.
+		void OverlapAABB(const ER_AABB& aBox, std::vector<UINT64>& aOutBits) const;
+		int GetOverlapBitsWordsCount() const { return (((mCount + 3) & ~3) + 63) / 64; }
+		static bool IsOverlapBitSet(const std::vector<UINT64>& aBits, int aEntry) { return (aBits[aEntry >> 6] & (1ull << (aEntry & 63))) != 0; }
+
+		// Union of the world AABBs of the visible entries (after CullFrustum()) in every distance range from aCameraPosition (an entry is in a range
+		// if the distances of its AABB overlap it), i.e. shadow receivers of cascades. aOutCounts gets the entries of every range (0 - empty bounds).
+		void GetVisibleBoundsByDistance(const XMFLOAT3& aCameraPosition, const float* aNearDistances, const float* aFarDistances, int aRangesCount,
+			ER_AABB* aOutBounds, int* aOutCounts) const;
+
+		ER_AABB GetWorldAABB(int aEntry) const;
+		bool IsCulled(int aEntry) const { return (mFlags[aEntry] & SCENE_DATA_ENTRY_CULLED) != 0; }
+		int GetLOD(int aEntry) const { return mLODs[aEntry]; } // -1 - further than the last LOD distance
+		float GetDistanceToCameraSqr(int aEntry) const { return mDistancesSqr[aEntry]; }
+
+		int GetEntriesCount() const { return mCount; }
+		UINT GetBoundsVersion() const { return mBoundsVersion; } // changes when any world AABB changes, an entry is released or the store is cleared
+		int GetAliveEntriesCount() const { return mAliveCount; }
+		UINT64 GetMemorySize() const;
+	private:
+		void Resize(int aCount);
+
+		int mCount = 0; // entries in use (including released ones in the middle)
+		int mAliveCount = 0;
+		UINT mBoundsVersion = 0;
+		std::vector<std::pair<int, int>> mFreeRanges; // first, count
+
+		// hot (arrays are padded to a multiple of 4 entries)
+		std::vector<float> mMinX, mMinY, mMinZ, mMaxX, mMaxY, mMaxZ;
+		std::vector<float> mPositionX, mPositionY, mPositionZ;
+		std::vector<float> mDistancesSqr;
+		std::vector<char> mLODs;
+		std::vector<unsigned char> mFlags;
+
+		// cold
+		std::vector<XMFLOAT4X4> mWorldMatrices;
+		std::vector<XMFLOAT3> mLocalCenters;
+		std::vector<XMFLOAT3> mLocalExtents;
+	};
+}
@@ -0,0 +1,198 @@
+#include "stdafx.h"
+
+#include "ER_SelfTests.h"
+#include "ER_Utility.h"
+#include "ER_Random.h"
+#include "ER_AsyncComputeScheduler.h"
+#include "ER_CompactInstanceData.h"
+#include "ER_DebugRenderer.h"
+#include "ER_DrawList.h"
+#include "ER_FoliageDensityBudget.h"
+#include "ER_GPUCuller.h"
+#include "ER_IndirectArgs.h"
+#include "ER_PostProcessingStack.h"
+#include "ER_ShadowMapper.h"
+#include "ER_Terrain.h"
+#include "ER_TransformHierarchy.h"
+
+namespace EveryRay_Core
+{
+	static const char* SelfTestsNames[ER_SELF_TEST_COUNT] =
+	{
+		"Async compute scheduler",
+		"Compact instance data precision",
+		"Debug renderer batching",
+		"Draw list sorting",
+		"Foliage density budget",
+		"GPU culling (CPU reference)",
+		"Indirect args generation",
+		"Post effects volumes lookup",
+		"Random number generator",
+		"Shadow cascades stability",
+		"Terrain quadtree selection",
+		"Terrain raycast",
+		"Transform hierarchy update"
+	};
+
+	// Smooth hills with some noise on top (grazing rays hit the slopes of many cells)
+	static void BuildSyntheticTerrain(ER_TerrainHeightPyramid& aOutPyramid)
+	{
+		const int resolution = ER_SELF_TESTS_TERRAIN_RESOLUTION;
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		std::vector<unsigned short> heights(resolution * resolution);
+		for (int z = 0; z < resolution; z++)
+		{
+			for (int x = 0; x < resolution; x++)
+			{
+				const float hills = 0.5f + 0.2f * sinf(x * 0.031f) * cosf(z * 0.027f) + 0.1f * sinf((x + z) * 0.11f);
+				const float height = std::min(std::max(hills + random.NextFloat(-0.02f, 0.02f), 0.0f), 1.0f);
+				heights[z * resolution + x] = static_cast<unsigned short>(height * 65535.0f);
+			}
+		}
+
+		aOutPyramid.Build(heights.data(), resolution);
+	}
+
+	static bool RunTerrainRaycastTest(std::string& aOutReport)
+	{
+		ER_TerrainHeightPyramid pyramid;
+		BuildSyntheticTerrain(pyramid);
+		return pyramid.RunRaycastBenchmark(ER_SELF_TESTS_TERRAIN_RAYS, ER_SELF_TESTS_TERRAIN_REFERENCE_RAYS, aOutReport);
+	}
+
+	// Terrain's default height scale and the max one of its slider
+	static bool RunTerrainQuadTreeTest(std::string& aOutReport)
+	{
+		ER_TerrainHeightPyramid pyramid;
+		BuildSyntheticTerrain(pyramid);
+
+		const float heightScales[] = { 328.0f, 1000.0f };
+		bool passed = true;
+		for (float heightScale : heightScales)
+		{
+			std::string report;
+			passed = ER_TerrainQuadTree::RunSelectionTest(pyramid, NUM_TERRAIN_LOD_LEVELS, heightScale, ER_TERRAIN_QUAD_TREE_SELECTION_TEST_CAMERAS, report) && passed;
+			aOutReport += (aOutReport.empty() ? "" : "\n") + report;
+		}
+		return passed;
+	}
+
+	// Every shadow quality preset (see ER_ShadowMapper's constructor)
+	static bool RunShadowCascadesTest(std::string& aOutReport)
+	{
+		const UINT resolutions[] = { 512, 1024, 2048 };
+		bool passed = true;
+		for (UINT resolution : resolutions)
+		{
+			std::string report;
+			passed = ER_ShadowMapper::RunStabilityTest(ER_SHADOW_STABILITY_TEST_FRAMES, resolution, report) && passed;
+			aOutReport += (aOutReport.empty() ? "" : "\n") + report;
+		}
+		return passed;
+	}
+
+	const char* ER_SelfTests::GetName(ER_SelfTestType aTest)
+	{
+		assert(aTest >= 0 && aTest < ER_SELF_TEST_COUNT);
+		return SelfTestsNames[aTest];
+	}
+
+	bool ER_SelfTests::Run(ER_SelfTestType aTest, std::string& aOutReport)
+	{
+		std::string report;
+		bool passed = false;
+		try
+		{
+			switch (aTest)
+			{
+			case ER_SELF_TEST_ASYNC_COMPUTE_SCHEDULER:
+				passed = ER_AsyncComputeScheduler::RunSelfTest(report);
+				break;
+			case ER_SELF_TEST_COMPACT_INSTANCE_DATA:
+				passed = ER_CompactInstanceData::RunPrecisionCheck(ER_COMPACT_INSTANCE_DATA_CHECK_SAMPLES, report);
+				break;
+			case ER_SELF_TEST_DEBUG_RENDERER:
+				passed = ER_DebugRenderer::RunBenchmark(ER_DEBUG_RENDERER_BENCHMARK_BOXES, ER_DEBUG_RENDERER_BENCHMARK_FRAMES, report);
+				break;
+			case ER_SELF_TEST_DRAW_LIST:
+				passed = ER_DrawList::RunBenchmark(ER_DRAW_LIST_BENCHMARK_ITEMS, ER_DRAW_LIST_BENCHMARK_FRAMES, report);
+				break;
+			case ER_SELF_TEST_FOLIAGE_DENSITY_BUDGET:
+				passed = ER_FoliageDensityBudget::RunSolverCheck(ER_SELF_TESTS_FOLIAGE_BUDGET_LAYOUTS, report);
+				break;
+			case ER_SELF_TEST_GPU_CULLER:
+				passed = ER_GPUCuller::RunBenchmark(ER_GPU_CULLER_BENCHMARK_OBJECTS, ER_GPU_CULLER_BENCHMARK_INSTANCES, ER_GPU_CULLER_BENCHMARK_FRAMES, report);
+				break;
+			case ER_SELF_TEST_INDIRECT_ARGS:
+				passed = ER_IndirectArgs::RunSelfTest(ER_INDIRECT_ARGS_SELF_TEST_DRAWS, ER_INDIRECT_ARGS_SELF_TEST_FRAMES, report);
+				break;
+			case ER_SELF_TEST_POST_EFFECTS_VOLUMES:
+				passed = ER_PostProcessingStack::RunVolumesBenchmark(POST_EFFECT_VOLUMES_BENCHMARK_VOLUMES, POST_EFFECT_VOLUMES_BENCHMARK_QUERIES, report);
+				break;
+			case ER_SELF_TEST_RANDOM:
+				passed = ER_Random::RunSelfTest(report);
+				break;
+			case ER_SELF_TEST_SHADOW_CASCADES:
+				passed = RunShadowCascadesTest(report);
+				break;
+			case ER_SELF_TEST_TERRAIN_QUAD_TREE:
+				passed = RunTerrainQuadTreeTest(report);
+				break;
+			case ER_SELF_TEST_TERRAIN_RAYCAST:
+				passed = RunTerrainRaycastTest(report);
+				break;
+			case ER_SELF_TEST_TRANSFORM_HIERARCHY:
+				passed = ER_TransformHierarchy::RunBenchmark(ER_TRANSFORM_HIERARCHY_BENCHMARK_NODES, ER_TRANSFORM_HIERARCHY_BENCHMARK_DIRTY_RATIO,
+					ER_TRANSFORM_HIERARCHY_BENCHMARK_FRAMES, report);
+				break;
+			default:
+				report = "unknown test";
+				break;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			report += std::string("exception: ") + e.what();
+			passed = false;
+		}
+
+		aOutReport = std::string(GetName(aTest)) + (passed ? ": passed\n" : ": FAILED\n") + report;
+		return passed;
+	}
+
+	int ER_SelfTests::RunAll()
+	{
+		// GUI processes have no console of their own
+		FILE* console = nullptr;
+		if (AttachConsole(ATTACH_PARENT_PROCESS))
+			freopen_s(&console, "CONOUT$", "w", stdout);
+
+		int failedCount = 0;
+		for (int i = 0; i < ER_SELF_TEST_COUNT; i++)
+		{
+			std::string report;
+			if (!Run(static_cast<ER_SelfTestType>(i), report))
+				failedCount++;
+
+			report += "\n\n";
+			ER_OUTPUT_LOG(ER_Utility::ToWideString("[ER Logger][ER_SelfTests] " + report).c_str());
+			if (console)
+				fputs(report.c_str(), stdout);
+		}
+
+		const std::string summary = std::to_string(ER_SELF_TEST_COUNT - failedCount) + "/" + std::to_string(ER_SELF_TEST_COUNT) + " self-tests passed\n";
+		ER_OUTPUT_LOG(ER_Utility::ToWideString("[ER Logger][ER_SelfTests] " + summary).c_str());
+		if (console)
+		{
+			fputs(summary.c_str(), stdout);
+			fclose(console);
+			FreeConsole();
+		}
+		return failedCount;
+	}
+
+	bool ER_SelfTests::IsRequested(const char* aCommandLine)
+	{
+		return aCommandLine && strstr(aCommandLine, ER_SELF_TESTS_COMMAND_LINE_SWITCH) != nullptr;
+	}
+}
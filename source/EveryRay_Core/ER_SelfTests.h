@@ -0,0 +1,46 @@
+#pragma once
+#include "Common.h"
+
+#define ER_SELF_TESTS_COMMAND_LINE_SWITCH "-selftests"
+#define ER_SELF_TESTS_TERRAIN_RESOLUTION 512 // synthetic tile of the terrain tests
+#define ER_SELF_TESTS_TERRAIN_RAYS 1000000
+#define ER_SELF_TESTS_TERRAIN_REFERENCE_RAYS 100000
+#define ER_SELF_TESTS_FOLIAGE_BUDGET_LAYOUTS 1000
+
+namespace EveryRay_Core
+{
+	enum ER_SelfTestType
+	{
+		ER_SELF_TEST_ASYNC_COMPUTE_SCHEDULER = 0,
+		ER_SELF_TEST_COMPACT_INSTANCE_DATA,
+		ER_SELF_TEST_DEBUG_RENDERER,
+		ER_SELF_TEST_DRAW_LIST,
+		ER_SELF_TEST_FOLIAGE_DENSITY_BUDGET,
+		ER_SELF_TEST_GPU_CULLER,
+		ER_SELF_TEST_INDIRECT_ARGS,
+		ER_SELF_TEST_POST_EFFECTS_VOLUMES,
+		ER_SELF_TEST_RANDOM,
+		ER_SELF_TEST_SHADOW_CASCADES,
+		ER_SELF_TEST_TERRAIN_QUAD_TREE,
+		ER_SELF_TEST_TERRAIN_RAYCAST,
+		ER_SELF_TEST_TRANSFORM_HIERARCHY,
+
+		ER_SELF_TEST_COUNT
+	};
+
+	// CPU tests and benchmarks of the engine's systems (CPU references of the shaders, solvers, sorting etc.): they need neither a window nor an RHI.
+	// Run all of them headless with ER_SELF_TESTS_COMMAND_LINE_SWITCH (before anything else is created, the exit code is the number of failed tests)
+	// or one by one from the systems' ImGui windows.
+	class ER_SelfTests
+	{
+	public:
+		static const char* GetName(ER_SelfTestType aTest);
+
+		// Writes the summary of the test (its name and result on the first line, then its timings and errors), returns false if it failed
+		static bool Run(ER_SelfTestType aTest, std::string& aOutReport);
+		// Runs every test, writes the reports to the output log (and to the console if the process was started from one), returns the failed count
+		static int RunAll();
+
+		static bool IsRequested(const char* aCommandLine);
+	};
+}
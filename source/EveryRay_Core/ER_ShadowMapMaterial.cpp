@@ -83,7 +83,7 @@ namespace EveryRay_Core
 
 		if (aObj->GetTextureData(meshIndex).AlbedoMap)
 			rhi->SetShaderResources(ER_PIXEL, { aObj->GetTextureData(meshIndex).AlbedoMap }, 0, rs, SHADOWMAP_MAT_ROOT_DESCRIPTOR_TABLE_PIXEL_SRV_INDEX);
-		if (aObj->IsGPUIndirectlyRendered())
+		if (aObj->IsGPUIndirectlyRendered() && aObj->GetIndirectNewInstanceBuffer())
 			rhi->SetShaderResources(ER_VERTEX, { aObj->GetIndirectNewInstanceBuffer() }, 1, rs, SHADOWMAP_MAT_ROOT_DESCRIPTOR_TABLE_VERTEX_SRV_INDEX);
 		rhi->SetSamplers(ER_PIXEL, { ER_RHI_SAMPLER_STATE::ER_TRILINEAR_WRAP });
 	}
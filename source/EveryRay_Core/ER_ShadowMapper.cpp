@@ -15,6 +15,8 @@
 #include "ER_MaterialsCallbacks.h"
 #include "ER_Terrain.h"
 #include "ER_Utility.h"
+#include "ER_Random.h"
+#include "ER_DebugRenderer.h"
 
 #include <sstream>
 #include <iomanip>
@@ -26,6 +28,21 @@ static const std::string psoNameInstanced = "ER_RHI_GPUPipelineStateObject: Shad
 
 namespace EveryRay_Core
 {
+	static inline float Dot3(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	static inline float AbsDot3(const XMFLOAT3& a, const XMFLOAT3& b) { return fabs(a.x * b.x) + fabs(a.y * b.y) + fabs(a.z * b.z); }
+	static inline XMFLOAT3 Cross3(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+	static inline XMFLOAT3 MulAdd3(const XMFLOAT3& a, const XMFLOAT3& b, float s) { return XMFLOAT3(a.x + b.x * s, a.y + b.y * s, a.z + b.z * s); }
+	static inline XMFLOAT3 Normalize3(const XMFLOAT3& a)
+	{
+		const float length = sqrtf(Dot3(a, a));
+		return (length > 0.0f) ? XMFLOAT3(a.x / length, a.y / length, a.z / length) : a;
+	}
+	static inline float Distance3(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		const XMFLOAT3 d(a.x - b.x, a.y - b.y, a.z - b.z);
+		return sqrtf(Dot3(d, d));
+	}
+
 	ER_ShadowMapper::ER_ShadowMapper(ER_Core& pCore, ER_Camera& camera, ER_DirectionalLight& dirLight, ShadowQuality pQuality, bool isCascaded)
 		: ER_CoreComponent(pCore),
 		mShadowMaps(0, nullptr), 
@@ -67,8 +84,11 @@ namespace EveryRay_Core
 			mLightProjectors.emplace_back(pCore);
 			mLightProjectors[i].Initialize();
 
-			float sphereRadius = 0.0f;
-			mLightProjectors[i].SetProjectionMatrix(GetProjectionBoundingSphere(i, sphereRadius));
+			XMFLOAT3 frustumCorners[8] = {};
+			GetFrustumSliceCorners(mCamera.Position(), mCamera.Direction(), mCamera.Up(), mCamera.Right(), tanf(mCamera.FieldOfView() * 0.5f), mCamera.AspectRatio(),
+				GetCameraNearShadowCascadeDistance(i), GetCameraFarShadowCascadeDistance(i), frustumCorners);
+			mCascadeFits[i] = FitCascade(frustumCorners, mDirectionalLight.Direction(), mDirectionalLight.Up(), mResolution);
+			ApplyCascadeFit(i);
 			//mLightProjectors[i]->ApplyRotation(mDirectionalLight.GetTransform());
 		}
 
@@ -91,25 +111,16 @@ namespace EveryRay_Core
 		DeleteObject(mRootSignature);
 	}
 
-	void ER_ShadowMapper::Update(const ER_CoreTime& gameTime)
+	void ER_ShadowMapper::Update(const ER_CoreTime& gameTime, const ER_Scene* aScene, ER_Terrain* aTerrain)
 	{
 		// UpdateFrustumDistances(mCamera.NearPlaneDistance(), mCamera.FarPlaneDistance());
 		UpdateFrustumDistances(mCamera.NearPlaneDistance(), mDirectionalLight.GetCascadeShadowFarDistance());
-		
-		ER_Frustum& cameraFrustum = mCamera.GetFrustum();
-		XMFLOAT3 frustumCorners[8] = {};
 
-		frustumCorners[0] = (cameraFrustum.Corners()[0]);
-		frustumCorners[1] = (cameraFrustum.Corners()[1]);
-		frustumCorners[2] = (cameraFrustum.Corners()[2]);
-		frustumCorners[3] = (cameraFrustum.Corners()[3]);
-		frustumCorners[4] = (cameraFrustum.Corners()[4]);
-		frustumCorners[5] = (cameraFrustum.Corners()[5]);
-		frustumCorners[6] = (cameraFrustum.Corners()[6]);
-		frustumCorners[7] = (cameraFrustum.Corners()[7]);
+		UpdateReceiversBounds(aScene, aTerrain);
+		UpdateCascadeCaching(aScene, aTerrain);
 
-		XMVECTOR direction = XMLoadFloat3(&mDirectionalLight.Direction());
-		XMVECTOR upDirection = XMLoadFloat3(&mDirectionalLight.Up());
+		const float tanHalfFovY = tanf(mCamera.FieldOfView() * 0.5f);
+		XMFLOAT3 frustumCorners[8] = {};
 
 		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
 		{
@@ -118,39 +129,161 @@ namespace EveryRay_Core
 			// else
 			// 	mCameraCascadesFrustums[i].SetMatrix(mCamera.ProjectionMatrix());
 
-			float sphereRadius = 0.0f;
-			XMMATRIX projectionMatrix = GetProjectionBoundingSphere(i, sphereRadius);
+			GetFrustumSliceCorners(mCamera.Position(), mCamera.Direction(), mCamera.Up(), mCamera.Right(), tanHalfFovY, mCamera.AspectRatio(),
+				GetCameraNearShadowCascadeDistance(i), GetCameraFarShadowCascadeDistance(i), frustumCorners);
+
+			const ER_AABB* receiversBounds = (mIsFittingToReceivers && mHasReceiversBounds[i]) ? &mReceiversBounds[i] : nullptr;
+			ER_ShadowCascadeFit fit = FitCascade(frustumCorners, mDirectionalLight.Direction(), mDirectionalLight.Up(), mResolution, receiversBounds, 0.0f, mIsTexelSizeIncremented);
 
-			if (mIsTexelSizeIncremented)
+			if (IsCascadeCached(i))
 			{
-				assert(sphereRadius);
-				float texelUnit = static_cast<float>(mResolution) / (sphereRadius * 2.0f);
-				//texelUnit *= 2.0f;
-				XMMATRIX scale = XMMatrixScaling(texelUnit, texelUnit, texelUnit);
-
-				XMMATRIX baseViewMatrix = XMMatrixLookToRH({ 0.0, 0.0, 0.0, 1.0 }, direction, upDirection);
-				baseViewMatrix *= scale;
-				XMMATRIX invBaseViewMatrix = XMMatrixInverse(nullptr, baseViewMatrix);
-
-				XMVECTOR posV = XMLoadFloat3(&mLightProjectorCenteredPositions[i]);
-				posV = XMVector3Transform(posV, baseViewMatrix);
-				
-				XMFLOAT3 pos;
-				XMStoreFloat3(&pos, posV);
-				pos.x = floor(pos.x);
-				pos.y = floor(pos.y);
-				posV = XMLoadFloat3(&pos);
-				posV = XMVector3Transform(posV, invBaseViewMatrix);
-				XMStoreFloat3(&mLightProjectorCenteredPositions[i], posV);
+				// keep the cached fit (and its depth) while it still covers the sub-frustum
+				if (IsCachedFitValid(mCascadeFits[i], fit))
+					continue;
+
+				mCascadeFits[i] = FitCascade(frustumCorners, mDirectionalLight.Direction(), mDirectionalLight.Up(), mResolution, receiversBounds,
+					ER_SHADOW_CACHED_CASCADE_MARGIN, mIsTexelSizeIncremented);
+				mCascadeRefitsCount[i]++;
 			}
+			else
+				mCascadeFits[i] = fit;
+
+			mIsCascadeDepthValid[i] = false;
+			ApplyCascadeFit(i);
+		}
+
+		// cached cascades which are re-rendered this frame get their casters for the new fit
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+		{
+			if (!IsCascadeCached(i) || mIsCascadeDepthValid[i])
+				continue;
+
+			if (aScene)
+				UpdateCascadeCasters(i, aScene);
+			else
+				mIsCascadeCastersCulled[i] = false;
+		}
+	}
+
+	// Receivers of every cascade: visible objects (from the scene's data store) and terrain tiles in the cascade's distance range
+	void ER_ShadowMapper::UpdateReceiversBounds(const ER_Scene* aScene, ER_Terrain* aTerrain)
+	{
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+			mHasReceiversBounds[i] = false;
+
+		if (!mIsFittingToReceivers || !aScene)
+			return;
+
+		float nearDistances[NUM_SHADOW_CASCADES];
+		float farDistances[NUM_SHADOW_CASCADES];
+		int receiversCounts[NUM_SHADOW_CASCADES];
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+		{
+			nearDistances[i] = GetCameraNearShadowCascadeDistance(i);
+			farDistances[i] = GetCameraFarShadowCascadeDistance(i);
+		}
+
+		const XMFLOAT3& cameraPos = mCamera.Position();
+		aScene->GetDataStore().GetVisibleBoundsByDistance(cameraPos, nearDistances, farDistances, NUM_SHADOW_CASCADES, mReceiversBounds, receiversCounts);
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+			mHasReceiversBounds[i] = receiversCounts[i] > 0;
 
-			mLightProjectors[i].SetPosition(mLightProjectorCenteredPositions[i].x, mLightProjectorCenteredPositions[i].y, mLightProjectorCenteredPositions[i].z);
-			mLightProjectors[i].SetProjectionMatrix(projectionMatrix);
-			mLightProjectors[i].SetViewMatrix(mLightProjectorCenteredPositions[i], mDirectionalLight.Direction(), mDirectionalLight.Up());
-			mLightProjectors[i].Update();
+		if (!aTerrain)
+			return;
+
+		for (int tileIndex = 0; tileIndex < aTerrain->GetHeightmapsCount(); tileIndex++)
+		{
+			HeightMap* tile = aTerrain->GetHeightmap(tileIndex);
+			if (tile->IsCulled())
+				continue;
+
+			// closest and farthest points of the tile's AABB
+			const ER_AABB& aabb = tile->mAABB;
+			const float nearX = std::max(std::max(aabb.first.x - cameraPos.x, cameraPos.x - aabb.second.x), 0.0f);
+			const float nearY = std::max(std::max(aabb.first.y - cameraPos.y, cameraPos.y - aabb.second.y), 0.0f);
+			const float nearZ = std::max(std::max(aabb.first.z - cameraPos.z, cameraPos.z - aabb.second.z), 0.0f);
+			const float farX = std::max(fabs(aabb.first.x - cameraPos.x), fabs(aabb.second.x - cameraPos.x));
+			const float farY = std::max(fabs(aabb.first.y - cameraPos.y), fabs(aabb.second.y - cameraPos.y));
+			const float farZ = std::max(fabs(aabb.first.z - cameraPos.z), fabs(aabb.second.z - cameraPos.z));
+			const float nearDistanceSqr = nearX * nearX + nearY * nearY + nearZ * nearZ;
+			const float farDistanceSqr = farX * farX + farY * farY + farZ * farZ;
+
+			for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+			{
+				if (nearDistanceSqr > farDistances[i] * farDistances[i] || farDistanceSqr < nearDistances[i] * nearDistances[i])
+					continue;
+
+				ER_AABB& bounds = mReceiversBounds[i];
+				if (!mHasReceiversBounds[i])
+				{
+					bounds = aabb;
+					mHasReceiversBounds[i] = true;
+					continue;
+				}
+				bounds.first.x = std::min(bounds.first.x, aabb.first.x); bounds.second.x = std::max(bounds.second.x, aabb.second.x);
+				bounds.first.y = std::min(bounds.first.y, aabb.first.y); bounds.second.y = std::max(bounds.second.y, aabb.second.y);
+				bounds.first.z = std::min(bounds.first.z, aabb.first.z); bounds.second.z = std::max(bounds.second.z, aabb.second.z);
+			}
 		}
 	}
 
+	// Casters of a cached cascade are the objects and instances overlapping its box, regardless of the camera's culling and LODs: the camera can
+	// turn or move inside the box without re-rendering it, and casters coming into the view must already be in the depth
+	void ER_ShadowMapper::UpdateCascadeCasters(int index, const ER_Scene* aScene)
+	{
+		std::vector<UINT64>& overlapBits = mCascadeCastersOverlapBits[index];
+		aScene->GetDataStore().OverlapAABB(GetFitWorldAABB(mCascadeFits[index]), overlapBits);
+
+		mCascadeCasters[index].clear();
+		mHasCascadeGPUCulledCasters[index] = false;
+		for (auto& objectInfo : aScene->GetRenderingObjects())
+		{
+			ER_RenderingObject* renderingObject = objectInfo.second;
+			if (!renderingObject->IsCastShadow() || !renderingObject->UpdateShadowCascadeInstances(index, overlapBits))
+				continue;
+
+			mCascadeCasters[index].push_back(renderingObject->GetHandle());
+			if (renderingObject->IsInstanced() && renderingObject->IsGPUIndirectlyRendered())
+				mHasCascadeGPUCulledCasters[index] = true;
+		}
+		mIsCascadeCastersCulled[index] = true;
+	}
+
+	// Casters are treated as static: any change of the objects' bounds or of the resident terrain tiles re-renders the cached cascades
+	void ER_ShadowMapper::UpdateCascadeCaching(const ER_Scene* aScene, ER_Terrain* aTerrain)
+	{
+		const UINT boundsVersion = aScene ? aScene->GetDataStore().GetBoundsVersion() : 0;
+		UINT terrainResidency = 0;
+		if (aTerrain)
+		{
+			for (int tileIndex = 0; tileIndex < aTerrain->GetHeightmapsCount(); tileIndex++)
+			{
+				if (aTerrain->GetHeightmap(tileIndex)->IsResident())
+					terrainResidency = terrainResidency * 31u + static_cast<UINT>(tileIndex) + 1u;
+			}
+		}
+
+		if (!mIsCachingCascades || boundsVersion != mCachedBoundsVersion || terrainResidency != mCachedTerrainResidency)
+		{
+			for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+				mIsCascadeDepthValid[i] = false;
+		}
+		mCachedBoundsVersion = boundsVersion;
+		mCachedTerrainResidency = terrainResidency;
+	}
+
+	void ER_ShadowMapper::ApplyCascadeFit(int index)
+	{
+		assert(index < NUM_SHADOW_CASCADES);
+		const ER_ShadowCascadeFit& fit = mCascadeFits[index];
+
+		mLightProjectorCenteredPositions[index] = GetFitPosition(fit);
+		mLightProjectors[index].SetPosition(mLightProjectorCenteredPositions[index]);
+		mLightProjectors[index].SetProjectionMatrix(XMMatrixOrthographicRH(fit.Size, fit.Size, fit.Near, fit.Far));
+		mLightProjectors[index].SetViewMatrix(mLightProjectorCenteredPositions[index], fit.LightDirection, fit.LightUp);
+		mLightProjectors[index].Update();
+	}
+
 	void ER_ShadowMapper::BeginRenderingToShadowMap(int cascadeIndex)
 	{
 		assert(cascadeIndex < NUM_SHADOW_CASCADES);
@@ -287,41 +420,403 @@ namespace EveryRay_Core
 		XMMATRIX projectionMatrix = XMMatrixOrthographicRH(maxX - minX, maxY - minY, -delta, maxZ - minZ);
 		return projectionMatrix;
 	}
-	XMMATRIX ER_ShadowMapper::GetProjectionBoundingSphere(int index, float& sphereRadius)
+	// Same basis as XMMatrixLookToRH(): right = up x back, up = back x right
+	void ER_ShadowMapper::GetLightBasis(const XMFLOAT3& aLightDirection, const XMFLOAT3& aLightUp, XMFLOAT3& aOutRight, XMFLOAT3& aOutUp)
 	{
-		// Create a bounding sphere around the camera frustum for 360 rotation
-		float nearV = index == 0 ? mCamera.NearPlaneDistance() : GetCameraNearShadowCascadeDistance(index);
-		float farV = GetCameraFarShadowCascadeDistance(index);
-		float endV = nearV + farV;
-		XMFLOAT3 sphereCenter = XMFLOAT3(
-			mCamera.Position().x + mCamera.Direction().x * (nearV + 0.5f * endV),
-			mCamera.Position().y + mCamera.Direction().y * (nearV + 0.5f * endV),
-			mCamera.Position().z + mCamera.Direction().z * (nearV + 0.5f * endV)
-		);
-		// Create a vector to the frustum far corner
-		float tanFovY = tanf(mCamera.FieldOfView());
-		float tanFovX = mCamera.AspectRatio() * tanFovY;
-
-		XMFLOAT3 farCorner = XMFLOAT3(
-			mCamera.Direction().x + mCamera.Right().x * tanFovX + mCamera.Up().x * tanFovY,
-			mCamera.Direction().y + mCamera.Right().y * tanFovX + mCamera.Up().y * tanFovY,
-			mCamera.Direction().z + mCamera.Right().z * tanFovX + mCamera.Up().z * tanFovY);
-		// Compute the frustumBoundingSphere radius
-		XMFLOAT3 boundVec = XMFLOAT3(
-			mCamera.Position().x + farCorner.x  * farV - sphereCenter.x,
-			mCamera.Position().y + farCorner.y  * farV - sphereCenter.y,
-			mCamera.Position().z + farCorner.z  * farV - sphereCenter.z);
-		sphereRadius = sqrt(boundVec.x * boundVec.x + boundVec.y * boundVec.y + boundVec.z * boundVec.z);
+		const XMFLOAT3 back = Normalize3(XMFLOAT3(-aLightDirection.x, -aLightDirection.y, -aLightDirection.z));
+		XMFLOAT3 right = Cross3(aLightUp, back);
+		if (Dot3(right, right) < 1e-8f) // up is along the light
+			right = Cross3(fabs(back.y) < 0.99f ? XMFLOAT3(0.0f, 1.0f, 0.0f) : XMFLOAT3(0.0f, 0.0f, 1.0f), back);
+		aOutRight = Normalize3(right);
+		aOutUp = Cross3(back, aOutRight);
+	}
 
-		mLightProjectorCenteredPositions[index] =
-			XMFLOAT3(
-				mCamera.Position().x + mCamera.Direction().x * 0.5f * GetCameraFarShadowCascadeDistance(index),
-				mCamera.Position().y + mCamera.Direction().y * 0.5f * GetCameraFarShadowCascadeDistance(index),
-				mCamera.Position().z + mCamera.Direction().z * 0.5f * GetCameraFarShadowCascadeDistance(index)
-			);
+	XMFLOAT3 ER_ShadowMapper::GetFitPosition(const ER_ShadowCascadeFit& aFit)
+	{
+		XMFLOAT3 right, up;
+		GetLightBasis(aFit.LightDirection, aFit.LightUp, right, up);
+		return MulAdd3(MulAdd3(XMFLOAT3(0.0f, 0.0f, 0.0f), right, aFit.CenterX), up, aFit.CenterY);
+	}
 
-		XMMATRIX projectionMatrix = XMMatrixOrthographicRH(sphereRadius, sphereRadius, -sphereRadius, sphereRadius);
-		return projectionMatrix;
+	void ER_ShadowMapper::GetFitCorners(const ER_ShadowCascadeFit& aFit, XMFLOAT3* aOutCorners)
+	{
+		XMFLOAT3 right, up;
+		GetLightBasis(aFit.LightDirection, aFit.LightUp, right, up);
+		const XMFLOAT3 position = GetFitPosition(aFit);
+		const float halfSize = aFit.Size * 0.5f;
+		const float distances[2] = { aFit.Near, aFit.Far };
+		for (int plane = 0; plane < 2; plane++)
+		{
+			const XMFLOAT3 center = MulAdd3(position, aFit.LightDirection, distances[plane]);
+			aOutCorners[plane * 4 + 0] = MulAdd3(MulAdd3(center, right, -halfSize), up, halfSize);
+			aOutCorners[plane * 4 + 1] = MulAdd3(MulAdd3(center, right, halfSize), up, halfSize);
+			aOutCorners[plane * 4 + 2] = MulAdd3(MulAdd3(center, right, halfSize), up, -halfSize);
+			aOutCorners[plane * 4 + 3] = MulAdd3(MulAdd3(center, right, -halfSize), up, -halfSize);
+		}
+	}
+
+	// Contains the AABB of every box inside the fit, so a fit which is still valid for a smaller required one (IsCachedFitValid()) has all its casters
+	ER_AABB ER_ShadowMapper::GetFitWorldAABB(const ER_ShadowCascadeFit& aFit)
+	{
+		XMFLOAT3 corners[8];
+		GetFitCorners(aFit, corners);
+		ER_AABB aabb(corners[0], corners[0]);
+		for (int i = 1; i < 8; i++)
+		{
+			aabb.first.x = std::min(aabb.first.x, corners[i].x); aabb.second.x = std::max(aabb.second.x, corners[i].x);
+			aabb.first.y = std::min(aabb.first.y, corners[i].y); aabb.second.y = std::max(aabb.second.y, corners[i].y);
+			aabb.first.z = std::min(aabb.first.z, corners[i].z); aabb.second.z = std::max(aabb.second.z, corners[i].z);
+		}
+		return aabb;
+	}
+
+	// Corners of the camera frustum between aNear and aFar: 4 near ones, then 4 far ones
+	void ER_ShadowMapper::GetFrustumSliceCorners(const XMFLOAT3& aPosition, const XMFLOAT3& aDirection, const XMFLOAT3& aUp, const XMFLOAT3& aRight,
+		float aTanHalfFovY, float aAspectRatio, float aNear, float aFar, XMFLOAT3* aOutCorners)
+	{
+		const float distances[2] = { aNear, aFar };
+		for (int i = 0; i < 2; i++)
+		{
+			const XMFLOAT3 center = MulAdd3(aPosition, aDirection, distances[i]);
+			const float halfHeight = aTanHalfFovY * distances[i];
+			const float halfWidth = halfHeight * aAspectRatio;
+			aOutCorners[i * 4 + 0] = MulAdd3(MulAdd3(center, aRight, -halfWidth), aUp, halfHeight);
+			aOutCorners[i * 4 + 1] = MulAdd3(MulAdd3(center, aRight, halfWidth), aUp, halfHeight);
+			aOutCorners[i * 4 + 2] = MulAdd3(MulAdd3(center, aRight, halfWidth), aUp, -halfHeight);
+			aOutCorners[i * 4 + 3] = MulAdd3(MulAdd3(center, aRight, -halfWidth), aUp, -halfHeight);
+		}
+	}
+
+	ER_ShadowCascadeFit ER_ShadowMapper::FitCascade(const XMFLOAT3* aFrustumCorners, const XMFLOAT3& aLightDirection, const XMFLOAT3& aLightUp, UINT aResolution,
+		const ER_AABB* aReceiversBounds, float aMargin, bool aSnapToTexels)
+	{
+		ER_ShadowCascadeFit fit;
+		fit.LightDirection = Normalize3(aLightDirection);
+		XMFLOAT3 right, up;
+		GetLightBasis(fit.LightDirection, aLightUp, right, up);
+		fit.LightUp = up;
+
+		// bounding sphere of the sub-frustum
+		XMFLOAT3 center(0.0f, 0.0f, 0.0f);
+		for (int i = 0; i < 8; i++)
+			center = MulAdd3(center, aFrustumCorners[i], 1.0f / 8.0f);
+		float radius = 0.0f;
+		for (int i = 0; i < 8; i++)
+			radius = std::max(radius, Distance3(aFrustumCorners[i], center));
+		radius = std::max(ceilf(radius * ER_SHADOW_CASCADE_RADIUS_PRECISION), 1.0f) / ER_SHADOW_CASCADE_RADIUS_PRECISION;
+
+		// 1 texel of border on each side, so that the box still covers the fitted area after snapping
+		const float resolution = static_cast<float>(std::max(aResolution, 4u));
+		const float borderScale = resolution / (resolution - 2.0f);
+		const float sphereSize = 2.0f * radius * borderScale;
+		const float maxSize = sphereSize * (1.0f + aMargin);
+		const float step = sphereSize / static_cast<float>(ER_SHADOW_CASCADE_FIT_SIZE_STEPS);
+
+		float centerX = Dot3(center, right);
+		float centerY = Dot3(center, up);
+		const float centerDepth = Dot3(center, fit.LightDirection);
+		float size = maxSize;
+		float receiversNear = centerDepth - radius;
+		float receiversFar = centerDepth + radius;
+
+		if (aReceiversBounds)
+		{
+			// overlap of the receivers' AABB (in light space) with the sub-frustum's box
+			const XMFLOAT3 boundsCenter(
+				0.5f * (aReceiversBounds->first.x + aReceiversBounds->second.x),
+				0.5f * (aReceiversBounds->first.y + aReceiversBounds->second.y),
+				0.5f * (aReceiversBounds->first.z + aReceiversBounds->second.z));
+			const XMFLOAT3 boundsExtent(
+				0.5f * (aReceiversBounds->second.x - aReceiversBounds->first.x),
+				0.5f * (aReceiversBounds->second.y - aReceiversBounds->first.y),
+				0.5f * (aReceiversBounds->second.z - aReceiversBounds->first.z));
+
+			float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+			for (int i = 0; i < 8; i++)
+			{
+				const float x = Dot3(aFrustumCorners[i], right);
+				const float y = Dot3(aFrustumCorners[i], up);
+				minX = std::min(minX, x); maxX = std::max(maxX, x);
+				minY = std::min(minY, y); maxY = std::max(maxY, y);
+			}
+
+			const float boundsX = Dot3(boundsCenter, right), extentX = AbsDot3(boundsExtent, right);
+			const float boundsY = Dot3(boundsCenter, up), extentY = AbsDot3(boundsExtent, up);
+			const float boundsDepth = Dot3(boundsCenter, fit.LightDirection), extentDepth = AbsDot3(boundsExtent, fit.LightDirection);
+			minX = std::max(minX, boundsX - extentX); maxX = std::min(maxX, boundsX + extentX);
+			minY = std::max(minY, boundsY - extentY); maxY = std::min(maxY, boundsY + extentY);
+			const float minDepth = std::max(receiversNear, boundsDepth - extentDepth);
+			const float maxDepth = std::min(receiversFar, boundsDepth + extentDepth);
+
+			// no overlap: nothing receives shadows in the cascade, keep the sphere's box
+			if (minX <= maxX && minY <= maxY && minDepth <= maxDepth)
+			{
+				const float requiredSize = std::max(maxX - minX, maxY - minY) * (1.0f + aMargin) * borderScale;
+				const float fittedSize = std::max(ceilf(requiredSize / step), 1.0f) * step;
+				if (fittedSize < maxSize)
+				{
+					size = fittedSize;
+					centerX = 0.5f * (minX + maxX);
+					centerY = 0.5f * (minY + maxY);
+				}
+				receiversNear = minDepth;
+				receiversFar = maxDepth;
+			}
+		}
+
+		// casters up to the sphere's diameter toward the light, planes in steps (depth range does not change every frame)
+		const float depthMargin = aMargin * sphereSize;
+		fit.Near = floorf((receiversNear - 2.0f * radius - depthMargin) / step) * step;
+		fit.Far = ceilf((receiversFar + depthMargin) / step) * step;
+
+		// snapped to texels of the light basis through the origin, so moves of the box are whole texels
+		if (aSnapToTexels)
+		{
+			const float texelSize = size / resolution;
+			centerX = floorf(centerX / texelSize + 0.5f) * texelSize;
+			centerY = floorf(centerY / texelSize + 0.5f) * texelSize;
+		}
+
+		fit.CenterX = centerX;
+		fit.CenterY = centerY;
+		fit.Size = size;
+		return fit;
+	}
+
+	bool ER_ShadowMapper::IsCachedFitValid(const ER_ShadowCascadeFit& aCached, const ER_ShadowCascadeFit& aRequired)
+	{
+		if (aCached.Size <= 0.0f || aRequired.Size <= 0.0f)
+			return false;
+		if (Dot3(aCached.LightDirection, aRequired.LightDirection) < ER_SHADOW_CACHED_CASCADE_LIGHT_THRESHOLD)
+			return false;
+
+		// too coarse for the required area (i.e. the camera moved closer to the receivers)
+		const float maxScale = (1.0f + ER_SHADOW_CACHED_CASCADE_MARGIN) * (1.0f + ER_SHADOW_CACHED_CASCADE_MARGIN);
+		if (aRequired.Size * maxScale < aCached.Size)
+			return false;
+
+		// required box in the cached basis, with the error of the slightly rotated basis (if the light moved below the threshold)
+		XMFLOAT3 cachedRight, cachedUp, requiredRight, requiredUp;
+		GetLightBasis(aCached.LightDirection, aCached.LightUp, cachedRight, cachedUp);
+		GetLightBasis(aRequired.LightDirection, aRequired.LightUp, requiredRight, requiredUp);
+		const float basisError = std::max(std::max(Distance3(cachedRight, requiredRight), Distance3(cachedUp, requiredUp)),
+			Distance3(aCached.LightDirection, aRequired.LightDirection));
+
+		const float halfSize = 0.5f * aRequired.Size;
+		const float halfDepth = 0.5f * (aRequired.Far - aRequired.Near);
+		const float rotationError = basisError * (1.42f * halfSize + halfDepth);
+		const XMFLOAT3 center = MulAdd3(GetFitPosition(aRequired), aRequired.LightDirection, aRequired.Near + halfDepth);
+
+		const float cachedHalfSize = 0.5f * aCached.Size;
+		return fabs(Dot3(center, cachedRight) - aCached.CenterX) + halfSize + rotationError <= cachedHalfSize &&
+			fabs(Dot3(center, cachedUp) - aCached.CenterY) + halfSize + rotationError <= cachedHalfSize &&
+			Dot3(center, aCached.LightDirection) - halfDepth - rotationError >= aCached.Near &&
+			Dot3(center, aCached.LightDirection) + halfDepth + rotationError <= aCached.Far;
+	}
+
+	// Bitset of the data store's entries in the view (spheres around their AABBs against the view's pyramid, close to the camera's frustum culling)
+	static void GetEntriesInView(const ER_SceneDataStore& aDataStore, const XMFLOAT3& aPosition, const XMFLOAT3& aDirection, const XMFLOAT3& aRight,
+		const XMFLOAT3& aUp, float aTanHalfFovY, float aAspectRatio, std::vector<UINT64>& aOutBits)
+	{
+		aOutBits.assign(aDataStore.GetOverlapBitsWordsCount(), 0);
+		const float tanHalfFovX = aTanHalfFovY * aAspectRatio;
+		const float radiusScaleX = sqrtf(1.0f + tanHalfFovX * tanHalfFovX);
+		const float radiusScaleY = sqrtf(1.0f + aTanHalfFovY * aTanHalfFovY);
+		for (int entry = 0; entry < aDataStore.GetEntriesCount(); entry++)
+		{
+			const ER_AABB aabb = aDataStore.GetWorldAABB(entry);
+			const XMFLOAT3 center(0.5f * (aabb.first.x + aabb.second.x) - aPosition.x, 0.5f * (aabb.first.y + aabb.second.y) - aPosition.y,
+				0.5f * (aabb.first.z + aabb.second.z) - aPosition.z);
+			const XMFLOAT3 extents(0.5f * (aabb.second.x - aabb.first.x), 0.5f * (aabb.second.y - aabb.first.y), 0.5f * (aabb.second.z - aabb.first.z));
+			const float radius = sqrtf(Dot3(extents, extents));
+			const float depth = Dot3(center, aDirection);
+			if (depth + radius > 0.0f && fabs(Dot3(center, aRight)) <= depth * tanHalfFovX + radius * radiusScaleX &&
+				fabs(Dot3(center, aUp)) <= depth * aTanHalfFovY + radius * radiusScaleY)
+				aOutBits[entry >> 6] |= 1ull << (entry & 63);
+		}
+	}
+
+	bool ER_ShadowMapper::RunStabilityTest(int aFramesCount, UINT aResolution, std::string& aOutReport)
+	{
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		const float tanHalfFovY = tanf(XM_PI / 6.0f);
+		const float aspectRatio = 16.0f / 9.0f;
+		const XMFLOAT3 worldUp(0.0f, 1.0f, 0.0f);
+		const ER_AABB ground(XMFLOAT3(-2000.0f, 0.0f, -2000.0f), XMFLOAT3(2000.0f, 30.0f, 2000.0f));
+		const int samplesPerCascade = 32;
+
+		FrustumDistance distances[NUM_SHADOW_CASCADES];
+		CalculateFrustumDistances(0.5f, 1000.0f, 0.04f, 0.1f, distances);
+
+		ER_ShadowCascadeFit previousFits[NUM_SHADOW_CASCADES];
+		ER_ShadowCascadeFit cachedFits[NUM_SHADOW_CASCADES];
+		int sizeChanges[NUM_SHADOW_CASCADES] = {};
+		int refits[NUM_SHADOW_CASCADES] = {};
+		double texelRatios[NUM_SHADOW_CASCADES] = {};
+		int coverageErrors = 0;
+		int shimmerErrors = 0;
+		int comparedFrames = 0;
+
+		// casters on the ground: cached cascades get the ones overlapping their boxes when re-rendered (as in UpdateCascadeCasters())
+		ER_SceneDataStore casters;
+		ER_Random castersRandom(ER_RANDOM_DEFAULT_SEED, 1);
+		const int firstCaster = casters.Allocate(ER_SHADOW_STABILITY_TEST_CASTERS, ER_AABB(XMFLOAT3(-1.0f, 0.0f, -1.0f), XMFLOAT3(1.0f, 1.0f, 1.0f)));
+		for (int caster = 0; caster < ER_SHADOW_STABILITY_TEST_CASTERS; caster++)
+		{
+			const float scale = castersRandom.NextFloat(2.0f, 10.0f);
+			casters.SetWorldMatrix(firstCaster + caster, XMMatrixScaling(scale, scale * castersRandom.NextFloat(1.0f, 4.0f), scale) *
+				XMMatrixTranslation(castersRandom.NextFloat(-1500.0f, 1500.0f), 0.0f, castersRandom.NextFloat(-1500.0f, 1500.0f)));
+		}
+		casters.UpdateBounds();
+
+		std::vector<UINT64> cachedCasters[NUM_SHADOW_CASCADES];
+		std::vector<UINT64> cachedCastersInView[NUM_SHADOW_CASCADES]; // casters in the view when the cascade was rendered
+		std::vector<UINT64> castersInView;
+		std::vector<UINT64> requiredCasters;
+		int missingCasters = 0; // casters of the required fit which are not in the cached depth
+		int castersCameIntoView = 0; // casters of the required fit in the view which were not in it when the cached cascade was rendered
+
+		// 4 phases: rotating in place, walking forward, strafing with pitch wobble, slowly moving sun
+		XMFLOAT3 position(0.0f, 20.0f, 0.0f);
+		float yaw = 0.0f;
+		float pitch = -0.2f;
+		float sunElevation = 0.6f;
+		const int phaseFrames = std::max(aFramesCount / 4, 1);
+
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			const int phase = std::min(frame / phaseFrames, 3);
+			const XMFLOAT3 cameraRight = Normalize3(XMFLOAT3(cosf(yaw), 0.0f, sinf(yaw)));
+			if (phase == 0)
+				yaw += 0.01f;
+			else if (phase == 1)
+				position = MulAdd3(position, XMFLOAT3(sinf(yaw), 0.0f, -cosf(yaw)), 0.5f);
+			else if (phase == 2)
+			{
+				position = MulAdd3(position, cameraRight, 0.3f);
+				pitch = -0.2f + 0.15f * sinf(static_cast<float>(frame) * 0.05f);
+			}
+			else
+			{
+				sunElevation += 0.0005f;
+				yaw += 0.002f;
+			}
+
+			const XMFLOAT3 cameraDirection = Normalize3(XMFLOAT3(cosf(pitch) * sinf(yaw), sinf(pitch), -cosf(pitch) * cosf(yaw)));
+			const XMFLOAT3 right = Normalize3(Cross3(cameraDirection, worldUp));
+			const XMFLOAT3 up = Cross3(right, cameraDirection);
+			const XMFLOAT3 lightDirection = Normalize3(XMFLOAT3(-cosf(sunElevation) * cosf(0.7f), -sinf(sunElevation), -cosf(sunElevation) * sinf(0.7f)));
+			GetEntriesInView(casters, position, cameraDirection, right, up, tanHalfFovY, aspectRatio, castersInView);
+
+			for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+			{
+				XMFLOAT3 corners[8];
+				GetFrustumSliceCorners(position, cameraDirection, up, right, tanHalfFovY, aspectRatio, distances[i].NearDistance, distances[i].FarDistance, corners);
+
+				const ER_ShadowCascadeFit fit = FitCascade(corners, lightDirection, worldUp, aResolution, &ground);
+				const ER_ShadowCascadeFit sphereFit = FitCascade(corners, lightDirection, worldUp, aResolution);
+				texelRatios[i] += fit.Size / sphereFit.Size;
+
+				// shimmering: with the same size and light the box must move in whole texels
+				if (frame > 0)
+				{
+					const ER_ShadowCascadeFit& previousFit = previousFits[i];
+					if (fit.Size != previousFit.Size)
+						sizeChanges[i]++;
+					else if (Dot3(fit.LightDirection, previousFit.LightDirection) == 1.0f)
+					{
+						const float texelSize = fit.Size / static_cast<float>(aResolution);
+						const float moveX = (fit.CenterX - previousFit.CenterX) / texelSize;
+						const float moveY = (fit.CenterY - previousFit.CenterY) / texelSize;
+						if (fabs(moveX - floorf(moveX + 0.5f)) > 0.01f || fabs(moveY - floorf(moveY + 0.5f)) > 0.01f)
+							shimmerErrors++;
+						comparedFrames++;
+					}
+				}
+				previousFits[i] = fit;
+
+				const ER_ShadowCascadeFit* usedFit = &fit;
+				if (i >= ER_SHADOW_CACHED_CASCADES_START)
+				{
+					if (!IsCachedFitValid(cachedFits[i], fit))
+					{
+						cachedFits[i] = FitCascade(corners, lightDirection, worldUp, aResolution, &ground, ER_SHADOW_CACHED_CASCADE_MARGIN);
+						refits[i]++;
+
+						casters.OverlapAABB(GetFitWorldAABB(cachedFits[i]), cachedCasters[i]);
+						cachedCastersInView[i] = castersInView;
+					}
+					usedFit = &cachedFits[i];
+
+					// casters of the current fit (what a re-render would draw) must already be in the cached depth, including the ones which
+					// came into the view since (camera-culled casters would miss them)
+					casters.OverlapAABB(GetFitWorldAABB(fit), requiredCasters);
+					for (int caster = firstCaster; caster < firstCaster + ER_SHADOW_STABILITY_TEST_CASTERS; caster++)
+					{
+						if (!ER_SceneDataStore::IsOverlapBitSet(requiredCasters, caster))
+							continue;
+
+						if (!ER_SceneDataStore::IsOverlapBitSet(cachedCasters[i], caster))
+							missingCasters++;
+						else if (ER_SceneDataStore::IsOverlapBitSet(castersInView, caster) && !ER_SceneDataStore::IsOverlapBitSet(cachedCastersInView[i], caster))
+							castersCameIntoView++;
+					}
+				}
+
+				// coverage: corners and random points of the sub-frustum on the receivers must be in the used box
+				XMFLOAT3 usedRight, usedUp;
+				GetLightBasis(usedFit->LightDirection, usedFit->LightUp, usedRight, usedUp);
+				for (int sample = 0; sample < 8 + samplesPerCascade; sample++)
+				{
+					XMFLOAT3 point;
+					if (sample < 8)
+						point = corners[sample];
+					else
+					{
+						const float distance = random.NextFloat(distances[i].NearDistance, distances[i].FarDistance);
+						point = MulAdd3(position, cameraDirection, distance);
+						point = MulAdd3(point, right, random.NextFloat(-1.0f, 1.0f) * tanHalfFovY * aspectRatio * distance);
+						point = MulAdd3(point, up, random.NextFloat(-1.0f, 1.0f) * tanHalfFovY * distance);
+					}
+					if (point.x < ground.first.x || point.x > ground.second.x || point.y < ground.first.y || point.y > ground.second.y ||
+						point.z < ground.first.z || point.z > ground.second.z)
+						continue;
+
+					const float depth = Dot3(point, usedFit->LightDirection);
+					if (fabs(Dot3(point, usedRight) - usedFit->CenterX) > 0.5f * usedFit->Size || fabs(Dot3(point, usedUp) - usedFit->CenterY) > 0.5f * usedFit->Size ||
+						depth < usedFit->Near || depth > usedFit->Far)
+						coverageErrors++;
+				}
+			}
+		}
+
+		std::string result = std::to_string(aFramesCount) + " frames, " + std::to_string(NUM_SHADOW_CASCADES) + " cascades, " + std::to_string(aResolution) + " texels\n" +
+			"coverage errors: " + std::to_string(coverageErrors) + ", shimmering: " + std::to_string(shimmerErrors) + " (of " + std::to_string(comparedFrames) + " moves)\n" +
+			"casters missing in cached cascades: " + std::to_string(missingCasters) + " (came into the view after the cached render: " + std::to_string(castersCameIntoView) + ")";
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+		{
+			result += "\ncascade " + std::to_string(i) + ": texel size " + std::to_string(texelRatios[i] / std::max(aFramesCount, 1)) + " of the sphere fit, size changes: " +
+				std::to_string(sizeChanges[i]);
+			if (i >= ER_SHADOW_CACHED_CASCADES_START)
+				result += ", cached re-renders: " + std::to_string(refits[i]);
+		}
+		aOutReport = result;
+		// without casters coming into the view the paths would not test the caching of casters
+		return coverageErrors == 0 && shimmerErrors == 0 && missingCasters == 0 && castersCameIntoView > 0;
+	}
+
+	void ER_ShadowMapper::DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer)
+	{
+		const XMFLOAT4 colors[3] = { XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f), XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f), XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) };
+		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
+		{
+			if (mCascadeFits[i].Size <= 0.0f)
+				continue;
+
+			XMFLOAT3 corners[8];
+			GetFitCorners(mCascadeFits[i], corners);
+			aDebugRenderer->AddBox(corners, colors[i % 3]);
+		}
 	}
 
 	void ER_ShadowMapper::Draw(const ER_Scene* scene, ER_Terrain* terrain)
@@ -333,6 +828,11 @@ namespace EveryRay_Core
 
 		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
 		{
+			// cached cascades keep their depth from a previous frame
+			mIsCascadeRendered[i] = !(IsCascadeCached(i) && mIsCascadeDepthValid[i]);
+			if (!mIsCascadeRendered[i])
+				continue;
+
 			std::string materialName = ER_MaterialHelper::shadowMapMaterialName + " " + std::to_string(i);
 			BeginRenderingToShadowMap(i);
 
@@ -346,10 +846,9 @@ namespace EveryRay_Core
 			rhi->SetRootSignature(mRootSignature);
 			rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-			int objectIndex = 0;
-			for (auto renderingObjectInfo = scene->objects.begin(); renderingObjectInfo != scene->objects.end(); renderingObjectInfo++, objectIndex++)
+			const bool isCulledToCascade = IsCascadeCached(i) && mIsCascadeCastersCulled[i];
+			auto drawCaster = [&](ER_RenderingObject* renderingObject)
 			{
-				ER_RenderingObject* renderingObject = renderingObjectInfo->second;
 				const std::string& psoName = renderingObject->IsInstanced() ? psoNameInstanced : psoNameNonInstanced;
 				auto materialInfo = renderingObject->GetMaterials().find(materialName);
 				if (materialInfo != renderingObject->GetMaterials().end())
@@ -375,40 +874,72 @@ namespace EveryRay_Core
 							continue;
 						}
 						static_cast<ER_ShadowMapMaterial*>(material)->PrepareForRendering(materialSystems, renderingObject, meshIndex, i, mRootSignature);
-						if (!renderingObject->IsInstanced())
+						if (isCulledToCascade)
+							renderingObject->DrawShadowCascade(materialName, meshIndex, i);
+						else if (!renderingObject->IsInstanced())
 							renderingObject->DrawLOD(materialName, true, meshIndex, renderingObject->GetLODCount() - 1); //drawing highest LOD
 						else
 							renderingObject->Draw(materialName, true, meshIndex);
 					}
 				}
+			};
+
+			if (isCulledToCascade)
+			{
+				for (auto& objectHandle : mCascadeCasters[i])
+				{
+					ER_RenderingObject* renderingObject = scene->GetRenderingObject(objectHandle);
+					if (renderingObject)
+						drawCaster(renderingObject);
+				}
+			}
+			else
+			{
+				for (auto& objectInfo : scene->GetRenderingObjects())
+					drawCaster(objectInfo.second);
 			}
 			rhi->EndEventTag();
 
 			rhi->UnsetPSO();
 			StopRenderingToShadowMap(i);
+
+			// depth of casters culled against the camera can not be kept for the next frames
+			mIsCascadeDepthValid[i] = !IsCascadeCached(i) || (isCulledToCascade && !mHasCascadeGPUCulledCasters[i]);
+			mCascadeRendersCount[i]++;
 		}
 	}
 
 	void ER_ShadowMapper::UpdateFrustumDistances(float nearClip, float farClip)
+	{
+		CalculateFrustumDistances(nearClip, farClip, FrustumSplitWeight, ShadowTransitionScale, FrustumDistances);
+	}
+
+	void ER_ShadowMapper::CalculateFrustumDistances(float nearClip, float farClip, float splitWeight, float transitionScale, FrustumDistance* outDistances)
 	{
 		assert(NUM_SHADOW_CASCADES > 0);
 		
 		float Ratio = farClip / nearClip;
 
+		// split distances first, so that the fade regions do not depend on the previous values
+		float splits[NUM_SHADOW_CASCADES + 1];
+		splits[0] = nearClip;
+		splits[NUM_SHADOW_CASCADES] = farClip;
 		for(int i = 1; i < NUM_SHADOW_CASCADES; i++)
 		{
 			float si = i / static_cast<float>(NUM_SHADOW_CASCADES);
 			// algorithm from https://developer.nvidia.com/gpugems/GPUGems3/gpugems3_ch10.html
-			FrustumDistances[i].NearDistance = FrustumSplitWeight * (nearClip * powf(Ratio, si)) + (1.0f - FrustumSplitWeight) * (nearClip + (farClip - nearClip) * si);
-			FrustumDistances[i - 1].FarDistance = FrustumDistances[i].NearDistance;
+			splits[i] = splitWeight * (nearClip * powf(Ratio, si)) + (1.0f - splitWeight) * (nearClip + (farClip - nearClip) * si);
+		}
+
+		for(int i = 0; i < NUM_SHADOW_CASCADES; i++)
+		{
+			outDistances[i].NearDistance = splits[i];
+			outDistances[i].FarDistance = splits[i + 1];
 
 			// add fade region between cascades
-			float Distance = FrustumDistances[i].FarDistance - FrustumDistances[i].NearDistance;
-			FrustumDistances[i].NearDistance = FrustumDistances[i].NearDistance - Distance * ShadowTransitionScale;
+			if (i > 0)
+				outDistances[i].NearDistance -= (splits[i + 1] - splits[i]) * transitionScale;
 		}
-
-		FrustumDistances[0].NearDistance = nearClip;
-		FrustumDistances[NUM_SHADOW_CASCADES - 1].FarDistance = farClip;
 	}
 	
 	float ER_ShadowMapper::GetCameraFarShadowCascadeDistance(int index) const
@@ -3,6 +3,15 @@
 #include "ER_CoreComponent.h"
 #include "ER_Frustum.h"
 #include "RHI/ER_RHI.h"
+#include "ER_RenderingObjectRegistry.h"
+
+#define ER_SHADOW_CASCADE_FIT_SIZE_STEPS 16 // fitted sizes are rounded up to 1/16 of the cascade's bounding sphere diameter (they change in steps, not every frame)
+#define ER_SHADOW_CASCADE_RADIUS_PRECISION 16.0f // bounding sphere radius is rounded up to 1/16 of a unit (float noise would change the texel size)
+#define ER_SHADOW_CACHED_CASCADES_START 1 // cascades from this one on are cached (fitted with a margin and only re-rendered when invalidated)
+#define ER_SHADOW_CACHED_CASCADE_MARGIN 0.25f // share of the fitted size added around cached cascades, so the camera can move before a re-fit
+#define ER_SHADOW_CACHED_CASCADE_LIGHT_THRESHOLD 0.9999f // cos of the light direction change that re-fits cached cascades
+#define ER_SHADOW_STABILITY_TEST_FRAMES 2000
+#define ER_SHADOW_STABILITY_TEST_CASTERS 4096
 
 namespace EveryRay_Core
 {
@@ -12,6 +21,7 @@ namespace EveryRay_Core
 	class ER_DirectionalLight;
 	class ER_Scene;
 	class ER_Terrain;
+	class ER_DebugRenderer;
 
 	enum ShadowQuality
 	{
@@ -20,6 +30,19 @@ namespace EveryRay_Core
 		SHADOW_HIGH
 	};
 
+	// Orthographic fit of a cascade in light space (basis of XMMatrixLookToRH() along the light): a Size x Size box centered at
+	// (CenterX, CenterY) and [Near, Far] along the light direction. The projector is at GetFitPosition() (on the light plane through the origin).
+	struct ER_ShadowCascadeFit
+	{
+		XMFLOAT3 LightDirection = XMFLOAT3(0.0f, -1.0f, 0.0f);
+		XMFLOAT3 LightUp = XMFLOAT3(0.0f, 0.0f, 1.0f);
+		float CenterX = 0.0f;
+		float CenterY = 0.0f;
+		float Size = 0.0f;
+		float Near = 0.0f;
+		float Far = 0.0f;
+	};
+
 	class ER_ShadowMapper : public ER_CoreComponent 
 	{
 	public:
@@ -27,7 +50,9 @@ namespace EveryRay_Core
 		~ER_ShadowMapper();
 
 		void Draw(const ER_Scene* scene, ER_Terrain* terrain = nullptr);
-		void Update(const ER_CoreTime& gameTime);
+		void DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer); // light-space boxes of the cascades' fits
+		// With a scene (after its data store update) cascades are fitted to the bounds of the visible receivers and cached cascades are invalidated on changes
+		void Update(const ER_CoreTime& gameTime, const ER_Scene* aScene = nullptr, ER_Terrain* aTerrain = nullptr);
 		void BeginRenderingToShadowMap(int cascadeIndex = 0);
 		void StopRenderingToShadowMap(int cascadeIndex = 0);
 		XMMATRIX GetViewMatrix(int cascadeIndex = 0) const;
@@ -38,17 +63,50 @@ namespace EveryRay_Core
 		//void ApplyRotation();
 
 		void UpdateFrustumDistances(float nearClip, float farClip);
+		static void CalculateFrustumDistances(float nearClip, float farClip, float splitWeight, float transitionScale, FrustumDistance* outDistances);
 		float GetCameraFarShadowCascadeDistance(int index) const;
 		float GetCameraNearShadowCascadeDistance(int index) const;
 		void UpdateFrustomSplitWeight(float weight) { FrustumSplitWeight = weight; }
 		void UpdateShadowTransitionScale(float scale) { ShadowTransitionScale = scale; }
 		float GetShadowTransitionScale() const { return ShadowTransitionScale; }
 
+		void SetFitToReceivers(bool value) { mIsFittingToReceivers = value; }
+		void SetCachingCascades(bool value) { mIsCachingCascades = value; }
+		bool IsCascadeCached(int index) const { return mIsCachingCascades && index >= ER_SHADOW_CACHED_CASCADES_START; }
+		bool IsCascadeRendered(int index) const { return mIsCascadeRendered[index]; } // in the last frame
+		int GetCascadeRefitsCount(int index) const { return mCascadeRefitsCount[index]; }
+		int GetCascadeRendersCount(int index) const { return mCascadeRendersCount[index]; }
+		float GetCascadeTexelSize(int index) const { return mCascadeFits[index].Size / static_cast<float>(mResolution); }
+
+		// Fits a cascade around the camera's sub-frustum (8 corners): its bounding sphere is rotation invariant, so without receivers the box is
+		// the sphere's (stable under camera rotation). With the world AABB of the receivers the box is tightened to their overlap with the
+		// sub-frustum (size rounded up to ER_SHADOW_CASCADE_FIT_SIZE_STEPS steps, plus aMargin of it) and the far plane to the receivers. The center
+		// is snapped to texels (if aSnapToTexels), so the shadow map does not shimmer while the size stays the same. Casters are included up to
+		// the sphere's diameter toward the light.
+		static ER_ShadowCascadeFit FitCascade(const XMFLOAT3* aFrustumCorners, const XMFLOAT3& aLightDirection, const XMFLOAT3& aLightUp, UINT aResolution,
+			const ER_AABB* aReceiversBounds = nullptr, float aMargin = 0.0f, bool aSnapToTexels = true);
+		// Whether a cached fit can still be used instead of aRequired (same light direction, contains it, not too large for it)
+		static bool IsCachedFitValid(const ER_ShadowCascadeFit& aCached, const ER_ShadowCascadeFit& aRequired);
+		static XMFLOAT3 GetFitPosition(const ER_ShadowCascadeFit& aFit);
+		static void GetFitCorners(const ER_ShadowCascadeFit& aFit, XMFLOAT3* aOutCorners); // 8 corners of the box (same order as the corners of ER_Frustum)
+		static ER_AABB GetFitWorldAABB(const ER_ShadowCascadeFit& aFit); // i.e. casters of cached cascades
+		static void GetLightBasis(const XMFLOAT3& aLightDirection, const XMFLOAT3& aLightUp, XMFLOAT3& aOutRight, XMFLOAT3& aOutUp);
+		static void GetFrustumSliceCorners(const XMFLOAT3& aPosition, const XMFLOAT3& aDirection, const XMFLOAT3& aUp, const XMFLOAT3& aRight,
+			float aTanHalfFovY, float aAspectRatio, float aNear, float aFar, XMFLOAT3* aOutCorners);
+
+		// Synthetic camera and light paths over a ground of receivers and casters: coverage of the sub-frustums, shimmering (texel snapping), size changes,
+		// texel sizes against the sphere fit, re-renders of cached cascades and their casters (coverage errors, shimmering and casters missing
+		// in cached cascades must be 0, casters which came into the view after a cached cascade was rendered must occur)
+		static bool RunStabilityTest(int aFramesCount, UINT aResolution, std::string& aOutReport);
+
 		// XMMATRIX GetCustomViewProjectionMatrixForCascade(const XMMATRIX& viewMatrix, float fov, float aspectRatio, float nearPlaneDistance, int cascadeIndex) const;
 
 	private:
 		XMMATRIX GetLightProjectionMatrixInFrustum(int index, ER_Frustum& cameraFrustum, ER_DirectionalLight& light);
-		XMMATRIX GetProjectionBoundingSphere(int index, float& sphereRadius);
+		void UpdateReceiversBounds(const ER_Scene* aScene, ER_Terrain* aTerrain);
+		void UpdateCascadeCaching(const ER_Scene* aScene, ER_Terrain* aTerrain);
+		void UpdateCascadeCasters(int index, const ER_Scene* aScene);
+		void ApplyCascadeFit(int index);
 
 		ER_Camera& mCamera;
 		ER_DirectionalLight& mDirectionalLight;
@@ -67,7 +125,28 @@ namespace EveryRay_Core
 		XMMATRIX mShadowMapProjectionMatrix;
 		UINT mResolution = 0;
 		bool mIsCascaded = true;
-		bool mIsTexelSizeIncremented = true;
+		bool mIsTexelSizeIncremented = true; // snap cascades to texels
+
+		ER_ShadowCascadeFit mCascadeFits[NUM_SHADOW_CASCADES];
+		ER_AABB mReceiversBounds[NUM_SHADOW_CASCADES];
+		bool mHasReceiversBounds[NUM_SHADOW_CASCADES] = {};
+		bool mIsFittingToReceivers = true;
+
+		// cached cascades: depth is kept until re-fitted or invalidated by changes of the bounds (objects' or terrain's)
+		bool mIsCachingCascades = true;
+		bool mIsCascadeDepthValid[NUM_SHADOW_CASCADES] = {};
+		bool mIsCascadeRendered[NUM_SHADOW_CASCADES] = {};
+		int mCascadeRefitsCount[NUM_SHADOW_CASCADES] = {};
+		int mCascadeRendersCount[NUM_SHADOW_CASCADES] = {};
+		UINT mCachedBoundsVersion = 0;
+		UINT mCachedTerrainResidency = 0; // hash of the resident terrain tiles
+
+		// casters of cached cascades: culled against the cascade's box when it is re-rendered (not against the camera, the depth is kept while
+		// the camera moves inside the box). Indirectly rendered casters are culled against the camera on GPU, so cascades with them are not kept.
+		std::vector<UINT64> mCascadeCastersOverlapBits[NUM_SHADOW_CASCADES];
+		std::vector<ER_RenderingObjectHandle> mCascadeCasters[NUM_SHADOW_CASCADES];
+		bool mIsCascadeCastersCulled[NUM_SHADOW_CASCADES] = {}; // false - no scene in Update(), drawn like not cached cascades
+		bool mHasCascadeGPUCulledCasters[NUM_SHADOW_CASCADES] = {};
 
 		FrustumDistance FrustumDistances[NUM_SHADOW_CASCADES];
 		float FrustumSplitWeight = 0.04;
@@ -14,15 +14,11 @@
 #include "ER_DirectionalLight.h"
 #include "ER_LightProbesManager.h"
 #include "ER_LightProbe.h"
-#include "ER_RenderableAABB.h"
+#include "ER_DebugRenderer.h"
 #include "ER_Camera.h"
 #include "ER_GBuffer.h"
-
-#define USE_RAYCASTING_FOR_ON_TERRAIN_PLACEMENT 0
-
-#define PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0
-#define PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX 1
-#define PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX 2
+#include "ER_Random.h"
+#include "ER_SelfTests.h"
 
 //used for gbuffer, shadows, forward
 #define TERRAIN_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX 0 
@@ -30,6 +26,16 @@
 
 namespace EveryRay_Core
 {
+	static bool GetFileMetadata(const std::wstring& aPath, WIN32_FILE_ATTRIBUTE_DATA& aOutAttributes)
+	{
+		return GetFileAttributesExW(aPath.c_str(), GetFileExInfoStandard, &aOutAttributes) != 0;
+	}
+
+	static std::wstring GetTileSplatPath(const std::wstring& aTexturesPath, int aTileX, int aTileY)
+	{
+		return aTexturesPath + L"terrainSplat_x" + std::to_wstring(aTileX) + L"_y" + std::to_wstring(aTileY) + L".png";
+	}
+
 	ER_Terrain::ER_Terrain(ER_Core& pCore, ER_DirectionalLight& light) :
 		ER_CoreComponent(pCore),
 		mHeightMaps(0, nullptr),
@@ -42,7 +48,8 @@ namespace EveryRay_Core
 			ER_RHI_INPUT_ELEMENT_DESC inputElementDescriptions[] =
 			{
 				{ "PATCH_INFO", 0, ER_FORMAT_R32G32B32A32_FLOAT, 0, 0, true, 0 },
-				{ "TILE_INDEX", 0, ER_FORMAT_R32_FLOAT, 0, 0xffffffff, true, 0 } //too much for tile index, but whatever for now...
+				{ "TILE_INDEX", 0, ER_FORMAT_R32_FLOAT, 0, 0xffffffff, true, 0 }, //too much for tile index, but whatever for now...
+				{ "LOD_INFO", 0, ER_FORMAT_R32G32B32_FLOAT, 0, 0xffffffff, true, 0 }
 			};
 			mInputLayout = rhi->CreateInputLayout(inputElementDescriptions, ARRAYSIZE(inputElementDescriptions));
 
@@ -52,6 +59,9 @@ namespace EveryRay_Core
 			mHS = rhi->CreateGPUShader();
 			mHS->CompileShader(rhi, "content\\shaders\\Terrain\\Terrain.hlsl", "HSMain", ER_TESSELLATION_HULL);
 
+			mHS_CDLOD = rhi->CreateGPUShader();
+			mHS_CDLOD->CompileShader(rhi, "content\\shaders\\Terrain\\Terrain.hlsl", "HSMain_CDLOD", ER_TESSELLATION_HULL);
+
 			mDS = rhi->CreateGPUShader();
 			mDS->CompileShader(rhi, "content\\shaders\\Terrain\\Terrain.hlsl", "DSMain", ER_TESSELLATION_DOMAIN);	
 			
@@ -66,9 +76,6 @@ namespace EveryRay_Core
 
 			mPS_GBuffer = rhi->CreateGPUShader();
 			mPS_GBuffer->CompileShader(rhi, "content\\shaders\\Terrain\\Terrain.hlsl", "PSGBuffer", ER_PIXEL);
-
-			mPlaceOnTerrainCS = rhi->CreateGPUShader();
-			mPlaceOnTerrainCS->CompileShader(rhi, "content\\shaders\\Terrain\\PlaceObjectsOnTerrain.hlsl", "CSMain", ER_COMPUTE);
 		}
 
 		// root signatures
@@ -83,47 +90,39 @@ namespace EveryRay_Core
 				mTerrainCommonPassRS->InitDescriptorTable(rhi, TERRAIN_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 2 });
 				mTerrainCommonPassRS->Finalize(rhi, "ER_RHI_GPURootSignature: Terrain Common Pass", true);
 			}
-
-			mTerrainPlacementPassRS = rhi->CreateRootSignature(3, 2);
-			if (mTerrainPlacementPassRS)
-			{
-				mTerrainPlacementPassRS->InitStaticSampler(rhi, 0, ER_RHI_SAMPLER_STATE::ER_BILINEAR_CLAMP);
-				mTerrainPlacementPassRS->InitStaticSampler(rhi, 1, ER_RHI_SAMPLER_STATE::ER_TRILINEAR_WRAP);
-				mTerrainPlacementPassRS->InitDescriptorTable(rhi, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_SRV }, { 0 }, { 3 });
-				mTerrainPlacementPassRS->InitDescriptorTable(rhi, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_UAV }, { 0 }, { 1 });
-				mTerrainPlacementPassRS->InitDescriptorTable(rhi, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, { ER_RHI_DESCRIPTOR_RANGE_TYPE::ER_RHI_DESCRIPTOR_RANGE_TYPE_CBV }, { 0 }, { 1 });
-				mTerrainPlacementPassRS->Finalize(rhi, "ER_RHI_GPURootSignature: Terrain Placement Pass");
-			}
 		}
 		mTerrainConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: Terrain CB");
-		mPlaceOnTerrainConstantBuffer.Initialize(rhi, "ER_RHI_GPUBuffer: Place On Terrain CB");
 		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
 			mTerrainShadowBuffers[i].Initialize(rhi, "ER_RHI_GPUBuffer: Terrain Shadow CB #" + std::to_string(i));
 	}
 
 	ER_Terrain::~ER_Terrain()
 	{
+		DeleteObject(mStreamer); // waits for the streaming threads
 		DeletePointerCollection(mHeightMaps);
+		ReleaseDeferredTileResources(true);
+		mHeightsFile.Close();
+		for (int i = 0; i < MAX_TERRAIN_TILE_COUNT; i++)
+		{
+			DeleteObject(mSlotVertexBuffersTS[i]);
+			DeleteObject(mSlotVertexBuffersCDLOD[i]);
+			DeleteObject(mSlotVertexBuffersCDLODShadow[i]);
+		}
 		for (int i = 0; i < NUM_TEXTURE_SPLAT_CHANNELS; i++)
 			DeleteObject(mSplatChannelTextures[i]);
 
 		DeleteObject(mVS);
 		DeleteObject(mHS);
+		DeleteObject(mHS_CDLOD);
 		DeleteObject(mDS);
 		DeleteObject(mDS_ShadowMap);
 		DeleteObject(mPS);
 		DeleteObject(mPS_ShadowMap);
 		DeleteObject(mPS_GBuffer);
-		DeleteObject(mPlaceOnTerrainCS);
 		DeleteObject(mInputLayout);
-		DeleteObject(mTerrainTilesDataGPU);
-		DeleteObject(mTerrainTilesHeightmapsArrayTexture);
-		DeleteObject(mTerrainTilesSplatmapsArrayTexture);
 		DeleteObject(mTerrainCommonPassRS);
-		DeleteObject(mTerrainPlacementPassRS);
 
 		mTerrainConstantBuffer.Release();
-		mPlaceOnTerrainConstantBuffer.Release();
 		for (int i = 0; i < NUM_SHADOW_CASCADES; i++)
 			mTerrainShadowBuffers[i].Release();
 
@@ -133,10 +132,10 @@ namespace EveryRay_Core
 		DeleteObject(ReadbackPlacedPositionsOnUpdateEvent);
 	}
 
+	// Only lightweight per-tile data is created here (bounds, paths, pointers into the memory-mapped heights),
+	// GPU resources of the tiles are streamed in/out around the camera later (see UpdateStreaming()).
 	void ER_Terrain::LoadTerrainData(ER_Scene* aScene)
 	{
-		ER_RHI* rhi = GetCore()->GetRHI();
-
 		if (!aScene->HasTerrain())
 		{
 			mEnabled = false;
@@ -158,12 +157,6 @@ namespace EveryRay_Core
 		if (!(mNumTiles && !(mNumTiles & (mNumTiles - 1))))
 			throw ER_CoreException("Number of tiles defined is not a power of 2!");
 
-		if (mNumTiles > MAX_TERRAIN_TILE_COUNT)
-			throw ER_CoreException("Number of tiles exceeds MAX_TERRAIN_TILE_COUNT!");
-
-		for (int i = 0; i < mNumTiles; i++)
-			mHeightMaps.push_back(new HeightMap(mWidth, mHeight));
-
 		std::wstring path = mLevelPath + L"terrain\\";
 		LoadTextures(path, 
 			path + aScene->GetTerrainSplatLayerTextureName(0),
@@ -171,36 +164,35 @@ namespace EveryRay_Core
 			path + aScene->GetTerrainSplatLayerTextureName(2),
 			path + aScene->GetTerrainSplatLayerTextureName(3)
 		); //not thread-safe
-
-		for (int i = 0; i < mNumTiles; i++)
+		mRaycastPagedPyramid.Clear(); // points into the previous heights file
+		mRaycastPagedTileIndex = -1;
+		LoadHeightsFile(path);
+
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
+		const int numTilesSqrt = static_cast<int>(sqrt(mNumTiles));
+		mHeightMaps.reserve(mNumTiles);
+		for (int tileX = 0; tileX < numTilesSqrt; tileX++)
 		{
-			LoadTile(i, path); //not thread-safe
-		}
-
-		int tileSize = mTileScale * mTileResolution;
-		TerrainTileDataGPU* terrainTilesDataCPUBuffer = new TerrainTileDataGPU[mNumTiles];
-		for (int tileIndex = 0; tileIndex < mNumTiles; tileIndex++)
-		{
-			terrainTilesDataCPUBuffer[tileIndex].UVoffsetTileSize = XMFLOAT4(mHeightMaps[tileIndex]->mTileUVOffset.x, mHeightMaps[tileIndex]->mTileUVOffset.y, tileSize, tileSize);
-			terrainTilesDataCPUBuffer[tileIndex].AABBMinPoint = XMFLOAT4(mHeightMaps[tileIndex]->mAABB.first.x, mHeightMaps[tileIndex]->mAABB.first.y, mHeightMaps[tileIndex]->mAABB.first.z, 1.0);
-			terrainTilesDataCPUBuffer[tileIndex].AABBMaxPoint = XMFLOAT4(mHeightMaps[tileIndex]->mAABB.second.x, mHeightMaps[tileIndex]->mAABB.second.y, mHeightMaps[tileIndex]->mAABB.second.z, 1.0);
+			for (int tileY = 0; tileY < numTilesSqrt; tileY++)
+			{
+				int tileIndex = tileX * numTilesSqrt + tileY;
+				assert(tileIndex == static_cast<int>(mHeightMaps.size()));
+
+				HeightMap* tile = new HeightMap(mWidth, mHeight);
+				tile->mRawHeights = mHeightsFile.GetTileHeights(tileIndex);
+				tile->mSplatPath = GetTileSplatPath(path, tileX, tileY);
+				tile->mWorldMatrixTS = XMMatrixTranslation(tileSize * (tileX - 1), 0.0f, tileSize * -tileY);
+				tile->mTileUVOffset = XMFLOAT2(tileSize - tileX * tileSize, tileY * tileSize);
+				tile->mAABB.first = XMFLOAT3(tileSize * (tileX - 1), 0.0f, tileSize * -tileY);
+				tile->mAABB.second = XMFLOAT3(tileSize * tileX, 0.0f, tileSize * -tileY + tileSize);
+				UpdateTileAABB(tile);
+				mHeightMaps.push_back(tile);
+			}
 		}
-		mTerrainTilesDataGPU = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tiles Data Buffer");
-		mTerrainTilesDataGPU->CreateGPUBufferResource(rhi, terrainTilesDataCPUBuffer, mNumTiles, sizeof(TerrainTileDataGPU), false, ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-		DeleteObjects(terrainTilesDataCPUBuffer);
+		CalculateTerrainDataHash();
+		CreateResidentSlotsData();
 
-		mTerrainTilesHeightmapsArrayTexture = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Terrain Tiles Heightmaps Array");
-		mTerrainTilesHeightmapsArrayTexture->CreateGPUTextureResource(rhi, mTileResolution, mTileResolution, 1, ER_FORMAT_R16_UNORM, ER_BIND_SHADER_RESOURCE, 1, -1, mNumTiles);
-		
-		mTerrainTilesSplatmapsArrayTexture = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Terraub Tiles Splatmaps Array");
-		mTerrainTilesSplatmapsArrayTexture->CreateGPUTextureResource(rhi, mTileResolution, mTileResolution, 1, ER_FORMAT_R16G16B16A16_UNORM, ER_BIND_SHADER_RESOURCE, 1, -1, mNumTiles);
-		
-		for (int tileIndex = 0; tileIndex < mNumTiles; tileIndex++)
-		{
-			//MipSlice + ArraySlice * MipLevels; => 0 + tileIndex * 1 = tileIndex
-			rhi->CopyGPUTextureSubresourceRegion(mTerrainTilesHeightmapsArrayTexture, tileIndex, 0, 0, 0, mHeightMaps[tileIndex]->mHeightTexture, 0);
-			rhi->CopyGPUTextureSubresourceRegion(mTerrainTilesSplatmapsArrayTexture, tileIndex, 0, 0, 0, mHeightMaps[tileIndex]->mSplatTexture, 0);
-		}
+		mStreamer = new ER_TerrainStreamer([this](int aTileIndex) { DecodeStreamedTile(aTileIndex); });
 	}
 
 	void ER_Terrain::LoadTextures(const std::wstring& aTexturesPath, const std::wstring& splatLayer0Path, const std::wstring& splatLayer1Path, const std::wstring& splatLayer2Path, const std::wstring& splatLayer3Path)
@@ -260,261 +252,351 @@ namespace EveryRay_Core
 				}
 			);
 		}
+	}
 
-		int numTilesSqrt = sqrt(mNumTiles);
+	// Heights of all tiles are packed into one file which is memory-mapped (we never keep all of them in memory).
+	// The packed file is (re)created from the separate .r16 tiles if it is missing, does not match the scene or is older than any of the tiles
+	// (or splat maps, since its header also stores the content hash of them, see CalculateTerrainDataHash()).
+	void ER_Terrain::LoadHeightsFile(const std::wstring& aTexturesPath)
+	{
+		const std::wstring heightsFilePath = aTexturesPath + L"terrainHeights.ertiles";
+		const int numTilesSqrt = static_cast<int>(sqrt(mNumTiles));
+
+		WIN32_FILE_ATTRIBUTE_DATA heightsFileAttributes;
+		bool isPacked = GetFileMetadata(heightsFilePath, heightsFileAttributes);
 
-		for (int i = 0; i < numTilesSqrt; i++)
+		std::vector<std::wstring> rawTilePaths;
+		std::vector<std::wstring> splatPaths;
+		rawTilePaths.reserve(mNumTiles);
+		splatPaths.reserve(mNumTiles);
+		for (int tileX = 0; tileX < numTilesSqrt; tileX++)
 		{
-			for (int j = 0; j < numTilesSqrt; j++)
+			for (int tileY = 0; tileY < numTilesSqrt; tileY++)
 			{
-				int index = i * numTilesSqrt + j;
-				
-				std::wstring filePathSplatmap = aTexturesPath;
-				filePathSplatmap += L"terrainSplat_x" + std::to_wstring(i) + L"_y" + std::to_wstring(j) + L".png";
-				LoadSplatmapPerTileGPU(i, j, filePathSplatmap); //unfortunately, not thread safe
-
-				std::wstring filePathHeightmap = aTexturesPath;
-				filePathHeightmap += L"terrainHeight_x" + std::to_wstring(i) + L"_y" + std::to_wstring(j) + L".png";
-				LoadHeightmapPerTileGPU(i, j, filePathHeightmap); //unfortunately, not thread safe
+				rawTilePaths.push_back(aTexturesPath + L"terrainHeight_x" + std::to_wstring(tileX) + L"_y" + std::to_wstring(tileY) + L".r16");
+				splatPaths.push_back(GetTileSplatPath(aTexturesPath, tileX, tileY));
+
+				WIN32_FILE_ATTRIBUTE_DATA tileAttributes;
+				if (isPacked && GetFileMetadata(rawTilePaths.back(), tileAttributes) &&
+					CompareFileTime(&tileAttributes.ftLastWriteTime, &heightsFileAttributes.ftLastWriteTime) > 0)
+					isPacked = false;
+				if (isPacked && GetFileMetadata(splatPaths.back(), tileAttributes) &&
+					CompareFileTime(&tileAttributes.ftLastWriteTime, &heightsFileAttributes.ftLastWriteTime) > 0)
+					isPacked = false;
 			}
 		}
-	}
-	
-	void ER_Terrain::LoadTile(int threadIndex, const std::wstring& aTexturesPath)
-	{
-		int numTilesSqrt = sqrt(mNumTiles);
-
-		int tileX = threadIndex / numTilesSqrt;
-		int tileY = threadIndex - numTilesSqrt * tileX;
 
-		int index = tileX * numTilesSqrt + tileY;
-		std::wstring filePathHeightmap = aTexturesPath;
-		filePathHeightmap += L"terrainHeight_x" + std::to_wstring(tileX) + L"_y" + std::to_wstring(tileY) + L".r16";
+		if (isPacked && mHeightsFile.Open(heightsFilePath, mTileResolution, mNumTiles))
+			return;
 
-		CreateTerrainTileDataCPU(tileX, tileY, filePathHeightmap);
-		CreateTerrainTileDataGPU(tileX, tileY);
+		ER_OUTPUT_LOG(L"[ER Logger][ER_Terrain] Packing terrain heights into one file...\n");
+		if (!ER_TerrainHeightsFile::Pack(heightsFilePath, rawTilePaths, splatPaths, mTileResolution) || !mHeightsFile.Open(heightsFilePath, mTileResolution, mNumTiles))
+			throw ER_CoreException("Can not create the terrain's packed heights file!");
 	}
 
-	void ER_Terrain::LoadSplatmapPerTileGPU(int tileIndexX, int tileIndexY, const std::wstring& path)
+	// Every resident slot has its own vertex buffers (created once and reused by the tiles streamed into that slot).
+	// Patches store the slot (and not the tile index) for indexing into TerrainTileWorld[] in the shaders.
+	void ER_Terrain::CreateResidentSlotsData()
 	{
 		ER_RHI* rhi = GetCore()->GetRHI();
 
-		int tileIndex = tileIndexX * sqrt(mNumTiles) + tileIndexY;
-		if (tileIndex >= mHeightMaps.size())
-			return;
+		const float terrainTileSize = static_cast<float>(mTileResolution * mTileScale);
+		const float patchSize = terrainTileSize / NUM_TERRAIN_PATCHES_PER_TILE;
+		const int patchesCount = NUM_TERRAIN_PATCHES_PER_TILE * NUM_TERRAIN_PATCHES_PER_TILE;
+		static_assert((1 << (NUM_TERRAIN_LOD_LEVELS - 1)) == NUM_TERRAIN_PATCHES_PER_TILE, "Finest CDLOD patch should match the regular terrain patch");
 
-		mHeightMaps[tileIndex]->mSplatTexture = rhi->CreateGPUTexture(L"");
-		mHeightMaps[tileIndex]->mSplatTexture->CreateGPUTextureResource(rhi, path, true);
-		rhi->GenerateMipsWithTextureReplacement(&mHeightMaps[tileIndex]->mSplatTexture,
-			[this, tileIndex](ER_RHI_GPUTexture** aNewTextureWithMips)
+		TerrainPatchInstance* patches = new TerrainPatchInstance[patchesCount];
+		for (int slot = 0; slot < MAX_TERRAIN_TILE_COUNT; slot++)
+		{
+			// regular grid, no morphing
+			for (int i = 0; i < NUM_TERRAIN_PATCHES_PER_TILE; i++)
 			{
-				assert(*aNewTextureWithMips);
-				DeleteObject(mHeightMaps[tileIndex]->mSplatTexture);
-				mHeightMaps[tileIndex]->mSplatTexture = *aNewTextureWithMips;
+				for (int j = 0; j < NUM_TERRAIN_PATCHES_PER_TILE; j++)
+				{
+					TerrainPatchInstance& patch = patches[i + j * NUM_TERRAIN_PATCHES_PER_TILE];
+					patch.PatchInfo = XMFLOAT4(i * patchSize, j * patchSize, patchSize, patchSize);
+					patch.TileIndex = static_cast<float>(slot);
+					patch.LODInfo = XMFLOAT3(0.0f, FLT_MAX * 0.5f, FLT_MAX);
+				}
 			}
-		);
 
-	}
+			mSlotVertexBuffersTS[slot] = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (TS) - Vertex Buffer, slot: " + std::to_string(slot));
+			mSlotVertexBuffersTS[slot]->CreateGPUBufferResource(rhi, patches, patchesCount, sizeof(TerrainPatchInstance), false, ER_BIND_VERTEX_BUFFER);
 
-	void ER_Terrain::LoadHeightmapPerTileGPU(int tileIndexX, int tileIndexY, const std::wstring& path)
-	{
-		ER_RHI* rhi = GetCore()->GetRHI();
+			// CDLOD selection can never produce more patches than the quadtree has leaves (= regular grid)
+			mSlotVertexBuffersCDLOD[slot] = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (TS, CDLOD) - Vertex Buffer, slot: " + std::to_string(slot));
+			mSlotVertexBuffersCDLOD[slot]->CreateGPUBufferResource(rhi, patches, patchesCount, sizeof(TerrainPatchInstance), true, ER_BIND_VERTEX_BUFFER);
+			mSlotVertexBuffersCDLODShadow[slot] = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (TS, CDLOD, Shadow) - Vertex Buffer, slot: " + std::to_string(slot));
+			mSlotVertexBuffersCDLODShadow[slot]->CreateGPUBufferResource(rhi, patches, patchesCount, sizeof(TerrainPatchInstance), true, ER_BIND_VERTEX_BUFFER);
+		}
+		DeleteObjects(patches);
 
-		int tileIndex = tileIndexX * sqrt(mNumTiles) + tileIndexY;
-		if (tileIndex >= mHeightMaps.size())
-			return;
-		
-		mHeightMaps[tileIndex]->mHeightTexture = rhi->CreateGPUTexture(L"");
-		mHeightMaps[tileIndex]->mHeightTexture->CreateGPUTextureResource(rhi, path, true);
+		// reversed, so that the slots are taken in order
+		mFreeResidentSlots.clear();
+		for (int slot = MAX_TERRAIN_TILE_COUNT - 1; slot >= 0; slot--)
+			mFreeResidentSlots.push_back(slot);
 	}
 
-	// Create pre-tessellated patch data which is used for terrain rendering (using GPU tessellation pipeline)
-	void ER_Terrain::CreateTerrainTileDataGPU(int tileIndexX, int tileIndexY)
+	// Keep a CPU copy of the tile's splat map (RGBA8), so that we can do splat-based placement without the GPU (and create its GPU texture from it).
+	// Can be called from a streaming thread, so we do not throw here.
+	bool ER_Terrain::LoadSplatmapPerTileCPU(HeightMap* aTile)
 	{
-		ER_RHI* rhi = GetCore()->GetRHI();
-
-		int tileIndex = tileIndexX * sqrt(mNumTiles) + tileIndexY;
-		assert(tileIndex < mHeightMaps.size());
+		DirectX::ScratchImage image;
+		if (FAILED(DirectX::LoadFromWICFile(aTile->mSplatPath.c_str(), DirectX::WIC_FLAGS_NONE, nullptr, image)))
+		{
+			std::wstring msg = L"[ER Logger][ER_Terrain] Can not load the terrain's splatmap: " + aTile->mSplatPath + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+			return false;
+		}
 
-		int terrainTileSize = mTileResolution * mTileScale;
+		const DirectX::Image* srcImage = image.GetImage(0, 0, 0);
+		DirectX::ScratchImage convertedImage;
+		if (srcImage->format != DXGI_FORMAT_R8G8B8A8_UNORM)
+		{
+			if (FAILED(DirectX::Convert(*srcImage, DXGI_FORMAT_R8G8B8A8_UNORM, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, convertedImage)))
+			{
+				std::wstring msg = L"[ER Logger][ER_Terrain] Can not convert the terrain's splatmap: " + aTile->mSplatPath + L"\n";
+				ER_OUTPUT_LOG(msg.c_str());
+				return false;
+			}
+			srcImage = convertedImage.GetImage(0, 0, 0);
+		}
 
-		const int numOfFloats = 5;
+		aTile->mSplatWidth = static_cast<int>(srcImage->width);
+		aTile->mSplatHeight = static_cast<int>(srcImage->height);
+		DeleteObjects(aTile->mSplatDataCPU);
+		aTile->mSplatDataCPU = new unsigned char[aTile->mSplatWidth * aTile->mSplatHeight * 4];
+		for (int row = 0; row < aTile->mSplatHeight; row++)
+			memcpy(aTile->mSplatDataCPU + row * aTile->mSplatWidth * 4, srcImage->pixels + row * srcImage->rowPitch, aTile->mSplatWidth * 4);
+		return true;
+	}
 
-		// creating terrain vertex buffer for patches
-		float* patches_rawdata = new float[NUM_TERRAIN_PATCHES_PER_TILE * NUM_TERRAIN_PATCHES_PER_TILE * numOfFloats];
-		for (int i = 0; i < NUM_TERRAIN_PATCHES_PER_TILE; i++)
+	// Streams terrain tiles in/out around the camera:
+	// - tiles within mStreamingDistance are requested (closest first) while there are free resident slots and the memory budget allows it
+	// - decoded tiles are uploaded to the GPU on the main thread (max. mMaxTileUploadsPerFrame per frame, unless we wait for all of them)
+	// - resident tiles are evicted when they get further than mStreamingDistance * mStreamingHysteresis (or when closer tiles need their slots)
+	void ER_Terrain::UpdateStreaming(ER_Camera* camera, bool aWaitForTiles)
+	{
+		mStreamingFrame++;
+		ReleaseDeferredTileResources();
+
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
+		const int numTilesSqrt = static_cast<int>(sqrt(mNumTiles));
+		const float streamingDistance = mStreamingDistance * tileSize;
+		const float keepDistance = streamingDistance * std::max(1.0f, mStreamingHysteresis);
+		const UINT64 budgetTilesCount = static_cast<UINT64>(mStreamingBudgetMB) * 1024 * 1024 / GetEstimatedTileMemory();
+		const size_t maxResidentTiles = static_cast<size_t>(std::max<UINT64>(1, std::min<UINT64>(MAX_TERRAIN_TILE_COUNT, budgetTilesCount)));
+
+		// only visit the tiles in range (grid layout is the same as in LoadTerrainData()), so that the cost does not depend on the amount of tiles
+		const XMFLOAT3 cameraPosition = camera->Position();
+		auto clampTile = [numTilesSqrt](float value) { return static_cast<int>(std::max(0.0f, std::min(value, static_cast<float>(numTilesSqrt - 1)))); };
+		int minTileX = clampTile(floorf((cameraPosition.x - keepDistance) / tileSize) + 1.0f);
+		int maxTileX = clampTile(floorf((cameraPosition.x + keepDistance) / tileSize) + 1.0f);
+		int minTileY = clampTile(ceilf(-(cameraPosition.z + keepDistance) / tileSize));
+		int maxTileY = clampTile(ceilf(-(cameraPosition.z - keepDistance) / tileSize));
+
+		mStreamingCandidates.clear();
+		for (int tileX = minTileX; tileX <= maxTileX; tileX++)
 		{
-			for (int j = 0; j < NUM_TERRAIN_PATCHES_PER_TILE; j++)
+			for (int tileY = minTileY; tileY <= maxTileY; tileY++)
 			{
-				patches_rawdata[(i + j * NUM_TERRAIN_PATCHES_PER_TILE) * numOfFloats + 0] = i * terrainTileSize / NUM_TERRAIN_PATCHES_PER_TILE;
-				patches_rawdata[(i + j * NUM_TERRAIN_PATCHES_PER_TILE) * numOfFloats + 1] = j * terrainTileSize / NUM_TERRAIN_PATCHES_PER_TILE;
-				patches_rawdata[(i + j * NUM_TERRAIN_PATCHES_PER_TILE) * numOfFloats + 2] = terrainTileSize / NUM_TERRAIN_PATCHES_PER_TILE;
-				patches_rawdata[(i + j * NUM_TERRAIN_PATCHES_PER_TILE) * numOfFloats + 3] = terrainTileSize / NUM_TERRAIN_PATCHES_PER_TILE;
-
-				patches_rawdata[(i + j * NUM_TERRAIN_PATCHES_PER_TILE) * numOfFloats + 4] = static_cast<float>(tileIndex);
+				int tileIndex = tileX * numTilesSqrt + tileY;
+				const ER_AABB& aabb = mHeightMaps[tileIndex]->mAABB;
+				float dx = std::max(aabb.first.x - cameraPosition.x, std::max(0.0f, cameraPosition.x - aabb.second.x));
+				float dz = std::max(aabb.first.z - cameraPosition.z, std::max(0.0f, cameraPosition.z - aabb.second.z));
+				float distance = sqrt(dx * dx + dz * dz);
+				if (distance <= keepDistance)
+					mStreamingCandidates.push_back(std::make_pair(distance, tileIndex));
 			}
 		}
+		std::sort(mStreamingCandidates.begin(), mStreamingCandidates.end());
+		if (mStreamingCandidates.size() > maxResidentTiles)
+			mStreamingCandidates.resize(maxResidentTiles);
 
-		mHeightMaps[tileIndex]->mVertexBufferTS = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (TS) - Vertex Buffer, tile index: " + std::to_string(tileIndex));
-		mHeightMaps[tileIndex]->mVertexBufferTS->CreateGPUBufferResource(rhi, patches_rawdata, NUM_TERRAIN_PATCHES_PER_TILE * NUM_TERRAIN_PATCHES_PER_TILE, numOfFloats * sizeof(float), false, ER_BIND_VERTEX_BUFFER);
+		for (auto& candidate : mStreamingCandidates)
+		{
+			mHeightMaps[candidate.second]->mStreamingKeepFrame = mStreamingFrame;
+			mHeightMaps[candidate.second]->mCameraDistance = candidate.first;
+		}
 
-		DeleteObjects(patches_rawdata);
+		// evict resident tiles which are not wanted anymore (loading tiles are evicted after they become resident)
+		for (int i = static_cast<int>(mStreamedTiles.size()) - 1; i >= 0; i--)
+		{
+			HeightMap* tile = mHeightMaps[mStreamedTiles[i]];
+			if (tile->IsResident() && tile->mStreamingKeepFrame != mStreamingFrame)
+				EvictTile(mStreamedTiles[i]);
+		}
 
-		mHeightMaps[tileIndex]->mWorldMatrixTS = XMMatrixTranslation(terrainTileSize * (tileIndexX - 1), 0.0f, terrainTileSize * -tileIndexY);
-		mHeightMaps[tileIndex]->mTileUVOffset = XMFLOAT2(terrainTileSize - tileIndexX * terrainTileSize, tileIndexY * terrainTileSize);
-	}
+		// request new tiles (closest first)
+		for (auto& candidate : mStreamingCandidates)
+		{
+			if (mFreeResidentSlots.empty())
+				break;
 
-	// Create CPU tile data which is used for terrain debugging, collisions, placement of ER_RenderingObject(s) (no GPU tessellation pipeline)
-	void ER_Terrain::CreateTerrainTileDataCPU(int tileIndexX, int tileIndexY, const std::wstring& aPath)
-	{
-		int tileIndex = tileIndexX * sqrt(mNumTiles) + tileIndexY;
-		assert(tileIndex < mHeightMaps.size());
-		ER_RHI* rhi = GetCore()->GetRHI();
+			HeightMap* tile = mHeightMaps[candidate.second];
+			if (candidate.first > streamingDistance || tile->mStreamingState != TILE_NOT_RESIDENT || tile->mIsStreamingFailed)
+				continue;
 
-		int error, i, j, index;
-		FILE* filePtr;
-		unsigned long long imageSize, count;
-		unsigned short* rawImage;
+			tile->mResidentSlot = mFreeResidentSlots.back();
+			mFreeResidentSlots.pop_back();
+			tile->mStreamingState = TILE_LOADING;
+			mStreamedTiles.push_back(candidate.second);
+			mStreamer->Request(candidate.second);
+		}
 
-		// Load raw heightmap file
+		// upload decoded tiles
+		int uploadsCount = 0;
+		int tileIndex = -1;
+		while (aWaitForTiles || uploadsCount < mMaxTileUploadsPerFrame)
 		{
-			// Open the 16 bit raw height map file for reading in binary.
-			error = _wfopen_s(&filePtr, aPath.c_str(), L"rb");
-			if (error != 0)
-				throw ER_CoreException("Can not open the terrain's heightmap RAW!");
-
-			// Calculate the size of the raw image data.
-			imageSize = mWidth * mHeight;
-
-			// Allocate memory for the raw image data.
-			rawImage = new unsigned short[imageSize];
-
-			// Read in the raw image data.
-			count = fread(rawImage, sizeof(unsigned short), imageSize, filePtr);
-			if (count != imageSize)
-				throw ER_CoreException("Can not read the terrain's heightmap RAW file!");
-
-			// Close the file.
-			error = fclose(filePtr);
-			if (error != 0)
-				throw ER_CoreException("Can not close the terrain's heightmap RAW file!");
+			if (!(aWaitForTiles ? mStreamer->WaitAndPopDecoded(tileIndex) : mStreamer->PopDecoded(tileIndex)))
+				break;
+
+			FinalizeStreamedTile(tileIndex);
+			uploadsCount++;
 		}
+	}
+
+	// Runs on a streaming thread: it only touches the data of the requested tile, which is not used by the main thread while the tile is loading
+	void ER_Terrain::DecodeStreamedTile(int aTileIndex)
+	{
+		HeightMap* tile = mHeightMaps[aTileIndex];
+		assert(tile->mStreamingState == TILE_LOADING);
 
-		// Copy the image data into the height map array.
+		if (LoadSplatmapPerTileCPU(tile))
 		{
-			int tileSize = mTileResolution * mTileScale;
-			for (j = 0; j < static_cast<int>(mHeight); j++)
-			{
-				for (i = 0; i < static_cast<int>(mWidth); i++)
-				{
-					index = (mWidth * j) + i;
+			DirectX::Image splatImage = {};
+			splatImage.width = tile->mSplatWidth;
+			splatImage.height = tile->mSplatHeight;
+			splatImage.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			splatImage.rowPitch = tile->mSplatWidth * 4;
+			splatImage.slicePitch = splatImage.rowPitch * tile->mSplatHeight;
+			splatImage.pixels = tile->mSplatDataCPU;
+			if (FAILED(DirectX::GenerateMipMaps(splatImage, DirectX::TEX_FILTER_DEFAULT, 0, tile->mSplatMipsCPU)))
+				tile->mSplatMipsCPU.Release();
+		}
 
-					// Store the height at this point in the height map array.
-					mHeightMaps[tileIndex]->mData[index].x = static_cast<float>(i * mTileScale + tileSize * (tileIndexX - 1));
-					mHeightMaps[tileIndex]->mData[index].y = static_cast<float>(rawImage[index]) / 200.0f;//TODO mTerrainNonTessellatedHeightScale;
-					mHeightMaps[tileIndex]->mData[index].z = static_cast<float>(j * mTileScale - tileSize * tileIndexY);
+		tile->mHeightPyramid.Build(tile->mRawHeights, mTileResolution);
+		tile->mQuadTree.Build(tile->mHeightPyramid, static_cast<float>(mTileResolution * mTileScale),
+			XMFLOAT3(tile->mAABB.first.x, 0.0f, tile->mAABB.first.z), tile->mResidentSlot, NUM_TERRAIN_LOD_LEVELS);
 
-					if (tileIndex > 0) //a way to fix the seams between tiles...
-					{
-						mHeightMaps[tileIndex]->mData[index].x -= static_cast<float>(tileIndexX) /** scale*/;
-						mHeightMaps[tileIndex]->mData[index].z += static_cast<float>(tileIndexY) /** scale*/;
-					}
+		tile->mStreamingState = TILE_DECODED;
+	}
 
-				}
-			}
+	// Creates GPU resources of the decoded tile (main thread)
+	void ER_Terrain::FinalizeStreamedTile(int aTileIndex)
+	{
+		ER_RHI* rhi = GetCore()->GetRHI();
 
-			// Release image data.
-			delete[] rawImage;
-			rawImage = 0;
+		HeightMap* tile = mHeightMaps[aTileIndex];
+		assert(tile->mStreamingState == TILE_DECODED);
+		if (!tile->mSplatDataCPU || tile->mSplatMipsCPU.GetImageCount() == 0)
+		{
+			// not fatal: the tile stays non-resident (and is not requested again), the rest of the terrain keeps streaming
+			std::wstring msg = L"[ER Logger][ER_Terrain] Can not stream in the terrain's tile (splatmap could not be decoded), tile index: " + std::to_wstring(aTileIndex) + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+			tile->mSplatMipsCPU.Release();
+			tile->mIsStreamingFailed = true;
+			ReleaseTileSlot(aTileIndex);
+			return;
 		}
 
-		// Generate CPU mesh (and its GPU vertex/index buffers) + calculate AABB of the tile
+		// heights are uploaded straight from the memory-mapped file
+		ER_RHI_SUBRESOURCE_DATA heightsData;
+		heightsData.Data = tile->mRawHeights;
+		heightsData.RowPitch = static_cast<UINT>(mTileResolution * sizeof(unsigned short));
+		heightsData.SlicePitch = static_cast<UINT>(mTileResolution * mTileResolution * sizeof(unsigned short));
+		tile->mHeightTexture = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Terrain Tile Heightmap, tile index: " + std::to_wstring(aTileIndex));
+		tile->mHeightTexture->CreateGPUTextureResource(rhi, &heightsData, 1, mTileResolution, mTileResolution, ER_FORMAT_R16_UNORM);
+
+		const DirectX::TexMetadata& splatMetadata = tile->mSplatMipsCPU.GetMetadata();
+		std::vector<ER_RHI_SUBRESOURCE_DATA> splatData(splatMetadata.mipLevels);
+		for (size_t mip = 0; mip < splatMetadata.mipLevels; mip++)
 		{
-			mHeightMaps[tileIndex]->mVertexCountNonTS = (mWidth - 1) * (mHeight - 1) * 6;
-			DebugTerrainVertexInput* vertices = new DebugTerrainVertexInput[mHeightMaps[tileIndex]->mVertexCountNonTS];
+			const DirectX::Image* mipImage = tile->mSplatMipsCPU.GetImage(mip, 0, 0);
+			splatData[mip].Data = mipImage->pixels;
+			splatData[mip].RowPitch = static_cast<UINT>(mipImage->rowPitch);
+			splatData[mip].SlicePitch = static_cast<UINT>(mipImage->slicePitch);
+		}
+		tile->mSplatTexture = rhi->CreateGPUTexture(L"ER_RHI_GPUTexture: Terrain Tile Splatmap, tile index: " + std::to_wstring(aTileIndex));
+		tile->mSplatTexture->CreateGPUTextureResource(rhi, splatData.data(), static_cast<UINT>(splatMetadata.mipLevels),
+			static_cast<UINT>(splatMetadata.width), static_cast<UINT>(splatMetadata.height), ER_FORMAT_R8G8B8A8_UNORM);
+		tile->mSplatMipsCPU.Release();
 
-			mHeightMaps[tileIndex]->mIndexCountNonTS = mHeightMaps[tileIndex]->mVertexCountNonTS;
-			unsigned long* indices = new unsigned long[mHeightMaps[tileIndex]->mIndexCountNonTS];
+		UpdateTileAABB(tile);
 
-			int index = 0;
-			int index1, index2, index3, index4;
-			// Load the vertex and index array with the terrain data.
-			for (int j = 0; j < ((int)mHeight - 1); j++)
-			{
-				for (int i = 0; i < ((int)mWidth - 1); i++)
-				{
-					index1 = (mHeight * j) + i;					// Bottom left.	
-					index2 = (mHeight * j) + (i + 1);			// Bottom right.
-					index3 = (mHeight * (j + 1)) + i;			// Upper left.	
-					index4 = (mHeight * (j + 1)) + (i + 1);		// Upper right.	
-
-					// Upper left.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index3].x, mHeightMaps[tileIndex]->mData[index3].y, mHeightMaps[tileIndex]->mData[index3].z, 1.0f);
-					indices[index] = index;
-					index++;
-
-					// Upper right.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index4].x, mHeightMaps[tileIndex]->mData[index4].y, mHeightMaps[tileIndex]->mData[index4].z, 1.0f);
-					indices[index] = index;
-					index++;
-
-					// Bottom left.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index1].x, mHeightMaps[tileIndex]->mData[index1].y, mHeightMaps[tileIndex]->mData[index1].z, 1.0f);
-					indices[index] = index;
-					index++;
-
-					// Bottom left.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index1].x, mHeightMaps[tileIndex]->mData[index1].y, mHeightMaps[tileIndex]->mData[index1].z, 1.0f);
-					indices[index] = index;
-					index++;
-
-					// Upper right.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index4].x, mHeightMaps[tileIndex]->mData[index4].y, mHeightMaps[tileIndex]->mData[index4].z, 1.0f);
-					indices[index] = index;
-					index++;
-
-					// Bottom right.
-					vertices[index].Position = XMFLOAT4(mHeightMaps[tileIndex]->mData[index2].x, mHeightMaps[tileIndex]->mData[index2].y, mHeightMaps[tileIndex]->mData[index2].z, 1.0f);
-					indices[index] = index;
-					index++;
-				}
-			}
+		tile->mStreamingState = TILE_RESIDENT;
+	}
 
-			mHeightMaps[tileIndex]->mVertexBufferNonTS = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (non-TS) - Vertex Buffer, tile index: " + std::to_string(tileIndex));
-			mHeightMaps[tileIndex]->mVertexBufferNonTS->CreateGPUBufferResource(rhi, vertices, mHeightMaps[tileIndex]->mVertexCountNonTS, sizeof(DebugTerrainVertexInput), false, ER_BIND_VERTEX_BUFFER);
+	void ER_Terrain::EvictTile(int aTileIndex)
+	{
+		HeightMap* tile = mHeightMaps[aTileIndex];
+		assert(tile->IsResident());
+
+		TerrainTileDeferredRelease release;
+		release.HeightTexture = tile->mHeightTexture;
+		release.SplatTexture = tile->mSplatTexture;
+		release.ReleaseFrame = mStreamingFrame + TERRAIN_STREAMING_DEFERRED_RELEASE_FRAMES;
+		mDeferredReleases.push_back(release);
+		tile->mHeightTexture = nullptr;
+		tile->mSplatTexture = nullptr;
+
+		ReleaseTileSlot(aTileIndex);
+	}
 
-			XMFLOAT3 minVertex = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
-			XMFLOAT3 maxVertex = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	// CPU data and the resident slot of an evicted (or failed) tile
+	void ER_Terrain::ReleaseTileSlot(int aTileIndex)
+	{
+		HeightMap* tile = mHeightMaps[aTileIndex];
+
+		DeleteObjects(tile->mSplatDataCPU);
+		tile->mQuadTree.Clear();
+		tile->mHeightPyramid.Clear();
+		tile->mPatchCountCDLOD = 0;
+		tile->mPatchCountCDLODShadow = 0;
+
+		mFreeResidentSlots.push_back(tile->mResidentSlot);
+		tile->mResidentSlot = -1;
+		tile->mStreamingState = TILE_NOT_RESIDENT;
+		UpdateTileAABB(tile);
+
+		mStreamedTiles.erase(std::find(mStreamedTiles.begin(), mStreamedTiles.end(), aTileIndex));
+	}
 
-			// copy vertices to tile data + calculate AABB
-			for (int i = 0; i < mHeightMaps[tileIndex]->mVertexCountNonTS; i++)
+	void ER_Terrain::ReleaseDeferredTileResources(bool aReleaseAll)
+	{
+		for (auto it = mDeferredReleases.begin(); it != mDeferredReleases.end();)
+		{
+			if (aReleaseAll || it->ReleaseFrame <= mStreamingFrame)
 			{
-				mHeightMaps[tileIndex]->mVertexList[i].x = vertices[i].Position.x;
-				mHeightMaps[tileIndex]->mVertexList[i].y = vertices[i].Position.y;
-				mHeightMaps[tileIndex]->mVertexList[i].z = vertices[i].Position.z;
-
-				//Get the smallest vertex 
-				minVertex.x = std::min(minVertex.x, vertices[i].Position.x);    // Find smallest x value in model
-				minVertex.y = std::min(minVertex.y, vertices[i].Position.y);    // Find smallest y value in model
-				minVertex.z = std::min(minVertex.z, vertices[i].Position.z);    // Find smallest z value in model
-
-				//Get the largest vertex 
-				maxVertex.x = std::max(maxVertex.x, vertices[i].Position.x);    // Find largest x value in model
-				maxVertex.y = std::max(maxVertex.y, vertices[i].Position.y);    // Find largest y value in model
-				maxVertex.z = std::max(maxVertex.z, vertices[i].Position.z);    // Find largest z value in model
+				DeleteObject(it->HeightTexture);
+				DeleteObject(it->SplatTexture);
+				it = mDeferredReleases.erase(it);
 			}
-			mHeightMaps[tileIndex]->mAABB = { minVertex, maxVertex };
-
-			DeleteObjects(vertices);
+			else
+				++it;
+		}
+	}
 
-			mHeightMaps[tileIndex]->mIndexBufferNonTS = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain Tile (non-TS) - Index Buffer, tile index: " + std::to_string(tileIndex));
-			mHeightMaps[tileIndex]->mIndexBufferNonTS->CreateGPUBufferResource(rhi, indices, mHeightMaps[tileIndex]->mIndexCountNonTS, sizeof(unsigned long), false, ER_BIND_INDEX_BUFFER);
+	// Height bounds come from the quadtree when the tile is streamed in, otherwise we have to assume the whole height range
+	void ER_Terrain::UpdateTileAABB(HeightMap* aTile)
+	{
+		float minHeight = 0.0f;
+		float maxHeight = 1.0f;
+		if (aTile->mStreamingState == TILE_RESIDENT || aTile->mStreamingState == TILE_DECODED)
+			aTile->mQuadTree.GetHeightBounds(minHeight, maxHeight);
 
-			DeleteObjects(indices);
+		aTile->mAABB.first.y = minHeight * mTerrainTessellatedHeightScale;
+		aTile->mAABB.second.y = maxHeight * mTerrainTessellatedHeightScale;
+	}
 
-			mHeightMaps[tileIndex]->mDebugGizmoAABB = new ER_RenderableAABB(*GetCore(), XMFLOAT4(0.0, 0.0, 1.0, 1.0));
-			mHeightMaps[tileIndex]->mDebugGizmoAABB->InitializeGeometry({ mHeightMaps[tileIndex]->mAABB.first,mHeightMaps[tileIndex]->mAABB.second });
-		}
+	// GPU heights (R16) + GPU splat map with mips (RGBA8) + CPU copy of the splat map (RGBA8) + height pyramid (2 x R16 with mips),
+	// assuming splat maps have the same resolution as heightmaps
+	UINT64 ER_Terrain::GetEstimatedTileMemory()
+	{
+		const UINT64 texelsCount = static_cast<UINT64>(mTileResolution) * mTileResolution;
+		const UINT64 pyramidCellsCount = static_cast<UINT64>(mTileResolution + 1) * (mTileResolution + 1);
+		return texelsCount * sizeof(unsigned short) + texelsCount * 4 * 4 / 3 + texelsCount * 4 + pyramidCellsCount * 2 * sizeof(unsigned short) * 4 / 3;
 	}
 
 	void ER_Terrain::Draw(TerrainRenderPass aPass, const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget, ER_ShadowMapper* worldShadowMapper, ER_LightProbesManager* probeManager, int shadowMapCascade)
@@ -542,13 +624,12 @@ namespace EveryRay_Core
 			mTerrainConstantBuffer.Data.ShadowCascadeDistances = XMFLOAT4{ worldShadowMapper->GetCameraFarShadowCascadeDistance(0), worldShadowMapper->GetCameraFarShadowCascadeDistance(1), worldShadowMapper->GetCameraFarShadowCascadeDistance(2), 1.0f };
 		}
 
-		int tileIndex = 0;
-		for (int i = 0; i < MAX_TERRAIN_TILE_COUNT; i++, tileIndex++)
+		for (int i = 0; i < MAX_TERRAIN_TILE_COUNT; i++)
+			mTerrainConstantBuffer.Data.TerrainTileWorld[i] = XMMatrixIdentity();
+		for (int tileIndex : mStreamedTiles)
 		{
-			if (tileIndex < static_cast<int>(mHeightMaps.size()))
-				mTerrainConstantBuffer.Data.TerrainTileWorld[tileIndex] = XMMatrixTranspose(mHeightMaps[tileIndex]->mWorldMatrixTS);
-			else
-				mTerrainConstantBuffer.Data.TerrainTileWorld[i] = XMMatrixIdentity();
+			if (mHeightMaps[tileIndex]->IsResident())
+				mTerrainConstantBuffer.Data.TerrainTileWorld[mHeightMaps[tileIndex]->mResidentSlot] = XMMatrixTranspose(mHeightMaps[tileIndex]->mWorldMatrixTS);
 		}
 		mTerrainConstantBuffer.Data.View = XMMatrixTranspose(camera->ViewMatrix());
 		mTerrainConstantBuffer.Data.Projection = XMMatrixTranspose(camera->ProjectionMatrix());
@@ -561,36 +642,57 @@ namespace EveryRay_Core
 		mTerrainConstantBuffer.Data.UseDynamicTessellation = mUseDynamicTessellation ? 1.0f : 0.0f;
 		mTerrainConstantBuffer.Data.DistanceFactor = mTessellationDistanceFactor;
 		mTerrainConstantBuffer.Data.TileSize = mTileResolution * mTileScale;
+		mTerrainConstantBuffer.Data.UseCDLOD = mUseCDLOD ? 1.0f : 0.0f;
+		mTerrainConstantBuffer.Data.CDLODGridResolution = static_cast<float>(mCDLODGridResolution);
 		mTerrainConstantBuffer.ApplyChanges(rhi);
 
-		for (int i = 0; i < mHeightMaps.size(); i++)
-			DrawTessellated(aPass, aRenderTargets, aDepthTarget, i, worldShadowMapper, probeManager, shadowMapCascade);
+		for (int tileIndex : mStreamedTiles)
+			DrawTessellated(aPass, aRenderTargets, aDepthTarget, tileIndex, worldShadowMapper, probeManager, shadowMapCascade);
 	}
 
-	void ER_Terrain::DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs)
+	void ER_Terrain::DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer)
 	{
 		if (!mEnabled || !mLoaded || !mDrawDebugAABBs)
 			return;
 
-		for (int i = 0; i < mHeightMaps.size(); i++)
-			mHeightMaps[i]->mDebugGizmoAABB->Draw(aRenderTarget, aDepth, rs);
+		for (int tileIndex : mStreamedTiles)
+		{
+			if (mHeightMaps[tileIndex]->IsResident())
+				aDebugRenderer->AddAABB(mHeightMaps[tileIndex]->mAABB, XMFLOAT4(0.0, 0.0, 1.0, 1.0));
+		}
 	}
 
 	void ER_Terrain::Update(const ER_CoreTime& gameTime)
 	{
 		ER_Camera* camera = (ER_Camera*)(mCore->GetServices().FindService(ER_Camera::TypeIdClass()));
 
+		if (mLoaded)
+		{
+			// first update waits for the tiles around the camera, so that we do not start with an empty terrain
+			UpdateStreaming(camera, !mIsStreamingInitialized);
+			mIsStreamingInitialized = true;
+		}
+
 		int visibleTiles = 0;
-		for (int i = 0; i < mHeightMaps.size(); i++)
+		int residentTiles = 0;
+		for (int tileIndex : mStreamedTiles)
 		{
-			if (!mHeightMaps[i]->PerformCPUFrustumCulling(mDoCPUFrustumCulling ? camera : nullptr))
+			HeightMap* tile = mHeightMaps[tileIndex];
+			if (!tile->IsResident())
+				continue;
+
+			residentTiles++;
+			if (!tile->PerformCPUFrustumCulling(mDoCPUFrustumCulling ? camera : nullptr))
 				visibleTiles++;
 		}
 
+		if (mUseCDLOD)
+			UpdateCDLODSelection(camera);
+
 		if (mShowDebug) {
 			ImGui::Begin("Terrain System");
 			
-			std::string cullText = "Visible tiles: " + std::to_string(visibleTiles) + "/" + std::to_string(mHeightMaps.size());
+			std::string cullText = "Visible tiles: " + std::to_string(visibleTiles) + "/" + std::to_string(residentTiles);
 			ImGui::Text(cullText.c_str());
 			ImGui::Checkbox("Enabled", &mEnabled);
 			ImGui::Checkbox("CPU frustum culling", &mDoCPUFrustumCulling);
@@ -599,21 +701,110 @@ namespace EveryRay_Core
 			ImGui::SliderInt("Tessellation factor dynamic", &mTessellationFactorDynamic, 1, 64);
 			ImGui::Checkbox("Use dynamic tessellation", &mUseDynamicTessellation);
 			ImGui::SliderFloat("Dynamic LOD distance factor", &mTessellationDistanceFactor, 0.0001f, 0.1f);
-			ImGui::SliderFloat("Tessellated terrain height scale", &mTerrainTessellatedHeightScale, 0.0f, 1000.0f);
+			if (ImGui::SliderFloat("Tessellated terrain height scale", &mTerrainTessellatedHeightScale, 0.0f, 1000.0f))
+			{
+				for (HeightMap* tile : mHeightMaps)
+					UpdateTileAABB(tile);
+			}
 			ImGui::SliderFloat("Placement height delta", &mPlacementHeightDelta, 0.0f, 10.0f);
+			ImGui::Separator();
+			std::string streamingText = "Resident tiles: " + std::to_string(residentTiles) + "/" + std::to_string(mHeightMaps.size()) +
+				" (max. " + std::to_string(MAX_TERRAIN_TILE_COUNT) + "), loading: " + std::to_string(mStreamedTiles.size() - residentTiles);
+			ImGui::Text(streamingText.c_str());
+			std::string memoryText = "Resident tiles memory (est.): " + std::to_string(residentTiles * GetEstimatedTileMemory() / (1024 * 1024)) + " MB";
+			ImGui::Text(memoryText.c_str());
+			ImGui::SliderFloat("Streaming distance (in tiles)", &mStreamingDistance, 0.5f, 8.0f);
+			ImGui::SliderInt("Streaming budget (MB)", &mStreamingBudgetMB, 16, 2048);
+			ImGui::SliderInt("Max tile uploads per frame", &mMaxTileUploadsPerFrame, 1, 8);
+			ImGui::Separator();
+			if (ImGui::Button("Benchmark 1M raycasts (CPU)"))
+				RunRaycastBenchmark();
+			if (!mRaycastBenchmarkResult.empty())
+				ImGui::Text(mRaycastBenchmarkResult.c_str());
+			std::string pagedText = "Raycast pyramids built for non-resident tiles: " + std::to_string(mRaycastPagedTilesCount);
+			ImGui::Text(pagedText.c_str());
+			ImGui::Separator();
+			ImGui::Checkbox("Use CDLOD (quadtree LOD selection)", &mUseCDLOD);
+			if (mUseCDLOD)
+			{
+				if (ImGui::SliderInt("CDLOD grid resolution", &mCDLODGridResolution, 2, 64))
+					mCDLODGridResolution = std::max(2, mCDLODGridResolution & ~1); // odd vertices have to collapse onto even ones
+				ImGui::SliderFloat("CDLOD finest range (in patch sizes)", &mCDLODRangeScale, 1.5f, 8.0f);
+				ImGui::SliderFloat("CDLOD morph start ratio", &mCDLODMorphStartRatio, 0.0f, 0.95f);
+
+				UINT selectedPatches = 0;
+				for (int lod = 0; lod < NUM_TERRAIN_LOD_LEVELS; lod++)
+				{
+					std::string lodText = "LOD " + std::to_string(lod) + " patches: " + std::to_string(mCDLODPatchesPerLOD[lod]) +
+						" (range: " + std::to_string(static_cast<int>(mCDLODRanges.Ranges[lod])) + ")";
+					ImGui::Text(lodText.c_str());
+					selectedPatches += mCDLODPatchesPerLOD[lod];
+				}
+				std::string trianglesText = "Triangles (main view): " + std::to_string(static_cast<UINT64>(selectedPatches) * 2 * mCDLODGridResolution * mCDLODGridResolution);
+				ImGui::Text(trianglesText.c_str());
+			}
 			ImGui::End();
 		}
 	}
 
+	// Select CDLOD patches of every resident tile and upload them to the vertex buffers of the tile's slot.
+	// Every selected patch is tessellated with the same (constant) factor, so the triangle count only depends on the number of selected patches.
+	void ER_Terrain::UpdateCDLODSelection(ER_Camera* camera)
+	{
+		ER_RHI* rhi = mCore->GetRHI();
+
+		float finestPatchSize = mTileResolution * mTileScale / NUM_TERRAIN_PATCHES_PER_TILE;
+		ER_TerrainQuadTree::CalculateLODRanges(mCDLODRanges, NUM_TERRAIN_LOD_LEVELS, finestPatchSize * mCDLODRangeScale, mCDLODMorphStartRatio);
+		memset(mCDLODPatchesPerLOD, 0, sizeof(mCDLODPatchesPerLOD));
+
+		ER_Frustum frustum = camera->GetFrustum();
+		for (int tileIndex : mStreamedTiles)
+		{
+			HeightMap* tile = mHeightMaps[tileIndex];
+			if (!tile->IsResident())
+				continue;
+
+			mCDLODSelectedPatches.clear();
+			if (!tile->IsCulled())
+				tile->mQuadTree.Select(camera->Position(), mCDLODRanges, mTerrainTessellatedHeightScale, mDoCPUFrustumCulling ? frustum.Planes() : nullptr,
+					mCDLODSelectedPatches, mCDLODPatchesPerLOD);
+			tile->mPatchCountCDLOD = static_cast<int>(mCDLODSelectedPatches.size());
+			if (tile->mPatchCountCDLOD > 0)
+				rhi->UpdateBuffer(mSlotVertexBuffersCDLOD[tile->mResidentSlot], mCDLODSelectedPatches.data(), tile->mPatchCountCDLOD * sizeof(TerrainPatchInstance));
+
+			// shadow cascades can see the tiles which are outside of the camera frustum, so we keep the same LODs but dont cull
+			mCDLODSelectedPatches.clear();
+			tile->mQuadTree.Select(camera->Position(), mCDLODRanges, mTerrainTessellatedHeightScale, nullptr, mCDLODSelectedPatches);
+			tile->mPatchCountCDLODShadow = static_cast<int>(mCDLODSelectedPatches.size());
+			if (tile->mPatchCountCDLODShadow > 0)
+				rhi->UpdateBuffer(mSlotVertexBuffersCDLODShadow[tile->mResidentSlot], mCDLODSelectedPatches.data(), tile->mPatchCountCDLODShadow * sizeof(TerrainPatchInstance));
+		}
+	}
+
 	void ER_Terrain::DrawTessellated(TerrainRenderPass aPass, const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget, int tileIndex, ER_ShadowMapper* worldShadowMapper, ER_LightProbesManager* probeManager, int shadowMapCascade)
 	{
 		if (aPass == TerrainRenderPass::TERRAIN_SHADOW)
 			assert(shadowMapCascade != -1);
 		
+		const int slot = mHeightMaps[tileIndex]->mResidentSlot;
+		if (!mHeightMaps[tileIndex]->IsResident())
+			return;
+
 		//for shadow mapping pass we dont want to cull with main camera frustum
 		if (mHeightMaps[tileIndex]->IsCulled() && (aPass == TerrainRenderPass::TERRAIN_FORWARD || aPass == TerrainRenderPass::TERRAIN_GBUFFER))
 			return;
 
+		ER_RHI_GPUBuffer* vertexBuffer = mSlotVertexBuffersTS[slot];
+		int patchesCount = NUM_TERRAIN_PATCHES_PER_TILE * NUM_TERRAIN_PATCHES_PER_TILE;
+		if (mUseCDLOD)
+		{
+			bool isShadowPass = aPass == TerrainRenderPass::TERRAIN_SHADOW;
+			vertexBuffer = isShadowPass ? mSlotVertexBuffersCDLODShadow[slot] : mSlotVertexBuffersCDLOD[slot];
+			patchesCount = isShadowPass ? mHeightMaps[tileIndex]->mPatchCountCDLODShadow : mHeightMaps[tileIndex]->mPatchCountCDLOD;
+			if (patchesCount == 0)
+				return;
+		}
+
 		ER_RHI* rhi = mCore->GetRHI();
 
 		ER_Camera* camera = (ER_Camera*)(mCore->GetServices().FindService(ER_Camera::TypeIdClass()));
@@ -622,14 +813,16 @@ namespace EveryRay_Core
 		ER_RHI_PRIMITIVE_TYPE originalPrimitiveTopology = rhi->GetCurrentTopologyType();
 
 		ER_RHI_GPURootSignature* rootSig = mTerrainCommonPassRS;
-		std::string& psoName = ER_Utility::IsWireframe ? mTerrainMainPassWireframePSOName : mTerrainMainPassPSOName;
+		std::string psoName = ER_Utility::IsWireframe ? mTerrainMainPassWireframePSOName : mTerrainMainPassPSOName;
 		if (aPass == TERRAIN_SHADOW)
 			psoName = mTerrainShadowPassPSOName;
 		else if (aPass == TERRAIN_GBUFFER)
 			psoName = ER_Utility::IsWireframe ? mTerrainGBufferPassWireframePSOName : mTerrainGBufferPassPSOName;
+		if (mUseCDLOD)
+			psoName += " (CDLOD)";
 
 		rhi->SetRootSignature(rootSig);
-		rhi->SetVertexBuffers({ mHeightMaps[tileIndex]->mVertexBufferTS });
+		rhi->SetVertexBuffers({ vertexBuffer });
 		rhi->SetTopologyType(ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_CONTROL_POINT_PATCHLIST);
 
 		if (!rhi->IsPSOReady(psoName))
@@ -638,7 +831,7 @@ namespace EveryRay_Core
 			rhi->SetTopologyTypeToPSO(psoName, ER_RHI_PRIMITIVE_TYPE::ER_PRIMITIVE_TOPOLOGY_CONTROL_POINT_PATCHLIST);
 			rhi->SetInputLayout(mInputLayout);
 			rhi->SetShader(mVS);
-			rhi->SetShader(mHS);
+			rhi->SetShader(mUseCDLOD ? mHS_CDLOD : mHS);
 			rhi->SetRootSignatureToPSO(psoName, rootSig);
 			rhi->SetBlendState(ER_RHI_BLEND_STATE::ER_NO_BLEND);
 			rhi->SetDepthStencilState(ER_RHI_DEPTH_STENCIL_STATE::ER_DEPTH_ONLY_WRITE_COMPARISON_LESS_EQUAL);
@@ -713,7 +906,7 @@ namespace EveryRay_Core
 			rhi->SetSamplers(ER_PIXEL, { ER_RHI_SAMPLER_STATE::ER_TRILINEAR_WRAP, ER_RHI_SAMPLER_STATE::ER_TRILINEAR_CLAMP, ER_RHI_SAMPLER_STATE::ER_SHADOW_SS });
 		}
 		
-		rhi->Draw(NUM_TERRAIN_PATCHES_PER_TILE * NUM_TERRAIN_PATCHES_PER_TILE);
+		rhi->Draw(patchesCount);
 		
 		rhi->UnsetPSO();
 
@@ -726,46 +919,6 @@ namespace EveryRay_Core
 	}
 
 
-	float HeightMap::FindHeightFromPosition(float x, float z)
-	{
-		int index = 0;
-		float vertex1[3] = { 0.0, 0.0, 0.0 };
-		float vertex2[3] = { 0.0, 0.0, 0.0 }; 
-		float vertex3[3] = { 0.0, 0.0, 0.0 }; 
-		float normals[3] = { 0.0, 0.0, 0.0 }; 
-		float height = 0.0f;
-		bool isFound = false;
-
-		int index1 = 0;
-		int index2 = 0;
-		int index3 = 0;
-
-		for (int i = 0; i < mVertexCountNonTS / 3; i++)
-		{
-			index = i * 3;
-
-			vertex1[0] = mVertexList[index].x;
-			vertex1[1] = mVertexList[index].y;
-			vertex1[2] = mVertexList[index].z;
-			index++;
-
-			vertex2[0] = mVertexList[index].x;
-			vertex2[1] = mVertexList[index].y;
-			vertex2[2] = mVertexList[index].z;
-			index++;
-
-			vertex3[0] = mVertexList[index].x;
-			vertex3[1] = mVertexList[index].y;
-			vertex3[2] = mVertexList[index].z;
-
-			// Check to see if this is the polygon we are looking for.
-			isFound = GetHeightFromTriangle(x, z, vertex1, vertex2, vertex3, normals, height);
-			if (isFound)
-				return height;
-		}
-		return -1.0f;
-	}
-
 	bool HeightMap::PerformCPUFrustumCulling(ER_Camera* camera)
 	{
 		if (!camera)
@@ -814,287 +967,455 @@ namespace EveryRay_Core
 		return culled;
 	}
 
-	bool HeightMap::RayIntersectsTriangle(float x, float z, float v0[3], float v1[3], float v2[3], float normals[3], float& height)
+	bool HeightMap::IsColliding(const XMFLOAT4& position, bool onlyXZCheck)
 	{
-		const float EPSILON = 0.00001f;
-
-		XMVECTOR directionVector = { 0.0f, 1.0f, 0.0f };
-		XMVECTOR originVector = { x, 0.0f, z };
-
-		XMVECTOR edge1 = { v1[0] - v0[0],v1[1] - v0[1], v1[2] - v0[2] };
-		XMVECTOR edge2 = { v2[0] - v0[0],v2[1] - v0[1], v2[2] - v0[2] };
-
-		XMVECTOR h = XMVector3Cross(directionVector, edge2);
-
-		float a = 0.0f;
-		XMStoreFloat(&a, XMVector3Dot(edge1, h));
-
-		if (a > -EPSILON && a < EPSILON)
-			return false;    // This ray is parallel to this triangle.
-		float f = 1.0f / a;
-		XMVECTOR s = XMVectorSubtract(originVector, XMVECTOR{v0[0],v0[1],v0[2]});
-		
-		float dotSH;
-		XMStoreFloat(&dotSH, XMVector3Dot(s, h));
+		bool isColliding =  onlyXZCheck ?
+			((position.x <= mAABB.second.x && position.x >= mAABB.first.x) &&
+			(position.z <= mAABB.second.z && position.z >= mAABB.first.z))
+			:
+			((position.x <= mAABB.second.x && position.x >= mAABB.first.x) &&
+			(position.y <= mAABB.second.y && position.y >= mAABB.first.y) &&
+			(position.z <= mAABB.second.z && position.z >= mAABB.first.z));
 
-		float u = f * dotSH;
-		if (u < 0.0 || u > 1.0)
-			return false;
+		return isColliding;
+	}
 
-		XMVECTOR q = XMVector3Cross(s, edge1);
+	HeightMap::HeightMap(int width, int height) : mWidth(width), mHeight(height), mStreamingState(TILE_NOT_RESIDENT)
+	{
+	}
 
-		float dotDirQ;
-		XMStoreFloat(&dotDirQ, XMVector3Dot(directionVector, q));
+	HeightMap::~HeightMap()
+	{		
+		DeleteObject(mSplatTexture);
+		DeleteObject(mHeightTexture);
+		DeleteObjects(mSplatDataCPU);
+	}
 
-		float v = f * dotDirQ;
-		if (v < 0.0 || u + v > 1.0)
-			return false;
+	// Same as the texture sampling with a bilinear clamp sampler in PlaceObjectsOnTerrain.hlsl
+	float HeightMap::SampleHeightBilinear(float u, float v) const
+	{
+		assert(mRawHeights);
+
+		float texelX = u * static_cast<float>(mWidth) - 0.5f;
+		float texelY = v * static_cast<float>(mHeight) - 0.5f;
+		float floorX = floorf(texelX);
+		float floorY = floorf(texelY);
+		float fracX = texelX - floorX;
+		float fracY = texelY - floorY;
+
+		int x0 = std::max(0, std::min(static_cast<int>(floorX), mWidth - 1));
+		int y0 = std::max(0, std::min(static_cast<int>(floorY), mHeight - 1));
+		int x1 = std::max(0, std::min(static_cast<int>(floorX) + 1, mWidth - 1));
+		int y1 = std::max(0, std::min(static_cast<int>(floorY) + 1, mHeight - 1));
+
+		const float normalization = 1.0f / 65535.0f;
+		float h00 = static_cast<float>(mRawHeights[y0 * mWidth + x0]) * normalization;
+		float h10 = static_cast<float>(mRawHeights[y0 * mWidth + x1]) * normalization;
+		float h01 = static_cast<float>(mRawHeights[y1 * mWidth + x0]) * normalization;
+		float h11 = static_cast<float>(mRawHeights[y1 * mWidth + x1]) * normalization;
+
+		return ER_Lerp(ER_Lerp(h00, h10, fracX), ER_Lerp(h01, h11, fracX), fracY);
+	}
 
-		// At this stage we can compute t to find out where the intersection point is on the line.
-		float dotEdge2Q;
-		XMStoreFloat(&dotEdge2Q, XMVector3Dot(edge2, q));
-		float t = f * dotEdge2Q;
-		if (t > EPSILON) // ray intersection
+	// Same as the texture sampling with a linear wrap sampler (top mip) in PlaceObjectsOnTerrain.hlsl
+	XMFLOAT4 HeightMap::SampleSplatBilinear(float u, float v) const
+	{
+		if (!mSplatDataCPU)
+			return XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+
+		float texelX = u * static_cast<float>(mSplatWidth) - 0.5f;
+		float texelY = v * static_cast<float>(mSplatHeight) - 0.5f;
+		float floorX = floorf(texelX);
+		float floorY = floorf(texelY);
+		float fracX = texelX - floorX;
+		float fracY = texelY - floorY;
+
+		auto wrap = [](int value, int size) { int result = value % size; return result < 0 ? result + size : result; };
+		int x0 = wrap(static_cast<int>(floorX), mSplatWidth);
+		int y0 = wrap(static_cast<int>(floorY), mSplatHeight);
+		int x1 = wrap(static_cast<int>(floorX) + 1, mSplatWidth);
+		int y1 = wrap(static_cast<int>(floorY) + 1, mSplatHeight);
+
+		float result[4];
+		const float normalization = 1.0f / 255.0f;
+		for (int channel = 0; channel < 4; channel++)
 		{
-			//outIntersectionPoint = rayOrigin + rayVector * t;
-			return true;
+			float c00 = static_cast<float>(mSplatDataCPU[(y0 * mSplatWidth + x0) * 4 + channel]) * normalization;
+			float c10 = static_cast<float>(mSplatDataCPU[(y0 * mSplatWidth + x1) * 4 + channel]) * normalization;
+			float c01 = static_cast<float>(mSplatDataCPU[(y1 * mSplatWidth + x0) * 4 + channel]) * normalization;
+			float c11 = static_cast<float>(mSplatDataCPU[(y1 * mSplatWidth + x1) * 4 + channel]) * normalization;
+			result[channel] = ER_Lerp(ER_Lerp(c00, c10, fracX), ER_Lerp(c01, c11, fracX), fracY);
 		}
-		else // This means that there is a line intersection but not a ray intersection.
-			return false;
+		return XMFLOAT4(result[0], result[1], result[2], result[3]);
 	}
 
-	bool HeightMap::GetHeightFromTriangle(float x, float z, float v0[3], float v1[3], float v2[3], float normals[3], float& height)
+	// Tiles are laid out on a regular grid (see LoadTerrainData()), so we can find the tile directly from the position
+	int ER_Terrain::FindTileIndex(float x, float z)
 	{
-		float startVector[3], directionVector[3], edge1[3], edge2[3], normal[3];
-		float Q[3], e1[3], e2[3], e3[3], edgeNormal[3], temp[3];
-		float magnitude, D, denominator, numerator, t, determinant;
-
-
-		// Starting position of the ray that is being cast.
-		startVector[0] = x;
-		startVector[1] = 0.0f;
-		startVector[2] = z;
+		if (mHeightMaps.empty())
+			return -1;
 
-		// The direction the ray is being cast.
-		directionVector[0] = 0.0f;
-		directionVector[1] = -1.0f;
-		directionVector[2] = 0.0f;
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
+		const float maxTile = static_cast<float>(static_cast<int>(sqrt(mNumTiles)) - 1);
+		int tileX = static_cast<int>(std::max(0.0f, std::min(floorf(x / tileSize) + 1.0f, maxTile)));
+		int tileY = static_cast<int>(std::max(0.0f, std::min(ceilf(-z / tileSize), maxTile)));
 
-		// Calculate the two edges from the three points given.
-		edge1[0] = v1[0] - v0[0];
-		edge1[1] = v1[1] - v0[1];
-		edge1[2] = v1[2] - v0[2];
+		int tileIndex = tileX * static_cast<int>(sqrt(mNumTiles)) + tileY;
+		return mHeightMaps[tileIndex]->IsColliding(XMFLOAT4(x, 0.0f, z, 1.0f), true) ? tileIndex : -1;
+	}
 
-		edge2[0] = v2[0] - v0[0];
-		edge2[1] = v2[1] - v0[1];
-		edge2[2] = v2[2] - v0[2];
+	// Vertical ray against the tile's pyramid (same query as Raycast()) when the tile is streamed in,
+	// otherwise the memory-mapped heights are sampled directly (both give the same bilinear surface, but we do not page in pyramids here: called from multiple threads).
+	float ER_Terrain::FindHeightFromHeightmap(float x, float z, int tileIndex)
+	{
+		const HeightMap* tile = mHeightMaps[tileIndex];
+		if (tile->IsResident() && tile->mHeightPyramid.IsBuilt())
+		{
+			const float rayStartY = tile->mAABB.second.y + 1.0f;
+			float distance;
+			if (RaycastTile(tile, tile->mHeightPyramid, XMFLOAT3(x, rayStartY, z), XMFLOAT3(0.0f, -1.0f, 0.0f), FLT_MAX, distance))
+				return rayStartY - distance;
+		}
 
-		// Calculate the normal of the triangle from the two edges.
-		normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
-		normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
-		normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
+		float u = (x + mHeightMaps[tileIndex]->mTileUVOffset.x) / tileSize;
+		float v = (z + mHeightMaps[tileIndex]->mTileUVOffset.y) / tileSize;
+		return mHeightMaps[tileIndex]->SampleHeightBilinear(u, v) * mTerrainTessellatedHeightScale;
+	}
 
-		magnitude = (float)sqrt((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2]));
-		normal[0] = normal[0] / magnitude;
-		normal[1] = normal[1] / magnitude;
-		normal[2] = normal[2] / magnitude;
+	// Slab test, returns the [enter, exit] range of the ray inside the box (clipped by [aTMin, aTMax])
+	static bool IntersectRayBox(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, const XMFLOAT3& aMin, const XMFLOAT3& aMax, float aTMin, float aTMax,
+		float& aOutEnter, float& aOutExit)
+	{
+		const float origin[3] = { aOrigin.x, aOrigin.y, aOrigin.z };
+		const float direction[3] = { aDirection.x, aDirection.y, aDirection.z };
+		const float boundsMin[3] = { aMin.x, aMin.y, aMin.z };
+		const float boundsMax[3] = { aMax.x, aMax.y, aMax.z };
+
+		aOutEnter = aTMin;
+		aOutExit = aTMax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (fabs(direction[axis]) < 1e-12f)
+			{
+				if (origin[axis] < boundsMin[axis] || origin[axis] > boundsMax[axis])
+					return false;
+			}
+			else
+			{
+				float t0 = (boundsMin[axis] - origin[axis]) / direction[axis];
+				float t1 = (boundsMax[axis] - origin[axis]) / direction[axis];
+				aOutEnter = std::max(aOutEnter, std::min(t0, t1));
+				aOutExit = std::min(aOutExit, std::max(t0, t1));
+				if (aOutEnter > aOutExit)
+					return false;
+			}
+		}
+		return true;
+	}
 
-		// Find the distance from the origin to the plane.
-		D = ((-normal[0] * v0[0]) + (-normal[1] * v0[1]) + (-normal[2] * v0[2]));
+	// Pyramid space: texels (shifted by 1) in XZ, normalized height in Y; the ray's parameter stays the same.
+	// Const and without any scratch data, so it can be called from multiple threads (i.e., in PlaceOnTerrainCPU()).
+	bool ER_Terrain::RaycastTile(const HeightMap* aTile, const ER_TerrainHeightPyramid& aPyramid, const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance,
+		float& aOutDistance) const
+	{
+		const float worldToTexels = static_cast<float>(mTileResolution) / static_cast<float>(mTileResolution * mTileScale);
+		XMFLOAT3 origin = XMFLOAT3(
+			(aOrigin.x - aTile->mAABB.first.x) * worldToTexels + 0.5f,
+			aOrigin.y / mTerrainTessellatedHeightScale,
+			(aOrigin.z - aTile->mAABB.first.z) * worldToTexels + 0.5f);
+		XMFLOAT3 direction = XMFLOAT3(aDirection.x * worldToTexels, aDirection.y / mTerrainTessellatedHeightScale, aDirection.z * worldToTexels);
+		return aPyramid.Raycast(origin, direction, aMaxDistance, aOutDistance) && aOutDistance <= aMaxDistance;
+	}
 
-		// Get the denominator of the equation.
-		denominator = ((normal[0] * directionVector[0]) + (normal[1] * directionVector[1]) + (normal[2] * directionVector[2]));
+	// Resident tiles have their pyramid built on streaming. Heights of the other tiles are memory-mapped as well,
+	// so their pyramid is built on demand into mRaycastPagedPyramid (and kept for the next rays, i.e., while the user drags the cursor over the same distant tile).
+	const ER_TerrainHeightPyramid* ER_Terrain::GetRaycastPyramid(int aTileIndex)
+	{
+		const HeightMap* tile = mHeightMaps[aTileIndex];
+		if (tile->IsResident() && tile->mHeightPyramid.IsBuilt())
+			return &tile->mHeightPyramid;
+		if (!tile->mRawHeights)
+			return nullptr;
 
-		// Make sure the result doesn't get too close to zero to prevent divide by zero.
-		if (fabs(denominator) < 0.0001f)
+		if (mRaycastPagedTileIndex != aTileIndex)
 		{
-			return false;
+			mRaycastPagedPyramid.Build(tile->mRawHeights, mTileResolution);
+			mRaycastPagedTileIndex = aTileIndex;
+			mRaycastPagedTilesCount++;
 		}
+		return &mRaycastPagedPyramid;
+	}
 
-		// Get the numerator of the equation.
-		numerator = -1.0f * (((normal[0] * startVector[0]) + (normal[1] * startVector[1]) + (normal[2] * startVector[2])) + D);
-
-		// Calculate where we intersect the triangle.
-		t = numerator / denominator;
+	// Tiles are visited front to back with a 2D DDA over the tiles' grid (no per-ray allocations or sorting), so we can stop at the first tile with a hit.
+	// Every tile along the ray is tested with full resolution heights, even if it is not streamed in (see GetRaycastPyramid()).
+	bool ER_Terrain::Raycast(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, XMFLOAT3& aOutPosition, float* aOutDistance)
+	{
+		if (!mLoaded || mHeightMaps.empty() || mTerrainTessellatedHeightScale < 0.0001f)
+			return false;
 
-		// Find the intersection vector.
-		Q[0] = startVector[0] + (directionVector[0] * t);
-		Q[1] = startVector[1] + (directionVector[1] * t);
-		Q[2] = startVector[2] + (directionVector[2] * t);
+		const int numTilesSqrt = static_cast<int>(sqrt(mNumTiles));
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
 
-		// Find the three edges of the triangle.
-		e1[0] = v1[0] - v0[0];
-		e1[1] = v1[1] - v0[1];
-		e1[2] = v1[2] - v0[2];
+		// XZ - grid of the tiles (see LoadTerrainData()), Y - whole height scale
+		const XMFLOAT3 boundsMin = XMFLOAT3(-tileSize, 0.0f, -tileSize * (numTilesSqrt - 1));
+		const XMFLOAT3 boundsMax = XMFLOAT3(tileSize * (numTilesSqrt - 1), mTerrainTessellatedHeightScale, tileSize);
+		float tEnter, tExit;
+		if (!IntersectRayBox(aOrigin, aDirection, boundsMin, boundsMax, 0.0f, aMaxDistance, tEnter, tExit))
+			return false;
 
-		e2[0] = v2[0] - v1[0];
-		e2[1] = v2[1] - v1[1];
-		e2[2] = v2[2] - v1[2];
+		const float enterX = aOrigin.x + aDirection.x * tEnter;
+		const float enterZ = aOrigin.z + aDirection.z * tEnter;
+		int tileX = std::max(0, std::min(static_cast<int>(floorf(enterX / tileSize)) + 1, numTilesSqrt - 1));
+		int tileY = std::max(0, std::min(static_cast<int>(floorf(-enterZ / tileSize)) + 1, numTilesSqrt - 1));
+		const int stepX = aDirection.x >= 0.0f ? 1 : -1;
+		const int stepY = aDirection.z > 0.0f ? -1 : 1; // rows of the tiles go along -Z
+
+		// ray parameters of the tile's borders in the direction of the ray
+		auto getNextBorderX = [&]() { return fabs(aDirection.x) > 1e-12f ? (tileSize * (stepX > 0 ? tileX : tileX - 1) - aOrigin.x) / aDirection.x : FLT_MAX; };
+		auto getNextBorderY = [&]() { return fabs(aDirection.z) > 1e-12f ? (-tileSize * (stepY > 0 ? tileY : tileY - 1) - aOrigin.z) / aDirection.z : FLT_MAX; };
+		float tNextX = getNextBorderX();
+		float tNextY = getNextBorderY();
+
+		float tTileEnter = tEnter;
+		while (true)
+		{
+			const float tTileExit = std::min(tExit, std::min(tNextX, tNextY));
+			HeightMap* tile = mHeightMaps[tileX * numTilesSqrt + tileY];
 
-		e3[0] = v0[0] - v2[0];
-		e3[1] = v0[1] - v2[1];
-		e3[2] = v0[2] - v2[2];
+			// skip the tile if the part of the ray inside of it is above/below its heights
+			const float enterY = aOrigin.y + aDirection.y * tTileEnter;
+			const float exitY = aOrigin.y + aDirection.y * tTileExit;
+			if (std::min(enterY, exitY) <= tile->mAABB.second.y && std::max(enterY, exitY) >= tile->mAABB.first.y)
+			{
+				const ER_TerrainHeightPyramid* pyramid = GetRaycastPyramid(tileX * numTilesSqrt + tileY);
+				float distance;
+				if (pyramid && RaycastTile(tile, *pyramid, aOrigin, aDirection, tExit, distance))
+				{
+					aOutPosition = XMFLOAT3(aOrigin.x + aDirection.x * distance, aOrigin.y + aDirection.y * distance, aOrigin.z + aDirection.z * distance);
+					if (aOutDistance)
+						*aOutDistance = distance;
+					return true;
+				}
+			}
 
-		// Calculate the normal for the first edge.
-		edgeNormal[0] = (e1[1] * normal[2]) - (e1[2] * normal[1]);
-		edgeNormal[1] = (e1[2] * normal[0]) - (e1[0] * normal[2]);
-		edgeNormal[2] = (e1[0] * normal[1]) - (e1[1] * normal[0]);
+			if (tTileExit >= tExit)
+				break;
+			if (tNextX < tNextY)
+			{
+				tileX += stepX;
+				if (tileX < 0 || tileX >= numTilesSqrt)
+					break;
+				tNextX = getNextBorderX();
+			}
+			else
+			{
+				tileY += stepY;
+				if (tileY < 0 || tileY >= numTilesSqrt)
+					break;
+				tNextY = getNextBorderY();
+			}
+			tTileEnter = tTileExit;
+		}
+		return false;
+	}
 
-		// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-		temp[0] = Q[0] - v0[0];
-		temp[1] = Q[1] - v0[1];
-		temp[2] = Q[2] - v0[2];
+	// Segment query (start + (end - start) * [0-1]), see Raycast()
+	bool ER_Terrain::IsColliding(const XMFLOAT3& aStart, const XMFLOAT3& aEnd, XMFLOAT3* aOutPosition)
+	{
+		XMFLOAT3 position;
+		if (!Raycast(aStart, XMFLOAT3(aEnd.x - aStart.x, aEnd.y - aStart.y, aEnd.z - aStart.z), 1.0f, position))
+			return false;
 
-		determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+		if (aOutPosition)
+			*aOutPosition = position;
+		return true;
+	}
 
-		// Check if it is outside.
-		if (determinant > 0.001f)
+	// Same test as ER_SELF_TEST_TERRAIN_RAYCAST, but across the closest resident tile (real heights instead of synthetic ones)
+	void ER_Terrain::RunRaycastBenchmark()
+	{
+		HeightMap* tile = nullptr;
+		for (int tileIndex : mStreamedTiles)
 		{
-			return false;
+			HeightMap* streamedTile = mHeightMaps[tileIndex];
+			if (streamedTile->IsResident() && streamedTile->mHeightPyramid.IsBuilt() && (!tile || streamedTile->mCameraDistance < tile->mCameraDistance))
+				tile = streamedTile;
 		}
+		if (!tile)
+			return;
 
-		// Calculate the normal for the second edge.
-		edgeNormal[0] = (e2[1] * normal[2]) - (e2[2] * normal[1]);
-		edgeNormal[1] = (e2[2] * normal[0]) - (e2[0] * normal[2]);
-		edgeNormal[2] = (e2[0] * normal[1]) - (e2[1] * normal[0]);
-
-		// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-		temp[0] = Q[0] - v1[0];
-		temp[1] = Q[1] - v1[1];
-		temp[2] = Q[2] - v1[2];
+		const bool passed = tile->mHeightPyramid.RunRaycastBenchmark(ER_SELF_TESTS_TERRAIN_RAYS, ER_SELF_TESTS_TERRAIN_REFERENCE_RAYS, mRaycastBenchmarkResult);
+		mRaycastBenchmarkResult = std::string(passed ? "passed\n" : "FAILED\n") + mRaycastBenchmarkResult;
+		ER_OUTPUT_LOG(ER_Utility::ToWideString("[ER Logger][ER_Terrain] Raycast benchmark: " + mRaycastBenchmarkResult + "\n").c_str());
+	}
 
-		determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+	bool ER_Terrain::IsOnSplatChannel(float x, float z, int tileIndex, TerrainSplatChannels splatChannel)
+	{
+		const float tileSize = static_cast<float>(mTileResolution * mTileScale);
+		float u = (x + mHeightMaps[tileIndex]->mTileUVOffset.x) / tileSize;
+		float v = 1.0f - (z + mHeightMaps[tileIndex]->mTileUVOffset.y) / tileSize;
 
-		// Check if it is outside.
-		if (determinant > 0.001f)
+		XMFLOAT4 value = mHeightMaps[tileIndex]->SampleSplatBilinear(u, v);
+		switch (splatChannel)
 		{
+		case TerrainSplatChannels::CHANNEL_0:
+			return value.x > TERRAIN_PLACEMENT_SPLAT_THRESHOLD;
+		case TerrainSplatChannels::CHANNEL_1:
+			return value.y > TERRAIN_PLACEMENT_SPLAT_THRESHOLD;
+		case TerrainSplatChannels::CHANNEL_2:
+			return value.z > TERRAIN_PLACEMENT_SPLAT_THRESHOLD;
+		case TerrainSplatChannels::CHANNEL_3:
+			return value.w > TERRAIN_PLACEMENT_SPLAT_THRESHOLD;
+		default:
 			return false;
 		}
+	}
 
-		// Calculate the normal for the third edge.
-		edgeNormal[0] = (e3[1] * normal[2]) - (e3[2] * normal[1]);
-		edgeNormal[1] = (e3[2] * normal[0]) - (e3[0] * normal[2]);
-		edgeNormal[2] = (e3[0] * normal[1]) - (e3[1] * normal[0]);
-
-		// Calculate the determinant to see if it is on the inside, outside, or directly on the edge.
-		temp[0] = Q[0] - v2[0];
-		temp[1] = Q[1] - v2[1];
-		temp[2] = Q[2] - v2[2];
+	// Method for displacing points on terrain: same logic as PlaceObjectsOnTerrain.hlsl, but working directly on the .r16 heights (and the CPU copy of splat maps).
+	// No GPU dispatch, no readback and no sync point with the GPU, so it can be called at any time (i.e., during level load or from the editor).
+	// Use cases: placing ER_RenderingObject(s) on terrain (even their instances individually), placing ER_Foliage patches on terrain (batch placement).
+	// Positions are processed in parallel (in-place), results do not depend on the amount of threads.
+	// Heights are always available (memory-mapped), splat maps of the tiles which are not streamed in are loaded temporarily.
+	void ER_Terrain::PlaceOnTerrainCPU(XMFLOAT4* positions, int positionsCount, TerrainSplatChannels splatChannel, float customDampDelta)
+	{
+		assert(positions);
+		if (!mLoaded || positionsCount <= 0)
+			return;
 
-		determinant = ((edgeNormal[0] * temp[0]) + (edgeNormal[1] * temp[1]) + (edgeNormal[2] * temp[2]));
+		const float heightDelta = abs(customDampDelta - FLT_MAX) < std::numeric_limits<float>::epsilon() ? mPlacementHeightDelta : customDampDelta;
 
-		// Check if it is outside.
-		if (determinant > 0.001f)
+		std::vector<int> tempSplatTiles;
+		if (splatChannel != TerrainSplatChannels::NONE)
 		{
-			return false;
+			std::vector<bool> isTileTouched(mHeightMaps.size(), false);
+			for (int i = 0; i < positionsCount; i++)
+			{
+				int tileIndex = FindTileIndex(positions[i].x, positions[i].z);
+				if (tileIndex >= 0)
+					isTileTouched[tileIndex] = true;
+			}
+
+			for (int tileIndex = 0; tileIndex < static_cast<int>(mHeightMaps.size()); tileIndex++)
+			{
+				if (!isTileTouched[tileIndex])
+					continue;
+
+				HeightMap* tile = mHeightMaps[tileIndex];
+				if (tile->mStreamingState == TILE_LOADING) // streaming thread is writing the splat data right now
+					mStreamer->WaitForDecoded(tileIndex);
+
+				if (!tile->mSplatDataCPU)
+				{
+					if (!LoadSplatmapPerTileCPU(tile))
+						throw ER_CoreException("Can not load the terrain's splatmap for CPU placement!");
+					tempSplatTiles.push_back(tileIndex);
+				}
+			}
 		}
 
-		// Now we have our height.
-		height = Q[1];
+		int numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		numThreads = std::max(1, std::min(numThreads, positionsCount / MIN_TERRAIN_PLACEMENT_POSITIONS_PER_THREAD));
+		int positionsPerThread = positionsCount / numThreads;
 
-		return true;
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads);
+		for (int i = 0; i < numThreads; i++)
+		{
+			threads.push_back(std::thread([&, i]
+			{
+				int endRange = (i < numThreads - 1) ? (i + 1) * positionsPerThread : positionsCount;
+				for (int j = i * positionsPerThread; j < endRange; j++)
+				{
+					int tileIndex = FindTileIndex(positions[j].x, positions[j].z);
+					if (tileIndex >= 0 && (splatChannel == TerrainSplatChannels::NONE || IsOnSplatChannel(positions[j].x, positions[j].z, tileIndex, splatChannel)))
+						positions[j].y = FindHeightFromHeightmap(positions[j].x, positions[j].z, tileIndex) - heightDelta;
+					else
+						positions[j].y = TERRAIN_PLACEMENT_CULLED_HEIGHT;
+				}
+			}));
+		}
+		for (auto& t : threads) t.join();
+
+		for (int tileIndex : tempSplatTiles)
+			DeleteObjects(mHeightMaps[tileIndex]->mSplatDataCPU);
 	}
 
-	bool HeightMap::IsColliding(const XMFLOAT4& position, bool onlyXZCheck)
+	// Hash of the terrain's contents: heights and splat maps are hashed once when the heights file is packed (stored in its header),
+	// so the key is the same on every machine with the same data (checkouts and copies of the level keep their placement caches)
+	void ER_Terrain::CalculateTerrainDataHash()
 	{
-		bool isColliding =  onlyXZCheck ?
-			((position.x <= mAABB.second.x && position.x >= mAABB.first.x) &&
-			(position.z <= mAABB.second.z && position.z >= mAABB.first.z))
-			:
-			((position.x <= mAABB.second.x && position.x >= mAABB.first.x) &&
-			(position.y <= mAABB.second.y && position.y >= mAABB.first.y) &&
-			(position.z <= mAABB.second.z && position.z >= mAABB.first.z));
-
-		return isColliding;
+		const UINT64 contentHash = mHeightsFile.GetContentHash();
+
+		UINT64 hash = ER_HASH_SEED;
+		hash = ER_Utility::HashBytes(&mNumTiles, sizeof(mNumTiles), hash);
+		hash = ER_Utility::HashBytes(&mTileResolution, sizeof(mTileResolution), hash);
+		hash = ER_Utility::HashBytes(&mTileScale, sizeof(mTileScale), hash);
+		hash = ER_Utility::HashBytes(&contentHash, sizeof(contentHash), hash);
+		mTerrainDataHash = hash;
 	}
 
-	// Method for displacing points on terrain (send some points to the GPU, get transformed points from the GPU).
-	// GPU does everything in a compute shader (it finds a proper terrain tile, checks for the splat channel and transforms the provided points).
-	// There is also some older functionality (USE_RAYCASTING_FOR_ON_TERRAIN_PLACEMENT) if you do not want to check heightmap collisions (fast) but use raycasts to geometry instead (slow).
-	// 
-	// Use cases: 
-	// - placing ER_RenderingObject(s) on terrain (even their instances individually)
-	// - placing ER_Foliage patches on terrain (batch placement)
-	void ER_Terrain::PlaceOnTerrain(ER_RHI_GPUBuffer* outputBuffer, ER_RHI_GPUBuffer* inputBuffer, XMFLOAT4* positions, int positionsCount,
-		TerrainSplatChannels splatChannel, XMFLOAT4* terrainVertices, int terrainVertexCount, float customDampDelta)
+	struct PlacementCacheHeader
 	{
-		assert(inputBuffer && outputBuffer);
-		ER_RHI* rhi = GetCore()->GetRHI();
-
-#if USE_RAYCASTING_FOR_ON_TERRAIN_PLACEMENT
-		ER_RHI_GPUBuffer* terrainBuffer = rhi->CreateGPUBuffer("ER_RHI_GPUBuffer: Terrain raycasting placement data");
-		terrainBuffer->CreateGPUBufferResource(rhi, terrainVertices, terrainVertexCount, sizeof(XMFLOAT4), false, ER_BIND_SHADER_RESOURCE, 0, ER_RESOURCE_MISC_BUFFER_STRUCTURED);
-		//...
-		//DeleteObject(terrainBuffer);
-#endif
-		rhi->SetRootSignature(mTerrainPlacementPassRS, true);		
-		if (!rhi->IsPSOReady(mTerrainPlacementPassPSOName, true))
+		UINT Magic;
+		UINT Version;
+		UINT64 InputHash;
+		UINT ElementSize;
+		UINT ElementCount;
+	};
+	static const UINT PLACEMENT_CACHE_MAGIC = 0x43505245; // "ERPC"
+	static const UINT PLACEMENT_CACHE_VERSION = 1;
+
+	std::wstring ER_Terrain::GetPlacementCachePath(const std::string& aCacheName)
+	{
+		std::string fileName = aCacheName;
+		for (auto& c : fileName)
 		{
-			rhi->InitializePSO(mTerrainPlacementPassPSOName, true);
-			rhi->SetRootSignatureToPSO(mTerrainPlacementPassPSOName, mTerrainPlacementPassRS, true);
-			rhi->SetShader(mPlaceOnTerrainCS);
-			rhi->FinalizePSO(mTerrainPlacementPassPSOName, true);
+			if (c == '\\' || c == '/' || c == ':' || c == '*' || c == '?' || c == '"' || c == '<' || c == '>' || c == '|' || c == '#')
+				c = '_';
 		}
-		rhi->SetPSO(mTerrainPlacementPassPSOName, true);
-		mPlaceOnTerrainConstantBuffer.Data.HeightScale = mTerrainTessellatedHeightScale;
-		mPlaceOnTerrainConstantBuffer.Data.SplatChannel = splatChannel == TerrainSplatChannels::NONE ? -1.0f : static_cast<float>(splatChannel);
-		mPlaceOnTerrainConstantBuffer.Data.TerrainTileCount = static_cast<int>(mNumTiles);
-		mPlaceOnTerrainConstantBuffer.Data.PlacementHeightDelta = abs(customDampDelta - FLT_MAX) < std::numeric_limits<float>::epsilon() ? mPlacementHeightDelta : customDampDelta;
-		mPlaceOnTerrainConstantBuffer.ApplyChanges(rhi);
-		rhi->SetConstantBuffers(ER_COMPUTE, { mPlaceOnTerrainConstantBuffer.Buffer() }, 0,
-			mTerrainPlacementPassRS, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_CBV_INDEX, true);
-		rhi->SetShaderResources(ER_COMPUTE, { mTerrainTilesDataGPU, mTerrainTilesHeightmapsArrayTexture, mTerrainTilesSplatmapsArrayTexture }, 0,
-			mTerrainPlacementPassRS, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_SRV_INDEX, true);
-		rhi->SetUnorderedAccessResources(ER_COMPUTE, { inputBuffer }, 0,
-			mTerrainPlacementPassRS, PLACEMENT_PASS_ROOT_DESCRIPTOR_TABLE_UAV_INDEX, true);
-		rhi->SetSamplers(ER_COMPUTE, { ER_RHI_SAMPLER_STATE::ER_BILINEAR_CLAMP, ER_RHI_SAMPLER_STATE::ER_TRILINEAR_WRAP });
-		rhi->Dispatch(512, 1, 1);
-		rhi->UnsetPSO();
-		rhi->UnbindResourcesFromShader(ER_COMPUTE);
-
-#ifdef ER_PLATFORM_WIN64_DX11
-		ReadbackPlacedPositions(outputBuffer, inputBuffer, positions, positionsCount); //direct readback in the dx11 immediate context
-#endif
+		return mLevelPath + L"terrain\\placement_cache\\" + ER_Utility::ToWideString(fileName) + L".bin";
 	}
 
-	// Read-back (GPU to CPU) new positions from placement compute pass
-	// WARNING: we are doing that in a current frame and waiting when GPU is finished => this produces a stall
-	// Ideally we should do that in async (on modern APIs) or read back on CPU in the next frame
-	void ER_Terrain::ReadbackPlacedPositions(ER_RHI_GPUBuffer* outputBuffer, ER_RHI_GPUBuffer* inputBuffer, XMFLOAT4* positions, int positionsCount)
+	// Placement caches store final (already placed on terrain) data of some system (i.e., instance transforms, foliage patches).
+	// Every cache is keyed by a hash of its inputs, which should always include GetTerrainDataHash(), so that changes in terrain invalidate it.
+	bool ER_Terrain::ReadPlacementCache(const std::string& aCacheName, UINT64 aInputHash, void* aOutData, UINT aElementSize, UINT aElementCount)
 	{
-		ER_RHI* rhi = GetCore()->GetRHI();
+		assert(aOutData);
 
-		rhi->BeginCopyCommandList();
-		rhi->CopyBuffer(outputBuffer, inputBuffer, 0, true);
-		rhi->EndCopyCommandList();
-		rhi->ExecuteCopyCommandList(); // it will wait for GPU on a copy fence in this method, too
+		FILE* filePtr = nullptr;
+		if (_wfopen_s(&filePtr, GetPlacementCachePath(aCacheName).c_str(), L"rb") != 0 || !filePtr)
+			return false;
 
-		void* outputData = nullptr;
-		rhi->BeginBufferRead(outputBuffer, &outputData);
-		{
-			assert(outputData);
-			XMFLOAT4* newPositions = reinterpret_cast<XMFLOAT4*>(outputData);
-			for (size_t i = 0; i < positionsCount; i++)
-				positions[i] = newPositions[i];
-		}
-		rhi->EndBufferRead(outputBuffer);
+		PlacementCacheHeader header = {};
+		bool isValid = fread(&header, sizeof(PlacementCacheHeader), 1, filePtr) == 1 &&
+			header.Magic == PLACEMENT_CACHE_MAGIC && header.Version == PLACEMENT_CACHE_VERSION && header.InputHash == aInputHash &&
+			header.ElementSize == aElementSize && header.ElementCount == aElementCount;
+		if (isValid)
+			isValid = fread(aOutData, aElementSize, aElementCount, filePtr) == aElementCount;
+
+		fclose(filePtr);
+		return isValid;
 	}
 
-	HeightMap::HeightMap(int width, int height)
+	void ER_Terrain::WritePlacementCache(const std::string& aCacheName, UINT64 aInputHash, const void* aData, UINT aElementSize, UINT aElementCount)
 	{
-		mData = new MapData[width * height];
-		mVertexList = new Vertex[(width - 1) * (height - 1) * 6];
-	}
+		assert(aData);
 
-	HeightMap::~HeightMap()
-	{		
-		DeleteObject(mVertexBufferTS);
-		DeleteObject(mVertexBufferNonTS);
-		DeleteObject(mIndexBufferNonTS);
-		DeleteObject(mSplatTexture);
-		DeleteObject(mHeightTexture);
-		DeleteObjects(mVertexList);
-		DeleteObjects(mData);
-		DeleteObject(mDebugGizmoAABB);
+		std::wstring cacheDirectory = mLevelPath + L"terrain\\placement_cache\\";
+		CreateDirectory(cacheDirectory.c_str(), NULL);
+
+		FILE* filePtr = nullptr;
+		if (_wfopen_s(&filePtr, GetPlacementCachePath(aCacheName).c_str(), L"wb") != 0 || !filePtr)
+		{
+			std::wstring msg = L"[ER Logger][ER_Terrain] Could not write placement cache: " + ER_Utility::ToWideString(aCacheName) + L"\n";
+			ER_OUTPUT_LOG(msg.c_str());
+			return;
+		}
+
+		PlacementCacheHeader header = { PLACEMENT_CACHE_MAGIC, PLACEMENT_CACHE_VERSION, aInputHash, aElementSize, aElementCount };
+		fwrite(&header, sizeof(PlacementCacheHeader), 1, filePtr);
+		fwrite(aData, aElementSize, aElementCount, filePtr);
+		fclose(filePtr);
 	}
 }
\ No newline at end of file
@@ -3,11 +3,19 @@
 #include "ER_CoreComponent.h"
 #include "ER_GenericEvent.h"
 #include "RHI/ER_RHI.h"
+#include "ER_TerrainQuadTree.h"
+#include "ER_TerrainHeightPyramid.h"
+#include "ER_TerrainStreamer.h"
 
 #define NUM_THREADS_PER_TERRAIN_SIDE 4
 #define NUM_TERRAIN_PATCHES_PER_TILE 8
+#define NUM_TERRAIN_LOD_LEVELS 4 // finest CDLOD patch = tile size / 2^(NUM_TERRAIN_LOD_LEVELS - 1), i.e. the same as the regular patch
 #define NUM_TEXTURE_SPLAT_CHANNELS 4
-#define MAX_TERRAIN_TILE_COUNT 64
+#define MAX_TERRAIN_TILE_COUNT 64 // max. number of resident (streamed-in) tiles, the terrain itself can have any (power of 2) amount of tiles
+#define TERRAIN_STREAMING_DEFERRED_RELEASE_FRAMES 3 // evicted GPU resources can still be referenced by the frames in flight
+#define TERRAIN_PLACEMENT_CULLED_HEIGHT -999.0f // should match with PlaceObjectsOnTerrain.hlsl
+#define TERRAIN_PLACEMENT_SPLAT_THRESHOLD 0.2f // should match with PlaceObjectsOnTerrain.hlsl
+#define MIN_TERRAIN_PLACEMENT_POSITIONS_PER_THREAD 256
 
 namespace EveryRay_Core 
 {
@@ -24,14 +32,15 @@ namespace EveryRay_Core
 	class ER_CoreTime;
 	class ER_DirectionalLight;
 	class ER_LightProbesManager;
-	class ER_RenderableAABB;
+	class ER_DebugRenderer;
 	class ER_Camera;
 
-	struct /*ER_ALIGN_GPU_BUFFER*/ TerrainTileDataGPU
+	enum TerrainTileStreamingState
 	{
-		XMFLOAT4 UVoffsetTileSize; // x,y - offsets, z,w - tile size
-		XMFLOAT4 AABBMinPoint;
-		XMFLOAT4 AABBMaxPoint;
+		TILE_NOT_RESIDENT = 0,
+		TILE_LOADING, // requested, decoding on a streaming thread
+		TILE_DECODED, // CPU data is ready, waiting for the GPU upload on the main thread
+		TILE_RESIDENT
 	};
 
 	enum TerrainSplatChannels {
@@ -70,16 +79,9 @@ namespace EveryRay_Core
 			float TessellationFactorDynamic;
 			float DistanceFactor;
 			float TileSize;
-		};
-
-		struct ER_ALIGN_GPU_BUFFER PlaceOnTerrainData
-		{
-			float HeightScale;
-			float SplatChannel;
-			float TerrainTileCount;
-			float PlacementHeightDelta;
-		};
-	}
+			float UseCDLOD;
+			float CDLODGridResolution;
+		};	}
 
 	struct NormalVector
 	{
@@ -88,44 +90,47 @@ namespace EveryRay_Core
 
 	class HeightMap
 	{
-		struct MapData
-		{
-			float x, y, z;
-		};
-
-		struct Vertex {
-			float x, y, z;
-		};
-
 	public:
-		bool GetHeightFromTriangle(float x, float z, float v0[3], float v1[3], float v2[3], float normal[3], float& height);
-		bool RayIntersectsTriangle(float x, float z, float v0[3], float v1[3], float v2[3], float normals[3], float& height);
-		float FindHeightFromPosition(float x, float z);
 		bool PerformCPUFrustumCulling(ER_Camera* camera);
 		bool IsCulled() { return mIsCulled; }
 		bool IsColliding(const XMFLOAT4& position, bool onlyXZCheck = false);
+		bool IsResident() const { return mStreamingState == TILE_RESIDENT; }
+
+		// CPU equivalents of the placement shader's texture sampling (bilinear, normalized [0-1] values)
+		float SampleHeightBilinear(float u, float v) const;
+		XMFLOAT4 SampleSplatBilinear(float u, float v) const;
 
 		HeightMap(int width, int height);
 		~HeightMap();
 
-		Vertex* mVertexList = nullptr;
-		MapData* mData = nullptr;
+		const unsigned short* mRawHeights = nullptr; // original .r16 data, points into the memory-mapped heights file (not owned)
+		unsigned char* mSplatDataCPU = nullptr; // RGBA8 copy of the splat texture (used for CPU placement), only kept while the tile is streamed in
+		DirectX::ScratchImage mSplatMipsCPU; // mip chain of the splat texture (decoded on a streaming thread, released after the GPU upload)
+		std::wstring mSplatPath;
+		int mWidth = 0;
+		int mHeight = 0;
+		int mSplatWidth = 0;
+		int mSplatHeight = 0;
 
 		ER_RHI_GPUTexture* mSplatTexture = nullptr;
 		ER_RHI_GPUTexture* mHeightTexture = nullptr;
 
-		ER_RenderableAABB* mDebugGizmoAABB = nullptr;
-		ER_AABB mAABB; //based on the CPU terrain
+		ER_AABB mAABB; // XZ - tile bounds, Y - height bounds of the quadtree (or the whole height scale if the tile is not resident)
 
 		XMFLOAT2 mTileUVOffset = XMFLOAT2(0.0, 0.0);
 
-		ER_RHI_GPUBuffer* mVertexBufferTS = nullptr;
 		XMMATRIX mWorldMatrixTS = XMMatrixIdentity();
 
-		ER_RHI_GPUBuffer* mVertexBufferNonTS = nullptr;
-		int mVertexCountNonTS = 0; //not used in GPU tessellated terrain
-		ER_RHI_GPUBuffer* mIndexBufferNonTS = nullptr;
-		int mIndexCountNonTS = 0; //not used in GPU tessellated terrain
+		ER_TerrainHeightPyramid mHeightPyramid; // min/max pyramid of mRawHeights, built on streaming (bounds for the quadtree, raycasts)
+		ER_TerrainQuadTree mQuadTree; // built on streaming (with the resident slot as a tile index)
+		int mPatchCountCDLOD = 0;
+		int mPatchCountCDLODShadow = 0;
+
+		std::atomic<int> mStreamingState;
+		int mResidentSlot = -1; // index into terrain's TerrainTileWorld[] and per-slot vertex buffers (-1 if not resident/loading)
+		UINT64 mStreamingKeepFrame = 0; // last streaming frame in which the tile was wanted
+		float mCameraDistance = FLT_MAX; // XZ distance from the camera to the tile (updated in streaming)
+		bool mIsStreamingFailed = false; // its data could not be decoded, never requested again
 
 		bool mIsCulled = false;
 	};
@@ -142,7 +147,7 @@ namespace EveryRay_Core
 		UINT GetHeight() { return mHeight; }
 
 		void Draw(TerrainRenderPass aPass, const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget = nullptr, ER_ShadowMapper* worldShadowMapper = nullptr, ER_LightProbesManager* probeManager = nullptr, int shadowMapCascade = -1);
-		void DrawDebugGizmos(ER_RHI_GPUTexture* aRenderTarget, ER_RHI_GPUTexture* aDepth, ER_RHI_GPURootSignature* rs);
+		void DrawDebugGizmos(ER_DebugRenderer* aDebugRenderer);
 		void Update(const ER_CoreTime& gameTime);
 		void Config() { mShowDebug = !mShowDebug; }
 		
@@ -154,9 +159,21 @@ namespace EveryRay_Core
 		void SetTessellationFactorDynamic(int factor) { mTessellationFactorDynamic = factor; }
 		void SetTerrainHeightScale(float scale) { mTerrainTessellatedHeightScale = scale; }
 		HeightMap* GetHeightmap(int index) { return mHeightMaps.at(index); }
-		void PlaceOnTerrain(ER_RHI_GPUBuffer* outputBuffer, ER_RHI_GPUBuffer* inputBuffer, XMFLOAT4* positions, int positionsCount,
-			TerrainSplatChannels splatChannel = TerrainSplatChannels::NONE,	XMFLOAT4* terrainVertices = nullptr, int terrainVertexCount = 0, float customDampDelta = FLT_MAX);
-		void ReadbackPlacedPositions(ER_RHI_GPUBuffer* outputBuffer, ER_RHI_GPUBuffer* inputBuffer, XMFLOAT4* positions, int positionsCount);
+		int GetHeightmapsCount() const { return static_cast<int>(mHeightMaps.size()); }
+		void PlaceOnTerrainCPU(XMFLOAT4* positions, int positionsCount, TerrainSplatChannels splatChannel = TerrainSplatChannels::NONE, float customDampDelta = FLT_MAX);
+		int FindTileIndex(float x, float z);
+		float FindHeightFromHeightmap(float x, float z, int tileIndex);
+		bool IsOnSplatChannel(float x, float z, int tileIndex, TerrainSplatChannels splatChannel);
+		// Closest intersection of the ray with the terrain's surface (same bilinear heights as in the shaders), all tiles along the ray are tested.
+		// Not thread-safe: pyramids of the tiles which are not streamed in are built on demand into a member scratch pyramid.
+		bool Raycast(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, XMFLOAT3& aOutPosition, float* aOutDistance = nullptr);
+		bool IsColliding(const XMFLOAT3& aStart, const XMFLOAT3& aEnd, XMFLOAT3* aOutPosition = nullptr);
+
+		bool ReadPlacementCache(const std::string& aCacheName, UINT64 aInputHash, void* aOutData, UINT aElementSize, UINT aElementCount);
+		void WritePlacementCache(const std::string& aCacheName, UINT64 aInputHash, const void* aData, UINT aElementSize, UINT aElementCount);
+		UINT64 GetTerrainDataHash() { return mTerrainDataHash; }
+		float GetHeightScale() { return mTerrainTessellatedHeightScale; }
+		float GetPlacementHeightDelta() { return mPlacementHeightDelta; }
 		//float GetHeightScale(bool tessellated) { if (tessellated) return mTerrainTessellatedHeightScale; else return mTerrainNonTessellatedHeightScale; }
 
 		void SetEnabled(bool val) { mEnabled = val; }
@@ -167,24 +184,38 @@ namespace EveryRay_Core
 		ER_GenericEvent<Delegate_ReadbackPlacedPositions>* ReadbackPlacedPositionsOnInitEvent = new ER_GenericEvent<Delegate_ReadbackPlacedPositions>();
 		ER_GenericEvent<Delegate_ReadbackPlacedPositions>* ReadbackPlacedPositionsOnUpdateEvent = new ER_GenericEvent<Delegate_ReadbackPlacedPositions>();
 	private:
-		void LoadTile(int threadIndex, const std::wstring& path);
-		void CreateTerrainTileDataCPU(int tileIndexX, int tileIndexY, const std::wstring& aPath);
-		void CreateTerrainTileDataGPU(int tileIndexX, int tileIndexY);
+		void LoadHeightsFile(const std::wstring& aTexturesPath);
+		void CreateResidentSlotsData();
 		void LoadTextures(const std::wstring& aTexturesPath, const std::wstring& splatLayer0Path, const std::wstring& splatLayer1Path,	const std::wstring& splatLayer2Path, const std::wstring& splatLayer3Path);
-		void LoadSplatmapPerTileGPU(int tileIndexX, int tileIndexY, const std::wstring& path);
-		void LoadHeightmapPerTileGPU(int tileIndexX, int tileIndexY, const std::wstring& path);
+		bool LoadSplatmapPerTileCPU(HeightMap* aTile);
+		void CalculateTerrainDataHash();
+		std::wstring GetPlacementCachePath(const std::string& aCacheName);
+
+		void UpdateStreaming(ER_Camera* camera, bool aWaitForTiles);
+		void DecodeStreamedTile(int aTileIndex); // called on a streaming thread
+		void FinalizeStreamedTile(int aTileIndex);
+		void EvictTile(int aTileIndex);
+		void ReleaseTileSlot(int aTileIndex);
+		void ReleaseDeferredTileResources(bool aReleaseAll = false);
+		void UpdateTileAABB(HeightMap* aTile);
+		UINT64 GetEstimatedTileMemory();
+		void RunRaycastBenchmark();
+		bool RaycastTile(const HeightMap* aTile, const ER_TerrainHeightPyramid& aPyramid, const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, float& aOutDistance) const;
+		const ER_TerrainHeightPyramid* GetRaycastPyramid(int aTileIndex);
+
+		void UpdateCDLODSelection(ER_Camera* camera);
 		void DrawTessellated(TerrainRenderPass aPass, const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget, int i, ER_ShadowMapper* worldShadowMapper = nullptr, ER_LightProbesManager* probeManager = nullptr, int shadowMapCascade = -1);
 
 		ER_DirectionalLight& mDirectionalLight;
 
 		ER_RHI_GPUConstantBuffer<TerrainCBufferData::TerrainShadowCB> mTerrainShadowBuffers[NUM_SHADOW_CASCADES];
 		ER_RHI_GPUConstantBuffer<TerrainCBufferData::TerrainCB> mTerrainConstantBuffer;
-		ER_RHI_GPUConstantBuffer<TerrainCBufferData::PlaceOnTerrainData> mPlaceOnTerrainConstantBuffer;
 
 		ER_RHI_InputLayout* mInputLayout = nullptr;
 
 		ER_RHI_GPUShader* mVS = nullptr;
 		ER_RHI_GPUShader* mHS = nullptr;
+		ER_RHI_GPUShader* mHS_CDLOD = nullptr;
 		ER_RHI_GPUShader* mDS = nullptr;
 		ER_RHI_GPUShader* mPS = nullptr;
 		std::string mTerrainMainPassPSOName = "ER_RHI_GPUPipelineStateObject: Terrain - Main Pass";
@@ -198,20 +229,33 @@ namespace EveryRay_Core
 		std::string mTerrainGBufferPassPSOName = "ER_RHI_GPUPipelineStateObject: Terrain - GBuffer Pass";
 		std::string mTerrainGBufferPassWireframePSOName = "ER_RHI_GPUPipelineStateObject: Terrain - GBuffer (Wireframe) Pass";
 
-		ER_RHI_GPUShader* mPlaceOnTerrainCS = nullptr;
-		std::string mTerrainPlacementPassPSOName = "ER_RHI_GPUPipelineStateObject: Terrain - Placement Pass";
-		ER_RHI_GPURootSignature* mTerrainPlacementPassRS = nullptr;
 		ER_RHI_GPURootSignature* mTerrainCommonPassRS = nullptr;
 
-		ER_RHI_GPUBuffer* mTerrainTilesDataGPU = nullptr;
-		ER_RHI_GPUTexture* mTerrainTilesHeightmapsArrayTexture = nullptr;
-		ER_RHI_GPUTexture* mTerrainTilesSplatmapsArrayTexture = nullptr;
-
 		std::vector<HeightMap*> mHeightMaps;
 		ER_RHI_GPUTexture* mSplatChannelTextures[NUM_TEXTURE_SPLAT_CHANNELS] = { nullptr, nullptr, nullptr, nullptr };
 
-		ER_RHI_GPUBuffer* mReadbackPositionsBuffer = nullptr;
-		ER_RHI_GPUBuffer* mTempPositionsBuffer = nullptr;
+		// streaming
+		struct TerrainTileDeferredRelease
+		{
+			ER_RHI_GPUTexture* HeightTexture;
+			ER_RHI_GPUTexture* SplatTexture;
+			UINT64 ReleaseFrame;
+		};
+		ER_TerrainHeightsFile mHeightsFile;
+		ER_TerrainStreamer* mStreamer = nullptr;
+		std::vector<int> mStreamedTiles; // tiles with a resident slot (loading, decoded or resident)
+		std::vector<int> mFreeResidentSlots;
+		std::vector<TerrainTileDeferredRelease> mDeferredReleases;
+		std::vector<std::pair<float, int>> mStreamingCandidates; // temp storage (distance, tile index)
+		ER_RHI_GPUBuffer* mSlotVertexBuffersTS[MAX_TERRAIN_TILE_COUNT] = { nullptr };
+		ER_RHI_GPUBuffer* mSlotVertexBuffersCDLOD[MAX_TERRAIN_TILE_COUNT] = { nullptr }; // patches selected for the main camera
+		ER_RHI_GPUBuffer* mSlotVertexBuffersCDLODShadow[MAX_TERRAIN_TILE_COUNT] = { nullptr }; // patches selected without frustum culling (for shadow cascades)
+		UINT64 mStreamingFrame = 0;
+		float mStreamingDistance = 2.5f; // in tile sizes
+		float mStreamingHysteresis = 1.25f; // resident tiles are evicted only after they get this much further than mStreamingDistance
+		int mStreamingBudgetMB = 256;
+		int mMaxTileUploadsPerFrame = 2;
+		bool mIsStreamingInitialized = false;
 
 		std::wstring mLevelPath;
 
@@ -227,6 +271,20 @@ namespace EveryRay_Core
 		int mTessellationFactorDynamic = 64;
 		float mTessellationDistanceFactor = 0.015f;
 		float mPlacementHeightDelta = 0.5f; // how much we want to damp the point on terrain
+		bool mUseCDLOD = true;
+		int mCDLODGridResolution = 16; // tessellation factor of every CDLOD patch (must be even for morphing)
+		float mCDLODRangeScale = 2.0f; // finest LOD range in sizes of the finest patch
+		float mCDLODMorphStartRatio = 0.66f;
+		TerrainLODRanges mCDLODRanges;
+		std::vector<TerrainPatchInstance> mCDLODSelectedPatches; // temp storage for the selection of one tile
+		UINT mCDLODPatchesPerLOD[MAX_TERRAIN_LOD_LEVELS] = { 0 };
+		UINT64 mTerrainDataHash = 0; // hash of terrain contents (heights, splat maps) and scales, used as a key for placement caches
+
+		ER_TerrainHeightPyramid mRaycastPagedPyramid; // of a tile which is not streamed in (see GetRaycastPyramid())
+		int mRaycastPagedTileIndex = -1;
+		int mRaycastPagedTilesCount = 0; // how many times raycasts had to build a pyramid on demand
+
+		std::string mRaycastBenchmarkResult; // of the closest resident tile (see RunRaycastBenchmark())
 
 		bool mDrawDebugAABBs = false;
 		bool mDoCPUFrustumCulling = true;
@@ -0,0 +1,428 @@
+#include "stdafx.h"
+
+#include "ER_TerrainHeightPyramid.h"
+#include "ER_Random.h"
+
+#define TERRAIN_PYRAMID_MAX_STACK_SIZE 128
+
+namespace EveryRay_Core
+{
+	// Slab test, returns the [enter, exit] range of the ray inside the box (clipped by [aTMin, aTMax])
+	static bool IntersectBox(const XMFLOAT3& aOrigin, const XMFLOAT3& aInvDirection, const XMFLOAT3& aMin, const XMFLOAT3& aMax, float aTMin, float aTMax,
+		float& aOutEnter, float& aOutExit)
+	{
+		float tx0 = (aMin.x - aOrigin.x) * aInvDirection.x;
+		float tx1 = (aMax.x - aOrigin.x) * aInvDirection.x;
+		float ty0 = (aMin.y - aOrigin.y) * aInvDirection.y;
+		float ty1 = (aMax.y - aOrigin.y) * aInvDirection.y;
+		float tz0 = (aMin.z - aOrigin.z) * aInvDirection.z;
+		float tz1 = (aMax.z - aOrigin.z) * aInvDirection.z;
+
+		aOutEnter = std::max(aTMin, std::max(std::min(tx0, tx1), std::max(std::min(ty0, ty1), std::min(tz0, tz1))));
+		aOutExit = std::min(aTMax, std::min(std::max(tx0, tx1), std::min(std::max(ty0, ty1), std::max(tz0, tz1))));
+		return aOutEnter <= aOutExit;
+	}
+
+	// Zero components are replaced with a tiny value, so that we never get (0 * inf) in the slab test
+	static XMFLOAT3 GetInvDirection(const XMFLOAT3& aDirection)
+	{
+		auto safeInv = [](float value) { return 1.0f / (fabs(value) > 1e-12f ? value : (value < 0.0f ? -1e-12f : 1e-12f)); };
+		return XMFLOAT3(safeInv(aDirection.x), safeInv(aDirection.y), safeInv(aDirection.z));
+	}
+
+	ER_TerrainHeightPyramid::ER_TerrainHeightPyramid()
+	{
+	}
+
+	ER_TerrainHeightPyramid::~ER_TerrainHeightPyramid()
+	{
+		Clear();
+	}
+
+	void ER_TerrainHeightPyramid::Build(const unsigned short* aHeights, int aResolution)
+	{
+		assert(aHeights && aResolution > 1);
+		mHeights = aHeights;
+		mResolution = aResolution;
+		mLevels.clear();
+
+		// level 0: cell (x, z) is between the texels (x - 1, z - 1) and (x, z)
+		Level level;
+		level.Size = aResolution + 1;
+		level.MinMax.resize(level.Size * level.Size * 2);
+		for (int z = 0; z < level.Size; z++)
+		{
+			int z0 = std::max(z - 1, 0);
+			int z1 = std::min(z, aResolution - 1);
+			for (int x = 0; x < level.Size; x++)
+			{
+				int x0 = std::max(x - 1, 0);
+				int x1 = std::min(x, aResolution - 1);
+				unsigned short h00 = aHeights[z0 * aResolution + x0];
+				unsigned short h10 = aHeights[z0 * aResolution + x1];
+				unsigned short h01 = aHeights[z1 * aResolution + x0];
+				unsigned short h11 = aHeights[z1 * aResolution + x1];
+				level.MinMax[(z * level.Size + x) * 2 + 0] = std::min(std::min(h00, h10), std::min(h01, h11));
+				level.MinMax[(z * level.Size + x) * 2 + 1] = std::max(std::max(h00, h10), std::max(h01, h11));
+			}
+		}
+		mLevels.push_back(std::move(level));
+
+		while (mLevels.back().Size > 1)
+		{
+			const Level& previous = mLevels.back();
+			Level next;
+			next.Size = (previous.Size + 1) / 2;
+			next.MinMax.resize(next.Size * next.Size * 2);
+			for (int z = 0; z < next.Size; z++)
+			{
+				for (int x = 0; x < next.Size; x++)
+				{
+					unsigned short minHeight = USHRT_MAX;
+					unsigned short maxHeight = 0;
+					for (int i = 0; i < 4; i++)
+					{
+						int childX = x * 2 + (i & 1);
+						int childZ = z * 2 + (i >> 1);
+						if (childX >= previous.Size || childZ >= previous.Size)
+							continue;
+						minHeight = std::min(minHeight, previous.MinMax[(childZ * previous.Size + childX) * 2 + 0]);
+						maxHeight = std::max(maxHeight, previous.MinMax[(childZ * previous.Size + childX) * 2 + 1]);
+					}
+					next.MinMax[(z * next.Size + x) * 2 + 0] = minHeight;
+					next.MinMax[(z * next.Size + x) * 2 + 1] = maxHeight;
+				}
+			}
+			mLevels.push_back(std::move(next));
+		}
+	}
+
+	void ER_TerrainHeightPyramid::Clear()
+	{
+		mLevels.clear();
+		mHeights = nullptr;
+		mResolution = 0;
+	}
+
+	UINT64 ER_TerrainHeightPyramid::GetMemorySize() const
+	{
+		UINT64 size = 0;
+		for (const auto& level : mLevels)
+			size += level.MinMax.size() * sizeof(unsigned short);
+		return size;
+	}
+
+	bool ER_TerrainHeightPyramid::RunRaycastBenchmark(int aRaysCount, int aReferenceRaysCount, std::string& aOutReport) const
+	{
+		assert(IsBuilt());
+		aReferenceRaysCount = std::min(aReferenceRaysCount, aRaysCount);
+		const float resolution = static_cast<float>(mResolution);
+
+		unsigned short minHeight, maxHeight;
+		GetBounds(0, 0, mResolution - 1, mResolution - 1, minHeight, maxHeight);
+
+		// rays are generated in pyramid space directly, so that we only measure the traversal (mostly grazing rays, as in picking/visibility queries)
+		ER_Random random(12345);
+		std::vector<float> positions(aRaysCount * 2);
+		std::vector<float> slopes(aRaysCount * 2);
+		std::vector<float> descents(aRaysCount);
+		random.FillFloat(positions.data(), positions.size(), 0.5f, resolution + 0.5f);
+		random.FillFloat(slopes.data(), slopes.size(), -resolution * 0.25f, resolution * 0.25f);
+		random.FillFloat(descents.data(), descents.size(), -0.5f, -0.05f);
+
+		std::vector<XMFLOAT3> origins(aRaysCount);
+		std::vector<XMFLOAT3> directions(aRaysCount);
+		for (int i = 0; i < aRaysCount; i++)
+		{
+			origins[i] = XMFLOAT3(positions[i * 2 + 0], static_cast<float>(maxHeight) / 65535.0f + 0.01f, positions[i * 2 + 1]);
+			directions[i] = XMFLOAT3(slopes[i * 2 + 0], descents[i], slopes[i * 2 + 1]);
+		}
+
+		std::vector<float> distances(aRaysCount, -1.0f);
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < aRaysCount; i++)
+		{
+			float distance;
+			if (Raycast(origins[i], directions[i], FLT_MAX, distance))
+				distances[i] = distance;
+		}
+		auto endTime = std::chrono::high_resolution_clock::now();
+		const double raycastTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+		int hits = 0;
+		for (int i = 0; i < aRaysCount; i++)
+			if (distances[i] >= 0.0f)
+				hits++;
+
+		int mismatches = 0;
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < aReferenceRaysCount; i++)
+		{
+			float distance = -1.0f;
+			if (!RaycastReference(origins[i], directions[i], FLT_MAX, distance))
+				distance = -1.0f;
+			if (fabs(distance - distances[i]) > 0.001f)
+				mismatches++;
+		}
+		endTime = std::chrono::high_resolution_clock::now();
+		const double referenceTime = std::chrono::duration<double, std::milli>(endTime - startTime).count() * aRaysCount / std::max(aReferenceRaysCount, 1);
+
+		aOutReport = std::to_string(aRaysCount) + " rays, " + std::to_string(mResolution) + " texels per side\n" +
+			"height pyramid: " + std::to_string(raycastTime) + " ms (hits: " + std::to_string(hits) + ")\n" +
+			"per-texel reference (scaled to all rays): " + std::to_string(referenceTime) + " ms, mismatches: " + std::to_string(mismatches) +
+			" (of " + std::to_string(aReferenceRaysCount) + ")";
+		return mismatches == 0;
+	}
+
+	float ER_TerrainHeightPyramid::GetHeight(int aTexelX, int aTexelZ) const
+	{
+		aTexelX = std::max(0, std::min(aTexelX, mResolution - 1));
+		aTexelZ = std::max(0, std::min(aTexelZ, mResolution - 1));
+		return static_cast<float>(mHeights[aTexelZ * mResolution + aTexelX]) / 65535.0f;
+	}
+
+	void ER_TerrainHeightPyramid::GetBounds(int aTexelStartX, int aTexelStartZ, int aTexelEndX, int aTexelEndZ, unsigned short& aOutMin, unsigned short& aOutMax) const
+	{
+		assert(!mLevels.empty());
+
+		// cells which are fully covered by the texel range (cell x is between the texels x - 1 and x)
+		int cellStartX = aTexelStartX + 1;
+		int cellStartZ = aTexelStartZ + 1;
+		int cellEndX = std::max(cellStartX, aTexelEndX);
+		int cellEndZ = std::max(cellStartZ, aTexelEndZ);
+
+		aOutMin = USHRT_MAX;
+		aOutMax = 0;
+		GetBoundsNode(static_cast<int>(mLevels.size()) - 1, 0, 0, cellStartX, cellStartZ, cellEndX, cellEndZ, aOutMin, aOutMax);
+	}
+
+	void ER_TerrainHeightPyramid::GetBoundsNode(int aLevel, int aX, int aZ, int aCellStartX, int aCellStartZ, int aCellEndX, int aCellEndZ,
+		unsigned short& aOutMin, unsigned short& aOutMax) const
+	{
+		const Level& level = mLevels[aLevel];
+		if (aX >= level.Size || aZ >= level.Size)
+			return;
+
+		int nodeStartX = aX << aLevel;
+		int nodeStartZ = aZ << aLevel;
+		int nodeEndX = ((aX + 1) << aLevel) - 1;
+		int nodeEndZ = ((aZ + 1) << aLevel) - 1;
+		if (nodeStartX > aCellEndX || nodeEndX < aCellStartX || nodeStartZ > aCellEndZ || nodeEndZ < aCellStartZ)
+			return;
+
+		if (aLevel == 0 || (nodeStartX >= aCellStartX && nodeEndX <= aCellEndX && nodeStartZ >= aCellStartZ && nodeEndZ <= aCellEndZ))
+		{
+			aOutMin = std::min(aOutMin, level.MinMax[(aZ * level.Size + aX) * 2 + 0]);
+			aOutMax = std::max(aOutMax, level.MinMax[(aZ * level.Size + aX) * 2 + 1]);
+			return;
+		}
+
+		for (int i = 0; i < 4; i++)
+			GetBoundsNode(aLevel - 1, aX * 2 + (i & 1), aZ * 2 + (i >> 1), aCellStartX, aCellStartZ, aCellEndX, aCellEndZ, aOutMin, aOutMax);
+	}
+
+	// Intersection of the ray with the bilinear patch of one cell (in [aTMin, aTMax] range of the ray):
+	// height along the ray is a quadratic function of t, so we only have to find its first root.
+	bool ER_TerrainHeightPyramid::IntersectCell(int aCellX, int aCellZ, const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aTMin, float aTMax, float& aOutDistance) const
+	{
+		float h00 = GetHeight(aCellX - 1, aCellZ - 1);
+		float h10 = GetHeight(aCellX, aCellZ - 1);
+		float h01 = GetHeight(aCellX - 1, aCellZ);
+		float h11 = GetHeight(aCellX, aCellZ);
+
+		// h(fx, fz) = h00 + b * fx + c * fz + e * fx * fz
+		float b = h10 - h00;
+		float c = h01 - h00;
+		float e = h00 - h10 - h01 + h11;
+		float ax = aOrigin.x - static_cast<float>(aCellX);
+		float az = aOrigin.z - static_cast<float>(aCellZ);
+
+		// f(t) = ray height - surface height = A * t^2 + B * t + C
+		float A = -e * aDirection.x * aDirection.z;
+		float B = aDirection.y - (b * aDirection.x + c * aDirection.z + e * (ax * aDirection.z + az * aDirection.x));
+		float C = aOrigin.y - (h00 + b * ax + c * az + e * ax * az);
+
+		// already under the surface when entering the cell
+		if ((A * aTMin + B) * aTMin + C <= 0.0f)
+		{
+			aOutDistance = aTMin;
+			return true;
+		}
+
+		float roots[2];
+		int rootsCount = 0;
+		if (fabs(A) < 1e-12f)
+		{
+			if (fabs(B) < 1e-12f)
+				return false;
+			roots[rootsCount++] = -C / B;
+		}
+		else
+		{
+			float discriminant = B * B - 4.0f * A * C;
+			if (discriminant < 0.0f)
+				return false;
+
+			// numerically stable form of the quadratic formula
+			float q = -0.5f * (B + (B < 0.0f ? -sqrt(discriminant) : sqrt(discriminant)));
+			roots[rootsCount++] = q / A;
+			if (q != 0.0f)
+				roots[rootsCount++] = C / q;
+		}
+
+		bool isHit = false;
+		aOutDistance = FLT_MAX;
+		for (int i = 0; i < rootsCount; i++)
+		{
+			if (roots[i] >= aTMin && roots[i] <= aTMax && roots[i] < aOutDistance)
+			{
+				aOutDistance = roots[i];
+				isHit = true;
+			}
+		}
+		return isHit;
+	}
+
+	bool ER_TerrainHeightPyramid::Raycast(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, float& aOutDistance) const
+	{
+		if (mLevels.empty())
+			return false;
+
+		const XMFLOAT3 invDirection = GetInvDirection(aDirection);
+		const float tileMin = 0.5f;
+		const float tileMax = static_cast<float>(mResolution) + 0.5f;
+
+		// clip the ray by the tile (without height bounds, leaf cells need the full range)
+		float tileEnter, tileExit;
+		if (!IntersectBox(aOrigin, invDirection, XMFLOAT3(tileMin, -FLT_MAX, tileMin), XMFLOAT3(tileMax, FLT_MAX, tileMax), 0.0f, aMaxDistance, tileEnter, tileExit))
+			return false;
+
+		struct StackEntry
+		{
+			int Level, X, Z;
+			float Enter;
+		};
+		StackEntry stack[TERRAIN_PYRAMID_MAX_STACK_SIZE];
+		int stackSize = 0;
+
+		const int topLevel = static_cast<int>(mLevels.size()) - 1;
+		stack[stackSize++] = { topLevel, 0, 0, tileEnter };
+
+		float closest = FLT_MAX;
+		while (stackSize > 0)
+		{
+			const StackEntry entry = stack[--stackSize];
+			if (entry.Enter > closest)
+				continue;
+
+			if (entry.Level == 0)
+			{
+				float cellEnter, cellExit, distance;
+				XMFLOAT3 cellMin = XMFLOAT3(static_cast<float>(entry.X), -FLT_MAX, static_cast<float>(entry.Z));
+				XMFLOAT3 cellMax = XMFLOAT3(cellMin.x + 1.0f, FLT_MAX, cellMin.z + 1.0f);
+				if (IntersectBox(aOrigin, invDirection, cellMin, cellMax, tileEnter, tileExit, cellEnter, cellExit) &&
+					IntersectCell(entry.X, entry.Z, aOrigin, aDirection, cellEnter, cellExit, distance) && distance < closest)
+					closest = distance;
+				continue;
+			}
+
+			// children which are hit by the ray, pushed back to front (closest is popped first)
+			const Level& childLevel = mLevels[entry.Level - 1];
+			const float childSize = static_cast<float>(1 << (entry.Level - 1));
+			StackEntry children[4];
+			int childrenCount = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				int childX = entry.X * 2 + (i & 1);
+				int childZ = entry.Z * 2 + (i >> 1);
+				if (childX >= childLevel.Size || childZ >= childLevel.Size)
+					continue;
+
+				const int childIndex = (childZ * childLevel.Size + childX) * 2;
+				XMFLOAT3 childMin = XMFLOAT3(childX * childSize, static_cast<float>(childLevel.MinMax[childIndex + 0]) / 65535.0f, childZ * childSize);
+				XMFLOAT3 childMax = XMFLOAT3(childMin.x + childSize, static_cast<float>(childLevel.MinMax[childIndex + 1]) / 65535.0f, childMin.z + childSize);
+
+				// everything under the max height has to be visited (rays which start under the surface hit immediately)
+				childMin.y = -FLT_MAX;
+
+				float childEnter, childExit;
+				if (IntersectBox(aOrigin, invDirection, childMin, childMax, tileEnter, std::min(tileExit, closest), childEnter, childExit))
+					children[childrenCount++] = { entry.Level - 1, childX, childZ, childEnter };
+			}
+
+			// insertion sort (max. 4 children): the farthest child goes first
+			for (int i = 1; i < childrenCount; i++)
+			{
+				StackEntry child = children[i];
+				int j = i - 1;
+				for (; j >= 0 && children[j].Enter < child.Enter; j--)
+					children[j + 1] = children[j];
+				children[j + 1] = child;
+			}
+			for (int i = 0; i < childrenCount; i++)
+			{
+				assert(stackSize < TERRAIN_PYRAMID_MAX_STACK_SIZE);
+				stack[stackSize++] = children[i];
+			}
+		}
+
+		if (closest == FLT_MAX)
+			return false;
+
+		aOutDistance = closest;
+		return true;
+	}
+
+	// Amanatides & Woo traversal of the level 0 cells, uses the same cell intersection as Raycast(), so the results should match
+	bool ER_TerrainHeightPyramid::RaycastReference(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, float& aOutDistance) const
+	{
+		if (mLevels.empty())
+			return false;
+
+		const XMFLOAT3 invDirection = GetInvDirection(aDirection);
+		const float tileMin = 0.5f;
+		const float tileMax = static_cast<float>(mResolution) + 0.5f;
+
+		float tileEnter, tileExit;
+		if (!IntersectBox(aOrigin, invDirection, XMFLOAT3(tileMin, -FLT_MAX, tileMin), XMFLOAT3(tileMax, FLT_MAX, tileMax), 0.0f, aMaxDistance, tileEnter, tileExit))
+			return false;
+
+		const int cellsCount = mLevels[0].Size;
+		int cellX = std::max(0, std::min(static_cast<int>(floorf(aOrigin.x + aDirection.x * tileEnter)), cellsCount - 1));
+		int cellZ = std::max(0, std::min(static_cast<int>(floorf(aOrigin.z + aDirection.z * tileEnter)), cellsCount - 1));
+		const int stepX = aDirection.x >= 0.0f ? 1 : -1;
+		const int stepZ = aDirection.z >= 0.0f ? 1 : -1;
+		const float deltaX = fabs(invDirection.x);
+		const float deltaZ = fabs(invDirection.z);
+		float nextX = (static_cast<float>(cellX + (stepX > 0 ? 1 : 0)) - aOrigin.x) * invDirection.x;
+		float nextZ = (static_cast<float>(cellZ + (stepZ > 0 ? 1 : 0)) - aOrigin.z) * invDirection.z;
+
+		while (cellX >= 0 && cellX < cellsCount && cellZ >= 0 && cellZ < cellsCount)
+		{
+			float cellEnter, cellExit, distance;
+			XMFLOAT3 cellMin = XMFLOAT3(static_cast<float>(cellX), -FLT_MAX, static_cast<float>(cellZ));
+			XMFLOAT3 cellMax = XMFLOAT3(cellMin.x + 1.0f, FLT_MAX, cellMin.z + 1.0f);
+			if (IntersectBox(aOrigin, invDirection, cellMin, cellMax, tileEnter, tileExit, cellEnter, cellExit) &&
+				IntersectCell(cellX, cellZ, aOrigin, aDirection, cellEnter, cellExit, distance))
+			{
+				aOutDistance = distance;
+				return true;
+			}
+
+			if (std::min(nextX, nextZ) > tileExit)
+				break;
+
+			if (nextX < nextZ)
+			{
+				cellX += stepX;
+				nextX += deltaX;
+			}
+			else
+			{
+				cellZ += stepZ;
+				nextZ += deltaZ;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "Common.h"
+
+namespace EveryRay_Core
+{
+	// Min/max mip pyramid of one terrain tile's heights (a.k.a. maximum mipmap).
+	//
+	// Pyramid space: x,z - texel coordinates shifted by 1 (center of the texel i is at i + 1), y - normalized [0-1] height.
+	// Every cell of level 0 spans 1x1 between the centers of 2x2 texels (indices are clamped at the borders, same as with a clamp sampler),
+	// so the whole tile [0.5, resolution + 0.5] is covered and the rays do not slip through the seams between tiles.
+	// Every cell of level N spans 2^N x 2^N cells of level 0.
+	class ER_TerrainHeightPyramid
+	{
+	public:
+		ER_TerrainHeightPyramid();
+		~ER_TerrainHeightPyramid();
+
+		// aHeights have to stay valid while the pyramid is used (raycasts read the full resolution heights in the last level)
+		void Build(const unsigned short* aHeights, int aResolution);
+		void Clear();
+		bool IsBuilt() const { return !mLevels.empty(); }
+
+		// Exact bounds of the (inclusive) texel range
+		void GetBounds(int aTexelStartX, int aTexelStartZ, int aTexelEndX, int aTexelEndZ, unsigned short& aOutMin, unsigned short& aOutMax) const;
+
+		// Returns the closest intersection (in units of aDirection) of the ray with the bilinear height surface.
+		// Hierarchical traversal: only the cells whose bounds are hit by the ray are visited (front to back).
+		bool Raycast(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, float& aOutDistance) const;
+		// Same as Raycast(), but steps through every cell of level 0 along the ray (reference for validation/benchmarks)
+		bool RaycastReference(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, float& aOutDistance) const;
+
+		// Random grazing rays from above the tile: timings of Raycast() and RaycastReference() (on a subset), fails if their hits differ
+		bool RunRaycastBenchmark(int aRaysCount, int aReferenceRaysCount, std::string& aOutReport) const;
+
+		int GetResolution() const { return mResolution; }
+		int GetLevelsCount() const { return static_cast<int>(mLevels.size()); }
+		UINT64 GetMemorySize() const;
+	private:
+		struct Level
+		{
+			int Size; // cells per side
+			std::vector<unsigned short> MinMax; // interleaved min, max
+		};
+
+		void GetBoundsNode(int aLevel, int aX, int aZ, int aCellStartX, int aCellStartZ, int aCellEndX, int aCellEndZ, unsigned short& aOutMin, unsigned short& aOutMax) const;
+		bool IntersectCell(int aCellX, int aCellZ, const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aTMin, float aTMax, float& aOutDistance) const;
+		float GetHeight(int aTexelX, int aTexelZ) const;
+
+		std::vector<Level> mLevels; // 0 - finest
+		const unsigned short* mHeights = nullptr;
+		int mResolution = 0;
+	};
+}
@@ -0,0 +1,364 @@
+#include "stdafx.h"
+
+#include "ER_TerrainQuadTree.h"
+#include "ER_Frustum.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	ER_TerrainQuadTree::ER_TerrainQuadTree()
+	{
+	}
+
+	ER_TerrainQuadTree::~ER_TerrainQuadTree()
+	{
+		mNodes.clear();
+	}
+
+	void ER_TerrainQuadTree::Build(const ER_TerrainHeightPyramid& aHeightPyramid, float aTileSize, const XMFLOAT3& aTileWorldOffset, int aTileIndex, int aLODCount)
+	{
+		assert(aHeightPyramid.IsBuilt());
+		assert(aLODCount > 0 && aLODCount <= MAX_TERRAIN_LOD_LEVELS);
+
+		mTileSize = aTileSize;
+		mTileWorldOffset = aTileWorldOffset;
+		mTileIndex = aTileIndex;
+		mLODCount = aLODCount;
+
+		// full quadtree: 1 + 4 + 16 + ... nodes, allocated once so that we can safely work with indices
+		int nodesCount = 0;
+		for (int level = 0; level < mLODCount; level++)
+			nodesCount += 1 << (2 * level);
+
+		mNodes.clear();
+		mNodes.reserve(nodesCount);
+		mNodes.push_back(Node());
+		BuildNode(aHeightPyramid, 0, 0.0f, 0.0f, aTileSize, 0);
+	}
+
+	void ER_TerrainQuadTree::BuildNode(const ER_TerrainHeightPyramid& aHeightPyramid, int aNodeIndex, float aX, float aZ, float aSize, int aLevel)
+	{
+		mNodes[aNodeIndex].X = aX;
+		mNodes[aNodeIndex].Z = aZ;
+		mNodes[aNodeIndex].Size = aSize;
+
+		if (aLevel == mLODCount - 1)
+		{
+			// leaf: bounds of the texels under the node (+1 texel border for bilinear filtering in the domain shader)
+			const int resolution = aHeightPyramid.GetResolution();
+			int startX = std::max(0, static_cast<int>(floor(aX / mTileSize * resolution)) - 1);
+			int startZ = std::max(0, static_cast<int>(floor(aZ / mTileSize * resolution)) - 1);
+			int endX = std::min(resolution - 1, static_cast<int>(ceil((aX + aSize) / mTileSize * resolution)) + 1);
+			int endZ = std::min(resolution - 1, static_cast<int>(ceil((aZ + aSize) / mTileSize * resolution)) + 1);
+
+			unsigned short minHeight, maxHeight;
+			aHeightPyramid.GetBounds(startX, startZ, endX, endZ, minHeight, maxHeight);
+
+			mNodes[aNodeIndex].MinHeight = static_cast<float>(minHeight) / 65535.0f;
+			mNodes[aNodeIndex].MaxHeight = static_cast<float>(maxHeight) / 65535.0f;
+			mNodes[aNodeIndex].FirstChild = -1;
+			return;
+		}
+
+		int firstChild = static_cast<int>(mNodes.size());
+		mNodes[aNodeIndex].FirstChild = firstChild;
+		for (int i = 0; i < 4; i++)
+			mNodes.push_back(Node());
+
+		float childSize = aSize * 0.5f;
+		float minHeight = 1.0f;
+		float maxHeight = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			BuildNode(aHeightPyramid, firstChild + i, aX + (i % 2) * childSize, aZ + (i / 2) * childSize, childSize, aLevel + 1);
+			minHeight = std::min(minHeight, mNodes[firstChild + i].MinHeight);
+			maxHeight = std::max(maxHeight, mNodes[firstChild + i].MaxHeight);
+		}
+		mNodes[aNodeIndex].MinHeight = minHeight;
+		mNodes[aNodeIndex].MaxHeight = maxHeight;
+	}
+
+	void ER_TerrainQuadTree::GetHeightBounds(float& aOutMin, float& aOutMax) const
+	{
+		assert(!mNodes.empty());
+		aOutMin = mNodes[0].MinHeight;
+		aOutMax = mNodes[0].MaxHeight;
+	}
+
+	// Every LOD range is twice as big as the previous one (same as in CDLOD), morphing happens in the last part of each range
+	void ER_TerrainQuadTree::CalculateLODRanges(TerrainLODRanges& aOutRanges, int aLODCount, float aFinestRange, float aMorphStartRatio)
+	{
+		assert(aLODCount > 0 && aLODCount <= MAX_TERRAIN_LOD_LEVELS);
+		aOutRanges.LODCount = aLODCount;
+
+		float previousRange = 0.0f;
+		float range = aFinestRange;
+		for (int lod = 0; lod < aLODCount; lod++)
+		{
+			aOutRanges.Ranges[lod] = range;
+			aOutRanges.MorphStart[lod] = previousRange + (range - previousRange) * aMorphStartRatio;
+			previousRange = range;
+			range *= 2.0f;
+		}
+	}
+
+	void ER_TerrainQuadTree::Select(const XMFLOAT3& aCameraPosition, const TerrainLODRanges& aRanges, float aHeightScale, const XMFLOAT4* aFrustumPlanes,
+		std::vector<TerrainPatchInstance>& aOutPatches, UINT* aOutPatchesPerLOD) const
+	{
+		if (mNodes.empty())
+			return;
+
+		assert(aRanges.LODCount == mLODCount);
+
+		SelectionContext context;
+		context.CameraPosition = aCameraPosition;
+		context.Ranges = &aRanges;
+		context.HeightScale = aHeightScale;
+		context.FrustumPlanes = aFrustumPlanes;
+		context.OutPatches = &aOutPatches;
+		context.OutPatchesPerLOD = aOutPatchesPerLOD;
+
+		SelectNode(context, 0, mLODCount - 1, aFrustumPlanes == nullptr);
+	}
+
+	// Returns false if the node is visible but out of its LOD range (parent has to cover its area then)
+	bool ER_TerrainQuadTree::SelectNode(const SelectionContext& aContext, int aNodeIndex, int aLOD, bool aParentFullyVisible) const
+	{
+		const Node& node = mNodes[aNodeIndex];
+
+		XMFLOAT3 aabbMin, aabbMax;
+		GetNodeAABB(node, aContext.HeightScale, aabbMin, aabbMax);
+
+		NodeVisibility visibility = aParentFullyVisible ? NODE_INSIDE : GetNodeVisibility(aContext.FrustumPlanes, aabbMin, aabbMax);
+		if (visibility == NODE_OUTSIDE)
+			return true; // culled, nothing to add
+
+		// coarsest LOD always covers the rest of the tile
+		if (aLOD < mLODCount - 1 && !IntersectsSphere(aContext.CameraPosition, aContext.Ranges->Ranges[aLOD], aabbMin, aabbMax))
+			return false;
+
+		if (aLOD == 0 || !IntersectsSphere(aContext.CameraPosition, aContext.Ranges->Ranges[aLOD - 1], aabbMin, aabbMax))
+		{
+			AddPatch(aContext, node, aLOD);
+			return true;
+		}
+
+		for (int i = 0; i < 4; i++)
+		{
+			const Node& child = mNodes[node.FirstChild + i];
+			if (!SelectNode(aContext, node.FirstChild + i, aLOD - 1, visibility == NODE_INSIDE))
+				AddPatch(aContext, child, aLOD);
+		}
+		return true;
+	}
+
+	void ER_TerrainQuadTree::AddPatch(const SelectionContext& aContext, const Node& aNode, int aLOD) const
+	{
+		TerrainPatchInstance patch;
+		patch.PatchInfo = XMFLOAT4(aNode.X, aNode.Z, aNode.Size, aNode.Size);
+		patch.TileIndex = static_cast<float>(mTileIndex);
+		if (aLOD < mLODCount - 1)
+			patch.LODInfo = XMFLOAT3(static_cast<float>(aLOD), aContext.Ranges->MorphStart[aLOD], aContext.Ranges->Ranges[aLOD]);
+		else // no coarser LOD to morph into
+			patch.LODInfo = XMFLOAT3(static_cast<float>(aLOD), FLT_MAX * 0.5f, FLT_MAX);
+
+		aContext.OutPatches->push_back(patch);
+		if (aContext.OutPatchesPerLOD)
+			aContext.OutPatchesPerLOD[aLOD]++;
+	}
+
+	void ER_TerrainQuadTree::GetNodeAABB(const Node& aNode, float aHeightScale, XMFLOAT3& aOutMin, XMFLOAT3& aOutMax) const
+	{
+		aOutMin = XMFLOAT3(mTileWorldOffset.x + aNode.X, mTileWorldOffset.y + aNode.MinHeight * aHeightScale, mTileWorldOffset.z + aNode.Z);
+		aOutMax = XMFLOAT3(aOutMin.x + aNode.Size, mTileWorldOffset.y + aNode.MaxHeight * aHeightScale, aOutMin.z + aNode.Size);
+	}
+
+	// Same plane convention as in HeightMap::PerformCPUFrustumCulling() (normals are pointing outside)
+	ER_TerrainQuadTree::NodeVisibility ER_TerrainQuadTree::GetNodeVisibility(const XMFLOAT4* aFrustumPlanes, const XMFLOAT3& aMin, const XMFLOAT3& aMax) const
+	{
+		if (!aFrustumPlanes)
+			return NODE_INSIDE;
+
+		NodeVisibility result = NODE_INSIDE;
+		for (int planeID = 0; planeID < 6; planeID++)
+		{
+			const XMFLOAT4& plane = aFrustumPlanes[planeID];
+
+			// closest and farthest corners along the plane normal
+			XMFLOAT3 nearVert = XMFLOAT3(plane.x > 0.0f ? aMin.x : aMax.x, plane.y > 0.0f ? aMin.y : aMax.y, plane.z > 0.0f ? aMin.z : aMax.z);
+			XMFLOAT3 farVert = XMFLOAT3(plane.x > 0.0f ? aMax.x : aMin.x, plane.y > 0.0f ? aMax.y : aMin.y, plane.z > 0.0f ? aMax.z : aMin.z);
+
+			if (plane.x * nearVert.x + plane.y * nearVert.y + plane.z * nearVert.z + plane.w > 0.0f)
+				return NODE_OUTSIDE;
+			if (plane.x * farVert.x + plane.y * farVert.y + plane.z * farVert.z + plane.w > 0.0f)
+				result = NODE_INTERSECTS;
+		}
+		return result;
+	}
+
+	bool ER_TerrainQuadTree::IntersectsSphere(const XMFLOAT3& aCenter, float aRadius, const XMFLOAT3& aMin, const XMFLOAT3& aMax) const
+	{
+		float dx = std::max(aMin.x - aCenter.x, std::max(0.0f, aCenter.x - aMax.x));
+		float dy = std::max(aMin.y - aCenter.y, std::max(0.0f, aCenter.y - aMax.y));
+		float dz = std::max(aMin.z - aCenter.z, std::max(0.0f, aCenter.z - aMax.z));
+		return dx * dx + dy * dy + dz * dz <= aRadius * aRadius;
+	}
+
+	// Same ranges (relative to the patch size) and morph ratio as the terrain's defaults, the tile is centered at the origin.
+	// The tile is split into a grid of the finest patches: every selected patch marks the cells under it with its LOD.
+	bool ER_TerrainQuadTree::RunSelectionTest(const ER_TerrainHeightPyramid& aHeightPyramid, int aLODCount, float aHeightScale, int aCamerasCount, std::string& aOutReport)
+	{
+		const float tileSize = static_cast<float>(aHeightPyramid.GetResolution()) * 2.0f;
+		const int cellsPerSide = 1 << (aLODCount - 1);
+		const float cellSize = tileSize / cellsPerSide;
+
+		ER_TerrainQuadTree quadTree;
+		quadTree.Build(aHeightPyramid, tileSize, XMFLOAT3(-0.5f * tileSize, 0.0f, -0.5f * tileSize), 0, aLODCount);
+
+		TerrainLODRanges ranges;
+		CalculateLODRanges(ranges, aLODCount, cellSize * 2.0f, 0.66f);
+
+		// node of aSize (tile space) containing the point
+		auto findNode = [&quadTree](float aX, float aZ, float aSize) -> const Node&
+		{
+			int nodeIndex = 0;
+			while (quadTree.mNodes[nodeIndex].Size > aSize && quadTree.mNodes[nodeIndex].FirstChild >= 0)
+			{
+				const Node& node = quadTree.mNodes[nodeIndex];
+				const float childSize = node.Size * 0.5f;
+				nodeIndex = node.FirstChild + (aX >= node.X + childSize ? 1 : 0) + (aZ >= node.Z + childSize ? 2 : 0);
+			}
+			return quadTree.mNodes[nodeIndex];
+		};
+		auto patchLess = [](const TerrainPatchInstance& a, const TerrainPatchInstance& b)
+		{
+			if (a.PatchInfo.x != b.PatchInfo.x) return a.PatchInfo.x < b.PatchInfo.x;
+			if (a.PatchInfo.y != b.PatchInfo.y) return a.PatchInfo.y < b.PatchInfo.y;
+			return a.PatchInfo.z < b.PatchInfo.z;
+		};
+		auto patchEqual = [](const TerrainPatchInstance& a, const TerrainPatchInstance& b)
+		{
+			return a.PatchInfo.x == b.PatchInfo.x && a.PatchInfo.y == b.PatchInfo.y && a.PatchInfo.z == b.PatchInfo.z && a.LODInfo.x == b.LODInfo.x;
+		};
+
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+		std::vector<TerrainPatchInstance> patches;
+		std::vector<TerrainPatchInstance> visiblePatches;
+		std::vector<TerrainPatchInstance> expectedVisiblePatches;
+		std::vector<int> cellsCoverage(cellsPerSide * cellsPerSide);
+		std::vector<int> cellsLOD(cellsPerSide * cellsPerSide);
+
+		int gaps = 0, overlaps = 0, rangeErrors = 0, morphErrors = 0, neighbourErrors = 0, frustumErrors = 0;
+		UINT patchesPerLOD[MAX_TERRAIN_LOD_LEVELS] = {};
+		int patchesCount = 0, rejectedPatchesCount = 0;
+		for (int camera = 0; camera < aCamerasCount; camera++)
+		{
+			const XMFLOAT3 cameraPosition = XMFLOAT3(random.NextFloat(-1.25f, 1.25f) * tileSize, random.NextFloat(0.0f, 1.5f) * aHeightScale,
+				random.NextFloat(-1.25f, 1.25f) * tileSize);
+
+			patches.clear();
+			quadTree.Select(cameraPosition, ranges, aHeightScale, nullptr, patches, patchesPerLOD);
+			patchesCount += static_cast<int>(patches.size());
+
+			std::fill(cellsCoverage.begin(), cellsCoverage.end(), 0);
+			for (const TerrainPatchInstance& patch : patches)
+			{
+				const int lod = static_cast<int>(patch.LODInfo.x);
+				const float lodSize = cellSize * (1 << lod);
+
+				// children of an out of range node are taken with the parent's LOD
+				if (patch.PatchInfo.z != lodSize && (lod == 0 || patch.PatchInfo.z != lodSize * 0.5f))
+				{
+					rangeErrors++;
+					continue;
+				}
+
+				XMFLOAT3 aabbMin, aabbMax;
+				quadTree.GetNodeAABB(findNode(patch.PatchInfo.x, patch.PatchInfo.y, patch.PatchInfo.z), aHeightScale, aabbMin, aabbMax);
+				if (lod > 0 && quadTree.IntersectsSphere(cameraPosition, ranges.Ranges[lod - 1], aabbMin, aabbMax))
+					rangeErrors++; // should have been split
+				quadTree.GetNodeAABB(findNode(patch.PatchInfo.x, patch.PatchInfo.y, lodSize), aHeightScale, aabbMin, aabbMax);
+				if (lod < aLODCount - 1 && !quadTree.IntersectsSphere(cameraPosition, ranges.Ranges[lod], aabbMin, aabbMax))
+					rangeErrors++; // should have been taken with a coarser LOD
+
+				if (lod < aLODCount - 1)
+				{
+					const float previousRange = lod > 0 ? ranges.Ranges[lod - 1] : 0.0f;
+					if (patch.LODInfo.y != ranges.MorphStart[lod] || patch.LODInfo.z != ranges.Ranges[lod] ||
+						patch.LODInfo.y < previousRange || patch.LODInfo.y >= patch.LODInfo.z)
+						morphErrors++;
+				}
+				else if (patch.LODInfo.y != FLT_MAX * 0.5f || patch.LODInfo.z != FLT_MAX)
+					morphErrors++;
+
+				const int startX = static_cast<int>(patch.PatchInfo.x / cellSize + 0.5f);
+				const int startZ = static_cast<int>(patch.PatchInfo.y / cellSize + 0.5f);
+				const int size = static_cast<int>(patch.PatchInfo.z / cellSize + 0.5f);
+				for (int z = startZ; z < std::min(startZ + size, cellsPerSide); z++)
+				{
+					for (int x = startX; x < std::min(startX + size, cellsPerSide); x++)
+					{
+						cellsCoverage[z * cellsPerSide + x]++;
+						cellsLOD[z * cellsPerSide + x] = lod;
+					}
+				}
+			}
+
+			for (int z = 0; z < cellsPerSide; z++)
+			{
+				for (int x = 0; x < cellsPerSide; x++)
+				{
+					const int cell = z * cellsPerSide + x;
+					if (cellsCoverage[cell] == 0)
+						gaps++;
+					else if (cellsCoverage[cell] > 1)
+						overlaps++;
+					if (x + 1 < cellsPerSide && abs(cellsLOD[cell] - cellsLOD[cell + 1]) > 1)
+						neighbourErrors++;
+					if (z + 1 < cellsPerSide && abs(cellsLOD[cell] - cellsLOD[cell + cellsPerSide]) > 1)
+						neighbourErrors++;
+				}
+			}
+
+			// LODs do not depend on the frustum, so it should only remove the patches outside of it
+			const float yaw = random.NextFloat(0.0f, XM_2PI);
+			const float pitch = random.NextFloat(-0.6f, 0.2f);
+			const XMVECTOR direction = XMVectorSet(cosf(pitch) * cosf(yaw), sinf(pitch), cosf(pitch) * sinf(yaw), 0.0f);
+			const XMMATRIX viewMatrix = XMMatrixLookToRH(XMLoadFloat3(&cameraPosition), direction, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+			const XMMATRIX projectionMatrix = XMMatrixPerspectiveFovRH(XM_PIDIV4, 16.0f / 9.0f, 0.5f, tileSize * 2.0f);
+			ER_Frustum frustum(XMMatrixMultiply(viewMatrix, projectionMatrix));
+
+			visiblePatches.clear();
+			quadTree.Select(cameraPosition, ranges, aHeightScale, frustum.Planes(), visiblePatches);
+
+			expectedVisiblePatches.clear();
+			for (const TerrainPatchInstance& patch : patches)
+			{
+				XMFLOAT3 aabbMin, aabbMax;
+				quadTree.GetNodeAABB(findNode(patch.PatchInfo.x, patch.PatchInfo.y, patch.PatchInfo.z), aHeightScale, aabbMin, aabbMax);
+				if (quadTree.GetNodeVisibility(frustum.Planes(), aabbMin, aabbMax) != NODE_OUTSIDE)
+					expectedVisiblePatches.push_back(patch);
+			}
+			rejectedPatchesCount += static_cast<int>(patches.size() - expectedVisiblePatches.size());
+
+			std::sort(visiblePatches.begin(), visiblePatches.end(), patchLess);
+			std::sort(expectedVisiblePatches.begin(), expectedVisiblePatches.end(), patchLess);
+			if (visiblePatches.size() != expectedVisiblePatches.size() ||
+				!std::equal(visiblePatches.begin(), visiblePatches.end(), expectedVisiblePatches.begin(), patchEqual))
+				frustumErrors++;
+		}
+
+		std::string patchesPerLODReport;
+		for (int lod = 0; lod < aLODCount; lod++)
+			patchesPerLODReport += (lod > 0 ? ", " : "") + std::to_string(patchesPerLOD[lod] / std::max(aCamerasCount, 1));
+
+		aOutReport = std::to_string(aCamerasCount) + " cameras, " + std::to_string(aLODCount) + " LODs, " + std::to_string(cellsPerSide) + "x" +
+			std::to_string(cellsPerSide) + " finest patches per tile, height scale: " + std::to_string(aHeightScale) + "\n" +
+			"patches per camera: " + std::to_string(patchesCount / std::max(aCamerasCount, 1)) + " (per LOD: " + patchesPerLODReport + "), rejected by the frustum: " +
+			std::to_string(rejectedPatchesCount / std::max(aCamerasCount, 1)) + "\n" +
+			"gaps: " + std::to_string(gaps) + ", overlaps: " + std::to_string(overlaps) + ", out of LOD range: " + std::to_string(rangeErrors) +
+			", wrong morph ranges: " + std::to_string(morphErrors) + ", neighbours with >1 LOD difference: " + std::to_string(neighbourErrors) +
+			", wrong frustum selections: " + std::to_string(frustumErrors);
+		return gaps == 0 && overlaps == 0 && rangeErrors == 0 && morphErrors == 0 && neighbourErrors == 0 && frustumErrors == 0 && rejectedPatchesCount > 0;
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "Common.h"
+#include "ER_TerrainHeightPyramid.h"
+
+#define MAX_TERRAIN_LOD_LEVELS 8
+#define ER_TERRAIN_QUAD_TREE_SELECTION_TEST_CAMERAS 500
+
+namespace EveryRay_Core
+{
+	// One control point per patch in the terrain's vertex buffer (should match VS_INPUT_TS in Terrain.hlsl)
+	struct TerrainPatchInstance
+	{
+		XMFLOAT4 PatchInfo; // x,y - origin (tile space), z,w - size
+		float TileIndex;
+		XMFLOAT3 LODInfo; // x - LOD level, y - morph start distance, z - morph end distance
+	};
+
+	// Distance ranges for every LOD level (0 - finest), shared by all tiles of the terrain
+	struct TerrainLODRanges
+	{
+		float Ranges[MAX_TERRAIN_LOD_LEVELS];
+		float MorphStart[MAX_TERRAIN_LOD_LEVELS];
+		int LODCount = 0;
+	};
+
+	// CDLOD-style quadtree of one terrain tile (https://github.com/fstrugar/CDLOD).
+	// Root node covers the whole tile at the coarsest LOD, leaves have the size of the finest patch.
+	// Every node stores its normalized [0-1] height bounds, so that we can scale them with the current height scale.
+	class ER_TerrainQuadTree
+	{
+	public:
+		ER_TerrainQuadTree();
+		~ER_TerrainQuadTree();
+
+		// Node height bounds are taken from the tile's min/max pyramid
+		void Build(const ER_TerrainHeightPyramid& aHeightPyramid, float aTileSize, const XMFLOAT3& aTileWorldOffset, int aTileIndex, int aLODCount);
+
+		// Selects the patches of the tile (coarse -> fine) based on the camera distance and (optionally) frustum.
+		// Selected patches are appended to aOutPatches, aOutPatchesPerLOD (if not null) is incremented for every selected patch.
+		void Select(const XMFLOAT3& aCameraPosition, const TerrainLODRanges& aRanges, float aHeightScale, const XMFLOAT4* aFrustumPlanes,
+			std::vector<TerrainPatchInstance>& aOutPatches, UINT* aOutPatchesPerLOD = nullptr) const;
+
+		void Clear() { mNodes.clear(); }
+		bool IsBuilt() const { return !mNodes.empty(); }
+
+		// Normalized [0-1] height bounds of the whole tile (root node)
+		void GetHeightBounds(float& aOutMin, float& aOutMax) const;
+
+		int GetLODCount() const { return mLODCount; }
+		int GetMaxPatchCount() const { return 1 << (2 * (mLODCount - 1)); } // number of leaves
+
+		static void CalculateLODRanges(TerrainLODRanges& aOutRanges, int aLODCount, float aFinestRange, float aMorphStartRatio);
+
+		// Selections of a tile built from aHeightPyramid for random cameras around it: fails if the patches do not cover the tile exactly once,
+		// are out of their LOD ranges, differ from their neighbours by more than one LOD or if the frustum does not reject exactly the patches outside of it
+		static bool RunSelectionTest(const ER_TerrainHeightPyramid& aHeightPyramid, int aLODCount, float aHeightScale, int aCamerasCount, std::string& aOutReport);
+	private:
+		struct Node
+		{
+			float X, Z, Size; // tile space
+			float MinHeight, MaxHeight; // normalized
+			int FirstChild = -1; // children are stored sequentially, -1 for leaves
+		};
+
+		enum NodeVisibility
+		{
+			NODE_OUTSIDE,
+			NODE_INTERSECTS,
+			NODE_INSIDE
+		};
+
+		struct SelectionContext
+		{
+			XMFLOAT3 CameraPosition;
+			const TerrainLODRanges* Ranges;
+			float HeightScale;
+			const XMFLOAT4* FrustumPlanes;
+			std::vector<TerrainPatchInstance>* OutPatches;
+			UINT* OutPatchesPerLOD;
+		};
+
+		void BuildNode(const ER_TerrainHeightPyramid& aHeightPyramid, int aNodeIndex, float aX, float aZ, float aSize, int aLevel);
+		bool SelectNode(const SelectionContext& aContext, int aNodeIndex, int aLOD, bool aParentFullyVisible) const;
+		void AddPatch(const SelectionContext& aContext, const Node& aNode, int aLOD) const;
+		void GetNodeAABB(const Node& aNode, float aHeightScale, XMFLOAT3& aOutMin, XMFLOAT3& aOutMax) const;
+		NodeVisibility GetNodeVisibility(const XMFLOAT4* aFrustumPlanes, const XMFLOAT3& aMin, const XMFLOAT3& aMax) const;
+		bool IntersectsSphere(const XMFLOAT3& aCenter, float aRadius, const XMFLOAT3& aMin, const XMFLOAT3& aMax) const;
+
+		std::vector<Node> mNodes;
+		XMFLOAT3 mTileWorldOffset = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float mTileSize = 0.0f;
+		int mTileIndex = 0;
+		int mLODCount = 0;
+	};
+}
@@ -0,0 +1,261 @@
+#include "stdafx.h"
+
+#include "ER_TerrainStreamer.h"
+#include "ER_Utility.h"
+
+namespace EveryRay_Core
+{
+	struct TerrainHeightsFileHeader
+	{
+		UINT Magic;
+		UINT Version;
+		UINT TileResolution;
+		UINT TilesCount;
+		UINT64 ContentHash; // heights + hashed source files (see Pack())
+	};
+	static const UINT TERRAIN_HEIGHTS_FILE_MAGIC = 0x48545245; // "ERTH"
+	static const UINT TERRAIN_HEIGHTS_FILE_VERSION = 2;
+
+	static bool HashFileContents(const std::wstring& aPath, UINT64& aHash)
+	{
+		FILE* filePtr = nullptr;
+		if (_wfopen_s(&filePtr, aPath.c_str(), L"rb") != 0 || !filePtr)
+			return false;
+
+		unsigned char chunk[64 * 1024];
+		size_t readBytes = 0;
+		while ((readBytes = fread(chunk, 1, sizeof(chunk), filePtr)) > 0)
+			aHash = ER_Utility::HashBytes(chunk, readBytes, aHash);
+		fclose(filePtr);
+		return true;
+	}
+
+	ER_TerrainHeightsFile::ER_TerrainHeightsFile()
+	{
+	}
+
+	ER_TerrainHeightsFile::~ER_TerrainHeightsFile()
+	{
+		Close();
+	}
+
+	bool ER_TerrainHeightsFile::Open(const std::wstring& aPath, int aTileResolution, int aTilesCount)
+	{
+		Close();
+
+		mFile = CreateFileW(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		const UINT64 tileBytes = static_cast<UINT64>(aTileResolution) * aTileResolution * sizeof(unsigned short);
+		if (!GetFileSizeEx(mFile, &fileSize) || static_cast<UINT64>(fileSize.QuadPart) != sizeof(TerrainHeightsFileHeader) + tileBytes * aTilesCount)
+		{
+			Close();
+			return false;
+		}
+
+		mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mMapping)
+		{
+			Close();
+			return false;
+		}
+
+		mView = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+		if (!mView)
+		{
+			Close();
+			return false;
+		}
+
+		const TerrainHeightsFileHeader* header = reinterpret_cast<const TerrainHeightsFileHeader*>(mView);
+		if (header->Magic != TERRAIN_HEIGHTS_FILE_MAGIC || header->Version != TERRAIN_HEIGHTS_FILE_VERSION ||
+			header->TileResolution != static_cast<UINT>(aTileResolution) || header->TilesCount != static_cast<UINT>(aTilesCount))
+		{
+			Close();
+			return false;
+		}
+
+		mTileResolution = aTileResolution;
+		mTilesCount = aTilesCount;
+		mContentHash = header->ContentHash;
+		return true;
+	}
+
+	void ER_TerrainHeightsFile::Close()
+	{
+		if (mView)
+		{
+			UnmapViewOfFile(mView);
+			mView = nullptr;
+		}
+		if (mMapping)
+		{
+			CloseHandle(mMapping);
+			mMapping = nullptr;
+		}
+		if (mFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(mFile);
+			mFile = INVALID_HANDLE_VALUE;
+		}
+		mTileResolution = 0;
+		mTilesCount = 0;
+		mContentHash = 0;
+	}
+
+	const unsigned short* ER_TerrainHeightsFile::GetTileHeights(int aTileIndex) const
+	{
+		assert(mView && aTileIndex >= 0 && aTileIndex < mTilesCount);
+		const UINT64 tileBytes = static_cast<UINT64>(mTileResolution) * mTileResolution * sizeof(unsigned short);
+		return reinterpret_cast<const unsigned short*>(mView + sizeof(TerrainHeightsFileHeader) + tileBytes * aTileIndex);
+	}
+
+	bool ER_TerrainHeightsFile::Pack(const std::wstring& aPath, const std::vector<std::wstring>& aRawTilePaths, const std::vector<std::wstring>& aHashedFilePaths, int aTileResolution)
+	{
+		FILE* filePtr = nullptr;
+		if (_wfopen_s(&filePtr, aPath.c_str(), L"wb") != 0 || !filePtr)
+			return false;
+
+		TerrainHeightsFileHeader header;
+		header.Magic = TERRAIN_HEIGHTS_FILE_MAGIC;
+		header.Version = TERRAIN_HEIGHTS_FILE_VERSION;
+		header.TileResolution = aTileResolution;
+		header.TilesCount = static_cast<UINT>(aRawTilePaths.size());
+		header.ContentHash = ER_HASH_SEED;
+		bool isWritten = fwrite(&header, sizeof(TerrainHeightsFileHeader), 1, filePtr) == 1; // rewritten with the final hash at the end
+
+		const size_t tileTexelsCount = static_cast<size_t>(aTileResolution) * aTileResolution;
+		std::vector<unsigned short> tileData(tileTexelsCount);
+		for (size_t i = 0; i < aRawTilePaths.size() && isWritten; i++)
+		{
+			FILE* rawFilePtr = nullptr;
+			bool isRead = _wfopen_s(&rawFilePtr, aRawTilePaths[i].c_str(), L"rb") == 0 && rawFilePtr &&
+				fread(tileData.data(), sizeof(unsigned short), tileTexelsCount, rawFilePtr) == tileTexelsCount;
+			if (rawFilePtr)
+				fclose(rawFilePtr);
+
+			if (!isRead)
+			{
+				std::wstring msg = L"[ER Logger][ER_TerrainHeightsFile] Could not read the terrain's heightmap RAW: " + aRawTilePaths[i] + L"\n";
+				ER_OUTPUT_LOG(msg.c_str());
+				isWritten = false;
+				break;
+			}
+			isWritten = fwrite(tileData.data(), sizeof(unsigned short), tileTexelsCount, filePtr) == tileTexelsCount;
+			header.ContentHash = ER_Utility::HashBytes(tileData.data(), tileTexelsCount * sizeof(unsigned short), header.ContentHash);
+		}
+
+		for (UINT i = 0; i < static_cast<UINT>(aHashedFilePaths.size()) && isWritten; i++)
+		{
+			// a missing file still changes the hash (its index is hashed either way, paths are not: they depend on the machine)
+			header.ContentHash = ER_Utility::HashBytes(&i, sizeof(i), header.ContentHash);
+			if (!HashFileContents(aHashedFilePaths[i], header.ContentHash))
+			{
+				std::wstring msg = L"[ER Logger][ER_TerrainHeightsFile] Could not hash the terrain's file: " + aHashedFilePaths[i] + L"\n";
+				ER_OUTPUT_LOG(msg.c_str());
+			}
+		}
+
+		if (isWritten)
+			isWritten = fseek(filePtr, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(TerrainHeightsFileHeader), 1, filePtr) == 1;
+
+		fclose(filePtr);
+		if (!isWritten)
+			_wremove(aPath.c_str()); // do not leave a broken file behind
+		return isWritten;
+	}
+
+	ER_TerrainStreamer::ER_TerrainStreamer(const Delegate_DecodeTile& aDecodeCallback, int aThreadsCount)
+		: mDecodeCallback(aDecodeCallback), mPendingCount(0)
+	{
+		assert(mDecodeCallback);
+		for (int i = 0; i < aThreadsCount; i++)
+			mThreads.push_back(std::thread(&ER_TerrainStreamer::WorkerLoop, this));
+	}
+
+	ER_TerrainStreamer::~ER_TerrainStreamer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mRequestsMutex);
+			mIsShuttingDown = true;
+			mRequests.clear();
+		}
+		mRequestsCondition.notify_all();
+		for (auto& t : mThreads)
+			t.join();
+	}
+
+	void ER_TerrainStreamer::Request(int aTileIndex)
+	{
+		mPendingCount++;
+		{
+			std::lock_guard<std::mutex> lock(mRequestsMutex);
+			mRequests.push_back(aTileIndex);
+		}
+		mRequestsCondition.notify_one();
+	}
+
+	bool ER_TerrainStreamer::PopDecoded(int& aOutTileIndex)
+	{
+		std::lock_guard<std::mutex> lock(mDecodedMutex);
+		if (mDecoded.empty())
+			return false;
+
+		aOutTileIndex = mDecoded.front();
+		mDecoded.pop_front();
+		mPendingCount--;
+		return true;
+	}
+
+	bool ER_TerrainStreamer::WaitAndPopDecoded(int& aOutTileIndex)
+	{
+		std::unique_lock<std::mutex> lock(mDecodedMutex);
+		mDecodedCondition.wait(lock, [this] { return !mDecoded.empty() || mPendingCount == 0; });
+		if (mDecoded.empty())
+			return false;
+
+		aOutTileIndex = mDecoded.front();
+		mDecoded.pop_front();
+		mPendingCount--;
+		return true;
+	}
+
+	void ER_TerrainStreamer::WaitForDecoded(int aTileIndex)
+	{
+		std::unique_lock<std::mutex> lock(mDecodedMutex);
+		mDecodedCondition.wait(lock, [this, aTileIndex] { return std::find(mDecoded.begin(), mDecoded.end(), aTileIndex) != mDecoded.end(); });
+	}
+
+	void ER_TerrainStreamer::WorkerLoop()
+	{
+		// WIC decoding needs COM on this thread
+		HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+		for (;;)
+		{
+			int tileIndex = -1;
+			{
+				std::unique_lock<std::mutex> lock(mRequestsMutex);
+				mRequestsCondition.wait(lock, [this] { return mIsShuttingDown || !mRequests.empty(); });
+				if (mIsShuttingDown)
+					break;
+
+				tileIndex = mRequests.front();
+				mRequests.pop_front();
+			}
+
+			mDecodeCallback(tileIndex);
+
+			{
+				std::lock_guard<std::mutex> lock(mDecodedMutex);
+				mDecoded.push_back(tileIndex);
+			}
+			mDecodedCondition.notify_all();
+		}
+
+		if (SUCCEEDED(comResult))
+			CoUninitialize();
+	}
+}
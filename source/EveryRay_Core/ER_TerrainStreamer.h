@@ -0,0 +1,72 @@
+#pragma once
+#include "Common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+#define NUM_TERRAIN_STREAMING_THREADS 2
+
+namespace EveryRay_Core
+{
+	// Memory-mapped file with the heights (R16) of all terrain tiles, stored tile after tile.
+	// OS pages the data in on first access, so only the tiles we actually touch take physical memory.
+	class ER_TerrainHeightsFile
+	{
+	public:
+		ER_TerrainHeightsFile();
+		~ER_TerrainHeightsFile();
+
+		bool Open(const std::wstring& aPath, int aTileResolution, int aTilesCount);
+		void Close();
+		bool IsOpen() const { return mView != nullptr; }
+
+		const unsigned short* GetTileHeights(int aTileIndex) const;
+		UINT64 GetContentHash() const { return mContentHash; }
+
+		// Packs separate .r16 tiles (in tile index order) into one file which can be used by Open().
+		// The header stores a hash of the heights and of the contents of aHashedFilePaths (i.e., splat maps), so it does not depend on file times.
+		static bool Pack(const std::wstring& aPath, const std::vector<std::wstring>& aRawTilePaths, const std::vector<std::wstring>& aHashedFilePaths, int aTileResolution);
+	private:
+		HANDLE mFile = INVALID_HANDLE_VALUE;
+		HANDLE mMapping = nullptr;
+		const unsigned char* mView = nullptr;
+		int mTileResolution = 0;
+		int mTilesCount = 0;
+		UINT64 mContentHash = 0;
+	};
+
+	// Pool of worker threads which decode requested terrain tiles in the background.
+	// Decoding is done by the provided callback (on a worker thread), finished tiles are then popped on the main thread.
+	class ER_TerrainStreamer
+	{
+	public:
+		using Delegate_DecodeTile = std::function<void(int aTileIndex)>;
+
+		ER_TerrainStreamer(const Delegate_DecodeTile& aDecodeCallback, int aThreadsCount = NUM_TERRAIN_STREAMING_THREADS);
+		~ER_TerrainStreamer();
+
+		void Request(int aTileIndex);
+		bool PopDecoded(int& aOutTileIndex);
+		bool WaitAndPopDecoded(int& aOutTileIndex); // blocks until a tile is decoded, false if nothing is pending
+		void WaitForDecoded(int aTileIndex); // blocks until the requested tile is decoded (it is still returned by PopDecoded() later)
+		int GetPendingCount() const { return mPendingCount; } // requested, but not popped yet
+	private:
+		void WorkerLoop();
+
+		Delegate_DecodeTile mDecodeCallback;
+		std::vector<std::thread> mThreads;
+
+		std::mutex mRequestsMutex;
+		std::condition_variable mRequestsCondition;
+		std::deque<int> mRequests;
+
+		std::mutex mDecodedMutex;
+		std::condition_variable mDecodedCondition;
+		std::deque<int> mDecoded;
+
+		std::atomic<int> mPendingCount;
+		bool mIsShuttingDown = false;
+	};
+}
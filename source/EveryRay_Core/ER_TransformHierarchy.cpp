@@ -0,0 +1,252 @@
+#include "stdafx.h"
+
+#include "ER_TransformHierarchy.h"
+#include "ER_Random.h"
+
+namespace EveryRay_Core
+{
+	ER_TransformHierarchy::ER_TransformHierarchy()
+	{
+	}
+
+	ER_TransformHierarchy::~ER_TransformHierarchy()
+	{
+	}
+
+	int ER_TransformHierarchy::AddNode(int aParentId, const XMFLOAT4X4& aLocalTransform)
+	{
+		assert(aParentId == -1 || IsValidNode(aParentId));
+
+		const int parentIndex = (aParentId >= 0) ? mIdToIndex[aParentId] : -1;
+		const int index = (parentIndex >= 0) ? parentIndex + mSubtreeSizes[parentIndex] : GetNodesCount();
+
+		int id;
+		if (!mFreeIds.empty())
+		{
+			id = mFreeIds.back();
+			mFreeIds.pop_back();
+		}
+		else
+		{
+			id = static_cast<int>(mIdToIndex.size());
+			mIdToIndex.push_back(-1);
+		}
+
+		mIds.insert(mIds.begin() + index, id);
+		mParentIndices.insert(mParentIndices.begin() + index, parentIndex);
+		mSubtreeSizes.insert(mSubtreeSizes.begin() + index, 1);
+		mFlags.insert(mFlags.begin() + index, 0);
+		mLocalTransforms.insert(mLocalTransforms.begin() + index, aLocalTransform);
+		mWorldTransforms.insert(mWorldTransforms.begin() + index, aLocalTransform);
+
+		// shift the nodes after the new one (nothing to do when it is added at the end, i.e. when building in depth-first order)
+		for (int i = index; i < GetNodesCount(); i++)
+		{
+			if (i > index && mParentIndices[i] >= index)
+				mParentIndices[i]++;
+			mIdToIndex[mIds[i]] = i;
+		}
+		for (int ancestor = parentIndex; ancestor >= 0; ancestor = mParentIndices[ancestor])
+			mSubtreeSizes[ancestor]++;
+
+		MarkDirty(index);
+		return id;
+	}
+
+	void ER_TransformHierarchy::RemoveNode(int aId)
+	{
+		assert(IsValidNode(aId));
+
+		const int index = mIdToIndex[aId];
+		const int count = mSubtreeSizes[index];
+		for (int ancestor = mParentIndices[index]; ancestor >= 0; ancestor = mParentIndices[ancestor])
+			mSubtreeSizes[ancestor] -= count;
+
+		for (int i = index; i < index + count; i++)
+		{
+			mIdToIndex[mIds[i]] = -1;
+			mFreeIds.push_back(mIds[i]);
+		}
+
+		mIds.erase(mIds.begin() + index, mIds.begin() + index + count);
+		mParentIndices.erase(mParentIndices.begin() + index, mParentIndices.begin() + index + count);
+		mSubtreeSizes.erase(mSubtreeSizes.begin() + index, mSubtreeSizes.begin() + index + count);
+		mFlags.erase(mFlags.begin() + index, mFlags.begin() + index + count);
+		mLocalTransforms.erase(mLocalTransforms.begin() + index, mLocalTransforms.begin() + index + count);
+		mWorldTransforms.erase(mWorldTransforms.begin() + index, mWorldTransforms.begin() + index + count);
+
+		for (int i = index; i < GetNodesCount(); i++)
+		{
+			if (mParentIndices[i] >= index)
+				mParentIndices[i] -= count;
+			mIdToIndex[mIds[i]] = i;
+		}
+
+		mChangedNodes.erase(std::remove_if(mChangedNodes.begin(), mChangedNodes.end(), [this](int id) { return mIdToIndex[id] < 0; }), mChangedNodes.end());
+	}
+
+	void ER_TransformHierarchy::Clear()
+	{
+		mIds.clear();
+		mParentIndices.clear();
+		mSubtreeSizes.clear();
+		mFlags.clear();
+		mLocalTransforms.clear();
+		mWorldTransforms.clear();
+		mIdToIndex.clear();
+		mFreeIds.clear();
+		mChangedNodes.clear();
+	}
+
+	void ER_TransformHierarchy::MarkDirty(int aIndex)
+	{
+		mFlags[aIndex] |= NODE_DIRTY;
+		for (int ancestor = mParentIndices[aIndex]; ancestor >= 0 && !(mFlags[ancestor] & NODE_DIRTY_CHILDREN); ancestor = mParentIndices[ancestor])
+			mFlags[ancestor] |= NODE_DIRTY_CHILDREN;
+	}
+
+	void ER_TransformHierarchy::SetLocalTransform(int aId, const XMFLOAT4X4& aLocalTransform)
+	{
+		assert(IsValidNode(aId));
+		const int index = mIdToIndex[aId];
+		mLocalTransforms[index] = aLocalTransform;
+		MarkDirty(index);
+	}
+
+	void ER_TransformHierarchy::SetWorldTransform(int aId, const XMFLOAT4X4& aWorldTransform)
+	{
+		assert(IsValidNode(aId));
+		const int index = mIdToIndex[aId];
+		const int parentIndex = mParentIndices[index];
+		if (parentIndex < 0)
+			mLocalTransforms[index] = aWorldTransform;
+		else
+		{
+			XMMATRIX parentWorldInverse = XMMatrixInverse(nullptr, XMLoadFloat4x4(&mWorldTransforms[parentIndex]));
+			XMStoreFloat4x4(&mLocalTransforms[index], XMMatrixMultiply(XMLoadFloat4x4(&aWorldTransform), parentWorldInverse));
+		}
+		MarkDirty(index);
+	}
+
+	int ER_TransformHierarchy::GetParent(int aId) const
+	{
+		assert(IsValidNode(aId));
+		const int parentIndex = mParentIndices[mIdToIndex[aId]];
+		return (parentIndex >= 0) ? mIds[parentIndex] : -1;
+	}
+
+	// Linear pass in depth-first order: a node is recalculated if it is dirty or its parent was recalculated in this pass
+	// (parents are always before their children). Subtrees with nothing dirty are skipped with their subtree size.
+	void ER_TransformHierarchy::Update()
+	{
+		mChangedNodes.clear();
+
+		const int count = GetNodesCount();
+		int i = 0;
+		while (i < count)
+		{
+			const int parentIndex = mParentIndices[i];
+			const bool isParentChanged = parentIndex >= 0 && (mFlags[parentIndex] & NODE_CHANGED);
+
+			if (isParentChanged || (mFlags[i] & NODE_DIRTY))
+			{
+				if (parentIndex >= 0)
+					XMStoreFloat4x4(&mWorldTransforms[i], XMMatrixMultiply(XMLoadFloat4x4(&mLocalTransforms[i]), XMLoadFloat4x4(&mWorldTransforms[parentIndex])));
+				else
+					mWorldTransforms[i] = mLocalTransforms[i];
+
+				// the whole subtree will be visited, so dirty flags of children are cleared when we get to them
+				mFlags[i] = NODE_CHANGED;
+				mChangedNodes.push_back(mIds[i]);
+				i++;
+			}
+			else if (mFlags[i] & NODE_DIRTY_CHILDREN)
+			{
+				mFlags[i] &= ~NODE_DIRTY_CHILDREN;
+				i++;
+			}
+			else
+				i += mSubtreeSizes[i];
+		}
+
+		for (int id : mChangedNodes)
+			mFlags[mIdToIndex[id]] &= ~NODE_CHANGED;
+	}
+
+	bool ER_TransformHierarchy::RunBenchmark(int aNodesCount, float aDirtyRatio, int aFramesCount, std::string& aOutReport)
+	{
+		const int maxDepth = 16;
+		ER_Random random(ER_RANDOM_DEFAULT_SEED);
+
+		auto randomTransform = [&random]() {
+			XMFLOAT4X4 transform;
+			const float scale = random.NextFloat(0.9f, 1.1f);
+			XMStoreFloat4x4(&transform, XMMatrixScaling(scale, scale, scale) *
+				XMMatrixRotationRollPitchYaw(random.NextFloat(-0.2f, 0.2f), random.NextFloat(-3.14f, 3.14f), random.NextFloat(-0.2f, 0.2f)) *
+				XMMatrixTranslation(random.NextFloat(-10.0f, 10.0f), random.NextFloat(-1.0f, 1.0f), random.NextFloat(-10.0f, 10.0f)));
+			return transform;
+		};
+
+		// random tree built in depth-first order (new nodes are always children of the current path, so they are added at the end)
+		ER_TransformHierarchy hierarchy;
+		std::vector<int> path;
+		for (int i = 0; i < aNodesCount; i++)
+		{
+			const int popCount = path.empty() ? 0 : random.NextInt(0, static_cast<int>(path.size()) + 1);
+			path.resize(path.size() - popCount);
+			if (path.size() >= maxDepth)
+				path.pop_back();
+
+			const int id = hierarchy.AddNode(path.empty() ? -1 : path.back(), randomTransform());
+			path.push_back(id);
+		}
+		hierarchy.Update();
+
+		const int dirtyCount = std::max(1, static_cast<int>(aNodesCount * aDirtyRatio));
+		std::vector<int> dirtyIds(dirtyCount);
+		std::vector<XMFLOAT4X4> dirtyTransforms(dirtyCount);
+		double updateTime = 0.0;
+		UINT64 changedNodes = 0;
+
+		for (int frame = 0; frame < aFramesCount; frame++)
+		{
+			for (int i = 0; i < dirtyCount; i++)
+			{
+				dirtyIds[i] = random.NextInt(0, aNodesCount);
+				dirtyTransforms[i] = randomTransform();
+			}
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < dirtyCount; i++)
+				hierarchy.SetLocalTransform(dirtyIds[i], dirtyTransforms[i]);
+			hierarchy.Update();
+			auto endTime = std::chrono::high_resolution_clock::now();
+
+			updateTime += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+			changedNodes += hierarchy.GetChangedNodes().size();
+		}
+
+		// reference: recalculating every node (same multiplication order, so the results must match exactly)
+		std::vector<XMFLOAT4X4> referenceWorld(aNodesCount);
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < aNodesCount; i++)
+		{
+			const int parentIndex = hierarchy.mParentIndices[i];
+			if (parentIndex >= 0)
+				XMStoreFloat4x4(&referenceWorld[i], XMMatrixMultiply(XMLoadFloat4x4(&hierarchy.mLocalTransforms[i]), XMLoadFloat4x4(&referenceWorld[parentIndex])));
+			else
+				referenceWorld[i] = hierarchy.mLocalTransforms[i];
+		}
+		auto endTime = std::chrono::high_resolution_clock::now();
+		const double fullUpdateTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+		int mismatches = 0;
+		for (int i = 0; i < aNodesCount; i++)
+			mismatches += (memcmp(&referenceWorld[i], &hierarchy.mWorldTransforms[i], sizeof(XMFLOAT4X4)) != 0) ? 1 : 0;
+
+		aOutReport = std::to_string(aNodesCount) + " nodes, " + std::to_string(dirtyCount) + " dirty per frame: " +
+			std::to_string(updateTime / aFramesCount) + " ms/frame (" + std::to_string(changedNodes / aFramesCount) + " nodes updated), full update: " +
+			std::to_string(fullUpdateTime) + " ms, mismatches: " + std::to_string(mismatches);
+		return mismatches == 0;
+	}
+}
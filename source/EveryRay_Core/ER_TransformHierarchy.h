@@ -0,0 +1,63 @@
+#pragma once
+#include "Common.h"
+
+#define ER_TRANSFORM_HIERARCHY_BENCHMARK_NODES 100000
+#define ER_TRANSFORM_HIERARCHY_BENCHMARK_DIRTY_RATIO 0.01f
+#define ER_TRANSFORM_HIERARCHY_BENCHMARK_FRAMES 100
+
+namespace EveryRay_Core
+{
+	// Parent/child transforms stored in depth-first order: a node's subtree is the contiguous range [index, index + subtree size),
+	// and a parent is always stored before its children. Update() is a single linear pass which recalculates world transforms
+	// of dirty nodes and of everything below them, and jumps over subtrees without dirty nodes (they cost nothing).
+	// Nodes are referenced by stable ids (indices in the depth-first order change when nodes are added or removed).
+	class ER_TransformHierarchy
+	{
+	public:
+		ER_TransformHierarchy();
+		~ER_TransformHierarchy();
+
+		// Adds a node as the last child of aParentId (-1 for a root). Returns the node's id.
+		int AddNode(int aParentId, const XMFLOAT4X4& aLocalTransform);
+		void RemoveNode(int aId); // removes the whole subtree
+		void Clear();
+
+		void SetLocalTransform(int aId, const XMFLOAT4X4& aLocalTransform);
+		// Sets the local transform so that the world transform becomes aWorldTransform (uses the parent's world transform from the last Update())
+		void SetWorldTransform(int aId, const XMFLOAT4X4& aWorldTransform);
+		const XMFLOAT4X4& GetLocalTransform(int aId) const { return mLocalTransforms[mIdToIndex[aId]]; }
+		const XMFLOAT4X4& GetWorldTransform(int aId) const { return mWorldTransforms[mIdToIndex[aId]]; } // valid after Update()
+		int GetParent(int aId) const;
+		bool IsValidNode(int aId) const { return aId >= 0 && aId < static_cast<int>(mIdToIndex.size()) && mIdToIndex[aId] >= 0; }
+
+		void Update();
+		const std::vector<int>& GetChangedNodes() const { return mChangedNodes; } // ids of nodes whose world transform was recalculated in the last Update()
+
+		int GetNodesCount() const { return static_cast<int>(mIds.size()); }
+
+		// Builds a random hierarchy, changes aDirtyRatio of the nodes every frame and compares Update() with a full recalculation
+		// (timings and the amount of mismatching world transforms, which must be 0)
+		static bool RunBenchmark(int aNodesCount, float aDirtyRatio, int aFramesCount, std::string& aOutReport);
+	private:
+		enum NodeFlags
+		{
+			NODE_DIRTY = 1 << 0, // local transform changed
+			NODE_DIRTY_CHILDREN = 1 << 1, // some node in the subtree (excluding this one) is dirty
+			NODE_CHANGED = 1 << 2 // world transform was recalculated in the current pass
+		};
+
+		void MarkDirty(int aIndex);
+
+		// depth-first order
+		std::vector<int> mIds;
+		std::vector<int> mParentIndices; // -1 for roots
+		std::vector<int> mSubtreeSizes; // including the node itself
+		std::vector<unsigned char> mFlags;
+		std::vector<XMFLOAT4X4> mLocalTransforms;
+		std::vector<XMFLOAT4X4> mWorldTransforms;
+
+		std::vector<int> mIdToIndex; // -1 for free ids
+		std::vector<int> mFreeIds;
+		std::vector<int> mChangedNodes;
+	};
+}
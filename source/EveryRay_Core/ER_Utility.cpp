@@ -1,6 +1,7 @@
 
 #include "stdafx.h"
 #include "ER_Utility.h"
+#include "ER_Random.h"
 #include <algorithm>
 #include <exception>
 #include <Shlwapi.h>
@@ -166,9 +167,18 @@ namespace EveryRay_Core
 	}
 
 	float ER_Utility::RandomFloat(float a, float b) {
-		float random = ((float)rand()) / (float)RAND_MAX;
-		float diff = b - a;
-		float r = random * diff;
-		return a + r;
+		static thread_local ER_Random sRandom;
+		return sRandom.NextFloat(a, b);
 	}
-}
+
+	UINT64 ER_Utility::HashBytes(const void* data, size_t size, UINT64 hash)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= static_cast<UINT64>(bytes[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+}
\ No newline at end of file
@@ -25,7 +25,8 @@ namespace EveryRay_Core
 		static std::wstring ToWideString(const std::string& source);
 		static void PathJoin(std::wstring& dest, const std::wstring& sourceDirectory, const std::wstring& sourceFile);
 		static void GetPathExtension(const std::wstring& source, std::wstring& dest);
-		static float RandomFloat(float a, float b);
+		static float RandomFloat(float a, float b); // per-thread ER_Random with the default seed, prefer own seeded ER_Random in systems
+		static UINT64 HashBytes(const void* data, size_t size, UINT64 hash = ER_HASH_SEED); // FNV-1a (64-bit), stable across platforms/runs
 
 		static bool IsEditorMode;
 		static bool IsLightEditor;
@@ -53,6 +53,8 @@ namespace EveryRay_Core
 		void SetEnabled(bool val) { mEnabled = val; }
 
 		ER_RHI_GPUTexture* GetVoxelFogTexture() { return mFinalVoxelAccumulationTexture3D; }
+		ER_RHI_GPUTexture* GetTempVoxelInjectionTexture(int aIndex) { return mTempVoxelInjectionTexture3D[aIndex]; }
+		ER_RHI_GPUTexture* GetBlueNoiseTexture() { return mBlueNoiseTexture; }
 	private:
 		void ComputeInjection();
 		void ComputeAccumulation();
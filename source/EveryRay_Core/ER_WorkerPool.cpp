@@ -0,0 +1,93 @@
+#include "stdafx.h"
+
+#include "ER_WorkerPool.h"
+
+namespace EveryRay_Core
+{
+	ER_WorkerPool::ER_WorkerPool(int aWorkersCount)
+		: mNextTask(0)
+	{
+		if (aWorkersCount < 0)
+			aWorkersCount = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+
+		mWorkers.reserve(aWorkersCount);
+		for (int i = 0; i < aWorkersCount; i++)
+			mWorkers.push_back(std::thread(&ER_WorkerPool::WorkerLoop, this, i));
+	}
+
+	ER_WorkerPool::~ER_WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mIsShuttingDown = true;
+		}
+		mJobCondition.notify_all();
+		for (auto& t : mWorkers)
+			t.join();
+	}
+
+	void ER_WorkerPool::Run(int aTasksCount, const Delegate_Task& aTask, int aMaxThreads)
+	{
+		if (aTasksCount <= 0)
+			return;
+
+		const int workersCount = std::min(static_cast<int>(mWorkers.size()), std::min(aMaxThreads, aTasksCount) - 1);
+		if (workersCount <= 0)
+		{
+			for (int i = 0; i < aTasksCount; i++)
+				aTask(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			assert(!mTask); // not reentrant
+			mTask = &aTask;
+			mTasksCount = aTasksCount;
+			mNextTask = 0;
+			mJobWorkersCount = workersCount;
+			mPendingWorkers = workersCount;
+			mJobIndex++;
+		}
+		mJobCondition.notify_all();
+
+		RunTasks(); // the calling thread works too
+
+		// workers still hold the task, so we can only return after all of them are done (even if there are no tasks left)
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDoneCondition.wait(lock, [this] { return mPendingWorkers == 0; });
+		mTask = nullptr;
+	}
+
+	void ER_WorkerPool::RunTasks()
+	{
+		for (int i = mNextTask++; i < mTasksCount; i = mNextTask++)
+			(*mTask)(i);
+	}
+
+	void ER_WorkerPool::WorkerLoop(int aWorkerIndex)
+	{
+		UINT64 lastJobIndex = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mJobCondition.wait(lock, [this, lastJobIndex] { return mIsShuttingDown || mJobIndex != lastJobIndex; });
+				if (mIsShuttingDown)
+					return;
+
+				lastJobIndex = mJobIndex;
+				if (aWorkerIndex >= mJobWorkersCount)
+					continue;
+			}
+
+			RunTasks();
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mPendingWorkers--;
+			}
+			mDoneCondition.notify_one();
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+namespace EveryRay_Core
+{
+	// Persistent worker threads for short parallel loops inside a frame (i.e. instance binning, voxel GI cascades):
+	// threads are created once and sleep between jobs, so a job only costs a wake-up instead of spawning and joining threads.
+	// Run() splits [0, aTasksCount) between the workers and the calling thread (via an atomic counter, tasks can be very uneven)
+	// and returns when all tasks are done. Only one job at a time (Run() is not reentrant), tasks must not call Run().
+	class ER_WorkerPool
+	{
+	public:
+		using Delegate_Task = std::function<void(int aTaskIndex)>;
+
+		ER_WorkerPool(int aWorkersCount = -1); // -1: one worker less than hardware threads (the calling thread works too)
+		~ER_WorkerPool();
+
+		// aMaxThreads includes the calling thread (1 - runs all tasks on the calling thread)
+		void Run(int aTasksCount, const Delegate_Task& aTask, int aMaxThreads = INT_MAX);
+		int GetMaxThreadsCount() const { return static_cast<int>(mWorkers.size()) + 1; }
+	private:
+		void WorkerLoop(int aWorkerIndex);
+		void RunTasks();
+
+		std::vector<std::thread> mWorkers;
+
+		std::mutex mMutex;
+		std::condition_variable mJobCondition;
+		std::condition_variable mDoneCondition;
+
+		// current job
+		const Delegate_Task* mTask = nullptr;
+		int mTasksCount = 0;
+		std::atomic<int> mNextTask;
+		int mJobWorkersCount = 0; // workers [0, mJobWorkersCount) take part in the job
+		int mPendingWorkers = 0;
+		UINT64 mJobIndex = 0;
+
+		bool mIsShuttingDown = false;
+	};
+}
@@ -424,12 +424,14 @@ namespace EveryRay_Core
 		mDirect3DDeviceContext->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
 	}
 
-	void ER_RHI_DX11::DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset)
+	// No multi-draw on DX11: one call per args (the count buffer can not be read, the args past the count have 0 instances)
+	void ER_RHI_DX11::DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset, UINT aDrawCount, ER_RHI_GPUBuffer* aCountBuffer, UINT aCountBufferOffset)
 	{
 		assert(anArgsBuffer);
 
 		ER_RHI_DX11_GPUBuffer* dx11Buffer = static_cast<ER_RHI_DX11_GPUBuffer*>(anArgsBuffer);
-		mDirect3DDeviceContext->DrawIndexedInstancedIndirect(static_cast<ID3D11Buffer*>(dx11Buffer->GetBuffer()), alignedByteOffset);
+		for (UINT i = 0; i < aDrawCount; i++)
+			mDirect3DDeviceContext->DrawIndexedInstancedIndirect(static_cast<ID3D11Buffer*>(dx11Buffer->GetBuffer()), alignedByteOffset + i * ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT * sizeof(UINT));
 	}
 
 	void ER_RHI_DX11::Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ)
@@ -437,6 +439,21 @@ namespace EveryRay_Core
 		mDirect3DDeviceContext->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
 	}
 
+	void ER_RHI_DX11::DispatchIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset)
+	{
+		assert(anArgsBuffer);
+
+		ER_RHI_DX11_GPUBuffer* dx11Buffer = static_cast<ER_RHI_DX11_GPUBuffer*>(anArgsBuffer);
+		mDirect3DDeviceContext->DispatchIndirect(static_cast<ID3D11Buffer*>(dx11Buffer->GetBuffer()), alignedByteOffset);
+	}
+
+	// No deferred contexts: the tasks are recorded one after another into the immediate context
+	void ER_RHI_DX11::RecordParallelGraphicsCommandLists(const std::vector<std::function<void(int)>>& aTasks)
+	{
+		for (auto& task : aTasks)
+			task(0);
+	}
+
 	void ER_RHI_DX11::GenerateMips(ER_RHI_GPUTexture* aTexture, ER_RHI_GPUTexture* aSRGBTexture)
 	{
 		assert(aTexture);
@@ -966,6 +983,19 @@ namespace EveryRay_Core
 		buffer->Unmap(this);
 	}
 
+	void ER_RHI_DX11::UpdateBufferRegions(ER_RHI_GPUBuffer* aBuffer, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount)
+	{
+		assert(aBuffer && aData);
+		ID3D11Buffer* buffer = static_cast<ID3D11Buffer*>(aBuffer->GetBuffer());
+		for (UINT i = 0; i < aRegionsCount; i++)
+		{
+			assert(aBuffer->GetSize() >= static_cast<int>(aRegions[i].Offset + aRegions[i].Size));
+
+			D3D11_BOX box = { aRegions[i].Offset, 0, 0, aRegions[i].Offset + aRegions[i].Size, 1, 1 };
+			mDirect3DDeviceContext->UpdateSubresource(buffer, 0, &box, static_cast<const unsigned char*>(aData) + aRegions[i].Offset, 0, 0);
+		}
+	}
+
 	void ER_RHI_DX11::InitImGui()
 	{
 		ImGui_ImplDX11_Init(mDirect3DDevice, mDirect3DDeviceContext);
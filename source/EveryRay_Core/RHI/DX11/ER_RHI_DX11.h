@@ -66,12 +66,13 @@ namespace EveryRay_Core
 		virtual void DrawIndexed(UINT IndexCount) override;
 		virtual void DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override;
 		virtual void DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override;
-		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) override;
+		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset, UINT aDrawCount = 1, ER_RHI_GPUBuffer* aCountBuffer = nullptr, UINT aCountBufferOffset = 0) override;
 
 		virtual void Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override;
-		//TODO DispatchIndirect
+		virtual void DispatchIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) override;
 
 		virtual void ExecuteCommandLists(int commandListIndex = 0, bool isCompute = false) override {}; //not supported on DX11
+		virtual void RecordParallelGraphicsCommandLists(const std::vector<std::function<void(int)>>& aTasks) override;
 		virtual void ExecuteCopyCommandList() override {}; //not supported on DX11
 
 		virtual void GenerateMips(ER_RHI_GPUTexture* aTexture, ER_RHI_GPUTexture* aSRGBTexture = nullptr) override;
@@ -137,6 +138,7 @@ namespace EveryRay_Core
 		virtual void UnbindResourcesFromShader(ER_RHI_SHADER_TYPE aShaderType, bool unbindShader = true) override;
 
 		virtual void UpdateBuffer(ER_RHI_GPUBuffer* aBuffer, void* aData, int dataSize, bool updateForAllBackBuffers = false) override;
+		virtual void UpdateBufferRegions(ER_RHI_GPUBuffer* aBuffer, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount) override;
 		
 		virtual bool IsHardwareRaytracingSupported() override { return false; }
 		virtual bool IsRootConstantSupported()  override { return false; }
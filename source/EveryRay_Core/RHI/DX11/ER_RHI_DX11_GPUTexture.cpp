@@ -411,6 +411,56 @@ namespace EveryRay_Core
 		resourceTex->Release();
 	}
 
+	void ER_RHI_DX11_GPUTexture::CreateGPUTextureResource(ER_RHI* aRHI, const ER_RHI_SUBRESOURCE_DATA* aData, UINT mipCount, UINT width, UINT height, ER_RHI_FORMAT format)
+	{
+		assert(aRHI);
+		assert(aData && mipCount > 0);
+		ER_RHI_DX11* aRHIDX11 = static_cast<ER_RHI_DX11*>(aRHI);
+		ID3D11Device* device = aRHIDX11->GetDevice();
+		assert(device);
+
+		mIsLoadedFromFile = false;
+		mArraySize = 1;
+		mMipLevels = mipCount;
+		mBindFlags = ER_BIND_SHADER_RESOURCE;
+		mWidth = width;
+		mHeight = height;
+		mDepth = 0;
+		mIsCubemap = false;
+		mIsDepthStencil = false;
+		mFormat = aRHIDX11->GetFormat(format);
+
+		D3D11_TEXTURE2D_DESC texDesc = {};
+		texDesc.Width = width;
+		texDesc.Height = height;
+		texDesc.MipLevels = mipCount;
+		texDesc.ArraySize = 1;
+		texDesc.Format = mFormat;
+		texDesc.SampleDesc.Count = 1;
+		texDesc.SampleDesc.Quality = 0;
+		texDesc.Usage = D3D11_USAGE_IMMUTABLE;
+		texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+		std::vector<D3D11_SUBRESOURCE_DATA> subresources(mipCount);
+		for (UINT i = 0; i < mipCount; i++)
+		{
+			subresources[i].pSysMem = aData[i].Data;
+			subresources[i].SysMemPitch = aData[i].RowPitch;
+			subresources[i].SysMemSlicePitch = aData[i].SlicePitch;
+		}
+
+		if (FAILED(device->CreateTexture2D(&texDesc, subresources.data(), &mTexture2D)))
+			throw ER_CoreException("ER_RHI_DX11: Could not create GPU texture from data");
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC sDesc = {};
+		sDesc.Format = mFormat;
+		sDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		sDesc.Texture2D.MipLevels = mipCount;
+		sDesc.Texture2D.MostDetailedMip = 0;
+		if (FAILED(device->CreateShaderResourceView(mTexture2D, &sDesc, &mSRV)))
+			throw ER_CoreException("ER_RHI_DX11: Could not create SRV of the GPU texture from data");
+	}
+
 	void ER_RHI_DX11_GPUTexture::LoadFallbackTexture(ER_RHI* aRHI, ID3D11Resource** texture, ID3D11ShaderResourceView** textureView)
 	{
 		assert(aRHI);
@@ -8,11 +8,13 @@
 
 #include "..\..\ER_CoreException.h"
 #include "..\..\ER_Utility.h"
+#include "..\..\ER_WorkerPool.h"
 
 namespace EveryRay_Core
 {
 	static ER_RHI_DX12_DescriptorHandle sNullSRV2DHandle;
 	static ER_RHI_DX12_DescriptorHandle sNullSRV3DHandle;
+	static thread_local int sCurrentGraphicsCommandListIndex = -1; // every recording thread has its own command list
 	int ER_RHI_DX12::mBackBufferIndex = 0;
 
 	ER_RHI_DX12::ER_RHI_DX12()
@@ -22,6 +24,8 @@ namespace EveryRay_Core
 	ER_RHI_DX12::~ER_RHI_DX12()
 	{
 		WaitForGpuOnGraphicsFence();
+		WaitForGpuOnComputeFence();
+		DeleteObject(mParallelRecordingPool);
 		DeleteObject(mGenerateMips2DCS);
 		DeleteObject(mGenerateMips2DRS);
 		DeleteObject(mGenerateMips3DCS);
@@ -33,6 +37,12 @@ namespace EveryRay_Core
 
 		ResetReplacementMippedTexturesPool();
 
+		for (int i = 0; i < ER_RHI_MAX_GRAPHICS_COMMAND_LISTS; i++)
+		{
+			DeleteObject(mGraphicsCommandListContexts[i].mBuildingGraphicsPSO);
+			DeleteObject(mGraphicsCommandListContexts[i].mBuildingComputePSO);
+		}
+
 		DeleteObject(mDescriptorHeapManager);
 	}
 
@@ -206,12 +216,65 @@ namespace EveryRay_Core
 					throw ER_CoreException("ER_RHI_DX12: Could not create event for main graphics fence");
 				mFenceGraphics->SetName(L"ER_RHI_DX12: Graphics fence (main)");
 
+				if (FAILED(mDevice->CreateFence(mFenceValuesParallelGraphics, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(mFenceParallelGraphics.ReleaseAndGetAddressOf()))))
+					throw ER_CoreException("ER_RHI_DX12: Could not create graphics fence (parallel lists)");
+
+				mFenceValuesParallelGraphics++;
+				mFenceEventParallelGraphics.Attach(CreateEventEx(nullptr, nullptr, 0, EVENT_MODIFY_STATE | SYNCHRONIZE));
+				if (!mFenceEventParallelGraphics.IsValid())
+					throw ER_CoreException("ER_RHI_DX12: Could not create event for graphics fence (parallel lists)");
+				mFenceParallelGraphics->SetName(L"ER_RHI_DX12: Graphics fence (parallel lists)");
 			}
 		}
 
-		//TODO create compute queue data 
+		// Create compute command queue data (async compute)
 		{
-			//...
+			D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+			queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+			queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+
+			if (FAILED(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(mCommandQueueCompute.ReleaseAndGetAddressOf()))))
+				throw ER_CoreException("ER_RHI_DX12: Could not create compute command queue");
+
+			for (int j = 0; j < DX12_MAX_BACK_BUFFER_COUNT; j++)
+			{
+				for (int i = 0; i < ER_RHI_MAX_COMPUTE_COMMAND_LISTS; i++)
+				{
+					if (FAILED(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(mCommandAllocatorsCompute[j][i].ReleaseAndGetAddressOf()))))
+					{
+						std::string message = "ER_RHI_DX12: Could not create compute command allocator " + std::to_string(j) + " " + std::to_string(i);
+						throw ER_CoreException(message.c_str());
+					}
+
+					if (j == 0)
+					{
+						if (FAILED(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COMPUTE, mCommandAllocatorsCompute[0][i].Get(), nullptr, IID_PPV_ARGS(mCommandListCompute[i].ReleaseAndGetAddressOf()))))
+						{
+							std::string message = "ER_RHI_DX12: Could not create compute command list " + std::to_string(i);
+							throw ER_CoreException(message.c_str());
+						}
+						mCommandListCompute[i]->Close();
+					}
+				}
+			}
+
+			// fences
+			{
+				if (FAILED(mDevice->CreateFence(mFenceValuesCompute, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(mFenceCompute.ReleaseAndGetAddressOf()))))
+					throw ER_CoreException("ER_RHI_DX12: Could not create compute fence");
+
+				mFenceValuesCompute++;
+				mFenceEventCompute.Attach(CreateEventEx(nullptr, nullptr, 0, EVENT_MODIFY_STATE | SYNCHRONIZE));
+				if (!mFenceEventCompute.IsValid())
+					throw ER_CoreException("ER_RHI_DX12: Could not create event for compute fence");
+				mFenceCompute->SetName(L"ER_RHI_DX12: Compute fence");
+
+				if (FAILED(mDevice->CreateFence(mFenceValuesGraphicsForCompute, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(mFenceGraphicsForCompute.ReleaseAndGetAddressOf()))))
+					throw ER_CoreException("ER_RHI_DX12: Could not create graphics fence (for compute)");
+
+				mFenceValuesGraphicsForCompute++;
+				mFenceGraphicsForCompute->SetName(L"ER_RHI_DX12: Graphics fence (for compute)");
+			}
 		}
 
 		WaitForGpuOnGraphicsFence();
@@ -331,6 +394,19 @@ namespace EveryRay_Core
 			if (FAILED(mDevice->CreateCommandSignature(&commandSignatureDesc, nullptr, IID_PPV_ARGS(mCommandSignature_DrawIndexed.ReleaseAndGetAddressOf()))))
 				throw ER_CoreException("ER_RHI_DX12: Could not create command signature (Draw Indexed)");
 		}
+		{
+			// Dispatch call
+			D3D12_INDIRECT_ARGUMENT_DESC argumentDescs[1] = {};
+			argumentDescs[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH;
+
+			D3D12_COMMAND_SIGNATURE_DESC commandSignatureDesc = {};
+			commandSignatureDesc.pArgumentDescs = argumentDescs;
+			commandSignatureDesc.NumArgumentDescs = _countof(argumentDescs);
+			commandSignatureDesc.ByteStride = sizeof(D3D12_DISPATCH_ARGUMENTS);
+
+			if (FAILED(mDevice->CreateCommandSignature(&commandSignatureDesc, nullptr, IID_PPV_ARGS(mCommandSignature_Dispatch.ReleaseAndGetAddressOf()))))
+				throw ER_CoreException("ER_RHI_DX12: Could not create command signature (Dispatch)");
+		}
 		return true;
 	}
 
@@ -356,7 +432,20 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::WaitForGpuOnComputeFence()
 	{
-		//TODO
+		if (mCommandQueueCompute && mFenceCompute && mFenceEventCompute.IsValid())
+		{
+			// Schedule a Signal command in the GPU queue.
+			UINT64 fenceValue = mFenceValuesCompute;
+			if (SUCCEEDED(mCommandQueueCompute->Signal(mFenceCompute.Get(), fenceValue)))
+			{
+				// Wait until the Signal has been processed.
+				if (SUCCEEDED(mFenceCompute->SetEventOnCompletion(fenceValue, mFenceEventCompute.Get())))
+				{
+					WaitForSingleObjectEx(mFenceEventCompute.Get(), INFINITE, FALSE);
+					mFenceValuesCompute++;
+				}
+			}
+		}
 	}
 
 	void ER_RHI_DX12::WaitForGpuOnCopyFence()
@@ -420,19 +509,28 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::BeginEventTag(const std::string& aName, bool isComputeQueue)
 	{
-		PIXBeginEvent(isComputeQueue ? mCommandListCompute[mCurrentComputeCommandListIndex].Get() : mCommandListGraphics[mCurrentGraphicsCommandListIndex].Get(), 0, aName.c_str());
+		// tags of the passes recorded into the compute list go there too
+		isComputeQueue = isComputeQueue || mCurrentComputeCommandListIndex > -1;
+		PIXBeginEvent(isComputeQueue ? mCommandListCompute[mCurrentComputeCommandListIndex].Get() : mCommandListGraphics[sCurrentGraphicsCommandListIndex].Get(), 0, aName.c_str());
 	}
 
 	void ER_RHI_DX12::EndEventTag(bool isComputeQueue)
 	{
-		PIXEndEvent(isComputeQueue ? mCommandListCompute[mCurrentComputeCommandListIndex].Get() : mCommandListGraphics[mCurrentGraphicsCommandListIndex].Get());
+		isComputeQueue = isComputeQueue || mCurrentComputeCommandListIndex > -1;
+		PIXEndEvent(isComputeQueue ? mCommandListCompute[mCurrentComputeCommandListIndex].Get() : mCommandListGraphics[sCurrentGraphicsCommandListIndex].Get());
 	}
 
 	void ER_RHI_DX12::BeginGraphicsCommandList(int index)
 	{
 		assert(index < ER_RHI_MAX_GRAPHICS_COMMAND_LISTS);
 
-		mCurrentGraphicsCommandListIndex = index;
+		sCurrentGraphicsCommandListIndex = index;
+
+		// a new list has no PSO set
+		ER_RHI_DX12_CommandListContext& context = mGraphicsCommandListContexts[index];
+		context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		context.mCurrentSetGraphicsPSOName = "";
+		context.mCurrentSetComputePSOName = "";
 
 		HRESULT hr;
 		if (FAILED(hr = mCommandAllocatorsGraphics[mBackBufferIndex][index]->Reset()))
@@ -451,7 +549,7 @@ namespace EveryRay_Core
 	void ER_RHI_DX12::EndGraphicsCommandList(int index)
 	{
 		assert(index < ER_RHI_MAX_GRAPHICS_COMMAND_LISTS);
-		mCurrentGraphicsCommandListIndex = -1;
+		sCurrentGraphicsCommandListIndex = -1;
 
 		HRESULT hr;
 		if (FAILED(hr = mCommandListGraphics[index]->Close()))
@@ -461,6 +559,48 @@ namespace EveryRay_Core
 		}
 	}
 
+	// Compute lists are recorded on the main thread; while one is recorded, all compute work (dispatches, compute root signatures, PSOs and tables)
+	// goes into it instead of the current graphics list
+	void ER_RHI_DX12::BeginComputeCommandList(int index)
+	{
+		assert(index < ER_RHI_MAX_COMPUTE_COMMAND_LISTS);
+
+		mCurrentComputeCommandListIndex = index;
+
+		ER_RHI_DX12_CommandListContext& context = mComputeCommandListContexts[index];
+		context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		context.mCurrentSetComputePSOName = "";
+
+		HRESULT hr;
+		if (FAILED(hr = mCommandAllocatorsCompute[mBackBufferIndex][index]->Reset()))
+		{
+			std::string message = "ER_RHI_DX12:: Could not Reset() command allocator (compute) " + std::to_string(index);
+			throw ER_CoreException(message.c_str());
+		}
+
+		if (FAILED(hr = mCommandListCompute[index]->Reset(mCommandAllocatorsCompute[mBackBufferIndex][index].Get(), nullptr)))
+		{
+			std::string message = "ER_RHI_DX12:: Could not Reset() command list (compute) " + std::to_string(index);
+			throw ER_CoreException(message.c_str());
+		}
+
+		ID3D12DescriptorHeap* ppHeaps[] = { mDescriptorHeapManager->GetGPUHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV)->GetHeap() };
+		mCommandListCompute[index]->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+	}
+
+	void ER_RHI_DX12::EndComputeCommandList(int index)
+	{
+		assert(index < ER_RHI_MAX_COMPUTE_COMMAND_LISTS);
+		mCurrentComputeCommandListIndex = -1;
+
+		HRESULT hr;
+		if (FAILED(hr = mCommandListCompute[index]->Close()))
+		{
+			std::string message = "ER_RHI_DX12:: Could not close command list (compute) " + std::to_string(index);
+			throw ER_CoreException(message.c_str());
+		}
+	}
+
 	void ER_RHI_DX12::BeginCopyCommandList(int index /*= 0*/)
 	{
 		HRESULT hr;
@@ -480,49 +620,49 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::ClearMainRenderTarget(float colors[4])
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(mMainRenderTarget[mBackBufferIndex].Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ResourceBarrier(1, &barrier);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearRenderTargetView(GetMainRenderTargetView(), colors, 0, nullptr);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ResourceBarrier(1, &barrier);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearRenderTargetView(GetMainRenderTargetView(), colors, 0, nullptr);
 	}
 
 	void ER_RHI_DX12::ClearMainDepthStencilTarget(float depth, UINT stencil /*= 0*/)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearDepthStencilView(GetMainDepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, depth, stencil, 0, nullptr);
+		assert(sCurrentGraphicsCommandListIndex > -1);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearDepthStencilView(GetMainDepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, depth, stencil, 0, nullptr);
 	}
 
 	void ER_RHI_DX12::ClearRenderTarget(ER_RHI_GPUTexture* aRenderTarget, float colors[4], int rtvArrayIndex)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(aRenderTarget);
-		TransitionResources({ static_cast<ER_RHI_GPUResource*>(aRenderTarget) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_RENDER_TARGET);
+		TransitionResources({ static_cast<ER_RHI_GPUResource*>(aRenderTarget) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_RENDER_TARGET, sCurrentGraphicsCommandListIndex);
 		if (rtvArrayIndex > 0)
 		{
 			ER_RHI_DX12_DescriptorHandle& handle = static_cast<ER_RHI_DX12_GPUTexture*>(aRenderTarget)->GetRTVHandle(rtvArrayIndex);
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearRenderTargetView(handle.GetCPUHandle(), colors, 0, nullptr);
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearRenderTargetView(handle.GetCPUHandle(), colors, 0, nullptr);
 		}
 		else
 		{
 			ER_RHI_DX12_DescriptorHandle& handle = static_cast<ER_RHI_DX12_GPUTexture*>(aRenderTarget)->GetRTVHandle();
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearRenderTargetView(handle.GetCPUHandle(), colors, 0, nullptr);
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearRenderTargetView(handle.GetCPUHandle(), colors, 0, nullptr);
 		}
 	}
 
 	void ER_RHI_DX12::ClearDepthStencilTarget(ER_RHI_GPUTexture* aDepthTarget, float depth, UINT stencil)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(aDepthTarget);
 		ER_RHI_DX12_GPUTexture* dtDX12 = static_cast<ER_RHI_DX12_GPUTexture*>(aDepthTarget);
 		assert(dtDX12);
-		TransitionResources({ aDepthTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_DEPTH_WRITE);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearDepthStencilView(dtDX12->GetDSVHandle().GetCPUHandle(), (stencil == -1) ? D3D12_CLEAR_FLAG_DEPTH : D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, depth, stencil, 0, nullptr);
+		TransitionResources({ aDepthTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_DEPTH_WRITE, sCurrentGraphicsCommandListIndex);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearDepthStencilView(dtDX12->GetDSVHandle().GetCPUHandle(), (stencil == -1) ? D3D12_CLEAR_FLAG_DEPTH : D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, depth, stencil, 0, nullptr);
 	}
 
 	// Two versions are available (shader and command). Shader is the default one at the moment
 	void ER_RHI_DX12::ClearUAV(ER_RHI_GPUResource* aRenderTarget, float colors[4])
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(aRenderTarget);
 		ER_RHI_DX12_GPUTexture* uavDX12 = static_cast<ER_RHI_DX12_GPUTexture*>(aRenderTarget);
 		assert(uavDX12);
@@ -531,10 +671,10 @@ namespace EveryRay_Core
 			return; //quick fix for not touching the resource that was created on a different back buffer's heap
 
 		bool is3D = uavDX12->GetDepth() > 0;
-		TransitionResources({ aRenderTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS, mCurrentGraphicsCommandListIndex);
+		TransitionResources({ aRenderTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS, sCurrentGraphicsCommandListIndex);
 
 		#pragma region SHADER_CLEAR
-		auto cmdList = mCommandListGraphics[mCurrentGraphicsCommandListIndex];
+		auto cmdList = mCommandListGraphics[sCurrentGraphicsCommandListIndex];
 
 		const std::string& psoName = is3D ? mClearUAV3DPSOName : mClearUAV2DPSOName;
 		ER_RHI_GPURootSignature* rs = is3D ? mClearUAV3DRS : mClearUAV2DRS;
@@ -566,7 +706,7 @@ namespace EveryRay_Core
 			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(static_cast<ID3D12Resource*>(aRenderTarget->GetResource())));
 		}
 		UnsetPSO();
-		TransitionResources({ aRenderTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, mCurrentGraphicsCommandListIndex);
+		TransitionResources({ aRenderTarget }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, sCurrentGraphicsCommandListIndex);
 #pragma endregion
 
 		#pragma region COMMAND_CLEAR
@@ -578,7 +718,7 @@ namespace EveryRay_Core
 		//	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = uavDX12->GetUAVHandle().GetCPUHandle();
 		//	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = uavDX12->GetUAVHandleGPU().GetGPUHandle();
 		//
-		//	mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearUnorderedAccessViewFloat(gpuHandle, cpuHandle, static_cast<ID3D12Resource*>(uavDX12->GetResource()), colors, 0, nullptr);
+		//	mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearUnorderedAccessViewFloat(gpuHandle, cpuHandle, static_cast<ID3D12Resource*>(uavDX12->GetResource()), colors, 0, nullptr);
 		//}
 		//else
 		//{
@@ -587,7 +727,7 @@ namespace EveryRay_Core
 		//		D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = uavDX12->GetUAVHandle(i).GetCPUHandle();
 		//		D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = uavDX12->GetUAVHandleGPU(i).GetGPUHandle();
 		//
-		//		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ClearUnorderedAccessViewFloat(gpuHandle, cpuHandle, static_cast<ID3D12Resource*>(uavDX12->GetResource()), colors, 0, nullptr);
+		//		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ClearUnorderedAccessViewFloat(gpuHandle, cpuHandle, static_cast<ID3D12Resource*>(uavDX12->GetResource()), colors, 0, nullptr);
 		//	}
 		//}
 #pragma endregion
@@ -698,7 +838,7 @@ namespace EveryRay_Core
 	void ER_RHI_DX12::CopyGPUTextureSubresourceRegion(ER_RHI_GPUResource* aDestBuffer, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ER_RHI_GPUResource* aSrcBuffer, UINT SrcSubresource, bool isInCopyQueueOrSkipTransitions)
 	{
 		if (!isInCopyQueueOrSkipTransitions)
-			assert(mCurrentGraphicsCommandListIndex > -1);
+			assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(aDestBuffer);
 		assert(aSrcBuffer);
 
@@ -710,7 +850,7 @@ namespace EveryRay_Core
 		if (!isInCopyQueueOrSkipTransitions)
 		{
 			TransitionResources({ static_cast<ER_RHI_GPUResource*>(dstbuffer), static_cast<ER_RHI_GPUResource*>(srcbuffer) },
-				{ ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_DEST, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_SOURCE }, mCurrentGraphicsCommandListIndex);
+				{ ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_DEST, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_SOURCE }, sCurrentGraphicsCommandListIndex);
 		}
 
 		D3D12_TEXTURE_COPY_LOCATION dstLocation;
@@ -723,7 +863,7 @@ namespace EveryRay_Core
 		srcLocation.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
 		srcLocation.SubresourceIndex = SrcSubresource;
 		
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->CopyTextureRegion(&dstLocation, DstX, DstY, DstZ, &srcLocation, NULL);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->CopyTextureRegion(&dstLocation, DstX, DstY, DstZ, &srcLocation, NULL);
 		//else if (dstbuffer->GetTexture3D() && srcbuffer->GetTexture3D())
 		//else
 		//	throw ER_CoreException("ER_RHI_DX12:: One of the resources is NULL during CopyGPUTextureSubresourceRegion()");
@@ -731,56 +871,78 @@ namespace EveryRay_Core
 		if (!isInCopyQueueOrSkipTransitions)
 		{
 			TransitionResources({ static_cast<ER_RHI_GPUResource*>(dstbuffer), static_cast<ER_RHI_GPUResource*>(srcbuffer) },
-				{ ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE }, mCurrentGraphicsCommandListIndex);
+				{ ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE }, sCurrentGraphicsCommandListIndex);
 		}
 	}
 
 	void ER_RHI_DX12::Draw(UINT VertexCount)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(VertexCount > 0);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->DrawInstanced(VertexCount, 1, 0, 0);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->DrawInstanced(VertexCount, 1, 0, 0);
 	}
 
 	void ER_RHI_DX12::DrawIndexed(UINT IndexCount)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(IndexCount > 0);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->DrawIndexedInstanced(IndexCount, 1, 0, 0, 0);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->DrawIndexedInstanced(IndexCount, 1, 0, 0, 0);
 	}
 
 	void ER_RHI_DX12::DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation)
 	{
 		assert(VertexCountPerInstance > 0);
 		assert(InstanceCount > 0);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
 	}
 
 	void ER_RHI_DX12::DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		assert(IndexCountPerInstance > 0);
 		assert(InstanceCount > 0);
 
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
 	}
 
-	void ER_RHI_DX12::DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset)
+	void ER_RHI_DX12::DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset, UINT aDrawCount, ER_RHI_GPUBuffer* aCountBuffer, UINT aCountBufferOffset)
 	{
 		assert(anArgsBuffer);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
-		TransitionResources({ anArgsBuffer }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		// parallel lists must not transition shared resources (see RecordParallelGraphicsCommandLists()): args are transitioned by the caller before
+		if (sCurrentGraphicsCommandListIndex >= mFirstParallelGraphicsCommandListIndex &&
+			sCurrentGraphicsCommandListIndex < mFirstParallelGraphicsCommandListIndex + ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS)
+		{
+			assert(anArgsBuffer->GetCurrentState() == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT);
+			assert(!aCountBuffer || aCountBuffer->GetCurrentState() == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		}
+		else if (aCountBuffer)
+			TransitionResources({ anArgsBuffer, aCountBuffer }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT, sCurrentGraphicsCommandListIndex);
+		else
+			TransitionResources({ anArgsBuffer }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT, sCurrentGraphicsCommandListIndex);
 
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->ExecuteIndirect(mCommandSignature_DrawIndexed.Get(), 1, static_cast<ID3D12Resource*>(anArgsBuffer->GetResource()), alignedByteOffset, nullptr, 0);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->ExecuteIndirect(mCommandSignature_DrawIndexed.Get(), aDrawCount, static_cast<ID3D12Resource*>(anArgsBuffer->GetResource()), alignedByteOffset,
+			aCountBuffer ? static_cast<ID3D12Resource*>(aCountBuffer->GetResource()) : nullptr, aCountBufferOffset);
 	}
 
 	void ER_RHI_DX12::Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+		GetComputeWorkCommandList()->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+	}
+
+	void ER_RHI_DX12::DispatchIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset)
+	{
+		assert(anArgsBuffer);
+
+		if (mCurrentComputeCommandListIndex > -1)
+			TransitionResourcesOnComputeCommandList({ anArgsBuffer }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		else
+			TransitionResources({ anArgsBuffer }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT, sCurrentGraphicsCommandListIndex);
+
+		GetComputeWorkCommandList()->ExecuteIndirect(mCommandSignature_Dispatch.Get(), 1, static_cast<ID3D12Resource*>(anArgsBuffer->GetResource()), alignedByteOffset, nullptr, 0);
 	}
 
 	void ER_RHI_DX12::ExecuteCommandLists(int commandListIndex /*= 0*/, bool isCompute /*= false*/)
@@ -790,7 +952,258 @@ namespace EveryRay_Core
 			ID3D12CommandList* ppCommandLists[] = { mCommandListGraphics[commandListIndex].Get() };
 			mCommandQueueGraphics->ExecuteCommandLists(1, ppCommandLists);
 		}
-		//else TODO
+		else
+		{
+			ID3D12CommandList* ppCommandLists[] = { mCommandListCompute[commandListIndex].Get() };
+			mCommandQueueCompute->ExecuteCommandLists(1, ppCommandLists);
+		}
+	}
+
+	// Signaling the graphics queue submits the commands recorded so far into the current graphics list (and reopens it),
+	// compute lists must be executed before their queue is signaled
+	UINT64 ER_RHI_DX12::SignalQueueFence(bool isComputeQueue)
+	{
+		if (isComputeQueue)
+		{
+			assert(mCurrentComputeCommandListIndex == -1);
+			const UINT64 fenceValue = mFenceValuesCompute++;
+			if (FAILED(mCommandQueueCompute->Signal(mFenceCompute.Get(), fenceValue)))
+				throw ER_CoreException("ER_RHI_DX12: Could not signal compute command queue");
+			return fenceValue;
+		}
+		else
+		{
+			const int index = sCurrentGraphicsCommandListIndex;
+			if (index > -1)
+			{
+				EndGraphicsCommandList(index);
+				ExecuteCommandLists(index);
+				ReopenGraphicsCommandList(index);
+			}
+
+			const UINT64 fenceValue = mFenceValuesGraphicsForCompute++;
+			if (FAILED(mCommandQueueGraphics->Signal(mFenceGraphicsForCompute.Get(), fenceValue)))
+				throw ER_CoreException("ER_RHI_DX12: Could not signal graphics command queue (for compute)");
+			return fenceValue;
+		}
+	}
+
+	// GPU-side wait: the queue waits for a value signaled by the other queue (the CPU does not block)
+	void ER_RHI_DX12::WaitForQueueFence(bool isComputeQueue, UINT64 aFenceValue)
+	{
+		if (isComputeQueue)
+		{
+			if (FAILED(mCommandQueueCompute->Wait(mFenceGraphicsForCompute.Get(), aFenceValue)))
+				throw ER_CoreException("ER_RHI_DX12: Compute command queue could not wait for the graphics fence");
+		}
+		else
+		{
+			// the commands recorded so far do not wait
+			const int index = sCurrentGraphicsCommandListIndex;
+			if (index > -1)
+			{
+				EndGraphicsCommandList(index);
+				ExecuteCommandLists(index);
+				ReopenGraphicsCommandList(index);
+			}
+
+			if (FAILED(mCommandQueueGraphics->Wait(mFenceCompute.Get(), aFenceValue)))
+				throw ER_CoreException("ER_RHI_DX12: Graphics command queue could not wait for the compute fence");
+		}
+	}
+
+	void ER_RHI_DX12::ReleaseResourcesToQueue(const std::vector<ER_RHI_GPUResource*>& aResources, ER_RHI_RESOURCE_STATE aState, bool isFromComputeQueue)
+	{
+		assert(IsComputeQueueState(aState));
+		if (isFromComputeQueue)
+			TransitionResourcesOnComputeCommandList(aResources, aState);
+		else
+			TransitionResources(aResources, aState, sCurrentGraphicsCommandListIndex);
+	}
+
+	// Compute lists only support the states of compute work (graphics-only states must be left on the graphics queue first)
+	bool ER_RHI_DX12::IsComputeQueueState(ER_RHI_RESOURCE_STATE aState)
+	{
+		return aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COMMON || aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS ||
+			aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE || aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_DEST ||
+			aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_SOURCE || aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_GENERIC_READ ||
+			aState == ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDIRECT_ARGUMENT;
+	}
+
+	void ER_RHI_DX12::TransitionResourcesOnComputeCommandList(const std::vector<ER_RHI_GPUResource*>& aResources, ER_RHI_RESOURCE_STATE aState)
+	{
+		assert(mCurrentComputeCommandListIndex > -1);
+		assert(IsComputeQueueState(aState));
+
+		std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+		for (auto resource : aResources)
+		{
+			if (!resource || resource->GetCurrentState() == aState)
+				continue;
+
+			assert(IsComputeQueueState(resource->GetCurrentState()));
+			barriers.emplace_back(CD3DX12_RESOURCE_BARRIER::Transition(static_cast<ID3D12Resource*>(resource->GetResource()), GetState(resource->GetCurrentState()), GetState(aState)));
+			resource->SetCurrentState(aState);
+		}
+
+		if (barriers.size() > 0)
+			mCommandListCompute[mCurrentComputeCommandListIndex]->ResourceBarrier(static_cast<UINT>(barriers.size()), barriers.data());
+	}
+
+	ID3D12GraphicsCommandList* ER_RHI_DX12::GetComputeWorkCommandList()
+	{
+		if (mCurrentComputeCommandListIndex > -1)
+			return mCommandListCompute[mCurrentComputeCommandListIndex].Get();
+
+		assert(sCurrentGraphicsCommandListIndex > -1);
+		return mCommandListGraphics[sCurrentGraphicsCommandListIndex].Get();
+	}
+
+	int ER_RHI_DX12::GetCurrentGraphicsCommandListIndex()
+	{
+		return sCurrentGraphicsCommandListIndex;
+	}
+
+	ER_RHI_DX12_CommandListContext& ER_RHI_DX12::GetCurrentContext()
+	{
+		// outside of command lists (i.e. PSOs created on init) the state goes to the first list's context
+		return mGraphicsCommandListContexts[sCurrentGraphicsCommandListIndex > -1 ? sCurrentGraphicsCommandListIndex : 0];
+	}
+
+	ER_RHI_DX12_DescriptorHandle ER_RHI_DX12::AllocateGPUDescriptors(UINT aCount)
+	{
+		assert(mDescriptorHeapManager);
+
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		ER_RHI_DX12_GPUDescriptorHeap* gpuDescriptorHeap = mDescriptorHeapManager->GetGPUHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+		// take a new range from the heap (shared by all command lists) when the current one is full or belongs to an old frame
+		if (context.mDescriptorRangeHeap != gpuDescriptorHeap || context.mDescriptorRangeResetCount != gpuDescriptorHeap->GetResetCount() ||
+			context.mDescriptorRangeUsed + aCount > context.mDescriptorRangeSize)
+		{
+			const UINT rangeSize = std::max(aCount, static_cast<UINT>(DX12_GPU_DESCRIPTOR_RANGE_SIZE));
+			context.mDescriptorRangeHeap = gpuDescriptorHeap;
+			context.mDescriptorRangeResetCount = gpuDescriptorHeap->GetResetCount();
+			context.mDescriptorRangeStart = gpuDescriptorHeap->GetHandleBlock(rangeSize).GetHeapIndex();
+			context.mDescriptorRangeSize = rangeSize;
+			context.mDescriptorRangeUsed = 0;
+		}
+
+		ER_RHI_DX12_DescriptorHandle handle = gpuDescriptorHeap->GetHandle(context.mDescriptorRangeStart + context.mDescriptorRangeUsed);
+		context.mDescriptorRangeUsed += aCount;
+		return handle;
+	}
+
+	void ER_RHI_DX12::SetViewportAndRect(int aCommandListIndex, const ER_RHI_Viewport& aViewport, const ER_RHI_Rect& aRect)
+	{
+		D3D12_VIEWPORT viewport;
+		viewport.TopLeftX = aViewport.TopLeftX;
+		viewport.TopLeftY = aViewport.TopLeftY;
+		viewport.Width = aViewport.Width;
+		viewport.Height = aViewport.Height;
+		viewport.MinDepth = aViewport.MinDepth;
+		viewport.MaxDepth = aViewport.MaxDepth;
+		mCommandListGraphics[aCommandListIndex]->RSSetViewports(1, &viewport);
+
+		D3D12_RECT rect = { aRect.left, aRect.top, aRect.right, aRect.bottom };
+		mCommandListGraphics[aCommandListIndex]->RSSetScissorRects(1, &rect);
+	}
+
+	void ER_RHI_DX12::RecordParallelGraphicsCommandLists(const std::vector<std::function<void(int)>>& aTasks)
+	{
+		const int tasksCount = static_cast<int>(aTasks.size());
+		assert(tasksCount <= ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS);
+		if (tasksCount == 0)
+			return;
+
+		// commands recorded so far into the current list go first
+		const int currentIndex = sCurrentGraphicsCommandListIndex;
+		assert(currentIndex < mFirstParallelGraphicsCommandListIndex || currentIndex >= mFirstParallelGraphicsCommandListIndex + ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS);
+		if (currentIndex > -1)
+			EndGraphicsCommandList(currentIndex);
+
+		// the lists (and their allocators) may have been submitted earlier in this frame already (i.e. several loads or passes in a row):
+		// their allocators can only be reset once the GPU is done with those commands
+		for (int i = 0; i < tasksCount; i++)
+		{
+			const UINT64 fenceValue = mParallelGraphicsCommandListsFenceValues[mBackBufferIndex][i];
+			if (mFenceParallelGraphics->GetCompletedValue() < fenceValue)
+			{
+				if (FAILED(mFenceParallelGraphics->SetEventOnCompletion(fenceValue, mFenceEventParallelGraphics.Get())))
+					throw ER_CoreException("ER_RHI_DX12: Could not wait for the graphics fence (parallel lists)");
+				WaitForSingleObjectEx(mFenceEventParallelGraphics.Get(), INFINITE, FALSE);
+			}
+		}
+
+		// persistent threads (created on the first call), the calling thread records lists too
+		if (!mParallelRecordingPool)
+			mParallelRecordingPool = new ER_WorkerPool(ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS - 1);
+
+		const ER_RHI_Viewport viewport = mCurrentViewport;
+		const ER_RHI_Rect rect = mCurrentRect;
+		std::vector<std::exception_ptr> exceptions(tasksCount);
+		mParallelRecordingPool->Run(tasksCount, [&](int i)
+		{
+			const int index = mFirstParallelGraphicsCommandListIndex + i;
+			try
+			{
+				BeginGraphicsCommandList(index);
+				SetGPUDescriptorHeap(ER_RHI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, false);
+				SetViewportAndRect(index, viewport, rect);
+				aTasks[i](index);
+				EndGraphicsCommandList(index);
+			}
+			catch (...)
+			{
+				exceptions[i] = std::current_exception();
+			}
+		});
+
+		for (auto& exception : exceptions)
+		{
+			if (exception)
+				std::rethrow_exception(exception);
+		}
+
+		// one submission in the order of the tasks
+		ID3D12CommandList* commandLists[ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS + 1];
+		UINT commandListsCount = 0;
+		if (currentIndex > -1)
+			commandLists[commandListsCount++] = mCommandListGraphics[currentIndex].Get();
+		for (int i = 0; i < tasksCount; i++)
+			commandLists[commandListsCount++] = mCommandListGraphics[mFirstParallelGraphicsCommandListIndex + i].Get();
+		mCommandQueueGraphics->ExecuteCommandLists(commandListsCount, commandLists);
+
+		const UINT64 fenceValue = mFenceValuesParallelGraphics++;
+		if (FAILED(mCommandQueueGraphics->Signal(mFenceParallelGraphics.Get(), fenceValue)))
+			throw ER_CoreException("ER_RHI_DX12: Could not signal graphics command queue (parallel lists)");
+		for (int i = 0; i < tasksCount; i++)
+			mParallelGraphicsCommandListsFenceValues[mBackBufferIndex][i] = fenceValue;
+
+		if (currentIndex > -1)
+			ReopenGraphicsCommandList(currentIndex);
+	}
+
+	// Reopens the list for the rest of its commands (without resetting its allocator: the submitted commands are still there)
+	// with the state that does not belong to passes (descriptor heap, viewport, rect and topology)
+	void ER_RHI_DX12::ReopenGraphicsCommandList(int aCommandListIndex)
+	{
+		if (FAILED(mCommandListGraphics[aCommandListIndex]->Reset(mCommandAllocatorsGraphics[mBackBufferIndex][aCommandListIndex].Get(), nullptr)))
+		{
+			std::string message = "ER_RHI_DX12:: Could not reopen command list (graphics) " + std::to_string(aCommandListIndex);
+			throw ER_CoreException(message.c_str());
+		}
+		sCurrentGraphicsCommandListIndex = aCommandListIndex;
+
+		ER_RHI_DX12_CommandListContext& context = mGraphicsCommandListContexts[aCommandListIndex];
+		context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		context.mCurrentSetGraphicsPSOName = "";
+		context.mCurrentSetComputePSOName = "";
+
+		SetGPUDescriptorHeap(ER_RHI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, false);
+		SetViewportAndRect(aCommandListIndex, mCurrentViewport, mCurrentRect);
+		if (context.mCurrentTopology != D3D_PRIMITIVE_TOPOLOGY_UNDEFINED)
+			mCommandListGraphics[aCommandListIndex]->IASetPrimitiveTopology(context.mCurrentTopology);
 	}
 
 	void ER_RHI_DX12::ExecuteCopyCommandList()
@@ -810,7 +1223,7 @@ namespace EveryRay_Core
 		const UINT rootParamIndexUav = 1;
 		const UINT rootParamIndexConstant = 2;
 
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		UINT srcWidth = aTexture->GetWidth();
 		UINT srcHeight = aTexture->GetHeight();
@@ -822,7 +1235,7 @@ namespace EveryRay_Core
 		UINT mipCount = (aTexture->GetMips() > 1) ? aTexture->GetMips() : aTexture->GetCalculatedMipCount();
 		assert(mipCount > 1);
 
-		auto cmdList = mCommandListGraphics[mCurrentGraphicsCommandListIndex];
+		auto cmdList = mCommandListGraphics[sCurrentGraphicsCommandListIndex];
 
 		const std::string& psoName = is3D ? mGenerateMips3DPSOName : mGenerateMips2DPSOName;
 		ER_RHI_GPURootSignature* rs = is3D ? mGenerateMips3DRS : mGenerateMips2DRS;
@@ -885,7 +1298,8 @@ namespace EveryRay_Core
 		if ((*aTexture)->GetMips() > 1) //probably the texture already has mips
 			return;
 
-		if (mGenerateMipsWithReplacementCurrentTextureIndexInPool > DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL)
+		const int poolIndex = mGenerateMipsWithReplacementCurrentTextureIndexInPool++; // textures can be loaded from several recording threads
+		if (poolIndex >= DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL)
 			throw ER_CoreException("ER_RHI_DX12:: There is no space left in the temp texture pool for mip generation! Bump DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL.");
 
 		ER_RHI_DX12_GPUTexture* dx12Texture = static_cast<ER_RHI_DX12_GPUTexture*>(*aTexture);
@@ -900,20 +1314,19 @@ namespace EveryRay_Core
 
 		// create new texture with empty mips from the pool
 		std::wstring name = dx12Texture->GetDebugName() + L" + mip maps";
-		assert(!mGenerateMipsWithReplacementReadyTexturesPool[mGenerateMipsWithReplacementCurrentTextureIndexInPool]);
+		assert(!mGenerateMipsWithReplacementReadyTexturesPool[poolIndex]);
 
-		mGenerateMipsWithReplacementReadyTexturesPool[mGenerateMipsWithReplacementCurrentTextureIndexInPool] = CreateGPUTexture(name);
-		static_cast<ER_RHI_DX12_GPUTexture*>(mGenerateMipsWithReplacementReadyTexturesPool[mGenerateMipsWithReplacementCurrentTextureIndexInPool])->CreateSimpleGPUTexture2DResource(this, dx12Texture->GetWidth(), dx12Texture->GetHeight(), newFormat,
+		mGenerateMipsWithReplacementReadyTexturesPool[poolIndex] = CreateGPUTexture(name);
+		static_cast<ER_RHI_DX12_GPUTexture*>(mGenerateMipsWithReplacementReadyTexturesPool[poolIndex])->CreateSimpleGPUTexture2DResource(this, dx12Texture->GetWidth(), dx12Texture->GetHeight(), newFormat,
 			ER_RHI_BIND_FLAG::ER_BIND_SHADER_RESOURCE | ER_RHI_BIND_FLAG::ER_BIND_UNORDERED_ACCESS, dx12Texture->GetCalculatedMipCount());
 
 		// copy from main texture to 0 mip of new texture (if srgb, then the shader will write into mip 0)
 		if (!isSRGB)
-			CopyGPUTextureSubresourceRegion(mGenerateMipsWithReplacementReadyTexturesPool[mGenerateMipsWithReplacementCurrentTextureIndexInPool], 0, 0, 0, 0, *aTexture, 0);
+			CopyGPUTextureSubresourceRegion(mGenerateMipsWithReplacementReadyTexturesPool[poolIndex], 0, 0, 0, 0, *aTexture, 0);
 		// generate the mip chain in the new texture (read from original texture in the compute shader if sRGB)
-		GenerateMips(mGenerateMipsWithReplacementReadyTexturesPool[mGenerateMipsWithReplacementCurrentTextureIndexInPool], isSRGB ? *aTexture : nullptr);
+		GenerateMips(mGenerateMipsWithReplacementReadyTexturesPool[poolIndex], isSRGB ? *aTexture : nullptr);
 
-		mGenerateMipsWithReplacementCallbacks[mGenerateMipsWithReplacementCurrentTextureIndexInPool] = aReplacementCallback;
-		mGenerateMipsWithReplacementCurrentTextureIndexInPool++;
+		mGenerateMipsWithReplacementCallbacks[poolIndex] = aReplacementCallback;
 		// we delete the original textures and replace them with mipped in ReplaceOriginalTexturesWithMipped() (we can't delete before flushing the gfx queue)
 	}
 
@@ -969,14 +1382,9 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::PresentCompute()
 	{
-		//mCommandListCompute->Close();
-		//
-		//ID3D12CommandList* ppCommandLists[] = { mCommandListCompute };
-		//mCommandQueueCompute->ExecuteCommandLists(1, ppCommandLists);
-
-		//UINT64 fenceValue = mFenceValuesCompute;
-		//mCommandQueueCompute->Signal(mFenceCompute.Get(), fenceValue);
-		//mFenceValuesCompute++;
+		EndComputeCommandList(0);
+		ExecuteCommandLists(0, true);
+		SignalQueueFence(true);
 	}
 
 	bool ER_RHI_DX12::ProjectCubemapToSH(ER_RHI_GPUTexture* aTexture, UINT order, float* resultR, float* resultG, float* resultB)
@@ -997,7 +1405,7 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetRenderTargets(const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget /*= nullptr*/, ER_RHI_GPUTexture* aUAV /*= nullptr*/, int rtvArrayIndex)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		if (!aUAV)
 		{
 			if (rtvArrayIndex > 0)
@@ -1030,13 +1438,13 @@ namespace EveryRay_Core
 
 				resources.push_back(static_cast<ER_RHI_GPUResource*>(aDepthTarget));
 				transitions.push_back(ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_DEPTH_WRITE);
-				TransitionResources(resources, transitions);
-				mCommandListGraphics[mCurrentGraphicsCommandListIndex]->OMSetRenderTargets(rtCount, rtvHandles, FALSE, &dsvHandle);
+				TransitionResources(resources, transitions, sCurrentGraphicsCommandListIndex);
+				mCommandListGraphics[sCurrentGraphicsCommandListIndex]->OMSetRenderTargets(rtCount, rtvHandles, FALSE, &dsvHandle);
 			}
 			else
 			{
-				TransitionResources(resources, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_RENDER_TARGET);
-				mCommandListGraphics[mCurrentGraphicsCommandListIndex]->OMSetRenderTargets(rtCount, rtvHandles, FALSE, NULL);
+				TransitionResources(resources, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_RENDER_TARGET, sCurrentGraphicsCommandListIndex);
+				mCommandListGraphics[sCurrentGraphicsCommandListIndex]->OMSetRenderTargets(rtCount, rtvHandles, FALSE, NULL);
 			}
 
 		}
@@ -1049,23 +1457,26 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetDepthTarget(ER_RHI_GPUTexture* aDepthTarget)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		assert(aDepthTarget);
 		D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle = static_cast<ER_RHI_DX12_GPUTexture*>(aDepthTarget)->GetDSVHandle().GetCPUHandle();
-		TransitionResources({ static_cast<ER_RHI_GPUResource*>(aDepthTarget) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_DEPTH_WRITE);
+		TransitionResources({ static_cast<ER_RHI_GPUResource*>(aDepthTarget) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_DEPTH_WRITE, sCurrentGraphicsCommandListIndex);
 
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->OMSetRenderTargets(0, nullptr, FALSE, &dsvHandle);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->OMSetRenderTargets(0, nullptr, FALSE, &dsvHandle);
 	}
 
 	void ER_RHI_DX12::SetRenderTargetFormats(const std::vector<ER_RHI_GPUTexture*>& aRenderTargets, ER_RHI_GPUTexture* aDepthTarget /*= nullptr*/)
 	{
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::COMPUTE)
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::COMPUTE)
 			return;
 
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		if (!context.mBuildingGraphicsPSO)
+			return;
 
-		ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
+		ER_RHI_DX12_GraphicsPSO& pso = *context.mBuildingGraphicsPSO;
 		int rtCount = static_cast<int>(aRenderTargets.size());
 		assert(rtCount <= 8);
 
@@ -1077,25 +1488,28 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetMainRenderTargetFormats()
 	{
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		if (!context.mBuildingGraphicsPSO)
+			return;
 
-		ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
-		pso.SetRenderTargetFormats(1, &mMainRTBufferFormat, mMainDepthBufferFormat);
+		context.mBuildingGraphicsPSO->SetRenderTargetFormats(1, &mMainRTBufferFormat, mMainDepthBufferFormat);
 	}
 
 	void ER_RHI_DX12::SetDepthStencilState(ER_RHI_DEPTH_STENCIL_STATE aDS, UINT stencilRef)
 	{
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
 			return;
 
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
 
 		auto it = mDepthStates.find(aDS);
 		if (it != mDepthStates.end())
 		{
 			mCurrentDS = aDS;
-			ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
-			pso.SetDepthStencilState(it->second);
+			if (context.mBuildingGraphicsPSO)
+				context.mBuildingGraphicsPSO->SetDepthStencilState(it->second);
 		}
 		else
 			throw ER_CoreException("ER_RHI_DX11: DepthStencil state is not found.");
@@ -1103,17 +1517,18 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetBlendState(ER_RHI_BLEND_STATE aBS, const float BlendFactor[4], UINT SampleMask)
 	{
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
 			return;
 
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
 
 		auto it = mBlendStates.find(aBS);
 		if (it != mBlendStates.end())
 		{
 			mCurrentBS = aBS;
-			ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
-			pso.SetBlendState(it->second);
+			if (context.mBuildingGraphicsPSO)
+				context.mBuildingGraphicsPSO->SetBlendState(it->second);
 		}
 		else
 			throw ER_CoreException("ER_RHI_DX11: Blend state is not found.");
@@ -1121,17 +1536,18 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetRasterizerState(ER_RHI_RASTERIZER_STATE aRS)
 	{
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
 			return;
 
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
 
 		auto it = mRasterizerStates.find(aRS);
 		if (it != mRasterizerStates.end())
 		{
 			mCurrentRS = aRS;
-			ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
-			pso.SetRasterizerState(it->second);
+			if (context.mBuildingGraphicsPSO)
+				context.mBuildingGraphicsPSO->SetRasterizerState(it->second);
 		}
 		else
 			throw ER_CoreException("ER_RHI_DX11: Rasterizer state is not found.");
@@ -1148,25 +1564,26 @@ namespace EveryRay_Core
 		viewport.MaxDepth = aViewport.MaxDepth;
 
 		mCurrentViewport = aViewport;
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->RSSetViewports(1, &viewport);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->RSSetViewports(1, &viewport);
 	}
 
 	void ER_RHI_DX12::SetRect(const ER_RHI_Rect& rect)
 	{
 		mCurrentRect = rect;
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		D3D12_RECT currentRect = { rect.left, rect.top, rect.right, rect.bottom };
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->RSSetScissorRects(1, &currentRect);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->RSSetScissorRects(1, &currentRect);
 	}
 
 	void ER_RHI_DX12::SetShader(ER_RHI_GPUShader* aShader)
 	{
 		assert(aShader);
 
-		assert(mCurrentPSOState != ER_RHI_DX12_PSO_STATE::UNSET);
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		assert(context.mCurrentPSOState != ER_RHI_DX12_PSO_STATE::UNSET);
 
 		ER_RHI_DX12_GPUShader* aDX12_Shader = static_cast<ER_RHI_DX12_GPUShader*>(aShader);
 		assert(aDX12_Shader);
@@ -1174,9 +1591,11 @@ namespace EveryRay_Core
 		ID3DBlob* blob = static_cast<ID3DBlob*>(aDX12_Shader->GetShaderObject());
 		assert(blob);
 
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS)
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS)
 		{
-			ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
+			if (!context.mBuildingGraphicsPSO)
+				return;
+			ER_RHI_DX12_GraphicsPSO& pso = *context.mBuildingGraphicsPSO;
 
 			switch (aShader->mShaderType)
 			{
@@ -1197,11 +1616,8 @@ namespace EveryRay_Core
 				break;
 			}
 		}
-		else
-		{
-			ER_RHI_DX12_ComputePSO& pso = mComputePSONames.at(mCurrentComputePSOName);
-			pso.SetComputeShader(blob->GetBufferPointer(), blob->GetBufferSize());
-		}
+		else if (context.mBuildingComputePSO)
+			context.mBuildingComputePSO->SetComputeShader(blob->GetBufferPointer(), blob->GetBufferSize());
 	}
 
 	void ER_RHI_DX12::SetShaderResources(ER_RHI_SHADER_TYPE aShaderType, const std::vector<ER_RHI_GPUResource*>& aSRVs, UINT startSlot /*= 0*/,
@@ -1213,10 +1629,10 @@ namespace EveryRay_Core
 		assert(srvCount > 0 && srvCount <= DX12_MAX_BOUND_SHADER_RESOURCE_VIEWS);
 		//assert(srvCount <= rs->GetRootParameterSRVCount(rootParamIndex));
 		assert(mDescriptorHeapManager);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		ER_RHI_DX12_GPUDescriptorHeap* gpuDescriptorHeap = mDescriptorHeapManager->GetGPUHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-		ER_RHI_DX12_DescriptorHandle& srvHandle = gpuDescriptorHeap->GetHandleBlock(srvCount);
+		ER_RHI_DX12_DescriptorHandle srvHandle = AllocateGPUDescriptors(srvCount);
 		for (int i = 0; i < srvCount; i++)
 		{
 			if (aSRVs[i])
@@ -1232,14 +1648,17 @@ namespace EveryRay_Core
 		}
 
 		if (!skipAutomaticTransition)
-			TransitionResources(aSRVs, aShaderType == ER_RHI_SHADER_TYPE::ER_PIXEL ? ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE : ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, mCurrentGraphicsCommandListIndex);
+		{
+			if (isComputeRS && mCurrentComputeCommandListIndex > -1)
+				TransitionResourcesOnComputeCommandList(aSRVs, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			else
+				TransitionResources(aSRVs, aShaderType == ER_RHI_SHADER_TYPE::ER_PIXEL ? ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE : ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, sCurrentGraphicsCommandListIndex);
+		}
 
 		if (!isComputeRS)
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, srvHandle.GetGPUHandle());
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, srvHandle.GetGPUHandle());
 		else
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetComputeRootDescriptorTable(rootParamIndex, srvHandle.GetGPUHandle());
-
-		//TODO compute queue
+			GetComputeWorkCommandList()->SetComputeRootDescriptorTable(rootParamIndex, srvHandle.GetGPUHandle());
 	}
 
 	void ER_RHI_DX12::SetUnorderedAccessResources(ER_RHI_SHADER_TYPE aShaderType, const std::vector<ER_RHI_GPUResource*>& aUAVs, UINT startSlot /*= 0*/,
@@ -1251,10 +1670,10 @@ namespace EveryRay_Core
 		assert(uavCount > 0 && uavCount <= DX12_MAX_BOUND_UNORDERED_ACCESS_VIEWS);
 		//assert(uavCount <= rs->GetRootParameterUAVCount(rootParamIndex));
 		assert(mDescriptorHeapManager);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		ER_RHI_DX12_GPUDescriptorHeap* gpuDescriptorHeap = mDescriptorHeapManager->GetGPUHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-		ER_RHI_DX12_DescriptorHandle& uavHandle = gpuDescriptorHeap->GetHandleBlock(uavCount);
+		ER_RHI_DX12_DescriptorHandle uavHandle = AllocateGPUDescriptors(uavCount);
 		for (int i = 0; i < uavCount; i++)
 		{
 			assert(aUAVs[i]);
@@ -1265,14 +1684,17 @@ namespace EveryRay_Core
 		}
 
 		if (!skipAutomaticTransition)
-			TransitionResources(aUAVs, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS, mCurrentGraphicsCommandListIndex);
+		{
+			if (isComputeRS && mCurrentComputeCommandListIndex > -1)
+				TransitionResourcesOnComputeCommandList(aUAVs, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS);
+			else
+				TransitionResources(aUAVs, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_UNORDERED_ACCESS, sCurrentGraphicsCommandListIndex);
+		}
 
 		if (!isComputeRS)
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, uavHandle.GetGPUHandle());
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, uavHandle.GetGPUHandle());
 		else
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetComputeRootDescriptorTable(rootParamIndex, uavHandle.GetGPUHandle());
-
-		//TODO compute queue
+			GetComputeWorkCommandList()->SetComputeRootDescriptorTable(rootParamIndex, uavHandle.GetGPUHandle());
 	}
 
 	void ER_RHI_DX12::SetConstantBuffers(ER_RHI_SHADER_TYPE aShaderType, const std::vector<ER_RHI_GPUBuffer*>& aCBs, UINT startSlot /*= 0*/,
@@ -1284,10 +1706,10 @@ namespace EveryRay_Core
 		assert(cbvCount > 0 && cbvCount <= DX12_MAX_BOUND_CONSTANT_BUFFERS);
 		//assert(cbvCount <= rs->GetRootParameterCBVCount(rootParamIndex));
 		assert(mDescriptorHeapManager);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		ER_RHI_DX12_GPUDescriptorHeap* gpuDescriptorHeap = mDescriptorHeapManager->GetGPUHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-		ER_RHI_DX12_DescriptorHandle& cbvHandle = gpuDescriptorHeap->GetHandleBlock(cbvCount);
+		ER_RHI_DX12_DescriptorHandle cbvHandle = AllocateGPUDescriptors(cbvCount);
 		for (int i = 0; i < cbvCount; i++)
 		{
 			assert(aCBs[i]);
@@ -1295,11 +1717,9 @@ namespace EveryRay_Core
 		}
 
 		if (!isComputeRS)
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, cbvHandle.GetGPUHandle());
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetGraphicsRootDescriptorTable(rootParamIndex, cbvHandle.GetGPUHandle());
 		else
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetComputeRootDescriptorTable(rootParamIndex, cbvHandle.GetGPUHandle());
-
-		//TODO compute queue
+			GetComputeWorkCommandList()->SetComputeRootDescriptorTable(rootParamIndex, cbvHandle.GetGPUHandle());
 	}
 
 	void ER_RHI_DX12::SetSamplers(ER_RHI_SHADER_TYPE aShaderType, const std::vector<ER_RHI_SAMPLER_STATE>& aSamplers, UINT startSlot /*= 0*/, ER_RHI_GPURootSignature* rs)
@@ -1312,11 +1732,12 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetInputLayout(ER_RHI_InputLayout* aIL)
 	{
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
 		assert(aIL);
 
-		ER_RHI_DX12_GraphicsPSO& pso = mGraphicsPSONames.at(mCurrentGraphicsPSOName);
-		pso.SetInputLayout(this, aIL->mInputElementDescriptionCount, aIL->mInputElementDescriptions);
+		if (context.mBuildingGraphicsPSO)
+			context.mBuildingGraphicsPSO->SetInputLayout(this, aIL->mInputElementDescriptionCount, aIL->mInputElementDescriptions);
 	}
 
 	void ER_RHI_DX12::SetEmptyInputLayout()
@@ -1326,19 +1747,19 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::SetIndexBuffer(ER_RHI_GPUBuffer* aBuffer, UINT offset /*= 0*/)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		assert(aBuffer);
 		ER_RHI_DX12_GPUBuffer* buf = static_cast<ER_RHI_DX12_GPUBuffer*>(aBuffer);
 		assert(buf);
 
 		D3D12_INDEX_BUFFER_VIEW view = buf->GetIndexBufferView();
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->IASetIndexBuffer(&view);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->IASetIndexBuffer(&view);
 	}
 
 	void ER_RHI_DX12::SetVertexBuffers(const std::vector<ER_RHI_GPUBuffer*>& aVertexBuffers)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		assert(aVertexBuffers.size() > 0 && aVertexBuffers.size() <= ER_RHI_MAX_BOUND_VERTEX_BUFFERS);
 		if (aVertexBuffers.size() == 1)
@@ -1349,7 +1770,7 @@ namespace EveryRay_Core
 			assert(buffer);
 
 			D3D12_VERTEX_BUFFER_VIEW view = buffer->GetVertexBufferView();
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->IASetVertexBuffers(0, 1, &view);
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->IASetVertexBuffers(0, 1, &view);
 		}
 		else //+ instance buffer
 		{
@@ -1364,46 +1785,46 @@ namespace EveryRay_Core
 			assert(instanceBuffer);
 
 			D3D12_VERTEX_BUFFER_VIEW views[2] = { vertexBuffer->GetVertexBufferView(), instanceBuffer->GetVertexBufferView() };
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->IASetVertexBuffers(0, 2, views);
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->IASetVertexBuffers(0, 2, views);
 		}
 	}
 
 	void ER_RHI_DX12::SetTopologyType(ER_RHI_PRIMITIVE_TYPE aType)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->IASetPrimitiveTopology(GetTopology(aType));
+		assert(sCurrentGraphicsCommandListIndex > -1);
+		const D3D12_PRIMITIVE_TOPOLOGY topology = GetTopology(aType);
+		mGraphicsCommandListContexts[sCurrentGraphicsCommandListIndex].mCurrentTopology = topology;
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->IASetPrimitiveTopology(topology);
 	}
 
 	void ER_RHI_DX12::SetRootSignature(ER_RHI_GPURootSignature* rs, bool isCompute)
 	{
 		assert(rs);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 		if (!isCompute)
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetGraphicsRootSignature(static_cast<ER_RHI_DX12_GPURootSignature*>(rs)->GetSignature());
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetGraphicsRootSignature(static_cast<ER_RHI_DX12_GPURootSignature*>(rs)->GetSignature());
 		else
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetComputeRootSignature(static_cast<ER_RHI_DX12_GPURootSignature*>(rs)->GetSignature());
-
-		//TODO compute queue
+			GetComputeWorkCommandList()->SetComputeRootSignature(static_cast<ER_RHI_DX12_GPURootSignature*>(rs)->GetSignature());
 	}
 
 	void ER_RHI_DX12::SetRootConstant(UINT aConstant, UINT aRootIndex, UINT anOffset, bool isCompute)
 	{
 		if (!isCompute)
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetGraphicsRoot32BitConstant(aRootIndex, aConstant, anOffset);
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetGraphicsRoot32BitConstant(aRootIndex, aConstant, anOffset);
 		else
-			mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetComputeRoot32BitConstant(aRootIndex, aConstant, anOffset);
-
-		//TODO compute queue
+			GetComputeWorkCommandList()->SetComputeRoot32BitConstant(aRootIndex, aConstant, anOffset);
 	}
 
 	void ER_RHI_DX12::SetTopologyTypeToPSO(const std::string& aName, ER_RHI_PRIMITIVE_TYPE aType)
 	{
-		if (mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		if (context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::UNSET)
 			return;
 
-		assert(mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
-		assert(mCurrentGraphicsPSOName == aName);
-		mGraphicsPSONames.at(aName).SetPrimitiveTopologyType(GetTopologyType(aType));
+		assert(context.mCurrentPSOState == ER_RHI_DX12_PSO_STATE::GRAPHICS);
+		assert(context.mCurrentGraphicsPSOName == aName);
+		if (context.mBuildingGraphicsPSO)
+			context.mBuildingGraphicsPSO->SetPrimitiveTopologyType(GetTopologyType(aType));
 	}
 
 	ER_RHI_PRIMITIVE_TYPE ER_RHI_DX12::GetCurrentTopologyType()
@@ -1415,14 +1836,14 @@ namespace EveryRay_Core
 	void ER_RHI_DX12::SetGPUDescriptorHeap(ER_RHI_DESCRIPTOR_HEAP_TYPE aType, bool aReset)
 	{
 		assert(mDescriptorHeapManager);
-		assert(mCurrentGraphicsCommandListIndex > -1);
+		assert(sCurrentGraphicsCommandListIndex > -1);
 
 		ER_RHI_DX12_GPUDescriptorHeap* gpuDescriptorHeap = mDescriptorHeapManager->GetGPUHeap(GetHeapType(aType));
 		if (aReset)
 			gpuDescriptorHeap->Reset();
 
 		ID3D12DescriptorHeap* ppHeaps[] = { gpuDescriptorHeap->GetHeap() };
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 	}
 
 	void ER_RHI_DX12::SetGPUDescriptorHeapImGui(int cmdListIndex)
@@ -1433,6 +1854,7 @@ namespace EveryRay_Core
 
 	bool ER_RHI_DX12::IsPSOReady(const std::string& aName, bool isCompute)
 	{
+		std::lock_guard<std::mutex> lock(mPSONamesMutex);
 		if (!isCompute)
 		{
 			auto it = mGraphicsPSONames.find(aName);
@@ -1453,17 +1875,21 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::InitializePSO(const std::string& aName, bool isCompute)
 	{
+		// the PSO is built in the current command list's context and only added to the RHI's PSOs on FinalizePSO()
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
 		if (isCompute)
 		{
-			mComputePSONames.insert(std::make_pair(aName, ER_RHI_DX12_ComputePSO(aName)));
-			mCurrentComputePSOName = aName;
-			mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
+			DeleteObject(context.mBuildingComputePSO);
+			context.mBuildingComputePSO = new ER_RHI_DX12_ComputePSO(aName);
+			context.mCurrentComputePSOName = aName;
+			context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
 		}
 		else
 		{
-			mGraphicsPSONames.insert(std::make_pair(aName, ER_RHI_DX12_GraphicsPSO(aName)));
-			mCurrentGraphicsPSOName = aName;
-			mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
+			DeleteObject(context.mBuildingGraphicsPSO);
+			context.mBuildingGraphicsPSO = new ER_RHI_DX12_GraphicsPSO(aName);
+			context.mCurrentGraphicsPSOName = aName;
+			context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
 			SetRasterizerState(ER_RHI_RASTERIZER_STATE::ER_BACK_CULLING); // set default RS to all gfx PSO on init
 		}
 	}
@@ -1474,91 +1900,119 @@ namespace EveryRay_Core
 		ER_RHI_DX12_GPURootSignature* rsDX12 = static_cast<ER_RHI_DX12_GPURootSignature*>(rs);
 		assert(rsDX12);
 
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
 		if (!isCompute)
 		{
-			assert(mCurrentGraphicsPSOName == aName);
-			mGraphicsPSONames.at(aName).SetRootSignature(*rsDX12);
+			assert(context.mCurrentGraphicsPSOName == aName && context.mBuildingGraphicsPSO);
+			context.mBuildingGraphicsPSO->SetRootSignature(*rsDX12);
 		}
 		else
 		{
-			assert(mCurrentComputePSOName == aName);
-			mComputePSONames.at(aName).SetRootSignature(*rsDX12);
+			assert(context.mCurrentComputePSOName == aName && context.mBuildingComputePSO);
+			context.mBuildingComputePSO->SetRootSignature(*rsDX12);
 		}
 	}
 
 	void ER_RHI_DX12::FinalizePSO(const std::string& aName, bool isCompute /*= false*/)
 	{
+		// several threads can build the same PSO at once: the first finalized one is kept
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
 		if (!isCompute)
 		{
-			assert(mCurrentGraphicsPSOName == aName);
-			mGraphicsPSONames.at(aName).Finalize(mDevice.Get());
+			assert(context.mCurrentGraphicsPSOName == aName && context.mBuildingGraphicsPSO);
+			context.mBuildingGraphicsPSO->Finalize(mDevice.Get());
+			{
+				std::lock_guard<std::mutex> lock(mPSONamesMutex);
+				if (mGraphicsPSONames.find(aName) == mGraphicsPSONames.end())
+					mGraphicsPSONames.insert(std::make_pair(aName, *context.mBuildingGraphicsPSO));
+			}
+			DeleteObject(context.mBuildingGraphicsPSO);
 		}
 		else
 		{
-			assert(mCurrentComputePSOName == aName);
-			mComputePSONames.at(aName).Finalize(mDevice.Get());
+			assert(context.mCurrentComputePSOName == aName && context.mBuildingComputePSO);
+			context.mBuildingComputePSO->Finalize(mDevice.Get());
+			{
+				std::lock_guard<std::mutex> lock(mPSONamesMutex);
+				if (mComputePSONames.find(aName) == mComputePSONames.end())
+					mComputePSONames.insert(std::make_pair(aName, *context.mBuildingComputePSO));
+			}
+			DeleteObject(context.mBuildingComputePSO);
 		}
 	}
 
 	void ER_RHI_DX12::SetPSO(const std::string& aName, bool isCompute)
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
-		auto resetPSO = [&](const std::string& name, bool comp)
+		assert(sCurrentGraphicsCommandListIndex > -1);
+		auto logMissingPSO = [&]()
 		{
-			std::wstring msg = L"[ER Logger][ER_RHI_DX12] Could not find PSO to set, adding it now and trying to reset: " + ER_Utility::ToWideString(aName) + L'\n';
+			std::wstring msg = L"[ER Logger][ER_RHI_DX12] Could not find PSO to set (it has to be finalized first): " + ER_Utility::ToWideString(aName) + L'\n';
 			ER_OUTPUT_LOG(msg.c_str());
-			InitializePSO(name, comp);
-			SetPSO(name, comp);
 		};
 
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
 		if (!isCompute)
 		{
-			auto it = mGraphicsPSONames.find(aName);
-			if (it != mGraphicsPSONames.end())
+			if (context.mCurrentGraphicsPSOName == aName && context.mCurrentSetGraphicsPSOName == aName)
 			{
-				if (mCurrentGraphicsPSOName == aName && mCurrentSetGraphicsPSOName == aName)
-				{
-					mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
-					return;
-				}
-				else
-				{
-					mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetPipelineState(it->second.GetPipelineStateObject());
-					mCurrentGraphicsPSOName = it->first;
-					mCurrentSetGraphicsPSOName = mCurrentGraphicsPSOName;
-					mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
-				}
+				context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
+				return;
 			}
-			else
-				resetPSO(aName, isCompute);
+
+			ID3D12PipelineState* pipelineState = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mPSONamesMutex);
+				auto it = mGraphicsPSONames.find(aName);
+				if (it != mGraphicsPSONames.end())
+					pipelineState = it->second.GetPipelineStateObject();
+			}
+			if (!pipelineState)
+			{
+				logMissingPSO();
+				return;
+			}
+
+			mCommandListGraphics[sCurrentGraphicsCommandListIndex]->SetPipelineState(pipelineState);
+			context.mCurrentGraphicsPSOName = aName;
+			context.mCurrentSetGraphicsPSOName = aName;
+			context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::GRAPHICS;
 		}
 		else
 		{
-			auto it = mComputePSONames.find(aName);
-			if (it != mComputePSONames.end())
+			// the set compute PSO belongs to the list it is set on
+			ER_RHI_DX12_CommandListContext& setContext = (mCurrentComputeCommandListIndex > -1) ? mComputeCommandListContexts[mCurrentComputeCommandListIndex] : context;
+			if (context.mCurrentComputePSOName == aName && setContext.mCurrentSetComputePSOName == aName)
 			{
-				if (mCurrentComputePSOName == aName && mCurrentSetComputePSOName == aName)
-				{
-					mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
-					return;
-				}
-				{
-					mCommandListGraphics[mCurrentGraphicsCommandListIndex]->SetPipelineState(it->second.GetPipelineStateObject());
-					mCurrentComputePSOName = it->first;
-					mCurrentSetComputePSOName = mCurrentComputePSOName;
-					mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
-				}
+				context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
+				return;
 			}
-			else
-				resetPSO(aName, isCompute);
+
+			ID3D12PipelineState* pipelineState = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mPSONamesMutex);
+				auto it = mComputePSONames.find(aName);
+				if (it != mComputePSONames.end())
+					pipelineState = it->second.GetPipelineStateObject();
+			}
+			if (!pipelineState)
+			{
+				logMissingPSO();
+				return;
+			}
+
+			GetComputeWorkCommandList()->SetPipelineState(pipelineState);
+			context.mCurrentComputePSOName = aName;
+			setContext.mCurrentSetComputePSOName = aName;
+			context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::COMPUTE;
 		}
 	}
 
 	void ER_RHI_DX12::UnsetPSO()
 	{
-		mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
-		mCurrentSetGraphicsPSOName = "";
-		mCurrentSetComputePSOName = "";
+		ER_RHI_DX12_CommandListContext& context = GetCurrentContext();
+		context.mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		context.mCurrentSetGraphicsPSOName = "";
+		context.mCurrentSetComputePSOName = "";
 	}
 
 	void ER_RHI_DX12::TransitionResources(const std::vector<ER_RHI_GPUResource*>& aResources, const std::vector<ER_RHI_RESOURCE_STATE>& aStates, int cmdListIndex, bool isCopyQueue, int subresourceIndex)
@@ -1631,8 +2085,8 @@ namespace EveryRay_Core
 
 	void ER_RHI_DX12::UnbindRenderTargets()
 	{
-		assert(mCurrentGraphicsCommandListIndex > -1);
-		mCommandListGraphics[mCurrentGraphicsCommandListIndex]->OMSetRenderTargets(0, nullptr, false, nullptr);
+		assert(sCurrentGraphicsCommandListIndex > -1);
+		mCommandListGraphics[sCurrentGraphicsCommandListIndex]->OMSetRenderTargets(0, nullptr, false, nullptr);
 	}
 
 	void ER_RHI_DX12::UpdateBuffer(ER_RHI_GPUBuffer* aBuffer, void* aData, int dataSize, bool updateForAllBackBuffers)
@@ -1645,6 +2099,15 @@ namespace EveryRay_Core
 		buffer->Update(this, aData, dataSize, updateForAllBackBuffers);
 	}
 
+	void ER_RHI_DX12::UpdateBufferRegions(ER_RHI_GPUBuffer* aBuffer, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount)
+	{
+		ER_RHI_DX12_GPUBuffer* buffer = static_cast<ER_RHI_DX12_GPUBuffer*>(aBuffer);
+		assert(buffer && aData);
+
+		if (aRegionsCount > 0)
+			buffer->UpdateSubresourceRegions(this, aData, aRegions, aRegionsCount, GetCurrentGraphicsCommandListIndex());
+	}
+
 	void ER_RHI_DX12::InitImGui()
 	{
 		D3D12_DESCRIPTOR_HEAP_DESC desc = {};
@@ -10,6 +10,7 @@
 #include <dxgidebug.h>
 #endif
 #include <d3dcompiler.h>
+#include <atomic>
 
 #include "imgui_impl_dx12.h"
 
@@ -22,6 +23,7 @@
 #define DX12_MAX_BACK_BUFFER_COUNT 2
 
 #define DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL 2048 // max # of textures pending for GenerateMipsWithTextureReplacement();
+#define DX12_GPU_DESCRIPTOR_RANGE_SIZE 256 // descriptors that a command list takes from the shader visible heap at once (and allocates its tables from)
 
 namespace EveryRay_Core
 {
@@ -37,6 +39,30 @@ namespace EveryRay_Core
 	class ER_RHI_DX12_GPURootSignature;
 	class ER_RHI_DX12_GPUDescriptorHeapManager;
 	class ER_RHI_DX12_DescriptorHandle;
+	class ER_RHI_DX12_GPUDescriptorHeap;
+	class ER_WorkerPool;
+
+	// Recording state of a graphics command list: only one thread records into a command list, so PSOs being built, the PSO set to the list
+	// and the descriptor range live here (and not in the RHI) to let several threads record at the same time
+	struct ER_RHI_DX12_CommandListContext
+	{
+		std::string mCurrentGraphicsPSOName;
+		std::string mCurrentComputePSOName;
+		std::string mCurrentSetGraphicsPSOName; //which was set to command list already
+		std::string mCurrentSetComputePSOName; //which was set to command list already
+		ER_RHI_DX12_PSO_STATE mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		D3D12_PRIMITIVE_TOPOLOGY mCurrentTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
+		// between InitializePSO() and FinalizePSO(), added to the RHI's PSOs when finalized
+		ER_RHI_DX12_GraphicsPSO* mBuildingGraphicsPSO = nullptr;
+		ER_RHI_DX12_ComputePSO* mBuildingComputePSO = nullptr;
+
+		ER_RHI_DX12_GPUDescriptorHeap* mDescriptorRangeHeap = nullptr;
+		UINT mDescriptorRangeResetCount = 0;
+		UINT mDescriptorRangeStart = 0;
+		UINT mDescriptorRangeSize = 0;
+		UINT mDescriptorRangeUsed = 0;
+	};
 
 	class ER_RHI_DX12: public ER_RHI
 	{
@@ -49,8 +75,8 @@ namespace EveryRay_Core
 		virtual void BeginGraphicsCommandList(int index = 0) override;
 		virtual void EndGraphicsCommandList(int index = 0) override;
 
-		virtual void BeginComputeCommandList(int index = 0) override {}; //TODO
-		virtual void EndComputeCommandList(int index = 0) override {}; //TODO
+		virtual void BeginComputeCommandList(int index = 0) override;
+		virtual void EndComputeCommandList(int index = 0) override;
 
 		virtual void BeginCopyCommandList(int index = 0) override;
 		virtual void EndCopyCommandList(int index = 0) override;
@@ -84,13 +110,22 @@ namespace EveryRay_Core
 		virtual void DrawIndexed(UINT IndexCount) override;
 		virtual void DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override;
 		virtual void DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override;
-		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) override;
+		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset, UINT aDrawCount = 1, ER_RHI_GPUBuffer* aCountBuffer = nullptr, UINT aCountBufferOffset = 0) override;
+		virtual bool IsIndirectCountSupported() override { return true; }
 
 		virtual void Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override;
-		//TODO DispatchIndirect
+		virtual void DispatchIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) override;
 
 		virtual void ExecuteCommandLists(int commandListIndex = 0, bool isCompute = false) override;
 		virtual void ExecuteCopyCommandList() override;
+		virtual void RecordParallelGraphicsCommandLists(const std::vector<std::function<void(int)>>& aTasks) override;
+		virtual int GetMaxParallelGraphicsCommandListsCount() override { return ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS; }
+		virtual int GetCurrentGraphicsCommandListIndex() override;
+
+		virtual bool IsAsyncComputeSupported() override { return true; }
+		virtual UINT64 SignalQueueFence(bool isComputeQueue) override;
+		virtual void WaitForQueueFence(bool isComputeQueue, UINT64 aFenceValue) override;
+		virtual void ReleaseResourcesToQueue(const std::vector<ER_RHI_GPUResource*>& aResources, ER_RHI_RESOURCE_STATE aState, bool isFromComputeQueue) override;
 
 		virtual void GenerateMips(ER_RHI_GPUTexture* aTexture, ER_RHI_GPUTexture* aSRGBTexture = nullptr) override;
 		virtual void GenerateMipsWithTextureReplacement(ER_RHI_GPUTexture** aTexture, std::function<void(ER_RHI_GPUTexture**)> aReplacementCallback) override;
@@ -159,6 +194,7 @@ namespace EveryRay_Core
 		virtual void UnbindResourcesFromShader(ER_RHI_SHADER_TYPE aShaderType, bool unbindShader = true) override {}; //Not needed on DX12
 
 		virtual void UpdateBuffer(ER_RHI_GPUBuffer* aBuffer, void* aData, int dataSize, bool updateForAllBackBuffers = false) override;
+		virtual void UpdateBufferRegions(ER_RHI_GPUBuffer* aBuffer, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount) override;
 		
 		virtual bool IsHardwareRaytracingSupported() override { return mIsRaytracingTierAvailable; }
 		virtual bool IsRootConstantSupported()  override { return true; }
@@ -210,6 +246,15 @@ namespace EveryRay_Core
 		DXGI_FORMAT ChangeFormatToUncompressed(DXGI_FORMAT aFormat);
 		bool IsFormatSRGB(DXGI_FORMAT aFormat);
 
+		ER_RHI_DX12_CommandListContext& GetCurrentContext();
+		ER_RHI_DX12_DescriptorHandle AllocateGPUDescriptors(UINT aCount); // from the current command list's range
+		void SetViewportAndRect(int aCommandListIndex, const ER_RHI_Viewport& aViewport, const ER_RHI_Rect& aRect);
+		void ReopenGraphicsCommandList(int aCommandListIndex); // after its commands were submitted (the allocator is not reset)
+
+		ID3D12GraphicsCommandList* GetComputeWorkCommandList(); // the compute list while one is recorded, otherwise the current graphics list
+		void TransitionResourcesOnComputeCommandList(const std::vector<ER_RHI_GPUResource*>& aResources, ER_RHI_RESOURCE_STATE aState);
+		bool IsComputeQueueState(ER_RHI_RESOURCE_STATE aState);
+
 		void CreateMainRenderTargetAndDepth(int width, int height);
 		void CreateSamplerStates();
 		void CreateBlendStates();
@@ -241,6 +286,14 @@ namespace EveryRay_Core
 		ComPtr<ID3D12Fence> mFenceGraphics;
 		UINT64 mFenceValuesGraphics[DX12_MAX_BACK_BUFFER_COUNT] = {};
 		Wrappers::Event mFenceEventGraphics;
+
+		// signaled after every submission of parallel lists (see RecordParallelGraphicsCommandLists()), so that a parallel list
+		// which is recorded several times in a frame does not reset its allocator while its previous commands are in flight
+		ComPtr<ID3D12Fence> mFenceParallelGraphics;
+		UINT64 mFenceValuesParallelGraphics = 0;
+		UINT64 mParallelGraphicsCommandListsFenceValues[DX12_MAX_BACK_BUFFER_COUNT][ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS] = {};
+		Wrappers::Event mFenceEventParallelGraphics;
+		ER_WorkerPool* mParallelRecordingPool = nullptr; // records the parallel lists
 		
 		// compute
 		ComPtr<ID3D12CommandQueue> mCommandQueueCompute;
@@ -248,8 +301,12 @@ namespace EveryRay_Core
 		ComPtr<ID3D12CommandAllocator> mCommandAllocatorsCompute[DX12_MAX_BACK_BUFFER_COUNT][ER_RHI_MAX_COMPUTE_COMMAND_LISTS];
 
 		ComPtr<ID3D12Fence> mFenceCompute;
-		UINT64 mFenceValuesCompute;
+		UINT64 mFenceValuesCompute = 0;
 		Wrappers::Event mFenceEventCompute;
+
+		ComPtr<ID3D12Fence> mFenceGraphicsForCompute; // signaled by the graphics queue for the compute queue (the main graphics fence paces the frames)
+		UINT64 mFenceValuesGraphicsForCompute = 0;
+		ER_RHI_DX12_CommandListContext mComputeCommandListContexts[ER_RHI_MAX_COMPUTE_COMMAND_LISTS];
 		
 		// copy
 		ComPtr<ID3D12CommandQueue> mCommandQueueCopy;
@@ -267,15 +324,13 @@ namespace EveryRay_Core
 
 		std::map<std::string, ER_RHI_DX12_GraphicsPSO> mGraphicsPSONames;
 		std::map<std::string, ER_RHI_DX12_ComputePSO> mComputePSONames;
-		std::string mCurrentGraphicsPSOName;
-		std::string mCurrentComputePSOName;
-		std::string mCurrentSetGraphicsPSOName; //which was set to command list already
-		std::string mCurrentSetComputePSOName; //which was set to command list already
-		ER_RHI_DX12_PSO_STATE mCurrentPSOState = ER_RHI_DX12_PSO_STATE::UNSET;
+		std::mutex mPSONamesMutex; // PSOs can be looked up and added from several recording threads
+		ER_RHI_DX12_CommandListContext mGraphicsCommandListContexts[ER_RHI_MAX_GRAPHICS_COMMAND_LISTS];
 
 		ER_RHI_DX12_GPUDescriptorHeapManager* mDescriptorHeapManager = nullptr;
 
 		ComPtr<ID3D12CommandSignature> mCommandSignature_DrawIndexed;
+		ComPtr<ID3D12CommandSignature> mCommandSignature_Dispatch;
 
 		D3D12_SAMPLER_DESC mEmptySampler;
 
@@ -300,6 +355,6 @@ namespace EveryRay_Core
 
 		ER_RHI_GPUTexture* mGenerateMipsWithReplacementReadyTexturesPool[DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL] = { nullptr };
 		std::function<void(ER_RHI_GPUTexture**)> mGenerateMipsWithReplacementCallbacks[DX12_MAX_GENERATE_MIPS_TEXTURES_IN_POOL];
-		int mGenerateMipsWithReplacementCurrentTextureIndexInPool = 0; // should be atomic (in the future), at the moment we do not use multithreading for submitting mip generation commands
+		std::atomic<int> mGenerateMipsWithReplacementCurrentTextureIndexInPool{ 0 }; // textures can be loaded by several recording threads
 	};
 }
\ No newline at end of file
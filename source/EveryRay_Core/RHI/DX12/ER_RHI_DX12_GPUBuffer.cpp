@@ -227,6 +227,40 @@ namespace EveryRay_Core
 			aRHIDX12->TransitionResources({ static_cast<ER_RHI_GPUResource*>(this) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_GENERIC_READ, cmdListIndex);
 	}
 
+	// Regions are written at the same offsets into this frame's upload buffer (so they never overlap) and then copied into the default heap buffer
+	void ER_RHI_DX12_GPUBuffer::UpdateSubresourceRegions(ER_RHI* aRHI, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount, int cmdListIndex)
+	{
+		assert(!mIsDynamic);
+		assert(cmdListIndex != -1);
+		assert(aRHI);
+
+		ER_RHI_DX12* aRHIDX12 = static_cast<ER_RHI_DX12*>(aRHI);
+		ID3D12Resource* uploadBuffer = mBufferUpload[ER_RHI_DX12::mBackBufferIndex].Get();
+		assert(uploadBuffer);
+
+		unsigned char* mappedData = nullptr;
+		CD3DX12_RANGE readRange(0, 0);
+		if (FAILED(uploadBuffer->Map(0, &readRange, reinterpret_cast<void**>(&mappedData))))
+			throw ER_CoreException("ER_RHI_DX12: Failed to map GPU buffer (upload).");
+		for (UINT i = 0; i < aRegionsCount; i++)
+		{
+			assert(mSize >= static_cast<int>(aRegions[i].Offset + aRegions[i].Size));
+			memcpy(mappedData + aRegions[i].Offset, static_cast<const unsigned char*>(aData) + aRegions[i].Offset, aRegions[i].Size);
+		}
+		uploadBuffer->Unmap(0, nullptr);
+
+		aRHIDX12->TransitionResources({ static_cast<ER_RHI_GPUResource*>(this) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_DEST, cmdListIndex);
+		for (UINT i = 0; i < aRegionsCount; i++)
+			aRHIDX12->GetGraphicsCommandList(cmdListIndex)->CopyBufferRegion(mBuffer.Get(), aRegions[i].Offset, uploadBuffer, aRegions[i].Offset, aRegions[i].Size);
+
+		if (mBindFlags & ER_BIND_CONSTANT_BUFFER || mBindFlags & ER_BIND_VERTEX_BUFFER)
+			aRHIDX12->TransitionResources({ static_cast<ER_RHI_GPUResource*>(this) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, cmdListIndex);
+		else if (mBindFlags & ER_BIND_INDEX_BUFFER)
+			aRHIDX12->TransitionResources({ static_cast<ER_RHI_GPUResource*>(this) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_INDEX_BUFFER, cmdListIndex);
+		else
+			aRHIDX12->TransitionResources({ static_cast<ER_RHI_GPUResource*>(this) }, ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_GENERIC_READ, cmdListIndex);
+	}
+
 	void ER_RHI_DX12_GPUBuffer::Update(ER_RHI* aRHI, void* aData, int dataSize, bool updateForAllBackBuffers)
 	{
 		assert(mSize >= dataSize);
@@ -86,34 +86,34 @@ namespace EveryRay_Core
 
 	ER_RHI_DX12_DescriptorHandle ER_RHI_DX12_GPUDescriptorHeap::GetHandleBlock(UINT count)
 	{
-		UINT newHandleID = 0;
-		UINT blockEnd = mCurrentDescriptorIndex + count;
-
-		if (blockEnd < mMaxNumDescriptors)
-		{
-			newHandleID = mCurrentDescriptorIndex;
-			mCurrentDescriptorIndex = blockEnd;
-		}
-		else
+		const UINT newHandleID = mCurrentDescriptorIndex.fetch_add(count);
+		if (newHandleID + count >= mMaxNumDescriptors)
 			throw ER_CoreException("ER_RHI_DX12: Ran out of GPU descriptor heap handles, need to increase heap size");
 
+		return GetHandle(newHandleID);
+	}
+
+	ER_RHI_DX12_DescriptorHandle ER_RHI_DX12_GPUDescriptorHeap::GetHandle(UINT index)
+	{
 		ER_RHI_DX12_DescriptorHandle newHandle;
 		D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = mDescriptorHeapCPUStart;
-		cpuHandle.ptr += newHandleID * mDescriptorSize;
+		cpuHandle.ptr += index * mDescriptorSize;
 		newHandle.SetCPUHandle(cpuHandle);
 
 		D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = mDescriptorHeapGPUStart;
-		gpuHandle.ptr += newHandleID * mDescriptorSize;
+		gpuHandle.ptr += index * mDescriptorSize;
 		newHandle.SetGPUHandle(gpuHandle);
 
-		newHandle.SetHeapIndex(newHandleID);
+		newHandle.SetHeapIndex(index);
 
 		return newHandle;
 	}
 
+	// must not be called while command lists are recorded (ranges allocated from the heap are dropped by their command lists on the next allocation)
 	void ER_RHI_DX12_GPUDescriptorHeap::Reset()
 	{
 		mCurrentDescriptorIndex = 0;
+		mResetCount++;
 	}
 
 	ER_RHI_DX12_GPUDescriptorHeapManager::ER_RHI_DX12_GPUDescriptorHeapManager(ID3D12Device* device)
@@ -148,6 +148,7 @@ namespace EveryRay_Core
 
 	ER_RHI_DX12_DescriptorHandle ER_RHI_DX12_GPUDescriptorHeapManager::CreateCPUHandle(D3D12_DESCRIPTOR_HEAP_TYPE heapType, int frameIndex)
 	{
+		std::lock_guard<std::mutex> lock(mCPUHandlesMutex);
 		return mCPUDescriptorHeaps[frameIndex >= 0 ? frameIndex : ER_RHI_DX12::mBackBufferIndex][heapType]->GetNewHandle();
 	}
 
@@ -88,10 +88,13 @@ namespace EveryRay_Core
 		~ER_RHI_DX12_GPUDescriptorHeap() final {};
 
 		void Reset();
-		ER_RHI_DX12_DescriptorHandle GetHandleBlock(UINT count);
+		ER_RHI_DX12_DescriptorHandle GetHandleBlock(UINT count); // thread-safe (command lists recorded in parallel allocate their ranges from here)
+		ER_RHI_DX12_DescriptorHandle GetHandle(UINT index); // of an already allocated block
+		UINT GetResetCount() { return mResetCount; }
 
 	private:
-		UINT mCurrentDescriptorIndex;
+		std::atomic<UINT> mCurrentDescriptorIndex;
+		UINT mResetCount = 0;
 	};
 
 	class ER_RHI_DX12_GPUDescriptorHeapManager
@@ -109,6 +112,7 @@ namespace EveryRay_Core
 		}
 
 	private:
+		std::mutex mCPUHandlesMutex; // resources can be created while command lists are recorded in parallel
 		ER_RHI_DX12_CPUDescriptorHeap* mCPUDescriptorHeaps[DX12_MAX_BACK_BUFFER_COUNT][D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];
 		ER_RHI_DX12_GPUDescriptorHeap* mGPUDescriptorHeaps[DX12_MAX_BACK_BUFFER_COUNT][D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];
 
@@ -452,6 +452,79 @@ namespace EveryRay_Core
 		}
 	}
 
+	void ER_RHI_DX12_GPUTexture::CreateGPUTextureResource(ER_RHI* aRHI, const ER_RHI_SUBRESOURCE_DATA* aData, UINT mipCount, UINT width, UINT height, ER_RHI_FORMAT format)
+	{
+		assert(aRHI);
+		assert(aData && mipCount > 0);
+		ER_RHI_DX12* aRHIDX12 = static_cast<ER_RHI_DX12*>(aRHI);
+		ID3D12Device* device = aRHIDX12->GetDevice();
+		assert(device);
+
+		ER_RHI_DX12_GPUDescriptorHeapManager* descriptorHeapManager = aRHIDX12->GetDescriptorHeapManager();
+		assert(descriptorHeapManager);
+
+		mIsLoadedFromFile = false;
+		mArraySize = 1;
+		mMipLevels = mipCount;
+		mBindFlags = ER_BIND_SHADER_RESOURCE;
+		mWidth = width;
+		mHeight = height;
+		mDepth = 0;
+		mIsCubemap = false;
+		mIsDepthStencil = false;
+		mRHIFormat = format;
+		mFormat = aRHIDX12->GetFormat(format);
+		mCurrentResourceState = ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_COPY_DEST;
+
+		D3D12_RESOURCE_DESC textureDesc = {};
+		textureDesc.DepthOrArraySize = 1;
+		textureDesc.MipLevels = mipCount;
+		textureDesc.Format = mFormat;
+		textureDesc.Width = width;
+		textureDesc.Height = height;
+		textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.SampleDesc.Quality = 0;
+		textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+
+		if (FAILED(device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&mResource))))
+			throw ER_CoreException("ER_RHI_DX12: Could not create a committed resource for the GPU texture from data");
+
+		// Create the GPU upload buffer and update subresources
+		const UINT64 uploadBufferSize = GetRequiredIntermediateSize(mResource.Get(), 0, mipCount);
+		if (FAILED(device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize), D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mResourceUpload))))
+			throw ER_CoreException("ER_RHI_DX12: Could not create a committed resource for the GPU texture resource (upload)");
+
+		{
+			std::vector<D3D12_SUBRESOURCE_DATA> subresources(mipCount);
+			for (UINT i = 0; i < mipCount; i++)
+			{
+				subresources[i].pData = aData[i].Data;
+				subresources[i].RowPitch = aData[i].RowPitch;
+				subresources[i].SlicePitch = aData[i].SlicePitch;
+			}
+
+			int cmdIndex = aRHIDX12->GetCurrentGraphicsCommandListIndex();
+			auto commandList = aRHIDX12->GetGraphicsCommandList(cmdIndex);
+			UpdateSubresources(commandList, mResource.Get(), mResourceUpload.Get(), 0, 0, mipCount, subresources.data());
+
+			auto barrier = CD3DX12_RESOURCE_BARRIER::Transition(mResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			commandList->ResourceBarrier(1, &barrier);
+
+			mCurrentResourceState = ER_RHI_RESOURCE_STATE::ER_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+		}
+
+		mSRVHandle = descriptorHeapManager->CreateCPUHandle(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = mFormat;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = mipCount;
+		device->CreateShaderResourceView(mResource.Get(), &srvDesc, mSRVHandle.GetCPUHandle());
+
+		mResource->SetName(mDebugName.c_str());
+	}
+
 	void ER_RHI_DX12_GPUTexture::CreateSimpleGPUTexture2DResource(ER_RHI* aRHI, UINT width, UINT height, DXGI_FORMAT format, ER_RHI_BIND_FLAG bindFlags /*= ER_BIND_NONE*/, int mip)
 	{
 		assert(aRHI);
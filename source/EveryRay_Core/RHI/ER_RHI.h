@@ -1,9 +1,12 @@
 #pragma once
 #include "..\Common.h"
 
-#define ER_RHI_MAX_GRAPHICS_COMMAND_LISTS 8
+#define ER_RHI_MAX_GRAPHICS_COMMAND_LISTS 16
+#define ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS 12 // recorded by worker threads (see RecordParallelGraphicsCommandLists())
 #define ER_RHI_MAX_COMPUTE_COMMAND_LISTS 2
 #define ER_RHI_MAX_BOUND_VERTEX_BUFFERS 2 //we only support 1 vertex buffer + 1 instance buffer
+#define ER_RHI_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS_COUNT 5 // IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation
+#define ER_RHI_DISPATCH_INDIRECT_ARGS_COUNT 3 // ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ
 
 namespace EveryRay_Core
 {
@@ -221,6 +224,21 @@ namespace EveryRay_Core
 		UINT InstanceDataStepRate = 0;
 	};
 
+	// Initial data of one subresource (mip) of a texture
+	struct ER_RHI_SUBRESOURCE_DATA
+	{
+		const void* Data;
+		UINT RowPitch;
+		UINT SlicePitch;
+	};
+
+	// Byte range of a buffer
+	struct ER_RHI_BUFFER_REGION
+	{
+		UINT Offset;
+		UINT Size;
+	};
+
 	struct ER_RHI_Viewport
 	{
 		float TopLeftX;
@@ -308,10 +326,13 @@ namespace EveryRay_Core
 		virtual void DrawIndexed(UINT IndexCount) = 0;
 		virtual void DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) = 0;
 		virtual void DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) = 0;
-		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) = 0;
+		// Multi-draw: 'aDrawCount' consecutive args (tightly packed); with a count buffer, the GPU draws min(count, aDrawCount) of them
+		// (if IsIndirectCountSupported(), otherwise all of them - the args past the count must have 0 instances)
+		virtual void DrawIndexedInstancedIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset, UINT aDrawCount = 1, ER_RHI_GPUBuffer* aCountBuffer = nullptr, UINT aCountBufferOffset = 0) = 0;
+		virtual bool IsIndirectCountSupported() { return false; }
 
 		virtual void Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) = 0;
-		//TODO DispatchIndirect
+		virtual void DispatchIndirect(ER_RHI_GPUBuffer* anArgsBuffer, UINT alignedByteOffset) = 0;
 
 		virtual void GenerateMips(ER_RHI_GPUTexture* aTexture, ER_RHI_GPUTexture* aSRGBTexture = nullptr) = 0;
 		virtual void GenerateMipsWithTextureReplacement(ER_RHI_GPUTexture** aTexture, std::function<void(ER_RHI_GPUTexture**)> aReplacementCallback) = 0;
@@ -320,9 +341,24 @@ namespace EveryRay_Core
 		virtual void ExecuteCommandLists(int commandListIndex = 0, bool isCompute = false) = 0;
 		virtual void ExecuteCopyCommandList() = 0;
 
+		// Records the tasks in parallel (one graphics command list per task, the index of the list is passed to the task; threads are persistent).
+		// The lists are executed in the order of the tasks, right after the commands recorded so far into the current command list.
+		// Every list starts with the descriptor heap, viewport and rect of the current list, everything else (render targets, root signature, PSO)
+		// must be set by the task, and again on the current list afterwards. A task must only transition resources that no other task uses
+		// (shared ones are transitioned on the current list before, i.e. DrawIndexedInstancedIndirect() does not transition its args on parallel lists).
+		virtual void RecordParallelGraphicsCommandLists(const std::vector<std::function<void(int)>>& aTasks) = 0;
+		virtual int GetMaxParallelGraphicsCommandListsCount() { return 1; }
+
 		virtual void PresentGraphics() = 0;
 		virtual void PresentCompute() = 0;
 
+		// Async compute: cross-queue GPU synchronization (the default is a single queue - nothing to synchronize)
+		virtual bool IsAsyncComputeSupported() { return false; }
+		virtual UINT64 SignalQueueFence(bool isComputeQueue) { return 0; } // returns the value to wait for on the other queue
+		virtual void WaitForQueueFence(bool isComputeQueue, UINT64 aFenceValue) {} // 'isComputeQueue' waits for the other queue
+		// hands resources over to the other queue in a state both queues support (COMMON, NON_PIXEL_SHADER_RESOURCE, UNORDERED_ACCESS...)
+		virtual void ReleaseResourcesToQueue(const std::vector<ER_RHI_GPUResource*>& aResources, ER_RHI_RESOURCE_STATE aState, bool isFromComputeQueue) {}
+
 		virtual bool ProjectCubemapToSH(ER_RHI_GPUTexture* aTexture, UINT order, float* resultR, float* resultG, float* resultB) = 0; //WARNING: only works on DX11 for now
 
 		virtual void SaveGPUTextureToFile(ER_RHI_GPUTexture* aTexture, const std::wstring& aPathName) = 0; //WARNING: only works on DX11 for now
@@ -388,6 +424,8 @@ namespace EveryRay_Core
 		virtual void UnbindResourcesFromShader(ER_RHI_SHADER_TYPE aShaderType, bool unbindShader = true) = 0;
 
 		virtual void UpdateBuffer(ER_RHI_GPUBuffer* aBuffer, void* aData, int dataSize, bool updateForAllBackBuffers = false) = 0;
+		// Partial update of a non-dynamic buffer: aData is the CPU copy of the whole buffer, only the given regions are copied (in order with the GPU work)
+		virtual void UpdateBufferRegions(ER_RHI_GPUBuffer* aBuffer, const void* aData, const ER_RHI_BUFFER_REGION* aRegions, UINT aRegionsCount) = 0;
 
 		virtual bool IsHardwareRaytracingSupported() = 0;
 		virtual bool IsRootConstantSupported() = 0;
@@ -411,7 +449,7 @@ namespace EveryRay_Core
 		virtual void EndEventTag(bool isComputeQueue = false) = 0;
 
 		inline const int GetPrepareGraphicsCommandListIndex() { return mPrepareGraphicsCommandListIndex; }
-		inline const int GetCurrentGraphicsCommandListIndex() { return mCurrentGraphicsCommandListIndex; }
+		virtual int GetCurrentGraphicsCommandListIndex() { return mCurrentGraphicsCommandListIndex; }
 		inline const int GetCurrentComputeCommandListIndex() { return mCurrentComputeCommandListIndex; }
 
 		ER_GRAPHICS_API GetAPI() { return mAPI; }
@@ -429,6 +467,7 @@ namespace EveryRay_Core
 		ER_RHI_Rect mCurrentRect;
 
 		const int mPrepareGraphicsCommandListIndex = ER_RHI_MAX_GRAPHICS_COMMAND_LISTS - 1; // command list for prepare commands (on init)
+		const int mFirstParallelGraphicsCommandListIndex = 1; // [1, ER_RHI_MAX_PARALLEL_GRAPHICS_COMMAND_LISTS] (0 is the frame's list, the last ones are update/prepare lists)
 		int mCurrentGraphicsCommandListIndex = -1;
 		int mCurrentComputeCommandListIndex = -1;
 	};
@@ -478,6 +517,8 @@ namespace EveryRay_Core
 			int mip = 1, int depth = -1, int arraySize = 1, bool isCubemap = false, int cubemapArraySize = -1) { AbstractRHIMethodAssert();	}
 		virtual void CreateGPUTextureResource(ER_RHI* aRHI, const std::string& aPath, bool isFullPath = false, bool is3D = false, bool skipFallback = false, bool* statusFlag = nullptr, bool isSilent = false) { AbstractRHIMethodAssert(); }
 		virtual void CreateGPUTextureResource(ER_RHI* aRHI, const std::wstring& aPath, bool isFullPath = false, bool is3D = false, bool skipFallback = false, bool* statusFlag = nullptr, bool isSilent = false) { AbstractRHIMethodAssert(); }
+		// immutable 2D shader resource texture from CPU data (one ER_RHI_SUBRESOURCE_DATA per mip)
+		virtual void CreateGPUTextureResource(ER_RHI* aRHI, const ER_RHI_SUBRESOURCE_DATA* aData, UINT mipCount, UINT width, UINT height, ER_RHI_FORMAT format) { AbstractRHIMethodAssert(); }
 
 		virtual void* GetRTV(void* aEmpty = nullptr) { AbstractRHIMethodAssert(); return nullptr; }
 		virtual void* GetRTV(int index) { AbstractRHIMethodAssert(); return nullptr; }
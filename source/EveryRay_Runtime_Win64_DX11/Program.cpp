@@ -5,6 +5,7 @@
 
 #include "..\EveryRay_Core\ER_RuntimeCore.h"
 #include "..\EveryRay_Core\ER_CoreException.h"
+#include "..\EveryRay_Core\ER_SelfTests.h"
 #include "..\EveryRay_Core\RHI\ER_RHI.h"
 #include "..\EveryRay_Core\RHI\DX11\ER_RHI_DX11.h"
 
@@ -18,6 +19,10 @@ using namespace EveryRay_Core;
 
 int WINAPI WinMain(HINSTANCE instance, HINSTANCE previousInstance, LPSTR commandLine, int showCommand)
 {
+	// CPU self-tests only (no window, no RHI): the exit code is the number of failed tests
+	if (ER_SelfTests::IsRequested(commandLine))
+		return ER_SelfTests::RunAll();
+
 	if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
 		throw ER_CoreException("Failed to call CoInitializeEx");
 